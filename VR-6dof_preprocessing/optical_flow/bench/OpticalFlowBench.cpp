@@ -0,0 +1,339 @@
+// benchmark of the stages of Coarse2FineFlow on equirectangular frames without MATLAB
+//
+// usage:
+//
+//   opticalflow_bench [options] [frame0.png frame1.png]
+//
+// options:
+//   -size 1024         the width of the 2:1 synthetic frames, repeated for several sizes (1024, 2048, 3840 by default)
+//   -repeat 5          the number of timed runs of every stage, the median and the minimum are reported
+//   -threads 0         the number of OpenMP threads, 0 for all cores
+//   -nofull            skip the full Coarse2FineFlow, the slowest stage
+//
+// the two frames, if given, are benchmarked at every size as well, resized to it. The parameters are the
+// defaults of Coarse2FineTwoFrames with the left and right borders adjacent. MB is a model of the traffic
+// of each stage, every image it reads and writes counted once, not a measurement
+//
+// the stages:
+//   pyramid     GaussianPyramid::ConstructPyramid of one frame
+//   pyramid8    the same from the frame quantized to 8 bits, converted into the finest level
+//   feature     im2feature of the finest level
+//   getDxs      the derivatives of the finest features of the two frames
+//   warpFL      the bilinear warp of the finest features
+//   warpDxs     the warp, the mask and the derivatives of an outer iteration of SmoothFlowSOR in one fused kernel
+//   resizeFlow  the upsampling of the flow of the next coarser level to the finest one
+//   sorLevel    SmoothFlowSOR of the finest level with the flow from zero
+//   full        Coarse2FineFlow of the two frames
+
+#include "project.h"
+#include "Image.h"
+#include "GaussianPyramid.h"
+#include "OpticalFlow.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+static double alpha=1,pyramidRatio=0.5;
+static int minWidth=40,nOuterFPIterations=3,nInnerFPIterations=1,nSORIterations=20;
+static int nRepeats=5;
+
+//--------------------------------------------------------------------------------------------------------
+// times a stage nRepeats times after one untimed run, prints the median and the minimum
+//--------------------------------------------------------------------------------------------------------
+template <class Stage>
+void timeStage(const string& frames,const char* name,Stage& stage,double bytes)
+{
+	stage();
+	vector<double> seconds;
+	for(int k=0;k<nRepeats;k++)
+	{
+		chrono::steady_clock::time_point start=chrono::steady_clock::now();
+		stage();
+		seconds.push_back(chrono::duration<double>(chrono::steady_clock::now()-start).count());
+	}
+	sort(seconds.begin(),seconds.end());
+	double median=seconds[seconds.size()/2];
+	printf("%-20s %-10s %10.2f %10.2f %10.1f %8.2f\n",frames.c_str(),name,median*1000,seconds[0]*1000,bytes/1e6,bytes/median/1e9);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the stages, each one a functor over the prepared inputs
+//--------------------------------------------------------------------------------------------------------
+struct PyramidStage
+{
+	const DImage* im;
+	GaussianPyramid pyramid;
+	void operator()() {pyramid.ConstructPyramid(*im,pyramidRatio,minWidth,OpticalFlow::IsHorizontalWrap);};
+};
+
+struct QuantizedPyramidStage
+{
+	const BiImage* im;
+	GaussianPyramid pyramid;
+	void operator()() {pyramid.ConstructPyramid(*im,255,pyramidRatio,minWidth,OpticalFlow::IsHorizontalWrap);};
+};
+
+struct FeatureStage
+{
+	const DImage* im;
+	DImage feature;
+	void operator()() {OpticalFlow::im2feature(feature,*im);};
+};
+
+struct DxsStage
+{
+	const DImage *Im1,*Im2;
+	DImage imdx,imdy,imdt;
+	void operator()() {OpticalFlow::getDxs(imdx,imdy,imdt,*Im1,*Im2);};
+};
+
+struct WarpStage
+{
+	const DImage *Im1,*Im2,*vx,*vy;
+	DImage warpIm2;
+	void operator()() {OpticalFlow::warpFL(warpIm2,*Im1,*Im2,*vx,*vy);};
+};
+
+struct WarpDxsStage
+{
+	const DImage *Im1,*Im2,*vx,*vy;
+	DImage imdx,imdy,imdt,mask,warpIm2;
+	OpticalFlow::Workspace ws;
+	void operator()() {OpticalFlow::WarpDxs(imdx,imdy,imdt,mask,warpIm2,*Im1,*Im2,*vx,*vy,false,ws);};
+};
+
+struct ResizeFlowStage
+{
+	const DImage *coarseVx,*coarseVy;
+	int width,height;
+	DImage vx,vy,foo1,foo2;
+	void operator()()
+	{
+		vx.copyData(*coarseVx);
+		vy.copyData(*coarseVy);
+		OpticalFlow::ResizeFlow(vx,vy,width,height,1/pyramidRatio,foo1,foo2);
+	};
+};
+
+struct SORStage
+{
+	const DImage *Im1,*Im2;
+	DImage vx,vy,warpIm2;
+	OpticalFlow::Workspace ws;
+	void operator()()
+	{
+		vx.allocate(Im1->width(),Im1->height());
+		vy.allocate(Im1->width(),Im1->height());
+		warpIm2.copyData(*Im2);
+		ws.reserve(Im1->width(),Im1->height(),Im1->nchannels());
+		ws.resetNoise(OpticalFlow::noiseModel,Im1->nchannels());
+		OpticalFlow::SmoothFlowSOR(*Im1,*Im2,warpIm2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+	};
+};
+
+struct FullStage
+{
+	const DImage *Im1,*Im2;
+	DImage vx,vy,warpI2;
+	OpticalFlow::Workspace ws;
+	void operator()() {OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,*Im1,*Im2,alpha,pyramidRatio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);};
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the traffic model of one SmoothFlowSOR level with nc feature channels: per outer iteration the warp, the
+// derivatives and the weights, per inner iteration the assembly, per sweep the 6 coefficients, the weights
+// and the update (du,dv) read and written
+//--------------------------------------------------------------------------------------------------------
+static double sorLevelBytes(double nPixels,int nc,int nOuter,int nSOR)
+{
+	double plane=nPixels*sizeof(double);
+	double perOuter=plane*(4*nc+2)+plane*(5*nc)+plane*(3*nc+6);
+	double perInner=plane*(5*nc+8);
+	double perSweep=plane*11;
+	return nOuter*(perOuter+nInnerFPIterations*(perInner+nSOR*perSweep));
+}
+
+static void runFrames(const string& frames,const DImage& frame1,const DImage& frame2,bool IsFull)
+{
+	double nPixels=frame1.npixels();
+	int nChannels=frame1.nchannels();
+	double plane=nPixels*sizeof(double);
+
+	PyramidStage pyramid;
+	pyramid.im=&frame1;
+	double pyramidBytes=0;
+	for(double levelPixels=nPixels;sqrt(levelPixels*2)>=minWidth;levelPixels*=pyramidRatio*pyramidRatio)
+		pyramidBytes+=levelPixels*sizeof(double)*nChannels*3;
+	timeStage(frames,"pyramid",pyramid,pyramidBytes);
+
+	BiImage quantized;
+	quantized.allocate(frame1);
+	for(int i=0;i<frame1.nelements();i++)
+		quantized.data()[i]=__min(__max(frame1.data()[i]*255+0.5,0),255);
+	QuantizedPyramidStage quantizedPyramid;
+	quantizedPyramid.im=&quantized;
+	timeStage(frames,"pyramid8",quantizedPyramid,pyramidBytes-plane*nChannels*2+nPixels*nChannels);
+
+	FeatureStage feature;
+	feature.im=&frame1;
+	DImage Im1,Im2;
+	OpticalFlow::im2feature(Im1,frame1);
+	OpticalFlow::im2feature(Im2,frame2);
+	int nc=Im1.nchannels();
+	timeStage(frames,"feature",feature,plane*(nChannels+nc));
+
+	DxsStage dxs;
+	dxs.Im1=&Im1;
+	dxs.Im2=&Im2;
+	timeStage(frames,"getDxs",dxs,plane*nc*5);
+
+	DImage vx(frame1.width(),frame1.height()),vy(frame1.width(),frame1.height());
+	for(int i=0;i<vx.npixels();i++)
+	{
+		vx.data()[i]=2.3;
+		vy.data()[i]=-1.1;
+	}
+	WarpStage warp;
+	warp.Im1=&Im1;
+	warp.Im2=&Im2;
+	warp.vx=&vx;
+	warp.vy=&vy;
+	timeStage(frames,"warpFL",warp,plane*(3*nc+2));
+
+	WarpDxsStage warpDxs;
+	warpDxs.Im1=&Im1;
+	warpDxs.Im2=&Im2;
+	warpDxs.vx=&vx;
+	warpDxs.vy=&vy;
+	OpticalFlow::SmoothDxs(warpDxs.ws.smooth1,Im1,warpDxs.ws);
+	timeStage(frames,"warpDxs",warpDxs,plane*(10*nc+3));
+
+	DImage coarseVx,coarseVy;
+	vx.imresize(coarseVx,frame1.width()*pyramidRatio,frame1.height()*pyramidRatio);
+	vy.imresize(coarseVy,frame1.width()*pyramidRatio,frame1.height()*pyramidRatio);
+	ResizeFlowStage resizeFlow;
+	resizeFlow.coarseVx=&coarseVx;
+	resizeFlow.coarseVy=&coarseVy;
+	resizeFlow.width=frame1.width();
+	resizeFlow.height=frame1.height();
+	timeStage(frames,"resizeFlow",resizeFlow,plane*2*(1+pyramidRatio*pyramidRatio));
+
+	SORStage sor;
+	sor.Im1=&Im1;
+	sor.Im2=&Im2;
+	timeStage(frames,"sorLevel",sor,sorLevelBytes(nPixels,nc,nOuterFPIterations,nSORIterations));
+
+	if(!IsFull)
+		return;
+	FullStage full;
+	full.Im1=&frame1;
+	full.Im2=&frame2;
+	double fullBytes=pyramidBytes*2;
+	int k=0;
+	for(double levelPixels=nPixels;sqrt(levelPixels*2)>=minWidth;levelPixels*=pyramidRatio*pyramidRatio,k++)
+		fullBytes+=sorLevelBytes(levelPixels,nc,nOuterFPIterations+k,nSORIterations+k*3);
+	timeStage(frames,"full",full,fullBytes);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// a textured frame that is periodic across the left and right borders, and the same frame moved by
+// (dx,dy) pixels
+//--------------------------------------------------------------------------------------------------------
+static void syntheticFrame(DImage& frame,int width,double dx,double dy)
+{
+	int height=width/2;
+	frame.allocate(width,height,3);
+	double w=2*M_PI/width;
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+			for(int c=0;c<3;c++)
+			{
+				double x=j-dx,y=i-dy;
+				frame.data()[(i*width+j)*3+c]=0.5+0.2*sin(x*w*17+c)*cos(y*w*13)+0.1*sin(x*w*61+y*w*37)+0.05*cos(x*w*211-y*w*157+c);
+			}
+}
+
+int main(int argc,char** argv)
+{
+	vector<int> sizes;
+	vector<string> filenames;
+	bool IsFull=true;
+	OpticalFlow::IsDisplay=false;
+	OpticalFlow::IsHorizontalWrap=true;
+	for(int i=1;i<argc;i++)
+	{
+		bool IsLast=(i==argc-1);
+		if(strcmp(argv[i],"-size")==0 && !IsLast)
+			sizes.push_back(atoi(argv[++i]));
+		else if(strcmp(argv[i],"-repeat")==0 && !IsLast)
+			nRepeats=__max(atoi(argv[++i]),1);
+		else if(strcmp(argv[i],"-threads")==0 && !IsLast)
+		{
+			int nThreads=atoi(argv[++i]);
+#ifdef _OPENMP
+			if(nThreads>0)
+				omp_set_num_threads(nThreads);
+#endif
+		}
+		else if(strcmp(argv[i],"-nofull")==0)
+			IsFull=false;
+		else if(argv[i][0]=='-')
+		{
+			cout<<"Unknown option "<<argv[i]<<"!"<<endl;
+			return 1;
+		}
+		else
+			filenames.push_back(argv[i]);
+	}
+	if(filenames.size()!=0 && filenames.size()!=2)
+	{
+		cout<<"usage: opticalflow_bench [options] [frame0 frame1]"<<endl;
+		return 1;
+	}
+	if(sizes.empty())
+	{
+		sizes.push_back(1024);
+		sizes.push_back(2048);
+		sizes.push_back(3840);
+	}
+	DImage real1,real2;
+	if(!filenames.empty() && (!real1.imread(filenames[0].c_str()) || !real2.imread(filenames[1].c_str()) || !real1.matchDimension(real2)))
+	{
+		cout<<"Fail to load "<<filenames[0]<<" and "<<filenames[1]<<", or their dimensions don't match!"<<endl;
+		return 1;
+	}
+
+	int nThreads=1;
+#ifdef _OPENMP
+	nThreads=omp_get_max_threads();
+#endif
+	printf("threads %d, repeats %d\n",nThreads,nRepeats);
+	printf("%-20s %-10s %10s %10s %10s %8s\n","frames","stage","median ms","min ms","MB","GB/s");
+	for(size_t s=0;s<sizes.size();s++)
+	{
+		char name[64];
+		DImage frame1,frame2;
+		syntheticFrame(frame1,sizes[s],0,0);
+		syntheticFrame(frame2,sizes[s],2.3,-1.1);
+		sprintf(name,"synthetic%dx%d",frame1.width(),frame1.height());
+		runFrames(name,frame1,frame2,IsFull);
+		if(!filenames.empty())
+		{
+			real1.imresize(frame1,sizes[s],sizes[s]/2);
+			real2.imresize(frame2,sizes[s],sizes[s]/2);
+			sprintf(name,"real%dx%d",frame1.width(),frame1.height());
+			runFrames(name,frame1,frame2,IsFull);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,976 @@
+// command line tool to compute the optical flow of a video or of an image sequence without MATLAB
+//
+// usage:
+//
+//   opticalflow [options] -video input.mp4 -out flowdir
+//   opticalflow [options] -out flowdir frame0.png frame1.png ...
+//   opticalflow [options] -clip flow.clip (-video input.mp4 | frame0.png frame1.png ...)
+//   opticalflow [options] -depth input_depth.mp4 -background input -video input.mp4
+//   opticalflow [options] -msi input_msi.mp4 -video input.mp4
+//   opticalflow [options] -web input_web -packalpha input_alphaproc.mp4 -video input.mp4
+//   opticalflow [options] -farm shareddir -clip flow.clip -video input.mp4
+//
+// options (the same parameters as Coarse2FineTwoFrames):
+//   -alpha 1  -ratio 0.5  -minwidth 40  -outer 3  -inner 1  -sor 20
+//   -redblack          parallel red-black SOR inside each pair
+//   -wrap              the left and right borders are adjacent (360 equirectangular frames)
+//   -equirect          decimate the rows towards the poles of equirectangular frames, implies -wrap
+//   -derotate          rotate the second frame of every pair by the rotation of the camera on the sphere before the
+//                      solve, for handheld 360 video, see SphereRotation.h; implies -wrap
+//   -pcg               preconditioned conjugate gradient instead of SOR, -sor bounds its iterations
+//   -updatetol 0       stop the fixed point iterations at an RMS flow update of this many pixels
+//   -sweeptol 0        stop the SOR sweeps at an RMS change of this many pixels per sweep
+//   -noisesamples 0    estimate the noise of each level on a subsample of at least this many pixels, 0 for all
+//   -tilerows 0        solve the levels taller than this in overlapping bands of about this many rows, bounding
+//                      the memory of the solver by the band instead of the frame, 0 to solve every level at once
+//   -tilehalo 32       the rows shared with each neighbouring band
+//   -upsample 0        upsample the flow of every level to the next by joint bilateral upsampling guided by the
+//                      frames, of this range sigma in the units of the frames in [0,1], e.g. 0.1; 0 for bilinear
+//   -halfpyramid       store the levels of the pyramids and their features in half precision, about a quarter of
+//                      their memory, see FeaturePyramid::compact
+//   -gpu               solve on a CUDA device when built with OPTICALFLOW_GPU, the CPU otherwise
+//   -devices 0         with -gpu, spread the pairs over this many CUDA devices, 0 for all of them
+//   -devicethreads 2   with -gpu and -threads 0, the pairs solved concurrently per device
+//   -hostthreads 0     with -gpu and -threads 0, the pairs solved concurrently on the CPU next to the devices
+//   -preview           the fast dense inverse search of PreviewFlow.h instead of the variational solver, to preview
+//                      the depth; -alpha weighs its refinement and -minwidth bounds its pyramid
+//   -previewlevel 1    the level of the finest flow of -preview, the frames halved that many times
+//   -keyframes 0       solve the flow over spans of this many pairs and interpolate the pairs between, for slowly
+//                      moving cameras; 0 or 1 to solve every pair, see OpticalFlowBatch.h
+//   -keyresidual 0     with -keyframes, solve a pair whose interpolated flow leaves a coarse RMS residual above this
+//                      on its own, e.g. 0.02; 0 to interpolate every pair of the spans
+//   -shots             classify every pair before its flow, see ShotClassifier.h: the static pairs and the cuts get
+//                      the flow 0 without a solve, and -depth restarts its smoothing over time at the cuts
+//   -cutdistance 0.6   the L1 distance of the gray histograms of a pair above which -shots finds a cut
+//   -staticresidual 0.002  the RMS difference of the coarse frames of a pair below which -shots finds it static
+//   -threads 0         the number of frame pairs solved concurrently, 0 for all cores
+//   -imagethreads 0    the threads of the elementwise operations of the images of a frame, 1 to run them serially,
+//                      0 for all cores; only a pair solved alone splits them, see ParallelFor.h
+//   -memory 0          the memory budget of the concurrent pairs in MB, 0 for no limit
+//   -predictmemory     print the memory the run would take at its peak, predicted from the dimensions of the frames
+//                      and the options, and exit without solving, to pack the jobs on a node
+//   -scale 1           downsize the frames by this factor before the flow, e.g. 0.5 to solve 4K frames at 2K; the
+//                      depth, the background, the packed and the multi-sphere outputs are of the downsized frames
+//   -verbose           print the progress and the stage times of every pyramid level
+//   -stats file.json   append the iterations and the stage times of every pair to file.json, one line per pair
+//   -format half       the samples of -clip: float, half or int16 (quantized with a scale per frame)
+//   -zstd              compress every frame of -clip with zstd when built with OPTICALFLOW_ZSTD
+//   -depth file.mp4    the inverse depth of the equirectangular frames as the 8-bit video of the viewer, with or
+//                      without -out or -clip, see FlowDepth.h
+//   -background name   the background layers of the viewer from the whole clip, name_BG.png, name_BGD.png,
+//                      name_BGA.png, name_BG_inp.png and name_BGD_inp.png, see BackgroundLayers.h
+//   -dds               also bake the background layers into the BC1 and BC4 textures of the viewer, name_BG.dds...,
+//                      see TextureCompression.h
+//   -shard k/n         solve shard k of n, the pairs of the clip split evenly, e.g. -shard 0/4 on the first node
+//   -first 0 -last 0   solve the pairs [first,last) only, last 0 for up to the last frame
+//   -warmup 0          the pairs solved before the first pair (or before the resumed chunk) to warm up -depth
+//   -checkpoint file   append the committed ranges of pairs to file, and resume after them when it exists
+//   -chunk 100         the pairs of a committed chunk with -checkpoint
+//   -farm dir          a worker of the farm in the shared directory dir: it solves the chunks of -chunk pairs that
+//                      no other worker holds, see FlowFarm.h, and the last one merges the chunks into -clip
+//   -lease 600         the seconds after which the chunk of a worker that stopped renewing it is taken over
+//   -hwenc             encode -depth as H.264 on the GPU (NVENC, QSV...) when FFmpeg has an encoder for it, see
+//                      VideoEncoder.h
+//   -packed file.mp4   the color, the depth and the alpha of every frame stacked top to bottom in one video of three
+//                      times the height, input_packed.mp4 for the Layout packed of the viewer
+//   -packalpha file    the alpha video stacked under the depth by -packed, e.g. input_alphaproc.mp4; 255 without it
+//   -msi file.mp4      the layers of the multi-sphere image of every frame in the tiles of an atlas video, the input of
+//                      the MultiSphere of the viewer, see MultiSphereImage.h
+//   -msilayers 8       the spheres of -msi
+//   -msicolumns 4      the tiles of a row of the atlas of -msi, every one of 1/msicolumns of the width and the height
+//   -web name          the assets of the web viewer: the packed video name_packed.mp4 unless -packed names it, the
+//                      background layers as KTX2 textures, name_BG.ktx2... unless -background names them, and the
+//                      manifest name.json of the files and of the layout of the packed frame
+//
+// the flow from frame i to frame i+1 is saved to flowdir/flow_%05d.bin by OpticalFlow::SaveOpticalFlow,
+// the directory must exist; with -outformat rawf or rawh to flowdir/flow_%05d.rawf (.rawh), the interleaved
+// (vx,vy) unquantized in a raw image, see RawImage.h. The frames of a list are read from any image file of
+// OpenCV or from the raw images .raw8, .rawh and .rawf, which are mapped instead of decoded. With -clip all the flow fields are written to one file, see FlowClip.h. With
+// -depth frame i of the video is the depth from the flow of pair i, gray in all three channels and the
+// nearest 255; the last frame repeats the depth of the last pair, so the video has as many frames as the input.
+// Next to the -depth video, input_depth.mp4.same lists the runs of its frames identical to the frame before
+// them, "first last" a line in the frames of the whole video, which the viewer copies instead of decoding.
+// With -shard, -first, -last or -checkpoint the -clip and -depth outputs are written in segments, one per
+// chunk, named after the first pair of the segment, e.g. input_depth.00500.mp4, to be concatenated in order,
+// their .same files as well.
+// -background, -packed, -msi and -web need the whole clip in one run
+
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include "OpticalFlowBatch.h"
+#include "PreviewFlow.h"
+#include "FlowClip.h"
+#include "FlowFarm.h"
+#include "FlowDepth.h"
+#include "BackgroundLayers.h"
+#include "MultiSphereImage.h"
+#include "VideoEncoder.h"
+#include "VideoDecoder.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------------
+// frames from a list of image files
+//--------------------------------------------------------------------------------------------------------
+class ImageListSource : public DOpticalFlowBatch::FrameSource
+{
+public:
+	vector<string> filenames;
+	double scale;
+	ImageListSource() {scale=1;};
+	int nframes() {return filenames.size();};
+	bool loadFrame(int index,DImage& frame)
+	{
+		if(!frame.imread(filenames[index].c_str()))
+		{
+			cout<<"Fail to load "<<filenames[index]<<"!"<<endl;
+			return false;
+		}
+		if(scale<1)
+		{
+			DImage resized;
+			frame.GaussianSmoothResize(resized,1/scale-1,(1/scale-1)*3,scale,OpticalFlow::IsHorizontalWrap);
+			frame.swap(resized);
+		}
+		return true;
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// frames from a video. The video is decoded once, front to back, by the thread of a VideoDecoder ahead of
+// the pairs; the decoded frames are kept until both pairs that use them have loaded them, so only the frames
+// of the pairs in flight and of the queue of the decoder are in memory
+//--------------------------------------------------------------------------------------------------------
+class VideoSource : public DOpticalFlowBatch::FrameSource
+{
+private:
+	VideoDecoder decoder;
+	int nFrames,nDecoded;
+	map<int,DImage> frames;
+	map<int,int> nLoads;
+public:
+	// the frames before firstFrame are skipped without being decoded
+	int firstFrame;
+	VideoSource() {nFrames=nDecoded=firstFrame=0;};
+	bool open(const char* filename,double scale=1)
+	{
+		if(!decoder.open(filename,scale,OpticalFlow::IsHorizontalWrap))
+			return false;
+		nFrames=decoder.nframes();
+		return true;
+	}
+	int nframes() {return nFrames;};
+	double fps() {return decoder.getFPS();};
+	bool decode(int index)
+	{
+		if(nDecoded<firstFrame)
+		{
+			decoder.start(firstFrame);
+			nDecoded=firstFrame;
+		}
+		while(nDecoded<=index)
+		{
+			if(!decoder.readFrame(frames[nDecoded]))
+			{
+				frames.erase(nDecoded);
+				nFrames=nDecoded;
+				return false;
+			}
+			nDecoded++;
+		}
+		return true;
+	}
+	bool frameDimension(int& width,int& height,int& nchannels)
+	{
+		if(!decode(firstFrame) || frames.find(firstFrame)==frames.end())
+			return false;
+		width=frames[firstFrame].width();
+		height=frames[firstFrame].height();
+		nchannels=frames[firstFrame].nchannels();
+		return true;
+	}
+	bool loadFrame(int index,DImage& frame)
+	{
+		if(!decode(index))
+			return false;
+		if(frames.find(index)==frames.end())
+		{
+			cout<<"Frame "<<index<<" is no longer in memory!"<<endl;
+			return false;
+		}
+		frame.copyData(frames[index]);
+		// the first and the last frame belong to one pair only
+		int nUses=(index==firstFrame || index==nFrames-1)?1:2;
+		if(++nLoads[index]>=nUses)
+		{
+			frames.erase(index);
+			nLoads.erase(index);
+		}
+		return true;
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the statistics of the pairs as lines of JSON, if a file is given
+//--------------------------------------------------------------------------------------------------------
+class StatisticsSink : public DOpticalFlowBatch::FlowSink
+{
+public:
+	ofstream statistics;
+	bool writeStatistics(int index,const OpticalFlow::Workspace& ws)
+	{
+		if(!statistics.is_open())
+			return true;
+		statistics<<"{\"pair\":"<<index<<",\"statistics\":";
+		ws.writeStatistics(statistics);
+		statistics<<"}"<<endl;
+		return statistics.good();
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// writes the flow fields to the output directory
+//--------------------------------------------------------------------------------------------------------
+class FlowFileSink : public StatisticsSink
+{
+public:
+	string outputDir;
+	// the extension of a raw image (see RawImage.h) to write the flow as it is, empty for the .bin of SaveOpticalFlow
+	string rawExtension;
+	bool writeFlow(int index,const DImage& vx,const DImage& vy)
+	{
+		char filename[1024];
+		sprintf(filename,"%s/flow_%05d%s",outputDir.c_str(),index,rawExtension.empty()?".bin":rawExtension.c_str());
+		DImage flow;
+		OpticalFlow::AssembleFlow(vx,vy,flow);
+		cout<<"Writing "<<filename<<endl;
+		if(!rawExtension.empty())
+			return flow.imwrite(filename);
+		return OpticalFlow::SaveOpticalFlow(flow,filename);
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// writes the flow fields to one clip file
+//--------------------------------------------------------------------------------------------------------
+class FlowClipSink : public StatisticsSink
+{
+public:
+	FlowClipWriter writer;
+	string filename,segment;
+	FlowClip::Format format;
+	FlowClip::Compression compression;
+	bool IsSegmented;	// a clip file per committed chunk
+	const FlowFarm* farm;	// the farm whose lease of chunk is renewed with every pair
+	int chunk;
+	FlowClipSink() {format=FlowClip::Float16;compression=FlowClip::None;IsSegmented=false;farm=NULL;chunk=0;};
+	bool writeFlow(int index,const DImage& vx,const DImage& vy)
+	{
+		if(farm!=NULL)
+			farm->renew(chunk);
+		if(segment.empty())
+		{
+			segment=IsSegmented?FlowFarm::segmentName(filename,index):filename;
+			if(!writer.open(segment.c_str(),vx.width(),vx.height(),format,compression))
+				return false;
+		}
+		cout<<"Writing frame "<<index<<" to "<<segment<<endl;
+		return writer.writeFrame(vx,vy);
+	}
+	bool commit(int endIndex)
+	{
+		if(!IsSegmented)
+			return true;
+		segment.clear();
+		return writer.close();
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the frames front to back, decoded a second time for the stages that need them with the flow
+//--------------------------------------------------------------------------------------------------------
+class FrameReader
+{
+private:
+	cv::VideoCapture capture;
+	const vector<string>* filenames;
+	int nRead;
+public:
+	// the frames downsized as those of the flow
+	double scale;
+	FrameReader() {filenames=NULL;nRead=0;scale=1;};
+	bool open(const char* videoname,const vector<string>& _filenames)
+	{
+		filenames=&_filenames;
+		nRead=0;
+		return videoname==NULL || capture.open(videoname);
+	}
+	bool read(cv::Mat& im)
+	{
+		if(!filenames->empty() && nRead<(int)filenames->size())
+			im=ImageIO::imread((*filenames)[nRead].c_str());
+		bool IsRead=(filenames->empty())?capture.read(im):(nRead<(int)filenames->size() && !im.empty());
+		if(!IsRead)
+			cout<<"Fail to read frame "<<nRead<<"!"<<endl;
+		else if(scale<1)
+		{
+			cv::Mat resized;
+			cv::resize(im,resized,cv::Size((int)(im.cols*scale),(int)(im.rows*scale)),0,0,cv::INTER_AREA);
+			im=resized;
+		}
+		nRead++;
+		return IsRead;
+	}
+	bool read(DImage& frame)
+	{
+		cv::Mat im;
+		return read(im) && frame.imread(im);
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// turns the flow fields into the depth video and the background layers of the viewer, passing them on to
+// another sink if there is one. The pairs arrive in order, so the depth is smoothed over time and the
+// background accumulated as the flow is written, and the depth frames are encoded on the thread of the
+// encoder while the next pairs are solved. The packed video stacks the color, the depth and the alpha of a
+// frame top to bottom, so the viewer decodes and uploads one frame instead of three; the multi-sphere video
+// is the atlas of the layers of every frame with its depth. The web viewer plays the packed video in one
+// <video> element, and finds it, the layout of its frame and the KTX2 background layers in the manifest
+//--------------------------------------------------------------------------------------------------------
+class DepthVideoSink : public StatisticsSink
+{
+public:
+	DFlowDepth depth;
+	VideoEncoder encoder,packedEncoder,msiEncoder;
+	VideoEncoder::Acceleration acceleration;
+	DBackgroundLayers background;
+	MultiSphereImage msi;
+	FrameReader frames;
+	cv::VideoCapture alphaVideo;
+	cv::Mat color,alpha;
+	DImage frame;
+	BiImage depth8,packed,color8,atlas;
+	BiImage lastDepth8;	// the last frame of the depth video, frame lastFrame
+	int lastFrame;
+	vector< pair<int,int> > sameRuns;	// the runs of frames of the segment identical to the frame before them
+	string filename,backgroundName,packedName,alphaName,msiName,webName,segmentName;
+	double fps;
+	StatisticsSink* flowSink;
+	bool IsSegmented;	// a video per committed chunk
+	bool IsCompressed;	// the background layers baked into DDS textures too
+	int nClipPairs;
+	DepthVideoSink() {fps=30;flowSink=NULL;acceleration=VideoEncoder::Software;IsSegmented=false;IsCompressed=false;nClipPairs=0;lastFrame=-1;};
+	bool warmupFlow(int index,const DImage& vx,const DImage& vy)
+	{
+		if(flowSink!=NULL && !flowSink->warmupFlow(index,vx,vy))
+			return false;
+		depth.addFrame(vx,vy,depth8);
+		return true;
+	}
+	bool writeFlow(int index,const DImage& vx,const DImage& vy)
+	{
+		if(flowSink!=NULL && !flowSink->writeFlow(index,vx,vy))
+			return false;
+		depth.addFrame(vx,vy,depth8);
+		if(!backgroundName.empty() || !packedName.empty() || !msiName.empty())
+		{
+			if(!frames.read(color))
+				return false;
+			if(!packedName.empty() && !writePacked())
+				return false;
+			if(!msiName.empty() && !writeMultiSphere())
+				return false;
+		}
+		if(!backgroundName.empty())
+		{
+			if(!frame.imread(color))
+				return false;
+			background.accumulate(frame,depth8);
+			background.advance(vx,vy);
+		}
+		if(filename.empty())
+			return true;
+		if(!encoder.isOpened())
+		{
+			segmentName=IsSegmented?FlowFarm::segmentName(filename,index):filename;
+			if(!encoder.open(segmentName.c_str(),vx.width(),vx.height(),fps,acceleration))
+				return false;
+		}
+		return writeDepth(index);
+	}
+	// frame index of the depth video, a run of identical frames extended when it is the last frame again
+	bool writeDepth(int index)
+	{
+		if(lastFrame==index-1 && lastDepth8.matchDimension(depth8) && memcmp(lastDepth8.data(),depth8.data(),depth8.nelements())==0)
+		{
+			if(!sameRuns.empty() && sameRuns.back().second==index-1)
+				sameRuns.back().second=index;
+			else
+				sameRuns.push_back(make_pair(index,index));
+		}
+		lastDepth8.copyData(depth8);
+		lastFrame=index;
+		return encoder.writeFrame(depth8);
+	}
+	// the runs of identical frames of the segment closed, to its .same file
+	bool writeSame()
+	{
+		string sameName=segmentName+".same";
+		ofstream same(sameName.c_str(),ios::out|ios::trunc);
+		for(size_t i=0;i<sameRuns.size();i++)
+			same<<sameRuns[i].first<<" "<<sameRuns[i].second<<endl;
+		sameRuns.clear();
+		if(!same)
+		{
+			cout<<"Fail to write "<<sameName<<"!"<<endl;
+			return false;
+		}
+		return true;
+	}
+	// the depth smoothed over time restarts with the new shot
+	bool cut(int index)
+	{
+		if(flowSink!=NULL && !flowSink->cut(index))
+			return false;
+		depth.reset();
+		return true;
+	}
+	// the last frame of the clip has the depth of the last pair
+	bool commit(int endIndex)
+	{
+		if(flowSink!=NULL && !flowSink->commit(endIndex))
+			return false;
+		if(!encoder.isOpened())
+			return true;
+		if(endIndex==nClipPairs)
+			writeDepth(endIndex);
+		if(IsSegmented || endIndex==nClipPairs)
+		{
+			encoder.close();
+			return writeSame();
+		}
+		return true;
+	}
+	// the color frame with the depth of the pair and the next alpha frame
+	bool writePacked()
+	{
+		if(!alphaName.empty() && !alphaVideo.read(alpha))
+		{
+			cout<<"Fail to read the alpha of "<<alphaName<<"!"<<endl;
+			return false;
+		}
+		if(!alpha.empty() && frames.scale<1)
+		{
+			cv::Mat resized;
+			cv::resize(alpha,resized,cv::Size((int)(alpha.cols*frames.scale),(int)(alpha.rows*frames.scale)),0,0,cv::INTER_AREA);
+			alpha=resized;
+		}
+		int width=depth8.width(),height=depth8.height();
+		if(color.cols!=width || color.rows!=height || color.type()!=CV_8UC3 || (!alpha.empty() && (alpha.cols!=width || alpha.rows!=height ||
+			alpha.type()!=CV_8UC3)))
+		{
+			cout<<"The frames of -packed don't match the depth!"<<endl;
+			return false;
+		}
+		packed.allocate(width,height*3,3);
+		int rowSize=width*3;
+		for(int i=0;i<height;i++)
+		{
+			memcpy(packed.data()+i*rowSize,color.data+i*color.step,rowSize);
+			unsigned char* pDepth=packed.data()+(height+i)*rowSize;
+			const unsigned char* pDepth8=depth8.data()+i*width;
+			for(int j=0;j<width;j++)
+				pDepth[j*3]=pDepth[j*3+1]=pDepth[j*3+2]=pDepth8[j];
+			unsigned char* pAlpha=packed.data()+(height*2+i)*rowSize;
+			if(alpha.empty())
+				memset(pAlpha,255,rowSize);
+			else
+				memcpy(pAlpha,alpha.data+i*alpha.step,rowSize);
+		}
+		if(!packedEncoder.isOpened() && !packedEncoder.open(packedName.c_str(),width,height*3,fps,acceleration))
+			return false;
+		return packedEncoder.writeFrame(packed);
+	}
+	// the layers of the color frame at the depth of the pair
+	bool writeMultiSphere()
+	{
+		if(!color8.imread(color) || color8.nchannels()!=3 || color8.width()!=depth8.width() || color8.height()!=depth8.height())
+		{
+			cout<<"The frames of -msi don't match the depth!"<<endl;
+			return false;
+		}
+		msi.makeAtlas(color8,depth8,atlas);
+		if(!msiEncoder.isOpened() && !msiEncoder.open(msiName.c_str(),atlas.width(),atlas.height(),fps,acceleration))
+			return false;
+		return msiEncoder.writeFrame(atlas);
+	}
+	// the last frame of the clip, with the depth of the last pair
+	bool close()
+	{
+		bool IsBackground=!backgroundName.empty() && background.nframes()>0,IsPacked=packedEncoder.isOpened(),IsMultiSphere=msiEncoder.isOpened();
+		if(!IsBackground && !IsPacked && !IsMultiSphere)
+			return true;
+		if(!frames.read(color))
+			return false;
+		if(IsPacked)
+		{
+			bool IsWritten=writePacked();
+			packedEncoder.close();
+			if(!IsWritten)
+				return false;
+		}
+		if(IsMultiSphere)
+		{
+			bool IsWritten=writeMultiSphere();
+			msiEncoder.close();
+			if(!IsWritten)
+				return false;
+		}
+		if(!IsBackground)
+			return true;
+		if(!frame.imread(color))
+			return false;
+		background.accumulate(frame,depth8);
+		cout<<"Writing the background layers "<<backgroundName<<"_BG*.png"<<endl;
+		if(!background.saveLayers(backgroundName.c_str(),IsCompressed,!webName.empty()))
+			return false;
+		return webName.empty() || writeManifest();
+	}
+	// the files of the web viewer relative to the manifest, and the rectangles of the color, the depth and
+	// the alpha in the packed frame, x, y, width and height in pixels
+	bool writeManifest()
+	{
+		string manifestName=webName+".json";
+		ofstream manifest(manifestName.c_str(),ios::out|ios::trunc);
+		int width=depth8.width(),height=depth8.height();
+		string background=relativeName(backgroundName);
+		manifest<<"{"<<endl
+			<<"\t\"video\": \""<<relativeName(packedName)<<"\","<<endl
+			<<"\t\"fps\": "<<fps<<","<<endl
+			<<"\t\"frames\": "<<packedEncoder.nframes()<<","<<endl
+			<<"\t\"width\": "<<width<<","<<endl
+			<<"\t\"height\": "<<height<<","<<endl
+			<<"\t\"layout\": {"<<endl
+			<<"\t\t\"color\": [0, 0, "<<width<<", "<<height<<"],"<<endl
+			<<"\t\t\"depth\": [0, "<<height<<", "<<width<<", "<<height<<"],"<<endl
+			<<"\t\t\"alpha\": [0, "<<height*2<<", "<<width<<", "<<height<<"]"<<endl
+			<<"\t},"<<endl
+			<<"\t\"depth\": \"inverse, 255 the nearest\","<<endl
+			<<"\t\"background\": {"<<endl
+			<<"\t\t\"color\": \""<<background<<"_BG.ktx2\","<<endl
+			<<"\t\t\"depth\": \""<<background<<"_BGD.ktx2\","<<endl
+			<<"\t\t\"alpha\": \""<<background<<"_BGA.ktx2\","<<endl
+			<<"\t\t\"colorInpainted\": \""<<background<<"_BG_inp.ktx2\","<<endl
+			<<"\t\t\"depthInpainted\": \""<<background<<"_BGD_inp.ktx2\""<<endl
+			<<"\t}"<<endl
+			<<"}"<<endl;
+		if(!manifest.good())
+		{
+			cout<<"Fail to write "<<manifestName<<"!"<<endl;
+			return false;
+		}
+		cout<<"Writing the manifest of the web viewer "<<manifestName<<endl;
+		return true;
+	}
+	// a file of the web viewer relative to the directory of the manifest, where it is in it
+	string relativeName(const string& name) const
+	{
+		size_t slash=webName.find_last_of("/\\");
+		string directory=(slash==string::npos)?"":webName.substr(0,slash+1);
+		return (name.compare(0,directory.size(),directory)==0)?name.substr(directory.size()):name;
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// a worker of the farm: it solves the chunks nobody holds until there is none left, and the worker that
+// finds all of them done merges their clips. The depth of a chunk is warmed up with the flow at the end of
+// the previous one when that is done, otherwise with nWarmupPairs pairs solved again
+//--------------------------------------------------------------------------------------------------------
+static int runFarm(FlowFarm& farm,DOpticalFlowBatch& batch,const char* videoname,ImageListSource& imageList,StatisticsSink& sink,
+						FlowClipSink& clipSink,DepthVideoSink& depthSink,int nWarmupPairs,const string& clipname,double scale)
+{
+	int nSolved=0;
+	for(int k=farm.claim();k>=0;k=farm.claim())
+	{
+		int first,end;
+		farm.chunkRange(k,first,end);
+		cout<<"Solving chunk "<<k<<", pairs "<<first<<" to "<<end<<endl;
+		batch.firstPair=first;
+		batch.lastPair=end;
+		batch.nWarmupPairs=depthSink.filename.empty()?0:nWarmupPairs;
+		clipSink.filename=farm.workClipName(k);
+		clipSink.chunk=k;
+		depthSink.depth.reset();
+		FlowClipReader previous;
+		if(batch.nWarmupPairs>0 && k>0 && farm.IsDone(k-1) && previous.open(farm.clipName(k-1).c_str()))
+		{
+			DImage vx,vy;
+			int n=previous.nframes();
+			for(int i=__max(n-nWarmupPairs,0);i<n;i++)
+				if(previous.readFrame(i,vx,vy))
+					depthSink.warmupFlow(first-n+i,vx,vy);
+			batch.nWarmupPairs=0;
+		}
+		int nWritten;
+		if(videoname!=NULL)
+		{
+			VideoSource video;
+			if(!video.open(videoname,scale))
+				return 1;
+			video.firstFrame=batch.firstLoadedFrame(first);
+			nWritten=batch.run(video,sink);
+		}
+		else
+			nWritten=batch.run(imageList,sink);
+		clipSink.writer.close();
+		clipSink.segment.clear();
+		if(nWritten!=end-first)
+		{
+			cout<<"Fail to solve chunk "<<k<<", its lease expires in "<<farm.leaseSeconds<<"s"<<endl;
+			return 1;
+		}
+		farm.complete(k);
+		nSolved++;
+	}
+	cout<<"Solved "<<nSolved<<" chunks, "<<farm.nDone()<<" of "<<farm.nchunks()<<" are done"<<endl;
+	if(!clipname.empty() && farm.nDone()==farm.nchunks() && !farm.mergeClips(clipname.c_str()))
+		cout<<"The clips of "<<farm.directory<<" are merged by another worker"<<endl;
+	return 0;
+}
+
+int main(int argc,char** argv)
+{
+	DOpticalFlowBatch batch;
+	ImageListSource imageList;
+	VideoSource video;
+	FlowFileSink fileSink;
+	FlowClipSink clipSink;
+	DepthVideoSink depthSink;
+	const char* videoname=NULL;
+	const char* statsname=NULL;
+	int shard=0,nShards=0;
+	const char* farmname=NULL;
+	FlowFarm farm;
+	double scale=1;
+	bool IsMemoryDryRun=false;
+	// the progress of the concurrent pairs would interleave
+	OpticalFlow::IsDisplay=false;
+	for(int i=1;i<argc;i++)
+	{
+		bool IsLast=(i==argc-1);
+		if(strcmp(argv[i],"-alpha")==0 && !IsLast)
+			batch.alpha=atof(argv[++i]);
+		else if(strcmp(argv[i],"-ratio")==0 && !IsLast)
+			batch.ratio=atof(argv[++i]);
+		else if(strcmp(argv[i],"-minwidth")==0 && !IsLast)
+			batch.minWidth=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-outer")==0 && !IsLast)
+			batch.nOuterFPIterations=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-inner")==0 && !IsLast)
+			batch.nInnerFPIterations=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-sor")==0 && !IsLast)
+			batch.nSORIterations=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-redblack")==0)
+			OpticalFlow::sorScheme=OpticalFlow::RedBlack;
+		else if(strcmp(argv[i],"-wrap")==0)
+			OpticalFlow::IsHorizontalWrap=true;
+		else if(strcmp(argv[i],"-pcg")==0)
+			OpticalFlow::linearSolver=OpticalFlow::PCG;
+		else if(strcmp(argv[i],"-updatetol")==0 && !IsLast)
+			OpticalFlow::updateTolerance=atof(argv[++i]);
+		else if(strcmp(argv[i],"-sweeptol")==0 && !IsLast)
+			OpticalFlow::sweepTolerance=atof(argv[++i]);
+		else if(strcmp(argv[i],"-noisesamples")==0 && !IsLast)
+			OpticalFlow::noiseSamples=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-tilerows")==0 && !IsLast)
+			OpticalFlow::tileRows=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-tilehalo")==0 && !IsLast)
+			OpticalFlow::tileHalo=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-upsample")==0 && !IsLast)
+			OpticalFlow::upsampleSigma=__max(atof(argv[++i]),0);
+		else if(strcmp(argv[i],"-halfpyramid")==0)
+			OpticalFlow::IsHalfPyramid=true;
+		else if(strcmp(argv[i],"-preview")==0)
+			OpticalFlow::backend=OpticalFlow::Preview;
+		else if(strcmp(argv[i],"-previewlevel")==0 && !IsLast)
+			PreviewFlow::finestLevel=__max(atoi(argv[++i]),0);
+		else if(strcmp(argv[i],"-gpu")==0)
+			OpticalFlow::backend=OpticalFlow::GPU;
+		else if(strcmp(argv[i],"-equirect")==0)
+		{
+			batch.IsLatitudeAdaptive=true;
+			OpticalFlow::IsHorizontalWrap=true;
+		}
+		else if(strcmp(argv[i],"-keyframes")==0 && !IsLast)
+			batch.keyframeInterval=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-keyresidual")==0 && !IsLast)
+			batch.keyframeResidual=atof(argv[++i]);
+		else if(strcmp(argv[i],"-derotate")==0)
+		{
+			batch.IsRotationAligned=true;
+			OpticalFlow::IsHorizontalWrap=true;
+		}
+		else if(strcmp(argv[i],"-shots")==0)
+			batch.IsClassified=true;
+		else if(strcmp(argv[i],"-cutdistance")==0 && !IsLast)
+			batch.classifier.cutDistance=atof(argv[++i]);
+		else if(strcmp(argv[i],"-staticresidual")==0 && !IsLast)
+			batch.classifier.staticResidual=atof(argv[++i]);
+		else if(strcmp(argv[i],"-predictmemory")==0)
+			IsMemoryDryRun=true;
+		else if(strcmp(argv[i],"-threads")==0 && !IsLast)
+			batch.nThreads=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-imagethreads")==0 && !IsLast)
+			ParallelFor::nThreads()=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-devices")==0 && !IsLast)
+			batch.nDevices=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-devicethreads")==0 && !IsLast)
+			batch.workersPerDevice=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-hostthreads")==0 && !IsLast)
+			batch.nHostWorkers=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-memory")==0 && !IsLast)
+			batch.memoryBudget=atof(argv[++i])*1024*1024;
+		else if(strcmp(argv[i],"-scale")==0 && !IsLast)
+			scale=atof(argv[++i]);
+		else if(strcmp(argv[i],"-verbose")==0)
+			OpticalFlow::IsDisplay=true;
+		else if(strcmp(argv[i],"-stats")==0 && !IsLast)
+			statsname=argv[++i];
+		else if(strcmp(argv[i],"-video")==0 && !IsLast)
+			videoname=argv[++i];
+		else if(strcmp(argv[i],"-out")==0 && !IsLast)
+			fileSink.outputDir=argv[++i];
+		else if(strcmp(argv[i],"-outformat")==0 && !IsLast)
+		{
+			string extension=string(".")+argv[++i];
+			RawImage::Sample sample;
+			if(RawImage::IsRawFile(extension.c_str(),&sample) && sample!=RawImage::UInt8)
+				fileSink.rawExtension=extension;
+			else
+				cout<<"Unknown flow format "<<argv[i]<<", the flow is saved as .bin!"<<endl;
+		}
+		else if(strcmp(argv[i],"-clip")==0 && !IsLast)
+			clipSink.filename=argv[++i];
+		else if(strcmp(argv[i],"-format")==0 && !IsLast)
+		{
+			i++;
+			if(strcmp(argv[i],"float")==0)
+				clipSink.format=FlowClip::Float32;
+			else if(strcmp(argv[i],"half")==0)
+				clipSink.format=FlowClip::Float16;
+			else if(strcmp(argv[i],"int16")==0)
+				clipSink.format=FlowClip::Int16;
+			else
+			{
+				cout<<"Unknown format "<<argv[i]<<"!"<<endl;
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i],"-zstd")==0)
+			clipSink.compression=FlowClip::Zstd;
+		else if(strcmp(argv[i],"-depth")==0 && !IsLast)
+			depthSink.filename=argv[++i];
+		else if(strcmp(argv[i],"-background")==0 && !IsLast)
+			depthSink.backgroundName=argv[++i];
+		else if(strcmp(argv[i],"-dds")==0)
+			depthSink.IsCompressed=true;
+		else if(strcmp(argv[i],"-packed")==0 && !IsLast)
+			depthSink.packedName=argv[++i];
+		else if(strcmp(argv[i],"-packalpha")==0 && !IsLast)
+			depthSink.alphaName=argv[++i];
+		else if(strcmp(argv[i],"-msi")==0 && !IsLast)
+			depthSink.msiName=argv[++i];
+		else if(strcmp(argv[i],"-msilayers")==0 && !IsLast)
+			depthSink.msi.nLayers=__max(atoi(argv[++i]),2);
+		else if(strcmp(argv[i],"-msicolumns")==0 && !IsLast)
+			depthSink.msi.nColumns=__max(atoi(argv[++i]),1);
+		else if(strcmp(argv[i],"-web")==0 && !IsLast)
+			depthSink.webName=argv[++i];
+		else if(strcmp(argv[i],"-hwenc")==0)
+			depthSink.acceleration=VideoEncoder::Hardware;
+		else if(strcmp(argv[i],"-shard")==0 && !IsLast)
+		{
+			if(sscanf(argv[++i],"%d/%d",&shard,&nShards)!=2 || nShards<1 || shard<0 || shard>=nShards)
+			{
+				cout<<"The shard "<<argv[i]<<" is not k/n with 0<=k<n!"<<endl;
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i],"-first")==0 && !IsLast)
+			batch.firstPair=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-last")==0 && !IsLast)
+			batch.lastPair=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-warmup")==0 && !IsLast)
+			batch.nWarmupPairs=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-checkpoint")==0 && !IsLast)
+			batch.checkpointFile=argv[++i];
+		else if(strcmp(argv[i],"-chunk")==0 && !IsLast)
+			batch.chunkPairs=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-farm")==0 && !IsLast)
+			farmname=argv[++i];
+		else if(strcmp(argv[i],"-lease")==0 && !IsLast)
+			farm.leaseSeconds=atof(argv[++i]);
+		else if(argv[i][0]=='-')
+		{
+			cout<<"Unknown option "<<argv[i]<<"!"<<endl;
+			return 1;
+		}
+		else
+			imageList.filenames.push_back(argv[i]);
+	}
+	if(scale<=0 || scale>1)
+	{
+		cout<<"The scale "<<scale<<" is not in (0,1]!"<<endl;
+		return 1;
+	}
+	imageList.scale=depthSink.frames.scale=scale;
+	if(IsMemoryDryRun)
+	{
+		if(videoname==NULL && imageList.filenames.size()<2)
+		{
+			cout<<"usage: opticalflow [options] -predictmemory (-video input | frame0 frame1 ...)"<<endl;
+			return 1;
+		}
+		if(videoname!=NULL && !video.open(videoname,scale))
+			return 1;
+		DOpticalFlowBatch::FrameSource& source=(videoname!=NULL)?(DOpticalFlowBatch::FrameSource&)video:imageList;
+		int width,height,nChannels,nPairs=source.nframes()-1;
+		if(!source.frameDimension(width,height,nChannels))
+		{
+			cout<<"Fail to load the first frame!"<<endl;
+			return 1;
+		}
+		if(batch.lastPair>0)
+			nPairs=__min(batch.lastPair,nPairs);
+		nPairs-=__max(batch.firstPair-batch.nWarmupPairs,0);
+		int K=__max(batch.keyframeInterval,1);
+		cout<<width<<"x"<<height<<"x"<<nChannels<<" frames, "<<batch.numWorkers(width,height,nChannels,(nPairs+K-1)/K)<<" concurrent spans of "
+			<<DOpticalFlowBatch::spanMemory(width,height,nChannels,batch.ratio,batch.minWidth,K)/1048576
+			<<" MB, peak "<<batch.predictMemory(width,height,nChannels,nPairs)/1048576<<" MB"<<endl;
+		return 0;
+	}
+	if(!depthSink.webName.empty())
+	{
+		if(depthSink.packedName.empty())
+			depthSink.packedName=depthSink.webName+"_packed.mp4";
+		if(depthSink.backgroundName.empty())
+			depthSink.backgroundName=depthSink.webName;
+	}
+	bool IsFlowOutput=!fileSink.outputDir.empty() || !clipSink.filename.empty();
+	bool IsWholeClip=!depthSink.backgroundName.empty() || !depthSink.packedName.empty() || !depthSink.msiName.empty();
+	bool IsDepthOutput=!depthSink.filename.empty() || IsWholeClip;
+	if(farmname!=NULL)
+	{
+		if(!fileSink.outputDir.empty() || IsWholeClip || nShards>0 || batch.firstPair>0 || batch.lastPair>0 ||
+			!batch.checkpointFile.empty() || (videoname==NULL && imageList.filenames.size()<2))
+		{
+			cout<<"usage: opticalflow [options] -farm dir [-clip file] [-depth file] (-video input | frame0 frame1 ...)"<<endl;
+			return 1;
+		}
+		if(videoname!=NULL && !video.open(videoname,scale))
+			return 1;
+		int nFrames=(videoname!=NULL)?video.nframes():imageList.nframes();
+		if(videoname!=NULL && video.fps()>0)
+			depthSink.fps=video.fps();
+		if(!farm.open(farmname,nFrames-1,(batch.chunkPairs>0)?batch.chunkPairs:100))
+			return 1;
+		string clipname=clipSink.filename;
+		clipSink.farm=&farm;
+		depthSink.IsSegmented=true;
+		depthSink.nClipPairs=nFrames-1;
+		depthSink.flowSink=&clipSink;
+		StatisticsSink* farmSink=depthSink.filename.empty()?(StatisticsSink*)&clipSink:&depthSink;
+		if(statsname!=NULL)
+			farmSink->statistics.open(statsname,ios::out|ios::app);
+		return runFarm(farm,batch,videoname,imageList,*farmSink,clipSink,depthSink,batch.nWarmupPairs,clipname,scale);
+	}
+	if((!IsFlowOutput && !IsDepthOutput) || (videoname==NULL && imageList.filenames.size()<2))
+	{
+		cout<<"usage: opticalflow [options] (-out flowdir | -clip file | -depth file | -background name | -packed file | -msi file | -web name) (-video input | frame0 frame1 ...)"<<endl;
+		return 1;
+	}
+	bool IsSegmented=nShards>0 || batch.firstPair>0 || batch.lastPair>0 || !batch.checkpointFile.empty();
+	if(IsSegmented && IsWholeClip)
+	{
+		cout<<"-background, -packed, -msi and -web need the whole clip in one run, without -shard, -first, -last or -checkpoint!"<<endl;
+		return 1;
+	}
+	if(!batch.checkpointFile.empty() && batch.chunkPairs<=0)
+		batch.chunkPairs=100;
+	clipSink.IsSegmented=depthSink.IsSegmented=IsSegmented;
+	StatisticsSink* sink=&fileSink;
+	if(!clipSink.filename.empty())
+		sink=&clipSink;
+	if(IsDepthOutput)
+	{
+		if(IsWholeClip && !depthSink.frames.open(videoname,imageList.filenames))
+		{
+			cout<<"Fail to open "<<videoname<<"!"<<endl;
+			return 1;
+		}
+		if(!depthSink.alphaName.empty() && !depthSink.alphaVideo.open(depthSink.alphaName))
+		{
+			cout<<"Fail to open "<<depthSink.alphaName<<"!"<<endl;
+			return 1;
+		}
+		depthSink.flowSink=IsFlowOutput?sink:NULL;
+		sink=&depthSink;
+	}
+	if(statsname!=NULL)
+	{
+		sink->statistics.open(statsname,ios::out|ios::app);
+		if(!sink->statistics.is_open())
+		{
+			cout<<"Fail to open "<<statsname<<"!"<<endl;
+			return 1;
+		}
+	}
+
+	if(videoname!=NULL && !video.open(videoname,scale))
+		return 1;
+	int nFrames=(videoname!=NULL)?video.nframes():imageList.nframes();
+	depthSink.nClipPairs=nFrames-1;
+	if(nShards>0)
+		DOpticalFlowBatch::shardRange(batch.firstPair,batch.lastPair,nFrames-1,shard,nShards);
+	// the pairs this run has to write, after the committed ones
+	int start=batch.firstPair,end=(batch.lastPair>0)?__min(batch.lastPair,nFrames-1):nFrames-1;
+	if(!batch.checkpointFile.empty())
+		start=DOpticalFlowBatch::resumePair(batch.checkpointFile,batch.firstPair);
+	if(start>=end)
+	{
+		cout<<"Pairs "<<batch.firstPair<<" to "<<end<<" are done"<<endl;
+		return 0;
+	}
+	if(start>batch.firstPair)
+		cout<<"Resuming at pair "<<start<<endl;
+
+	int nWritten;
+	if(videoname!=NULL)
+	{
+		video.firstFrame=batch.firstLoadedFrame(start);
+		if(video.fps()>0)
+			depthSink.fps=video.fps();
+		nWritten=batch.run(video,*sink);
+	}
+	else
+		nWritten=batch.run(imageList,*sink);
+	if(!clipSink.writer.close())
+	{
+		cout<<"Fail to write the index of "<<clipSink.filename<<"!"<<endl;
+		return 1;
+	}
+	if(!depthSink.close())
+		return 1;
+	cout<<"Peak memory of the images "<<MemoryAccounting::peak()/1048576.0<<" MB"<<endl;
+	return (nWritten==end-start)?0:1;
+}
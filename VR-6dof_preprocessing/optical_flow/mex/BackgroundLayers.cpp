@@ -0,0 +1,263 @@
+#include "BackgroundLayers.h"
+#include "ImageProcessing.h"
+#include "TextureCompression.h"
+#include <math.h>
+#include <string>
+
+using namespace std;
+
+template <class T>
+BackgroundLayers<T>::BackgroundLayers(double _depthMargin,int _minSamples)
+{
+	depthMargin=_depthMargin;
+	minSamples=_minSamples;
+	width=height=nChannels=nFrames=0;
+}
+
+template <class T>
+void BackgroundLayers<T>::reset(int _width,int _height,int _nChannels)
+{
+	width=_width;
+	height=_height;
+	nChannels=_nChannels;
+	nFrames=0;
+	int nPixels=width*height;
+	positionX.resize(nPixels);
+	positionY.resize(nPixels);
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			positionX[i*width+j]=j;
+			positionY[i*width+j]=i;
+		}
+	color.assign(nPixels*nChannels,0);
+	depth.assign(nPixels,0);
+	spread.assign(nPixels,0);
+	nSamples.assign(nPixels,0);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the median of the color moves by a step against the sign of every new sample, the step shrinking as
+// 1/sqrt(n) in units of the deviation of the samples; the depth of the surface is their mean
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void BackgroundLayers<T>::accumulate(const TImage& frame,const BiImage& depth8)
+{
+	if(nFrames==0 && (frame.width()!=width || frame.height()!=height || frame.nchannels()!=nChannels))
+		reset(frame.width(),frame.height(),frame.nchannels());
+	if(frame.width()!=width || frame.height()!=height || frame.nchannels()!=nChannels || nChannels>4 || depth8.width()!=width ||
+		depth8.height()!=height)
+	{
+		cout<<"The frames of BackgroundLayers::accumulate() don't match the first frame!"<<endl;
+		return;
+	}
+	int nPixels=width*height;
+	const double initialSpread=0.02;
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)nPixels>65536)
+#endif
+	for(int i=0;i<nPixels;i++)
+	{
+		double x=positionX[i],y=positionY[i];
+		x-=floor(x/width)*width;
+		y=__max(__min(y,height-1),0);
+		double sample[4]={0,0,0,0},r=0;
+		ImageProcessing::BilinearInterpolate(frame.data(),width,height,nChannels,x,y,sample,true);
+		ImageProcessing::BilinearInterpolate(depth8.data(),width,height,1,x,y,&r,true);
+		float* pColor=&color[i*nChannels];
+		int& n=nSamples[i];
+		if(n==0 || r<depth[i]-depthMargin)
+		{
+			// the first sample, or a surface behind the one seen so far
+			n=1;
+			depth[i]=r;
+			spread[i]=initialSpread;
+			for(int k=0;k<nChannels;k++)
+				pColor[k]=sample[k];
+			continue;
+		}
+		if(r>depth[i]+depthMargin)
+			continue;
+		n++;
+		depth[i]+=(r-depth[i])/n;
+		double step=1.5*spread[i]/sqrt((double)n),deviation=0;
+		for(int k=0;k<nChannels;k++)
+		{
+			double difference=sample[k]-pColor[k];
+			deviation+=fabs(difference);
+			if(difference>0)
+				pColor[k]+=__min(step,difference);
+			else
+				pColor[k]-=__min(step,-difference);
+		}
+		spread[i]+=(deviation/nChannels-spread[i])/n;
+	}
+	nFrames++;
+}
+
+template <class T>
+void BackgroundLayers<T>::advance(const TImage& vx,const TImage& vy)
+{
+	if(vx.width()!=width || vx.height()!=height)
+	{
+		cout<<"The flow of BackgroundLayers::advance() doesn't match the frames!"<<endl;
+		return;
+	}
+	int nPixels=width*height;
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)nPixels>65536)
+#endif
+	for(int i=0;i<nPixels;i++)
+	{
+		double x=positionX[i],y=positionY[i];
+		x-=floor(x/width)*width;
+		y=__max(__min(y,height-1),0);
+		double u=0,v=0;
+		ImageProcessing::BilinearInterpolate(vx.data(),width,height,1,x,y,&u,true);
+		ImageProcessing::BilinearInterpolate(vy.data(),width,height,1,x,y,&v,true);
+		positionX[i]=x+u;
+		positionY[i]=__max(__min(y+v,height-1),0);
+	}
+}
+
+template <class T>
+void BackgroundLayers<T>::getLayers(TImage& background,BiImage& backgroundDepth,BiImage& alpha) const
+{
+	background.allocate(width,height,nChannels);
+	backgroundDepth.allocate(width,height);
+	alpha.allocate(width,height);
+	int nPixels=width*height;
+	for(int i=0;i<nPixels;i++)
+	{
+		for(int k=0;k<nChannels;k++)
+			background.data()[i*nChannels+k]=__max(__min(color[i*nChannels+k],1),0);
+		backgroundDepth.data()[i]=__min(depth[i]+0.5,255);
+		alpha.data()[i]=(nSamples[i]>=minSamples)?255:0;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// push-pull: the image is halved with the weights of its pixels until no pixel is empty, and every level
+// is filled from the bilinear upsampling of the next coarser one where its weights are below 1
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void BackgroundLayers<T>::pushPull(vector<double>& image,vector<double>& weight,int width,int height,int nChannels,bool IsHorizontalWrap)
+{
+	int nPixels=width*height;
+	bool IsFull=true;
+	for(int i=0;i<nPixels && IsFull;i++)
+		IsFull=weight[i]>=1;
+	if(IsFull || (width==1 && height==1))
+		return;
+	int coarseWidth=(width+1)/2,coarseHeight=(height+1)/2;
+	vector<double> coarse(coarseWidth*coarseHeight*nChannels,0),coarseWeight(coarseWidth*coarseHeight,0);
+	for(int i=0;i<coarseHeight;i++)
+		for(int j=0;j<coarseWidth;j++)
+		{
+			int offset=i*coarseWidth+j;
+			double* pCoarse=&coarse[offset*nChannels];
+			for(int m=0;m<2;m++)
+				for(int n=0;n<2;n++)
+				{
+					int u=__min(j*2+n,width-1),v=__min(i*2+m,height-1);
+					double w=weight[v*width+u];
+					coarseWeight[offset]+=w;
+					for(int k=0;k<nChannels;k++)
+						pCoarse[k]+=image[(v*width+u)*nChannels+k]*w;
+				}
+			if(coarseWeight[offset]>0)
+				for(int k=0;k<nChannels;k++)
+					pCoarse[k]/=coarseWeight[offset];
+			coarseWeight[offset]=__min(coarseWeight[offset],1);
+		}
+	pushPull(coarse,coarseWeight,coarseWidth,coarseHeight,nChannels,IsHorizontalWrap);
+	vector<double> upsampled(nChannels);
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double w=weight[offset];
+			if(w>=1)
+				continue;
+			double x=__max((j+0.5)/2-0.5,0),y=__max((i+0.5)/2-0.5,0);
+			std::fill(upsampled.begin(),upsampled.end(),0);
+			ImageProcessing::BilinearInterpolate(&coarse[0],coarseWidth,coarseHeight,nChannels,x,y,&upsampled[0],IsHorizontalWrap);
+			for(int k=0;k<nChannels;k++)
+				image[offset*nChannels+k]=w*image[offset*nChannels+k]+(1-w)*upsampled[k];
+			weight[offset]=1;
+		}
+}
+
+template <class T>
+void BackgroundLayers<T>::inpaint(TImage& image,const BiImage& alpha,bool IsHorizontalWrap)
+{
+	int nPixels=image.npixels(),nChannels=image.nchannels();
+	vector<double> values(image.data(),image.data()+nPixels*nChannels),weight(nPixels);
+	for(int i=0;i<nPixels;i++)
+		weight[i]=alpha.data()[i]/255.0;
+	pushPull(values,weight,image.width(),image.height(),nChannels,IsHorizontalWrap);
+	for(int i=0;i<nPixels*nChannels;i++)
+		image.data()[i]=values[i];
+}
+
+template <class T>
+void BackgroundLayers<T>::inpaint(BiImage& image,const BiImage& alpha,bool IsHorizontalWrap)
+{
+	int nPixels=image.npixels(),nChannels=image.nchannels();
+	vector<double> values(image.data(),image.data()+nPixels*nChannels),weight(nPixels);
+	for(int i=0;i<nPixels;i++)
+		weight[i]=alpha.data()[i]/255.0;
+	pushPull(values,weight,image.width(),image.height(),nChannels,IsHorizontalWrap);
+	for(int i=0;i<nPixels*nChannels;i++)
+		image.data()[i]=__min(__max(values[i]+0.5,0),255);
+}
+
+// the 8-bit color of a layer as imwrite saves it
+template <class T>
+static void toBytes(const Image<T>& image,BiImage& bytes)
+{
+	bytes.allocate(image.width(),image.height(),image.nchannels());
+	for(int i=0;i<image.npixels()*image.nchannels();i++)
+		bytes.data()[i]=image.data()[i]*255;
+}
+
+// a layer block compressed into the containers asked for
+static bool saveCompressed(const string& name,const BiImage& image,TextureCompression::Format format,bool IsDDS,bool IsKTX2)
+{
+	return (!IsDDS || TextureCompression::saveDDS((name+".dds").c_str(),image,format)) &&
+		(!IsKTX2 || TextureCompression::saveKTX2((name+".ktx2").c_str(),image,format));
+}
+
+template <class T>
+bool BackgroundLayers<T>::saveLayers(const char* name,bool IsCompressed,bool IsWeb) const
+{
+	TImage background;
+	BiImage backgroundDepth,alpha;
+	getLayers(background,backgroundDepth,alpha);
+	string prefix(name);
+	bool IsSaved=background.imwrite((prefix+"_BG.png").c_str()) && backgroundDepth.imwrite((prefix+"_BGD.png").c_str()) &&
+					alpha.imwrite((prefix+"_BGA.png").c_str());
+	BiImage color8;
+	if(IsCompressed || IsWeb)
+	{
+		toBytes(background,color8);
+		IsSaved=IsSaved && saveCompressed(prefix+"_BG",color8,TextureCompression::BC1,IsCompressed,IsWeb) &&
+					saveCompressed(prefix+"_BGD",backgroundDepth,TextureCompression::BC4,IsCompressed,IsWeb) &&
+					saveCompressed(prefix+"_BGA",alpha,TextureCompression::BC4,IsCompressed,IsWeb);
+	}
+	inpaint(background,alpha);
+	inpaint(backgroundDepth,alpha);
+	IsSaved=IsSaved && background.imwrite((prefix+"_BG_inp.png").c_str()) && backgroundDepth.imwrite((prefix+"_BGD_inp.png").c_str());
+	if(IsCompressed || IsWeb)
+	{
+		toBytes(background,color8);
+		IsSaved=IsSaved && saveCompressed(prefix+"_BG_inp",color8,TextureCompression::BC1,IsCompressed,IsWeb) &&
+					saveCompressed(prefix+"_BGD_inp",backgroundDepth,TextureCompression::BC4,IsCompressed,IsWeb);
+	}
+	if(!IsSaved)
+		cout<<"Fail to save the background layers of "<<name<<"!"<<endl;
+	return IsSaved;
+}
+
+template class BackgroundLayers<double>;
+template class BackgroundLayers<float>;
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Image.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the static background layers of a clip for the viewer: <name>_BG.png and <name>_BGD.png, the color and
+// the depth of the background, <name>_BGA.png, the pixels where the background was seen, and <name>_BG_inp.png
+// and <name>_BGD_inp.png, the same with the unseen pixels inpainted.
+//
+// The frames are streamed once, front to back. Every pixel of the first frame is followed through the clip
+// along the chained flow, and the samples of the farthest surface it sees are accumulated: a sample of a
+// farther surface, by more than depthMargin, restarts the pixel, a nearer one is a foreground occluder and
+// is skipped, and the samples of the same surface update a stochastic approximation of their median. The
+// state of a pixel is a few numbers whatever the length of the clip, and the pixels are updated in parallel
+//
+// the depth is the 8-bit inverse depth of FlowDepth, 255 the nearest
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class BackgroundLayers
+{
+public:
+	typedef Image<T> TImage;
+
+	double depthMargin;		// the inverse depths of the same surface, in 8-bit codes
+	int minSamples;			// the samples of a pixel before its background is trusted
+private:
+	int width,height,nChannels,nFrames;
+	// the position of every pixel of the first frame in the current frame
+	std::vector<float> positionX,positionY;
+	// the median estimate of the color, the mean depth of its surface, the mean absolute deviation of the
+	// color, and the number of samples
+	std::vector<float> color,depth,spread;
+	std::vector<int> nSamples;
+public:
+	BackgroundLayers(double _depthMargin=8,int _minSamples=3);
+	void reset(int _width,int _height,int _nChannels);
+	inline int nframes() const {return nFrames;};
+
+	// the next frame of the clip, of up to 4 channels, with its depth; both have the dimension of the first frame
+	void accumulate(const TImage& frame,const BiImage& depth8);
+	// the flow from the current frame to the next one
+	void advance(const TImage& vx,const TImage& vy);
+	void getLayers(TImage& background,BiImage& backgroundDepth,BiImage& alpha) const;
+	// the pixels of alpha 0 filled from their neighbors, from coarse to fine
+	static void inpaint(TImage& image,const BiImage& alpha,bool IsHorizontalWrap=true);
+	static void inpaint(BiImage& image,const BiImage& alpha,bool IsHorizontalWrap=true);
+	// the five layers named after the color video, e.g. name_BG.png; IsCompressed: also baked into the
+	// BC1 and BC4 textures of the viewer, name_BG.dds..., IsWeb: into those of the web viewer, name_BG.ktx2...,
+	// see TextureCompression.h
+	bool saveLayers(const char* name,bool IsCompressed=false,bool IsWeb=false) const;
+private:
+	static void pushPull(std::vector<double>& image,std::vector<double>& weight,int width,int height,int nChannels,bool IsHorizontalWrap);
+};
+
+typedef BackgroundLayers<double> DBackgroundLayers;
+typedef BackgroundLayers<float> FBackgroundLayers;
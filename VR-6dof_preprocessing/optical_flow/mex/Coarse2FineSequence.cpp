@@ -0,0 +1,88 @@
+#include "mex.h"
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include <iostream>
+
+using namespace std;
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// check for proper number of input and output arguments
+	if(nrhs<1 || nrhs>2)
+		mexErrMsgTxt("Only one or two input arguments are allowed!");
+	if(nlhs!=2)
+		mexErrMsgTxt("Only two output arguments are allowed!");
+	if(!mxIsCell(prhs[0]))
+		mexErrMsgTxt("The frames must be given in a cell array!");
+	int nFrames=mxGetNumberOfElements(prhs[0]);
+	if(nFrames<2)
+		mexErrMsgTxt("At least two frames are needed!");
+
+	// get the parameters
+	DOpticalFlowSequence sequence;
+	OpticalFlow::sorScheme = OpticalFlow::Lexicographic;
+	OpticalFlow::nThreads = 0;
+	OpticalFlow::IsHorizontalWrap = false;
+	if(nrhs>1)
+	{
+		const int *dims=mxGetDimensions(prhs[1]);
+		double* para=(double *)mxGetData(prhs[1]);
+		int npara=dims[0]*dims[1];
+		if(npara>0)
+			sequence.alpha=para[0];
+		if(npara>1)
+			sequence.ratio=para[1];
+		if(npara>2)
+			sequence.minWidth=para[2];
+		if(npara>3)
+			sequence.nOuterFPIterations=para[3];
+		if(npara>4)
+			sequence.nInnerFPIterations=para[4];
+		if(npara>5)
+			sequence.nSORIterations = para[5];
+		if(npara>6)
+			OpticalFlow::sorScheme = (para[6]>0) ? OpticalFlow::RedBlack : OpticalFlow::Lexicographic;
+		if(npara>7)
+			OpticalFlow::nThreads = para[7];
+		if(npara>8 && para[8]>=0)
+		{
+			sequence.IsWarmStart = true;
+			sequence.nSkipLevels = para[8];
+		}
+		if(npara>9)
+			sequence.nWarmOuterFPIterations = para[9];
+		if(npara>10)
+			OpticalFlow::IsHorizontalWrap = (para[10]>0);
+	}
+
+	// the frames are loaded one at a time, the flow of pair i goes to channel i of the output
+	DImage frame,first,vx,vy,Vx,Vy;
+	for(int i=0;i<nFrames;i++)
+	{
+		const mxArray* matrix=mxGetCell(prhs[0],i);
+		if(matrix==NULL)
+			mexErrMsgTxt("Empty frame in the sequence!");
+		frame.LoadMatlabImage(matrix);
+		if(i==0)
+		{
+			first.copyData(frame);
+			Vx.allocate(frame.width(),frame.height(),nFrames-1);
+			Vy.allocate(frame.width(),frame.height(),nFrames-1);
+		}
+		else if(frame.matchDimension(first)==false)
+			mexErrMsgTxt("The frames of the sequence don't match!");
+		if(!sequence.AddFrame(frame,vx,vy))
+			continue;
+		int nPixels=frame.npixels();
+		for(int j=0;j<nPixels;j++)
+		{
+			Vx.pData[j*(nFrames-1)+i-1]=vx.pData[j];
+			Vy.pData[j*(nFrames-1)+i-1]=vy.pData[j];
+		}
+	}
+
+	// output the flow fields
+	Vx.OutputToMatlab(plhs[0]);
+	Vy.OutputToMatlab(plhs[1]);
+}
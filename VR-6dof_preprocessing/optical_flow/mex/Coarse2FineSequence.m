@@ -0,0 +1,26 @@
+% function to compute the dense optical flow between all consecutive frames of a video
+%
+% usage:
+%
+% [vx,vy]=Coarse2FineSequence(frames);
+% [vx,vy]=Coarse2FineSequence(frames,para);
+%
+% frames: a cell array of N frames with the same dimension
+% para (optional): the argument for optical flow, the same as in Coarse2FineTwoFrames
+%     para(1)--alpha (1), the regularization weight
+%     para(2)--ratio (0.5), the downsample ratio
+%     para(3)--minWidth (40), the width of the coarsest level
+%     para(4)--nOuterFPIterations (3), the number of outer fixed point iterations
+%     para(5)--nInnerFPIterations (1), the number of inner fixed point iterations
+%     para(6)--nSORIterations (20), the number of SOR iterations
+%     para(7)--SOR ordering (0), 0 for lexicographic, 1 for parallel red-black
+%     para(8)--nThreads (0), the number of threads for red-black SOR, 0 for all cores
+%     para(9)--nSkipLevels (-1), warm start each pair from the flow of the previous pair and skip
+%              this many coarsest levels, -1 to estimate every pair from scratch
+%     para(10)--nWarmOuterFPIterations (0), the outer iterations of warm started pairs, 0 for para(4)
+%     para(11)--boundary (0), 1 if the left and right borders are adjacent (360 equirectangular)
+%
+% vx, vy: H x W x (N-1) arrays, vx(:,:,i) is the flow from frames{i} to frames{i+1}
+%
+% The pyramid of each frame is built only once and shared by the two pairs it belongs to,
+% so this is faster than calling Coarse2FineTwoFrames on every pair.
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "mex.h"
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include "OpticalFlowEquirect.h"
+
+//--------------------------------------------------------------------------------------------------------
+// the body of the mex entries Coarse2FineTwoFrames (T=double) and Coarse2FineTwoFramesSingle (T=float): the
+// arguments, the para vector and the outputs are parsed the same for both, only the scalar type of the solver
+// and of the returned images differs
+//--------------------------------------------------------------------------------------------------------
+namespace Coarse2FineTwoFramesMex
+{
+	// builds the pyramid of an input image. uint8 and uint16 images stay quantized and are converted into the
+	// finest level of the pyramid, divided by 255 as LoadMatlabImage does, instead of being loaded at T first
+	template <class T,class T1>
+	void BuildQuantizedPyramid(typename OpticalFlowT<T>::Pyramid& pyramid,const mxArray* matrix,double ratio,int minWidth)
+	{
+		Image<T1> image;
+		image.LoadMatlabImage(matrix,false);
+		OpticalFlowT<T>::BuildPyramid(pyramid,image,255,ratio,minWidth);
+	}
+
+	template <class T>
+	void BuildPyramid(typename OpticalFlowT<T>::Pyramid& pyramid,const mxArray* matrix,const Image<T>& im,bool IsQuantizedInput,double ratio,int minWidth)
+	{
+		if(!IsQuantizedInput)
+			OpticalFlowT<T>::BuildPyramid(pyramid,im,ratio,minWidth);
+		else if(mxIsClass(matrix,"uint8"))
+			BuildQuantizedPyramid<T,unsigned char>(pyramid,matrix,ratio,minWidth);
+		else if(mxIsClass(matrix,"uint16"))
+			BuildQuantizedPyramid<T,unsigned short>(pyramid,matrix,ratio,minWidth);
+	}
+
+	inline bool IsQuantized(const mxArray* matrix)
+	{
+		return mxIsClass(matrix,"uint8") || mxIsClass(matrix,"uint16");
+	}
+
+	template <class T>
+	void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+	{
+		typedef OpticalFlowT<T> Flow;
+		typedef Image<T> TImage;
+
+		// check for proper number of input and output arguments
+		if(nrhs<2 || nrhs>6 || nrhs==4)
+			mexErrMsgTxt("Only two, three, five or six input arguments are allowed!");
+		if(nlhs<2 || nlhs>5)
+			mexErrMsgTxt("Only two to five output arguments are allowed!");
+		int nDims=mxGetNumberOfDimensions(prhs[0]);
+		const int *imDims=mxGetDimensions(prhs[0]),*imDims2=mxGetDimensions(prhs[1]);
+		if(nDims!=mxGetNumberOfDimensions(prhs[1]) || imDims[0]!=imDims2[0] || imDims[1]!=imDims2[1] || (nDims>2 && imDims[2]!=imDims2[2]))
+			mexErrMsgTxt("The two images don't match!");
+		int width=imDims[1],height=imDims[0];
+
+		// get the parameters
+		double alpha= 1;
+		double ratio=0.5;
+		int minWidth= 40;
+		int nOuterFPIterations = 3;
+		int nInnerFPIterations = 1;
+		int nSORIterations= 20;
+		int nSkipLevels = 0;
+		int nWarmOuterFPIterations = 0;
+		bool IsLatitudeAdaptive = false;
+		OpticalFlowBase::sorScheme = OpticalFlowBase::Lexicographic;
+		OpticalFlowBase::nThreads = 0;
+		OpticalFlowBase::IsHorizontalWrap = false;
+		OpticalFlowBase::linearSolver = OpticalFlowBase::SOR;
+		OpticalFlowBase::updateTolerance = 0;
+		OpticalFlowBase::sweepTolerance = 0;
+		OpticalFlowBase::noiseSamples = 0;
+		if(nrhs>2)
+		{
+			const int *dims=mxGetDimensions(prhs[2]);
+			double* para=(double *)mxGetData(prhs[2]);
+			int npara=dims[0]*dims[1];
+			if(npara>0)
+				alpha=para[0];
+			if(npara>1)
+				ratio=para[1];
+			if(npara>2)
+				minWidth=para[2];
+			if(npara>3)
+				nOuterFPIterations=para[3];
+			if(npara>4)
+				nInnerFPIterations=para[4];
+			if(npara>5)
+				nSORIterations = para[5];
+			if(npara>6)
+				OpticalFlowBase::sorScheme = (para[6]>0) ? OpticalFlowBase::RedBlack : OpticalFlowBase::Lexicographic;
+			if(npara>7)
+				OpticalFlowBase::nThreads = para[7];
+			if(npara>8)
+				nSkipLevels = para[8];
+			if(npara>9)
+				nWarmOuterFPIterations = para[9];
+			if(npara>10)
+				OpticalFlowBase::IsHorizontalWrap = (para[10]>0);
+			if(npara>11)
+				IsLatitudeAdaptive = (para[11]>0);
+			if(npara>12)
+				OpticalFlowBase::linearSolver = (para[12]>0) ? OpticalFlowBase::PCG : OpticalFlowBase::SOR;
+			if(npara>13)
+				OpticalFlowBase::updateTolerance = para[13];
+			if(npara>14)
+				OpticalFlowBase::sweepTolerance = para[14];
+			if(npara>15)
+				OpticalFlowBase::noiseSamples = para[15];
+		}
+
+		// the quantized images are loaded by BuildPyramid, the latitude adaptive flow takes the images at T
+		TImage Im1,Im2;
+		bool IsQuantizedInput = IsQuantized(prhs[0]) && IsQuantized(prhs[1]) && !IsLatitudeAdaptive;
+		if(!IsQuantizedInput)
+		{
+			Im1.LoadMatlabImage(prhs[0]);
+			Im2.LoadMatlabImage(prhs[1]);
+		}
+
+		TImage vx,vy,warpI2;
+		typename Flow::Workspace ws;
+		ws.IsConfidence = nlhs>4 && !IsLatitudeAdaptive;
+		bool IsPrior = nrhs>4 && mxGetNumberOfElements(prhs[3])>0 && mxGetNumberOfElements(prhs[4])>0;
+		if(nrhs>5 && mxGetNumberOfElements(prhs[5])>0)
+		{
+			TImage mask;
+			mask.LoadMatlabImage(prhs[5]);
+			if(mask.width()!=width || mask.height()!=height)
+				mexErrMsgTxt("The mask doesn't match the images!");
+			if(IsLatitudeAdaptive)
+				mexErrMsgTxt("The mask is not supported with para(12)!");
+			ws.setROI(mask);
+		}
+		if(IsPrior)
+		{
+			// warm start from the prior flow
+			TImage priorVx,priorVy;
+			priorVx.LoadMatlabImage(prhs[3]);
+			priorVy.LoadMatlabImage(prhs[4]);
+			if(!priorVx.matchDimension(width,height,1) || !priorVy.matchDimension(width,height,1))
+				mexErrMsgTxt("The prior flow doesn't match the images!");
+			if(nWarmOuterFPIterations>0)
+				nOuterFPIterations = nWarmOuterFPIterations;
+			typename Flow::Pyramid Pyramid1,Pyramid2;
+			BuildPyramid<T>(Pyramid1,prhs[0],Im1,IsQuantizedInput,ratio,minWidth);
+			BuildPyramid<T>(Pyramid2,prhs[1],Im2,IsQuantizedInput,ratio,minWidth);
+			Flow::Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,priorVx,priorVy,alpha,ratio,nSkipLevels,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+		}
+		else if(IsLatitudeAdaptive)
+		{
+			OpticalFlowEquirect<T> equirect;
+			equirect.Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+		}
+		else if(IsQuantizedInput)
+		{
+			typename Flow::Pyramid Pyramid1,Pyramid2;
+			BuildPyramid<T>(Pyramid1,prhs[0],Im1,IsQuantizedInput,ratio,minWidth);
+			BuildPyramid<T>(Pyramid2,prhs[1],Im2,IsQuantizedInput,ratio,minWidth);
+			Flow::Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+		}
+		else
+			Flow::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+
+		// output the parameters
+		vx.OutputToMatlab(plhs[0]);
+		vy.OutputToMatlab(plhs[1]);
+		if(nlhs>2)
+			warpI2.OutputToMatlab(plhs[2]);
+		if(nlhs>3)
+		{
+			// one row per pyramid level, the coarsest first, always at double
+			int nLevels = ws.statistics.size();
+			plhs[3] = mxCreateDoubleMatrix(nLevels,12,mxREAL);
+			double* stats = mxGetPr(plhs[3]);
+			for(int k=0;k<nLevels;k++)
+			{
+				const SolverStatistics& s = ws.statistics[k];
+				double columns[12] = {(double)s.width,(double)s.height,(double)s.nOuterIterations,(double)s.nSolverIterations,s.lastUpdate,s.lastResidual,
+					s.warpTime,s.derivativeTime,s.weightTime,s.assemblyTime,s.solverTime,s.noiseTime};
+				for(int c=0;c<12;c++)
+					stats[k+nLevels*c] = columns[c];
+			}
+		}
+		if(nlhs>4)
+		{
+			if(ws.confidence.IsEmpty())
+				plhs[4] = mxCreateDoubleMatrix(0,0,mxREAL);
+			else
+				ws.confidence.OutputToMatlab(plhs[4]);
+		}
+	}
+}
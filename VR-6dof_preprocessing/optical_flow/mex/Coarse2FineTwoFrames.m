@@ -4,8 +4,14 @@
 %
 % [vx,vy,warpI2]=Coarse2FineTwoFrames(im1,im2);
 % [vx,vy,warpI2]=Coarse2FineTwoFrames(im1,im2,para);
+% [vx,vy,warpI2]=Coarse2FineTwoFrames(im1,im2,para,vx0,vy0);
+% [vx,vy,warpI2]=Coarse2FineTwoFrames(im1,im2,para,vx0,vy0,mask);
+% [vx,vy,warpI2,stats]=Coarse2FineTwoFrames(...);
+% [vx,vy,warpI2,stats,confidence]=Coarse2FineTwoFrames(...);
 %
-% im1, im2: two frames with the same dimension
+% im1, im2: two frames with the same dimension. uint8 and uint16 frames are divided by 255 as the
+%     other integer classes, but directly into the finest level of the pyramid, without a copy
+%     of the frames at double precision (except with para(12))
 % para (optional): the argument for optical flow
 %     para(1)--alpha (1), the regularization weight
 %     para(2)--ratio (0.5), the downsample ratio
@@ -13,6 +19,35 @@
 %     para(4)--nOuterFPIterations (3), the number of outer fixed point iterations
 %     para(5)--nInnerFPIterations (1), the number of inner fixed point iterations
 %     para(6)--nSORIterations (20), the number of SOR iterations
+%     para(7)--SOR ordering (0), 0 for lexicographic, 1 for parallel red-black
+%     para(8)--nThreads (0), the number of threads for red-black SOR, 0 for all cores
+%     para(9)--nSkipLevels (0), the number of coarsest levels skipped with a prior flow
+%     para(10)--nWarmOuterFPIterations (0), the outer iterations with a prior flow, 0 for para(4)
+%     para(11)--boundary (0), 1 if the left and right borders are adjacent (360 equirectangular)
+%     para(12)--latitude-adaptive (0), 1 to decimate the rows towards the poles of equirectangular
+%               frames, with para(11) set as well. Not used with vx0, vy0. Compile the mex file
+%               with OpticalFlowEquirect.cpp
+%     para(13)--linear solver (0), 0 for SOR, 1 for preconditioned conjugate gradient that stops
+%               at a relative residual of 1e-3, with para(6) as its maximal number of iterations
+%     para(14)--updateTolerance (0), the fixed point iterations stop when the RMS of the flow update
+%               is at most this many pixels, 0 to run all of them
+%     para(15)--sweepTolerance (0), the SOR sweeps stop when the RMS change of one sweep is at most
+%               this many pixels, 0 to run all of them
+%     para(16)--noiseSamples (0), the noise of each level is estimated on a regular subsample of at
+%               least this many pixels, e.g. 16384, 0 for all the pixels
+% vx0, vy0 (optional): a prior flow to start from, e.g. the flow of the previous frame pair.
+%     It is downsampled to the first level that is not skipped. Pass [] for no prior with a mask
+% mask (optional): the region of interest, nonzero where the flow is wanted. The flow is solved in the
+%     region dilated by a few pixels at each level; elsewhere it is upsampled from the coarser levels
+%     only. Not used with para(12)
+% stats (optional): one row per pyramid level, the coarsest first, of [width height
+%     nOuterIterations nSORIterations lastUpdate lastResidual warp derivatives weights assembly
+%     solver noise]; lastUpdate is the RMS of the last flow update, lastResidual the RMS change of
+%     the last SOR sweep or the relative residual of PCG, and the last six the seconds spent in
+%     each stage of the level. With para(12) the rows of the last latitude band
+% confidence (optional): the confidence of the flow in [0,1] at every pixel, from the robust weights
+%     of the data term in the last fixed point iteration of the finest level, 0 where the flow leaves
+%     the image or outside the mask. It costs no extra pass over the images. Empty with para(12)
 %
 % Ce Liu
 % Dec, 2009
@@ -0,0 +1,79 @@
+#include "mex.h"
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include <iostream>
+
+using namespace std;
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	// check for proper number of input and output arguments
+	if(nrhs<2 || nrhs>3)
+		mexErrMsgTxt("Only two or three input arguments are allowed!");
+	if(nlhs<4 || nlhs>5)
+		mexErrMsgTxt("Only four or five output arguments are allowed!");
+	DImage Im1,Im2;
+	Im1.LoadMatlabImage(prhs[0]);
+	Im2.LoadMatlabImage(prhs[1]);
+	if(Im1.matchDimension(Im2)==false)
+		mexErrMsgTxt("The two images don't match!");
+
+	// get the parameters, the same indices as in Coarse2FineTwoFrames
+	double alpha= 1;
+	double ratio=0.5;
+	int minWidth= 40;
+	int nOuterFPIterations = 3;
+	int nInnerFPIterations = 1;
+	int nSORIterations= 20;
+	OpticalFlow::sorScheme = OpticalFlow::Lexicographic;
+	OpticalFlow::nThreads = 0;
+	OpticalFlow::IsHorizontalWrap = false;
+	OpticalFlow::linearSolver = OpticalFlow::SOR;
+	OpticalFlow::updateTolerance = 0;
+	OpticalFlow::sweepTolerance = 0;
+	OpticalFlow::noiseSamples = 0;
+	if(nrhs>2)
+	{
+		const int *dims=mxGetDimensions(prhs[2]);
+		double* para=(double *)mxGetData(prhs[2]);
+		int npara=dims[0]*dims[1];
+		if(npara>0)
+			alpha=para[0];
+		if(npara>1)
+			ratio=para[1];
+		if(npara>2)
+			minWidth=para[2];
+		if(npara>3)
+			nOuterFPIterations=para[3];
+		if(npara>4)
+			nInnerFPIterations=para[4];
+		if(npara>5)
+			nSORIterations = para[5];
+		if(npara>6)
+			OpticalFlow::sorScheme = (para[6]>0) ? OpticalFlow::RedBlack : OpticalFlow::Lexicographic;
+		if(npara>7)
+			OpticalFlow::nThreads = para[7];
+		if(npara>10)
+			OpticalFlow::IsHorizontalWrap = (para[10]>0);
+		if(npara>12)
+			OpticalFlow::linearSolver = (para[12]>0) ? OpticalFlow::PCG : OpticalFlow::SOR;
+		if(npara>13)
+			OpticalFlow::updateTolerance = para[13];
+		if(npara>14)
+			OpticalFlow::sweepTolerance = para[14];
+		if(npara>15)
+			OpticalFlow::noiseSamples = para[15];
+	}
+
+	DImage vx,vy,vxB,vyB,occlusion;
+	OpticalFlow::Coarse2FineFlowBidirectional(vx,vy,vxB,vyB,occlusion,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations);
+
+	// output the parameters
+	vx.OutputToMatlab(plhs[0]);
+	vy.OutputToMatlab(plhs[1]);
+	vxB.OutputToMatlab(plhs[2]);
+	vyB.OutputToMatlab(plhs[3]);
+	if(nlhs>4)
+		occlusion.OutputToMatlab(plhs[4]);
+}
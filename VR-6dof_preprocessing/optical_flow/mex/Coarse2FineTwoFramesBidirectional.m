@@ -0,0 +1,31 @@
+% function to compute the dense optical flow from im1 to im2 and from im2 to im1 in one call
+%
+% usage:
+%
+% [vx,vy,vxB,vyB]=Coarse2FineTwoFramesBidirectional(im1,im2);
+% [vx,vy,vxB,vyB,occlusion]=Coarse2FineTwoFramesBidirectional(im1,im2,para);
+%
+% im1, im2: two frames with the same dimension
+% para (optional): the argument for optical flow, the same indices as in Coarse2FineTwoFrames
+%     para(1)--alpha (1), the regularization weight
+%     para(2)--ratio (0.5), the downsample ratio
+%     para(3)--minWidth (40), the width of the coarsest level
+%     para(4)--nOuterFPIterations (3), the number of outer fixed point iterations
+%     para(5)--nInnerFPIterations (1), the number of inner fixed point iterations
+%     para(6)--nSORIterations (20), the number of SOR iterations
+%     para(7)--SOR ordering (0), 0 for lexicographic, 1 for parallel red-black
+%     para(8)--nThreads (0), the number of threads for red-black SOR, 0 for all cores
+%     para(9), para(10), para(12) are not used
+%     para(11)--boundary (0), 1 if the left and right borders are adjacent (360 equirectangular)
+%     para(13)--linear solver (0), 0 for SOR, 1 for preconditioned conjugate gradient
+%     para(14)--updateTolerance (0), see Coarse2FineTwoFrames
+%     para(15)--sweepTolerance (0), see Coarse2FineTwoFrames
+%     para(16)--noiseSamples (0), see Coarse2FineTwoFrames
+%
+% vx, vy: the flow from im1 to im2
+% vxB, vyB: the flow from im2 to im1
+% occlusion (optional): 1 on the pixels of im1 that move out of the image or whose flow is not
+%     consistent with the backward flow at its target, 0 elsewhere
+%
+% The pyramids and the features of the two frames are built only once and the two directions are
+% solved level by level, so this is faster than calling Coarse2FineTwoFrames twice.
@@ -0,0 +1,12 @@
+#include "Coarse2FineTwoFrames.h"
+#include <iostream>
+
+using namespace std;
+
+// single precision version of Coarse2FineTwoFrames, the flow is returned as single. The arguments are parsed
+// by Coarse2FineTwoFramesMex, the same as the ones of the double version
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	Coarse2FineTwoFramesMex::mexFunction<float>(nlhs,plhs,nrhs,prhs);
+}
\ No newline at end of file
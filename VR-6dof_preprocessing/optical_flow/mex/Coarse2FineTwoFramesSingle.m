@@ -0,0 +1,35 @@
+% function to compute dense optical flow field in a coarse to fine manner
+% in single precision; vx, vy, warpI2 and confidence are returned as single
+%
+% usage:
+%
+% [vx,vy,warpI2]=Coarse2FineTwoFramesSingle(im1,im2);
+% [vx,vy,warpI2]=Coarse2FineTwoFramesSingle(im1,im2,para);
+% [vx,vy,warpI2]=Coarse2FineTwoFramesSingle(im1,im2,para,vx0,vy0);
+% [vx,vy,warpI2]=Coarse2FineTwoFramesSingle(im1,im2,para,vx0,vy0,mask);
+% [vx,vy,warpI2,stats]=Coarse2FineTwoFramesSingle(...);
+% [vx,vy,warpI2,stats,confidence]=Coarse2FineTwoFramesSingle(...);
+%
+% im1, im2: two frames with the same dimension
+% para (optional): the argument for optical flow, para(1) to para(16) as in Coarse2FineTwoFrames
+%     para(1)--alpha (1), the regularization weight
+%     para(2)--ratio (0.5), the downsample ratio
+%     para(3)--minWidth (40), the width of the coarsest level
+%     para(4)--nOuterFPIterations (3), the number of outer fixed point iterations
+%     para(5)--nInnerFPIterations (1), the number of inner fixed point iterations
+%     para(6)--nSORIterations (20), the number of SOR iterations
+%     para(7)--SOR ordering (0), 0 for lexicographic, 1 for parallel red-black
+%     para(8)--nThreads (0), the number of threads for red-black SOR, 0 for all cores
+%     para(9)--nSkipLevels (0), the number of coarsest levels skipped with a prior flow
+%     para(10)--nWarmOuterFPIterations (0), the outer iterations with a prior flow, 0 for para(4)
+%     para(11)--boundary (0), 1 if the left and right borders are adjacent (360 equirectangular)
+%     para(12)--latitude-adaptive (0), 1 to decimate the rows towards the poles of equirectangular
+%               frames. Compile the mex file with OpticalFlowEquirect.cpp
+%     para(13)--linear solver (0), 0 for SOR, 1 for preconditioned conjugate gradient
+%     para(14)--updateTolerance (0), the RMS flow update that stops the fixed point iterations
+%     para(15)--sweepTolerance (0), the RMS change of one sweep that stops the SOR sweeps
+%     para(16)--noiseSamples (0), the pixels the noise of each level is estimated on, 0 for all
+% vx0, vy0, mask, stats, confidence (optional): as in Coarse2FineTwoFrames; stats is double
+%
+% the arguments are parsed by Coarse2FineTwoFrames.h, shared with the double precision version
+% Coarse2FineTwoFrames
@@ -0,0 +1,348 @@
+#include "FlowClip.h"
+#include "FlowKernels.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef _LINUX_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#ifdef OPTICALFLOW_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+const char FlowClip::magic[8] = {'F','L','O','W','C','L','I','P'};
+
+//--------------------------------------------------------------------------------------------------------
+// the writer
+//--------------------------------------------------------------------------------------------------------
+bool FlowClipWriter::open(const char* filename,int width,int height,Format format,Compression compression)
+{
+	close();
+#ifndef OPTICALFLOW_ZSTD
+	if(compression==Zstd)
+	{
+		cout<<"The zstd compression needs OPTICALFLOW_ZSTD, the frames are stored uncompressed!"<<endl;
+		compression=None;
+	}
+#endif
+	file.open(filename,ios::out|ios::binary|ios::trunc);
+	if(!file.is_open())
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		return false;
+	}
+	memset(&header,0,sizeof(Header));
+	memcpy(header.magic,magic,8);
+	header.version=version;
+	header.width=width;
+	header.height=height;
+	header.format=format;
+	header.compression=compression;
+	index.clear();
+	file.write((const char*)&header,sizeof(Header));
+	return file.good();
+}
+
+template <class T>
+bool FlowClipWriter::writeFrame(const Image<T>& vx,const Image<T>& vy)
+{
+	if(!file.is_open())
+		return false;
+	if(!vx.matchDimension(header.width,header.height,1) || !vy.matchDimension(header.width,header.height,1))
+	{
+		cout<<"The flow does not match the dimension of the clip!"<<endl;
+		return false;
+	}
+	int nSamples=header.width*header.height*2;
+	buffer.resize((size_t)nSamples*sampleSize((Format)header.format));
+	const T *pVx=vx.data(),*pVy=vy.data();
+	Frame frame;
+	memset(&frame,0,sizeof(Frame));
+	frame.scale=1;
+	switch(header.format)
+	{
+	case Float32:
+		{
+			float* pData=(float*)&buffer[0];
+			for(int i=0;i<nSamples/2;i++)
+			{
+				pData[i*2]=pVx[i];
+				pData[i*2+1]=pVy[i];
+			}
+		}
+		break;
+	case Float16:
+		{
+			uint16_t* pData=(uint16_t*)&buffer[0];
+			for(int i=0;i<nSamples/2;i++)
+			{
+				pData[i*2]=FlowKernels::floatToHalf(pVx[i]);
+				pData[i*2+1]=FlowKernels::floatToHalf(pVy[i]);
+			}
+		}
+		break;
+	case Int16:
+		{
+			// the largest magnitude of the frame maps to 32767
+			double maxValue=0;
+			for(int i=0;i<nSamples/2;i++)
+				maxValue=__max(maxValue,__max(fabs((double)pVx[i]),fabs((double)pVy[i])));
+			frame.scale=(maxValue>0)?maxValue/32767:1;
+			double invScale=1/(double)frame.scale;
+			int16_t* pData=(int16_t*)&buffer[0];
+			for(int i=0;i<nSamples/2;i++)
+			{
+				pData[i*2]=__max(__min(floor(pVx[i]*invScale+0.5),32767.0),-32767.0);
+				pData[i*2+1]=__max(__min(floor(pVy[i]*invScale+0.5),32767.0),-32767.0);
+			}
+		}
+		break;
+	}
+	const char* pStored=&buffer[0];
+	frame.size=buffer.size();
+#ifdef OPTICALFLOW_ZSTD
+	if(header.compression==Zstd)
+	{
+		compressed.resize(ZSTD_compressBound(buffer.size()));
+		size_t size=ZSTD_compress(&compressed[0],compressed.size(),&buffer[0],buffer.size(),3);
+		if(ZSTD_isError(size))
+		{
+			cout<<"Fail to compress frame "<<index.size()<<": "<<ZSTD_getErrorName(size)<<"!"<<endl;
+			return false;
+		}
+		pStored=&compressed[0];
+		frame.size=size;
+	}
+#endif
+	frame.offset=file.tellp();
+	file.write(pStored,frame.size);
+	if(!file.good())
+		return false;
+	index.push_back(frame);
+	return true;
+}
+
+bool FlowClipWriter::close()
+{
+	if(!file.is_open())
+		return true;
+	header.nFrames=index.size();
+	// the index is aligned to 8 bytes in the mapped file
+	const char padding[8]={0};
+	file.write(padding,(8-(uint64_t)file.tellp()%8)%8);
+	header.indexOffset=file.tellp();
+	if(!index.empty())
+		file.write((const char*)&index[0],sizeof(Frame)*index.size());
+	file.seekp(0);
+	file.write((const char*)&header,sizeof(Header));
+	bool IsGood=file.good();
+	file.close();
+	return IsGood;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the reader
+//--------------------------------------------------------------------------------------------------------
+FlowClipReader::FlowClipReader()
+{
+	pData=NULL;
+	fileSize=0;
+	pHeader=NULL;
+	pIndex=NULL;
+#ifdef _LINUX_MAC
+	fd=-1;
+#else
+	hFile=hMapping=NULL;
+#endif
+}
+
+bool FlowClipReader::open(const char* filename)
+{
+	close();
+#ifdef _LINUX_MAC
+	fd=::open(filename,O_RDONLY);
+	struct stat status;
+	if(fd<0 || fstat(fd,&status)!=0)
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	fileSize=status.st_size;
+	void* pMapped=(fileSize>0)?mmap(NULL,fileSize,PROT_READ,MAP_SHARED,fd,0):MAP_FAILED;
+	if(pMapped==MAP_FAILED)
+	{
+		cout<<"Fail to map "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	pData=(const unsigned char*)pMapped;
+#else
+	hFile=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if(hFile==INVALID_HANDLE_VALUE)
+		hFile=NULL;
+	LARGE_INTEGER size;
+	if(hFile==NULL || !GetFileSizeEx(hFile,&size))
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	fileSize=size.QuadPart;
+	hMapping=(fileSize>0)?CreateFileMappingA(hFile,NULL,PAGE_READONLY,0,0,NULL):NULL;
+	pData=(hMapping!=NULL)?(const unsigned char*)MapViewOfFile(hMapping,FILE_MAP_READ,0,0,0):NULL;
+	if(pData==NULL)
+	{
+		cout<<"Fail to map "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+#endif
+
+	// check the header and the index before any frame is read
+	const Header* header=(const Header*)pData;
+	if(fileSize<sizeof(Header) || memcmp(header->magic,magic,8)!=0 || header->version!=version)
+	{
+		cout<<filename<<" is not a flow clip!"<<endl;
+		close();
+		return false;
+	}
+	if(header->indexOffset==0 || header->indexOffset>fileSize || (fileSize-header->indexOffset)/sizeof(Frame)<header->nFrames ||
+		header->format>Int16 || header->compression>Zstd)
+	{
+		cout<<filename<<" is truncated or was not closed!"<<endl;
+		close();
+		return false;
+	}
+	const Frame* index=(const Frame*)(pData+header->indexOffset);
+	uint64_t rawSize=(uint64_t)header->width*header->height*2*sampleSize((Format)header->format);
+	for(uint32_t i=0;i<header->nFrames;i++)
+		if(index[i].offset>fileSize || index[i].size>fileSize-index[i].offset || (header->compression==None && index[i].size!=rawSize))
+		{
+			cout<<"Frame "<<i<<" of "<<filename<<" is out of the file!"<<endl;
+			close();
+			return false;
+		}
+	pHeader=header;
+	pIndex=index;
+	return true;
+}
+
+void FlowClipReader::close()
+{
+#ifdef _LINUX_MAC
+	if(pData!=NULL)
+		munmap((void*)pData,fileSize);
+	if(fd>=0)
+		::close(fd);
+	fd=-1;
+#else
+	if(pData!=NULL)
+		UnmapViewOfFile(pData);
+	if(hMapping!=NULL)
+		CloseHandle(hMapping);
+	if(hFile!=NULL)
+		CloseHandle(hFile);
+	hFile=hMapping=NULL;
+#endif
+	pData=NULL;
+	fileSize=0;
+	pHeader=NULL;
+	pIndex=NULL;
+}
+
+const void* FlowClipReader::frameData(int index) const
+{
+	if(pHeader==NULL || index<0 || index>=(int)pHeader->nFrames || pHeader->compression!=None)
+		return NULL;
+	return pData+pIndex[index].offset;
+}
+
+template <class T>
+bool FlowClipReader::readFrame(int index,Image<T>& vx,Image<T>& vy) const
+{
+	if(pHeader==NULL || index<0 || index>=(int)pHeader->nFrames)
+	{
+		cout<<"Frame "<<index<<" is not in the clip!"<<endl;
+		return false;
+	}
+	const Frame& frame=pIndex[index];
+	const void* pStored=pData+frame.offset;
+	int width=pHeader->width,height=pHeader->height;
+	vector<char> buffer;
+#ifdef OPTICALFLOW_ZSTD
+	if(pHeader->compression==Zstd)
+	{
+		buffer.resize((size_t)width*height*2*sampleSize(format()));
+		size_t size=ZSTD_decompress(&buffer[0],buffer.size(),pStored,frame.size);
+		if(ZSTD_isError(size) || size!=buffer.size())
+		{
+			cout<<"Fail to decompress frame "<<index<<"!"<<endl;
+			return false;
+		}
+		pStored=&buffer[0];
+	}
+#else
+	if(pHeader->compression==Zstd)
+	{
+		cout<<"The clip is compressed with zstd, compile with OPTICALFLOW_ZSTD to read it!"<<endl;
+		return false;
+	}
+#endif
+	if(!vx.matchDimension(width,height,1))
+		vx.allocate(width,height);
+	if(!vy.matchDimension(width,height,1))
+		vy.allocate(width,height);
+	T *pVx=vx.data(),*pVy=vy.data();
+	int nPixels=width*height;
+	switch(pHeader->format)
+	{
+	case Float32:
+		{
+			const float* pSample=(const float*)pStored;
+			for(int i=0;i<nPixels;i++)
+			{
+				pVx[i]=pSample[i*2];
+				pVy[i]=pSample[i*2+1];
+			}
+		}
+		break;
+	case Float16:
+		{
+			const uint16_t* pSample=(const uint16_t*)pStored;
+			for(int i=0;i<nPixels;i++)
+			{
+				pVx[i]=FlowKernels::halfToFloat(pSample[i*2]);
+				pVy[i]=FlowKernels::halfToFloat(pSample[i*2+1]);
+			}
+		}
+		break;
+	case Int16:
+		{
+			const int16_t* pSample=(const int16_t*)pStored;
+			double scale=frame.scale;
+			for(int i=0;i<nPixels;i++)
+			{
+				pVx[i]=pSample[i*2]*scale;
+				pVy[i]=pSample[i*2+1]*scale;
+			}
+		}
+		break;
+	}
+	return true;
+}
+
+template bool FlowClipWriter::writeFrame<double>(const Image<double>& vx,const Image<double>& vy);
+template bool FlowClipWriter::writeFrame<float>(const Image<float>& vx,const Image<float>& vy);
+template bool FlowClipReader::readFrame<double>(int index,Image<double>& vx,Image<double>& vy) const;
+template bool FlowClipReader::readFrame<float>(int index,Image<float>& vx,Image<float>& vy) const;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Image.h"
+#include <fstream>
+#include <stdint.h>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// a seekable container of the flow fields of a whole clip. The header is followed by the frames, each one
+// the interleaved (vx,vy) samples of a frame pair, and by the index of the frames at the end of the file.
+// The samples are stored as float32, float16, or int16 quantized with a scale per frame, and each frame
+// can be compressed on its own with zstd (compiled with OPTICALFLOW_ZSTD), so any frame is read without
+// touching the others. The file is little endian
+//--------------------------------------------------------------------------------------------------------
+class FlowClip
+{
+public:
+	enum Format {Float32=0,Float16=1,Int16=2};
+	enum Compression {None=0,Zstd=1};
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t width,height;
+		uint32_t format,compression;
+		uint32_t nFrames;
+		uint64_t indexOffset;	// 0 until the writer is closed
+	};
+	struct Frame
+	{
+		uint64_t offset,size;	// the bytes stored in the file, compressed or not
+		float scale;			// the flow is the int16 samples times scale, 1 for the other formats
+		uint32_t reserved;
+	};
+	static const char magic[8];
+	static const uint32_t version = 1;
+	static int sampleSize(Format format) {return (format==Float32)?4:2;};
+};
+
+//--------------------------------------------------------------------------------------------------------
+// writes the flow fields one frame after the other; the index is written by close()
+//--------------------------------------------------------------------------------------------------------
+class FlowClipWriter : public FlowClip
+{
+private:
+	std::ofstream file;
+	Header header;
+	std::vector<Frame> index;
+	std::vector<char> buffer,compressed;
+public:
+	FlowClipWriter() {};
+	~FlowClipWriter() {close();};
+	bool open(const char* filename,int width,int height,Format format=Float16,Compression compression=None);
+	template <class T>
+	bool writeFrame(const Image<T>& vx,const Image<T>& vy);
+	bool close();
+	inline int nframes() const {return index.size();};
+};
+
+//--------------------------------------------------------------------------------------------------------
+// maps the whole file into memory, so that the frames are read at random without parsing the file. The
+// reads are const and can be made from several threads
+//--------------------------------------------------------------------------------------------------------
+class FlowClipReader : public FlowClip
+{
+private:
+	const unsigned char* pData;
+	size_t fileSize;
+	const Header* pHeader;
+	const Frame* pIndex;
+#ifdef _LINUX_MAC
+	int fd;
+#else
+	void *hFile,*hMapping;
+#endif
+public:
+	FlowClipReader();
+	~FlowClipReader() {close();};
+	bool open(const char* filename);
+	void close();
+	inline bool IsOpen() const {return pHeader!=NULL;};
+	inline int nframes() const {return pHeader->nFrames;};
+	inline int width() const {return pHeader->width;};
+	inline int height() const {return pHeader->height;};
+	inline Format format() const {return (Format)pHeader->format;};
+	inline Compression compression() const {return (Compression)pHeader->compression;};
+	inline const Frame& frame(int index) const {return pIndex[index];};
+	// the stored samples of a frame in the mapped file, interleaved vx,vy; NULL if the frames are compressed
+	const void* frameData(int index) const;
+	template <class T>
+	bool readFrame(int index,Image<T>& vx,Image<T>& vy) const;
+};
@@ -0,0 +1,368 @@
+#include "FlowDepth.h"
+#include "ImageProcessing.h"
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+template <class T>
+FlowDepth<T>::FlowDepth(int _nMotionIterations,int _sampleStep,double _minParallax,double _temporalDecay,int _spatialRadius,
+								double _rangePercentile,double _rangeDecay)
+{
+	nMotionIterations=_nMotionIterations;
+	sampleStep=_sampleStep;
+	minParallax=_minParallax;
+	temporalDecay=_temporalDecay;
+	spatialRadius=_spatialRadius;
+	rangePercentile=_rangePercentile;
+	rangeDecay=_rangeDecay;
+	reset();
+}
+
+template <class T>
+void FlowDepth<T>::reset()
+{
+	width=height=0;
+	IsFirstFrame=true;
+	range=0;
+	for(int k=0;k<3;k++)
+		lastMotion.omega[k]=lastMotion.t[k]=0;
+	lastMotion.parallax=0;
+	history.clear();
+	warpedHistory.clear();
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the unit bearing of the center of pixel (x,y), longitude -pi..pi from left to right and latitude pi/2..-pi/2
+// from top to bottom
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void FlowDepth<T>::bearing(double* d,int x,int y,int width,int height)
+{
+	double theta=(x+0.5)/width*2*M_PI-M_PI;
+	double phi=M_PI/2-(y+0.5)/height*M_PI;
+	d[0]=cos(phi)*cos(theta);
+	d[1]=cos(phi)*sin(theta);
+	d[2]=sin(phi);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the displacement on the unit sphere of the flow (vx,vy) at bearing d: vx moves along the parallel by
+// cos(phi)*2pi/width radians per pixel and vy down the meridian by pi/height
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void FlowDepth<T>::sphericalFlow(double* delta,const double* d,double vx,double vy,int width,int height)
+{
+	double cosPhi=sqrt(d[0]*d[0]+d[1]*d[1]);
+	double east=vx*2*M_PI/width,south=vy*M_PI/height;
+	delta[0]=-d[1]*east+d[2]*d[0]/cosPhi*south;
+	delta[1]=d[0]*east+d[2]*d[1]/cosPhi*south;
+	delta[2]=-cosPhi*south;
+}
+
+static inline void cross(double* c,const double* a,const double* b)
+{
+	c[0]=a[1]*b[2]-a[2]*b[1];
+	c[1]=a[2]*b[0]-a[0]*b[2];
+	c[2]=a[0]*b[1]-a[1]*b[0];
+}
+
+static inline double dot(const double* a,const double* b)
+{
+	return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the 6x6 normal equations by Gaussian elimination with partial pivoting, false if singular
+//--------------------------------------------------------------------------------------------------------
+static bool solveNormalEquations(double* x,double A[6][6],double* b)
+{
+	for(int k=0;k<6;k++)
+	{
+		int pivot=k;
+		for(int i=k+1;i<6;i++)
+			if(fabs(A[i][k])>fabs(A[pivot][k]))
+				pivot=i;
+		if(fabs(A[pivot][k])<1E-30)
+			return false;
+		if(pivot!=k)
+		{
+			for(int j=0;j<6;j++)
+				swap(A[k][j],A[pivot][j]);
+			swap(b[k],b[pivot]);
+		}
+		for(int i=k+1;i<6;i++)
+		{
+			double f=A[i][k]/A[k][k];
+			for(int j=k;j<6;j++)
+				A[i][j]-=f*A[k][j];
+			b[i]-=f*b[k];
+		}
+	}
+	for(int k=5;k>=0;k--)
+	{
+		double sum=b[k];
+		for(int j=k+1;j<6;j++)
+			sum-=A[k][j]*x[j];
+		x[k]=sum/A[k][k];
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// least squares of the motion on the sampled pixels, weighted by cos(latitude) for the area they cover.
+// With rho fixed the flow is linear in (omega,t); with the motion fixed rho of each sample is its projection
+// on -(I-dd')t. The alternation starts from a constant rho, |t| is normalized to 1 after every solve and
+// its sign is chosen for a positive rho
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void FlowDepth<T>::estimateMotion(Motion& motion,const TImage& vx,const TImage& vy) const
+{
+	int w=vx.width(),h=vx.height(),step=__max(sampleStep,1);
+	vector<double> d,delta,weight,rho;
+	for(int i=step/2;i<h;i+=step)
+		for(int j=step/2;j<w;j+=step)
+		{
+			double dd[3],dl[3];
+			bearing(dd,j,i,w,h);
+			sphericalFlow(dl,dd,vx.data()[i*w+j],vy.data()[i*w+j],w,h);
+			d.insert(d.end(),dd,dd+3);
+			delta.insert(delta.end(),dl,dl+3);
+			weight.push_back(sqrt(dd[0]*dd[0]+dd[1]*dd[1]));
+		}
+	int nSamples=weight.size();
+	rho.assign(nSamples,1);
+	for(int k=0;k<3;k++)
+		motion.omega[k]=motion.t[k]=0;
+	motion.parallax=0;
+
+	for(int iter=0;iter<nMotionIterations;iter++)
+	{
+		double A[6][6]={{0}},b[6]={0},x[6];
+		for(int n=0;n<nSamples;n++)
+		{
+			const double* dd=&d[n*3];
+			// the columns of the 3x6 system: e_k x d for omega, -rho*(I-dd')e_k for t
+			double column[6][3];
+			for(int k=0;k<3;k++)
+			{
+				double e[3]={0,0,0};
+				e[k]=1;
+				cross(column[k],e,dd);
+				for(int l=0;l<3;l++)
+					column[k+3][l]=-rho[n]*(e[l]-dd[l]*dd[k]);
+			}
+			for(int k=0;k<6;k++)
+			{
+				for(int l=k;l<6;l++)
+					A[k][l]+=weight[n]*dot(column[k],column[l]);
+				b[k]+=weight[n]*dot(column[k],&delta[n*3]);
+			}
+		}
+		for(int k=0;k<6;k++)
+			for(int l=0;l<k;l++)
+				A[k][l]=A[l][k];
+		if(!solveNormalEquations(x,A,b))
+			break;
+		double tnorm=sqrt(dot(x+3,x+3));
+		for(int k=0;k<3;k++)
+		{
+			motion.omega[k]=x[k];
+			motion.t[k]=(tnorm>1E-12)?x[k+3]/tnorm:0;
+		}
+		if(tnorm<=1E-12)
+			break;
+
+		double sign=0;
+		for(int n=0;n<nSamples;n++)
+		{
+			const double* dd=&d[n*3];
+			double u[3],rotation[3],res[3];
+			double dt=dot(dd,motion.t);
+			cross(rotation,motion.omega,dd);
+			for(int l=0;l<3;l++)
+			{
+				u[l]=motion.t[l]-dd[l]*dt;
+				res[l]=delta[n*3+l]-rotation[l];
+			}
+			double uu=dot(u,u);
+			if(uu>1E-6)
+				rho[n]=-dot(res,u)/uu;
+			sign+=weight[n]*rho[n]*uu;
+		}
+		if(sign<0)
+		{
+			for(int k=0;k<3;k++)
+				motion.t[k]=-motion.t[k];
+			for(int n=0;n<nSamples;n++)
+				rho[n]=-rho[n];
+		}
+	}
+
+	double sum=0,sumWeight=0;
+	for(int n=0;n<nSamples;n++)
+	{
+		const double* dd=&d[n*3];
+		double dt=dot(dd,motion.t),u[3];
+		for(int l=0;l<3;l++)
+			u[l]=motion.t[l]-dd[l]*dt;
+		sum+=weight[n]*rho[n]*rho[n]*dot(u,u);
+		sumWeight+=weight[n];
+	}
+	motion.parallax=(sumWeight>0)?sqrt(sum/sumWeight)*w/(2*M_PI):0;
+	if(motion.parallax<minParallax)
+		for(int k=0;k<3;k++)
+			motion.t[k]=0;
+}
+
+template <class T>
+void FlowDepth<T>::inverseDepth(TImage& rho,TImage& confidence,const TImage& vx,const TImage& vy,const Motion& motion) const
+{
+	int w=vx.width(),h=vx.height();
+	if(!rho.matchDimension(w,h,1))
+		rho.allocate(w,h);
+	if(!confidence.matchDimension(w,h,1))
+		confidence.allocate(w,h);
+	bool IsTranslation=dot(motion.t,motion.t)>0;
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)w*h>65536)
+#endif
+	for(int i=0;i<h;i++)
+		for(int j=0;j<w;j++)
+		{
+			int offset=i*w+j;
+			if(!IsTranslation)
+			{
+				rho.data()[offset]=confidence.data()[offset]=0;
+				continue;
+			}
+			double d[3],delta[3],rotation[3],u[3];
+			bearing(d,j,i,w,h);
+			sphericalFlow(delta,d,vx.data()[offset],vy.data()[offset],w,h);
+			cross(rotation,motion.omega,d);
+			double dt=dot(d,motion.t),ru=0,uu=0;
+			for(int l=0;l<3;l++)
+			{
+				u[l]=motion.t[l]-d[l]*dt;
+				ru+=(delta[l]-rotation[l])*u[l];
+				uu+=u[l]*u[l];
+			}
+			rho.data()[offset]=(uu>1E-6)?__max(-ru/uu,0):0;
+			confidence.data()[offset]=uu;
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the history of frame i-1 moved to frame i by the flow between them: pixel x of frame i came from about
+// x-v(x), sampled bilinearly with the left and right borders adjacent
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void FlowDepth<T>::warpHistory(const TImage& vx,const TImage& vy)
+{
+	warpedHistory.assign(history.size(),0);
+	const double* pHistory=&history[0];
+	double* pWarped=&warpedHistory[0];
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height>65536)
+#endif
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double x=j-vx.data()[offset],y=i-vy.data()[offset];
+			x-=floor(x/width)*width;
+			y=__max(__min(y,height-1),0);
+			ImageProcessing::BilinearInterpolate(pHistory,width,height,2,x,y,pWarped+offset*2,true);
+		}
+}
+
+template <class T>
+void FlowDepth<T>::addFrame(const TImage& vx,const TImage& vy,BiImage& depth8)
+{
+	if(vx.width()!=width || vx.height()!=height)
+	{
+		reset();
+		width=vx.width();
+		height=vx.height();
+	}
+	int nPixels=width*height;
+	bool IsParallel=(double)nPixels>65536;
+	Motion motion;
+	estimateMotion(motion,vx,vy);
+	TImage rho,confidence;
+	inverseDepth(rho,confidence,vx,vy,motion);
+
+	// the scale of t is arbitrary, so rho of every frame pair is normalized by its confident median
+	vector<double> samples;
+	for(int i=0;i<nPixels;i+=__max(sampleStep,1))
+		if(confidence.data()[i]>0.01)
+			samples.push_back(rho.data()[i]);
+	double median=0;
+	if(!samples.empty())
+	{
+		nth_element(samples.begin(),samples.begin()+samples.size()/2,samples.end());
+		median=samples[samples.size()/2];
+	}
+	double scale=(median>0)?1/median:0;
+
+	if(IsFirstFrame)
+		history.assign(nPixels*2,0);
+	else
+		warpHistory(lastVx,lastVy);
+	const double* pWarped=IsFirstFrame?NULL:&warpedHistory[0];
+	double* pHistory=&history[0];
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<nPixels;i++)
+	{
+		double c=(scale>0)?confidence.data()[i]:0;
+		double previous[2]={0,0};
+		if(pWarped!=NULL)
+		{
+			previous[0]=pWarped[i*2]*temporalDecay;
+			previous[1]=pWarped[i*2+1]*temporalDecay;
+		}
+		pHistory[i*2]=previous[0]+c*rho.data()[i]*scale;
+		pHistory[i*2+1]=previous[1]+c;
+	}
+
+	// the normalized convolution of the history fills the pixels of low confidence from their neighbors
+	vector<double> smoothed(history);
+	if(spatialRadius>0)
+		ImageProcessing::boxfiltering(&smoothed[0],width,height,2,spatialRadius);
+	TImage smoothRho(width,height);
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<nPixels;i++)
+		smoothRho.data()[i]=(smoothed[i*2+1]>1E-6)?smoothed[i*2]/smoothed[i*2+1]:0;
+
+	samples.clear();
+	for(int i=0;i<nPixels;i+=__max(sampleStep,1))
+		if(smoothed[i*2+1]>1E-6)
+			samples.push_back(smoothRho.data()[i]);
+	if(!samples.empty())
+	{
+		size_t k=__min((size_t)(samples.size()*rangePercentile),samples.size()-1);
+		nth_element(samples.begin(),samples.begin()+k,samples.end());
+		range=(range>0)?rangeDecay*range+(1-rangeDecay)*samples[k]:samples[k];
+	}
+
+	if(!depth8.matchDimension(width,height,1))
+		depth8.allocate(width,height);
+	double factor=(range>0)?255/range:0;
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<nPixels;i++)
+		depth8.data()[i]=__min(smoothRho.data()[i]*factor+0.5,255);
+
+	lastVx.copyData(vx);
+	lastVy.copyData(vy);
+	lastMotion=motion;
+	IsFirstFrame=false;
+}
+
+template class FlowDepth<double>;
+template class FlowDepth<float>;
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Image.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the inverse depth of equirectangular frames from the flow between consecutive frames, the stage after
+// Coarse2FineFlow that feeds the <name>_depth.mp4 of the viewer. The flow of a static point at bearing d
+// and inverse depth rho is, on the unit sphere,
+//
+//     delta(d) = omega x d - rho*(I-dd')t
+//
+// for the rotation omega and the translation t of the camera. The camera motion is estimated from the
+// flow by least squares alternated with rho, the rotation is removed and rho of every pixel is the
+// parallax along the direction away from t. The parallax vanishes towards the epipoles (+-t), so every
+// rho comes with the confidence |(I-dd')t|^2, and rho is accumulated over time along the flow with these
+// confidences. The scale of t is lost, rho is normalized to a median of 1 per frame and quantized to 8 bits
+// against a smoothed high percentile, 255 the nearest
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class FlowDepth
+{
+public:
+	typedef Image<T> TImage;
+
+	struct Motion
+	{
+		double omega[3];	// the rotation, radians per frame
+		double t[3];		// the direction of the translation, unit or 0 without parallax
+		double parallax;	// the rms parallax of the translation in pixels
+	};
+
+	int nMotionIterations;		// the alternations of the motion and rho
+	int sampleStep;				// the motion is estimated on every sampleStep-th pixel of every sampleStep-th row
+	double minParallax;			// the rms parallax in pixels below which a frame pair gives no depth
+	double temporalDecay;		// the weight of the accumulated history against a new frame pair
+	int spatialRadius;			// the radius of the confidence-weighted box filter of rho, 0 for none
+	double rangePercentile;		// rho of this percentile is quantized to 255
+	double rangeDecay;			// the weight of the previous range against the range of a new frame pair
+private:
+	int width,height;
+	bool IsFirstFrame;
+	double range;
+	Motion lastMotion;
+	// the accumulated (confidence*rho, confidence) and the flow that moves them to the next frame
+	std::vector<double> history,warpedHistory;
+	TImage lastVx,lastVy;
+public:
+	FlowDepth(int _nMotionIterations=5,int _sampleStep=4,double _minParallax=0.05,double _temporalDecay=0.8,int _spatialRadius=2,
+					double _rangePercentile=0.99,double _rangeDecay=0.9);
+	void reset();
+	const Motion& motion() const{return lastMotion;};
+
+	// the camera motion of the flow (vx,vy) from frame i to frame i+1
+	void estimateMotion(Motion& motion,const TImage& vx,const TImage& vy) const;
+	// rho and its confidence in frame i from the flow and its motion
+	void inverseDepth(TImage& rho,TImage& confidence,const TImage& vx,const TImage& vy,const Motion& motion) const;
+	// the next frame pair of a sequence, depth8 the smoothed inverse depth of frame i quantized to 8 bits
+	void addFrame(const TImage& vx,const TImage& vy,BiImage& depth8);
+private:
+	static void bearing(double* d,int x,int y,int width,int height);
+	static void sphericalFlow(double* delta,const double* d,double vx,double vy,int width,int height);
+	void warpHistory(const TImage& vx,const TImage& vy);
+};
+
+typedef FlowDepth<double> DFlowDepth;
+typedef FlowDepth<float> FFlowDepth;
@@ -0,0 +1,210 @@
+#include "FlowFarm.h"
+#include <sys/stat.h>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+#ifdef _LINUX_MAC
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+using namespace std;
+
+FlowFarm::FlowFarm(double _leaseSeconds)
+{
+	leaseSeconds=_leaseSeconds;
+	nPairs=0;
+	chunkPairs=1;
+}
+
+string FlowFarm::path(const char* name,int k) const
+{
+	char filename[64];
+	if(k>=0)
+		sprintf(filename,name,k);
+	else
+		sprintf(filename,"%s",name);
+	return directory+"/"+filename;
+}
+
+// a name of this process for its temporary files
+static string processSuffix()
+{
+	char suffix[32];
+	sprintf(suffix,".%d",(int)getpid());
+	return suffix;
+}
+
+string FlowFarm::segmentName(const string& filename,int index)
+{
+	char suffix[32];
+	sprintf(suffix,".%05d",index);
+	size_t dot=filename.find_last_of('.');
+	size_t slash=filename.find_last_of("/\\");
+	if(dot==string::npos || (slash!=string::npos && dot<slash))
+		return filename+suffix;
+	return filename.substr(0,dot)+suffix+filename.substr(dot);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// fopen with "x" fails if the file exists, an atomic test and create on the local and the network file
+// systems. The file holds the process that created it and the time, for the logs and the leases
+//--------------------------------------------------------------------------------------------------------
+bool FlowFarm::createExclusive(const string& filename) const
+{
+	FILE* file=fopen(filename.c_str(),"wx");
+	if(file==NULL)
+		return false;
+	fprintf(file,"%d %ld\n",(int)getpid(),(long)time(NULL));
+	fclose(file);
+	return true;
+}
+
+bool FlowFarm::open(const char* _directory,int _nPairs,int _chunkPairs)
+{
+	directory=_directory;
+	string planName=path("plan.txt");
+	string temporary=planName+processSuffix();
+	{
+		ofstream plan(temporary.c_str());
+		plan<<_nPairs<<" "<<_chunkPairs<<endl;
+	}
+	// the complete plan of the first worker is moved in place, link and rename failing if it's there; the
+	// other workers follow it
+#ifdef _LINUX_MAC
+	link(temporary.c_str(),planName.c_str());
+#else
+	rename(temporary.c_str(),planName.c_str());
+#endif
+	remove(temporary.c_str());
+	ifstream plan(planName.c_str());
+	if(!(plan>>nPairs>>chunkPairs) || chunkPairs<1)
+	{
+		cout<<"Fail to read the plan of "<<directory<<"!"<<endl;
+		return false;
+	}
+	if(nPairs!=_nPairs)
+	{
+		cout<<"The plan of "<<directory<<" has "<<nPairs<<" pairs, the clip "<<_nPairs<<"!"<<endl;
+		return false;
+	}
+	return true;
+}
+
+void FlowFarm::chunkRange(int k,int& first,int& end) const
+{
+	first=k*chunkPairs;
+	end=__min(first+chunkPairs,nPairs);
+}
+
+bool FlowFarm::IsDone(int k) const
+{
+	struct stat status;
+	return stat(path("chunk_%05d.done",k).c_str(),&status)==0;
+}
+
+int FlowFarm::nDone() const
+{
+	int n=0;
+	for(int k=0;k<nchunks();k++)
+		n+=IsDone(k);
+	return n;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// an expired lease is renamed away first: only one worker succeeds, and it creates the lock again
+//--------------------------------------------------------------------------------------------------------
+int FlowFarm::claim()
+{
+	for(int k=0;k<nchunks();k++)
+	{
+		if(IsDone(k))
+			continue;
+		string lock=path("chunk_%05d.lock",k);
+		if(createExclusive(lock))
+			return k;
+		struct stat status;
+		if(stat(lock.c_str(),&status)!=0 || difftime(time(NULL),status.st_mtime)<leaseSeconds)
+			continue;
+		string expired=lock+processSuffix();
+		if(rename(lock.c_str(),expired.c_str())==0)
+		{
+			remove(expired.c_str());
+			cout<<"Taking over the expired lease of chunk "<<k<<endl;
+			if(createExclusive(lock))
+				return k;
+		}
+	}
+	return -1;
+}
+
+void FlowFarm::renew(int k) const
+{
+	FILE* file=fopen(path("chunk_%05d.lock",k).c_str(),"w");
+	if(file==NULL)
+		return;
+	fprintf(file,"%d %ld\n",(int)getpid(),(long)time(NULL));
+	fclose(file);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the worker of an expired lease may still be writing, so the clip of a chunk is written under the name of
+// the process and renamed in place when the chunk is done
+//--------------------------------------------------------------------------------------------------------
+bool FlowFarm::complete(int k) const
+{
+	if(IsDone(k))
+	{
+		cout<<"Chunk "<<k<<" is already done!"<<endl;
+		remove(workClipName(k).c_str());
+		return false;
+	}
+	remove(clipName(k).c_str());
+	if(rename(workClipName(k).c_str(),clipName(k).c_str())!=0 || !createExclusive(path("chunk_%05d.done",k)))
+	{
+		cout<<"Fail to complete chunk "<<k<<"!"<<endl;
+		return false;
+	}
+	remove(path("chunk_%05d.lock",k).c_str());
+	return true;
+}
+
+string FlowFarm::clipName(int k) const
+{
+	int first,end;
+	chunkRange(k,first,end);
+	return segmentName(directory+"/flow.clip",first);
+}
+
+string FlowFarm::workClipName(int k) const
+{
+	return clipName(k)+processSuffix();
+}
+
+bool FlowFarm::mergeClips(const char* filename) const
+{
+	if(nDone()<nchunks() || !createExclusive(path("merge.lock")))
+		return false;
+	cout<<"Merging "<<nchunks()<<" chunks into "<<filename<<endl;
+	FlowClipWriter writer;
+	FImage vx,vy;
+	for(int k=0;k<nchunks();k++)
+	{
+		FlowClipReader reader;
+		if(!reader.open(clipName(k).c_str()))
+		{
+			cout<<"Fail to open "<<clipName(k)<<"!"<<endl;
+			return false;
+		}
+		if(k==0 && !writer.open(filename,reader.width(),reader.height(),reader.format(),reader.compression()))
+			return false;
+		for(int i=0;i<reader.nframes();i++)
+			if(!reader.readFrame(i,vx,vy) || !writer.writeFrame(vx,vy))
+				return false;
+	}
+	return writer.close();
+}
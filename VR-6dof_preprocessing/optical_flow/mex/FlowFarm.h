@@ -0,0 +1,46 @@
+#pragma once
+
+#include "FlowClip.h"
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------
+// the pairs of a clip split into chunks that worker processes on several machines solve through a shared
+// directory. The directory is the coordinator: plan.txt fixes the chunks, a worker leases a chunk by
+// creating chunk_%05d.lock exclusively, renews the lease while it works and marks the chunk with
+// chunk_%05d.done. A lease not renewed for leaseSeconds belongs to a lost worker and is taken over. The
+// files are only created, renamed and removed, so no process but the workers is needed, and the chunks
+// are independent because so are the pairs of Coarse2FineFlow.
+//
+// The workers write the flow of a chunk to a clip of its own in the directory, flow.%05d.clip after its
+// first pair, renamed in place by complete(). The next chunk reads the flow at the end of it to warm up
+// the sinks that smooth over time, and mergeClips() joins them into the clip of the whole video
+//--------------------------------------------------------------------------------------------------------
+class FlowFarm
+{
+public:
+	std::string directory;
+	int nPairs,chunkPairs;
+	double leaseSeconds;
+public:
+	FlowFarm(double _leaseSeconds=600);
+	// creates the plan of the clip, or reads the plan of another worker; false if they don't match
+	bool open(const char* _directory,int _nPairs,int _chunkPairs);
+	inline int nchunks() const {return (nPairs+chunkPairs-1)/chunkPairs;};
+	void chunkRange(int k,int& first,int& end) const;
+	// leases a chunk neither done nor leased, the first one in order; -1 when there is none
+	int claim();
+	void renew(int k) const;
+	bool complete(int k) const;
+	bool IsDone(int k) const;
+	int nDone() const;
+	// the clip of the flow of chunk k, and the one this process writes until the chunk is done
+	std::string clipName(int k) const;
+	std::string workClipName(int k) const;
+	// the clips of all the chunks joined in order into filename, by the one worker that takes merge.lock
+	bool mergeClips(const char* filename) const;
+	// the name of the segment of a file from pair index on, the index inserted before the extension
+	static std::string segmentName(const std::string& filename,int index);
+private:
+	std::string path(const char* name,int k=-1) const;
+	bool createExclusive(const std::string& filename) const;
+};
@@ -0,0 +1,1245 @@
+#ifndef _FlowKernels_h
+#define _FlowKernels_h
+
+#include "math.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define _FLOW_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define _FLOW_TARGET_AVX
+		#define _FLOW_TARGET_F16C
+		#define _FLOW_TARGET_AVX2
+	#else
+		#include <cpuid.h>
+		#define _FLOW_TARGET_AVX __attribute__((target("avx")))
+		#define _FLOW_TARGET_F16C __attribute__((target("avx,f16c")))
+		#define _FLOW_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#elif defined(__aarch64__)
+	#define _FLOW_NEON
+	#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+	#define _FLOW_WASM
+	#include <wasm_simd128.h>
+#endif
+
+//----------------------------------------------------------------------------------
+// class to hold the vectorized per-pixel kernels of the optical flow solvers
+// every kernel has a scalar reference version and SIMD versions for double and float; the SIMD level is
+// detected once at runtime (AVX, SSE2 on x86, NEON on arm64, SIMD128 in WebAssembly built with -msimd128)
+// and used by dispatch
+//----------------------------------------------------------------------------------
+
+class FlowKernels
+{
+public:
+	enum SIMDLevel {Scalar,SSE2,AVX,NEON,SIMD128};
+
+	//---------------------------------------------------------------------------------
+	// runtime detection of the instruction set, computed once
+	//---------------------------------------------------------------------------------
+	static inline SIMDLevel simdLevel()
+	{
+		static SIMDLevel level = detectSIMDLevel();
+		return level;
+	}
+
+	static inline SIMDLevel detectSIMDLevel()
+	{
+#if defined(_FLOW_X86)
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info,1);
+		bool osxsave = (info[2] & (1<<27))!=0;
+		bool avx = (info[2] & (1<<28))!=0;
+		// the OS has to save the ymm registers as well
+		if(osxsave && avx && (_xgetbv(0) & 6)==6)
+			return AVX;
+		return SSE2;
+	#else
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx"))
+			return AVX;
+		return SSE2;
+	#endif
+#elif defined(_FLOW_NEON)
+		return NEON;
+#elif defined(_FLOW_WASM)
+		return SIMD128;
+#else
+		return Scalar;
+#endif
+	}
+
+	//---------------------------------------------------------------------------------
+	// weight of the flow smoothness term, in double or single precision
+	//     phi = 0.5/sqrt(ux^2+uy^2+vx^2+vy^2+varepsilon)
+	//---------------------------------------------------------------------------------
+	static inline void RobustPhi(double* phi,const double* ux,const double* uy,const double* vx,const double* vy,int nPixels,double varepsilon)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			RobustPhi_AVX(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+		case SSE2:
+			RobustPhi_SSE2(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			RobustPhi_NEON(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			RobustPhi_SIMD128(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#endif
+		default:
+			RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,0);
+		}
+	}
+
+	static inline void RobustPhi(float* phi,const float* ux,const float* uy,const float* vx,const float* vy,int nPixels,double varepsilon)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			RobustPhi_AVX(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+		case SSE2:
+			RobustPhi_SSE2(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			RobustPhi_NEON(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			RobustPhi_SIMD128(phi,ux,uy,vx,vy,nPixels,varepsilon);
+			return;
+#endif
+		default:
+			RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,0);
+		}
+	}
+
+	template <class T>
+	static inline void RobustPhi_Scalar(T* phi,const T* ux,const T* uy,const T* vx,const T* vy,int nPixels,double varepsilon,int start)
+	{
+		for(int i=start;i<nPixels;i++)
+		{
+			double temp=(double)ux[i]*ux[i]+(double)uy[i]*uy[i]+(double)vx[i]*vx[i]+(double)vy[i]*vy[i];
+			phi[i] = 0.5/sqrt(temp+varepsilon);
+		}
+	}
+
+	//---------------------------------------------------------------------------------
+	// Laplacian weight of the data term for channel k of an interleaved image
+	//     psi = scale/sqrt((imdt+imdx*du+imdy*dv)^2+varepsilon)
+	//---------------------------------------------------------------------------------
+	static inline void RobustLapPsi(double* psi,const double* imdt,const double* imdx,const double* imdy,const double* du,const double* dv,
+																int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			RobustLapPsi_AVX(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+		case SSE2:
+			RobustLapPsi_SSE2(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			RobustLapPsi_NEON(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			RobustLapPsi_SIMD128(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#endif
+		default:
+			RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,0);
+		}
+	}
+
+	static inline void RobustLapPsi(float* psi,const float* imdt,const float* imdx,const float* imdy,const float* du,const float* dv,
+																int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			RobustLapPsi_AVX(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+		case SSE2:
+			RobustLapPsi_SSE2(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			RobustLapPsi_NEON(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			RobustLapPsi_SIMD128(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon);
+			return;
+#endif
+		default:
+			RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,0);
+		}
+	}
+
+	template <class T>
+	static inline void RobustLapPsi_Scalar(T* psi,const T* imdt,const T* imdx,const T* imdy,const T* du,const T* dv,
+																			int nPixels,int nChannels,int k,double scale,double varepsilon,int start)
+	{
+		for(int i=start;i<nPixels;i++)
+		{
+			int offset=i*nChannels+k;
+			double temp=(double)imdt[offset]+(double)imdx[offset]*du[i]+(double)imdy[offset]*dv[i];
+			psi[offset]=scale/sqrt(temp*temp+varepsilon);
+		}
+	}
+
+	//---------------------------------------------------------------------------------
+	// a row of the weighted 5-point Laplacian of one or two flow components, in one pass over the rows above
+	// and below: out(j) = -w(j)*(in(j+1)-in(j)) + w(j-1)*(in(j)-in(j-1)) - w(j)*(in(j+width)-in(j))
+	// + w(j-width)*(in(j)-in(j-width)), every term an edge of the image. The rows are width apart, IsUp and
+	// IsDown whether the row has a row above and below, IsWrap whether the last and the first column are
+	// adjacent. The weight is loaded once for both components; out2 and in2 are NULL for one component. The
+	// terms are added in the same order in every version, so the result doesn't depend on the SIMD level
+	//---------------------------------------------------------------------------------
+	static inline void LaplacianRow(double* out1,double* out2,const double* in1,const double* in2,const double* weight,int width,
+															bool IsUp,bool IsDown,bool IsWrap)
+	{
+		int end=1;
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			end=LaplacianRow_AVX(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+		case SSE2:
+			end=LaplacianRow_SSE2(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			end=LaplacianRow_NEON(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			end=LaplacianRow_SIMD128(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#endif
+		default:
+			break;
+		}
+		LaplacianRow_Scalar(out1,out2,in1,in2,weight,width,IsUp,IsDown,IsWrap,end);
+	}
+
+	static inline void LaplacianRow(float* out1,float* out2,const float* in1,const float* in2,const float* weight,int width,
+															bool IsUp,bool IsDown,bool IsWrap)
+	{
+		int end=1;
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			end=LaplacianRow_AVX(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+		case SSE2:
+			end=LaplacianRow_SSE2(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			end=LaplacianRow_NEON(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			end=LaplacianRow_SIMD128(out1,out2,in1,in2,weight,width,IsUp,IsDown);
+			break;
+#endif
+		default:
+			break;
+		}
+		LaplacianRow_Scalar(out1,out2,in1,in2,weight,width,IsUp,IsDown,IsWrap,end);
+	}
+
+	template <class T>
+	static inline T LaplacianPixel(const T* in,const T* weight,int width,bool IsUp,bool IsDown,bool IsWrap,int j)
+	{
+		T out=0;
+		if(j<width-1)
+			out-=(in[j+1]-in[j])*weight[j];
+		if(j>0)
+			out+=(in[j]-in[j-1])*weight[j-1];
+		if(IsWrap && j==width-1)
+			out-=(in[0]-in[j])*weight[j];
+		if(IsWrap && j==0)
+			out+=(in[0]-in[width-1])*weight[width-1];
+		if(IsDown)
+			out-=(in[j+width]-in[j])*weight[j];
+		if(IsUp)
+			out+=(in[j]-in[j-width])*weight[j-width];
+		return out;
+	}
+
+	// the first column and the columns from start on, those the SIMD versions leave
+	template <class T>
+	static inline void LaplacianRow_Scalar(T* out1,T* out2,const T* in1,const T* in2,const T* weight,int width,bool IsUp,bool IsDown,bool IsWrap,int start)
+	{
+		for(int j=0;j<width;j=(j==0 && start>1)?start:j+1)
+		{
+			out1[j]=LaplacianPixel(in1,weight,width,IsUp,IsDown,IsWrap,j);
+			if(out2!=NULL)
+				out2[j]=LaplacianPixel(in2,weight,width,IsUp,IsDown,IsWrap,j);
+		}
+	}
+
+	//---------------------------------------------------------------------------------
+	// the dot product of two vectors and y += a*x, the kernels of the dense Vector and Matrix (see
+	// Matrix::Multiply and ConjugateGradient) and of CStochastic::ComputeMeanCovariance. The SIMD versions are
+	// for double, the other types take the scalar ones; the products are summed in the lanes of the SIMD level,
+	// so a dot product may differ from the scalar one in the last bits
+	//---------------------------------------------------------------------------------
+	template <class T1,class T2>
+	static inline double Dot(const T1* a,const T2* b,int n)
+	{
+		return Dot_Scalar(a,b,n,0);
+	}
+
+	static inline double Dot(const double* a,const double* b,int n)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			return Dot_AVX(a,b,n);
+		case SSE2:
+			return Dot_SSE2(a,b,n);
+#elif defined(_FLOW_NEON)
+		case NEON:
+			return Dot_NEON(a,b,n);
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			return Dot_SIMD128(a,b,n);
+#endif
+		default:
+			return Dot_Scalar(a,b,n,0);
+		}
+	}
+
+	template <class T1,class T2>
+	static inline double Dot_Scalar(const T1* a,const T2* b,int n,int start)
+	{
+		double result=0;
+		for(int i=start;i<n;i++)
+			result+=(double)a[i]*b[i];
+		return result;
+	}
+
+	template <class T1,class T2>
+	static inline void Axpy(T1* y,const T2* x,double a,int n)
+	{
+		Axpy_Scalar(y,x,a,n,0);
+	}
+
+	static inline void Axpy(double* y,const double* x,double a,int n)
+	{
+		switch(simdLevel())
+		{
+#if defined(_FLOW_X86)
+		case AVX:
+			Axpy_AVX(y,x,a,n);
+			return;
+		case SSE2:
+			Axpy_SSE2(y,x,a,n);
+			return;
+#elif defined(_FLOW_NEON)
+		case NEON:
+			Axpy_NEON(y,x,a,n);
+			return;
+#elif defined(_FLOW_WASM)
+		case SIMD128:
+			Axpy_SIMD128(y,x,a,n);
+			return;
+#endif
+		default:
+			Axpy_Scalar(y,x,a,n,0);
+		}
+	}
+
+	template <class T1,class T2>
+	static inline void Axpy_Scalar(T1* y,const T2* x,double a,int n,int start)
+	{
+		for(int i=start;i<n;i++)
+			y[i]+=a*x[i];
+	}
+
+	//---------------------------------------------------------------------------------
+	// conversion between float or double and IEEE half precision, rounded to the nearest even: 8 samples per
+	// instruction with F16C on x86 (with AVX, detected once), 4 with NEON on arm64, one by one otherwise
+	//---------------------------------------------------------------------------------
+	static inline bool hasF16C()
+	{
+		static bool f16c = detectF16C();
+		return f16c;
+	}
+
+	static inline bool detectF16C()
+	{
+#if defined(_FLOW_X86)
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info,1);
+		return simdLevel()==AVX && (info[2] & (1<<29))!=0;
+	#else
+		unsigned int eax,ebx,ecx,edx;
+		if(!__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+			return false;
+		return simdLevel()==AVX && (ecx & (1u<<29))!=0;
+	#endif
+#else
+		return false;
+#endif
+	}
+
+	template <class T>
+	static inline void FloatToHalf(uint16_t* half,const T* value,size_t n)
+	{
+		size_t i=0;
+#if defined(_FLOW_X86)
+		if(hasF16C())
+			i=FloatToHalf_F16C(half,value,n);
+#elif defined(_FLOW_NEON)
+		i=FloatToHalf_NEON(half,value,n);
+#endif
+		for(;i<n;i++)
+			half[i]=floatToHalf((float)value[i]);
+	}
+
+	template <class T>
+	static inline void HalfToFloat(T* value,const uint16_t* half,size_t n)
+	{
+		size_t i=0;
+#if defined(_FLOW_X86)
+		if(hasF16C())
+			i=HalfToFloat_F16C(value,half,n);
+#elif defined(_FLOW_NEON)
+		i=HalfToFloat_NEON(value,half,n);
+#endif
+		for(;i<n;i++)
+			value[i]=(T)halfToFloat(half[i]);
+	}
+
+	//---------------------------------------------------------------------------------
+	// the blend of the bilinear interpolation of a block of one channel samples, see
+	// ImageProcessing::BilinearInterpolateRow: the four neighbours of sample j at the offsets
+	// offsets[m*stride+j] of pImage, of the weights weights[m*stride+j], are added to result[j] in
+	// the order m=0..3 and in double. With AVX2 (detected once) the neighbours of 4 samples are
+	// gathered at once. Returns the samples blended, the rest is left to the scalar loop
+	//---------------------------------------------------------------------------------
+	static inline bool hasAVX2()
+	{
+		static bool avx2 = detectAVX2();
+		return avx2;
+	}
+
+	static inline bool detectAVX2()
+	{
+#if defined(_FLOW_X86)
+	#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info,7,0);
+		return simdLevel()==AVX && (info[1] & (1<<5))!=0;
+	#else
+		__builtin_cpu_init();
+		return simdLevel()==AVX && __builtin_cpu_supports("avx2");
+	#endif
+#else
+		return false;
+#endif
+	}
+
+	template <class T1,class T2>
+	static inline int BilinearGather(T2*,const T1*,const int*,const double*,int,int)
+	{
+		return 0;
+	}
+
+	static inline int BilinearGather(double* result,const double* pImage,const int* offsets,const double* weights,int n,int stride)
+	{
+#if defined(_FLOW_X86)
+		if(hasAVX2())
+			return BilinearGather_AVX2(result,pImage,offsets,weights,n,stride);
+#endif
+		return 0;
+	}
+
+	static inline int BilinearGather(float* result,const float* pImage,const int* offsets,const double* weights,int n,int stride)
+	{
+#if defined(_FLOW_X86)
+		if(hasAVX2())
+			return BilinearGather_AVX2(result,pImage,offsets,weights,n,stride);
+#endif
+		return 0;
+	}
+
+	static inline uint16_t floatToHalf(float value)
+	{
+		uint32_t x;
+		memcpy(&x,&value,4);
+		uint32_t sign=(x>>16)&0x8000,mantissa=x&0x7fffff;
+		int exponent=(int)((x>>23)&0xff);
+		if(exponent==0xff)
+			return sign|0x7c00|(mantissa?0x200:0);
+		exponent+=15-127;
+		if(exponent>=31)
+			return sign|0x7c00;
+		uint32_t half,rest,halfway;
+		if(exponent<=0)
+		{
+			// subnormal
+			if(exponent<-10)
+				return sign;
+			mantissa|=0x800000;
+			int shift=14-exponent;
+			half=mantissa>>shift;
+			rest=mantissa&((1u<<shift)-1);
+			halfway=1u<<(shift-1);
+		}
+		else
+		{
+			half=(exponent<<10)|(mantissa>>13);
+			rest=mantissa&0x1fff;
+			halfway=0x1000;
+		}
+		// a carry of the mantissa moves to the exponent, which is still the correct rounding
+		if(rest>halfway || (rest==halfway && (half&1)))
+			half++;
+		return sign|half;
+	}
+
+	static inline float halfToFloat(uint16_t h)
+	{
+		uint32_t sign=(uint32_t)(h&0x8000)<<16,exponent=(h>>10)&0x1f,mantissa=h&0x3ff,x;
+		if(exponent==0)
+		{
+			if(mantissa==0)
+				x=sign;
+			else
+			{
+				// subnormal, normalize it
+				exponent=127-15+1;
+				while(!(mantissa&0x400))
+				{
+					mantissa<<=1;
+					exponent--;
+				}
+				x=sign|(exponent<<23)|((mantissa&0x3ff)<<13);
+			}
+		}
+		else if(exponent==31)
+			x=sign|0x7f800000|(mantissa<<13);
+		else
+			x=sign|((exponent+127-15)<<23)|(mantissa<<13);
+		float value;
+		memcpy(&value,&x,4);
+		return value;
+	}
+
+#if defined(_FLOW_X86)
+	// the samples converted, the rest is left to the scalar loop
+	static _FLOW_TARGET_F16C size_t FloatToHalf_F16C(uint16_t* half,const float* value,size_t n)
+	{
+		size_t i=0;
+		for(;i+8<=n;i+=8)
+			_mm_storeu_si128((__m128i*)(half+i),_mm256_cvtps_ph(_mm256_loadu_ps(value+i),_MM_FROUND_TO_NEAREST_INT));
+		return i;
+	}
+
+	static _FLOW_TARGET_F16C size_t FloatToHalf_F16C(uint16_t* half,const double* value,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+			_mm_storel_epi64((__m128i*)(half+i),_mm_cvtps_ph(_mm256_cvtpd_ps(_mm256_loadu_pd(value+i)),_MM_FROUND_TO_NEAREST_INT));
+		return i;
+	}
+
+	static _FLOW_TARGET_F16C size_t HalfToFloat_F16C(float* value,const uint16_t* half,size_t n)
+	{
+		size_t i=0;
+		for(;i+8<=n;i+=8)
+			_mm256_storeu_ps(value+i,_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(half+i))));
+		return i;
+	}
+
+	static _FLOW_TARGET_F16C size_t HalfToFloat_F16C(double* value,const uint16_t* half,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+			_mm256_storeu_pd(value+i,_mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(half+i)))));
+		return i;
+	}
+
+	static _FLOW_TARGET_AVX2 int BilinearGather_AVX2(double* result,const double* pImage,const int* offsets,const double* weights,int n,int stride)
+	{
+		// the masked gather of all the lanes, from zeros, is the plain one but for the -Wmaybe-uninitialized that
+		// GCC warns of the undefined source of _mm256_i32gather_pd
+		const __m256d all=_mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		int j=0;
+		for(;j+4<=n;j+=4)
+		{
+			__m256d sum=_mm256_loadu_pd(result+j);
+			for(int m=0;m<4;m++)
+			{
+				__m256d pixel=_mm256_mask_i32gather_pd(_mm256_setzero_pd(),pImage,_mm_loadu_si128((const __m128i*)(offsets+m*stride+j)),all,8);
+				sum=_mm256_add_pd(sum,_mm256_mul_pd(pixel,_mm256_loadu_pd(weights+m*stride+j)));
+			}
+			_mm256_storeu_pd(result+j,sum);
+		}
+		return j;
+	}
+
+	// the sum is rounded to float after every neighbour, as the scalar += of a float result
+	static _FLOW_TARGET_AVX2 int BilinearGather_AVX2(float* result,const float* pImage,const int* offsets,const double* weights,int n,int stride)
+	{
+		int j=0;
+		for(;j+4<=n;j+=4)
+		{
+			__m128 sum=_mm_loadu_ps(result+j);
+			for(int m=0;m<4;m++)
+			{
+				__m256d pixel=_mm256_cvtps_pd(_mm_i32gather_ps(pImage,_mm_loadu_si128((const __m128i*)(offsets+m*stride+j)),4));
+				sum=_mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(sum),_mm256_mul_pd(pixel,_mm256_loadu_pd(weights+m*stride+j))));
+			}
+			_mm_storeu_ps(result+j,sum);
+		}
+		return j;
+	}
+#elif defined(_FLOW_NEON)
+	static inline size_t FloatToHalf_NEON(uint16_t* half,const float* value,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+			vst1_u16(half+i,vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(value+i))));
+		return i;
+	}
+
+	static inline size_t FloatToHalf_NEON(uint16_t* half,const double* value,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+		{
+			float32x4_t f=vcombine_f32(vcvt_f32_f64(vld1q_f64(value+i)),vcvt_f32_f64(vld1q_f64(value+i+2)));
+			vst1_u16(half+i,vreinterpret_u16_f16(vcvt_f16_f32(f)));
+		}
+		return i;
+	}
+
+	static inline size_t HalfToFloat_NEON(float* value,const uint16_t* half,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+			vst1q_f32(value+i,vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(half+i))));
+		return i;
+	}
+
+	static inline size_t HalfToFloat_NEON(double* value,const uint16_t* half,size_t n)
+	{
+		size_t i=0;
+		for(;i+4<=n;i+=4)
+		{
+			float32x4_t f=vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(half+i)));
+			vst1q_f64(value+i,vcvt_f64_f32(vget_low_f32(f)));
+			vst1q_f64(value+i+2,vcvt_high_f64_f32(f));
+		}
+		return i;
+	}
+#endif
+
+#if defined(_FLOW_X86)
+	//---------------------------------------------------------------------------------
+	// x86 versions, 2 (SSE2) or 4 (AVX) pixels per instruction
+	//---------------------------------------------------------------------------------
+	static inline void RobustPhi_SSE2(double* phi,const double* ux,const double* uy,const double* vx,const double* vy,int nPixels,double varepsilon)
+	{
+		const __m128d eps=_mm_set1_pd(varepsilon),half=_mm_set1_pd(0.5);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			__m128d a=_mm_loadu_pd(ux+i),b=_mm_loadu_pd(uy+i),c=_mm_loadu_pd(vx+i),d=_mm_loadu_pd(vy+i);
+			__m128d temp=_mm_add_pd(_mm_add_pd(_mm_mul_pd(a,a),_mm_mul_pd(b,b)),_mm_add_pd(_mm_mul_pd(c,c),_mm_mul_pd(d,d)));
+			_mm_storeu_pd(phi+i,_mm_div_pd(half,_mm_sqrt_pd(_mm_add_pd(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static _FLOW_TARGET_AVX void RobustPhi_AVX(double* phi,const double* ux,const double* uy,const double* vx,const double* vy,int nPixels,double varepsilon)
+	{
+		const __m256d eps=_mm256_set1_pd(varepsilon),half=_mm256_set1_pd(0.5);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			__m256d a=_mm256_loadu_pd(ux+i),b=_mm256_loadu_pd(uy+i),c=_mm256_loadu_pd(vx+i),d=_mm256_loadu_pd(vy+i);
+			__m256d temp=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a,a),_mm256_mul_pd(b,b)),_mm256_add_pd(_mm256_mul_pd(c,c),_mm256_mul_pd(d,d)));
+			_mm256_storeu_pd(phi+i,_mm256_div_pd(half,_mm256_sqrt_pd(_mm256_add_pd(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_SSE2(double* psi,const double* imdt,const double* imdx,const double* imdy,const double* du,const double* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const __m128d eps=_mm_set1_pd(varepsilon),s=_mm_set1_pd(scale);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			int o0=i*nChannels+k,o1=o0+nChannels;
+			__m128d dt=_mm_set_pd(imdt[o1],imdt[o0]),dx=_mm_set_pd(imdx[o1],imdx[o0]),dy=_mm_set_pd(imdy[o1],imdy[o0]);
+			__m128d temp=_mm_add_pd(dt,_mm_add_pd(_mm_mul_pd(dx,_mm_loadu_pd(du+i)),_mm_mul_pd(dy,_mm_loadu_pd(dv+i))));
+			__m128d res=_mm_div_pd(s,_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(temp,temp),eps)));
+			_mm_storel_pd(psi+o0,res);
+			_mm_storeh_pd(psi+o1,res);
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	static _FLOW_TARGET_AVX void RobustLapPsi_AVX(double* psi,const double* imdt,const double* imdx,const double* imdy,const double* du,const double* dv,
+																				int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const __m256d eps=_mm256_set1_pd(varepsilon),s=_mm256_set1_pd(scale);
+		int i=0;
+		if(nChannels==1)
+			for(;i+4<=nPixels;i+=4)
+			{
+				__m256d temp=_mm256_add_pd(_mm256_loadu_pd(imdt+i),_mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(imdx+i),_mm256_loadu_pd(du+i)),
+																									_mm256_mul_pd(_mm256_loadu_pd(imdy+i),_mm256_loadu_pd(dv+i))));
+				_mm256_storeu_pd(psi+i,_mm256_div_pd(s,_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(temp,temp),eps))));
+			}
+		else
+			for(;i+4<=nPixels;i+=4)
+			{
+				int o0=i*nChannels+k,o1=o0+nChannels,o2=o1+nChannels,o3=o2+nChannels;
+				__m256d dt=_mm256_set_pd(imdt[o3],imdt[o2],imdt[o1],imdt[o0]);
+				__m256d dx=_mm256_set_pd(imdx[o3],imdx[o2],imdx[o1],imdx[o0]);
+				__m256d dy=_mm256_set_pd(imdy[o3],imdy[o2],imdy[o1],imdy[o0]);
+				__m256d temp=_mm256_add_pd(dt,_mm256_add_pd(_mm256_mul_pd(dx,_mm256_loadu_pd(du+i)),_mm256_mul_pd(dy,_mm256_loadu_pd(dv+i))));
+				double res[4];
+				_mm256_storeu_pd(res,_mm256_div_pd(s,_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(temp,temp),eps))));
+				psi[o0]=res[0];
+				psi[o1]=res[1];
+				psi[o2]=res[2];
+				psi[o3]=res[3];
+			}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	//---------------------------------------------------------------------------------
+	// single precision x86 versions, 4 (SSE2) or 8 (AVX) pixels per instruction
+	//---------------------------------------------------------------------------------
+	static inline void RobustPhi_SSE2(float* phi,const float* ux,const float* uy,const float* vx,const float* vy,int nPixels,double varepsilon)
+	{
+		const __m128 eps=_mm_set1_ps((float)varepsilon),half=_mm_set1_ps(0.5f);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			__m128 a=_mm_loadu_ps(ux+i),b=_mm_loadu_ps(uy+i),c=_mm_loadu_ps(vx+i),d=_mm_loadu_ps(vy+i);
+			__m128 temp=_mm_add_ps(_mm_add_ps(_mm_mul_ps(a,a),_mm_mul_ps(b,b)),_mm_add_ps(_mm_mul_ps(c,c),_mm_mul_ps(d,d)));
+			_mm_storeu_ps(phi+i,_mm_div_ps(half,_mm_sqrt_ps(_mm_add_ps(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static _FLOW_TARGET_AVX void RobustPhi_AVX(float* phi,const float* ux,const float* uy,const float* vx,const float* vy,int nPixels,double varepsilon)
+	{
+		const __m256 eps=_mm256_set1_ps((float)varepsilon),half=_mm256_set1_ps(0.5f);
+		int i=0;
+		for(;i+8<=nPixels;i+=8)
+		{
+			__m256 a=_mm256_loadu_ps(ux+i),b=_mm256_loadu_ps(uy+i),c=_mm256_loadu_ps(vx+i),d=_mm256_loadu_ps(vy+i);
+			__m256 temp=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a,a),_mm256_mul_ps(b,b)),_mm256_add_ps(_mm256_mul_ps(c,c),_mm256_mul_ps(d,d)));
+			_mm256_storeu_ps(phi+i,_mm256_div_ps(half,_mm256_sqrt_ps(_mm256_add_ps(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_SSE2(float* psi,const float* imdt,const float* imdx,const float* imdy,const float* du,const float* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const __m128 eps=_mm_set1_ps((float)varepsilon),s=_mm_set1_ps((float)scale);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			int o0=i*nChannels+k,o1=o0+nChannels,o2=o1+nChannels,o3=o2+nChannels;
+			__m128 dt=_mm_set_ps(imdt[o3],imdt[o2],imdt[o1],imdt[o0]);
+			__m128 dx=_mm_set_ps(imdx[o3],imdx[o2],imdx[o1],imdx[o0]);
+			__m128 dy=_mm_set_ps(imdy[o3],imdy[o2],imdy[o1],imdy[o0]);
+			__m128 temp=_mm_add_ps(dt,_mm_add_ps(_mm_mul_ps(dx,_mm_loadu_ps(du+i)),_mm_mul_ps(dy,_mm_loadu_ps(dv+i))));
+			float res[4];
+			_mm_storeu_ps(res,_mm_div_ps(s,_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(temp,temp),eps))));
+			psi[o0]=res[0];
+			psi[o1]=res[1];
+			psi[o2]=res[2];
+			psi[o3]=res[3];
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	static _FLOW_TARGET_AVX void RobustLapPsi_AVX(float* psi,const float* imdt,const float* imdx,const float* imdy,const float* du,const float* dv,
+																				int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const __m256 eps=_mm256_set1_ps((float)varepsilon),s=_mm256_set1_ps((float)scale);
+		int i=0;
+		for(;i+8<=nPixels;i+=8)
+		{
+			float dtv[8],dxv[8],dyv[8],res[8];
+			for(int l=0;l<8;l++)
+			{
+				int offset=(i+l)*nChannels+k;
+				dtv[l]=imdt[offset];
+				dxv[l]=imdx[offset];
+				dyv[l]=imdy[offset];
+			}
+			__m256 temp=_mm256_add_ps(_mm256_loadu_ps(dtv),_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(dxv),_mm256_loadu_ps(du+i)),
+																							_mm256_mul_ps(_mm256_loadu_ps(dyv),_mm256_loadu_ps(dv+i))));
+			_mm256_storeu_ps(res,_mm256_div_ps(s,_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(temp,temp),eps))));
+			for(int l=0;l<8;l++)
+				psi[(i+l)*nChannels+k]=res[l];
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	//---------------------------------------------------------------------------------
+	// the inner columns [1,width-1) of LaplacianRow, returns the first column left
+	//---------------------------------------------------------------------------------
+	static inline __m128d LaplacianStencil_SSE2(const double* in,const double* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		__m128d center=_mm_loadu_pd(in+j),w=_mm_loadu_pd(weight+j);
+		__m128d out=_mm_sub_pd(_mm_setzero_pd(),_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in+j+1),center),w));
+		out=_mm_add_pd(out,_mm_mul_pd(_mm_sub_pd(center,_mm_loadu_pd(in+j-1)),_mm_loadu_pd(weight+j-1)));
+		if(IsDown)
+			out=_mm_sub_pd(out,_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in+j+width),center),w));
+		if(IsUp)
+			out=_mm_add_pd(out,_mm_mul_pd(_mm_sub_pd(center,_mm_loadu_pd(in+j-width)),_mm_loadu_pd(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_SSE2(double* out1,double* out2,const double* in1,const double* in2,const double* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+2<=width-1;j+=2)
+		{
+			_mm_storeu_pd(out1+j,LaplacianStencil_SSE2(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				_mm_storeu_pd(out2+j,LaplacianStencil_SSE2(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline __m128 LaplacianStencil_SSE2(const float* in,const float* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		__m128 center=_mm_loadu_ps(in+j),w=_mm_loadu_ps(weight+j);
+		__m128 out=_mm_sub_ps(_mm_setzero_ps(),_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in+j+1),center),w));
+		out=_mm_add_ps(out,_mm_mul_ps(_mm_sub_ps(center,_mm_loadu_ps(in+j-1)),_mm_loadu_ps(weight+j-1)));
+		if(IsDown)
+			out=_mm_sub_ps(out,_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in+j+width),center),w));
+		if(IsUp)
+			out=_mm_add_ps(out,_mm_mul_ps(_mm_sub_ps(center,_mm_loadu_ps(in+j-width)),_mm_loadu_ps(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_SSE2(float* out1,float* out2,const float* in1,const float* in2,const float* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+4<=width-1;j+=4)
+		{
+			_mm_storeu_ps(out1+j,LaplacianStencil_SSE2(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				_mm_storeu_ps(out2+j,LaplacianStencil_SSE2(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static _FLOW_TARGET_AVX inline __m256d LaplacianStencil_AVX(const double* in,const double* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		__m256d center=_mm256_loadu_pd(in+j),w=_mm256_loadu_pd(weight+j);
+		__m256d out=_mm256_sub_pd(_mm256_setzero_pd(),_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(in+j+1),center),w));
+		out=_mm256_add_pd(out,_mm256_mul_pd(_mm256_sub_pd(center,_mm256_loadu_pd(in+j-1)),_mm256_loadu_pd(weight+j-1)));
+		if(IsDown)
+			out=_mm256_sub_pd(out,_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(in+j+width),center),w));
+		if(IsUp)
+			out=_mm256_add_pd(out,_mm256_mul_pd(_mm256_sub_pd(center,_mm256_loadu_pd(in+j-width)),_mm256_loadu_pd(weight+j-width)));
+		return out;
+	}
+
+	static _FLOW_TARGET_AVX int LaplacianRow_AVX(double* out1,double* out2,const double* in1,const double* in2,const double* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+4<=width-1;j+=4)
+		{
+			_mm256_storeu_pd(out1+j,LaplacianStencil_AVX(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				_mm256_storeu_pd(out2+j,LaplacianStencil_AVX(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static _FLOW_TARGET_AVX inline __m256 LaplacianStencil_AVX(const float* in,const float* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		__m256 center=_mm256_loadu_ps(in+j),w=_mm256_loadu_ps(weight+j);
+		__m256 out=_mm256_sub_ps(_mm256_setzero_ps(),_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in+j+1),center),w));
+		out=_mm256_add_ps(out,_mm256_mul_ps(_mm256_sub_ps(center,_mm256_loadu_ps(in+j-1)),_mm256_loadu_ps(weight+j-1)));
+		if(IsDown)
+			out=_mm256_sub_ps(out,_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in+j+width),center),w));
+		if(IsUp)
+			out=_mm256_add_ps(out,_mm256_mul_ps(_mm256_sub_ps(center,_mm256_loadu_ps(in+j-width)),_mm256_loadu_ps(weight+j-width)));
+		return out;
+	}
+
+	static _FLOW_TARGET_AVX int LaplacianRow_AVX(float* out1,float* out2,const float* in1,const float* in2,const float* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+8<=width-1;j+=8)
+		{
+			_mm256_storeu_ps(out1+j,LaplacianStencil_AVX(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				_mm256_storeu_ps(out2+j,LaplacianStencil_AVX(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline double Dot_SSE2(const double* a,const double* b,int n)
+	{
+		__m128d sum0=_mm_setzero_pd(),sum1=_mm_setzero_pd();
+		int i=0;
+		for(;i+4<=n;i+=4)
+		{
+			sum0=_mm_add_pd(sum0,_mm_mul_pd(_mm_loadu_pd(a+i),_mm_loadu_pd(b+i)));
+			sum1=_mm_add_pd(sum1,_mm_mul_pd(_mm_loadu_pd(a+i+2),_mm_loadu_pd(b+i+2)));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes,_mm_add_pd(sum0,sum1));
+		return lanes[0]+lanes[1]+Dot_Scalar(a,b,n,i);
+	}
+
+	static _FLOW_TARGET_AVX double Dot_AVX(const double* a,const double* b,int n)
+	{
+		__m256d sum0=_mm256_setzero_pd(),sum1=_mm256_setzero_pd();
+		int i=0;
+		for(;i+8<=n;i+=8)
+		{
+			sum0=_mm256_add_pd(sum0,_mm256_mul_pd(_mm256_loadu_pd(a+i),_mm256_loadu_pd(b+i)));
+			sum1=_mm256_add_pd(sum1,_mm256_mul_pd(_mm256_loadu_pd(a+i+4),_mm256_loadu_pd(b+i+4)));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes,_mm256_add_pd(sum0,sum1));
+		return (lanes[0]+lanes[1])+(lanes[2]+lanes[3])+Dot_Scalar(a,b,n,i);
+	}
+
+	static inline void Axpy_SSE2(double* y,const double* x,double a,int n)
+	{
+		const __m128d s=_mm_set1_pd(a);
+		int i=0;
+		for(;i+2<=n;i+=2)
+			_mm_storeu_pd(y+i,_mm_add_pd(_mm_loadu_pd(y+i),_mm_mul_pd(s,_mm_loadu_pd(x+i))));
+		Axpy_Scalar(y,x,a,n,i);
+	}
+
+	static _FLOW_TARGET_AVX void Axpy_AVX(double* y,const double* x,double a,int n)
+	{
+		const __m256d s=_mm256_set1_pd(a);
+		int i=0;
+		for(;i+4<=n;i+=4)
+			_mm256_storeu_pd(y+i,_mm256_add_pd(_mm256_loadu_pd(y+i),_mm256_mul_pd(s,_mm256_loadu_pd(x+i))));
+		Axpy_Scalar(y,x,a,n,i);
+	}
+#endif
+
+#if defined(_FLOW_NEON)
+	//---------------------------------------------------------------------------------
+	// arm64 versions, 2 pixels per instruction
+	//---------------------------------------------------------------------------------
+	static inline void RobustPhi_NEON(double* phi,const double* ux,const double* uy,const double* vx,const double* vy,int nPixels,double varepsilon)
+	{
+		const float64x2_t eps=vdupq_n_f64(varepsilon),half=vdupq_n_f64(0.5);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			float64x2_t a=vld1q_f64(ux+i),b=vld1q_f64(uy+i),c=vld1q_f64(vx+i),d=vld1q_f64(vy+i);
+			float64x2_t temp=vaddq_f64(vaddq_f64(vmulq_f64(a,a),vmulq_f64(b,b)),vaddq_f64(vmulq_f64(c,c),vmulq_f64(d,d)));
+			vst1q_f64(phi+i,vdivq_f64(half,vsqrtq_f64(vaddq_f64(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_NEON(double* psi,const double* imdt,const double* imdx,const double* imdy,const double* du,const double* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const float64x2_t eps=vdupq_n_f64(varepsilon),s=vdupq_n_f64(scale);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			int o0=i*nChannels+k,o1=o0+nChannels;
+			double dtv[2]={imdt[o0],imdt[o1]},dxv[2]={imdx[o0],imdx[o1]},dyv[2]={imdy[o0],imdy[o1]};
+			float64x2_t temp=vaddq_f64(vld1q_f64(dtv),vaddq_f64(vmulq_f64(vld1q_f64(dxv),vld1q_f64(du+i)),vmulq_f64(vld1q_f64(dyv),vld1q_f64(dv+i))));
+			float64x2_t res=vdivq_f64(s,vsqrtq_f64(vaddq_f64(vmulq_f64(temp,temp),eps)));
+			psi[o0]=vgetq_lane_f64(res,0);
+			psi[o1]=vgetq_lane_f64(res,1);
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+	static inline void RobustPhi_NEON(float* phi,const float* ux,const float* uy,const float* vx,const float* vy,int nPixels,double varepsilon)
+	{
+		const float32x4_t eps=vdupq_n_f32((float)varepsilon),half=vdupq_n_f32(0.5f);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			float32x4_t a=vld1q_f32(ux+i),b=vld1q_f32(uy+i),c=vld1q_f32(vx+i),d=vld1q_f32(vy+i);
+			float32x4_t temp=vaddq_f32(vaddq_f32(vmulq_f32(a,a),vmulq_f32(b,b)),vaddq_f32(vmulq_f32(c,c),vmulq_f32(d,d)));
+			vst1q_f32(phi+i,vdivq_f32(half,vsqrtq_f32(vaddq_f32(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_NEON(float* psi,const float* imdt,const float* imdx,const float* imdy,const float* du,const float* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const float32x4_t eps=vdupq_n_f32((float)varepsilon),s=vdupq_n_f32((float)scale);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			float dtv[4],dxv[4],dyv[4],res[4];
+			for(int l=0;l<4;l++)
+			{
+				int offset=(i+l)*nChannels+k;
+				dtv[l]=imdt[offset];
+				dxv[l]=imdx[offset];
+				dyv[l]=imdy[offset];
+			}
+			float32x4_t temp=vaddq_f32(vld1q_f32(dtv),vaddq_f32(vmulq_f32(vld1q_f32(dxv),vld1q_f32(du+i)),vmulq_f32(vld1q_f32(dyv),vld1q_f32(dv+i))));
+			vst1q_f32(res,vdivq_f32(s,vsqrtq_f32(vaddq_f32(vmulq_f32(temp,temp),eps))));
+			for(int l=0;l<4;l++)
+				psi[(i+l)*nChannels+k]=res[l];
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	static inline float64x2_t LaplacianStencil_NEON(const double* in,const double* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		float64x2_t center=vld1q_f64(in+j),w=vld1q_f64(weight+j);
+		float64x2_t out=vsubq_f64(vdupq_n_f64(0),vmulq_f64(vsubq_f64(vld1q_f64(in+j+1),center),w));
+		out=vaddq_f64(out,vmulq_f64(vsubq_f64(center,vld1q_f64(in+j-1)),vld1q_f64(weight+j-1)));
+		if(IsDown)
+			out=vsubq_f64(out,vmulq_f64(vsubq_f64(vld1q_f64(in+j+width),center),w));
+		if(IsUp)
+			out=vaddq_f64(out,vmulq_f64(vsubq_f64(center,vld1q_f64(in+j-width)),vld1q_f64(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_NEON(double* out1,double* out2,const double* in1,const double* in2,const double* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+2<=width-1;j+=2)
+		{
+			vst1q_f64(out1+j,LaplacianStencil_NEON(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				vst1q_f64(out2+j,LaplacianStencil_NEON(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline float32x4_t LaplacianStencil_NEON(const float* in,const float* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		float32x4_t center=vld1q_f32(in+j),w=vld1q_f32(weight+j);
+		float32x4_t out=vsubq_f32(vdupq_n_f32(0),vmulq_f32(vsubq_f32(vld1q_f32(in+j+1),center),w));
+		out=vaddq_f32(out,vmulq_f32(vsubq_f32(center,vld1q_f32(in+j-1)),vld1q_f32(weight+j-1)));
+		if(IsDown)
+			out=vsubq_f32(out,vmulq_f32(vsubq_f32(vld1q_f32(in+j+width),center),w));
+		if(IsUp)
+			out=vaddq_f32(out,vmulq_f32(vsubq_f32(center,vld1q_f32(in+j-width)),vld1q_f32(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_NEON(float* out1,float* out2,const float* in1,const float* in2,const float* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+4<=width-1;j+=4)
+		{
+			vst1q_f32(out1+j,LaplacianStencil_NEON(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				vst1q_f32(out2+j,LaplacianStencil_NEON(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline double Dot_NEON(const double* a,const double* b,int n)
+	{
+		float64x2_t sum0=vdupq_n_f64(0),sum1=vdupq_n_f64(0);
+		int i=0;
+		for(;i+4<=n;i+=4)
+		{
+			sum0=vfmaq_f64(sum0,vld1q_f64(a+i),vld1q_f64(b+i));
+			sum1=vfmaq_f64(sum1,vld1q_f64(a+i+2),vld1q_f64(b+i+2));
+		}
+		return vaddvq_f64(vaddq_f64(sum0,sum1))+Dot_Scalar(a,b,n,i);
+	}
+
+	static inline void Axpy_NEON(double* y,const double* x,double a,int n)
+	{
+		const float64x2_t s=vdupq_n_f64(a);
+		int i=0;
+		for(;i+2<=n;i+=2)
+			vst1q_f64(y+i,vfmaq_f64(vld1q_f64(y+i),s,vld1q_f64(x+i)));
+		Axpy_Scalar(y,x,a,n,i);
+	}
+#endif
+
+#if defined(_FLOW_WASM)
+	//---------------------------------------------------------------------------------
+	// WebAssembly versions, 2 (double) or 4 (float) pixels per instruction
+	//---------------------------------------------------------------------------------
+	static inline void RobustPhi_SIMD128(double* phi,const double* ux,const double* uy,const double* vx,const double* vy,int nPixels,double varepsilon)
+	{
+		const v128_t eps=wasm_f64x2_splat(varepsilon),half=wasm_f64x2_splat(0.5);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			v128_t a=wasm_v128_load(ux+i),b=wasm_v128_load(uy+i),c=wasm_v128_load(vx+i),d=wasm_v128_load(vy+i);
+			v128_t temp=wasm_f64x2_add(wasm_f64x2_add(wasm_f64x2_mul(a,a),wasm_f64x2_mul(b,b)),wasm_f64x2_add(wasm_f64x2_mul(c,c),wasm_f64x2_mul(d,d)));
+			wasm_v128_store(phi+i,wasm_f64x2_div(half,wasm_f64x2_sqrt(wasm_f64x2_add(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_SIMD128(double* psi,const double* imdt,const double* imdx,const double* imdy,const double* du,const double* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const v128_t eps=wasm_f64x2_splat(varepsilon),s=wasm_f64x2_splat(scale);
+		int i=0;
+		for(;i+2<=nPixels;i+=2)
+		{
+			int o0=i*nChannels+k,o1=o0+nChannels;
+			v128_t dt=wasm_f64x2_make(imdt[o0],imdt[o1]),dx=wasm_f64x2_make(imdx[o0],imdx[o1]),dy=wasm_f64x2_make(imdy[o0],imdy[o1]);
+			v128_t temp=wasm_f64x2_add(dt,wasm_f64x2_add(wasm_f64x2_mul(dx,wasm_v128_load(du+i)),wasm_f64x2_mul(dy,wasm_v128_load(dv+i))));
+			v128_t res=wasm_f64x2_div(s,wasm_f64x2_sqrt(wasm_f64x2_add(wasm_f64x2_mul(temp,temp),eps)));
+			psi[o0]=wasm_f64x2_extract_lane(res,0);
+			psi[o1]=wasm_f64x2_extract_lane(res,1);
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	static inline void RobustPhi_SIMD128(float* phi,const float* ux,const float* uy,const float* vx,const float* vy,int nPixels,double varepsilon)
+	{
+		const v128_t eps=wasm_f32x4_splat((float)varepsilon),half=wasm_f32x4_splat(0.5f);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			v128_t a=wasm_v128_load(ux+i),b=wasm_v128_load(uy+i),c=wasm_v128_load(vx+i),d=wasm_v128_load(vy+i);
+			v128_t temp=wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(a,a),wasm_f32x4_mul(b,b)),wasm_f32x4_add(wasm_f32x4_mul(c,c),wasm_f32x4_mul(d,d)));
+			wasm_v128_store(phi+i,wasm_f32x4_div(half,wasm_f32x4_sqrt(wasm_f32x4_add(temp,eps))));
+		}
+		RobustPhi_Scalar(phi,ux,uy,vx,vy,nPixels,varepsilon,i);
+	}
+
+	static inline void RobustLapPsi_SIMD128(float* psi,const float* imdt,const float* imdx,const float* imdy,const float* du,const float* dv,
+																		int nPixels,int nChannels,int k,double scale,double varepsilon)
+	{
+		const v128_t eps=wasm_f32x4_splat((float)varepsilon),s=wasm_f32x4_splat((float)scale);
+		int i=0;
+		for(;i+4<=nPixels;i+=4)
+		{
+			int o0=i*nChannels+k,o1=o0+nChannels,o2=o1+nChannels,o3=o2+nChannels;
+			v128_t dt=wasm_f32x4_make(imdt[o0],imdt[o1],imdt[o2],imdt[o3]);
+			v128_t dx=wasm_f32x4_make(imdx[o0],imdx[o1],imdx[o2],imdx[o3]);
+			v128_t dy=wasm_f32x4_make(imdy[o0],imdy[o1],imdy[o2],imdy[o3]);
+			v128_t temp=wasm_f32x4_add(dt,wasm_f32x4_add(wasm_f32x4_mul(dx,wasm_v128_load(du+i)),wasm_f32x4_mul(dy,wasm_v128_load(dv+i))));
+			v128_t res=wasm_f32x4_div(s,wasm_f32x4_sqrt(wasm_f32x4_add(wasm_f32x4_mul(temp,temp),eps)));
+			psi[o0]=wasm_f32x4_extract_lane(res,0);
+			psi[o1]=wasm_f32x4_extract_lane(res,1);
+			psi[o2]=wasm_f32x4_extract_lane(res,2);
+			psi[o3]=wasm_f32x4_extract_lane(res,3);
+		}
+		RobustLapPsi_Scalar(psi,imdt,imdx,imdy,du,dv,nPixels,nChannels,k,scale,varepsilon,i);
+	}
+
+	static inline v128_t LaplacianStencil_SIMD128(const double* in,const double* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		v128_t center=wasm_v128_load(in+j),w=wasm_v128_load(weight+j);
+		v128_t out=wasm_f64x2_sub(wasm_f64x2_splat(0),wasm_f64x2_mul(wasm_f64x2_sub(wasm_v128_load(in+j+1),center),w));
+		out=wasm_f64x2_add(out,wasm_f64x2_mul(wasm_f64x2_sub(center,wasm_v128_load(in+j-1)),wasm_v128_load(weight+j-1)));
+		if(IsDown)
+			out=wasm_f64x2_sub(out,wasm_f64x2_mul(wasm_f64x2_sub(wasm_v128_load(in+j+width),center),w));
+		if(IsUp)
+			out=wasm_f64x2_add(out,wasm_f64x2_mul(wasm_f64x2_sub(center,wasm_v128_load(in+j-width)),wasm_v128_load(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_SIMD128(double* out1,double* out2,const double* in1,const double* in2,const double* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+2<=width-1;j+=2)
+		{
+			wasm_v128_store(out1+j,LaplacianStencil_SIMD128(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				wasm_v128_store(out2+j,LaplacianStencil_SIMD128(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline v128_t LaplacianStencil_SIMD128(const float* in,const float* weight,int j,int width,bool IsUp,bool IsDown)
+	{
+		v128_t center=wasm_v128_load(in+j),w=wasm_v128_load(weight+j);
+		v128_t out=wasm_f32x4_sub(wasm_f32x4_splat(0),wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(in+j+1),center),w));
+		out=wasm_f32x4_add(out,wasm_f32x4_mul(wasm_f32x4_sub(center,wasm_v128_load(in+j-1)),wasm_v128_load(weight+j-1)));
+		if(IsDown)
+			out=wasm_f32x4_sub(out,wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(in+j+width),center),w));
+		if(IsUp)
+			out=wasm_f32x4_add(out,wasm_f32x4_mul(wasm_f32x4_sub(center,wasm_v128_load(in+j-width)),wasm_v128_load(weight+j-width)));
+		return out;
+	}
+
+	static inline int LaplacianRow_SIMD128(float* out1,float* out2,const float* in1,const float* in2,const float* weight,int width,bool IsUp,bool IsDown)
+	{
+		int j=1;
+		for(;j+4<=width-1;j+=4)
+		{
+			wasm_v128_store(out1+j,LaplacianStencil_SIMD128(in1,weight,j,width,IsUp,IsDown));
+			if(out2!=NULL)
+				wasm_v128_store(out2+j,LaplacianStencil_SIMD128(in2,weight,j,width,IsUp,IsDown));
+		}
+		return j;
+	}
+
+	static inline double Dot_SIMD128(const double* a,const double* b,int n)
+	{
+		v128_t sum0=wasm_f64x2_splat(0),sum1=wasm_f64x2_splat(0);
+		int i=0;
+		for(;i+4<=n;i+=4)
+		{
+			sum0=wasm_f64x2_add(sum0,wasm_f64x2_mul(wasm_v128_load(a+i),wasm_v128_load(b+i)));
+			sum1=wasm_f64x2_add(sum1,wasm_f64x2_mul(wasm_v128_load(a+i+2),wasm_v128_load(b+i+2)));
+		}
+		v128_t sum=wasm_f64x2_add(sum0,sum1);
+		return wasm_f64x2_extract_lane(sum,0)+wasm_f64x2_extract_lane(sum,1)+Dot_Scalar(a,b,n,i);
+	}
+
+	static inline void Axpy_SIMD128(double* y,const double* x,double a,int n)
+	{
+		const v128_t s=wasm_f64x2_splat(a);
+		int i=0;
+		for(;i+2<=n;i+=2)
+			wasm_v128_store(y+i,wasm_f64x2_add(wasm_v128_load(y+i),wasm_f64x2_mul(s,wasm_v128_load(x+i))));
+		Axpy_Scalar(y,x,a,n,i);
+	}
+#endif
+};
+
+#endif
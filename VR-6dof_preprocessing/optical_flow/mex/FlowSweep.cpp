@@ -0,0 +1,170 @@
+#include "FlowSweep.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+template <class T>
+FlowSweep<T>::FlowSweep()
+{
+	sweepTime=0;
+	levelSolves=0;
+}
+
+template <class T>
+bool FlowSweep<T>::IsSameLevel(const Setting& s1,const Setting& s2)
+{
+	return s1.alpha==s2.alpha && s1.nOuterFPIterations==s2.nOuterFPIterations && s1.nInnerFPIterations==s2.nInnerFPIterations &&
+		s1.nSORIterations==s2.nSORIterations;
+}
+
+template <class T>
+const typename FlowSweep<T>::Setting& FlowSweep<T>::levelSetting(const Setting& setting,int k) const
+{
+	if(setting.nFineLevels>0 && k>=setting.nFineLevels)
+		return coarse;
+	return setting;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the settings of a branch have solved the levels above k the same way, and vx and vy hold the flow of
+// level k+1. They are split by their solve of level k, each part solving it and its finer levels in turn
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void FlowSweep<T>::SolveBranch(const vector<Setting>& settings,const vector<int>& branch,int k,int startLevel,
+							   Pyramid& Pyramid1,Pyramid& Pyramid2,TImage& vx,TImage& vy,vector<Result>& results)
+{
+	if(k<0)
+	{
+		// the flow of the finest level, the same for every setting of the branch
+		chrono::steady_clock::time_point start=chrono::steady_clock::now();
+		Result& first=results[branch[0]];
+		OpticalFlowT<T>::WarpFrame(first.warpI2,Pyramid1,Pyramid2,vx,vy,ws);
+		const TImage& Im1=Pyramid1.level(0,ws.level1);
+		double sum=0;
+		for(int i=0;i<Im1.nelements();i++)
+		{
+			double difference=(double)first.warpI2.data()[i]-Im1.data()[i];
+			sum+=difference*difference;
+		}
+		double residual=sqrt(sum/__max(Im1.nelements(),1));
+		double warpTime=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+		for(size_t i=0;i<branch.size();i++)
+		{
+			Result& result=results[branch[i]];
+			result.vx.copyData(vx);
+			result.vy.copyData(vy);
+			if(i>0)
+				result.warpI2.copyData(first.warpI2);
+			result.residual=residual;
+			result.statistics=ws.statistics;
+			result.time+=warpTime;
+		}
+		return;
+	}
+	// the settings of the branch grouped by their solve of level k
+	vector< vector<int> > parts;
+	for(size_t i=0;i<branch.size();i++)
+	{
+		const Setting& setting=levelSetting(settings[branch[i]],k);
+		size_t j=0;
+		while(j<parts.size() && !IsSameLevel(levelSetting(settings[parts[j][0]],k),setting))
+			j++;
+		if(j==parts.size())
+			parts.push_back(vector<int>());
+		parts[j].push_back(branch[i]);
+	}
+	// the flow and the noise model of the level above, restored before every part but the first
+	TImage saveVx,saveVy;
+	GaussianMixture saveGMPara;
+	Vector<double> saveLapPara;
+	size_t nStatistics=ws.statistics.size();
+	if(parts.size()>1)
+	{
+		saveVx.copyData(vx);
+		saveVy.copyData(vy);
+		saveGMPara=ws.GMPara;
+		saveLapPara=ws.LapPara;
+	}
+	for(size_t j=0;j<parts.size();j++)
+	{
+		if(j>0)
+		{
+			vx.copyData(saveVx);
+			vy.copyData(saveVy);
+			ws.GMPara=saveGMPara;
+			ws.LapPara=saveLapPara;
+			ws.statistics.resize(nStatistics);
+		}
+		const Setting& setting=levelSetting(settings[parts[j][0]],k);
+		chrono::steady_clock::time_point start=chrono::steady_clock::now();
+		OpticalFlowT<T>::SolveLevel(vx,vy,Pyramid1,Pyramid2,setting.alpha,settings[parts[j][0]].ratio,k,startLevel,false,
+									setting.nOuterFPIterations,setting.nInnerFPIterations,setting.nSORIterations,ws);
+		double levelTime=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+		levelSolves++;
+		for(size_t i=0;i<parts[j].size();i++)
+		{
+			results[parts[j][i]].time+=levelTime;
+			if(parts[j].size()>1)
+				results[parts[j][i]].nSharedLevels++;
+		}
+		SolveBranch(settings,parts[j],k-1,startLevel,Pyramid1,Pyramid2,vx,vy,results);
+	}
+}
+
+template <class T>
+void FlowSweep<T>::Run(const TImage& Im1,const TImage& Im2,const vector<Setting>& settings,vector<Result>& results)
+{
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	results.clear();
+	results.resize(settings.size());
+	levelSolves=0;
+	sweepTime=0;
+	if(!Im1.matchDimension(Im2))
+	{
+		cout<<"The input images for optical flow have different dimensions!"<<endl;
+		return;
+	}
+	for(size_t i=0;i<results.size();i++)
+	{
+		results[i].time=results[i].pyramidTime=results[i].residual=0;
+		results[i].nSharedLevels=0;
+	}
+	ws.pParameters=&parameters;
+	ws.clearROI();
+	ws.IsConfidence=false;
+	// the settings of the same ratio and minWidth solved on the same pyramids, one ratio after the other
+	vector<bool> IsSolved(settings.size(),false);
+	for(size_t i=0;i<settings.size();i++)
+	{
+		if(IsSolved[i])
+			continue;
+		vector<int> branch;
+		for(size_t j=i;j<settings.size();j++)
+			if(!IsSolved[j] && settings[j].ratio==settings[i].ratio && settings[j].minWidth==settings[i].minWidth)
+			{
+				branch.push_back((int)j);
+				IsSolved[j]=true;
+			}
+		Pyramid Pyramid1,Pyramid2;
+		chrono::steady_clock::time_point pyramidStart=chrono::steady_clock::now();
+		OpticalFlowT<T>::BuildPyramid(Pyramid1,Im1,settings[i].ratio,settings[i].minWidth,parameters);
+		OpticalFlowT<T>::BuildPyramid(Pyramid2,Im2,settings[i].ratio,settings[i].minWidth,parameters);
+		double pyramidTime=chrono::duration<double>(chrono::steady_clock::now()-pyramidStart).count();
+		for(size_t j=0;j<branch.size();j++)
+			results[branch[j]].pyramidTime=pyramidTime;
+
+		OpticalFlowT<T>::PrepareWorkspace(Pyramid1,ws);
+		ws.pyramidTime=Pyramid1.pyramidTime+Pyramid2.pyramidTime;
+		ws.featureTime=Pyramid1.featureTime+Pyramid2.featureTime;
+		ws.pyramidMemory=Pyramid1.memory()+Pyramid2.memory();
+		TImage vx,vy;
+		int startLevel=Pyramid1.nlevels()-1;
+		SolveBranch(settings,branch,startLevel,startLevel,Pyramid1,Pyramid2,vx,vy,results);
+	}
+	sweepTime=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+}
+
+template class FlowSweep<double>;
+template class FlowSweep<float>;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "OpticalFlow.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the flow of one pair for a list of settings, to tune alpha, ratio and the iterations of a clip without
+// solving the pair from scratch for every setting. The settings of the same ratio and minWidth share their
+// pyramids and features, and the settings that solve a level the same way share the solve of that level
+// and of every coarser one: the coarse to fine solves form a tree from the coarsest level, branching where
+// the settings of a level differ, each branch restarting from a copy of the flow and of the noise model
+// of the level above. A setting with nFineLevels>0 solves only its nFineLevels finest levels with its own
+// alpha and iterations and the coarser ones with those of coarse, so that the settings of a sweep of the
+// fine levels branch from one coarse solve. The solves are those of Coarse2FineFlow, one after the other
+// on the workspace of the sweep, without a region of interest or a confidence
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class FlowSweep
+{
+public:
+	typedef Image<T> TImage;
+	typedef FeaturePyramid<T> Pyramid;
+	struct Setting
+	{
+		double alpha,ratio;
+		int minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations;
+		// the finest levels solved with the alpha and the iterations of the setting, 0 for all of them
+		int nFineLevels;
+		Setting(double _alpha=1,double _ratio=0.5,int _minWidth=40,int _nOuterFPIterations=3,int _nInnerFPIterations=1,int _nSORIterations=20,int _nFineLevels=0)
+		{
+			alpha=_alpha;ratio=_ratio;minWidth=_minWidth;
+			nOuterFPIterations=_nOuterFPIterations;nInnerFPIterations=_nInnerFPIterations;nSORIterations=_nSORIterations;
+			nFineLevels=_nFineLevels;
+		}
+	};
+	struct Result
+	{
+		TImage vx,vy,warpI2;
+		// the wall time in seconds of the levels of the setting and of its final warp, the shared levels
+		// included, i.e. about the time of its solve alone; and of the pyramids it shares with the settings
+		// of the same ratio and minWidth
+		double time,pyramidTime;
+		// the RMS difference of warpI2 and the first frame, over all the channels, the intensities in [0,1]
+		double residual;
+		// the levels solved once for this setting and at least another one
+		int nSharedLevels;
+		std::vector<SolverStatistics> statistics;
+	};
+	OpticalFlowBase::Parameters parameters;
+	// the alpha and the iterations of the levels coarser than the nFineLevels of a setting
+	Setting coarse;
+	// the wall time in seconds of the last Run, with the pyramids
+	double sweepTime;
+private:
+	FlowWorkspace<T> ws;
+	int levelSolves;
+	static bool IsSameLevel(const Setting& s1,const Setting& s2);
+	const Setting& levelSetting(const Setting& setting,int k) const;
+	void SolveBranch(const std::vector<Setting>& settings,const std::vector<int>& branch,int k,int startLevel,
+					 Pyramid& Pyramid1,Pyramid& Pyramid2,TImage& vx,TImage& vy,std::vector<Result>& results);
+public:
+	FlowSweep();
+	// the result of settings[i] in results[i]
+	void Run(const TImage& Im1,const TImage& Im2,const std::vector<Setting>& settings,std::vector<Result>& results);
+	// the levels solved by the last Run, against the sum of the levels of its settings
+	inline int nLevelSolves() const {return levelSolves;};
+};
+
+typedef FlowSweep<double> DFlowSweep;
+typedef FlowSweep<float> FFlowSweep;
@@ -1,12 +1,38 @@
 #include "GaussianPyramid.h"
 #include "math.h"
+#include <vector>
 
-GaussianPyramid::GaussianPyramid(void)
+template <class T>
+GaussianPyramidT<T>::GaussianPyramidT(void)
 {
 	ImPyramid=NULL;
+	nLevels=0;
 }
 
-GaussianPyramid::~GaussianPyramid(void)
+template <class T>
+GaussianPyramidT<T>::GaussianPyramidT(GaussianPyramidT<T>&& pyramid) noexcept
+{
+	ImPyramid=NULL;
+	nLevels=0;
+	swap(pyramid);
+}
+
+template <class T>
+GaussianPyramidT<T>& GaussianPyramidT<T>::operator=(GaussianPyramidT<T>&& pyramid) noexcept
+{
+	if(this!=&pyramid)
+	{
+		if(ImPyramid!=NULL)
+			delete []ImPyramid;
+		ImPyramid=NULL;
+		nLevels=0;
+		swap(pyramid);
+	}
+	return *this;
+}
+
+template <class T>
+GaussianPyramidT<T>::~GaussianPyramidT(void)
 {
 	if(ImPyramid!=NULL)
 		delete []ImPyramid;
@@ -16,7 +42,7 @@ GaussianPyramid::~GaussianPyramid(void)
 // function to construct the pyramid
 // this is the slow way
 //---------------------------------------------------------------------------------------
-/*void GaussianPyramid::ConstructPyramid(const DImage &image, double ratio, int minWidth)
+/*void GaussianPyramidT<T>::ConstructPyramid(const TImage &image, double ratio, int minWidth)
 {
 	// the ratio cannot be arbitrary numbers
 	if(ratio>0.98 || ratio<0.4)
@@ -25,12 +51,12 @@ GaussianPyramid::~GaussianPyramid(void)
 	nLevels=log((double)minWidth/image.width())/log(ratio);
 	if(ImPyramid!=NULL)
 		delete []ImPyramid;
-	ImPyramid=new DImage[nLevels];
+	ImPyramid=new TImage[nLevels];
 	ImPyramid[0].copyData(image);
 	double baseSigma=(1/ratio-1);
 	for(int i=1;i<nLevels;i++)
 	{
-		DImage foo;
+		TImage foo;
 		double sigma=baseSigma*i;
 		image.GaussianSmoothing(foo,sigma,sigma*2.5);
 		foo.imresize(ImPyramid[i],pow(ratio,i));
@@ -41,39 +67,87 @@ GaussianPyramid::~GaussianPyramid(void)
 // function to construct the pyramid
 // this is the fast way
 //---------------------------------------------------------------------------------------
-void GaussianPyramid::ConstructPyramid(const DImage &image, double ratio, int minWidth)
+template <class T>
+void GaussianPyramidT<T>::ConstructPyramid(const TImage &image, double ratio, int minWidth,bool IsHorizontalWrap)
+{
+	ratio=AllocateLevels(image.width(),ratio,minWidth);
+	ImPyramid[0].copyData(image);
+	SmoothLevels(ratio,IsHorizontalWrap);
+}
+
+//---------------------------------------------------------------------------------------
+// the pyramid of an 8 or 16-bit image: the samples are converted once, into the finest
+// level, and the coarser levels are smoothed from it, so the full resolution image is
+// never held at full precision twice. The conversion looks the samples up in a table of
+// the quotients, the same values as dividing each one
+//---------------------------------------------------------------------------------------
+template <class T>
+template <class T1>
+void GaussianPyramidT<T>::ConstructPyramid(const ::Image<T1> &image,double divisor,double ratio,int minWidth,bool IsHorizontalWrap)
+{
+	ratio=AllocateLevels(image.width(),ratio,minWidth);
+	ImPyramid[0].allocate(image);
+	std::vector<T> table(1<<(sizeof(T1)*8));
+	for(size_t i=0;i<table.size();i++)
+		table[i]=(double)i/divisor;
+	const T1* pSrc=image.data();
+	T* pDst=ImPyramid[0].data();
+	int nElements=image.nelements();
+#ifdef _OPENMP
+	#pragma omp parallel for if(nElements>65536)
+#endif
+	for(int i=0;i<nElements;i++)
+		pDst[i]=table[pSrc[i]];
+	SmoothLevels(ratio,IsHorizontalWrap);
+}
+
+//---------------------------------------------------------------------------------------
+// decides how many levels, returns the ratio that is used
+//---------------------------------------------------------------------------------------
+template <class T>
+double GaussianPyramidT<T>::AllocateLevels(int width,double ratio,int minWidth)
 {
 	// the ratio cannot be arbitrary numbers
 	if(ratio>0.98 || ratio<0.4)
 		ratio=0.75;
-	// first decide how many levels
-	nLevels=log((double)minWidth/image.width())/log(ratio);
+	// the levels of a pyramid rebuilt with as many levels keep their buffers
+	int n=log((double)minWidth/width)/log(ratio);
+	if(ImPyramid!=NULL && n==nLevels)
+		return ratio;
+	nLevels=n;
 	if(ImPyramid!=NULL)
 		delete []ImPyramid;
-	ImPyramid=new DImage[nLevels];
-	ImPyramid[0].copyData(image);
+	ImPyramid=new TImage[nLevels];
+	return ratio;
+}
+
+//---------------------------------------------------------------------------------------
+// smooths and resizes the coarser levels from the finest one
+//---------------------------------------------------------------------------------------
+template <class T>
+void GaussianPyramidT<T>::SmoothLevels(double ratio,bool IsHorizontalWrap)
+{
+	const TImage& image=ImPyramid[0];
 	double baseSigma=(1/ratio-1);
 	int n=log(0.25)/log(ratio);
 	double nSigma=baseSigma*n;
 	for(int i=1;i<nLevels;i++)
 	{
-		DImage foo;
 		if(i<=n)
 		{
 			double sigma=baseSigma*i;
-			image.GaussianSmoothing(foo,sigma,sigma*3);
-			foo.imresize(ImPyramid[i],pow(ratio,i));
+			image.GaussianSmoothResize(ImPyramid[i],sigma,sigma*3,pow(ratio,i),IsHorizontalWrap);
 		}
 		else
 		{
-			ImPyramid[i-n].GaussianSmoothing(foo,nSigma,nSigma*3);
-			double rate=(double)pow(ratio,i)*image.width()/foo.width();
-			foo.imresize(ImPyramid[i],rate);
+			double rate=(double)pow(ratio,i)*image.width()/ImPyramid[i-n].width();
+			ImPyramid[i-n].GaussianSmoothResize(ImPyramid[i],nSigma,nSigma*3,rate,IsHorizontalWrap);
 		}
 	}
 }
 
-void GaussianPyramid::ConstructPyramidLevels(const DImage &image, double ratio, int _nLevels)
+template <class T>
+void GaussianPyramidT<T>::ConstructPyramidLevels(const TImage &image, double ratio, int _nLevels)
 {
 	// the ratio cannot be arbitrary numbers
 	if(ratio>0.98 || ratio<0.4)
@@ -81,30 +155,73 @@ void GaussianPyramid::ConstructPyramidLevels(const DImage &image, double ratio,
 	nLevels = _nLevels;
 	if(ImPyramid!=NULL)
 		delete []ImPyramid;
-	ImPyramid=new DImage[nLevels];
+	ImPyramid=new TImage[nLevels];
 	ImPyramid[0].copyData(image);
 	double baseSigma=(1/ratio-1);
 	int n=log(0.25)/log(ratio);
 	double nSigma=baseSigma*n;
 	for(int i=1;i<nLevels;i++)
 	{
-		DImage foo;
 		if(i<=n)
 		{
 			double sigma=baseSigma*i;
-			image.GaussianSmoothing(foo,sigma,sigma*3);
-			foo.imresize(ImPyramid[i],pow(ratio,i));
+			image.GaussianSmoothResize(ImPyramid[i],sigma,sigma*3,pow(ratio,i));
+		}
+		else
+		{
+			double rate=(double)pow(ratio,i)*image.width()/ImPyramid[i-n].width();
+			ImPyramid[i-n].GaussianSmoothResize(ImPyramid[i],nSigma,nSigma*3,rate);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// the same levels and the same rounding as AllocateLevels and SmoothLevels, where the
+// size of a level is that of GaussianSmoothResize from the finer level it is resized from
+//---------------------------------------------------------------------------------------
+template <class T>
+void GaussianPyramidT<T>::LevelDimensions(int width,int height,double ratio,int minWidth,std::vector<int>& widths,std::vector<int>& heights)
+{
+	if(ratio>0.98 || ratio<0.4)
+		ratio=0.75;
+	int levels=log((double)minWidth/width)/log(ratio);
+	int n=log(0.25)/log(ratio);
+	widths.resize(__max(levels,0));
+	heights.resize(__max(levels,0));
+	for(int i=0;i<levels;i++)
+	{
+		double rate;
+		int base;
+		if(i==0)
+		{
+			widths[i]=width;
+			heights[i]=height;
+			continue;
+		}
+		if(i<=n)
+		{
+			base=0;
+			rate=pow(ratio,i);
 		}
 		else
 		{
-			ImPyramid[i-n].GaussianSmoothing(foo,nSigma,nSigma*3);
-			double rate=(double)pow(ratio,i)*image.width()/foo.width();
-			foo.imresize(ImPyramid[i],rate);
+			base=i-n;
+			rate=(double)pow(ratio,i)*width/widths[base];
 		}
+		widths[i]=(double)widths[base]*rate;
+		heights[i]=(double)heights[base]*rate;
 	}
 }
 
-void GaussianPyramid::displayTop(const char *filename)
+template <class T>
+void GaussianPyramidT<T>::displayTop(const char *filename)
 {
 	ImPyramid[nLevels-1].imwrite(filename);
-}
\ No newline at end of file
+}
+
+template class GaussianPyramidT<double>;
+template class GaussianPyramidT<float>;
+template void GaussianPyramidT<double>::ConstructPyramid(const ::Image<unsigned char>&,double,double,int,bool);
+template void GaussianPyramidT<double>::ConstructPyramid(const ::Image<unsigned short>&,double,double,int,bool);
+template void GaussianPyramidT<float>::ConstructPyramid(const ::Image<unsigned char>&,double,double,int,bool);
+template void GaussianPyramidT<float>::ConstructPyramid(const ::Image<unsigned short>&,double,double,int,bool);
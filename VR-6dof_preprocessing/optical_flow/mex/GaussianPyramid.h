@@ -2,20 +2,40 @@
 #define _GaussianPyramid_h
 
 #include "Image.h"
+#include <vector>
 
-class GaussianPyramid
+template <class T>
+class GaussianPyramidT
 {
+public:
+	typedef ::Image<T> TImage;
 private:
-	DImage* ImPyramid;
+	TImage* ImPyramid;
 	int nLevels;
+	double AllocateLevels(int width,double ratio,int minWidth);
+	void SmoothLevels(double ratio,bool IsHorizontalWrap);
 public:
-	GaussianPyramid(void);
-	~GaussianPyramid(void);
-	void ConstructPyramid(const DImage& image,double ratio=0.8,int minWidth=30);
-	void ConstructPyramidLevels(const DImage& image,double ratio =0.8,int _nLevels = 2);
+	GaussianPyramidT(void);
+	// the levels of pyramid are taken over and pyramid is left empty. A pyramid is not copied, its levels
+	// are moved between the pyramids, e.g. of a std::vector of FeaturePyramid
+	GaussianPyramidT(GaussianPyramidT<T>&& pyramid) noexcept;
+	GaussianPyramidT<T>& operator=(GaussianPyramidT<T>&& pyramid) noexcept;
+	void swap(GaussianPyramidT<T>& pyramid) noexcept {std::swap(ImPyramid,pyramid.ImPyramid);std::swap(nLevels,pyramid.nLevels);};
+	~GaussianPyramidT(void);
+	void ConstructPyramid(const TImage& image,double ratio=0.8,int minWidth=30,bool IsHorizontalWrap=false);
+	// the pyramid of a quantized image, the finest level is its samples divided by divisor
+	template <class T1>
+	void ConstructPyramid(const ::Image<T1>& image,double divisor,double ratio,int minWidth,bool IsHorizontalWrap);
+	void ConstructPyramidLevels(const TImage& image,double ratio =0.8,int _nLevels = 2);
 	void displayTop(const char* filename);
+	// the dimensions of the levels ConstructPyramid builds from an image of width x height, without building them
+	static void LevelDimensions(int width,int height,double ratio,int minWidth,std::vector<int>& widths,std::vector<int>& heights);
 	inline int nlevels() const {return nLevels;};
-	inline DImage& Image(int index) {return ImPyramid[index];};
+	inline TImage& Image(int index) {return ImPyramid[index];};
+	inline const TImage& Image(int index) const {return ImPyramid[index];};
 };
 
-#endif
\ No newline at end of file
+typedef GaussianPyramidT<double> GaussianPyramid;
+typedef GaussianPyramidT<float> FGaussianPyramid;
+
+#endif
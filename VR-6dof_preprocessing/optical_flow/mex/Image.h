@@ -4,21 +4,28 @@
 #include "stdio.h"
 #include "memory.h"
 #include "ImageProcessing.h"
+#include "Reduction.h"
+#include "ParallelFor.h"
+#include "MemoryAccounting.h"
 #include <iostream>
 #include <fstream>
 #include <typeinfo>
+#include <utility>
 #include "Vector.h"
 #include "Stochastic.h"
 
-#ifndef _MATLAB
-	#include "ImageIO.h"
-#else
+#if defined(_MATLAB)
 	#include "mex.h"
+#elif !defined(_NO_IMAGEIO)
+	#include "ImageIO.h"
 #endif
 
 using namespace std;
 
 enum collapse_type{collapse_average,collapse_max,collapse_min};
+// an expression of ImageExpression.h
+template <class E>
+class ImageExpr;
 enum color_type{RGB,BGR,DATA,GRAY};
 
 // template class for image
@@ -30,6 +37,7 @@ public:
 protected:
 	int imWidth,imHeight,nChannels;
 	int nPixels,nElements;
+	int nCapacity; // number of elements pData can hold, allocate() reuses the buffer when it fits, counted by MemoryAccounting
 	bool IsDerivativeImage;
 	color_type colorType;
 public:
@@ -37,8 +45,16 @@ public:
 	Image(int width,int height,int nchannels=1);
 	Image(const T& value,int _width,int _height,int _nchannels=1);
 	Image(const Image<T>& other);
+	// the buffer of other is taken over and other is left empty, e.g. for the images returned by value and the
+	// levels of a std::vector that grows
+	Image(Image<T>&& other) noexcept;
 	~Image(void);
 	virtual Image<T>& operator=(const Image<T>& other);
+	Image<T>& operator=(Image<T>&& other) noexcept;
+	// evaluates a lazy expression of images in one pass, see ImageExpression.h
+	template <class E>
+	Image<T>& operator=(const ImageExpr<E>& expression);
+	void swap(Image<T>& other) noexcept;
 
 	virtual inline void computeDimension(){nPixels=imWidth*imHeight;nElements=nPixels*nChannels;};
 
@@ -49,6 +65,11 @@ public:
 
 	virtual void clear();
 	virtual void reset();
+	// a buffer of width*height*nchannels elements used in place, e.g. the memory of a NumPy array. The image
+	// does not own it, so it is detached before the image is destroyed, cleared or reallocated
+	void attach(T* data,int width,int height,int nchannels=1);
+	// the buffer to its new owner, who frees it with delete [], and the image empty
+	T* detach();
 	virtual void copyData(const Image<T>& other);
 	void setValue(const T& value);
 	void setValue(const T& value,int _width,int _height,int _nchannels=1);
@@ -81,6 +102,7 @@ public:
 	inline int nchannels() const {return nChannels;};
 	inline int npixels() const {return nPixels;};
 	inline int nelements() const {return nElements;};
+	inline int capacity() const {return nCapacity;};
 	inline bool isDerivativeImage() const {return IsDerivativeImage;};
 	inline color_type colortype() const{return colorType;};
 
@@ -116,8 +138,9 @@ public:
 	virtual bool loadImage(const char* filename);
 	virtual bool saveImage(ofstream& myfile) const;
 	virtual bool loadImage(ifstream& myfile);
-#ifndef _MATLAB
+#if !defined(_MATLAB) && !defined(_NO_IMAGEIO)
 	virtual bool imread(const char* filename);
+	virtual bool imread(const cv::Mat& im);
 	virtual bool imwrite(const char* filename) const;
 	virtual bool imwrite(const char* filename,ImageIO::ImageType) const;
 	//virtual bool imread(const QString& filename);
@@ -126,16 +149,21 @@ public:
 	//virtual bool imwrite(const QString& filename,int quality=100) const;
 	//virtual bool imwrite(const QString& filename,ImageIO::ImageType imagetype,int quality=100) const;
 	//virtual bool imwrite(const QString& fileanme,T min,T max,int quality=100) const;
-#else
+#elif defined(_MATLAB)
 	virtual bool imread(const char* filename) const {return true;};
 	virtual bool imwrite(const char* filename) const {return true;};
+#else
+	// no image files without ImageIO
+	virtual bool imread(const char*) {return false;};
+	virtual bool imwrite(const char*) const {return false;};
 #endif
 
 	template <class T1>
 	Image<T1> dx (bool IsAdvancedFilter=false) const;
 
+	// IsHorizontalWrap treats the left and the right borders as adjacent, e.g. in 360 equirectangular images
 	template <class T1>
-	void dx(Image<T1>& image,bool IsAdvancedFilter=false) const;
+	void dx(Image<T1>& image,bool IsAdvancedFilter=false,bool IsHorizontalWrap=false) const;
 
 	template<class T1>
 	Image<T1> dy(bool IsAdvancedFilter=false) const;
@@ -158,11 +186,20 @@ public:
 	void GaussianSmoothing(double sigma,int fsize);
 
 	template <class T1>
-	void GaussianSmoothing(Image<T1>& image,double sigma,int fsize) const;
+	void GaussianSmoothing(Image<T1>& image,double sigma,int fsize,bool IsHorizontalWrap=false) const;
+
+	// GaussianSmoothing by the recursive filter of Young and van Vliet, at the same cost for any sigma. For large
+	// sigma, where the support of the filter of GaussianSmoothing makes it slow
+	template <class T1>
+	void GaussianSmoothingRecursive(Image<T1>& image,double sigma,bool IsHorizontalWrap=false) const;
 
 	template <class T1>
 	void GaussianSmoothing_transpose(Image<T1>& image,double sigma,int fsize) const;
 
+	// GaussianSmoothing followed by imresize(result,ratio), computed only at the samples of the result
+	template <class T1>
+	void GaussianSmoothResize(Image<T1>& result,double sigma,int fsize,double ratio,bool IsHorizontalWrap=false) const;
+
 	template <class T1>
 	void smoothing(Image<T1>& image,double factor=4);
 
@@ -182,13 +219,13 @@ public:
 	Image<T1> imfilter(const double* filter,int fsize) const;
 
 	template <class T1>
-	void imfilter_h(Image<T1>& image,double* filter,int fsize) const;
+	void imfilter_h(Image<T1>& image,double* filter,int fsize,bool IsHorizontalWrap=false) const;
 
 	template <class T1>
 	void imfilter_v(Image<T1>& image,double* filter,int fsize) const;
 
 	template <class T1>
-	void imfilter_hv(Image<T1>& image,const double* hfilter,int hfsize,const double* vfilter,int vfsize) const;
+	void imfilter_hv(Image<T1>& image,const double* hfilter,int hfsize,const double* vfilter,int vfsize,bool IsHorizontalWrap=false) const;
 
 	template<class T1>
 	void imfilter_hv(Image<T1>& image,const Image<double>& hfilter,const Image<double>& vfilter) const;
@@ -223,6 +260,10 @@ public:
 
 	template <class T1>
 	void collapse(Image<T1>& image,collapse_type type = collapse_average) const;
+protected:
+	template <int NC,class T1>
+	void collapseChannels(T1* data,collapse_type type) const;
+public:
 
 	void collapse(collapse_type type = collapse_average);
 
@@ -244,6 +285,15 @@ public:
 	template <class T1,class T2>
 	void separate(unsigned firstNChannels,Image<T1>& image1,Image<T2>& image2) const;
 
+	// the planar layout: the planes of the channels stacked as the rows of a single channel image, plane k
+	// in the rows k*height..(k+1)*height-1, so that the operations along the rows and the per-channel loops
+	// run over contiguous memory. interleave() converts such an image of nchannels planes back
+	template <class T1>
+	void planarize(Image<T1>& planes) const;
+
+	template <class T1>
+	void interleave(Image<T1>& image,int nchannels) const;
+
 	// function to sample patch
 	template <class T1>
 	void getPatch(Image<T1>& patch,double x,double y,int fsize) const;
@@ -252,7 +302,8 @@ public:
 	template <class T1>
 	void crop(Image<T1>& patch,int Left,int Top,int Width,int Height) const;
 
-	// basic numerics of images
+	// basic numerics of images. reset, copyData, setValue, collapse, threshold and the operations below but
+	// MultiplyAcross run on the threads of ParallelFor over large images
 	template <class T1,class T2>
 	void Multiply(const Image<T1>& image1,const Image<T2>& image2);
 
@@ -299,7 +350,8 @@ public:
 	// function to threshold an image
 	void threshold();
 
-	// function to compute the statistics of the image
+	// function to compute the statistics of the image. The sums are parallel over large images and the same
+	// for any number of threads, see Reduction
 	double norm2() const;
 
 	double sum() const;
@@ -307,13 +359,15 @@ public:
 	template <class T1>
 	double innerproduct(Image<T1>& image) const;
 
-	// function to bilateral smooth flow field
+	// function to bilateral smooth flow field. With IsGuidedFilter the guided filter with this image as the
+	// guide approximates it in O(1) per pixel: fsize is the radius of its box window, range_sigma^2 its
+	// regularization, and filter_sigma is not used
 	template <class T1>
-	void BilateralFiltering(Image<T1>& other,int fsize,double filter_signa,double range_sigma);
+	void BilateralFiltering(Image<T1>& other,int fsize,double filter_signa,double range_sigma,bool IsGuidedFilter=false);
 
-	// function to bilateral smooth an image
+	// function to bilateral smooth an image, with IsGuidedFilter approximated as above
 	//Image<T> BilateralFiltering(int fsize,double filter_sigma,double range_sigma);
-	void imBilateralFiltering(Image<T>& result,int fsize,double filter_sigma,double range_sigma);
+	void imBilateralFiltering(Image<T>& result,int fsize,double filter_sigma,double range_sigma,bool IsGuidedFilter=false);
 
 	template <class T1,class T2>
 	int kmeansIndex(int pixelIndex,T1& minDistance,const T2* pDictionary,int nVocabulary, int nDim);
@@ -345,10 +399,22 @@ public:
 	void warpImageBicubic(Image<T>& output,const Image<T1>& coeff,const Image<T2>& vx,const Image<T2>& vy) const;
 
 	template <class T1,class T2>
-	void warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& imdx,const Image<T1>& imdy, const Image<T1>& imdxdy,const Image<T2>& vx,const Image<T2>& vy) const;
+	void warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& imdx,const Image<T1>& imdy, const Image<T1>& imdxdy,const Image<T2>& vx,const Image<T2>& vy,
+										bool IsHorizontalWrap=false) const;
 
 	template <class T1>
-	void warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& vx,const Image<T1>& vy) const;
+	void warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& vx,const Image<T1>& vy,bool IsHorizontalWrap=false) const;
+
+	// the derivatives read by the bicubic warp. They only depend on the image, so a caller that warps the
+	// same image repeatedly computes them once and passes them to warpImageBicubicRef
+	template <class T1>
+	void bicubicDerivatives(Image<T1>& imdx,Image<T1>& imdy,Image<T1>& imdxdy,bool IsHorizontalWrap=false) const;
+protected:
+	// the body of warpImageBicubicRef, with nChannels known at compile time when NC>0
+	template <int NC,class T1,class T2>
+	void warpImageBicubicRefChannels(const Image<T>& ref,Image<T>& output,const Image<T1>& imdx,const Image<T1>& imdy, const Image<T1>& imdxdy,const Image<T2>& vx,const Image<T2>& vy,
+										bool IsHorizontalWrap) const;
+public:
 
 	template <class T1,class T2>
 	void warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& coeff,const Image<T2>& vx,const Image<T2>& vy) const;
@@ -456,8 +522,9 @@ template <class T>
 Image<T>::Image()
 {
 	pData=NULL;
-	imWidth=imHeight=nChannels=nPixels=nElements=0;
+	imWidth=imHeight=nChannels=nPixels=nElements=nCapacity=0;
 	IsDerivativeImage=false;
+	colorType=RGB;
 }
 
 //------------------------------------------------------------------------------------------
@@ -472,15 +539,21 @@ Image<T>::Image(int width,int height,int nchannels)
 	computeDimension();
 	pData=NULL;
 	pData=new T[nElements];
+	nCapacity=nElements;
+	MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
 	if(nElements>0)
 		memset(pData,0,sizeof(T)*nElements);
 	IsDerivativeImage=false;
+	colorType=RGB;
 }
 
 template <class T>
 Image<T>::Image(const T& value,int _width,int _height,int _nchannels)
 {
 	pData=NULL;
+	nCapacity=0;
+	IsDerivativeImage=false;
+	colorType=RGB;
 	allocate(_width,_height,_nchannels);
 	setValue(value);
 }
@@ -497,6 +570,17 @@ Image<T>::Image(const T& value,int _width,int _height,int _nchannels)
 template <class T>
 void Image<T>::allocate(int width,int height,int nchannels)
 {
+	// reuse the current buffer if it is large enough
+	if(pData!=NULL && width*height*nchannels<=nCapacity)
+	{
+		imWidth=width;
+		imHeight=height;
+		nChannels=nchannels;
+		computeDimension();
+		if(nElements>0)
+			memset(pData,0,sizeof(T)*nElements);
+		return;
+	}
 	clear();
 	imWidth=width;
 	imHeight=height;
@@ -507,6 +591,8 @@ void Image<T>::allocate(int width,int height,int nchannels)
 	if(nElements>0)
 	{
 		pData=new T[nElements];
+		nCapacity=nElements;
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
 		memset(pData,0,sizeof(T)*nElements);
 	}
 }
@@ -526,11 +612,38 @@ void Image<T>::allocate(const Image<T1> &other)
 template <class T>
 Image<T>::Image(const Image<T>& other)
 {
-	imWidth=imHeight=nChannels=nElements=0;
+	imWidth=imHeight=nChannels=nElements=nCapacity=0;
 	pData=NULL;
 	copyData(other);
 }
 
+//------------------------------------------------------------------------------------------
+// move constructor
+//------------------------------------------------------------------------------------------
+template <class T>
+Image<T>::Image(Image<T>&& other) noexcept
+{
+	pData=NULL;
+	imWidth=imHeight=nChannels=nPixels=nElements=nCapacity=0;
+	IsDerivativeImage=false;
+	colorType=RGB;
+	swap(other);
+}
+
+template <class T>
+void Image<T>::swap(Image<T>& other) noexcept
+{
+	std::swap(pData,other.pData);
+	std::swap(imWidth,other.imWidth);
+	std::swap(imHeight,other.imHeight);
+	std::swap(nChannels,other.nChannels);
+	std::swap(nPixels,other.nPixels);
+	std::swap(nElements,other.nElements);
+	std::swap(nCapacity,other.nCapacity);
+	std::swap(IsDerivativeImage,other.IsDerivativeImage);
+	std::swap(colorType,other.colorType);
+}
+
 //------------------------------------------------------------------------------------------
 // destructor
 //------------------------------------------------------------------------------------------
@@ -538,7 +651,10 @@ template <class T>
 Image<T>::~Image()
 {
 	if(pData!=NULL)
+	{
+		MemoryAccounting::released((long long)sizeof(T)*nCapacity);
 		delete []pData;
+	}
 }
 
 //------------------------------------------------------------------------------------------
@@ -548,9 +664,37 @@ template <class T>
 void Image<T>::clear()
 {
 	if(pData!=NULL)
+	{
+		MemoryAccounting::released((long long)sizeof(T)*nCapacity);
 		delete []pData;
+	}
 	pData=NULL;
-	imWidth=imHeight=nChannels=nPixels=nElements=0;
+	imWidth=imHeight=nChannels=nPixels=nElements=nCapacity=0;
+}
+
+template <class T>
+void Image<T>::attach(T* data,int width,int height,int nchannels)
+{
+	clear();
+	pData=data;
+	imWidth=width;
+	imHeight=height;
+	nChannels=nchannels;
+	computeDimension();
+	nCapacity=nElements;
+	if(pData!=NULL)
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
+}
+
+template <class T>
+T* Image<T>::detach()
+{
+	T* data=pData;
+	if(pData!=NULL)
+		MemoryAccounting::released((long long)sizeof(T)*nCapacity);
+	pData=NULL;
+	imWidth=imHeight=nChannels=nPixels=nElements=nCapacity=0;
+	return data;
 }
 
 //------------------------------------------------------------------------------------------
@@ -559,15 +703,18 @@ void Image<T>::clear()
 template <class T>
 void Image<T>::reset()
 {
-	if(pData!=NULL)
-		memset(pData,0,sizeof(T)*nElements);
+	if(pData==NULL)
+		return;
+	T* p=pData;
+	ParallelFor::run(nElements,[p](long long begin,long long end) {memset(p+begin,0,sizeof(T)*(end-begin));},imWidth*nChannels);
 }
 
 template <class T>
 void Image<T>::setValue(const T &value)
 {
-	for(int i=0;i<nElements;i++)
-		pData[i]=value;
+	T* p=pData;
+	ParallelFor::run(nElements,[p,&value](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=value;},imWidth*nChannels);
 }
 
 template <class T>
@@ -591,24 +738,30 @@ void Image<T>::copyData(const Image<T>& other)
 	IsDerivativeImage=other.IsDerivativeImage;
 	colorType = other.colorType;
 
-	if(nElements!=other.nElements)
+	if(other.nElements>nCapacity)
 	{
 		nElements=other.nElements;		
 		if(pData!=NULL)
+		{
+			MemoryAccounting::released((long long)sizeof(T)*nCapacity);
 			delete []pData;
+		}
 		pData=NULL;
 		pData=new T[nElements];
+		nCapacity=nElements;
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
 	}
-	if(nElements>0)
-		memcpy(pData,other.pData,sizeof(T)*nElements);
+	else
+		nElements=other.nElements;
+	T* p=pData;
+	const T* p1=other.pData;
+	ParallelFor::run(nElements,[p,p1](long long begin,long long end) {memcpy(p+begin,p1+begin,sizeof(T)*(end-begin));},imWidth*nChannels);
 }
 
 template <class T>
 template <class T1>
 void Image<T>::copy(const Image<T1>& other)
 {
-	clear();
-
 	imWidth=other.width();
 	imHeight=other.height();
 	nChannels=other.nchannels();
@@ -617,8 +770,18 @@ void Image<T>::copy(const Image<T1>& other)
 	IsDerivativeImage=other.isDerivativeImage();
 	colorType = other.colortype();
 
-	pData=NULL;
-	pData=new T[nElements];
+	// the buffer is reused when it is large enough, as in allocate
+	if(nElements>nCapacity)
+	{
+		if(pData!=NULL)
+		{
+			MemoryAccounting::released((long long)sizeof(T)*nCapacity);
+			delete []pData;
+		}
+		pData=new T[nElements];
+		nCapacity=nElements;
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
+	}
 	const T1*& srcData=other.data();
 	for(int i=0;i<nElements;i++)
 		pData[i]=srcData[i];
@@ -642,6 +805,17 @@ Image<T>& Image<T>::operator=(const Image<T>& other)
 	return *this;
 }
 
+template <class T>
+Image<T>& Image<T>::operator=(Image<T>&& other) noexcept
+{
+	if(this!=&other)
+	{
+		clear();
+		swap(other);
+	}
+	return *this;
+}
+
 template <class T>
 bool Image<T>::IsFloat() const
 {
@@ -718,11 +892,14 @@ bool Image<T>::imresize(double ratio)
 
 	ImageProcessing::ResizeImage(pData,pDstData,imWidth,imHeight,nChannels,ratio);
 
+	MemoryAccounting::released((long long)sizeof(T)*nCapacity);
 	delete []pData;
 	pData=pDstData;
 	imWidth=DstWidth;
 	imHeight=DstHeight;
 	computeDimension();
+	nCapacity=nElements;
+	MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
 	return true;
 }
 
@@ -755,7 +932,7 @@ void Image<T>::imresize(Image<T1>& result,int DstWidth,int DstHeight) const
 template <class T>
 void Image<T>::imresize(int dstWidth,int dstHeight)
 {
-	DImage foo(dstWidth,dstHeight,nChannels);
+	Image<T> foo(dstWidth,dstHeight,nChannels);
 	ImageProcessing::ResizeImage(pData,foo.data(),imWidth,imHeight,nChannels,dstWidth,dstHeight);
 	copyData(foo);
 }
@@ -868,7 +1045,7 @@ bool Image<T>::loadImage(ifstream& myfile)
 //------------------------------------------------------------------------------------------
 // function to load the image
 //------------------------------------------------------------------------------------------
-#ifndef _MATLAB
+#if !defined(_MATLAB) && !defined(_NO_IMAGEIO)
 
 template <class T>
 bool Image<T>::imread(const char* filename)
@@ -877,12 +1054,29 @@ bool Image<T>::imread(const char* filename)
 	if(ImageIO::loadImage(filename,pData,imWidth,imHeight,nChannels))
 	{
 		computeDimension();
+		nCapacity=nElements;
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
 		colorType = BGR; // when we use qt or opencv to load the image, it's often BGR
 		return true;
 	}
 	return false;
 }
 
+template <class T>
+bool Image<T>::imread(const cv::Mat& im)
+{
+	clear();
+	if(ImageIO::loadImage(im,pData,imWidth,imHeight,nChannels))
+	{
+		computeDimension();
+		nCapacity=nElements;
+		MemoryAccounting::allocated((long long)sizeof(T)*nCapacity);
+		colorType = BGR;
+		return true;
+	}
+	return false;
+}
+
 
 //template <class T>
 //bool Image<T>::imread(const QString &filename)
@@ -944,7 +1138,7 @@ bool Image<T>::imwrite(const char* filename,ImageIO::ImageType type) const
 //------------------------------------------------------------------------------------------
 template <class T>
 template <class T1>
-void Image<T>::dx(Image<T1>& result,bool IsAdvancedFilter) const
+void Image<T>::dx(Image<T1>& result,bool IsAdvancedFilter,bool IsHorizontalWrap) const
 {
 	if(matchDimension(result)==false)
 		result.allocate(imWidth,imHeight,nChannels);
@@ -953,19 +1147,31 @@ void Image<T>::dx(Image<T1>& result,bool IsAdvancedFilter) const
 	T1*& data=result.data();
 	int i,j,k,offset;
 	if(IsAdvancedFilter==false)
+	{
+		// the channels of a row are contiguous, so the difference runs over the row without a channel loop
+		int nRowElements=(imWidth-1)*nChannels;
 		for(i=0;i<imHeight;i++)
-			for(j=0;j<imWidth-1;j++)
+		{
+			const T* pRow=pData+i*imWidth*nChannels;
+			T1* pDstRow=data+i*imWidth*nChannels;
+			for(j=0;j<nRowElements;j++)
+				pDstRow[j]=(T1)pRow[j+nChannels]-pRow[j];
+		}
+		// the last column differs from the first one
+		if(IsHorizontalWrap)
+			for(i=0;i<imHeight;i++)
 			{
-				offset=i*imWidth+j;
+				offset=i*imWidth+imWidth-1;
 				for(k=0;k<nChannels;k++)
-					data[offset*nChannels+k]=(T1)pData[(offset+1)*nChannels+k]-pData[offset*nChannels+k];
+					data[offset*nChannels+k]=(T1)pData[i*imWidth*nChannels+k]-pData[offset*nChannels+k];
 			}
+	}
 	else
 	{
 		double xFilter[5]={1,-8,0,8,-1};
 		for(i=0;i<5;i++)
 			xFilter[i]/=12;
-		ImageProcessing::hfiltering(pData,data,imWidth,imHeight,nChannels,xFilter,2);
+		ImageProcessing::hfiltering(pData,data,imWidth,imHeight,nChannels,xFilter,2,IsHorizontalWrap);
 	}
 }
 
@@ -989,15 +1195,14 @@ void Image<T>::dy(Image<T1>& result,bool IsAdvancedFilter) const
 		result.allocate(imWidth,imHeight,nChannels);
 	result.setDerivative();
 	T1*& data=result.data();
-	int i,j,k,offset;
+	int i,offset;
 	if(IsAdvancedFilter==false)
-		for(i=0;i<imHeight-1;i++)
-			for(j=0;j<imWidth;j++)
-			{
-				offset=i*imWidth+j;
-				for(k=0;k<nChannels;k++)
-					data[offset*nChannels+k]=(T1)pData[(offset+imWidth)*nChannels+k]-pData[offset*nChannels+k];
-			}
+	{
+		// one difference of rows over all the pixels and channels but the last row
+		int nRowElements=imWidth*nChannels;
+		for(offset=0;offset<(imHeight-1)*nRowElements;offset++)
+			data[offset]=(T1)pData[offset+nRowElements]-pData[offset];
+	}
 	else
 	{
 		double yFilter[5]={1,-8,0,8,-1};
@@ -1168,7 +1373,7 @@ void Image<T>::GaussianSmoothing(double sigma,int fsize)
 
 template <class T>
 template <class T1>
-void Image<T>::GaussianSmoothing(Image<T1>& image,double sigma,int fsize) const 
+void Image<T>::GaussianSmoothing(Image<T1>& image,double sigma,int fsize,bool IsHorizontalWrap) const 
 {
 	Image<T1> foo;
 	// constructing the 1D gaussian filter
@@ -1185,14 +1390,54 @@ void Image<T>::GaussianSmoothing(Image<T1>& image,double sigma,int fsize) const
 		gFilter[i]/=sum;
 
 	// apply filtering
-	imfilter_hv(image,gFilter,fsize,gFilter,fsize);
+	imfilter_hv(image,gFilter,fsize,gFilter,fsize,IsHorizontalWrap);
 
-	delete gFilter;
+	delete []gFilter;
+}
+
+template <class T>
+template <class T1>
+void Image<T>::GaussianSmoothingRecursive(Image<T1>& image,double sigma,bool IsHorizontalWrap) const
+{
+	if(!image.matchDimension(imWidth,imHeight,nChannels))
+		image.allocate(imWidth,imHeight,nChannels);
+	const T* pSrc=pData;
+	T1* pDst=image.data();
+	for(int i=0;i<nElements;i++)
+		pDst[i]=pSrc[i];
+	ImageProcessing::recursiveGaussian(pDst,imWidth,imHeight,nChannels,sigma,IsHorizontalWrap);
 }
 
 //------------------------------------------------------------------------------------------
 // function to do Gaussian smoothing
 //------------------------------------------------------------------------------------------
+template <class T>
+template <class T1>
+void Image<T>::GaussianSmoothResize(Image<T1>& result,double sigma,int fsize,double ratio,bool IsHorizontalWrap) const
+{
+	int DstWidth,DstHeight;
+	DstWidth=(double)imWidth*ratio;
+	DstHeight=(double)imHeight*ratio;
+	if(result.width()!=DstWidth || result.height()!=DstHeight || result.nchannels()!=nChannels)
+		result.allocate(DstWidth,DstHeight,nChannels);
+	// constructing the 1D gaussian filter, as in GaussianSmoothing
+	double* gFilter;
+	gFilter=new double[fsize*2+1];
+	double sum=0;
+	sigma=sigma*sigma*2;
+	for(int i=-fsize;i<=fsize;i++)
+	{
+		gFilter[i+fsize]=exp(-(double)(i*i)/sigma);
+		sum+=gFilter[i+fsize];
+	}
+	for(int i=0;i<2*fsize+1;i++)
+		gFilter[i]/=sum;
+
+	ImageProcessing::FilterResizeImage(pData,result.data(),imWidth,imHeight,nChannels,ratio,gFilter,fsize,IsHorizontalWrap);
+
+	delete []gFilter;
+}
+
 template <class T>
 template <class T1>
 void Image<T>::GaussianSmoothing_transpose(Image<T1>& image,double sigma,int fsize) const 
@@ -1214,7 +1459,7 @@ void Image<T>::GaussianSmoothing_transpose(Image<T1>& image,double sigma,int fsi
 	// apply filtering
 	imfilter_hv_transpose(image,gFilter,fsize,gFilter,fsize);
 
-	delete gFilter;
+	delete []gFilter;
 }
 
 
@@ -1291,11 +1536,11 @@ Image<T1> Image<T>::imfilter(const double *filter, int fsize) const
 
 template <class T>
 template <class T1>
-void Image<T>::imfilter_h(Image<T1>& image,double* filter,int fsize) const
+void Image<T>::imfilter_h(Image<T1>& image,double* filter,int fsize,bool IsHorizontalWrap) const
 {
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
-	ImageProcessing::hfiltering(pData,image.data(),imWidth,imHeight,nChannels,filter,fsize);
+	ImageProcessing::hfiltering(pData,image.data(),imWidth,imHeight,nChannels,filter,fsize,IsHorizontalWrap);
 }
 
 template <class T>
@@ -1310,15 +1555,15 @@ void Image<T>::imfilter_v(Image<T1>& image,double* filter,int fsize) const
 
 template <class T>
 template <class T1>
-void Image<T>::imfilter_hv(Image<T1> &image, const double *hfilter, int hfsize, const double *vfilter, int vfsize) const
+void Image<T>::imfilter_hv(Image<T1> &image, const double *hfilter, int hfsize, const double *vfilter, int vfsize,bool IsHorizontalWrap) const
 {
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
 	T1* pTempBuffer;
 	pTempBuffer=new T1[nElements];
-	ImageProcessing::hfiltering(pData,pTempBuffer,imWidth,imHeight,nChannels,hfilter,hfsize);
+	ImageProcessing::hfiltering(pData,pTempBuffer,imWidth,imHeight,nChannels,hfilter,hfsize,IsHorizontalWrap);
 	ImageProcessing::vfiltering(pTempBuffer,image.data(),imWidth,imHeight,nChannels,vfilter,vfsize);
-    delete pTempBuffer;
+	delete []pTempBuffer;
 }
 
 template <class T>
@@ -1465,33 +1710,54 @@ void Image<T>::collapse(Image<T1> &image,collapse_type type) const
 		image.copy(*this);
 		return;
 	}
-	T1* data=image.data();
-	int offset;
-	double temp;
-	for(int i=0;i<nPixels;i++)
+	switch(nChannels)
 	{
-		offset=i*nChannels;
-		switch(type){
-			case collapse_average:
-				temp=0;
-				for(int j=0;j<nChannels;j++)
-					temp+=pData[offset+j];
-				data[i]=temp/nChannels;
-				break;
-			case collapse_max:
-				data[i] = pData[offset];
-				for(int j=1;j<nChannels;j++)
-					data[i] = __max(data[i],pData[offset+j]);
-				break;
-			case collapse_min:
-				data[i] = pData[offset];
-				for(int j = 1;j<nChannels;j++)
-					data[i]=__min(data[i],pData[offset+j]);
-				break;
-		}
+	case 3:
+		collapseChannels<3>(image.data(),type);
+		break;
+	case 5:
+		collapseChannels<5>(image.data(),type);
+		break;
+	default:
+		collapseChannels<0>(image.data(),type);
 	}
 }
 
+template <class T>
+template <int NC,class T1>
+void Image<T>::collapseChannels(T1* data,collapse_type type) const
+{
+	const int nChannels=(NC>0)?NC:this->nChannels;
+	const T* pData=this->pData;
+	ParallelFor::run(nPixels,[=](long long begin,long long end)
+	{
+		int offset;
+		double temp;
+		for(long long i=begin;i<end;i++)
+		{
+			offset=i*nChannels;
+			switch(type){
+				case collapse_average:
+					temp=0;
+					for(int j=0;j<nChannels;j++)
+						temp+=pData[offset+j];
+					data[i]=temp/nChannels;
+					break;
+				case collapse_max:
+					data[i] = pData[offset];
+					for(int j=1;j<nChannels;j++)
+						data[i] = __max(data[i],pData[offset+j]);
+					break;
+				case collapse_min:
+					data[i] = pData[offset];
+					for(int j = 1;j<nChannels;j++)
+						data[i]=__min(data[i],pData[offset+j]);
+					break;
+			}
+		}
+	},imWidth);
+}
+
 template <class T>
 void Image<T>::collapse(collapse_type type)
 {
@@ -1606,6 +1872,42 @@ void Image<T>::separate(unsigned int firstNChannels, Image<T1> &image1, Image<T2
 		}
 }
 
+//------------------------------------------------------------------------------------------
+// functions to convert between the interleaved and the planar layout
+//------------------------------------------------------------------------------------------
+template <class T>
+template <class T1>
+void Image<T>::planarize(Image<T1>& planes) const
+{
+	if(!planes.matchDimension(imWidth,imHeight*nChannels,1))
+		planes.allocate(imWidth,imHeight*nChannels,1);
+	planes.IsDerivativeImage=IsDerivativeImage;
+	T1* data=planes.data();
+	for(int k=0;k<nChannels;k++)
+	{
+		T1* pPlane=data+(size_t)k*nPixels;
+		for(int i=0;i<nPixels;i++)
+			pPlane[i]=pData[i*nChannels+k];
+	}
+}
+
+template <class T>
+template <class T1>
+void Image<T>::interleave(Image<T1>& image,int nchannels) const
+{
+	int height=imHeight/nchannels,nPlanePixels=imWidth*height;
+	if(!image.matchDimension(imWidth,height,nchannels))
+		image.allocate(imWidth,height,nchannels);
+	image.IsDerivativeImage=IsDerivativeImage;
+	T1* data=image.data();
+	for(int k=0;k<nchannels;k++)
+	{
+		const T* pPlane=pData+(size_t)k*nPlanePixels;
+		for(int i=0;i<nPlanePixels;i++)
+			data[i*nchannels+k]=pPlane[i];
+	}
+}
+
 //------------------------------------------------------------------------------------------
 // function to separate the image into two
 //------------------------------------------------------------------------------------------
@@ -1686,8 +1988,9 @@ void Image<T>::Multiply(const Image<T1>& image1,const Image<T2>& image2,const Im
 	const T2*& pData2=image2.data();
 	const T3*& pData3=image3.data();
 
-	for(int i=0;i<nElements;i++)
-		pData[i]=pData1[i]*pData2[i]*pData3[i];
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=pData1[i]*pData2[i]*pData3[i];},imWidth*nChannels);
 }
 
 template <class T>
@@ -1705,8 +2008,9 @@ void Image<T>::Multiply(const Image<T1>& image1,const Image<T2>& image2)
 	const T1*& pData1=image1.data();
 	const T2*& pData2=image2.data();
 
-	for(int i=0;i<nElements;i++)
-		pData[i]=pData1[i]*pData2[i];
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=pData1[i]*pData2[i];},imWidth*nChannels);
 }
 
 template <class T>
@@ -1739,8 +2043,9 @@ void Image<T>::Multiplywith(const Image<T1> &image1)
 		return;
 	}
 	const T1*& pData1=image1.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]*=pData1[i];
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]*=pData1[i];},imWidth*nChannels);
 }
 
 template <class T>
@@ -1762,8 +2067,9 @@ void Image<T>::MultiplywithAcross(const Image<T1> &image1)
 template <class T>
 void Image<T>::Multiplywith(double value)
 {
-	for(int i=0;i<nElements;i++)
-		pData[i]*=value;
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]*=value;},imWidth*nChannels);
 }
 
 //------------------------------------------------------------------------------------------
@@ -1783,8 +2089,9 @@ void Image<T>::Add(const Image<T1>& image1,const Image<T2>& image2)
 
 	const T1*& pData1=image1.data();
 	const T2*& pData2=image2.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]=pData1[i]+pData2[i];	
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=pData1[i]+pData2[i];},imWidth*nChannels);
 }
 
 template <class T>
@@ -1801,8 +2108,9 @@ void Image<T>::Add(const Image<T1>& image1,const Image<T2>& image2,double ratio)
 
 	const T1*& pData1=image1.data();
 	const T2*& pData2=image2.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]=pData1[i]+pData2[i]*ratio;	
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=pData1[i]+pData2[i]*ratio;},imWidth*nChannels);
 }
 
 template <class T>
@@ -1815,8 +2123,9 @@ void Image<T>::Add(const Image<T1>& image1,const double ratio)
 		return;
 	}
 	const T1*& pData1=image1.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]+=pData1[i]*ratio;	
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]+=pData1[i]*ratio;},imWidth*nChannels);
 }
 
 template <class T>
@@ -1829,15 +2138,17 @@ void Image<T>::Add(const Image<T1>& image1)
 		return;
 	}
 	const T1*& pData1=image1.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]+=pData1[i];	
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]+=pData1[i];},imWidth*nChannels);
 }
 
 template <class T>
 void Image<T>::Add(const T value)
 {
-	for(int i=0;i<nElements;i++)
-		pData[i]+=value;
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]+=value;},imWidth*nChannels);
 }
 
 //------------------------------------------------------------------------------------------
@@ -1857,8 +2168,9 @@ void Image<T>::Subtract(const Image<T1> &image1, const Image<T2> &image2)
 
 	const T1*& pData1=image1.data();
 	const T2*& pData2=image2.data();
-	for(int i=0;i<nElements;i++)
-		pData[i]=(T)pData1[i]-pData2[i];
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=(T)pData1[i]-pData2[i];},imWidth*nChannels);
 }
 
 //------------------------------------------------------------------------------------------
@@ -1904,9 +2216,10 @@ void Image<T>::normalize(Image<T>& image)
 template <class T>
 double Image<T>::norm2() const
 {
-	double result=0;
-	for(int i=0;i<nElements;i++)
-		result+=pData[i]*pData[i];
+	const T* p=pData;
+	double result;
+	Reduction::reduce(nElements,1,&result,[p](int begin,int end,double* sums)
+		{sums[0]=Reduction::sum(begin,end,[p](int i) {return (double)p[i]*p[i];});},(nElements>65536)?0:1);
 	return result;
 }
 
@@ -1918,16 +2231,18 @@ void Image<T>::threshold()
 		ImgMax = 1;
 	else
 		ImgMax = 255;
-	for(int i = 0;i<nPixels*nChannels;i++)
-		pData[i] = __min(__max(pData[i],0),ImgMax);
+	T* p=pData;
+	ParallelFor::run(nElements,[=](long long begin,long long end)
+		{for(long long i=begin;i<end;i++) p[i]=__min(__max(p[i],0),ImgMax);},imWidth*nChannels);
 }
 
 template <class T>
 double Image<T>::sum() const
 {
-	double result=0;
-	for(int i=0;i<nElements;i++)
-		result+=pData[i];
+	const T* p=pData;
+	double result;
+	Reduction::reduce(nElements,1,&result,[p](int begin,int end,double* sums)
+		{sums[0]=Reduction::sum(begin,end,[p](int i) {return (double)p[i];});},(nElements>65536)?0:1);
 	return result;
 }
 
@@ -1935,10 +2250,11 @@ template <class T>
 template <class T1>
 double Image<T>::innerproduct(Image<T1> &image) const
 {
-	double result=0;
-	const T1* pData1=image.data();
-	for(int i=0;i<nElements;i++)
-		result+=pData[i]*pData1[i];
+	const T* p=pData;
+	const T1* p1=image.data();
+	double result;
+	Reduction::reduce(nElements,1,&result,[p,p1](int begin,int end,double* sums)
+		{sums[0]=Reduction::sum(begin,end,[p,p1](int i) {return (double)p[i]*p1[i];});},(nElements>65536)?0:1);
 	return result;
 }
 
@@ -1997,11 +2313,14 @@ double Image<T>::innerproduct(Image<T1> &image) const
 
 template <class T>
 template <class T1>
-void Image<T>::BilateralFiltering(Image<T1>& other,int fsize,double filter_sigma,double range_sigma)
+void Image<T>::BilateralFiltering(Image<T1>& other,int fsize,double filter_sigma,double range_sigma,bool IsGuidedFilter)
 {
-	double *pBuffer;
+	if(IsGuidedFilter)
+	{
+		ImageProcessing::guidedfiltering(pData,nChannels,other.data(),other.data(),imWidth,imHeight,other.nchannels(),fsize,range_sigma*range_sigma);
+		return;
+	}
 	Image<T1> result(other);
-	pBuffer=new double[other.nchannels()];
 
 	// set spatial weight to save time
 	double *pSpatialWeight;
@@ -2011,53 +2330,65 @@ void Image<T>::BilateralFiltering(Image<T1>& other,int fsize,double filter_sigma
 		for(int j=-fsize;j<=fsize;j++)
 			pSpatialWeight[(i+fsize)*flength+j+fsize]=exp(-(double)(i*i+j*j)/(2*filter_sigma*filter_sigma));
 
-	for(int i=0;i<imHeight;i++)
-		for(int j=0;j<imWidth;j++)
-		{
-			double totalWeight=0;
-			for(int k=0;k<other.nchannels();k++)
-				pBuffer[k]=0;
-			for(int ii=-fsize;ii<=fsize;ii++)
-				for(int jj=-fsize;jj<=fsize;jj++)
-				{
-					int x=j+jj;
-					int y=i+ii;
-					if(x<0 || x>=imWidth || y<0 || y>=imHeight)
-						continue;
-
-					// compute weight
-					int offset=(y*imWidth+x)*nChannels;
-					double temp=0;
-					for(int k=0;k<nChannels;k++)
+	// the pixels are independent, so the rows are filtered in parallel
+#ifdef _OPENMP
+	#pragma omp parallel if((double)nPixels*flength*flength>65536)
+#endif
+	{
+		double *pBuffer=new double[other.nchannels()];
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int i=0;i<imHeight;i++)
+			for(int j=0;j<imWidth;j++)
+			{
+				double totalWeight=0;
+				for(int k=0;k<other.nchannels();k++)
+					pBuffer[k]=0;
+				for(int ii=-fsize;ii<=fsize;ii++)
+					for(int jj=-fsize;jj<=fsize;jj++)
 					{
-						double diff=pData[offset+k]-pData[(i*imWidth+j)*nChannels+k];
-						temp+=diff*diff;
+						int x=j+jj;
+						int y=i+ii;
+						if(x<0 || x>=imWidth || y<0 || y>=imHeight)
+							continue;
+
+						// compute weight
+						int offset=(y*imWidth+x)*nChannels;
+						double temp=0;
+						for(int k=0;k<nChannels;k++)
+						{
+							double diff=pData[offset+k]-pData[(i*imWidth+j)*nChannels+k];
+							temp+=diff*diff;
+						}
+						double weight=exp(-temp/(2*range_sigma*range_sigma));
+						weight *= pSpatialWeight[(ii+fsize)*flength+jj+fsize];
+						//weight*=exp(-(double)(ii*ii+jj*jj)/(2*filter_sigma*filter_sigma));
+						totalWeight+=weight;
+						for(int k=0;k<other.nchannels();k++)
+							pBuffer[k]+=other.data()[(y*imWidth+x)*other.nchannels()+k]*weight;
 					}
-					double weight=exp(-temp/(2*range_sigma*range_sigma));
-					weight *= pSpatialWeight[(ii+fsize)*flength+jj+fsize];
-					//weight*=exp(-(double)(ii*ii+jj*jj)/(2*filter_sigma*filter_sigma));
-					totalWeight+=weight;
-					for(int k=0;k<other.nchannels();k++)
-						pBuffer[k]+=other.data()[(y*imWidth+x)*other.nchannels()+k]*weight;
-				}
-			for(int k=0;k<other.nchannels();k++)
-				result.data()[(i*imWidth+j)*other.nchannels()]=pBuffer[k]/totalWeight;
-		}
+				for(int k=0;k<other.nchannels();k++)
+					result.data()[(i*imWidth+j)*other.nchannels()+k]=pBuffer[k]/totalWeight;
+			}
+		delete []pBuffer;
+	}
 	other.copyData(result);
-	delete pBuffer;
-	delete pSpatialWeight;
+	delete []pSpatialWeight;
 }
 
 
 template <class T>
 //Image<T>  Image<T>::BilateralFiltering(int fsize,double filter_sigma,double range_sigma)
-void  Image<T>::imBilateralFiltering(Image<T>& result,int fsize,double filter_sigma,double range_sigma)
+void  Image<T>::imBilateralFiltering(Image<T>& result,int fsize,double filter_sigma,double range_sigma,bool IsGuidedFilter)
 {
 	//Image<T> result(*this);
 	result.allocate(*this);
-
-	double *pBuffer;
-	pBuffer=new double[nChannels];
+	if(IsGuidedFilter)
+	{
+		ImageProcessing::guidedfiltering(pData,nChannels,pData,result.data(),imWidth,imHeight,nChannels,fsize,range_sigma*range_sigma);
+		return;
+	}
 
 	// set spatial weight to save time
 	double *pSpatialWeight;
@@ -2067,43 +2398,53 @@ void  Image<T>::imBilateralFiltering(Image<T>& result,int fsize,double filter_si
 		for(int j=-fsize;j<=fsize;j++)
 			pSpatialWeight[(i+fsize)*flength+j+fsize]=exp(-(double)(i*i+j*j)/(2*filter_sigma*filter_sigma));
 
-	for(int i=0;i<imHeight;i++)
-		for(int j=0;j<imWidth;j++)
-		{
-			double totalWeight=0;
-			for(int k=0;k<nChannels;k++)
-				pBuffer[k]=0;
-			int offset0 = (i*imWidth+j)*nChannels;
-			for(int ii=-fsize;ii<=fsize;ii++)
-				for(int jj=-fsize;jj<=fsize;jj++)
-				{
-					int x=j+jj;
-					int y=i+ii;
-					if(x<0 || x>=imWidth || y<0 || y>=imHeight)
-						continue;
-
-					// compute weight
-					int offset=(y*imWidth+x)*nChannels;
-					double temp=0;
-					for(int k=0;k<nChannels;k++)
+	// the pixels are independent, so the rows are filtered in parallel
+#ifdef _OPENMP
+	#pragma omp parallel if((double)nPixels*flength*flength>65536)
+#endif
+	{
+		double *pBuffer=new double[nChannels];
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int i=0;i<imHeight;i++)
+			for(int j=0;j<imWidth;j++)
+			{
+				double totalWeight=0;
+				for(int k=0;k<nChannels;k++)
+					pBuffer[k]=0;
+				int offset0 = (i*imWidth+j)*nChannels;
+				for(int ii=-fsize;ii<=fsize;ii++)
+					for(int jj=-fsize;jj<=fsize;jj++)
 					{
-						double diff=pData[offset+k]-pData[offset0+k];
-						temp+=diff*diff;
+						int x=j+jj;
+						int y=i+ii;
+						if(x<0 || x>=imWidth || y<0 || y>=imHeight)
+							continue;
+
+						// compute weight
+						int offset=(y*imWidth+x)*nChannels;
+						double temp=0;
+						for(int k=0;k<nChannels;k++)
+						{
+							double diff=pData[offset+k]-pData[offset0+k];
+							temp+=diff*diff;
+						}
+						double weight=exp(-temp/(2*range_sigma*range_sigma));
+						weight *= pSpatialWeight[(ii+fsize)*flength+jj+fsize];
+
+						//weight*=exp(-(double)(ii*ii+jj*jj)/(2*filter_sigma*filter_sigma));
+						totalWeight+=weight;
+						for(int k=0;k<nChannels;k++)
+							pBuffer[k]+=pData[offset+k]*weight;
 					}
-					double weight=exp(-temp/(2*range_sigma*range_sigma));
-					weight *= pSpatialWeight[(ii+fsize)*flength+jj+fsize];
-
-					//weight*=exp(-(double)(ii*ii+jj*jj)/(2*filter_sigma*filter_sigma));
-					totalWeight+=weight;
-					for(int k=0;k<nChannels;k++)
-						pBuffer[k]+=pData[offset+k]*weight;
-				}
-			for(int k=0;k<nChannels;k++)
-				result.data()[offset0+k]=pBuffer[k]/totalWeight;
+				for(int k=0;k<nChannels;k++)
+					result.data()[offset0+k]=pBuffer[k]/totalWeight;
 
-		}
-	delete pBuffer;
-	delete pSpatialWeight;
+			}
+		delete []pBuffer;
+	}
+	delete []pSpatialWeight;
 	//return result;
 }
 
@@ -2461,14 +2802,21 @@ void Image<T>::warpImageBicubicCoeff(Image<T1>& output) const
 
 template <class T>
 template <class T1>
-void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& vx,const Image<T1>& vy) const
+void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& vx,const Image<T1>& vy,bool IsHorizontalWrap) const
 {
-	double dfilter[3] = {-0.5,0,0.5};
 	DImage imdx,imdy,imdxdy;
-	imfilter_h(imdx,dfilter,1);
+	bicubicDerivatives(imdx,imdy,imdxdy,IsHorizontalWrap);
+	warpImageBicubicRef(ref,output,imdx,imdy,imdxdy,vx,vy,IsHorizontalWrap);
+}
+
+template <class T>
+template <class T1>
+void Image<T>::bicubicDerivatives(Image<T1>& imdx,Image<T1>& imdy,Image<T1>& imdxdy,bool IsHorizontalWrap) const
+{
+	double dfilter[3] = {-0.5,0,0.5};
+	imfilter_h(imdx,dfilter,1,IsHorizontalWrap);
 	imfilter_v(imdy,dfilter,1);
 	imdx.imfilter_v(imdxdy,dfilter,1);
-	warpImageBicubicRef(ref,output,imdx,imdy,imdxdy,vx,vy);
 }
 
 template <class T>
@@ -2498,8 +2846,31 @@ void Image<T>::DissembleFlow(Image<T1>& vx,Image<T1>& vy) const
 template <class T>
 template <class T1,class T2>
 void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Image<T1>& imdx,const Image<T1>& imdy,const Image<T1>& imdxdy,
-																		const Image<T2>& vx,const Image<T2>& vy) const
+																		const Image<T2>& vx,const Image<T2>& vy,bool IsHorizontalWrap) const
 {
+	// the gray and color images and the 3 and 5 channel features of the flow are unrolled over the channels
+	switch(nChannels)
+	{
+	case 1:
+		warpImageBicubicRefChannels<1>(ref,output,imdx,imdy,imdxdy,vx,vy,IsHorizontalWrap);
+		break;
+	case 3:
+		warpImageBicubicRefChannels<3>(ref,output,imdx,imdy,imdxdy,vx,vy,IsHorizontalWrap);
+		break;
+	case 5:
+		warpImageBicubicRefChannels<5>(ref,output,imdx,imdy,imdxdy,vx,vy,IsHorizontalWrap);
+		break;
+	default:
+		warpImageBicubicRefChannels<0>(ref,output,imdx,imdy,imdxdy,vx,vy,IsHorizontalWrap);
+	}
+}
+
+template <class T>
+template <int NC,class T1,class T2>
+void Image<T>::warpImageBicubicRefChannels(const Image<T>& ref,Image<T>& output,const Image<T1>& imdx,const Image<T1>& imdy,const Image<T1>& imdxdy,
+																		const Image<T2>& vx,const Image<T2>& vy,bool IsHorizontalWrap) const
+{
+	const int nChannels=(NC>0)?NC:this->nChannels;
 	T* pIm = pData;
 	const T1* pImDx = imdx.data();
 	const T1* pImDy = imdy.data();
@@ -2508,8 +2879,6 @@ void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Im
 	int height = vx.height();
 	if(!output.matchDimension(width,height,nChannels))
 		output.allocate(width,height,nChannels);
-	double a[4][4];
-	int offsets[2][2];
 
 	T ImgMax;
 	if(IsFloat())
@@ -2517,13 +2886,25 @@ void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Im
 	else
 		ImgMax = 255;
 
+	// the pixels are independent, so the rows are warped in parallel
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height*nChannels>65536)
+#endif
 	for(int i  = 0; i<height; i++)
 		for(int j = 0;j<width;j++)
 		{
+			double a[4][4];
+			int offsets[2][2];
 			int offset = i*width+j;
 			double x = j + vx.pData[offset];
 			double y = i + vy.pData[offset];
-			if(x<0 || x>imWidth-1 || y<0 || y>imHeight-1)
+			if(IsHorizontalWrap)
+			{
+				x = fmod(x,(double)imWidth);
+				if(x<0)
+					x += imWidth;
+			}
+			if(x<0 || (x>imWidth-1 && !IsHorizontalWrap) || y<0 || y>imHeight-1)
 			{
 				for(int k = 0; k<nChannels;k++)
 					output.pData[offset*nChannels+k] = ref.pData[offset*nChannels+k];
@@ -2533,6 +2914,8 @@ void Image<T>::warpImageBicubicRef(const Image<T>& ref,Image<T>& output,const Im
 			int y0 = y;
 			int x1 = x0+1;
 			int y1 = y0+1;
+			if(IsHorizontalWrap)
+				x1 = x1%imWidth;
 			x0 = __min(__max(x0,0),imWidth-1);
 			x1 = __min(__max(x1,0),imWidth-1);
 			y0 = __min(__max(y0,0),imHeight-1);
@@ -2697,6 +3080,55 @@ T Image<T>::min() const
 
 #ifdef _MATLAB
 
+//------------------------------------------------------------------------------------------------------------
+// the matlab arrays are column major with one plane per channel and the images row major with the channels
+// interleaved. The transposes walk both in tiles of 32x32 pixels, so the reads and the writes of a tile stay
+// in the cache, and the samples are multiplied by multiplier/divisor in double precision
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void MatlabPlanesToImage(T2* pImage,const T1* pMatlabPlane,int width,int height,int nChannels,double multiplier=1,double divisor=1)
+{
+	const int tile=32;
+	int nPixels=width*height;
+#ifdef _OPENMP
+	#pragma omp parallel for if(nPixels*nChannels>65536)
+#endif
+	for(int i0=0;i0<height;i0+=tile)
+		for(int j0=0;j0<width;j0+=tile)
+		{
+			int i1=__min(i0+tile,height),j1=__min(j0+tile,width);
+			for(int k=0;k<nChannels;k++)
+				for(int j=j0;j<j1;j++)
+				{
+					const T1* pColumn=pMatlabPlane+k*nPixels+j*height;
+					for(int i=i0;i<i1;i++)
+						pImage[(i*width+j)*nChannels+k]=(double)pColumn[i]*multiplier/divisor;
+				}
+		}
+}
+
+template <class T1,class T2>
+void ImageToMatlabPlanes(T1* pMatlabPlane,const T2* pImage,int width,int height,int nChannels)
+{
+	const int tile=32;
+	int nPixels=width*height;
+#ifdef _OPENMP
+	#pragma omp parallel for if(nPixels*nChannels>65536)
+#endif
+	for(int i0=0;i0<height;i0+=tile)
+		for(int j0=0;j0<width;j0+=tile)
+		{
+			int i1=__min(i0+tile,height),j1=__min(j0+tile,width);
+			for(int k=0;k<nChannels;k++)
+				for(int j=j0;j<j1;j++)
+				{
+					T1* pColumn=pMatlabPlane+k*nPixels+j*height;
+					for(int i=i0;i<i1;i++)
+						pColumn[i]=pImage[(i*width+j)*nChannels+k];
+				}
+		}
+}
+
 template <class T>
 template <class T1>
 void Image<T>::LoadMatlabImageCore(const mxArray *image,bool IsImageScaleCovnersion)
@@ -2721,17 +3153,10 @@ void Image<T>::LoadMatlabImageCore(const mxArray *image,bool IsImageScaleCovners
 		ConvertFromMatlab<T1>(pMatlabPlane,imWidth,imHeight,nChannels);
 		return;
 	}
-	int offset=0;
 	if(isfloat==true)
-		for(int i=0;i<imHeight;i++)
-			for(int j=0;j<imWidth;j++)
-				for(int k=0;k<nChannels;k++)
-					pData[offset++]=(double)pMatlabPlane[k*nPixels+j*imHeight+i]/255;
+		MatlabPlanesToImage(pData,pMatlabPlane,imWidth,imHeight,nChannels,1,255);
 	else
-		for(int i=0;i<imHeight;i++)
-			for(int j=0;j<imWidth;j++)
-				for(int k=0;k<nChannels;k++)
-					pData[offset++]=(double)pMatlabPlane[k*nPixels+j*imHeight+i]*255;
+		MatlabPlanesToImage(pData,pMatlabPlane,imWidth,imHeight,nChannels,255,1);
 }
 
 template <class T>
@@ -2789,11 +3214,7 @@ void Image<T>::ConvertFromMatlab(const T1 *pMatlabPlane, int _width, int _height
 {
 	if(imWidth!=_width || imHeight!=_height || nChannels!=_nchannels)
 		allocate(_width,_height,_nchannels);
-	int offset=0;
-	for(int i=0;i<imHeight;i++)
-		for(int j=0;j<imWidth;j++)
-			for(int k=0;k<nChannels;k++)
-				pData[offset++]=pMatlabPlane[k*nPixels+j*imHeight+i];
+	MatlabPlanesToImage(pData,pMatlabPlane,imWidth,imHeight,nChannels);
 }
 
 // convert image data to matlab matrix
@@ -2801,11 +3222,7 @@ template <class T>
 template <class T1>
 void Image<T>::ConvertToMatlab(T1 *pMatlabPlane) const
 {
-	int offset=0;
-	for(int i=0;i<imHeight;i++)
-		for(int j=0;j<imWidth;j++)
-			for(int k=0;k<nChannels;k++)
-				pMatlabPlane[k*nPixels+j*imHeight+i]=pData[offset++];
+	ImageToMatlabPlanes(pMatlabPlane,pData,imWidth,imHeight,nChannels);
 }
 
 template <class T>
@@ -2839,4 +3256,5 @@ void Image<T>::OutputToMatlab(mxArray *&matrix) const
 
 #endif
 
-
+// the lazy arithmetic of the images
+#include "ImageExpression.h"
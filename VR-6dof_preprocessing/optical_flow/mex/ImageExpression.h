@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Image.h"
+#include <iostream>
+#include <type_traits>
+
+//--------------------------------------------------------------------------------------------------------
+// lazy elementwise arithmetic of images. a+b, a-b, a*b, a/b and -a of images, of scalars and of other
+// expressions build an expression that keeps references to its images, and assigning it to an image
+// evaluates it in one loop over the elements, e.g.
+//
+//   out = psi*(dx*dy);           // instead of foo.Multiply(dx,dy); out.Multiply(psi,foo);
+//   Im = Im1*0.4+Im2*0.6;        // instead of Im.copyData(Im1); Im.Multiplywith(0.4); Im.Add(Im2,0.6);
+//
+// without the temporary images and the passes of Multiply, Add... The images of an expression have the
+// dimensions of the image it is assigned to, which is allocated to them otherwise, and the image may be one
+// of them since every element only depends on the elements at its own index. The elements are evaluated in
+// double and rounded to the type of the image once, so with float images the result may differ from the
+// chain of Multiply and Add by the rounding of its intermediate images. The expressions are meant to be
+// assigned where they are written, they hold references to the images and not copies
+//--------------------------------------------------------------------------------------------------------
+template <class E>
+class ImageExpr
+{
+public:
+	inline const E& self() const {return static_cast<const E&>(*this);};
+};
+
+// an image in an expression
+template <class T>
+class ImageTerm : public ImageExpr< ImageTerm<T> >
+{
+	const T* pData;
+	const Image<T>& image;
+public:
+	ImageTerm(const Image<T>& _image) : pData(_image.data()),image(_image) {};
+	inline double operator[](int i) const {return pData[i];};
+	// the dimensions of the first image of the expression
+	inline bool dimension(int& width,int& height,int& nchannels) const
+	{
+		width=image.width();
+		height=image.height();
+		nchannels=image.nchannels();
+		return true;
+	};
+	inline bool matchDimension(int width,int height,int nchannels) const {return image.matchDimension(width,height,nchannels);};
+};
+
+// a scalar in an expression, the same at every element
+class ScalarTerm : public ImageExpr<ScalarTerm>
+{
+	double value;
+public:
+	ScalarTerm(double _value) : value(_value) {};
+	inline double operator[](int) const {return value;};
+	inline bool dimension(int&,int&,int&) const {return false;};
+	inline bool matchDimension(int,int,int) const {return true;};
+};
+
+struct ExprAdd {static inline double apply(double a,double b) {return a+b;}};
+struct ExprSubtract {static inline double apply(double a,double b) {return a-b;}};
+struct ExprMultiply {static inline double apply(double a,double b) {return a*b;}};
+struct ExprDivide {static inline double apply(double a,double b) {return a/b;}};
+
+template <class Op,class L,class R>
+class BinaryExpr : public ImageExpr< BinaryExpr<Op,L,R> >
+{
+	L left;
+	R right;
+public:
+	BinaryExpr(const L& _left,const R& _right) : left(_left),right(_right) {};
+	inline double operator[](int i) const {return Op::apply(left[i],right[i]);};
+	inline bool dimension(int& width,int& height,int& nchannels) const {return left.dimension(width,height,nchannels) || right.dimension(width,height,nchannels);};
+	inline bool matchDimension(int width,int height,int nchannels) const
+	{
+		return left.matchDimension(width,height,nchannels) && right.matchDimension(width,height,nchannels);
+	};
+};
+
+template <class E>
+class NegateExpr : public ImageExpr< NegateExpr<E> >
+{
+	E operand;
+public:
+	NegateExpr(const E& _operand) : operand(_operand) {};
+	inline double operator[](int i) const {return -operand[i];};
+	inline bool dimension(int& width,int& height,int& nchannels) const {return operand.dimension(width,height,nchannels);};
+	inline bool matchDimension(int width,int height,int nchannels) const {return operand.matchDimension(width,height,nchannels);};
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the types that the operators take, as the terms of the expression. Anything else, two scalars included,
+// is left to the other operators
+//--------------------------------------------------------------------------------------------------------
+template <class X,class Enable=void>
+struct ExprOperand
+{
+	static const bool IsOperand=false;
+	static const bool IsScalar=false;
+};
+
+template <class X>
+struct ExprOperand<X,typename std::enable_if<std::is_base_of<ImageExpr<X>,X>::value>::type>
+{
+	static const bool IsOperand=true;
+	static const bool IsScalar=false;
+	typedef X type;
+	static inline const X& term(const X& x) {return x;};
+};
+
+template <class X>
+struct ExprOperand<X,typename std::enable_if<std::is_arithmetic<X>::value>::type>
+{
+	static const bool IsOperand=true;
+	static const bool IsScalar=true;
+	typedef ScalarTerm type;
+	static inline ScalarTerm term(X x) {return ScalarTerm(x);};
+};
+
+template <class T>
+struct ExprOperand< Image<T>,void >
+{
+	static const bool IsOperand=true;
+	static const bool IsScalar=false;
+	typedef ImageTerm<T> type;
+	static inline ImageTerm<T> term(const Image<T>& image) {return ImageTerm<T>(image);};
+};
+
+// the expression of a binary operator, no type for the operands that aren't terms
+template <class Op,class L,class R,
+			bool IsEnabled=ExprOperand<L>::IsOperand && ExprOperand<R>::IsOperand && !(ExprOperand<L>::IsScalar && ExprOperand<R>::IsScalar)>
+struct ExprResult
+{
+};
+
+template <class Op,class L,class R>
+struct ExprResult<Op,L,R,true>
+{
+	typedef BinaryExpr<Op,typename ExprOperand<L>::type,typename ExprOperand<R>::type> type;
+};
+
+template <class L,class R>
+inline typename ExprResult<ExprAdd,L,R>::type operator+(const L& left,const R& right)
+{
+	return typename ExprResult<ExprAdd,L,R>::type(ExprOperand<L>::term(left),ExprOperand<R>::term(right));
+}
+
+template <class L,class R>
+inline typename ExprResult<ExprSubtract,L,R>::type operator-(const L& left,const R& right)
+{
+	return typename ExprResult<ExprSubtract,L,R>::type(ExprOperand<L>::term(left),ExprOperand<R>::term(right));
+}
+
+template <class L,class R>
+inline typename ExprResult<ExprMultiply,L,R>::type operator*(const L& left,const R& right)
+{
+	return typename ExprResult<ExprMultiply,L,R>::type(ExprOperand<L>::term(left),ExprOperand<R>::term(right));
+}
+
+template <class L,class R>
+inline typename ExprResult<ExprDivide,L,R>::type operator/(const L& left,const R& right)
+{
+	return typename ExprResult<ExprDivide,L,R>::type(ExprOperand<L>::term(left),ExprOperand<R>::term(right));
+}
+
+template <class X>
+inline typename std::enable_if<ExprOperand<X>::IsOperand && !ExprOperand<X>::IsScalar,NegateExpr<typename ExprOperand<X>::type> >::type operator-(const X& operand)
+{
+	return NegateExpr<typename ExprOperand<X>::type>(ExprOperand<X>::term(operand));
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the evaluation of an expression into an image, in one pass
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+template <class E>
+Image<T>& Image<T>::operator=(const ImageExpr<E>& expression)
+{
+	const E& e=expression.self();
+	int width=0,height=0,nchannels=0;
+	if(!e.dimension(width,height,nchannels))
+	{
+		std::cout<<"An expression of images has no image!"<<std::endl;
+		return *this;
+	}
+	if(!e.matchDimension(width,height,nchannels))
+	{
+		std::cout<<"The dimensions of the images of the expression don't match!"<<std::endl;
+		return *this;
+	}
+	if(!matchDimension(width,height,nchannels))
+		allocate(width,height,nchannels);
+	T* pDst=pData;
+	int n=nElements;
+#ifdef _OPENMP
+	#pragma omp parallel for if(n>65536)
+#endif
+	for(int i=0;i<n;i++)
+		pDst[i]=e[i];
+	return *this;
+}
@@ -1,8 +1,9 @@
 #ifndef _ImageIO_h
 #define _ImageIO_h
 
-#include "cv.h"
-#include "highgui.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include "RawImage.h"
 
 class ImageIO
 {
@@ -14,14 +15,52 @@ public:
 	template <class T>
 	static bool loadImage(const char* filename,T*& pImagePlane,int& width,int& height, int& nchannels);
 	template <class T>
+	static bool loadImage(const cv::Mat& im,T*& pImagePlane,int& width,int& height, int& nchannels);
+	template <class T>
 	static bool saveImage(const char* filename,const T* pImagePlane,int width,int height, int nchannels,ImageType imtype = standard);
+	// cv::imread, or the samples of a raw image (see RawImage.h) in 8 bits
+	static cv::Mat imread(const char* filename);
 
 };
 
+// the intermediate files of the extensions of RawImage are mapped instead of decoded
 template <class T>
 bool ImageIO::loadImage(const char *filename, T *&pImagePlane, int &width, int &height, int &nchannels)
 {
+	if(RawImage::IsRawFile(filename))
+	{
+		RawImageReader reader;
+		if(!reader.open(filename))
+			return false;
+		width = reader.width();
+		height = reader.height();
+		nchannels = reader.nchannels();
+		pImagePlane = new T[width*height*nchannels];
+		return reader.read(pImagePlane);
+	}
 	cv::Mat im = cv::imread(filename);
+	return loadImage(im,pImagePlane,width,height,nchannels);
+}
+
+inline cv::Mat ImageIO::imread(const char* filename)
+{
+	if(!RawImage::IsRawFile(filename))
+		return cv::imread(filename);
+	RawImageReader reader;
+	cv::Mat im;
+	if(reader.open(filename))
+	{
+		im.create(reader.height(),reader.width(),CV_MAKETYPE(CV_8U,reader.nchannels()));
+		if(!reader.read(im.data))
+			im.release();
+	}
+	return im;
+}
+
+// the image planes of a decoded frame, e.g. from cv::VideoCapture
+template <class T>
+bool ImageIO::loadImage(const cv::Mat& im, T *&pImagePlane, int &width, int &height, int &nchannels)
+{
 	if(im.data == NULL) // if allocation fails
 		return false;
 	if(im.type()!= CV_8UC1 && im.type()!=CV_8UC3 && im.type()!=CV_8UC4) // we only support three types of image information for now
@@ -58,9 +97,13 @@ bool ImageIO::loadImage(const char *filename, T *&pImagePlane, int &width, int &
 	return true;
 }
 
+// the files of the extensions of RawImage keep the samples of any number of channels as they are, without imtype
 template <class T>
 bool ImageIO::saveImage(const char* filename,const T* pImagePlane,int width,int height, int nchannels,ImageType imtype)
 {
+	RawImage::Sample sample;
+	if(RawImage::IsRawFile(filename,&sample))
+		return RawImage::write(filename,pImagePlane,width,height,nchannels,sample);
 	cv::Mat im;
 	switch(nchannels){
 		case 1:
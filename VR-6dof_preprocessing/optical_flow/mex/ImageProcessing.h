@@ -5,6 +5,9 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include <typeinfo>
+#include <vector>
+#include <algorithm>
+#include "FlowKernels.h"
 
 //----------------------------------------------------------------------------------
 // class to handle basic image processing functions
@@ -21,12 +24,15 @@ public:
 	// basic functions
 	template <class T>
 	static inline T EnforceRange(const T& x,const int& MaxValue) {return __min(__max(x,0),MaxValue-1);};
+	// the index of a column when the left and the right borders are adjacent, e.g. in 360 equirectangular images
+	static inline int WrapRange(int x,int MaxValue) {x%=MaxValue; return (x<0)?x+MaxValue:x;};
+	static inline int BoundaryRange(int x,int MaxValue,bool IsWrap) {return IsWrap?WrapRange(x,MaxValue):EnforceRange(x,MaxValue);};
 
 	//---------------------------------------------------------------------------------
 	// function to interpolate the image plane
 	//---------------------------------------------------------------------------------
 	template <class T1,class T2> 
-	static inline void BilinearInterpolate(const T1* pImage,int width,int height,int nChannels,double x,double y,T2* result);
+	static inline void BilinearInterpolate(const T1* pImage,int width,int height,int nChannels,double x,double y,T2* result,bool IsHorizontalWrap=false);
 
 	template <class T1>
 	static inline T1 BilinearInterpolate(const T1* pImage,int width,int height,double x,double y);
@@ -38,6 +44,17 @@ public:
 	template <class T1>
 	static inline T1 BilinearInterpolate_transpose(const T1* pImage,int width,int height,double x,double y);
 
+	// BilinearInterpolate of the n samples (x[j],y[j]) of a row at once, accumulated into result+j*nChannels. The
+	// samples of pInside 0 are skipped, their coordinates aren't read and nothing is added to their result
+	template <class T1,class T2>
+	static void BilinearInterpolateRow(const T1* pImage,int width,int height,int nChannels,const double* x,const double* y,int n,T2* result,
+												bool IsHorizontalWrap=false,const unsigned char* pInside=NULL);
+	// the blend of a block of BilinearInterpolateRow from the offsets and the weights of the four neighbours of its
+	// samples, with nChannels known at compile time when NC>0
+	template <int NC,class T1,class T2>
+	static inline void BilinearBlendBlock(const T1* pImage,int nChannels,const int* offsets,const double* weights,int n,T2* result);
+	enum {BilinearBlock=64};
+
 	template <class T1,class T2>
 	static void ResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double Ratio);
 
@@ -48,17 +65,44 @@ public:
 	// functions for 1D filtering
 	//---------------------------------------------------------------------------------
 	template <class T1,class T2>
-	static void hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize);
+	static void hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize,bool IsHorizontalWrap=false);
 
 	template <class T1,class T2>
 	static void vfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize);
 
+	// the row kernel of hfiltering, with nChannels known at compile time when NC>0
+	template <int NC,class T1,class T2>
+	static inline void hfilteringRow(const T1* pSrcRow,T2* pDstRow,int width,int nChannels,const double* pfilter1D,int fsize,bool IsHorizontalWrap);
+
+	// the columns of a strip of vfiltering that keep the rows read by the filter in L2
+	static inline int vfilteringStripWidth(int width,int nChannels,int elementSize,int fsize);
+
 	template <class T1,class T2>
 	static void hfiltering_transpose(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize);
 
 	template <class T1,class T2>
 	static void vfiltering_transpose(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize);
 
+	// hfiltering and vfiltering with the same filter followed by ResizeImage, evaluating the filters only at the
+	// pixels read by the interpolation
+	template <class T1,class T2>
+	static void FilterResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double Ratio,
+										const double* pfilter1D,int fsize,bool IsHorizontalWrap=false);
+
+	// the resize of the two components of a flow field to DstWidth x DstHeight multiplied by scale, in one parallel
+	// pass; the same as ResizeImage and Multiplywith on each component
+	template <class T1,class T2>
+	static void ResizeFlow(const T1* pSrcVx,const T1* pSrcVy,T2* pDstVx,T2* pDstVy,int SrcWidth,int SrcHeight,int DstWidth,int DstHeight,
+									double scale);
+
+	// ResizeFlow with the joint bilateral upsampling guided by an image at both sizes: the flow of the 4x4 source
+	// pixels around a sample is averaged with the weights of their distance and of the difference between the
+	// guide and the source guide, of range sigma, so that the flow does not bleed across the edges of the guide
+	template <class T1,class T2,class T3>
+	static void JointBilateralResizeFlow(const T1* pSrcVx,const T1* pSrcVy,T2* pDstVx,T2* pDstVy,int SrcWidth,int SrcHeight,
+													int DstWidth,int DstHeight,double scale,const T3* pSrcGuide,const T3* pDstGuide,int nChannels,
+													double sigma,bool IsHorizontalWrap=false);
+
 	//---------------------------------------------------------------------------------
 	// functions for 2D filtering
 	//---------------------------------------------------------------------------------
@@ -71,6 +115,27 @@ public:
 	template <class T1,class T2>
 	static void Laplacian(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels);
 
+	// the mean over the box of the given radius clipped to the image, in place and parallel
+	template <class T>
+	static void boxfiltering(T* pImage,int width,int height,int nChannels,int radius);
+
+	// the guided filter of pInput with pGuide, an O(1) per pixel edge-preserving smoothing
+	template <class T1,class T2>
+	static void guidedfiltering(const T1* pGuide,int nGuideChannels,const T2* pInput,T2* pOutput,int width,int height,int nChannels,
+										int radius,double epsilon);
+
+	// the coefficients of the recursive Gaussian of standard deviation sigma, and its passes along a line
+	struct RecursiveGaussian
+	{
+		double B,a[3],M[9];
+		RecursiveGaussian(double sigma);
+		inline void filter(double* pLine,double* pForward,int n,int nChannels) const;
+	};
+
+	// the Gaussian smoothing by the recursive filter, in place, in O(1) per pixel for any sigma
+	template <class T>
+	static void recursiveGaussian(T* pImage,int width,int height,int nChannels,double sigma,bool IsHorizontalWrap=false);
+
 	//---------------------------------------------------------------------------------
 	// functions for sample a patch from the image
 	//---------------------------------------------------------------------------------
@@ -81,7 +146,12 @@ public:
 	// function to warp image
 	//---------------------------------------------------------------------------------
 	template <class T1,class T2>
-	static void warpImage(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pVx,const T2* pVy,int width,int height,int nChannels);
+	static void warpImage(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pVx,const T2* pVy,int width,int height,int nChannels,bool IsHorizontalWrap=false);
+
+	// row i of warpImage above, all of its pixels written
+	template <class T1,class T2>
+	static void warpImageRow(T1* pWarpRow,const T1* pIm1Row,const T1* pIm2,const T2* pVxRow,const T2* pVyRow,int i,int width,int height,int nChannels,
+								bool IsHorizontalWrap);
 
 	template <class T1,class T2>
 	static void warpImageFlow(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pFlow,int width,int height,int nChannels);
@@ -124,7 +194,7 @@ public:
 // function to interplate multi-channel image plane for (x,y)
 // --------------------------------------------------------------------------------------------------
 template <class T1,class T2>
-inline void ImageProcessing::BilinearInterpolate(const T1* pImage,int width,int height,int nChannels,double x,double y,T2* result)
+inline void ImageProcessing::BilinearInterpolate(const T1* pImage,int width,int height,int nChannels,double x,double y,T2* result,bool IsHorizontalWrap)
 {
 	int xx,yy,m,n,u,v,l,offset;
 	xx=x;
@@ -136,7 +206,7 @@ inline void ImageProcessing::BilinearInterpolate(const T1* pImage,int width,int
 	for(m=0;m<=1;m++)
 		for(n=0;n<=1;n++)
 		{
-			u=EnforceRange(xx+m,width);
+			u=BoundaryRange(xx+m,width,IsHorizontalWrap);
 			v=EnforceRange(yy+n,height);
 			offset=(v*width+u)*nChannels;
 			s=fabs(1-m-dx)*fabs(1-n-dy);
@@ -194,6 +264,85 @@ inline void ImageProcessing::BilinearInterpolate_transpose(const T1* pInput,int
 		}
 }
 
+//--------------------------------------------------------------------------------------------------
+// the samples of a row in blocks: the offsets and the weights of the neighbours of a block first, in
+// the order of BilinearInterpolate, (0,0) (0,1) (1,0) (1,1), then the blend of the block. The blend
+// of one channel gathers the neighbours of several samples at once (see FlowKernels::BilinearGather),
+// and the blends of 3 and 5 channels are unrolled at compile time. The products and the sums are
+// those of BilinearInterpolate in the same order, so the results are identical
+// --------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::BilinearInterpolateRow(const T1* pImage,int width,int height,int nChannels,const double* x,const double* y,int n,T2* result,
+												bool IsHorizontalWrap,const unsigned char* pInside)
+{
+	int offsets[4*BilinearBlock];
+	double weights[4*BilinearBlock];
+	for(int j0=0;j0<n;j0+=BilinearBlock)
+	{
+		int nBlock=__min(n-j0,(int)BilinearBlock);
+		for(int j=0;j<nBlock;j++)
+		{
+			if(pInside!=NULL && !pInside[j0+j])
+			{
+				for(int m=0;m<4;m++)
+				{
+					offsets[m*BilinearBlock+j]=0;
+					weights[m*BilinearBlock+j]=0;
+				}
+				continue;
+			}
+			int xx=x[j0+j],yy=y[j0+j];
+			double dx=__max(__min(x[j0+j]-xx,1),0);
+			double dy=__max(__min(y[j0+j]-yy,1),0);
+			int u0=BoundaryRange(xx,width,IsHorizontalWrap),u1=BoundaryRange(xx+1,width,IsHorizontalWrap);
+			int v0=EnforceRange(yy,height)*width,v1=EnforceRange(yy+1,height)*width;
+			offsets[j]=(v0+u0)*nChannels;
+			offsets[BilinearBlock+j]=(v1+u0)*nChannels;
+			offsets[2*BilinearBlock+j]=(v0+u1)*nChannels;
+			offsets[3*BilinearBlock+j]=(v1+u1)*nChannels;
+			weights[j]=(1-dx)*(1-dy);
+			weights[BilinearBlock+j]=(1-dx)*dy;
+			weights[2*BilinearBlock+j]=dx*(1-dy);
+			weights[3*BilinearBlock+j]=dx*dy;
+		}
+		T2* pResult=result+j0*nChannels;
+		switch(nChannels)
+		{
+		case 1:
+			BilinearBlendBlock<1>(pImage,nChannels,offsets,weights,nBlock,pResult);
+			break;
+		case 3:
+			BilinearBlendBlock<3>(pImage,nChannels,offsets,weights,nBlock,pResult);
+			break;
+		case 5:
+			BilinearBlendBlock<5>(pImage,nChannels,offsets,weights,nBlock,pResult);
+			break;
+		default:
+			BilinearBlendBlock<0>(pImage,nChannels,offsets,weights,nBlock,pResult);
+		}
+	}
+}
+
+template <int NC,class T1,class T2>
+inline void ImageProcessing::BilinearBlendBlock(const T1* pImage,int nChannels,const int* offsets,const double* weights,int n,T2* result)
+{
+	const int nc=(NC>0)?NC:nChannels;
+	int j=0;
+	if(NC==1)
+		j=FlowKernels::BilinearGather(result,pImage,offsets,weights,n,BilinearBlock);
+	for(;j<n;j++)
+	{
+		T2* pResult=result+j*nc;
+		for(int m=0;m<4;m++)
+		{
+			const T1* pPixel=pImage+offsets[m*BilinearBlock+j];
+			double s=weights[m*BilinearBlock+j];
+			for(int k=0;k<nc;k++)
+				pResult[k]+=pPixel[k]*s;
+		}
+	}
+}
+
 //------------------------------------------------------------------------------------------------------------
 // this is the most general function for reszing an image with a varying nChannels
 // bilinear interpolation is used for now. It might be replaced by other (bicubic) interpolation methods 
@@ -206,17 +355,16 @@ void ImageProcessing::ResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth
 	DstHeight=(double)SrcHeight*Ratio;
 	memset(pDstImage,0,sizeof(T2)*DstWidth*DstHeight*nChannels);
 	
-	double x,y;
-
+	// the columns of the samples are the same on every row
+	std::vector<double> x(DstWidth),y(DstWidth);
+	for(int j=0;j<DstWidth;j++)
+		x[j]=(double)(j+1)/Ratio-1;
 	for(int i=0;i<DstHeight;i++)
-		for(int j=0;j<DstWidth;j++)
-		{
-			x=(double)(j+1)/Ratio-1;
-			y=(double)(i+1)/Ratio-1;
-
-			// bilinear interpolation
-			BilinearInterpolate(pSrcImage,SrcWidth,SrcHeight,nChannels,x,y,pDstImage+(i*DstWidth+j)*nChannels);
-		}
+	{
+		std::fill(y.begin(),y.end(),(double)(i+1)/Ratio-1);
+		// bilinear interpolation
+		BilinearInterpolateRow(pSrcImage,SrcWidth,SrcHeight,nChannels,x.data(),y.data(),DstWidth,pDstImage+i*DstWidth*nChannels);
+	}
 }
 
 template <class T1,class T2>
@@ -226,42 +374,357 @@ void ImageProcessing::ResizeImage(const T1 *pSrcImage, T2 *pDstImage, int SrcWid
 	double yRatio=(double)DstHeight/SrcHeight;
 	memset(pDstImage,sizeof(T2)*DstWidth*DstHeight*nChannels,0);
 
-	double x,y;
+	std::vector<double> x(DstWidth),y(DstWidth);
+	for(int j=0;j<DstWidth;j++)
+		x[j]=(double)(j+1)/xRatio-1;
+	for(int i=0;i<DstHeight;i++)
+	{
+		std::fill(y.begin(),y.end(),(double)(i+1)/yRatio-1);
+		// bilinear interpolation
+		BilinearInterpolateRow(pSrcImage,SrcWidth,SrcHeight,nChannels,x.data(),y.data(),DstWidth,pDstImage+i*DstWidth*nChannels);
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// fused smoothing and downsampling for the pyramids. The bilinear interpolation of ResizeImage reads at most two
+// columns and two rows of the smoothed image per output pixel, and only one when the sampling position is an
+// integer. The horizontal filter is evaluated at these columns, on the rows that the vertical filter reads,
+// and the vertical filter only at the rows read; the sums are accumulated in the same order as in hfiltering,
+// vfiltering and BilinearInterpolate, so the result is identical to the three passes. The passes are
+// parallel over the rows, and the vertical pass runs along contiguous rows of the compacted columns
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::FilterResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double Ratio,
+														const double* pfilter1D,int fsize,bool IsHorizontalWrap)
+{
+	int DstWidth,DstHeight;
+	DstWidth=(double)SrcWidth*Ratio;
+	DstHeight=(double)SrcHeight*Ratio;
+	memset(pDstImage,0,sizeof(T2)*DstWidth*DstHeight*nChannels);
+	if(DstWidth<=0 || DstHeight<=0)
+		return;
 
+	// the sampling positions of ResizeImage, and the compacted index of the columns and rows they read
+	std::vector<int> xx(DstWidth),yy(DstHeight);
+	std::vector<double> dx(DstWidth),dy(DstHeight);
+	std::vector<int> colIndex(SrcWidth,-1),rowIndex(SrcHeight,-1);
+	std::vector<int> cols,rows;
+	for(int j=0;j<DstWidth;j++)
+	{
+		double x=(double)(j+1)/Ratio-1;
+		xx[j]=x;
+		dx[j]=__max(__min(x-xx[j],1),0);
+		for(int m=0;m<=1;m++)
+			if(fabs(1-m-dx[j])>0)
+			{
+				int u=EnforceRange(xx[j]+m,SrcWidth);
+				if(colIndex[u]<0)
+				{
+					colIndex[u]=cols.size();
+					cols.push_back(u);
+				}
+			}
+	}
 	for(int i=0;i<DstHeight;i++)
+	{
+		double y=(double)(i+1)/Ratio-1;
+		yy[i]=y;
+		dy[i]=__max(__min(y-yy[i],1),0);
+		for(int n=0;n<=1;n++)
+			if(fabs(1-n-dy[i])>0)
+			{
+				int v=EnforceRange(yy[i]+n,SrcHeight);
+				if(rowIndex[v]<0)
+				{
+					rowIndex[v]=rows.size();
+					rows.push_back(v);
+				}
+			}
+	}
+	// the source rows read by the vertical filter
+	std::vector<int> hRows;
+	std::vector<char> IsRead(SrcHeight,0);
+	for(int r=0;r<(int)rows.size();r++)
+		for(int l=-fsize;l<=fsize;l++)
+			IsRead[EnforceRange(rows[r]+l,SrcHeight)]=1;
+	for(int i=0;i<SrcHeight;i++)
+		if(IsRead[i])
+			hRows.push_back(i);
+
+	int nCols=cols.size(),nRows=rows.size(),nHRows=hRows.size();
+	int rowStride=nCols*nChannels;
+	std::vector<T2> hBuffer((size_t)SrcHeight*rowStride),vBuffer((size_t)nRows*rowStride);
+	bool IsParallel=(double)SrcHeight*SrcWidth*nChannels>65536;
+
+	// horizontal filtering at the compacted columns
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int r=0;r<nHRows;r++)
+	{
+		int i=hRows[r];
+		const T1* pSrcRow=pSrcImage+i*SrcWidth*nChannels;
+		T2* pRow=&hBuffer[(size_t)i*rowStride];
+		for(int c=0;c<nCols;c++)
+		{
+			T2* pBuffer=pRow+c*nChannels;
+			if(cols[c]-fsize>=0 && cols[c]+fsize<SrcWidth)
+			{
+				// no boundary within the support of the filter
+				const T1* pSrc=pSrcRow+(cols[c]-fsize)*nChannels;
+				for(int l=0;l<=2*fsize;l++,pSrc+=nChannels)
+				{
+					double w=pfilter1D[l];
+					for(int k=0;k<nChannels;k++)
+						pBuffer[k]+=pSrc[k]*w;
+				}
+				continue;
+			}
+			for(int l=-fsize;l<=fsize;l++)
+			{
+				double w=pfilter1D[l+fsize];
+				int jj=BoundaryRange(cols[c]+l,SrcWidth,IsHorizontalWrap);
+				for(int k=0;k<nChannels;k++)
+					pBuffer[k]+=pSrcRow[jj*nChannels+k]*w;
+			}
+		}
+	}
+
+	// vertical filtering at the compacted rows
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int r=0;r<nRows;r++)
+	{
+		T2* pRow=&vBuffer[(size_t)r*rowStride];
+		for(int l=-fsize;l<=fsize;l++)
+		{
+			double w=pfilter1D[l+fsize];
+			const T2* pHRow=&hBuffer[(size_t)EnforceRange(rows[r]+l,SrcHeight)*rowStride];
+			for(int k=0;k<rowStride;k++)
+				pRow[k]+=pHRow[k]*w;
+		}
+	}
+
+	// bilinear interpolation, skipping the taps of zero weight
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<DstHeight;i++)
+		for(int j=0;j<DstWidth;j++)
+		{
+			T2* result=pDstImage+(i*DstWidth+j)*nChannels;
+			for(int m=0;m<=1;m++)
+				for(int n=0;n<=1;n++)
+				{
+					double s=fabs(1-m-dx[j])*fabs(1-n-dy[i]);
+					if(s==0)
+						continue;
+					const T2* pData=&vBuffer[(size_t)rowIndex[EnforceRange(yy[i]+n,SrcHeight)]*rowStride+colIndex[EnforceRange(xx[j]+m,SrcWidth)]*nChannels];
+					for(int l=0;l<nChannels;l++)
+						result[l]+=pData[l]*s;
+				}
+		}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the flow between the pyramid levels. The sampling positions and the weights of the bilinear interpolation are
+// computed once per column and per row instead of per pixel and component, and the taps are summed in the order
+// of BilinearInterpolate with the same rounding, so the result is identical to ResizeImage and Multiplywith
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::ResizeFlow(const T1* pSrcVx,const T1* pSrcVy,T2* pDstVx,T2* pDstVy,int SrcWidth,int SrcHeight,int DstWidth,int DstHeight,
+											double scale)
+{
+	if(DstWidth<=0 || DstHeight<=0)
+		return;
+	double xRatio=(double)DstWidth/SrcWidth;
+	double yRatio=(double)DstHeight/SrcHeight;
+	// the two source columns of every destination column and their weights
+	std::vector<int> u0(DstWidth),u1(DstWidth);
+	std::vector<double> wx0(DstWidth),wx1(DstWidth);
+	for(int j=0;j<DstWidth;j++)
+	{
+		double x=(double)(j+1)/xRatio-1;
+		int xx=x;
+		double dx=__max(__min(x-xx,1),0);
+		u0[j]=EnforceRange(xx,SrcWidth);
+		u1[j]=EnforceRange(xx+1,SrcWidth);
+		wx0[j]=fabs(1-dx);
+		wx1[j]=fabs(-dx);
+	}
+	bool IsParallel=(double)DstWidth*DstHeight>65536;
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<DstHeight;i++)
+	{
+		double y=(double)(i+1)/yRatio-1;
+		int yy=y;
+		double dy=__max(__min(y-yy,1),0);
+		double wy0=fabs(1-dy),wy1=fabs(-dy);
+		const T1* pVx0=pSrcVx+EnforceRange(yy,SrcHeight)*SrcWidth;
+		const T1* pVx1=pSrcVx+EnforceRange(yy+1,SrcHeight)*SrcWidth;
+		const T1* pVy0=pSrcVy+EnforceRange(yy,SrcHeight)*SrcWidth;
+		const T1* pVy1=pSrcVy+EnforceRange(yy+1,SrcHeight)*SrcWidth;
+		T2* pVx=pDstVx+i*DstWidth;
+		T2* pVy=pDstVy+i*DstWidth;
 		for(int j=0;j<DstWidth;j++)
 		{
-			x=(double)(j+1)/xRatio-1;
-			y=(double)(i+1)/yRatio-1;
+			double s00=wx0[j]*wy0,s01=wx0[j]*wy1,s10=wx1[j]*wy0,s11=wx1[j]*wy1;
+			T2 vx=0,vy=0;
+			vx+=pVx0[u0[j]]*s00;
+			vx+=pVx1[u0[j]]*s01;
+			vx+=pVx0[u1[j]]*s10;
+			vx+=pVx1[u1[j]]*s11;
+			vy+=pVy0[u0[j]]*s00;
+			vy+=pVy1[u0[j]]*s01;
+			vy+=pVy0[u1[j]]*s10;
+			vy+=pVy1[u1[j]]*s11;
+			vx*=scale;
+			vy*=scale;
+			pVx[j]=vx;
+			pVy[j]=vy;
+		}
+	}
+}
 
-			// bilinear interpolation
-			BilinearInterpolate(pSrcImage,SrcWidth,SrcHeight,nChannels,x,y,pDstImage+(i*DstWidth+j)*nChannels);
+//------------------------------------------------------------------------------------------------------------
+// the joint bilateral upsampling of a flow field. The spatial weight is a Gaussian of one source pixel over the
+// distance to the sampling position of ResizeFlow, the range weight a Gaussian of sigma over the RMS difference
+// of the channels of the guide at the destination pixel and of the source guide at the source pixel. Where all
+// the range weights vanish the spatial weights alone are used
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2,class T3>
+void ImageProcessing::JointBilateralResizeFlow(const T1* pSrcVx,const T1* pSrcVy,T2* pDstVx,T2* pDstVy,int SrcWidth,int SrcHeight,
+															int DstWidth,int DstHeight,double scale,const T3* pSrcGuide,const T3* pDstGuide,int nChannels,
+															double sigma,bool IsHorizontalWrap)
+{
+	if(DstWidth<=0 || DstHeight<=0)
+		return;
+	double xRatio=(double)DstWidth/SrcWidth;
+	double yRatio=(double)DstHeight/SrcHeight;
+	const int radius=2,taps=2*radius;
+	// the source columns of every destination column and their spatial weights
+	std::vector<int> us((size_t)DstWidth*taps);
+	std::vector<double> wxs((size_t)DstWidth*taps);
+	for(int j=0;j<DstWidth;j++)
+	{
+		double x=(double)(j+1)/xRatio-1;
+		int xx=floor(x);
+		for(int m=0;m<taps;m++)
+		{
+			double d=xx+m-radius+1-x;
+			us[j*taps+m]=BoundaryRange(xx+m-radius+1,SrcWidth,IsHorizontalWrap);
+			wxs[j*taps+m]=exp(-d*d/2);
+		}
+	}
+	double rangeFactor=-1/(2*sigma*sigma*nChannels);
+	bool IsParallel=(double)DstWidth*DstHeight>16384;
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<DstHeight;i++)
+	{
+		double y=(double)(i+1)/yRatio-1;
+		int yy=floor(y);
+		int vs[taps];
+		double wys[taps];
+		for(int n=0;n<taps;n++)
+		{
+			double d=yy+n-radius+1-y;
+			vs[n]=EnforceRange(yy+n-radius+1,SrcHeight);
+			wys[n]=exp(-d*d/2);
+		}
+		for(int j=0;j<DstWidth;j++)
+		{
+			const T3* pGuide=pDstGuide+(i*DstWidth+j)*nChannels;
+			double sum=0,sumVx=0,sumVy=0,spatial=0,spatialVx=0,spatialVy=0;
+			for(int n=0;n<taps;n++)
+				for(int m=0;m<taps;m++)
+				{
+					int offset=vs[n]*SrcWidth+us[j*taps+m];
+					double w=wxs[j*taps+m]*wys[n];
+					const T3* pSrc=pSrcGuide+offset*nChannels;
+					double d2=0;
+					for(int k=0;k<nChannels;k++)
+						d2+=((double)pGuide[k]-pSrc[k])*((double)pGuide[k]-pSrc[k]);
+					double wr=w*exp(d2*rangeFactor);
+					sum+=wr;
+					sumVx+=pSrcVx[offset]*wr;
+					sumVy+=pSrcVy[offset]*wr;
+					spatial+=w;
+					spatialVx+=pSrcVx[offset]*w;
+					spatialVy+=pSrcVy[offset]*w;
+				}
+			if(sum<1E-12*spatial)
+			{
+				sum=spatial;
+				sumVx=spatialVx;
+				sumVy=spatialVy;
+			}
+			pDstVx[i*DstWidth+j]=sumVx/sum*scale;
+			pDstVy[i*DstWidth+j]=sumVy/sum*scale;
 		}
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
 //  horizontal direction filtering
+// the channels of the common images (gray, color and the 3 and 5 channel flow features) are unrolled at compile
+// time, and the pixels away from the borders skip the boundary handling
 //------------------------------------------------------------------------------------------------------------
-template <class T1,class T2>
-void ImageProcessing::hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize)
+template <int NC,class T1,class T2>
+inline void ImageProcessing::hfilteringRow(const T1* pSrcRow,T2* pDstRow,int width,int nChannels,const double* pfilter1D,int fsize,bool IsHorizontalWrap)
 {
-	memset(pDstImage,0,sizeof(T2)*width*height*nChannels);
-	T2* pBuffer;
-	double w;
-	int i,j,l,k,offset,jj;
-	for(i=0;i<height;i++)
-		for(j=0;j<width;j++)
+	const int nc=(NC>0)?NC:nChannels;
+	for(int j=0;j<width;j++)
+	{
+		T2* pBuffer=pDstRow+j*nc;
+		if(j-fsize>=0 && j+fsize<width)
 		{
-			offset=i*width*nChannels;
-			pBuffer=pDstImage+offset+j*nChannels;
-			for(l=-fsize;l<=fsize;l++)
+			const T1* pSrc=pSrcRow+(j-fsize)*nc;
+			for(int l=0;l<=2*fsize;l++,pSrc+=nc)
 			{
-				w=pfilter1D[l+fsize];
-				jj=EnforceRange(j+l,width);
-				for(k=0;k<nChannels;k++)
-					pBuffer[k]+=pSrcImage[offset+jj*nChannels+k]*w;
+				double w=pfilter1D[l];
+				for(int k=0;k<nc;k++)
+					pBuffer[k]+=pSrc[k]*w;
 			}
+			continue;
+		}
+		for(int l=-fsize;l<=fsize;l++)
+		{
+			double w=pfilter1D[l+fsize];
+			int jj=BoundaryRange(j+l,width,IsHorizontalWrap);
+			for(int k=0;k<nc;k++)
+				pBuffer[k]+=pSrcRow[jj*nc+k]*w;
 		}
+	}
+}
+
+template <class T1,class T2>
+void ImageProcessing::hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize,bool IsHorizontalWrap)
+{
+	memset(pDstImage,0,sizeof(T2)*width*height*nChannels);
+	for(int i=0;i<height;i++)
+	{
+		const T1* pSrcRow=pSrcImage+i*width*nChannels;
+		T2* pDstRow=pDstImage+i*width*nChannels;
+		switch(nChannels)
+		{
+		case 1:
+			hfilteringRow<1>(pSrcRow,pDstRow,width,nChannels,pfilter1D,fsize,IsHorizontalWrap);
+			break;
+		case 3:
+			hfilteringRow<3>(pSrcRow,pDstRow,width,nChannels,pfilter1D,fsize,IsHorizontalWrap);
+			break;
+		case 5:
+			hfilteringRow<5>(pSrcRow,pDstRow,width,nChannels,pfilter1D,fsize,IsHorizontalWrap);
+			break;
+		default:
+			hfilteringRow<0>(pSrcRow,pDstRow,width,nChannels,pfilter1D,fsize,IsHorizontalWrap);
+		}
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -331,26 +794,38 @@ void ImageProcessing::Laplacian(const T1 *pSrcImage, T2 *pDstImage, int width, i
 
 //------------------------------------------------------------------------------------------------------------
 // vertical direction filtering
+// the image is processed in strips of columns narrow enough that the 2*fsize+1 source rows read for one output
+// row are still in L2 for the next one. Within a strip every tap adds one contiguous source row to the output
+// row, whatever nChannels is; the taps are added in the same order as per pixel
 //------------------------------------------------------------------------------------------------------------
+inline int ImageProcessing::vfilteringStripWidth(int width,int nChannels,int elementSize,int fsize)
+{
+	const int L2Size=256*1024;
+	int stripWidth=L2Size/((2*fsize+2)*nChannels*elementSize);
+	stripWidth=__max(stripWidth/16*16,16);
+	return __min(stripWidth,width);
+}
+
 template <class T1,class T2>
 void ImageProcessing::vfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* pfilter1D,int fsize)
 {
 	memset(pDstImage,0,sizeof(T2)*width*height*nChannels);
-	T2* pBuffer;
-	double w;
-	int i,j,l,k,offset,ii;
-	for(i=0;i<height;i++)
-		for(j=0;j<width;j++)
+	int stripWidth=vfilteringStripWidth(width,nChannels,sizeof(T1),fsize);
+	for(int left=0;left<width;left+=stripWidth)
+	{
+		int nElements=(__min(left+stripWidth,width)-left)*nChannels;
+		for(int i=0;i<height;i++)
 		{
-			pBuffer=pDstImage+(i*width+j)*nChannels;
-			for(l=-fsize;l<=fsize;l++)
+			T2* pBuffer=pDstImage+(i*width+left)*nChannels;
+			for(int l=-fsize;l<=fsize;l++)
 			{
-				w=pfilter1D[l+fsize];
-				ii=EnforceRange(i+l,height);
-				for(k=0;k<nChannels;k++)
-					pBuffer[k]+=pSrcImage[(ii*width+j)*nChannels+k]*w;
+				double w=pfilter1D[l+fsize];
+				const T1* pSrc=pSrcImage+(EnforceRange(i+l,height)*width+left)*nChannels;
+				for(int k=0;k<nElements;k++)
+					pBuffer[k]+=pSrc[k]*w;
 			}
 		}
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -440,6 +915,376 @@ void ImageProcessing::filtering_transpose(const T1* pSrcImage,T2* pDstImage,int
 }
 
 
+//------------------------------------------------------------------------------------------------------------
+// the mean over the (2*radius+1)x(2*radius+1) window clipped to the image, in place. Each pass is a running
+// sum, so the cost doesn't depend on the radius; the rows of the horizontal pass and the strips of columns
+// of the vertical pass are independent
+//------------------------------------------------------------------------------------------------------------
+template <class T>
+void ImageProcessing::boxfiltering(T* pImage,int width,int height,int nChannels,int radius)
+{
+	bool IsParallel=(double)width*height*nChannels>65536;
+	int rowStride=width*nChannels;
+#ifdef _OPENMP
+	#pragma omp parallel if(IsParallel)
+#endif
+	{
+		std::vector<double> row(rowStride),sum(nChannels);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int i=0;i<height;i++)
+		{
+			T* pRow=pImage+(size_t)i*rowStride;
+			for(int k=0;k<rowStride;k++)
+				row[k]=pRow[k];
+			for(int k=0;k<nChannels;k++)
+				sum[k]=0;
+			for(int j=0;j<__min(radius,width);j++)
+				for(int k=0;k<nChannels;k++)
+					sum[k]+=row[j*nChannels+k];
+			for(int j=0;j<width;j++)
+			{
+				if(j+radius<width)
+					for(int k=0;k<nChannels;k++)
+						sum[k]+=row[(j+radius)*nChannels+k];
+				if(j-radius-1>=0)
+					for(int k=0;k<nChannels;k++)
+						sum[k]-=row[(j-radius-1)*nChannels+k];
+				double count=__min(j+radius,width-1)-__max(j-radius,0)+1;
+				for(int k=0;k<nChannels;k++)
+					pRow[j*nChannels+k]=sum[k]/count;
+			}
+		}
+	}
+
+	// a row of the strip is subtracted radius+1 rows after it is overwritten, so the last radius+2 input
+	// rows of the strip are kept in a ring
+	const int stripSize=256;
+	int nStrips=(rowStride+stripSize-1)/stripSize,ringSize=radius+2;
+#ifdef _OPENMP
+	#pragma omp parallel if(IsParallel)
+#endif
+	{
+		std::vector<double> ring((size_t)ringSize*stripSize),sum(stripSize);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int s=0;s<nStrips;s++)
+		{
+			int left=s*stripSize,nElements=__min(left+stripSize,rowStride)-left;
+			for(int k=0;k<nElements;k++)
+				sum[k]=0;
+			for(int i=0;i<__min(radius,height);i++)
+				for(int k=0;k<nElements;k++)
+					sum[k]+=pImage[(size_t)i*rowStride+left+k];
+			for(int i=0;i<height;i++)
+			{
+				T* pRow=pImage+(size_t)i*rowStride+left;
+				if(i+radius<height)
+				{
+					const T* pAdd=pImage+(size_t)(i+radius)*rowStride+left;
+					for(int k=0;k<nElements;k++)
+						sum[k]+=pAdd[k];
+				}
+				if(i-radius-1>=0)
+				{
+					const double* pSub=&ring[(size_t)((i-radius-1)%ringSize)*stripSize];
+					for(int k=0;k<nElements;k++)
+						sum[k]-=pSub[k];
+				}
+				double* pSave=&ring[(size_t)(i%ringSize)*stripSize];
+				double count=__min(i+radius,height-1)-__max(i-radius,0)+1;
+				for(int k=0;k<nElements;k++)
+				{
+					pSave[k]=pRow[k];
+					pRow[k]=sum[k]/count;
+				}
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the guided filter of He et al.: within every window the output is an affine function of the guide fitted
+// to the input by ridge regression, a = (Sigma+epsilon*U)^-1 cov(guide,input), and the coefficients of the
+// windows covering a pixel are averaged. It is edge-preserving like the bilateral filter, with epsilon in the
+// role of range_sigma^2 and the box window in the role of the spatial Gaussian, but it costs O(1) per pixel
+// for any radius. pOutput may be pInput; when the input is the guide its products aren't stored twice
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::guidedfiltering(const T1* pGuide,int nGuideChannels,const T2* pInput,T2* pOutput,int width,int height,int nChannels,
+												int radius,double epsilon)
+{
+	int nI=nGuideChannels,nP=nChannels,nPixels=width*height;
+	bool IsSelf=((const void*)pGuide==(const void*)pInput) && nI==nP;
+	int nCov=nI*(nI+1)/2;
+	// the layout of the window statistics: the guide, the input, the products of the guide channels (upper
+	// triangle) and their products with the input
+	int oP=IsSelf?0:nI,oII=IsSelf?nI:nI+nP,oIp=oII+nCov;
+	int nStats=IsSelf?nI+nCov:nI+nP+nCov+nI*nP,nCoeffs=nP*(nI+1);
+	int stride=__max(nStats,nCoeffs);
+	std::vector<double> buffer((size_t)nPixels*stride);
+	bool IsParallel=(double)nPixels*stride>65536;
+
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<nPixels;i++)
+	{
+		const T1* I=pGuide+(size_t)i*nI;
+		const T2* P=pInput+(size_t)i*nP;
+		double* s=&buffer[(size_t)i*stride];
+		for(int c=0;c<nI;c++)
+			s[c]=I[c];
+		if(!IsSelf)
+			for(int k=0;k<nP;k++)
+				s[oP+k]=P[k];
+		for(int c=0,m=oII;c<nI;c++)
+			for(int d=c;d<nI;d++)
+				s[m++]=(double)I[c]*I[d];
+		if(!IsSelf)
+			for(int c=0;c<nI;c++)
+				for(int k=0;k<nP;k++)
+					s[oIp+c*nP+k]=(double)I[c]*P[k];
+	}
+	boxfiltering(&buffer[0],width,height,stride,radius);
+
+	// the coefficients of the window centered at each pixel: nP columns of a, then b
+#ifdef _OPENMP
+	#pragma omp parallel if(IsParallel)
+#endif
+	{
+		std::vector<double> stats(stride),L((size_t)nI*nI),a((size_t)nI*nP),y(nI);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int i=0;i<nPixels;i++)
+		{
+			double* s=&buffer[(size_t)i*stride];
+			for(int c=0;c<stride;c++)
+				stats[c]=s[c];
+			const double* meanI=&stats[0];
+			const double* meanP=&stats[oP];
+			// the Cholesky factor of the regularized covariance of the guide
+			for(int c=0;c<nI;c++)
+				for(int d=0;d<=c;d++)
+				{
+					int m=oII+d*nI-d*(d-1)/2+(c-d);
+					double v=stats[m]-meanI[c]*meanI[d]+((c==d)?epsilon:0);
+					for(int e=0;e<d;e++)
+						v-=L[c*nI+e]*L[d*nI+e];
+					if(c==d)
+						L[c*nI+c]=sqrt(__max(v,1E-20));
+					else
+						L[c*nI+d]=v/L[d*nI+d];
+				}
+			for(int k=0;k<nP;k++)
+			{
+				// the covariance of the guide and the input channel k, solved against L L^T
+				for(int c=0;c<nI;c++)
+				{
+					double corr;
+					if(IsSelf)
+					{
+						int lo=__min(c,k),hi=__max(c,k);
+						corr=stats[oII+lo*nI-lo*(lo-1)/2+(hi-lo)];
+					}
+					else
+						corr=stats[oIp+c*nP+k];
+					double v=corr-meanI[c]*meanP[k];
+					for(int e=0;e<c;e++)
+						v-=L[c*nI+e]*y[e];
+					y[c]=v/L[c*nI+c];
+				}
+				for(int c=nI-1;c>=0;c--)
+				{
+					double v=y[c];
+					for(int e=c+1;e<nI;e++)
+						v-=L[e*nI+c]*a[e*nP+k];
+					a[c*nP+k]=v/L[c*nI+c];
+				}
+			}
+			for(int k=0;k<nP;k++)
+			{
+				double b=meanP[k];
+				for(int c=0;c<nI;c++)
+				{
+					s[k*nI+c]=a[c*nP+k];
+					b-=a[c*nP+k]*meanI[c];
+				}
+				s[nP*nI+k]=b;
+			}
+		}
+	}
+	boxfiltering(&buffer[0],width,height,stride,radius);
+
+#ifdef _OPENMP
+	#pragma omp parallel for if(IsParallel)
+#endif
+	for(int i=0;i<nPixels;i++)
+	{
+		const T1* I=pGuide+(size_t)i*nI;
+		const double* s=&buffer[(size_t)i*stride];
+		for(int k=0;k<nP;k++)
+		{
+			double q=s[nP*nI+k];
+			for(int c=0;c<nI;c++)
+				q+=s[k*nI+c]*I[c];
+			pOutput[(size_t)i*nP+k]=q;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the recursive Gaussian of Young and van Vliet: y[n]=B*x[n]+a[0]*y[n-1]+a[1]*y[n-2]+a[2]*y[n-3] forward and
+// then the same backward, a few percent from the sampled Gaussian for sigma of 2 and more. M gives the last
+// three values of the backward pass from the last three of the forward pass when the signal continues with its
+// last value, as in Triggs and Sdika. It is computed from the responses of the two passes to the three states
+// of the forward pass rather than by its closed form, in O(sigma) once per filter
+//------------------------------------------------------------------------------------------------------------
+inline ImageProcessing::RecursiveGaussian::RecursiveGaussian(double sigma)
+{
+	sigma=__max(sigma,0.5);
+	double q=(sigma>=2.5)?0.98711*sigma-0.96330:3.97156-4.14554*sqrt(1-0.26891*sigma);
+	double q2=q*q,q3=q2*q;
+	double b0=1.57825+2.44413*q+1.4281*q2+0.422205*q3;
+	a[0]=(2.44413*q+2.85619*q2+1.26661*q3)/b0;
+	a[1]=-(1.4281*q2+1.26661*q3)/b0;
+	a[2]=0.422205*q3/b0;
+	B=1-a[0]-a[1]-a[2];
+
+	int length=10*(int)ceil(sigma)+50;
+	std::vector<double> forward(length+3),backward(length+4);
+	for(int s=0;s<3;s++)
+	{
+		for(int k=0;k<3;k++)
+			forward[2-k]=(k==s);
+		for(int n=3;n<length+3;n++)
+			forward[n]=a[0]*forward[n-1]+a[1]*forward[n-2]+a[2]*forward[n-3];
+		backward[length+1]=backward[length+2]=backward[length+3]=0;
+		for(int n=length;n>=0;n--)
+			backward[n]=B*forward[n+2]+a[0]*backward[n+1]+a[1]*backward[n+2]+a[2]*backward[n+3];
+		for(int k=0;k<3;k++)
+			M[k*3+s]=backward[k];
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the two passes of the filter along a line of n samples of nChannels interleaved channels, in place. The
+// line is taken to continue with its first and last samples; pLine has room for 2 samples after the line and
+// pForward for n+3 samples. The recursion steps from sample to sample and the inner loops run over the
+// channels, which are contiguous
+//------------------------------------------------------------------------------------------------------------
+inline void ImageProcessing::RecursiveGaussian::filter(double* pLine,double* pForward,int n,int nChannels) const
+{
+	// the 3 samples of the forward pass before the line
+	for(int k=0;k<nChannels;k++)
+		pForward[k]=pForward[nChannels+k]=pForward[2*nChannels+k]=pLine[k];
+	double* w=pForward+3*nChannels;
+	for(int i=0;i<n;i++)
+	{
+		const double *w1=w+(i-1)*nChannels,*w2=w+(i-2)*nChannels,*w3=w+(i-3)*nChannels,*x=pLine+i*nChannels;
+		double* w0=w+i*nChannels;
+		for(int k=0;k<nChannels;k++)
+			w0[k]=B*x[k]+a[0]*w1[k]+a[1]*w2[k]+a[2]*w3[k];
+	}
+	// the last sample of the backward pass and the 2 after the line
+	double* y=pLine+(n-1)*nChannels;
+	for(int k=0;k<nChannels;k++)
+	{
+		double last=y[k];
+		double d0=w[(n-1)*nChannels+k]-last,d1=w[(n-2)*nChannels+k]-last,d2=w[(n-3)*nChannels+k]-last;
+		y[k]=M[0]*d0+M[1]*d1+M[2]*d2+last;
+		y[nChannels+k]=M[3]*d0+M[4]*d1+M[5]*d2+last;
+		y[2*nChannels+k]=M[6]*d0+M[7]*d1+M[8]*d2+last;
+	}
+	for(int i=n-2;i>=0;i--)
+	{
+		double* y0=pLine+i*nChannels;
+		const double *y1=y0+nChannels,*y2=y0+2*nChannels,*y3=y0+3*nChannels,*w0=w+i*nChannels;
+		for(int k=0;k<nChannels;k++)
+			y0[k]=B*w0[k]+a[0]*y1[k]+a[1]*y2[k]+a[2]*y3[k];
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the Gaussian smoothing of standard deviation sigma by the recursive filter, in place, at a cost that doesn't
+// depend on sigma. The horizontal pass filters the rows in groups of 8, interleaved as the channels of one
+// line, and the vertical pass strips of columns, so the inner loops of the recursion run over contiguous
+// samples of several rows or columns. A horizontally wrapped row is filtered as one that starts ceil(5*sigma)
+// pixels before its left border and ends as many after its right one
+//------------------------------------------------------------------------------------------------------------
+template <class T>
+void ImageProcessing::recursiveGaussian(T* pImage,int width,int height,int nChannels,double sigma,bool IsHorizontalWrap)
+{
+	RecursiveGaussian filterLine(sigma);
+	bool IsParallel=(double)width*height*nChannels>65536;
+	int rowStride=width*nChannels;
+	int margin=IsHorizontalWrap?(int)ceil(5*__max(sigma,0.5)):0;
+	int lineLength=width+2*margin;
+	const int groupSize=8;
+	int nGroups=(height+groupSize-1)/groupSize;
+#ifdef _OPENMP
+	#pragma omp parallel if(IsParallel)
+#endif
+	{
+		std::vector<double> line((size_t)(lineLength+2)*groupSize*nChannels),forward((size_t)(lineLength+3)*groupSize*nChannels);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int g=0;g<nGroups;g++)
+		{
+			int top=g*groupSize,nGroupRows=__min(top+groupSize,height)-top,lineChannels=nGroupRows*nChannels;
+			for(int j=0;j<lineLength;j++)
+			{
+				double* pDst=&line[(size_t)j*lineChannels];
+				int offset=WrapRange(j-margin,width)*nChannels;
+				for(int r=0;r<nGroupRows;r++)
+					for(int k=0;k<nChannels;k++)
+						pDst[r*nChannels+k]=pImage[(size_t)(top+r)*rowStride+offset+k];
+			}
+			filterLine.filter(&line[0],&forward[0],lineLength,lineChannels);
+			for(int r=0;r<nGroupRows;r++)
+			{
+				T* pRow=pImage+(size_t)(top+r)*rowStride;
+				for(int j=0;j<width;j++)
+					for(int k=0;k<nChannels;k++)
+						pRow[j*nChannels+k]=line[(size_t)(j+margin)*lineChannels+r*nChannels+k];
+			}
+		}
+	}
+
+	const int stripSize=256;
+	int nStrips=(rowStride+stripSize-1)/stripSize;
+#ifdef _OPENMP
+	#pragma omp parallel if(IsParallel)
+#endif
+	{
+		std::vector<double> strip((size_t)(height+2)*stripSize),forward((size_t)(height+3)*stripSize);
+#ifdef _OPENMP
+		#pragma omp for
+#endif
+		for(int s=0;s<nStrips;s++)
+		{
+			int left=s*stripSize,nElements=__min(left+stripSize,rowStride)-left;
+			for(int i=0;i<height;i++)
+			{
+				const T* pRow=pImage+(size_t)i*rowStride+left;
+				for(int k=0;k<nElements;k++)
+					strip[(size_t)i*nElements+k]=pRow[k];
+			}
+			filterLine.filter(&strip[0],&forward[0],height,nElements);
+			for(int i=0;i<height;i++)
+			{
+				T* pRow=pImage+(size_t)i*rowStride+left;
+				for(int k=0;k<nElements;k++)
+					pRow[k]=strip[(size_t)i*nElements+k];
+			}
+		}
+	}
+}
+
 //------------------------------------------------------------------------------------------------------------
 // function to sample a patch from the source image
 //------------------------------------------------------------------------------------------------------------
@@ -448,16 +1293,18 @@ void ImageProcessing::getPatch(const T1* pSrcImage,T2* pPatch,int width,int heig
 {
 	// suppose pPatch has been allocated and cleared before calling the function
 	int wlength=wsize*2+1;
-	double x,y;
+	std::vector<double> x(wlength),y(wlength);
+	std::vector<unsigned char> IsInside(wlength);
 	for(int i=-wsize;i<=wsize;i++)
+	{
 		for(int j=-wsize;j<=wsize;j++)
 		{
-			y=y0+i;
-			x=x0+j;
-			if(x<0 || x>width-1 || y<0 || y>height-1)
-				continue;
-			BilinearInterpolate(pSrcImage,width,height,nChannels,x,y,pPatch+((i+wsize)*wlength+j+wsize)*nChannels);
+			y[j+wsize]=y0+i;
+			x[j+wsize]=x0+j;
+			IsInside[j+wsize]=!(x[j+wsize]<0 || x[j+wsize]>width-1 || y[j+wsize]<0 || y[j+wsize]>height-1);
 		}
+		BilinearInterpolateRow(pSrcImage,width,height,nChannels,x.data(),y.data(),wlength,pPatch+(i+wsize)*wlength*nChannels,false,IsInside.data());
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -465,25 +1312,49 @@ void ImageProcessing::getPatch(const T1* pSrcImage,T2* pPatch,int width,int heig
 // pWarpIm2 has to be allocated before hands
 //------------------------------------------------------------------------------------------------------------
 template <class T1,class T2>
-void ImageProcessing::warpImage(T1 *pWarpIm2, const T1 *pIm1, const T1 *pIm2, const T2 *pVx, const T2 *pVy, int width, int height, int nChannels)
+void ImageProcessing::warpImage(T1 *pWarpIm2, const T1 *pIm1, const T1 *pIm2, const T2 *pVx, const T2 *pVy, int width, int height, int nChannels,bool IsHorizontalWrap)
 {
-	memset(pWarpIm2,0,sizeof(T1)*width*height*nChannels);
+	// the pixels are independent, so the rows are warped in parallel
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height*nChannels>65536)
+#endif
 	for(int i=0;i<height;i++)
-		for(int j=0;j<width;j++)
+	{
+		size_t offset=(size_t)i*width;
+		warpImageRow(pWarpIm2+offset*nChannels,pIm1+offset*nChannels,pIm2,pVx+offset,pVy+offset,i,width,height,nChannels,IsHorizontalWrap);
+	}
+}
+
+template <class T1,class T2>
+void ImageProcessing::warpImageRow(T1* pWarpRow,const T1* pIm1Row,const T1* pIm2,const T2* pVxRow,const T2* pVyRow,int i,int width,int height,int nChannels,
+									bool IsHorizontalWrap)
+{
+	double x[BilinearBlock],y[BilinearBlock];
+	unsigned char IsInside[BilinearBlock];
+	memset(pWarpRow,0,sizeof(T1)*width*nChannels);
+	for(int j0=0;j0<width;j0+=BilinearBlock)
+	{
+		int nBlock=__min(width-j0,(int)BilinearBlock);
+		for(int j=0;j<nBlock;j++)
 		{
-			int offset=i*width+j;
-			double x,y;
-			y=i+pVy[offset];
-			x=j+pVx[offset];
-			offset*=nChannels;
-			if(x<0 || x>width-1 || y<0 || y>height-1)
+			y[j]=i+pVyRow[j0+j];
+			x[j]=j0+j+pVxRow[j0+j];
+			// with horizontal wraparound a pixel only leaves the image through the top or the bottom
+			if(IsHorizontalWrap)
 			{
-				for(int k=0;k<nChannels;k++)
-					pWarpIm2[offset+k]=pIm1[offset+k];
-				continue;
+				x[j]=fmod(x[j],(double)width);
+				if(x[j]<0)
+					x[j]+=width;
 			}
-			BilinearInterpolate(pIm2,width,height,nChannels,x,y,pWarpIm2+offset);
+			IsInside[j]=!(x[j]<0 || x[j]>width-1+(IsHorizontalWrap?1:0) || y[j]<0 || y[j]>height-1);
 		}
+		T1* pWarp=pWarpRow+j0*nChannels;
+		BilinearInterpolateRow(pIm2,width,height,nChannels,x,y,nBlock,pWarp,IsHorizontalWrap,IsInside);
+		for(int j=0;j<nBlock;j++)
+			if(!IsInside[j])
+				for(int k=0;k<nChannels;k++)
+					pWarp[j*nChannels+k]=pIm1Row[(j0+j)*nChannels+k];
+	}
 }
 
 template <class T1,class T2>
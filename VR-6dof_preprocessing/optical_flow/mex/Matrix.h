@@ -6,7 +6,13 @@
 #ifdef _QT
 	#include <QFile>
 #endif
+// the products of the matrices by a BLAS (cmake -DOPTICALFLOW_BLAS=ON), otherwise by the blocked loops and the
+// SIMD kernels of FlowKernels
+#ifdef OPTICALFLOW_BLAS
+	#include <cblas.h>
+#endif
 #include <iostream>
+#include <utility>
 
 using namespace std;
 
@@ -21,6 +27,8 @@ public:
 	Matrix(void);
 	Matrix(int _nrow,int _ncol,double* data=NULL);
 	Matrix(const Matrix<T>& matrix);
+	// the buffer of matrix is taken over and matrix is left empty
+	Matrix(Matrix<T>&& matrix) noexcept;
 	~Matrix(void);
 	void releaseData();
 	void copyData(const Matrix<T>& matrix);
@@ -57,18 +65,23 @@ public:
 	void Multiply(Vector<T>& result,const Vector<T>& vect) const;
 	void Multiply(Matrix<T>& result,const Matrix<T>& matrix) const;
 
+	// C = A*B of row major matrices, A m x k and B k x n
+	static void Gemm(double* C,const double* A,const double* B,int m,int n,int k);
+
 	void transpose(Matrix& result) const;
 	void fromVector(const Vector<T>& vect);
 	double norm2() const;
 	double sum() const
 	{
 		double total = 0;
-		for(int i = 0;i<nCol*nRom;i++)
+		for(int i = 0;i<nCol*nRow;i++)
 			total += pData[i];
 		return total;
 	}
 	// operators
 	Matrix& operator=(const Matrix<T>& matrix);
+	Matrix& operator=(Matrix<T>&& matrix) noexcept;
+	void swap(Matrix<T>& matrix) noexcept {std::swap(nRow,matrix.nRow);std::swap(nCol,matrix.nCol);std::swap(pData,matrix.pData);};
 	
 	Matrix& operator+=(double val);
 	Matrix& operator-=(double val);
@@ -128,6 +141,14 @@ Matrix<T>::Matrix(const Matrix<T>& matrix)
 	copyData(matrix);
 }
 
+template<class T>
+Matrix<T>::Matrix(Matrix<T>&& matrix) noexcept
+{
+	nRow=nCol=0;
+	pData=NULL;
+	swap(matrix);
+}
+
 template<class T>
 Matrix<T>::~Matrix(void)
 {
@@ -138,7 +159,7 @@ template<class T>
 void Matrix<T>::releaseData()
 {
 	if(pData!=NULL)
-		delete pData;
+		delete []pData;
 	pData=NULL;
 	nRow=nCol=0;
 }
@@ -181,6 +202,12 @@ void Matrix<T>::reset()
 template<class T>
 void Matrix<T>::allocate(int nrow,int ncol)
 {
+	// the buffer is kept when the dimensions match
+	if(matchDimension(nrow,ncol) && pData!=NULL)
+	{
+		reset();
+		return;
+	}
 	releaseData();
 	nRow=nrow;
 	nCol=ncol;
@@ -285,13 +312,15 @@ void Matrix<T>::Multiply(Vector<T> &result, const Vector<T>&vect) const
 	checkDimRight(vect);
 	if(result.dim()!=nRow)
 		result.allocate(nRow);
-	for(int i=0;i<nRow;i++)
+#ifdef OPTICALFLOW_BLAS
+	if(nRow>0 && nCol>0)
 	{
-		double temp=0;
-		for(int j=0;j<nCol;j++)
-			temp+=pData[i*nCol+j]*vect.data()[j];
-		result.data()[i]=temp;
+		cblas_dgemv(CblasRowMajor,CblasNoTrans,nRow,nCol,1.0,pData,nCol,vect.data(),1,0.0,result.data(),1);
+		return;
 	}
+#endif
+	for(int i=0;i<nRow;i++)
+		result.data()[i]=FlowKernels::Dot(pData+(size_t)i*nCol,vect.data(),nCol);
 }
 
 template<class T>
@@ -300,14 +329,47 @@ void Matrix<T>::Multiply(Matrix<T> &result, const Matrix<T> &matrix) const
 	checkDimRight(matrix);
 	if(!result.matchDimension(nRow,matrix.nCol))
 		result.allocate(nRow,matrix.nCol);
-	for(int i=0;i<nRow;i++)
-		for(int j=0;j<matrix.nCol;j++)
+	Gemm(result.pData,pData,matrix.pData,nRow,matrix.nCol,nCol);
+}
+
+//--------------------------------------------------------------------------------------------------
+// without a BLAS the product is computed in blocks of rowBlock rows of A, depthBlock columns of A and
+// colBlock columns of B, so that the block of B stays in the cache while the rows of A go over it: each
+// row of the block of C adds a(i,k) times the rows of the block of B, with FlowKernels::Axpy
+//--------------------------------------------------------------------------------------------------
+template<class T>
+void Matrix<T>::Gemm(double* C,const double* A,const double* B,int m,int n,int k)
+{
+	memset(C,0,sizeof(double)*m*n);
+	if(m==0 || n==0 || k==0)
+		return;
+#ifdef OPTICALFLOW_BLAS
+	cblas_dgemm(CblasRowMajor,CblasNoTrans,CblasNoTrans,m,n,k,1.0,A,k,B,n,0.0,C,n);
+#else
+	const int rowBlock=64,depthBlock=128,colBlock=512;
+	for(int j0=0;j0<n;j0+=colBlock)
+	{
+		int nCols=__min(colBlock,n-j0);
+		for(int k0=0;k0<k;k0+=depthBlock)
 		{
-			double temp=0;
-			for(int k=0;k<nCol;k++)
-				temp+=pData[i*nCol+k]*matrix.pData[k*matrix.nCol+j];
-			result.pData[i*matrix.nCol+j]=temp;
+			int kEnd=__min(k0+depthBlock,k);
+			for(int i0=0;i0<m;i0+=rowBlock)
+			{
+				int iEnd=__min(i0+rowBlock,m);
+				for(int i=i0;i<iEnd;i++)
+				{
+					double* pRow=C+(size_t)i*n+j0;
+					for(int l=k0;l<kEnd;l++)
+					{
+						double a=A[(size_t)i*k+l];
+						if(a!=0)
+							FlowKernels::Axpy(pRow,B+(size_t)l*n+j0,a,nCols);
+					}
+				}
+			}
 		}
+	}
+#endif
 }
 
 template<class T>
@@ -349,6 +411,17 @@ Matrix<T>& Matrix<T>::operator=(const Matrix<T>& matrix)
 	return *this;
 }
 
+template<class T>
+Matrix<T>& Matrix<T>::operator=(Matrix<T>&& matrix) noexcept
+{
+	if(this!=&matrix)
+	{
+		releaseData();
+		swap(matrix);
+	}
+	return *this;
+}
+
 template<class T>
 Matrix<T>& Matrix<T>::operator +=(double val)
 {
@@ -448,6 +521,7 @@ void Matrix<T>::ConjugateGradient(Vector<T> &result, const Vector<T>&b) const
 	if(!result.matchDimension(b))
 		result.allocate(b);
 
+	// the vectors are updated in place with the SIMD kernels, without the temporaries of the operators
 	Vector<T> r(b),p,q;
 	result.reset();
 
@@ -466,12 +540,13 @@ void Matrix<T>::ConjugateGradient(Vector<T> &result, const Vector<T>&b) const
 		else
 		{
 			double ratio=rou[k]/rou[k-1];
-			p=r+p*ratio;
+			p*=ratio;
+			FlowKernels::Axpy(p.data(),r.data(),1.0,nRow);
 		}
 		Multiply(q,p);
 		double alpha=rou[k]/innerproduct(p,q);
-		result+=p*alpha;
-		r-=q*alpha;
+		FlowKernels::Axpy(result.data(),p.data(),alpha,nRow);
+		FlowKernels::Axpy(r.data(),q.data(),-alpha,nRow);
 	}
 }
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+
+//--------------------------------------------------------------------------------------------------------
+// the bytes held by the buffers of all the images of the process, and the most they reached. Image counts
+// a buffer from its allocation to its release, an attached buffer from attach to detach, so the counters
+// follow the capacity of the images and not their dimensions. The counters are shared by all the threads;
+// resetPeak starts a new peak from the current bytes, e.g. before the job that is measured
+//--------------------------------------------------------------------------------------------------------
+class MemoryAccounting
+{
+	static inline std::atomic<long long>& currentBytes() {static std::atomic<long long> bytes(0);return bytes;};
+	static inline std::atomic<long long>& peakBytes() {static std::atomic<long long> bytes(0);return bytes;};
+public:
+	static inline void allocated(long long bytes)
+	{
+		long long current=currentBytes().fetch_add(bytes)+bytes;
+		long long peak=peakBytes().load();
+		while(current>peak && !peakBytes().compare_exchange_weak(peak,current))
+			;
+	};
+	static inline void released(long long bytes) {currentBytes().fetch_sub(bytes);};
+	static inline long long current() {return currentBytes().load();};
+	static inline long long peak() {return peakBytes().load();};
+	static inline void resetPeak() {peakBytes().store(currentBytes().load());};
+};
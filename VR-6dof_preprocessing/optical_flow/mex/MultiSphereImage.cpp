@@ -0,0 +1,120 @@
+#include "MultiSphereImage.h"
+#include "BackgroundLayers.h"
+#include <math.h>
+#include <cstring>
+
+using namespace std;
+
+MultiSphereImage::MultiSphereImage(int _nLayers,int _nColumns)
+{
+	nLayers=__max(_nLayers,2);
+	nColumns=__max(_nColumns,1);
+	tileWidth=tileHeight=0;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the mean color and inverse depth of the box of pixels of every pixel of a tile
+//--------------------------------------------------------------------------------------------------------
+void MultiSphereImage::downsample(const BiImage& frame,const BiImage& depth8)
+{
+	int width=frame.width(),height=frame.height();
+	tileWidth=__max(width/nColumns/2*2,2);
+	tileHeight=__max(height/nColumns/2*2,2);
+	color.assign(tileWidth*tileHeight*3,0);
+	depth.assign(tileWidth*tileHeight,0);
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height>65536)
+#endif
+	for(int i=0;i<tileHeight;i++)
+	{
+		int y0=i*height/tileHeight,y1=__max((i+1)*height/tileHeight,y0+1);
+		for(int j=0;j<tileWidth;j++)
+		{
+			int x0=j*width/tileWidth,x1=__max((j+1)*width/tileWidth,x0+1);
+			int offset=i*tileWidth+j;
+			double* pColor=&color[offset*3];
+			for(int y=y0;y<y1;y++)
+				for(int x=x0;x<x1;x++)
+				{
+					const unsigned char* pPixel=frame.data()+(y*width+x)*3;
+					for(int k=0;k<3;k++)
+						pColor[k]+=pPixel[k];
+					depth[offset]+=depth8.data()[y*width+x];
+				}
+			double n=(y1-y0)*(x1-x0);
+			for(int k=0;k<3;k++)
+				pColor[k]/=n;
+			depth[offset]/=n;
+		}
+	}
+}
+
+void MultiSphereImage::makeAtlas(const BiImage& frame,const BiImage& depth8,BiImage& atlas)
+{
+	if(frame.nchannels()!=3 || depth8.nchannels()!=1 || frame.width()!=depth8.width() || frame.height()!=depth8.height())
+	{
+		cout<<"The frame of MultiSphereImage::makeAtlas() doesn't match its depth!"<<endl;
+		return;
+	}
+	downsample(frame,depth8);
+	int nPixels=tileWidth*tileHeight;
+	layerColor.resize(nLayers);
+	layerAlpha.resize(nLayers);
+	for(int k=0;k<nLayers;k++)
+	{
+		layerColor[k].allocate(tileWidth,tileHeight,3);
+		layerAlpha[k].allocate(tileWidth,tileHeight);
+	}
+	// the layer behind every pixel, opaque, and the fraction of the layer in front of it
+	for(int i=0;i<nPixels;i++)
+	{
+		double position=depth[i]/255*nLayers-0.5;
+		int k=(int)floor(position);
+		double fraction=position-k;
+		if(k<0 || k>=nLayers-1)
+		{
+			k=__min(__max(k,0),nLayers-1);
+			fraction=0;
+		}
+		int alpha[2]={255,(int)(fraction*255+0.5)};
+		for(int m=0;m<2 && alpha[m]>0;m++)
+		{
+			unsigned char* pColor=layerColor[k+m].data()+i*3;
+			for(int c=0;c<3;c++)
+				pColor[c]=__min(color[i*3+c]+0.5,255);
+			layerAlpha[k+m].data()[i]=alpha[m];
+		}
+	}
+	// the colors under alpha 0 inpainted from the pixels of the layer, whatever their alpha
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int k=0;k<nLayers;k++)
+	{
+		BiImage covered(tileWidth,tileHeight);
+		for(int i=0;i<nPixels;i++)
+			covered.data()[i]=(layerAlpha[k].data()[i]>0)?255:0;
+		DBackgroundLayers::inpaint(layerColor[k],covered);
+		if(k==0)
+			memset(layerAlpha[k].data(),255,nPixels);
+	}
+	atlas.allocate(tileWidth*nColumns,tileHeight*nrows(),3);
+	int atlasWidth=atlas.width();
+	for(int t=0;t<2*nLayers;t++)
+	{
+		int x0=(t%nColumns)*tileWidth,y0=(t/nColumns)*tileHeight;
+		const BiImage& layer=(t<nLayers)?layerColor[t]:layerAlpha[t-nLayers];
+		for(int i=0;i<tileHeight;i++)
+		{
+			unsigned char* pAtlas=atlas.data()+((y0+i)*atlasWidth+x0)*3;
+			if(t<nLayers)
+			{
+				memcpy(pAtlas,layer.data()+i*tileWidth*3,tileWidth*3);
+				continue;
+			}
+			const unsigned char* pAlpha=layer.data()+i*tileWidth;
+			for(int j=0;j<tileWidth;j++)
+				pAtlas[j*3]=pAtlas[j*3+1]=pAtlas[j*3+2]=pAlpha[j];
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Image.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the multi-sphere image of a frame for the viewer: nLayers concentric spheres of RGBA, composited back to
+// front, in place of the three displaced layers. Layer k is at the fixed inverse depth (k+0.5)/nLayers of the
+// 8-bit range of FlowDepth, layer 0 the farthest, so the viewer places the spheres with no data of the clip.
+//
+// The frame and its depth are averaged down to tiles of 1/nColumns of their width and height. A pixel goes to
+// the layer behind its inverse depth with alpha 1 and to the layer in front of it with the fraction of the way
+// to it, so the two blend back to its color and the surface moves smoothly between the layers. The colors where
+// a layer is transparent are inpainted from its own pixels, so its filtered edges blend with their neighbors
+// and not black, and the farthest layer is opaque, its holes behind the foreground filled the same way.
+//
+// The atlas is a grid of nColumns tiles per row, the colors of the layers in order then their alphas, gray
+// in all three channels, e.g. 8 layers of 4 columns in 4 rows of the size of the frame
+//--------------------------------------------------------------------------------------------------------
+class MultiSphereImage
+{
+public:
+	int nLayers,nColumns;
+private:
+	int tileWidth,tileHeight;
+	std::vector<double> color,depth;
+	std::vector<BiImage> layerColor,layerAlpha;
+public:
+	MultiSphereImage(int _nLayers=8,int _nColumns=4);
+	inline int nrows() const {return (2*nLayers+nColumns-1)/nColumns;};
+	inline int tilewidth() const {return tileWidth;};
+	inline int tileheight() const {return tileHeight;};
+	// the inverse depth of layer k, 1 the nearest
+	inline double layerDepth(int k) const {return (k+0.5)/nLayers;};
+
+	// the atlas of an 8-bit BGR frame and its 8-bit inverse depth, of sizes even for the encoders
+	void makeAtlas(const BiImage& frame,const BiImage& depth8,BiImage& atlas);
+private:
+	void downsample(const BiImage& frame,const BiImage& depth8);
+};
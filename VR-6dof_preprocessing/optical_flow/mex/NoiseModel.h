@@ -2,7 +2,10 @@
 
 #include "stdio.h"
 #include "Vector.h"
+#include <algorithm>
 #include <iostream>
+#include <utility>
+#include <vector>
 #define PI 3.1415926535897932384626433832
 
 using namespace std;
@@ -16,6 +19,11 @@ public:
 	double* beta;
 	double* sigma_square;
 	double* beta_square;
+	// the weight of the first Gaussian, prob1/(prob1+prob2), of every channel sampled at tableSize+1 points of
+	// x in [0,tableSize/tableScale[k]] and constant beyond, rebuilt by square() whenever the parameters change
+	static const int tableSize = 4096;
+	std::vector<double> table;
+	std::vector<double> tableScale;
 public:
 	GaussianMixture()
 	{
@@ -36,25 +44,63 @@ public:
 	}
 	GaussianMixture(const GaussianMixture& GM)
 	{
-		clear();
+		nChannels = 0;
+		alpha = sigma = beta = sigma_square = beta_square = NULL;
 		copy(GM);
 	}
+	// the buffers of GM are taken over and GM is left empty
+	GaussianMixture(GaussianMixture&& GM) noexcept
+	{
+		nChannels = 0;
+		alpha = sigma = beta = sigma_square = beta_square = NULL;
+		swap(GM);
+	}
+	// the buffers are kept for the same number of channels, and the table is copied instead of rebuilt
 	void copy(const GaussianMixture& GM)
 	{
-		nChannels = GM.nChannels;
-		allocate();
+		if(nChannels != GM.nChannels || alpha == NULL)
+		{
+			clear();
+			nChannels = GM.nChannels;
+			allocate();
+		}
 		for(int i  = 0;i<nChannels;i++)
 		{
 			alpha[i]  = GM.alpha[i];
 			sigma[i] = GM.sigma[i];
 			beta[i]    = GM.beta[i];
+			sigma_square[i] = GM.sigma_square[i];
+			beta_square[i] = GM.beta_square[i];
 		}
-		square();
+		table = GM.table;
+		tableScale = GM.tableScale;
 	}
-	void operator=(const GaussianMixture& GM)
+	GaussianMixture& operator=(const GaussianMixture& GM)
 	{
-		clear();
-		copy(GM);
+		if(this != &GM)
+			copy(GM);
+		return *this;
+	}
+	GaussianMixture& operator=(GaussianMixture&& GM) noexcept
+	{
+		if(this != &GM)
+		{
+			clear();
+			nChannels = 0;
+			swap(GM);
+		}
+		return *this;
+	}
+	void swap(GaussianMixture& GM) noexcept
+	{
+		std::swap(nChannels,GM.nChannels);
+		std::swap(alpha,GM.alpha);
+		std::swap(sigma,GM.sigma);
+		std::swap(beta,GM.beta);
+		std::swap(sigma_square,GM.sigma_square);
+		std::swap(beta_square,GM.beta_square);
+		table.swap(GM.table);
+		tableScale.swap(GM.tableScale);
 	}
 	GaussianMixture shrink(int N)
 	{
@@ -78,15 +124,15 @@ public:
 	}
 	void clear()
 	{
-		if(!alpha)
+		if(alpha)
 			delete []alpha;
-		if(!sigma)
+		if(sigma)
 			delete []sigma;
-		if(!beta)
+		if(beta)
 			delete []beta;
-		if(!sigma_square)
+		if(sigma_square)
 			delete []sigma_square;
-		if(!beta_square)
+		if(beta_square)
 			delete []beta_square;
 		alpha = sigma = beta = sigma_square = beta_square = NULL;
 	}
@@ -104,9 +150,12 @@ public:
 	}
 	void reset(int _nChannels)
 	{
-		clear();
-		nChannels = _nChannels;
-		allocate();
+		if(nChannels != _nChannels || alpha == NULL)
+		{
+			clear();
+			nChannels = _nChannels;
+			allocate();
+		}
 		reset();
 	}
 	double Gaussian(double x,int i,int k) const
@@ -116,6 +165,16 @@ public:
 		else
 			return exp(-x/(2*beta_square[k]))/(2*PI*beta[k]);
 	}
+	// the weight of the first Gaussian interpolated in the table, without branches. The weights of the mixture
+	// are w and 1-w, and the robust weight of the data term (prob1/(2sigma^2)+prob2/(2beta^2))/(prob1+prob2) is
+	// 1/(2beta^2)+w*(1/(2sigma^2)-1/(2beta^2))
+	inline double weight(double x,int k) const
+	{
+		double u = std::min(x*tableScale[k],(double)tableSize);
+		int i = std::min((int)u,tableSize-1);
+		const double* pTable = &table[k*(tableSize+1)+i];
+		return pTable[0]+(pTable[1]-pTable[0])*(u-i);
+	}
 	~GaussianMixture()
 	{
 		clear();
@@ -127,6 +186,32 @@ public:
 			sigma_square[i] = sigma[i]*sigma[i];
 			beta_square[i] = beta[i]*beta[i];
 		}
+		buildTable();
+	}
+	// w = 1/(1+r*exp(d*x)) with r = prob2/prob1 at x=0 and d = 1/(2sigma^2)-1/(2beta^2), so w is 1/(1+r) at 0
+	// and within 1e-11 of its limit once |d|*x is 25 past the middle of the transition, log(r)/-d
+	void buildTable()
+	{
+		table.resize(nChannels*(tableSize+1));
+		tableScale.resize(nChannels);
+		for(int k = 0;k<nChannels;k++)
+		{
+			double a1 = alpha[k]/(2*PI*sigma[k]), a2 = (1-alpha[k])/(2*PI*beta[k]);
+			double d = 1/(2*sigma_square[k])-1/(2*beta_square[k]);
+			double logr = (a1>0 && a2>0) ? log(a2/a1) : 0;
+			double range = (fabs(logr)+25)/fabs(d);
+			if(!(range<1E100))
+				range = 1;
+			tableScale[k] = tableSize/range;
+			// the logistic form doesn't underflow where both Gaussians do
+			for(int i = 0;i<=tableSize;i++)
+			{
+				double w = 1/(1+exp(logr+d*i/tableScale[k]));
+				if(a1<=0 || a2<=0)
+					w = (a1>0) ? 1 : 0;
+				table[k*(tableSize+1)+i] = w;
+			}
+		}
 	}
 	void display()
 	{
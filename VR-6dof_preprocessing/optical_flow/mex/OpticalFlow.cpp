@@ -1,77 +1,159 @@
 #include "OpticalFlow.h"
 #include "ImageProcessing.h"
 #include "GaussianPyramid.h"
+#include "FlowKernels.h"
+#include "PreviewFlow.h"
+#ifdef _OPENCV_GPU
+#include "OpticalFlowGPU.h"
+#endif
+#include <chrono>
 #include <cstdlib> 
 #include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 using namespace std;
 
+OpticalFlowBase::Parameters::Parameters()
+{
 #ifndef _MATLAB
-	bool OpticalFlow::IsDisplay=true;
+	IsDisplay=true;
 #else
-	bool OpticalFlow::IsDisplay=false;
+	IsDisplay=false;
 #endif
+	//interpolation = Bicubic;
+	interpolation = Bilinear;
+	noiseModel = Lap;
+	IsGaussianMixtureTable = true;
+	noiseSamples = 0;
+	sorScheme = Lexicographic;
+	linearSolver = SOR;
+	solverTolerance = 1E-3;
+	updateTolerance = 0;
+	sweepTolerance = 0;
+	IsPlanar = true;
+	roiDilation = 4;
+	tileRows = 0;
+	tileHalo = 32;
+	occlusionRatio = 0.01;
+	occlusionOffset = 0.5;
+	nThreads = 0;
+	IsHorizontalWrap = false;
+	upsampleSigma = 0;
+	backend = CPU;
+	IsHalfPyramid = false;
+}
 
-//OpticalFlow::InterpolationMethod OpticalFlow::interpolation = OpticalFlow::Bicubic;
-OpticalFlow::InterpolationMethod OpticalFlow::interpolation = OpticalFlow::Bilinear;
-OpticalFlow::NoiseModel OpticalFlow::noiseModel = OpticalFlow::Lap;
-GaussianMixture OpticalFlow::GMPara;
-Vector<double> OpticalFlow::LapPara;
+OpticalFlowBase::Parameters OpticalFlowBase::parameters;
+bool& OpticalFlowBase::IsDisplay = OpticalFlowBase::parameters.IsDisplay;
+OpticalFlowBase::InterpolationMethod& OpticalFlowBase::interpolation = OpticalFlowBase::parameters.interpolation;
+OpticalFlowBase::NoiseModel& OpticalFlowBase::noiseModel = OpticalFlowBase::parameters.noiseModel;
+bool& OpticalFlowBase::IsGaussianMixtureTable = OpticalFlowBase::parameters.IsGaussianMixtureTable;
+int& OpticalFlowBase::noiseSamples = OpticalFlowBase::parameters.noiseSamples;
+OpticalFlowBase::SORScheme& OpticalFlowBase::sorScheme = OpticalFlowBase::parameters.sorScheme;
+OpticalFlowBase::LinearSolver& OpticalFlowBase::linearSolver = OpticalFlowBase::parameters.linearSolver;
+double& OpticalFlowBase::solverTolerance = OpticalFlowBase::parameters.solverTolerance;
+double& OpticalFlowBase::updateTolerance = OpticalFlowBase::parameters.updateTolerance;
+double& OpticalFlowBase::sweepTolerance = OpticalFlowBase::parameters.sweepTolerance;
+bool& OpticalFlowBase::IsPlanar = OpticalFlowBase::parameters.IsPlanar;
+int& OpticalFlowBase::roiDilation = OpticalFlowBase::parameters.roiDilation;
+int& OpticalFlowBase::tileRows = OpticalFlowBase::parameters.tileRows;
+int& OpticalFlowBase::tileHalo = OpticalFlowBase::parameters.tileHalo;
+double& OpticalFlowBase::occlusionRatio = OpticalFlowBase::parameters.occlusionRatio;
+double& OpticalFlowBase::occlusionOffset = OpticalFlowBase::parameters.occlusionOffset;
+int& OpticalFlowBase::nThreads = OpticalFlowBase::parameters.nThreads;
+bool& OpticalFlowBase::IsHorizontalWrap = OpticalFlowBase::parameters.IsHorizontalWrap;
+double& OpticalFlowBase::upsampleSigma = OpticalFlowBase::parameters.upsampleSigma;
+OpticalFlowBase::Backend& OpticalFlowBase::backend = OpticalFlowBase::parameters.backend;
+bool& OpticalFlowBase::IsHalfPyramid = OpticalFlowBase::parameters.IsHalfPyramid;
+GaussianMixture OpticalFlowBase::GMPara;
+Vector<double> OpticalFlowBase::LapPara;
 
+//--------------------------------------------------------------------------------------------------------
+// the wall time of consecutive stages, each lap() returns the seconds since the previous one
+//--------------------------------------------------------------------------------------------------------
+class StageTimer
+{
+private:
+	std::chrono::steady_clock::time_point last;
+public:
+	StageTimer() {last=std::chrono::steady_clock::now();};
+	double lap()
+	{
+		std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+		double seconds=std::chrono::duration<double>(now-last).count();
+		last=now;
+		return seconds;
+	}
+};
 
-OpticalFlow::OpticalFlow(void)
+template <class T>
+OpticalFlowT<T>::OpticalFlowT(void)
 {
 }
 
-OpticalFlow::~OpticalFlow(void)
+template <class T>
+OpticalFlowT<T>::~OpticalFlowT(void)
 {
 }
 
 //--------------------------------------------------------------------------------------------------------
 //  function to compute dx, dy and dt for motion estimation
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::getDxs(DImage &imdx, DImage &imdy, DImage &imdt, const DImage &im1, const DImage &im2)
+template <class T>
+void OpticalFlowT<T>::getDxs(TImage &imdx, TImage &imdy, TImage &imdt, const TImage &im1, const TImage &im2,const Parameters& p)
+{
+	Workspace ws;
+	ws.pParameters=&p;
+	getDxs(imdx,imdy,imdt,im1,im2,ws);
+}
+
+template <class T>
+void OpticalFlowT<T>::getDxs(TImage &imdx, TImage &imdy, TImage &imdt, const TImage &im1, const TImage &im2,Workspace& ws)
 {
+	const Parameters& p=ws.parameters();
 	//double gfilter[5]={0.01,0.09,0.8,0.09,0.01};
 	double gfilter[5]={0.02,0.11,0.74,0.11,0.02};
 	//double gfilter[5]={0,0,1,0,0};
 	if(1)
 	{
-		//DImage foo,Im;
+		//TImage foo,Im;
 		//Im.Add(im1,im2);
 		//Im.Multiplywith(0.5);
 		////foo.imfilter_hv(Im,gfilter,2,gfilter,2);
 		//Im.dx(imdx,true);
 		//Im.dy(imdy,true);
 		//imdt.Subtract(im2,im1);
-		DImage Im1,Im2,Im;
+		TImage &Im1=ws.smooth1,&Im2=ws.smooth2,&Im=ws.smoothAvg;
 		
-		im1.imfilter_hv(Im1,gfilter,2,gfilter,2);
-		im2.imfilter_hv(Im2,gfilter,2,gfilter,2);
-		Im.copyData(Im1);
-		Im.Multiplywith(0.4);
-		Im.Add(Im2,0.6);
+		// separable smoothing through the workspace buffer instead of imfilter_hv's temporary
+		im1.imfilter_h(ws.filterTemp,gfilter,2,p.IsHorizontalWrap);
+		ws.filterTemp.imfilter_v(Im1,gfilter,2);
+		im2.imfilter_h(ws.filterTemp,gfilter,2,p.IsHorizontalWrap);
+		ws.filterTemp.imfilter_v(Im2,gfilter,2);
+		Im = Im1*0.4+Im2*0.6;
 		//Im.Multiplywith(0.5);
 		//Im1.copyData(im1);
 		//Im2.copyData(im2);
     
-		Im.dx(imdx,true);
+		Im.dx(imdx,true,p.IsHorizontalWrap);
 		Im.dy(imdy,true);
 		imdt.Subtract(Im2,Im1);
 	}
 	else
 	{
 		// Im1 and Im2 are the smoothed version of im1 and im2
-		DImage Im1,Im2;
+		TImage &Im1=ws.smooth1,&Im2=ws.smooth2;
 		
-		im1.imfilter_hv(Im1,gfilter,2,gfilter,2);
-		im2.imfilter_hv(Im2,gfilter,2,gfilter,2);
+		im1.imfilter_hv(Im1,gfilter,2,gfilter,2,p.IsHorizontalWrap);
+		im2.imfilter_hv(Im2,gfilter,2,gfilter,2,p.IsHorizontalWrap);
 
 		//Im1.copyData(im1);
 		//Im2.copyData(im2);
     
-		Im2.dx(imdx,true);
+		Im2.dx(imdx,true,p.IsHorizontalWrap);
 		Im2.dy(imdy,true);
 		imdt.Subtract(Im2,Im1);
 	}
@@ -82,10 +164,55 @@ void OpticalFlow::getDxs(DImage &imdx, DImage &imdy, DImage &imdt, const DImage
 	imdt.setDerivative();
 }
 
+//--------------------------------------------------------------------------------------------------------
+// the vertical filter of each plane of a planar image on its own, so that the taps don't run across the
+// borders of the planes
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+static void vfilterPlanes(Image<T>& result,const Image<T>& planes,int nChannels,const double* filter,int fsize)
+{
+	if(!result.matchDimension(planes))
+		result.allocate(planes.width(),planes.height(),1);
+	int width=planes.width(),height=planes.height()/nChannels;
+	size_t planeSize=(size_t)width*height;
+	for(int k=0;k<nChannels;k++)
+		ImageProcessing::vfiltering(planes.data()+k*planeSize,result.data()+k*planeSize,width,height,1,filter,fsize);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// getDxs in the planar layout, the filters of getDxs plane by plane
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::getDxsPlanar(TImage& imdx,TImage& imdy,TImage& imdt,const TImage& planes1,const TImage& planes2,int nChannels,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	double gfilter[5]={0.02,0.11,0.74,0.11,0.02};
+	double yFilter[5]={1,-8,0,8,-1};
+	for(int i=0;i<5;i++)
+		yFilter[i]/=12;
+	TImage &Im1=ws.smooth1,&Im2=ws.smooth2,&Im=ws.smoothAvg;
+
+	// the horizontal filters don't cross the rows, so they run over the stacked planes at once
+	planes1.imfilter_h(ws.filterTemp,gfilter,2,p.IsHorizontalWrap);
+	vfilterPlanes(Im1,ws.filterTemp,nChannels,gfilter,2);
+	planes2.imfilter_h(ws.filterTemp,gfilter,2,p.IsHorizontalWrap);
+	vfilterPlanes(Im2,ws.filterTemp,nChannels,gfilter,2);
+	Im = Im1*0.4+Im2*0.6;
+
+	Im.dx(imdx,true,p.IsHorizontalWrap);
+	vfilterPlanes(imdy,Im,nChannels,yFilter,2);
+	imdt.Subtract(Im2,Im1);
+
+	imdx.setDerivative();
+	imdy.setDerivative();
+	imdt.setDerivative();
+}
+
 //--------------------------------------------------------------------------------------------------------
 // function to do sanity check: imdx*du+imdy*dy+imdt=0
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::SanityCheck(const DImage &imdx, const DImage &imdy, const DImage &imdt, double du, double dv)
+template <class T>
+void OpticalFlowT<T>::SanityCheck(const TImage &imdx, const TImage &imdy, const TImage &imdt, double du, double dv)
 {
 	if(imdx.matchDimension(imdy)==false || imdx.matchDimension(imdt)==false)
 	{
@@ -112,25 +239,48 @@ void OpticalFlow::SanityCheck(const DImage &imdx, const DImage &imdy, const DIma
 //--------------------------------------------------------------------------------------------------------
 // function to warp image based on the flow field
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::warpFL(DImage &warpIm2, const DImage &Im1, const DImage &Im2, const DImage &vx, const DImage &vy)
+template <class T>
+void OpticalFlowT<T>::warpFL(TImage &warpIm2, const TImage &Im1, const TImage &Im2, const TImage &vx, const TImage &vy,const Parameters& p)
 {
 	if(warpIm2.matchDimension(Im2)==false)
 		warpIm2.allocate(Im2.width(),Im2.height(),Im2.nchannels());
-	ImageProcessing::warpImage(warpIm2.data(),Im1.data(),Im2.data(),vx.data(),vy.data(),Im2.width(),Im2.height(),Im2.nchannels());
+	ImageProcessing::warpImage(warpIm2.data(),Im1.data(),Im2.data(),vx.data(),vy.data(),Im2.width(),Im2.height(),Im2.nchannels(),p.IsHorizontalWrap);
 }
 
-void OpticalFlow::warpFL(DImage &warpIm2, const DImage &Im1, const DImage &Im2, const DImage &Flow)
+template <class T>
+void OpticalFlowT<T>::warpFL(TImage &warpIm2, const TImage &Im1, const TImage &Im2, const TImage &Flow)
 {
 	if(warpIm2.matchDimension(Im2)==false)
 		warpIm2.allocate(Im2.width(),Im2.height(),Im2.nchannels());
 	ImageProcessing::warpImageFlow(warpIm2.data(),Im1.data(),Im2.data(),Flow.data(),Im2.width(),Im2.height(),Im2.nchannels());
 }
 
+//--------------------------------------------------------------------------------------------------------
+// the flow of the next pyramid level, both components in one pass instead of the imresize and the
+// Multiplywith of each one
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::ResizeFlow(TImage& vx,TImage& vy,int width,int height,double scale,TImage& foo1,TImage& foo2,const Parameters& p,
+											const TImage* guide,const TImage* srcGuide)
+{
+	foo1.allocate(width,height);
+	foo2.allocate(width,height);
+	if(p.upsampleSigma>0 && guide!=NULL && srcGuide!=NULL && guide->matchDimension(width,height,guide->nchannels()) &&
+		srcGuide->matchDimension(vx.width(),vx.height(),guide->nchannels()))
+		ImageProcessing::JointBilateralResizeFlow(vx.data(),vy.data(),foo1.data(),foo2.data(),vx.width(),vx.height(),width,height,scale,
+																srcGuide->data(),guide->data(),guide->nchannels(),p.upsampleSigma,p.IsHorizontalWrap);
+	else
+		ImageProcessing::ResizeFlow(vx.data(),vy.data(),foo1.data(),foo2.data(),vx.width(),vx.height(),width,height,scale);
+	vx.copyData(foo1);
+	vy.copyData(foo2);
+}
+
 
 //--------------------------------------------------------------------------------------------------------
 // function to generate mask of the pixels that move inside the image boundary
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::genInImageMask(DImage &mask, const DImage &vx, const DImage &vy,int interval)
+template <class T>
+void OpticalFlowT<T>::genInImageMask(TImage &mask, const TImage &vx, const TImage &vy,int interval,const Parameters& p)
 {
 	int imWidth,imHeight;
 	imWidth=vx.width();
@@ -150,13 +300,14 @@ void OpticalFlow::genInImageMask(DImage &mask, const DImage &vx, const DImage &v
 			int offset=i*imWidth+j;
 			y=i+pVx[offset];
 			x=j+pVy[offset];
-			if(x<interval  || x>imWidth-1-interval || y<interval || y>imHeight-1-interval)
+			if((!p.IsHorizontalWrap && (x<interval  || x>imWidth-1-interval)) || y<interval || y>imHeight-1-interval)
 				continue;
 			pMask[offset]=1;
 		}
 }
 
-void OpticalFlow::genInImageMask(DImage &mask, const DImage &flow,int interval)
+template <class T>
+void OpticalFlowT<T>::genInImageMask(TImage &mask, const TImage &flow,int interval,const Parameters& p)
 {
 	int imWidth,imHeight;
 	imWidth=flow.width();
@@ -177,12 +328,572 @@ void OpticalFlow::genInImageMask(DImage &mask, const DImage &flow,int interval)
 			int offset=i*imWidth+j;
 			y=i+pFlow[offset*2+1];
 			x=j+pFlow[offset*2];
-			if(x<interval  || x>imWidth-1-interval || y<interval || y>imHeight-1-interval)
+			if((!p.IsHorizontalWrap && (x<interval  || x>imWidth-1-interval)) || y<interval || y>imHeight-1-interval)
 				continue;
 			pMask[offset]=1;
 		}
 }
 
+//--------------------------------------------------------------------------------------------------------
+// the smoothing of an image of getDxs, the same for Im1 in all the outer iterations of a level
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::SmoothDxs(TImage& smooth,const TImage& im,Workspace& ws)
+{
+	double gfilter[5]={0.02,0.11,0.74,0.11,0.02};
+	im.imfilter_h(ws.filterTemp,gfilter,2,ws.parameters().IsHorizontalWrap);
+	ws.filterTemp.imfilter_v(smooth,gfilter,2);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// warpFL, genInImageMask and getDxs of an outer iteration in three passes instead of about ten: every row
+// is warped, masked and smoothed horizontally at once, the rows are smoothed vertically, and the derivatives
+// of the blend of the two smoothed images are taken in one pass without storing the blend. ws.smooth1 holds
+// Im1 smoothed by SmoothDxs. With IsWarped warpIm2 is already warped, e.g. bicubically, and only read. The
+// taps are added in the order of hfiltering and vfiltering and every value rounded to T as by the separate
+// passes, so the results are the same
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::WarpDxs(TImage& imdx,TImage& imdy,TImage& imdt,TImage& mask,TImage& warpIm2,const TImage& Im1,const TImage& Im2,
+										const TImage& vx,const TImage& vy,bool IsWarped,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	int width=Im2.width(),height=Im2.height(),nChannels=Im2.nchannels();
+	bool IsWrap=p.IsHorizontalWrap;
+	double gfilter[5]={0.02,0.11,0.74,0.11,0.02};
+	double dFilter[5]={1,-8,0,8,-1};
+	for(int l=0;l<5;l++)
+		dFilter[l]/=12;
+	TImage* images[]={&warpIm2,&ws.filterTemp,&ws.smooth2,&imdx,&imdy,&imdt};
+	for(size_t k=0;k<sizeof(images)/sizeof(images[0]);k++)
+		if(!images[k]->matchDimension(width,height,nChannels))
+			images[k]->allocate(width,height,nChannels);
+	if(!mask.matchDimension(width,height,1))
+		mask.allocate(width,height);
+	const T *pIm1=Im1.data(),*pIm2=Im2.data(),*pVx=vx.data(),*pVy=vy.data();
+	T *pWarp=warpIm2.data(),*pTemp=ws.filterTemp.data(),*pMask=mask.data();
+	int nRowElements=width*nChannels;
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height*nChannels>65536)
+#endif
+	for(int i=0;i<height;i++)
+	{
+		T* pWarpRow=pWarp+(size_t)i*nRowElements;
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			// the mask of genInImageMask(mask,vx,vy,0)
+			double my=i+pVx[offset],mx=j+pVy[offset];
+			pMask[offset]=((!IsWrap && (mx<0 || mx>width-1)) || my<0 || my>height-1)?0:1;
+		}
+		// the warp of ImageProcessing::warpImage
+		if(!IsWarped)
+			ImageProcessing::warpImageRow(pWarpRow,pIm1+(size_t)i*nRowElements,pIm2,pVx+(size_t)i*width,pVy+(size_t)i*width,i,width,height,nChannels,IsWrap);
+		T* pTempRow=pTemp+(size_t)i*nRowElements;
+		memset(pTempRow,0,sizeof(T)*nRowElements);
+		switch(nChannels)
+		{
+		case 1:
+			ImageProcessing::hfilteringRow<1>(pWarpRow,pTempRow,width,nChannels,gfilter,2,IsWrap);
+			break;
+		case 3:
+			ImageProcessing::hfilteringRow<3>(pWarpRow,pTempRow,width,nChannels,gfilter,2,IsWrap);
+			break;
+		case 5:
+			ImageProcessing::hfilteringRow<5>(pWarpRow,pTempRow,width,nChannels,gfilter,2,IsWrap);
+			break;
+		default:
+			ImageProcessing::hfilteringRow<0>(pWarpRow,pTempRow,width,nChannels,gfilter,2,IsWrap);
+		}
+	}
+	ImageProcessing::vfiltering(pTemp,ws.smooth2.data(),width,height,nChannels,gfilter,2);
+
+	// the blend Im1*0.4+Im2*0.6 of the smoothed images as the expression rounds it, kept for the row of dx and
+	// computed on the fly for the rows of dy. One band of rows per thread, each one with its row of the blend
+	const T *pSmooth1=ws.smooth1.data(),*pSmooth2=ws.smooth2.data();
+	auto blend=[pSmooth1,pSmooth2](size_t index) {return (T)((double)pSmooth1[index]*0.4+(double)pSmooth2[index]*0.6);};
+	T *pDx=imdx.data(),*pDy=imdy.data(),*pDt=imdt.data();
+	int nBands=1;
+#ifdef _OPENMP
+	if((double)width*height*nChannels>65536)
+		nBands=__min(p.numThreads(),height);
+	#pragma omp parallel for num_threads(nBands) schedule(static,1)
+#endif
+	for(int b=0;b<nBands;b++)
+	{
+		vector<T> line(nRowElements);
+		for(int i=(long long)height*b/nBands;i<(long long)height*(b+1)/nBands;i++)
+		{
+			size_t rows[5];
+			for(int l=0;l<5;l++)
+				rows[l]=(size_t)ImageProcessing::EnforceRange(i+l-2,height)*nRowElements;
+			size_t row=(size_t)i*nRowElements;
+			for(int e=0;e<nRowElements;e++)
+				line[e]=blend(row+e);
+			for(int j=0;j<width;j++)
+			{
+				int columns[5];
+				for(int l=0;l<5;l++)
+					columns[l]=ImageProcessing::BoundaryRange(j+l-2,width,IsWrap)*nChannels;
+				for(int k=0;k<nChannels;k++)
+				{
+					size_t index=row+j*nChannels+k;
+					T dx=0,dy=0;
+					for(int l=0;l<5;l++)
+						dx+=line[columns[l]+k]*dFilter[l];
+					for(int l=0;l<5;l++)
+						dy+=((l==2)?line[j*nChannels+k]:blend(rows[l]+j*nChannels+k))*dFilter[l];
+					pDx[index]=dx;
+					pDy[index]=dy;
+					pDt[index]=pSmooth2[index]-pSmooth1[index];
+				}
+			}
+		}
+	}
+	imdx.setDerivative();
+	imdy.setDerivative();
+	imdt.setDerivative();
+}
+
+//--------------------------------------------------------------------------------------------------------
+// function to compute the robust weight phi of the smoothness term from the flow gradients
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::RobustPhi(TImage& Phi_1st,const TImage& ux,const TImage& uy,const TImage& vx,const TImage& vy,double varepsilon_phi,
+												const RowSpans* roi)
+{
+	if(!Phi_1st.matchDimension(ux.width(),ux.height(),1))
+		Phi_1st.allocate(ux.width(),ux.height());
+	if(roi==NULL)
+	{
+		FlowKernels::RobustPhi(Phi_1st.data(),ux.data(),uy.data(),vx.data(),vy.data(),ux.npixels(),varepsilon_phi);
+		return;
+	}
+	int width=ux.width();
+	for(int i=0;i<ux.height();i++)
+		for(int s=roi->first[i];s<roi->first[i+1];s++)
+		{
+			int offset=i*width+roi->begin[s];
+			FlowKernels::RobustPhi(Phi_1st.data()+offset,ux.data()+offset,uy.data()+offset,vx.data()+offset,vy.data()+offset,
+											roi->end[s]-roi->begin[s],varepsilon_phi);
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// function to compute the robust weight psi of the data term; the noise model is a template parameter
+// so that the per-pixel loops do not branch on it. normalizeLap divides the Laplacian weight by the
+// estimated noise level, as the PDE solver does
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::RobustPsi(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+													const GaussianMixture& GMPara,const Vector<double>& LapPara,
+													double varepsilon_psi,bool normalizeLap,const RowSpans* roi,const Parameters& p)
+{
+	int nChannels=imdx.nchannels();
+	RobustPsiSpans(Psi_1st,imdx,imdy,imdt,du,dv,GMPara,LapPara,varepsilon_psi,normalizeLap,nChannels,nChannels,1,roi,p);
+}
+
+template <class T>
+void OpticalFlowT<T>::RobustPsiPlanar(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+													const GaussianMixture& GMPara,const Vector<double>& LapPara,
+													double varepsilon_psi,bool normalizeLap,int nChannels,const RowSpans* roi,const Parameters& p)
+{
+	RobustPsiSpans(Psi_1st,imdx,imdy,imdt,du,dv,GMPara,LapPara,varepsilon_psi,normalizeLap,nChannels,1,du.npixels(),roi,p);
+}
+
+template <class T>
+void OpticalFlowT<T>::RobustPsiSpans(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+													const GaussianMixture& GMPara,const Vector<double>& LapPara,double varepsilon_psi,bool normalizeLap,
+													int nChannels,int pixelStride,int channelStride,const RowSpans* roi,const Parameters& p)
+{
+	Psi_1st.reset();
+	// without a region of interest the whole image is one span
+	int width=du.width(),nRows=(roi==NULL)?1:du.height();
+	for(int i=0;i<nRows;i++)
+	{
+		int nSpans=(roi==NULL)?1:roi->first[i+1]-roi->first[i];
+		for(int s=0;s<nSpans;s++)
+		{
+			int iBegin=(roi==NULL)?0:i*width+roi->begin[roi->first[i]+s];
+			int iEnd=(roi==NULL)?du.npixels():i*width+roi->end[roi->first[i]+s];
+			switch(p.noiseModel)
+			{
+			case GMixture:
+				RobustPsi<GMixture>(Psi_1st,imdx,imdy,imdt,du,dv,GMPara,LapPara,varepsilon_psi,normalizeLap,nChannels,pixelStride,channelStride,iBegin,iEnd,p);
+				break;
+			case Lap:
+				RobustPsi<Lap>(Psi_1st,imdx,imdy,imdt,du,dv,GMPara,LapPara,varepsilon_psi,normalizeLap,nChannels,pixelStride,channelStride,iBegin,iEnd,p);
+				break;
+			}
+		}
+	}
+}
+
+template <class T>
+template <OpticalFlowBase::NoiseModel model>
+void OpticalFlowT<T>::RobustPsi(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+													const GaussianMixture& GMPara,const Vector<double>& LapPara,double varepsilon_psi,bool normalizeLap,
+													int nChannels,int pixelStride,int channelStride,int iBegin,int iEnd,const Parameters& p)
+{
+	_FlowPrecision* psiData=Psi_1st.data();
+	const _FlowPrecision *imdxData=imdx.data(),*imdyData=imdy.data(),*imdtData=imdt.data();
+	const _FlowPrecision *duData=du.data(),*dvData=dv.data();
+
+	for(int k=0;k<nChannels;k++)
+	{
+		if(model==Lap)
+		{
+			if(LapPara[k]<1E-20)
+				continue;
+			double scale=normalizeLap ? 0.5/LapPara[k] : 0.5;
+			// the samples of channel k from pixel iBegin on, contiguous in the planar layout
+			size_t first=(size_t)iBegin*pixelStride+(size_t)k*channelStride;
+			FlowKernels::RobustLapPsi(psiData+first,imdtData+first,imdxData+first,imdyData+first,
+												duData+iBegin,dvData+iBegin,iEnd-iBegin,pixelStride,0,scale,varepsilon_psi);
+		}
+		else if(p.IsGaussianMixtureTable)
+		{
+			// log Gaussian mixture probability model, the weight of the first Gaussian from the table
+			double psi2=1/(2*GMPara.beta_square[k]),psi12=1/(2*GMPara.sigma_square[k])-psi2,temp;
+			for(int i=iBegin;i<iEnd;i++)
+			{
+				size_t offset=(size_t)i*pixelStride+(size_t)k*channelStride;
+				temp=imdtData[offset]+imdxData[offset]*duData[i]+imdyData[offset]*dvData[i];
+				psiData[offset]=psi2+psi12*GMPara.weight(temp*temp,k);
+			}
+		}
+		else
+		{
+			// log Gaussian mixture probability model
+			double prob1,prob2,prob11,prob22,temp;
+			for(int i=iBegin;i<iEnd;i++)
+			{
+				size_t offset=(size_t)i*pixelStride+(size_t)k*channelStride;
+				temp=imdtData[offset]+imdxData[offset]*duData[i]+imdyData[offset]*dvData[i];
+				temp *= temp;
+				prob1 = GMPara.Gaussian(temp,0,k)*GMPara.alpha[k];
+				prob2 = GMPara.Gaussian(temp,1,k)*(1-GMPara.alpha[k]);
+				prob11 = prob1/(2*GMPara.sigma_square[k]);
+				prob22 = prob2/(2*GMPara.beta_square[k]);
+				psiData[offset] = (prob11+prob22)/(prob1+prob2);
+			}
+		}
+	}
+}
+
+template <class T>
+void OpticalFlowT<T>::RobustPsiRange(double& peak,double& floor,const GaussianMixture& GMPara,const Vector<double>& LapPara,
+													 double varepsilon_psi,int k,const Parameters& p)
+{
+	if(p.noiseModel==Lap)
+	{
+		// a channel without noise is left out of the data term
+		peak=(LapPara[k]<1E-20) ? 0 : 0.5/sqrt(varepsilon_psi);
+		floor=0;
+		return;
+	}
+	// the mixture tends to the weight of its wider Gaussian, the table interpolates the same weights
+	double prob1=GMPara.Gaussian(0,0,k)*GMPara.alpha[k],prob2=GMPara.Gaussian(0,1,k)*(1-GMPara.alpha[k]);
+	peak=(prob1/(2*GMPara.sigma_square[k])+prob2/(2*GMPara.beta_square[k]))/(prob1+prob2);
+	floor=__min(1/(2*GMPara.sigma_square[k]),1/(2*GMPara.beta_square[k]));
+}
+
+//--------------------------------------------------------------------------------------------------------
+// Multiply(Psi_1st,imdx,imdy) and collapse for the five components fused into one pass over the derivatives,
+// without the multichannel products. The products and the averages are rounded as in Multiply and collapse
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::AssembleLinearSystem(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+																const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const RowSpans* roi)
+{
+	AssembleLinearSystemSpans(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,imdx.width(),imdx.height(),imdx.nchannels(),false,roi);
+}
+
+template <class T>
+void OpticalFlowT<T>::AssembleLinearSystemPlanar(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+																const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int nChannels,const RowSpans* roi)
+{
+	AssembleLinearSystemSpans(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,imdx.width(),imdx.height()/nChannels,nChannels,true,roi);
+}
+
+template <class T>
+void OpticalFlowT<T>::AssembleLinearSystemSpans(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+																const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int imWidth,int imHeight,int nChannels,
+																bool IsPlanarLayout,const RowSpans* roi)
+{
+	TImage* components[]={&imdxy,&imdx2,&imdy2,&imdtdx,&imdtdy};
+	for(int i=0;i<5;i++)
+		if(!components[i]->matchDimension(imWidth,imHeight,1))
+			components[i]->allocate(imWidth,imHeight,1);
+	void (*assemble)(TImage&,TImage&,TImage&,TImage&,TImage&,const TImage&,const TImage&,const TImage&,const TImage&,int,int,int);
+	switch(nChannels)
+	{
+	case 1:
+		assemble=&AssembleLinearSystemChannels<1,false>;
+		break;
+	case 3:
+		assemble=IsPlanarLayout ? &AssembleLinearSystemChannels<3,true> : &AssembleLinearSystemChannels<3,false>;
+		break;
+	case 5:
+		assemble=IsPlanarLayout ? &AssembleLinearSystemChannels<5,true> : &AssembleLinearSystemChannels<5,false>;
+		break;
+	default:
+		assemble=IsPlanarLayout ? &AssembleLinearSystemChannels<0,true> : &AssembleLinearSystemChannels<0,false>;
+	}
+	if(roi==NULL)
+	{
+		assemble(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,nChannels,0,imWidth*imHeight);
+		return;
+	}
+	for(int i=0;i<imHeight;i++)
+		for(int s=roi->first[i];s<roi->first[i+1];s++)
+			assemble(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,nChannels,i*imWidth+roi->begin[s],i*imWidth+roi->end[s]);
+}
+
+template <class T>
+template <int NC,bool IsPlanarLayout>
+void OpticalFlowT<T>::AssembleLinearSystemChannels(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+																		const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int nChannels,int iBegin,int iEnd)
+{
+	const int nc=(NC>0)?NC:nChannels;
+	const size_t planeSize=imdxy.npixels();
+	const _FlowPrecision *psiData=Psi_1st.data(),*imdxData=imdx.data(),*imdyData=imdy.data(),*imdtData=imdt.data();
+	_FlowPrecision *imdxyData=imdxy.data(),*imdx2Data=imdx2.data(),*imdy2Data=imdy2.data(),*imdtdxData=imdtdx.data(),*imdtdyData=imdtdy.data();
+	for(int i=iBegin;i<iEnd;i++)
+	{
+		double sumxy=0,sumx2=0,sumy2=0,sumtdx=0,sumtdy=0;
+		for(int k=0;k<nc;k++)
+		{
+			size_t offset=IsPlanarLayout ? k*planeSize+i : (size_t)i*nc+k;
+			_FlowPrecision psi=psiData[offset],dx=imdxData[offset],dy=imdyData[offset],dt=imdtData[offset];
+			_FlowPrecision xy=psi*dx*dy,x2=psi*dx*dx,y2=psi*dy*dy,tdx=psi*dx*dt,tdy=psi*dy*dt;
+			if(nc==1)
+			{
+				imdxyData[i]=xy;
+				imdx2Data[i]=x2;
+				imdy2Data[i]=y2;
+				imdtdxData[i]=tdx;
+				imdtdyData[i]=tdy;
+				break;
+			}
+			sumxy+=xy;
+			sumx2+=x2;
+			sumy2+=y2;
+			sumtdx+=tdx;
+			sumtdy+=tdy;
+		}
+		if(nc>1)
+		{
+			imdxyData[i]=sumxy/nc;
+			imdx2Data[i]=sumx2/nc;
+			imdy2Data[i]=sumy2/nc;
+			imdtdxData[i]=sumtdx/nc;
+			imdtdyData[i]=sumtdy/nc;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// one SOR update of (du,dv) at pixel (i,j), shared by the lexicographic and the red-black sweeps
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+inline double OpticalFlowT<T>::SORUpdate(int i,int j,int imWidth,int imHeight,double alpha,double omega,const _FlowPrecision* phiData,
+																	const _FlowPrecision* imdxyData,const _FlowPrecision* imdx2Data,const _FlowPrecision* imdy2Data,
+																	const _FlowPrecision* imdtdxData,const _FlowPrecision* imdtdyData,_FlowPrecision* duData,_FlowPrecision* dvData,bool IsWrap)
+{
+	int offset = i * imWidth+j;
+	double sigma1 = 0, sigma2 = 0, coeff = 0;
+	double _weight;
+	double du0 = duData[offset], dv0 = dvData[offset];
+
+	if(j>0)
+	{
+		_weight = phiData[offset-1];
+		sigma1  += _weight*duData[offset-1];
+		sigma2  += _weight*dvData[offset-1];
+		coeff   += _weight;
+	}
+	else if(IsWrap) // the left neighbor is the last pixel of the row
+	{
+		_weight = phiData[offset+imWidth-1];
+		sigma1  += _weight*duData[offset+imWidth-1];
+		sigma2  += _weight*dvData[offset+imWidth-1];
+		coeff   += _weight;
+	}
+	if(j<imWidth-1)
+	{
+		_weight = phiData[offset];
+		sigma1 += _weight*duData[offset+1];
+		sigma2 += _weight*dvData[offset+1];
+		coeff   += _weight;
+	}
+	else if(IsWrap) // the right neighbor is the first pixel of the row
+	{
+		_weight = phiData[offset];
+		sigma1 += _weight*duData[offset-imWidth+1];
+		sigma2 += _weight*dvData[offset-imWidth+1];
+		coeff   += _weight;
+	}
+	if(i>0)
+	{
+		_weight = phiData[offset-imWidth];
+		sigma1 += _weight*duData[offset-imWidth];
+		sigma2 += _weight*dvData[offset-imWidth];
+		coeff   += _weight;
+	}
+	if(i<imHeight-1)
+	{
+		_weight = phiData[offset];
+		sigma1  += _weight*duData[offset+imWidth];
+		sigma2  += _weight*dvData[offset+imWidth];
+		coeff   += _weight;
+	}
+	sigma1 *= -alpha;
+	sigma2 *= -alpha;
+	coeff *= alpha;
+	 // compute du
+	sigma1 += imdxyData[offset]*dvData[offset];
+	duData[offset] = (1-omega)*duData[offset] + omega/(imdx2Data[offset] + alpha*0.05 + coeff)*(imdtdxData[offset] - sigma1);
+	// compute dv
+	sigma2 += imdxyData[offset]*duData[offset];
+	dvData[offset] = (1-omega)*dvData[offset] + omega/(imdy2Data[offset] + alpha*0.05 + coeff)*(imdtdyData[offset] - sigma2);
+	double ddu = duData[offset]-du0, ddv = dvData[offset]-dv0;
+	return ddu*ddu+ddv*ddv;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// conjugate gradient on the linear system that SORUpdate relaxes,
+//     (imdx2+alpha*0.05)*du + imdxy*dv + alpha*Laplacian(du) = b1
+//     imdxy*du + (imdy2+alpha*0.05)*dv + alpha*Laplacian(dv) = b2
+// preconditioned by the inverse of the 2x2 block of (du,dv) at each pixel. The system is symmetric and
+// positive definite, imdx2*imdy2>=imdxy^2 since they are weighted sums of the same products. It stops
+// when |r|<=tolerance*|b| or after nMaxIterations
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+int OpticalFlowT<T>::SolvePCG(TImage& du,TImage& dv,const TImage& imdxy,const TImage& imdx2,const TImage& imdy2,const TImage& b1,const TImage& b2,
+															const TImage& Phi_1st,double alpha,int nMaxIterations,double tolerance,Workspace& ws,double* relativeResidual)
+{
+	const Parameters& p=ws.parameters();
+	int width=du.width(),height=du.height(),nPixels=width*height;
+	TImage &r1=ws.r1,&r2=ws.r2,&p1=ws.p1,&p2=ws.p2,&q1=ws.q1,&q2=ws.q2;
+	TImage &M11=ws.M11,&M12=ws.M12,&M22=ws.M22,&z1=ws.z1,&z2=ws.z2;
+	TImage* blocks[]={&M11,&M12,&M22,&z1,&z2};
+	for(size_t i=0;i<sizeof(blocks)/sizeof(blocks[0]);i++)
+		blocks[i]->allocate(width,height);
+	const _FlowPrecision *phiData=Phi_1st.data();
+	const _FlowPrecision *imdxyData=imdxy.data(),*imdx2Data=imdx2.data(),*imdy2Data=imdy2.data();
+
+	// the diagonal of the smoothness term is the sum of the weights of the neighbors, as in SORUpdate
+	_FlowPrecision *m11=M11.data(),*m12=M12.data(),*m22=M22.data();
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double coeff=0;
+			if(j>0)
+				coeff+=phiData[offset-1];
+			else if(p.IsHorizontalWrap)
+				coeff+=phiData[offset+width-1];
+			if(j<width-1 || p.IsHorizontalWrap)
+				coeff+=phiData[offset];
+			if(i>0)
+				coeff+=phiData[offset-width];
+			if(i<height-1)
+				coeff+=phiData[offset];
+			double a11=imdx2Data[offset]+alpha*(0.05+coeff);
+			double a22=imdy2Data[offset]+alpha*(0.05+coeff);
+			double a12=imdxyData[offset];
+			double det=a11*a22-a12*a12;
+			m11[offset]=a22/det;
+			m12[offset]=-a12/det;
+			m22[offset]=a11/det;
+		}
+
+	du.reset();
+	dv.reset();
+	r1.copyData(b1);
+	r2.copyData(b2);
+	double bnorm=r1.norm2()+r2.norm2();
+	if(relativeResidual!=NULL)
+		*relativeResidual=0;
+	if(bnorm==0)
+		return 0;
+
+	_FlowPrecision *duData=du.data(),*dvData=dv.data();
+	_FlowPrecision *r1Data=r1.data(),*r2Data=r2.data(),*z1Data=z1.data(),*z2Data=z2.data();
+	double rz=0;
+	for(int i=0;i<nPixels;i++)
+	{
+		z1Data[i]=m11[i]*r1Data[i]+m12[i]*r2Data[i];
+		z2Data[i]=m12[i]*r1Data[i]+m22[i]*r2Data[i];
+		rz+=r1Data[i]*z1Data[i]+r2Data[i]*z2Data[i];
+	}
+	p1.copyData(z1);
+	p2.copyData(z2);
+
+	int k;
+	for(k=0;k<nMaxIterations;)
+	{
+		// q = A p
+		Laplacian(q1,q2,p1,p2,Phi_1st,p);
+		_FlowPrecision *p1Data=p1.data(),*p2Data=p2.data(),*q1Data=q1.data(),*q2Data=q2.data();
+		double pq=0;
+		for(int i=0;i<nPixels;i++)
+		{
+			q1Data[i]=(imdx2Data[i]+alpha*0.05)*p1Data[i]+imdxyData[i]*p2Data[i]+alpha*q1Data[i];
+			q2Data[i]=imdxyData[i]*p1Data[i]+(imdy2Data[i]+alpha*0.05)*p2Data[i]+alpha*q2Data[i];
+			pq+=p1Data[i]*q1Data[i]+p2Data[i]*q2Data[i];
+		}
+		double beta=rz/pq;
+
+		// update the solution and the residual, and precondition the residual in the same pass
+		double rnorm=0,rzNext=0;
+		for(int i=0;i<nPixels;i++)
+		{
+			duData[i]+=beta*p1Data[i];
+			dvData[i]+=beta*p2Data[i];
+			r1Data[i]-=beta*q1Data[i];
+			r2Data[i]-=beta*q2Data[i];
+			z1Data[i]=m11[i]*r1Data[i]+m12[i]*r2Data[i];
+			z2Data[i]=m12[i]*r1Data[i]+m22[i]*r2Data[i];
+			rnorm+=r1Data[i]*r1Data[i]+r2Data[i]*r2Data[i];
+			rzNext+=r1Data[i]*z1Data[i]+r2Data[i]*z2Data[i];
+		}
+		k++;
+		if(relativeResidual!=NULL)
+			*relativeResidual=sqrt(rnorm/bnorm);
+		if(rnorm<=tolerance*tolerance*bnorm)
+			break;
+		double ratio=rzNext/rz;
+		rz=rzNext;
+		for(int i=0;i<nPixels;i++)
+		{
+			p1Data[i]=z1Data[i]+ratio*p1Data[i];
+			p2Data[i]=z2Data[i]+ratio*p2Data[i];
+		}
+	}
+	return k;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// number of threads used by the parallel solvers, nThreads<=0 means all available cores
+//--------------------------------------------------------------------------------------------------------
+int OpticalFlowBase::Parameters::numThreads() const
+{
+#ifdef _OPENMP
+	if(nThreads>0)
+		return nThreads;
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+int OpticalFlowBase::getNumThreads()
+{
+	return parameters.numThreads();
+}
+
 //--------------------------------------------------------------------------------------------------------
 // function to compute optical flow field using two fixed point iterations
 // Input arguments:
@@ -191,47 +902,126 @@ void OpticalFlow::genInImageMask(DImage &mask, const DImage &flow,int interval)
 //	u,v:									the current flow field, NOTICE that they are also output arguments
 //	
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::SmoothFlowSOR(const DImage &Im1, const DImage &Im2, DImage &warpIm2, DImage &u, DImage &v, 
+template <class T>
+void OpticalFlowT<T>::SmoothFlowSOR(const TImage &Im1, const TImage &Im2, TImage &warpIm2, TImage &u, TImage &v, 
 																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nSORIterations)
 {
-	DImage mask,imdx,imdy,imdt;
+	// the noise model is read from and written back to the static members
+	Workspace ws;
+	ws.GMPara=GMPara;
+	ws.LapPara=LapPara;
+	SmoothFlowSOR(Im1,Im2,warpIm2,u,v,alpha,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+	GMPara=ws.GMPara;
+	LapPara=ws.LapPara;
+}
+
+template <class T>
+void OpticalFlowT<T>::SmoothFlowSOR(const TImage &Im1, const TImage &Im2, TImage &warpIm2, TImage &u, TImage &v, 
+																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nSORIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	TImage &mask=ws.mask,&imdx=ws.imdx,&imdy=ws.imdy,&imdt=ws.imdt;
 	int imWidth,imHeight,nChannels,nPixels;
 	imWidth=Im1.width();
 	imHeight=Im1.height();
 	nChannels=Im1.nchannels();
 	nPixels=imWidth*imHeight;
 
-	DImage du(imWidth,imHeight),dv(imWidth,imHeight);
-	DImage uu(imWidth,imHeight),vv(imWidth,imHeight);
-	DImage ux(imWidth,imHeight),uy(imWidth,imHeight);
-	DImage vx(imWidth,imHeight),vy(imWidth,imHeight);
-	DImage Phi_1st(imWidth,imHeight);
-	DImage Psi_1st(imWidth,imHeight,nChannels);
-
-	DImage imdxy,imdx2,imdy2,imdtdx,imdtdy;
-	DImage ImDxy,ImDx2,ImDy2,ImDtDx,ImDtDy;
-	DImage foo1,foo2;
+	TImage &du=ws.du,&dv=ws.dv,&uu=ws.uu,&vv=ws.vv;
+	TImage &ux=ws.ux,&uy=ws.uy,&vx=ws.vx,&vy=ws.vy;
+	du.allocate(imWidth,imHeight);
+	dv.allocate(imWidth,imHeight);
+	// the data term in the planar layout walks every channel with unit stride; the warp and the noise
+	// estimation stay on the interleaved images
+	bool IsPlanar = p.IsPlanar && nChannels>1;
+	TImage &Phi_1st=ws.Phi_1st,&Psi_1st=ws.Psi_1st;
+	Phi_1st.allocate(imWidth,imHeight);
+	if(IsPlanar)
+		Psi_1st.allocate(imWidth,imHeight*nChannels,1);
+	else
+		Psi_1st.allocate(imWidth,imHeight,nChannels);
 
-	double prob1,prob2,prob11,prob22;
+	TImage &imdxy=ws.imdxy,&imdx2=ws.imdx2,&imdy2=ws.imdy2,&imdtdx=ws.imdtdx,&imdtdy=ws.imdtdy;
+	TImage &foo1=ws.foo1,&foo2=ws.foo2;
 
 	double varepsilon_phi=pow(0.001,2);
 	double varepsilon_psi=pow(0.001,2);
 
+	// the derivatives of Im2 for the bicubic warp are the same in all the outer iterations
+	if(p.interpolation == Bicubic && !ws.IsWarpDerivatives)
+		Im2.bicubicDerivatives(ws.warpDx,ws.warpDy,ws.warpDxDy,p.IsHorizontalWrap);
+	if(IsPlanar)
+		Im1.planarize(ws.planarImage1);
+	else
+		SmoothDxs(ws.smooth1,Im1,ws);
+
+	SolverStatistics stats;
+	stats.width = imWidth;
+	stats.height = imHeight;
+	stats.nOuterIterations = 0;
+	stats.nSolverIterations = 0;
+	stats.lastUpdate = 0;
+	stats.lastResidual = 0;
+	stats.warpTime = stats.derivativeTime = stats.weightTime = stats.assemblyTime = stats.solverTime = stats.noiseTime = 0;
+	stats.workspaceMemory = stats.peakMemory = 0;
+
+	// with a region of interest the weights, the linear system and SOR are restricted to its spans, and PCG
+	// gives way to SOR. The smoothness weights outside stay 0, so the pixels outside are decoupled and keep
+	// their flow
+	const RowSpans* roi = ws.roiSpans.IsEmpty() ? NULL : &ws.roiSpans;
+	int nSolved = (roi == NULL) ? nPixels : __max(roi->npixels(),1);
+	if(roi != NULL)
+		Phi_1st.reset();
+	// the confidence is taken from the weights of the data term as the right hand side is assembled, in the
+	// last outer iteration or in every one when they may stop early
+	vector<double> psiFloor,psiScale;
+	if(ws.IsConfidenceLevel)
+	{
+		ws.confidence.allocate(imWidth,imHeight);
+		psiFloor.resize(nChannels);
+		psiScale.resize(nChannels);
+	}
+
 	//--------------------------------------------------------------------------
 	// the outer fixed point iteration
 	//--------------------------------------------------------------------------
 	for(int count=0;count<nOuterFPIterations;count++)
 	{
-		// compute the gradient
-		getDxs(imdx,imdy,imdt,Im1,warpIm2);
-
-		// generate the mask to set the weight of the pxiels moving outside of the image boundary to be zero
-		genInImageMask(mask,u,v);
+		StageTimer timer;
+		// compute the gradient and the mask that sets the weight of the pixels moving outside of the image boundary
+		// to be zero; after the first outer iteration they are computed with the warp
+		if(IsPlanar)
+		{
+			warpIm2.planarize(ws.planarWarpImage2);
+			getDxsPlanar(imdx,imdy,imdt,ws.planarImage1,ws.planarWarpImage2,nChannels,ws);
+			genInImageMask(mask,u,v,0,p);
+		}
+		else if(count==0)
+			WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,true,ws);
 
 		// set the derivative of the flow field to be zero
 		du.reset();
 		dv.reset();
 
+		// the weights of the channels to average into the confidence, the noise model is fixed until the warp
+		_FlowPrecision* pConfidence=NULL;
+		if(ws.IsConfidenceLevel && (count==nOuterFPIterations-1 || p.updateTolerance>0))
+		{
+			pConfidence=ws.confidence.data();
+			int nValid=0;
+			for(int k=0;k<nChannels;k++)
+			{
+				double peak;
+				RobustPsiRange(peak,psiFloor[k],ws.GMPara,ws.LapPara,varepsilon_psi,k,p);
+				psiScale[k]=(peak>psiFloor[k]) ? 1/(peak-psiFloor[k]) : 0;
+				nValid+=(psiScale[k]>0);
+			}
+			for(int k=0;k<nChannels;k++)
+				psiScale[k]/=__max(nValid,1);
+		}
+		const _FlowPrecision* psiData=Psi_1st.data();
+		const _FlowPrecision* maskData=mask.data();
+
 		//--------------------------------------------------------------------------
 		// the inner fixed point iteration
 		//--------------------------------------------------------------------------
@@ -248,127 +1038,44 @@ void OpticalFlow::SmoothFlowSOR(const DImage &Im1, const DImage &Im2, DImage &wa
 				uu.Add(u,du);
 				vv.Add(v,dv);
 			}
-			uu.dx(ux);
+			uu.dx(ux,false,p.IsHorizontalWrap);
 			uu.dy(uy);
-			vv.dx(vx);
+			vv.dx(vx,false,p.IsHorizontalWrap);
 			vv.dy(vy);
+			stats.derivativeTime += timer.lap();
 
 			// compute the weight of phi
-			Phi_1st.reset();
+			RobustPhi(Phi_1st,ux,uy,vx,vy,varepsilon_phi,roi);
 			_FlowPrecision* phiData=Phi_1st.data();
-			double temp;
-			const _FlowPrecision *uxData,*uyData,*vxData,*vyData;
-			uxData=ux.data();
-			uyData=uy.data();
-			vxData=vx.data();
-			vyData=vy.data();
-			double power_alpha = 0.5;
-			for(int i=0;i<nPixels;i++)
-			{
-				temp=uxData[i]*uxData[i]+uyData[i]*uyData[i]+vxData[i]*vxData[i]+vyData[i]*vyData[i];
-				//phiData[i]=power_alpha*pow(temp+varepsilon_phi,power_alpha-1);
-				phiData[i] = 0.5/sqrt(temp+varepsilon_phi);
-				//phiData[i] = 1/(power_alpha+temp);
-			}
 
 			// compute the nonlinear term of psi
-			Psi_1st.reset();
-			_FlowPrecision* psiData=Psi_1st.data();
-			const _FlowPrecision *imdxData,*imdyData,*imdtData;
-			const _FlowPrecision *duData,*dvData;
-			imdxData=imdx.data();
-			imdyData=imdy.data();
-			imdtData=imdt.data();
-			duData=du.data();
-			dvData=dv.data();
-		
-			double _a  = 10000, _b = 0.1;
-			if(nChannels==1)
-				for(int i=0;i<nPixels;i++)
-				{
-					temp=imdtData[i]+imdxData[i]*duData[i]+imdyData[i]*dvData[i];
-					//if(temp*temp<0.04)
-					// psiData[i]=1/(2*sqrt(temp*temp+varepsilon_psi));
-					//psiData[i] = _a*_b/(1+_a*temp*temp);
-
-					// the following code is for log Gaussian mixture probability model
-					temp *= temp;
-					switch(noiseModel)
-					{
-					case GMixture:
-						prob1 = GMPara.Gaussian(temp,0,0)*GMPara.alpha[0];
-						prob2 = GMPara.Gaussian(temp,1,0)*(1-GMPara.alpha[0]);
-						prob11 = prob1/(2*GMPara.sigma_square[0]);
-						prob22 = prob2/(2*GMPara.beta_square[0]);
-						psiData[i] = (prob11+prob22)/(prob1+prob2);
-						break;
-					case Lap:
-						if(LapPara[0]<1E-20)
-							continue;
-						//psiData[i]=1/(2*sqrt(temp+varepsilon_psi)*LapPara[0]);
-                        psiData[i]=1/(2*sqrt(temp+varepsilon_psi));
-						break;
-					}
-				}
+			if(IsPlanar)
+				RobustPsiPlanar(Psi_1st,imdx,imdy,imdt,du,dv,ws.GMPara,ws.LapPara,varepsilon_psi,false,nChannels,roi,p);
 			else
-				for(int i=0;i<nPixels;i++)
-					for(int k=0;k<nChannels;k++)
-					{
-						int offset=i*nChannels+k;
-						temp=imdtData[offset]+imdxData[offset]*duData[i]+imdyData[offset]*dvData[i];
-						//if(temp*temp<0.04)
-						 // psiData[offset]=1/(2*sqrt(temp*temp+varepsilon_psi));
-						//psiData[offset] =  _a*_b/(1+_a*temp*temp);
-						temp *= temp;
-						switch(noiseModel)
-						{
-						case GMixture:
-							prob1 = GMPara.Gaussian(temp,0,k)*GMPara.alpha[k];
-							prob2 = GMPara.Gaussian(temp,1,k)*(1-GMPara.alpha[k]);
-							prob11 = prob1/(2*GMPara.sigma_square[k]);
-							prob22 = prob2/(2*GMPara.beta_square[k]);
-							psiData[offset] = (prob11+prob22)/(prob1+prob2);
-							break;
-						case Lap:
-							if(LapPara[k]<1E-20)
-								continue;
-							//psiData[offset]=1/(2*sqrt(temp+varepsilon_psi)*LapPara[k]);
-                            psiData[offset]=1/(2*sqrt(temp+varepsilon_psi));
-							break;
-						}
-					}
-			// prepare the components of the large linear system
-			ImDxy.Multiply(Psi_1st,imdx,imdy);
-			ImDx2.Multiply(Psi_1st,imdx,imdx);
-			ImDy2.Multiply(Psi_1st,imdy,imdy);
-			ImDtDx.Multiply(Psi_1st,imdx,imdt);
-			ImDtDy.Multiply(Psi_1st,imdy,imdt);
+				RobustPsi(Psi_1st,imdx,imdy,imdt,du,dv,ws.GMPara,ws.LapPara,varepsilon_psi,false,roi,p);
+			stats.weightTime += timer.lap();
 
-			if(nChannels>1)
-			{
-				ImDxy.collapse(imdxy);
-				ImDx2.collapse(imdx2);
-				ImDy2.collapse(imdy2);
-				ImDtDx.collapse(imdtdx);
-				ImDtDy.collapse(imdtdy);
-			}
+			// prepare the components of the large linear system
+			if(IsPlanar)
+				AssembleLinearSystemPlanar(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,nChannels,roi);
 			else
-			{
-				imdxy.copyData(ImDxy);
-				imdx2.copyData(ImDx2);
-				imdy2.copyData(ImDy2);
-				imdtdx.copyData(ImDtDx);
-				imdtdy.copyData(ImDtDy);
-			}
+				AssembleLinearSystem(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt,roi);
 			// laplacian filtering of the current flow field
-		    Laplacian(foo1,u,Phi_1st);
-			Laplacian(foo2,v,Phi_1st);
+			Laplacian(foo1,foo2,u,v,Phi_1st,p);
 
 			for(int i=0;i<nPixels;i++)
 			{
 				imdtdx.data()[i] = -imdtdx.data()[i]-alpha*foo1.data()[i];
 				imdtdy.data()[i] = -imdtdy.data()[i]-alpha*foo2.data()[i];
+				if(pConfidence!=NULL)
+				{
+					double sum=0;
+					for(int k=0;k<nChannels;k++)
+						sum+=(psiData[IsPlanar ? (size_t)k*nPixels+i : (size_t)i*nChannels+k]-psiFloor[k])*psiScale[k];
+					pConfidence[i]=maskData[i]*__min(__max(sum,0),1);
+				}
 			}
+			stats.assemblyTime += timer.lap();
 
 			// here we start SOR
 
@@ -378,77 +1085,110 @@ void OpticalFlow::SmoothFlowSOR(const DImage &Im1, const DImage &Im2, DImage &wa
 			du.reset();
 			dv.reset();
 
-			for(int k = 0; k<nSORIterations; k++)
-				for(int i = 0; i<imHeight; i++)
-					for(int j = 0; j<imWidth; j++)
-					{
-						int offset = i * imWidth+j;
-						double sigma1 = 0, sigma2 = 0, coeff = 0;
-                        double _weight;
+			_FlowPrecision *duSOR=du.data(),*dvSOR=dv.data();
+			const _FlowPrecision *imdxyData=imdxy.data(),*imdx2Data=imdx2.data(),*imdy2Data=imdy2.data();
+			const _FlowPrecision *imdtdxData=imdtdx.data(),*imdtdyData=imdtdy.data();
 
-						
-						if(j>0)
-						{
-                            _weight = phiData[offset-1];
-							sigma1  += _weight*du.data()[offset-1];
-							sigma2  += _weight*dv.data()[offset-1];
-							coeff   += _weight;
-						}
-						if(j<imWidth-1)
-						{
-                            _weight = phiData[offset];
-							sigma1 += _weight*du.data()[offset+1];
-							sigma2 += _weight*dv.data()[offset+1];
-							coeff   += _weight;
-						}
-						if(i>0)
-						{
-                            _weight = phiData[offset-imWidth];
-							sigma1 += _weight*du.data()[offset-imWidth];
-							sigma2 += _weight*dv.data()[offset-imWidth];
-							coeff   += _weight;
-						}
-						if(i<imHeight-1)
+			// a sweep that changes nothing is a fixed point, so stopping there is exact even without tolerance
+			double minChange = p.sweepTolerance*p.sweepTolerance*nSolved;
+			if(p.linearSolver == PCG && roi == NULL)
+				stats.nSolverIterations += SolvePCG(du,dv,imdxy,imdx2,imdy2,imdtdx,imdtdy,Phi_1st,alpha,nSORIterations,p.solverTolerance,ws,&stats.lastResidual);
+			else if(p.sorScheme == Lexicographic)
+			{
+				for(int k = 0; k<nSORIterations; k++)
+				{
+					double change = 0;
+					for(int i = 0; i<imHeight; i++)
+						if(roi == NULL)
+							for(int j = 0; j<imWidth; j++)
+								change += SORUpdate(i,j,imWidth,imHeight,alpha,omega,phiData,imdxyData,imdx2Data,imdy2Data,imdtdxData,imdtdyData,duSOR,dvSOR,p.IsHorizontalWrap);
+						else
+							for(int s = roi->first[i]; s<roi->first[i+1]; s++)
+								for(int j = roi->begin[s]; j<roi->end[s]; j++)
+									change += SORUpdate(i,j,imWidth,imHeight,alpha,omega,phiData,imdxyData,imdx2Data,imdy2Data,imdtdxData,imdtdyData,duSOR,dvSOR,p.IsHorizontalWrap);
+					stats.nSolverIterations++;
+					stats.lastResidual = sqrt(change/nSolved);
+					if(change <= minChange)
+						break;
+				}
+			}
+			else
+			{
+				// red-black ordering: the pixels of one color only depend on the pixels of the other color,
+				// so each half sweep can be distributed over the rows
+				// the changes are summed in blocks of 4 rows, the same for any number of workers
+				int nWorkers = p.numThreads();
+				for(int k = 0; k<nSORIterations; k++)
+				{
+					double change = 0;
+					for(int color = 0; color<2; color++)
+					{
+						double colorChange;
+						Reduction::reduce(imHeight,1,&colorChange,[&](int begin,int end,double* sums)
 						{
-                            _weight = phiData[offset];
-							sigma1  += _weight*du.data()[offset+imWidth];
-							sigma2  += _weight*dv.data()[offset+imWidth];
-							coeff   += _weight;
-						}
-						sigma1 *= -alpha;
-						sigma2 *= -alpha;
-						coeff *= alpha;
-						 // compute du
-						sigma1 += imdxy.data()[offset]*dv.data()[offset];
-						du.data()[offset] = (1-omega)*du.data()[offset] + omega/(imdx2.data()[offset] + alpha*0.05 + coeff)*(imdtdx.data()[offset] - sigma1);
-						// compute dv
-						sigma2 += imdxy.data()[offset]*du.data()[offset];
-						dv.data()[offset] = (1-omega)*dv.data()[offset] + omega/(imdy2.data()[offset] + alpha*0.05 + coeff)*(imdtdy.data()[offset] - sigma2);
+							double rowsChange = 0;
+							for(int i = begin; i<end; i++)
+								if(roi == NULL)
+									for(int j = (i+color)%2; j<imWidth; j+=2)
+										rowsChange += SORUpdate(i,j,imWidth,imHeight,alpha,omega,phiData,imdxyData,imdx2Data,imdy2Data,imdtdxData,imdtdyData,duSOR,dvSOR,p.IsHorizontalWrap);
+								else
+									for(int s = roi->first[i]; s<roi->first[i+1]; s++)
+										for(int j = roi->begin[s]+((roi->begin[s]+i+color)&1); j<roi->end[s]; j+=2)
+											rowsChange += SORUpdate(i,j,imWidth,imHeight,alpha,omega,phiData,imdxyData,imdx2Data,imdy2Data,imdtdxData,imdtdyData,duSOR,dvSOR,p.IsHorizontalWrap);
+							sums[0] = rowsChange;
+						},nWorkers,4);
+						change += colorChange;
 					}
+					stats.nSolverIterations++;
+					stats.lastResidual = sqrt(change/nSolved);
+					if(change <= minChange)
+						break;
+				}
+			}
+			// a small update hardly changes the linearization. Without a tolerance the update of the last
+			// iteration is measured once, for the statistics
+			if(p.updateTolerance>0)
+				stats.lastUpdate = sqrt((du.norm2()+dv.norm2())/nSolved);
+			stats.solverTime += timer.lap();
+			if(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance)
+				break;
 		}
 		u.Add(du);
 		v.Add(dv);
-		if(interpolation == Bilinear)
-			warpFL(warpIm2,Im1,Im2,u,v);
+		// the derivatives of the next outer iteration along with the warp
+		bool IsNext = !IsPlanar && count+1<nOuterFPIterations && !(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance);
+		if(p.interpolation == Bilinear && IsNext)
+			WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,false,ws);
+		else if(p.interpolation == Bilinear)
+			warpFL(warpIm2,Im1,Im2,u,v,p);
 		else
 		{
-			Im2.warpImageBicubicRef(Im1,warpIm2,u,v);
+			Im2.warpImageBicubicRef(Im1,warpIm2,ws.warpDx,ws.warpDy,ws.warpDxDy,u,v,p.IsHorizontalWrap);
 			warpIm2.threshold();
+			if(IsNext)
+				WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,true,ws);
 		}
 
 		//Im2.warpImageBicubicRef(Im1,warpIm2,BicubicCoeff,u,v);
+		stats.warpTime += timer.lap();
 
 		// estimate noise level
-		switch(noiseModel)
+		switch(p.noiseModel)
 		{
 		case GMixture:
-			estGaussianMixture(Im1,warpIm2,GMPara);
+			estGaussianMixture(Im1,warpIm2,ws.GMPara,0.9,p);
 			break;
 		case Lap:
-			estLaplacianNoise(Im1,warpIm2,LapPara);
+			estLaplacianNoise(Im1,warpIm2,ws.LapPara,p);
 		}
+		stats.noiseTime += timer.lap();
+		stats.nOuterIterations++;
+		if(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance)
+			break;
 	}
-
+	if(p.updateTolerance==0 && stats.nOuterIterations>0)
+		stats.lastUpdate = sqrt((du.norm2()+dv.norm2())/nSolved);
+	ws.statistics.push_back(stats);
 }
 
 
@@ -461,50 +1201,82 @@ void OpticalFlow::SmoothFlowSOR(const DImage &Im1, const DImage &Im2, DImage &wa
 //	u,v:									the current flow field, NOTICE that they are also output arguments
 //	
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &warpIm2, DImage &u, DImage &v, 
+template <class T>
+void OpticalFlowT<T>::SmoothFlowPDE(const TImage &Im1, const TImage &Im2, TImage &warpIm2, TImage &u, TImage &v, 
 																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
 {
-	DImage mask,imdx,imdy,imdt;
+	// the noise model is read from and written back to the static members
+	Workspace ws;
+	ws.GMPara=GMPara;
+	ws.LapPara=LapPara;
+	SmoothFlowPDE(Im1,Im2,warpIm2,u,v,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+	GMPara=ws.GMPara;
+	LapPara=ws.LapPara;
+}
+
+template <class T>
+void OpticalFlowT<T>::SmoothFlowPDE(const TImage &Im1, const TImage &Im2, TImage &warpIm2, TImage &u, TImage &v, 
+																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	TImage &mask=ws.mask,&imdx=ws.imdx,&imdy=ws.imdy,&imdt=ws.imdt;
 	int imWidth,imHeight,nChannels,nPixels;
 	imWidth=Im1.width();
 	imHeight=Im1.height();
 	nChannels=Im1.nchannels();
 	nPixels=imWidth*imHeight;
 
-	DImage du(imWidth,imHeight),dv(imWidth,imHeight);
-	DImage uu(imWidth,imHeight),vv(imWidth,imHeight);
-	DImage ux(imWidth,imHeight),uy(imWidth,imHeight);
-	DImage vx(imWidth,imHeight),vy(imWidth,imHeight);
-	DImage Phi_1st(imWidth,imHeight);
-	DImage Psi_1st(imWidth,imHeight,nChannels);
+	TImage &du=ws.du,&dv=ws.dv,&uu=ws.uu,&vv=ws.vv;
+	TImage &ux=ws.ux,&uy=ws.uy,&vx=ws.vx,&vy=ws.vy;
+	du.allocate(imWidth,imHeight);
+	dv.allocate(imWidth,imHeight);
+	TImage &Phi_1st=ws.Phi_1st,&Psi_1st=ws.Psi_1st;
+	Phi_1st.allocate(imWidth,imHeight);
+	Psi_1st.allocate(imWidth,imHeight,nChannels);
 
-	DImage imdxy,imdx2,imdy2,imdtdx,imdtdy;
-	DImage ImDxy,ImDx2,ImDy2,ImDtDx,ImDtDy;
-	DImage A11,A12,A22,b1,b2;
-	DImage foo1,foo2;
+	TImage &imdxy=ws.imdxy,&imdx2=ws.imdx2,&imdy2=ws.imdy2,&imdtdx=ws.imdtdx,&imdtdy=ws.imdtdy;
+	TImage &A11=ws.A11,&A12=ws.A12,&A22=ws.A22,&b1=ws.b1,&b2=ws.b2;
+	TImage &foo1=ws.foo1,&foo2=ws.foo2;
 
 	// compute bicubic interpolation coeff
-	//DImage BicubicCoeff;
+	//TImage BicubicCoeff;
 	//Im2.warpImageBicubicCoeff(BicubicCoeff);
-	double prob1,prob2,prob11,prob22;
 	// variables for conjugate gradient
-	DImage r1,r2,p1,p2,q1,q2;
-	double* rou;
-	rou=new double[nCGIterations];
+	TImage &r1=ws.r1,&r2=ws.r2,&p1=ws.p1,&p2=ws.p2,&q1=ws.q1,&q2=ws.q2;
+	if((int)ws.rou.size()<nCGIterations)
+		ws.rou.resize(nCGIterations);
+	double* rou=&ws.rou[0];
 
 	double varepsilon_phi=pow(0.001,2);
 	double varepsilon_psi=pow(0.001,2);
 
+	// the derivatives of Im2 for the bicubic warp are the same in all the outer iterations
+	if(p.interpolation == Bicubic && !ws.IsWarpDerivatives)
+		Im2.bicubicDerivatives(ws.warpDx,ws.warpDy,ws.warpDxDy,p.IsHorizontalWrap);
+
+	SolverStatistics stats;
+	stats.width = imWidth;
+	stats.height = imHeight;
+	stats.nOuterIterations = 0;
+	stats.nSolverIterations = 0;
+	stats.lastUpdate = 0;
+	stats.lastResidual = 0;
+	stats.warpTime = stats.derivativeTime = stats.weightTime = stats.assemblyTime = stats.solverTime = stats.noiseTime = 0;
+	stats.workspaceMemory = stats.peakMemory = 0;
+
 	//--------------------------------------------------------------------------
 	// the outer fixed point iteration
 	//--------------------------------------------------------------------------
 	for(int count=0;count<nOuterFPIterations;count++)
 	{
-		// compute the gradient
-		getDxs(imdx,imdy,imdt,Im1,warpIm2);
-
-		// generate the mask to set the weight of the pxiels moving outside of the image boundary to be zero
-		genInImageMask(mask,u,v);
+		StageTimer timer;
+		// compute the gradient and the mask that sets the weight of the pixels moving outside of the image boundary
+		// to be zero; after the first outer iteration they are computed with the warp
+		if(count==0)
+		{
+			SmoothDxs(ws.smooth1,Im1,ws);
+			WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,true,ws);
+		}
 
 		// set the derivative of the flow field to be zero
 		du.reset();
@@ -526,151 +1298,40 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 				uu.Add(u,du);
 				vv.Add(v,dv);
 			}
-			uu.dx(ux);
+			uu.dx(ux,false,p.IsHorizontalWrap);
 			uu.dy(uy);
-			vv.dx(vx);
+			vv.dx(vx,false,p.IsHorizontalWrap);
 			vv.dy(vy);
+			stats.derivativeTime += timer.lap();
 
 			// compute the weight of phi
-			Phi_1st.reset();
-			_FlowPrecision* phiData=Phi_1st.data();
-			_FlowPrecision temp;
-			const _FlowPrecision *uxData,*uyData,*vxData,*vyData;
-			uxData=ux.data();
-			uyData=uy.data();
-			vxData=vx.data();
-			vyData=vy.data();
-			double power_alpha = 0.5;
-			for(int i=0;i<nPixels;i++)
-			{
-				temp=uxData[i]*uxData[i]+uyData[i]*uyData[i]+vxData[i]*vxData[i]+vyData[i]*vyData[i];
-				//phiData[i]=power_alpha*pow(temp+varepsilon_phi,power_alpha-1);
-				phiData[i] = 0.5/sqrt(temp+varepsilon_phi);
-				//phiData[i] = 1/(power_alpha+temp);
-			}
+			RobustPhi(Phi_1st,ux,uy,vx,vy,varepsilon_phi);
 
 			// compute the nonlinear term of psi
-			Psi_1st.reset();
-			_FlowPrecision* psiData=Psi_1st.data();
-			const _FlowPrecision *imdxData,*imdyData,*imdtData;
-			const _FlowPrecision *duData,*dvData;
-			imdxData=imdx.data();
-			imdyData=imdy.data();
-			imdtData=imdt.data();
-			duData=du.data();
-			dvData=dv.data();
-		
-			double _a  = 10000, _b = 0.1;
-			if(nChannels==1)
-				for(int i=0;i<nPixels;i++)
-				{
-					temp=imdtData[i]+imdxData[i]*duData[i]+imdyData[i]*dvData[i];
-					//if(temp*temp<0.04)
-					// psiData[i]=1/(2*sqrt(temp*temp+varepsilon_psi));
-					//psiData[i] = _a*_b/(1+_a*temp*temp);
-
-					// the following code is for log Gaussian mixture probability model
-					temp *= temp;
-					switch(noiseModel)
-					{
-					case GMixture:
-						prob1 = GMPara.Gaussian(temp,0,0)*GMPara.alpha[0];
-						prob2 = GMPara.Gaussian(temp,1,0)*(1-GMPara.alpha[0]);
-						prob11 = prob1/(2*GMPara.sigma_square[0]);
-						prob22 = prob2/(2*GMPara.beta_square[0]);
-						psiData[i] = (prob11+prob22)/(prob1+prob2);
-						break;
-					case Lap:
-						if(LapPara[0]<1E-20)
-							continue;
-						psiData[i]=1/(2*sqrt(temp+varepsilon_psi)*LapPara[0]);
-						break;
-					}
-				}
-			else
-				for(int i=0;i<nPixels;i++)
-					for(int k=0;k<nChannels;k++)
-					{
-						int offset=i*nChannels+k;
-						temp=imdtData[offset]+imdxData[offset]*duData[i]+imdyData[offset]*dvData[i];
-						//if(temp*temp<0.04)
-						 // psiData[offset]=1/(2*sqrt(temp*temp+varepsilon_psi));
-						//psiData[offset] =  _a*_b/(1+_a*temp*temp);
-						temp *= temp;
-						switch(noiseModel)
-						{
-						case GMixture:
-							prob1 = GMPara.Gaussian(temp,0,k)*GMPara.alpha[k];
-							prob2 = GMPara.Gaussian(temp,1,k)*(1-GMPara.alpha[k]);
-							prob11 = prob1/(2*GMPara.sigma_square[k]);
-							prob22 = prob2/(2*GMPara.beta_square[k]);
-							psiData[offset] = (prob11+prob22)/(prob1+prob2);
-							break;
-						case Lap:
-							if(LapPara[k]<1E-20)
-								continue;
-							psiData[offset]=1/(2*sqrt(temp+varepsilon_psi)*LapPara[k]);
-							break;
-						}
-					}
+			RobustPsi(Psi_1st,imdx,imdy,imdt,du,dv,ws.GMPara,ws.LapPara,varepsilon_psi,true,NULL,p);
+			stats.weightTime += timer.lap();
 
 			// prepare the components of the large linear system
-			ImDxy.Multiply(Psi_1st,imdx,imdy);
-			ImDx2.Multiply(Psi_1st,imdx,imdx);
-			ImDy2.Multiply(Psi_1st,imdy,imdy);
-			ImDtDx.Multiply(Psi_1st,imdx,imdt);
-			ImDtDy.Multiply(Psi_1st,imdy,imdt);
-
-			if(nChannels>1)
-			{
-				ImDxy.collapse(imdxy);
-				ImDx2.collapse(imdx2);
-				ImDy2.collapse(imdy2);
-				ImDtDx.collapse(imdtdx);
-				ImDtDy.collapse(imdtdy);
-			}
-			else
-			{
-				imdxy.copyData(ImDxy);
-				imdx2.copyData(ImDx2);
-				imdy2.copyData(ImDy2);
-				imdtdx.copyData(ImDtDx);
-				imdtdy.copyData(ImDtDy);
-			}
+			AssembleLinearSystem(imdxy,imdx2,imdy2,imdtdx,imdtdy,Psi_1st,imdx,imdy,imdt);
 
 			// filtering
 			//imdx2.smoothing(A11,3);
 			//imdxy.smoothing(A12,3);
 			//imdy2.smoothing(A22,3);
-			A11.copyData(imdx2);
+			// add epsilon to A11 and A22
+			A11 = imdx2+alpha*0.5;
 			A12.copyData(imdxy);
-			A22.copyData(imdy2);
+			A22 = imdy2+alpha*0.5;
 
-			// add epsilon to A11 and A22
-			A11.Add(alpha*0.5);
-			A22.Add(alpha*0.5);
+			// laplacian filtering of the current flow field
+			Laplacian(foo1,foo2,u,v,Phi_1st,p);
 
 			// form b
 			//imdtdx.smoothing(b1,3);
 			//imdtdy.smoothing(b2,3);
-			b1.copyData(imdtdx);
-			b2.copyData(imdtdy);
-
-			// laplacian filtering of the current flow field
-		    Laplacian(foo1,u,Phi_1st);
-			Laplacian(foo2,v,Phi_1st);
-			_FlowPrecision *b1Data,*b2Data;
-			const _FlowPrecision *foo1Data,*foo2Data;
-			b1Data=b1.data();
-			b2Data=b2.data();
-			foo1Data=foo1.data();
-			foo2Data=foo2.data();
-
-			for(int i=0;i<nPixels;i++)
-			{
-				b1Data[i]=-b1Data[i]-alpha*foo1Data[i];
-				b2Data[i]=-b2Data[i]-alpha*foo2Data[i];
-			}
+			b1 = -imdtdx-alpha*foo1;
+			b2 = -imdtdy-alpha*foo2;
+			stats.assemblyTime += timer.lap();
 
 			// for debug only, displaying the matrix coefficients
 			//A11.imwrite("A11.bmp",ImageIO::normalized);
@@ -680,19 +1341,47 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 			//b2.imwrite("b2.bmp",ImageIO::normalized);
 
 			//-----------------------------------------------------------------------
-			// conjugate gradient algorithm
+			// conjugate gradient algorithm. Besides the Laplacians an iteration makes three passes over
+			// the images, each with its dot products fused in. The dot products are summed in the blocks
+			// of Reduction, the same for any number of threads
 			//-----------------------------------------------------------------------
 			r1.copyData(b1);
 			r2.copyData(b2);
 			du.reset();
 			dv.reset();
+			p1.allocate(imWidth,imHeight);
+			p2.allocate(imWidth,imHeight);
+			q1.allocate(imWidth,imHeight);
+			q2.allocate(imWidth,imHeight);
+
+			_FlowPrecision *duData=du.data(),*dvData=dv.data();
+			_FlowPrecision *r1Data=r1.data(),*r2Data=r2.data(),*p1Data=p1.data(),*p2Data=p2.data();
+			_FlowPrecision *q1Data=q1.data(),*q2Data=q2.data();
+			const _FlowPrecision *A11Data=A11.data(),*A12Data=A12.data(),*A22Data=A22.data();
+			const _FlowPrecision *lap1Data=foo1.data(),*lap2Data=foo2.data();
+			bool IsParallel=(nPixels>65536);
+			int nReduceThreads=IsParallel?0:1;
+			double sums[4];
+			Reduction::reduce(nPixels,2,sums,[&](int begin,int end,double* s)
+			{
+				double s0=0,s1=0;
+				for(int i=begin;i<end;i++)
+				{
+					s0+=r1Data[i]*r1Data[i];
+					s1+=r2Data[i]*r2Data[i];
+				}
+				s[0]=s0;
+				s[1]=s1;
+			},nReduceThreads);
+			double rnorm1=sums[0],rnorm2=sums[1];
 
 			for(int k=0;k<nCGIterations;k++)
 			{
-				rou[k]=r1.norm2()+r2.norm2();
+				rou[k]=rnorm1+rnorm2;
 				//cout<<rou[k]<<endl;
 				if(rou[k]<1E-10)
 					break;
+				stats.nSolverIterations++;
 				if(k==0)
 				{
 					p1.copyData(r1);
@@ -701,31 +1390,73 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 				else
 				{
 					double ratio=rou[k]/rou[k-1];
-					p1.Add(r1,p1,ratio);
-					p2.Add(r2,p2,ratio);
+#ifdef _OPENMP
+					#pragma omp parallel for if(IsParallel)
+#endif
+					for(int i=0;i<nPixels;i++)
+					{
+						p1Data[i]=r1Data[i]+p1Data[i]*ratio;
+						p2Data[i]=r2Data[i]+p2Data[i]*ratio;
+					}
 				}
 				// go through the large linear system
-				foo1.Multiply(A11,p1);
-				foo2.Multiply(A12,p2);
-				q1.Add(foo1,foo2);
-				Laplacian(foo1,p1,Phi_1st);
-				q1.Add(foo1,alpha);
-
-				foo1.Multiply(A12,p1);
-				foo2.Multiply(A22,p2);
-				q2.Add(foo1,foo2);
-				Laplacian(foo2,p2,Phi_1st);
-				q2.Add(foo2,alpha);
+				Laplacian(foo1,foo2,p1,p2,Phi_1st,p);
+				Reduction::reduce(nPixels,2,sums,[&](int begin,int end,double* s)
+				{
+					double s0=0,s1=0;
+					for(int i=begin;i<end;i++)
+					{
+						_FlowPrecision a=A11Data[i]*p1Data[i],b=A12Data[i]*p2Data[i];
+						_FlowPrecision q=a+b;
+						q1Data[i]=q+lap1Data[i]*alpha;
+						a=A12Data[i]*p1Data[i];
+						b=A22Data[i]*p2Data[i];
+						q=a+b;
+						q2Data[i]=q+lap2Data[i]*alpha;
+						s0+=p1Data[i]*q1Data[i];
+						s1+=p2Data[i]*q2Data[i];
+					}
+					s[0]=s0;
+					s[1]=s1;
+				},nReduceThreads);
+				double pq1=sums[0],pq2=sums[1];
 
 				double beta;
-				beta=rou[k]/(p1.innerproduct(q1)+p2.innerproduct(q2));
-				
-				du.Add(p1,beta);
-				dv.Add(p2,beta);
+				beta=rou[k]/(pq1+pq2);
 
-				r1.Add(q1,-beta);
-				r2.Add(q2,-beta);
+				Reduction::reduce(nPixels,4,sums,[&](int begin,int end,double* s)
+				{
+					double s0=0,s1=0,s2=0,s3=0;
+					for(int i=begin;i<end;i++)
+					{
+						duData[i]+=p1Data[i]*beta;
+						dvData[i]+=p2Data[i]*beta;
+						r1Data[i]+=q1Data[i]*(-beta);
+						r2Data[i]+=q2Data[i]*(-beta);
+						s0+=r1Data[i]*r1Data[i];
+						s1+=r2Data[i]*r2Data[i];
+						s2+=p1Data[i]*p1Data[i];
+						s3+=p2Data[i]*p2Data[i];
+					}
+					s[0]=s0;
+					s[1]=s1;
+					s[2]=s2;
+					s[3]=s3;
+				},nReduceThreads);
+				rnorm1=sums[0];
+				rnorm2=sums[1];
+				double pnorm1=sums[2],pnorm2=sums[3];
+
+				// the change of (du,dv) is beta*p
+				if(p.sweepTolerance>0 && beta*beta*(pnorm1+pnorm2)<=p.sweepTolerance*p.sweepTolerance*nPixels)
+					break;
 			}
+			stats.lastResidual = (nCGIterations>0 && rou[0]>0) ? sqrt((rnorm1+rnorm2)/rou[0]) : 0;
+			if(p.updateTolerance>0)
+				stats.lastUpdate = sqrt((du.norm2()+dv.norm2())/nPixels);
+			stats.solverTime += timer.lap();
+			if(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance)
+				break;
 			//-----------------------------------------------------------------------
 			// end of conjugate gradient algorithm
 			//-----------------------------------------------------------------------
@@ -736,107 +1467,158 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 		// update the flow field
 		u.Add(du,1);
 		v.Add(dv,1);
-		if(interpolation == Bilinear)
-			warpFL(warpIm2,Im1,Im2,u,v);
+		bool IsNext = count+1<nOuterFPIterations && !(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance);
+		if(p.interpolation == Bilinear && IsNext)
+			WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,false,ws);
+		else if(p.interpolation == Bilinear)
+			warpFL(warpIm2,Im1,Im2,u,v,p);
 		else
 		{
-			Im2.warpImageBicubicRef(Im1,warpIm2,u,v);
+			Im2.warpImageBicubicRef(Im1,warpIm2,ws.warpDx,ws.warpDy,ws.warpDxDy,u,v,p.IsHorizontalWrap);
 			warpIm2.threshold();
+			if(IsNext)
+				WarpDxs(imdx,imdy,imdt,mask,warpIm2,Im1,Im2,u,v,true,ws);
 		}
 
 		//Im2.warpImageBicubicRef(Im1,warpIm2,BicubicCoeff,u,v);
+		stats.warpTime += timer.lap();
 
 		// estimate noise level
-		switch(noiseModel)
+		switch(p.noiseModel)
 		{
 		case GMixture:
-			estGaussianMixture(Im1,warpIm2,GMPara);
+			estGaussianMixture(Im1,warpIm2,ws.GMPara,0.9,p);
 			break;
 		case Lap:
-			estLaplacianNoise(Im1,warpIm2,LapPara);
+			estLaplacianNoise(Im1,warpIm2,ws.LapPara,p);
 		}
-
+		stats.noiseTime += timer.lap();
+		stats.nOuterIterations++;
+		if(p.updateTolerance>0 && stats.lastUpdate<=p.updateTolerance)
+			break;
 	}// end of outer fixed point iteration
-	delete rou;
+	if(p.updateTolerance==0 && stats.nOuterIterations>0)
+		stats.lastUpdate = sqrt((du.norm2()+dv.norm2())/nPixels);
+	ws.statistics.push_back(stats);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the noise estimation sums over the sampled rows in the blocks of Reduction, so the result doesn't depend on
+// the number of threads either
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+int OpticalFlowT<T>::noiseStride(const TImage& Im1,const Parameters& p)
+{
+	if(p.noiseSamples<=0)
+		return 1;
+	return __max((int)sqrt((double)Im1.npixels()/p.noiseSamples),1);
 }
 
-void OpticalFlow::estGaussianMixture(const DImage& Im1,const DImage& Im2,GaussianMixture& para,double prior)
+template <class T>
+int OpticalFlowT<T>::noiseThreads(const TImage& Im1,int stride,const Parameters& p)
+{
+#ifdef _OPENMP
+	if((double)Im1.nelements()/stride/stride>65536)
+		return p.numThreads();
+#endif
+	return 1;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// EM fit of the mixture of two Gaussians, the E step and the sums of the M step fused into one pass
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::estGaussianMixture(const TImage& Im1,const TImage& Im2,GaussianMixture& para,double prior,const Parameters& p)
 {
 	int nIterations = 3, nChannels = Im1.nchannels();
-	DImage weight1(Im1),weight2(Im1);
-	double *total1,*total2;
-	total1 = new double[nChannels];
-	total2 = new double[nChannels];
+	int width = Im1.width(), height = Im1.height(), stride = noiseStride(Im1,p);
+	int nRows = (height+stride-1)/stride, nThreads = noiseThreads(Im1,stride,p);
+	// per channel: the total weights of the two Gaussians and the weighted squared residuals
+	vector<double> sums(nChannels*4);
+	const T *pIm1 = Im1.data(), *pIm2 = Im2.data();
 	for(int count = 0; count<nIterations; count++)
 	{
-		double temp;
-		memset(total1,0,sizeof(double)*nChannels);
-		memset(total2,0,sizeof(double)*nChannels);
-
-		// E step
-		for(int i = 0;i<weight1.npixels();i++)
-			for(int k=0;k<nChannels;k++)
-			{
-				int offset = i*weight1.nchannels()+k;
-				temp = Im1[offset]-Im2[offset];
-				temp *= temp;
-				weight1[offset] = para.Gaussian(temp,0,k)*para.alpha[k];
-				weight2[offset] = para.Gaussian(temp,1,k)*(1-para.alpha[k]);
-				temp = weight1[offset]+weight2[offset];
-				weight1[offset]/=temp;
-				weight2[offset]/=temp;
-				total1[k] += weight1[offset];
-				total2[k] += weight2[offset];
-			}
+		Reduction::reduce(nRows,nChannels*4,&sums[0],[&](int begin,int end,double* blockSums)
+		{
+			double *total1 = blockSums, *total2 = total1+nChannels, *sigma = total2+nChannels, *beta = sigma+nChannels;
+			for(int r = begin;r<end;r++)
+				for(int j = 0;j<width;j+=stride)
+					for(int k = 0;k<nChannels;k++)
+					{
+						int offset = (r*stride*width+j)*nChannels+k;
+						double temp = pIm1[offset]-pIm2[offset], weight1, weight2;
+						temp *= temp;
+						// E step
+						if(p.IsGaussianMixtureTable)
+						{
+							weight1 = para.weight(temp,k);
+							weight2 = 1-weight1;
+						}
+						else
+						{
+							weight1 = para.Gaussian(temp,0,k)*para.alpha[k];
+							weight2 = para.Gaussian(temp,1,k)*(1-para.alpha[k]);
+							double total = weight1+weight2;
+							weight1 /= total;
+							weight2 /= total;
+						}
+						total1[k] += weight1;
+						total2[k] += weight2;
+						sigma[k] += weight1*temp;
+						beta[k] += weight2*temp;
+					}
+		},nThreads,4);
 
-		// M step
+		// M step, the weighted squared residuals added to the sigma and beta of reset()
 		para.reset();
-
-
-		for(int i = 0;i<weight1.npixels();i++)
-			for(int k =0;k<nChannels;k++)
-			{
-				int offset = i*weight1.nchannels()+k;
-				temp = Im1[offset]-Im2[offset];
-				temp *= temp;
-				para.sigma[k]+= weight1[offset]*temp;
-				para.beta[k] += weight2[offset]*temp;
-			}
-
 		for(int k =0;k<nChannels;k++)
 		{
-			para.alpha[k] = total1[k]/(total1[k]+total2[k])*(1-prior)+0.95*prior; // regularize alpha
-			para.sigma[k] = sqrt(para.sigma[k]/total1[k]);
-			para.beta[k]   = sqrt(para.beta[k]/total2[k])*(1-prior)+0.3*prior; // regularize beta
+			double total1 = sums[k], total2 = sums[nChannels+k];
+			para.sigma[k] += sums[nChannels*2+k];
+			para.beta[k] += sums[nChannels*3+k];
+			para.alpha[k] = total1/(total1+total2)*(1-prior)+0.95*prior; // regularize alpha
+			para.sigma[k] = sqrt(para.sigma[k]/total1);
+			para.beta[k]   = sqrt(para.beta[k]/total2)*(1-prior)+0.3*prior; // regularize beta
 		}
 		para.square();
-		count = count;
 	}
 }
 
-void OpticalFlow::estLaplacianNoise(const DImage& Im1,const DImage& Im2,Vector<double>& para)
+template <class T>
+void OpticalFlowT<T>::estLaplacianNoise(const TImage& Im1,const TImage& Im2,Vector<double>& para,const Parameters& p)
 {
 	int nChannels = Im1.nchannels();
 	if(para.dim()!=nChannels)
 		para.allocate(nChannels);
 	else
 		para.reset();
-	double temp;
+	int width = Im1.width(), height = Im1.height(), stride = noiseStride(Im1,p);
+	int nRows = (height+stride-1)/stride, nThreads = noiseThreads(Im1,stride,p);
+	// per channel: the sum of the absolute residuals and their number
+	vector<double> sums(nChannels*2);
+	const T *pIm1 = Im1.data(), *pIm2 = Im2.data();
+	Reduction::reduce(nRows,nChannels*2,&sums[0],[&](int begin,int end,double* blockSums)
+	{
+		double *sum = blockSums, *count = sum+nChannels;
+		for(int r = begin;r<end;r++)
+			for(int j = 0;j<width;j+=stride)
+				for(int k = 0;k<nChannels;k++)
+				{
+					int offset = (r*stride*width+j)*nChannels+k;
+					double temp= abs(pIm1[offset]-pIm2[offset]);
+					if(temp>0 && temp<1000000)
+					{
+						sum[k] += temp;
+						count[k]++;
+					}
+				}
+	},nThreads,4);
 	Vector<double> total(nChannels);
 	for(int k = 0;k<nChannels;k++)
-		total[k] = 0;
-
-	for(int i =0;i<Im1.npixels();i++)
-		for(int k = 0;k<nChannels;k++)
-		{
-			int offset = i*nChannels+k;
-			temp= abs(Im1.data()[offset]-Im2.data()[offset]);
-			if(temp>0 && temp<1000000)
-			{
-				para[k] += temp;
-				total[k]++;
-			}
-		}
+	{
+		para[k] = sums[k];
+		total[k] = sums[nChannels+k];
+	}
 	for(int k = 0;k<nChannels;k++)
 	{
 		if(total[k]==0)
@@ -850,175 +1632,689 @@ void OpticalFlow::estLaplacianNoise(const DImage& Im1,const DImage& Im2,Vector<d
 	}
 }
 
-void OpticalFlow::Laplacian(DImage &output, const DImage &input, const DImage& weight)
+template <class T>
+void OpticalFlowT<T>::Laplacian(TImage &output, const TImage &input, const TImage& weight,const Parameters& p)
 {
 	if(output.matchDimension(input)==false)
 		output.allocate(input);
-	output.reset();
-
 	if(input.matchDimension(weight)==false)
 	{
 		cout<<"Error in image dimension matching OpticalFlow::Laplacian()!"<<endl;
+		output.reset();
 		return;
 	}
-	
-	const _FlowPrecision *inputData=input.data(),*weightData=weight.data();
-	int width=input.width(),height=input.height();
-	DImage foo(width,height);
-	_FlowPrecision *fooData=foo.data(),*outputData=output.data();
-	
+	LaplacianRows(output.data(),NULL,input.data(),NULL,weight.data(),input.width(),input.height(),p);
+}
 
-	// horizontal filtering
+template <class T>
+void OpticalFlowT<T>::Laplacian(TImage& output1,TImage& output2,const TImage& input1,const TImage& input2,const TImage& weight,const Parameters& p)
+{
+	if(output1.matchDimension(input1)==false)
+		output1.allocate(input1);
+	if(output2.matchDimension(input2)==false)
+		output2.allocate(input2);
+	if(input1.matchDimension(weight)==false || input2.matchDimension(weight)==false)
+	{
+		cout<<"Error in image dimension matching OpticalFlow::Laplacian()!"<<endl;
+		output1.reset();
+		output2.reset();
+		return;
+	}
+	LaplacianRows(output1.data(),output2.data(),input1.data(),input2.data(),weight.data(),input1.width(),input1.height(),p);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the stencil of every pixel from the rows around it, without the difference images of the edges: each row
+// is written once and reads its own row and the rows above and below, so the rows are independent and
+// split over the threads in bands of rows that stay in the cache together
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::LaplacianRows(_FlowPrecision* output1,_FlowPrecision* output2,const _FlowPrecision* input1,const _FlowPrecision* input2,
+									   const _FlowPrecision* weight,int width,int height,const Parameters& p)
+{
+	bool IsParallel=(width*height>65536);
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(static,16) if(IsParallel)
+#endif
 	for(int i=0;i<height;i++)
-		for(int j=0;j<width-1;j++)
-		{
-			int offset=i*width+j;
-			fooData[offset]=(inputData[offset+1]-inputData[offset])*weightData[offset];
-		}
+	{
+		int offset=i*width;
+		FlowKernels::LaplacianRow(output1+offset,(output2!=NULL)?output2+offset:NULL,input1+offset,(input2!=NULL)?input2+offset:NULL,
+									weight+offset,width,i>0,i<height-1,p.IsHorizontalWrap);
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// every edge between neighbors p and q, with the weight of the pixel on its left or top, adds weight to
+// A(p,p) and A(q,q) and subtracts it from A(p,q) and A(q,p), as Laplacian() moves the flux between them
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::LaplacianMatrix(SparseMatrix<T>& A,const TImage& weight,const Parameters& p)
+{
+	int width=weight.width(),height=weight.height(),nPixels=width*height;
+	const _FlowPrecision* weightData=weight.data();
+	vector<int> rows,cols;
+	vector<T> vals;
+	rows.reserve(nPixels*5);
+	cols.reserve(nPixels*5);
+	vals.reserve(nPixels*5);
 	for(int i=0;i<height;i++)
 		for(int j=0;j<width;j++)
 		{
 			int offset=i*width+j;
+			int neighbors[2]={-1,-1};
 			if(j<width-1)
-				outputData[offset]-=fooData[offset];
-			if(j>0)
-				outputData[offset]+=fooData[offset-1];
-		}
-	foo.reset();
-	// vertical filtering
-	for(int i=0;i<height-1;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
-			fooData[offset]=(inputData[offset+width]-inputData[offset])*weightData[offset];
-		}
-	for(int i=0;i<height;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
+				neighbors[0]=offset+1;
+			else if(p.IsHorizontalWrap && width>1)
+				neighbors[0]=i*width;
 			if(i<height-1)
-				outputData[offset]-=fooData[offset];
-			if(i>0)
-				outputData[offset]+=fooData[offset-width];
+				neighbors[1]=offset+width;
+			for(int n=0;n<2;n++)
+			{
+				if(neighbors[n]<0)
+					continue;
+				T w=weightData[offset];
+				int q=neighbors[n];
+				rows.push_back(offset); cols.push_back(offset); vals.push_back(w);
+				rows.push_back(q); cols.push_back(q); vals.push_back(w);
+				rows.push_back(offset); cols.push_back(q); vals.push_back(-w);
+				rows.push_back(q); cols.push_back(offset); vals.push_back(-w);
+			}
 		}
+	A.fromTriplets(nPixels,nPixels,rows,cols,vals);
 }
 
-void OpticalFlow::testLaplacian(int dim)
+//--------------------------------------------------------------------------------------------------------
+// checks LaplacianMatrix against Laplacian() on random flow, and prints the matrix when it is small
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::testLaplacian(int dim)
 {
 	// generate the random weight
-	DImage weight(dim,dim);
+	TImage weight(dim,dim);
 	for(int i=0;i<dim;i++)
 		for(int j=0;j<dim;j++)
-			//weight.data()[i*dim+j]=(double)rand()/RAND_MAX+1;
-			weight.data()[i*dim+j]=1;
-	// go through the linear system;
-	DImage sysMatrix(dim*dim,dim*dim);
-	DImage u(dim,dim),du(dim,dim);
+			weight.data()[i*dim+j]=(double)rand()/RAND_MAX+1;
+	SparseMatrix<T> sysMatrix;
+	LaplacianMatrix(sysMatrix,weight);
+	TImage u(dim,dim),du;
 	for(int i=0;i<dim*dim;i++)
-	{
-		u.reset();
-		u.data()[i]=1;
-		Laplacian(du,u,weight);
-		for(int j=0;j<dim*dim;j++)
-			sysMatrix.data()[j*dim*dim+i]=du.data()[j];
-	}
-	// test whether the matrix is symmetric
+		u.data()[i]=(double)rand()/RAND_MAX;
+	Laplacian(du,u,weight);
+	Vector<T> product(dim*dim);
+	sysMatrix.Multiply(product.data(),u.data());
+	double maxDiff=0;
 	for(int i=0;i<dim*dim;i++)
-	{
-		for(int j=0;j<dim*dim;j++)
-		{
-			if(sysMatrix.data()[i*dim*dim+j]>=0)
-				printf(" ");
-			printf(" %1.0f ",sysMatrix.data()[i*dim*dim+j]);
-		}
-		printf("\n");
-	}
+		maxDiff=__max(maxDiff,fabs(product[i]-du.data()[i]));
+	// test whether the matrix is symmetric
+	cout<<"Laplacian of "<<dim<<"x"<<dim<<": "<<sysMatrix.nnz()<<" nonzeros, symmetric "<<sysMatrix.IsSymmetric(1E-12)
+		<<", max difference to Laplacian() "<<maxDiff<<endl;
+	if(dim<=8)
+		sysMatrix.printMatrix();
 }
 
 //--------------------------------------------------------------------------------------
 // function to perfomr coarse to fine optical flow estimation
 //--------------------------------------------------------------------------------------
-void OpticalFlow::Coarse2FineFlow(DImage &vx, DImage &vy, DImage &warpI2,const DImage &Im1, const DImage &Im2, double alpha, double ratio, int minWidth, 
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2,const TImage &Im1, const TImage &Im2, double alpha, double ratio, int minWidth, 
 																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
 {
+	Workspace ws;
+	Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+	// keep the estimated noise model in the static members as before
+	GMPara=ws.GMPara;
+	LapPara=ws.LapPara;
+}
+
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2,const TImage &Im1, const TImage &Im2, double alpha, double ratio, int minWidth, 
+																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	ws.confidence.clear();
+	if(p.backend==Preview)
+	{
+		PreviewFlow::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,minWidth,p.IsHorizontalWrap);
+		return;
+	}
+#ifdef _OPENCV_GPU
+	if(p.backend==GPU && !p.IsHorizontalWrap && OpticalFlowGPU::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations))
+		return;
+#endif
 	// first build the pyramid of the two images
-	GaussianPyramid GPyramid1;
-	GaussianPyramid GPyramid2;
-	if(IsDisplay)
+	Pyramid Pyramid1,Pyramid2;
+	if(p.IsDisplay)
 		cout<<"Constructing pyramid...";
-	GPyramid1.ConstructPyramid(Im1,ratio,minWidth);
-	GPyramid2.ConstructPyramid(Im2,ratio,minWidth);
-	if(IsDisplay)
+	BuildPyramid(Pyramid1,Im1,ratio,minWidth,p);
+	BuildPyramid(Pyramid2,Im2,ratio,minWidth,p);
+	if(p.IsDisplay)
 		cout<<"done!"<<endl;
-	
+	Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+}
+
+//--------------------------------------------------------------------------------------
+// the region of interest is resized to the level, so any overlap with the mask counts, and dilated by
+// roiDilation pixels with the distance to the nearest pixel of the mask, along the rows and then the columns
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::BuildLevelROI(Workspace& ws,int width,int height)
+{
+	const Parameters& p=ws.parameters();
+	if(ws.roiMask.IsEmpty())
+	{
+		ws.roiSpans.clear();
+		return;
+	}
+	TImage &level=ws.roiLevel,&temp=ws.roiTemp;
+	ws.roiMask.imresize(temp,width,height);
+	level.allocate(width,height);
+	const _FlowPrecision* pTemp=temp.data();
+	_FlowPrecision* pLevel=level.data();
+	int r=p.roiDilation;
+	for(int i=0;i<height;i++)
+	{
+		int last=-r-1,next=width+r;
+		for(int j=0;j<width;j++)
+		{
+			if(pTemp[i*width+j]>0)
+				last=j;
+			pLevel[i*width+j]=(j-last<=r);
+		}
+		for(int j=width-1;j>=0;j--)
+		{
+			if(pTemp[i*width+j]>0)
+				next=j;
+			if(next-j<=r)
+				pLevel[i*width+j]=1;
+		}
+	}
+	temp.copyData(level);
+	for(int j=0;j<width;j++)
+	{
+		int last=-r-1,next=height+r;
+		for(int i=0;i<height;i++)
+		{
+			if(pTemp[i*width+j]>0)
+				last=i;
+			pLevel[i*width+j]=(i-last<=r);
+		}
+		for(int i=height-1;i>=0;i--)
+		{
+			if(pTemp[i*width+j]>0)
+				next=i;
+			if(next-i<=r)
+				pLevel[i*width+j]=1;
+		}
+	}
+	ws.roiSpans.build(level);
+}
+
+//--------------------------------------------------------------------------------------
+// function to build the Gaussian pyramid of an image and the features of every level
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::BuildPyramid(Pyramid& pyramid,const TImage& im,double ratio,int minWidth,const Parameters& p)
+{
+	StageTimer timer;
+	pyramid.pyramid.ConstructPyramid(im,ratio,minWidth,p.IsHorizontalWrap);
+	pyramid.pyramidTime=timer.lap();
+	pyramid.features.resize(pyramid.nlevels());
+	for(int k=0;k<pyramid.nlevels();k++)
+		im2feature(pyramid.features[k],pyramid.pyramid.Image(k),p);
+	if(p.IsHalfPyramid)
+		pyramid.compact();
+	pyramid.featureTime=timer.lap();
+}
+
+//--------------------------------------------------------------------------------------
+// the buffers of Coarse2FineFlow as they are allocated: the pyramids and the features of
+// BuildPyramid, the workspace that PrepareWorkspace reserves for the largest level or band,
+// the bands and the derivatives of the bicubic warps of SolveLevel, and the flow
+//--------------------------------------------------------------------------------------
+template <class T>
+double OpticalFlowT<T>::predictMemory(int width,int height,int nChannels,double ratio,int minWidth,const Parameters& p)
+{
+	vector<int> widths,heights;
+	GaussianPyramidT<T>::LevelDimensions(width,height,ratio,minWidth,widths,heights);
+	int nFeatures=(nChannels==1)?3:((nChannels==3)?5:nChannels);
+	double pixels=(double)width*height,pyramid=0,reserve=0,warpDerivatives=pixels*nChannels;
+	bool IsBands=false;
+	for(size_t k=0;k<widths.size();k++)
+	{
+		double levelPixels=(double)widths[k]*heights[k];
+		pyramid+=levelPixels*(nChannels+nFeatures);
+		bool IsTiled=p.IsTiledLevel(heights[k]);
+		if(IsTiled)
+			levelPixels=(double)widths[k]*(p.tileRows+2*p.tileHalo);
+		IsBands=IsBands || IsTiled;
+		reserve=__max(reserve,levelPixels);
+		if(p.interpolation==Bicubic)
+			warpDerivatives=__max(warpDerivatives,levelPixels*nFeatures);
+	}
+	int nMultiChannel=11+(p.IsPlanar?2:0),nSingleChannel=(p.linearSolver==PCG)?33:28;
+	// the half pyramids keep 2 bytes of an element, and expand a level of the features and of the frames at once
+	if(p.IsHalfPyramid)
+	{
+		pyramid=pyramid*2/sizeof(T);
+		nSingleChannel+=2*nChannels;
+	}
+	double elements=2*pixels*nChannels+2*pyramid+reserve*(nMultiChannel*nFeatures+nSingleChannel)+pixels*(2+nChannels);
+	if(IsBands)
+		elements+=reserve*(2*nFeatures+2)+pixels*2;
+	return elements*sizeof(T)+3*warpDerivatives*sizeof(double);
+}
+
+template <class T>
+template <class T1>
+void OpticalFlowT<T>::BuildPyramid(Pyramid& pyramid,const ::Image<T1>& im,double divisor,double ratio,int minWidth,const Parameters& p)
+{
+	StageTimer timer;
+	pyramid.pyramid.ConstructPyramid(im,divisor,ratio,minWidth,p.IsHorizontalWrap);
+	pyramid.pyramidTime=timer.lap();
+	pyramid.features.resize(pyramid.nlevels());
+	for(int k=0;k<pyramid.nlevels();k++)
+		im2feature(pyramid.features[k],pyramid.pyramid.Image(k),p);
+	if(p.IsHalfPyramid)
+		pyramid.compact();
+	pyramid.featureTime=timer.lap();
+}
+
+//--------------------------------------------------------------------------------------
+// function to perform coarse to fine optical flow estimation on prebuilt pyramids
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2, double alpha, double ratio,
+																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations,Workspace& ws)
+{
+	Coarse2FineFlowFrom(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,Pyramid1.nlevels()-1,false,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+}
+
+//--------------------------------------------------------------------------------------
+// function to perform coarse to fine optical flow estimation from a prior flow
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2,const TImage &Im1, const TImage &Im2,const TImage& priorVx,const TImage& priorVy,
+																	 double alpha, double ratio, int minWidth,int nSkipLevels,int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
+{
+	Pyramid Pyramid1,Pyramid2;
+	Workspace ws;
+	BuildPyramid(Pyramid1,Im1,ratio,minWidth);
+	BuildPyramid(Pyramid2,Im2,ratio,minWidth);
+	Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,priorVx,priorVy,alpha,ratio,nSkipLevels,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+	GMPara=ws.GMPara;
+	LapPara=ws.LapPara;
+}
+
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& priorVx,const TImage& priorVy,
+																	 double alpha, double ratio,int nSkipLevels,int nOuterFPIterations, int nInnerFPIterations, int nCGIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	int width0=Pyramid1.width(0),height0=Pyramid1.height(0);
+	if(!priorVx.matchDimension(width0,height0,1) || !priorVy.matchDimension(width0,height0,1))
+	{
+		cout<<"The prior flow does not match the images, the flow is estimated from scratch!"<<endl;
+		Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+		return;
+	}
+	int startLevel=__max(__min(Pyramid1.nlevels()-1-nSkipLevels,Pyramid1.nlevels()-1),0);
+
+	// downsample the prior to the start level and scale its magnitude accordingly
+	int width=Pyramid1.width(startLevel);
+	int height=Pyramid1.height(startLevel);
+	vx.copyData(priorVx);
+	vy.copyData(priorVy);
+	if(startLevel>0)
+		ResizeFlow(vx,vy,width,height,(double)width/width0,ws.foo1,ws.foo2,p);
+	Coarse2FineFlowFrom(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,startLevel,true,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+}
+
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlowFrom(TImage &vx, TImage &vy, TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2, double alpha, double ratio,int startLevel,bool IsInit,
+																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations,Workspace& ws)
+{
+	PrepareWorkspace(Pyramid1,ws);
+	ws.pyramidTime=Pyramid1.pyramidTime+Pyramid2.pyramidTime;
+	ws.featureTime=Pyramid1.featureTime+Pyramid2.featureTime;
+	ws.pyramidMemory=Pyramid1.memory()+Pyramid2.memory();
 	// now iterate from the top level to the bottom
-	DImage Image1,Image2,WarpImage2;
+	for(int k=startLevel;k>=0;k--)
+		SolveLevel(vx,vy,Pyramid1,Pyramid2,alpha,ratio,k,startLevel,IsInit,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+	//warpFL(warpI2,Im1,Im2,vx,vy);
+	WarpFrame(warpI2,Pyramid1,Pyramid2,vx,vy,ws);
+}
+
+template <class T>
+void OpticalFlowT<T>::WarpFrame(TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& vx,const TImage& vy,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	// the frame, not its features, so its own derivatives in the planes of the levels
+	const TImage &Im1=Pyramid1.level(0,ws.level1),&Im2=Pyramid2.level(0,ws.level2);
+	Im2.bicubicDerivatives(ws.warpDx,ws.warpDy,ws.warpDxDy,p.IsHorizontalWrap);
+	Im2.warpImageBicubicRef(Im1,warpI2,ws.warpDx,ws.warpDy,ws.warpDxDy,vx,vy,p.IsHorizontalWrap);
+	warpI2.threshold();
+}
+
+template <class T>
+void OpticalFlowT<T>::PrepareWorkspace(Pyramid& Pyramid1,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	if(!ws.roiMask.IsEmpty() && !ws.roiMask.matchDimension(Pyramid1.width(0),Pyramid1.height(0),1))
+	{
+		cout<<"The region of interest does not match the images, the whole frame is solved!"<<endl;
+		ws.clearROI();
+	}
+	// the features have 3 channels for gray and 5 for color images. The temporaries hold the largest level
+	// solved at once, or the largest band
+	int reserveWidth=0,reserveHeight=0;
+	for(int k=0;k<Pyramid1.nlevels();k++)
+	{
+		int width=Pyramid1.width(k),height=Pyramid1.height(k);
+		if(p.IsTiledLevel(height) && ws.roiMask.IsEmpty())
+			height=p.tileRows+2*p.tileHalo;
+		if((double)width*height>(double)reserveWidth*reserveHeight)
+		{
+			reserveWidth=width;
+			reserveHeight=height;
+		}
+	}
+	ws.reserve(reserveWidth,reserveHeight,Pyramid1.nFeatureChannels());
 	//GaussianMixture GMPara(Im1.nchannels()+2);
 
 	// initialize noise
-	switch(noiseModel){
-	case GMixture:
-		GMPara.reset(Im1.nchannels()+2);
-		break;
-	case Lap:
-		LapPara.allocate(Im1.nchannels()+2);
-		for(int i = 0;i<LapPara.dim();i++)
-			LapPara[i] = 0.02;
-		break;
-	}
+	ws.resetNoise(p.noiseModel,Pyramid1.nchannels()+2);
+	ws.statistics.clear();
+}
 
-	for(int k=GPyramid1.nlevels()-1;k>=0;k--)
+template <class T>
+void OpticalFlowT<T>::SolveLevel(TImage& vx,TImage& vy,Pyramid& Pyramid1,Pyramid& Pyramid2,double alpha,double ratio,int k,int startLevel,bool IsInit,
+																	 int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	TImage &WarpImage2=ws.WarpImage2;
+	StageTimer timer;
+	if(p.IsDisplay)
+		cout<<"Pyramid level "<<k;
+	int width=Pyramid1.width(k);
+	int height=Pyramid1.height(k);
+	// the features of half pyramids are expanded into the workspace for the level
+	const TImage &Image1=Pyramid1.feature(k,ws.Image1),&Image2=Pyramid2.feature(k,ws.Image2);
+	// the bands warp their own rows
+	bool IsBands=p.IsTiledLevel(height) && ws.roiMask.IsEmpty();
+	// the derivatives of Image2 for the bicubic warp, once for the first warp and all the outer iterations
+	ws.IsWarpDerivatives=false;
+	if(p.interpolation == Bicubic && !IsBands)
 	{
-		if(IsDisplay)
-			cout<<"Pyramid level "<<k;
-		int width=GPyramid1.Image(k).width();
-		int height=GPyramid1.Image(k).height();
-		im2feature(Image1,GPyramid1.Image(k));
-		im2feature(Image2,GPyramid2.Image(k));
+		Image2.bicubicDerivatives(ws.warpDx,ws.warpDy,ws.warpDxDy,p.IsHorizontalWrap);
+		ws.IsWarpDerivatives=true;
+	}
 
-		if(k==GPyramid1.nlevels()-1) // if at the top level
-		{
-			vx.allocate(width,height);
-			vy.allocate(width,height);
-			//warpI2.copyData(Image2);
+	if(k==startLevel && !IsInit) // if at the top level
+	{
+		vx.allocate(width,height);
+		vy.allocate(width,height);
+		//warpI2.copyData(Image2);
+		if(!IsBands)
 			WarpImage2.copyData(Image2);
+	}
+	else
+	{
+		if(k<startLevel)
+			ResizeFlow(vx,vy,width,height,1/ratio,ws.foo1,ws.foo2,p,&Pyramid1.level(k,ws.level1),&Pyramid1.level(k+1,ws.level2));
+		//warpFL(warpI2,GPyramid1.Image(k),GPyramid2.Image(k),vx,vy);
+		if(!IsBands)
+		{
+			if(p.interpolation == Bilinear)
+				warpFL(WarpImage2,Image1,Image2,vx,vy,p);
+			else
+				Image2.warpImageBicubicRef(Image1,WarpImage2,ws.warpDx,ws.warpDy,ws.warpDxDy,vx,vy,p.IsHorizontalWrap);
 		}
+	}
+	//SmoothFlowPDE(GPyramid1.Image(k),GPyramid2.Image(k),warpI2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
+	//SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha*pow((1/ratio),k),nOuterFPIterations,nInnerFPIterations,nCGIterations,GMPara);
+	
+	//SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
+	BuildLevelROI(ws,width,height);
+	ws.IsConfidenceLevel=ws.IsConfidence && k==0;
+	double warpTime=timer.lap();
+	if(IsBands)
+		SolveLevelBands(vx,vy,Image1,Image2,alpha,nOuterFPIterations+k,nInnerFPIterations,nCGIterations+k*3,ws);
+	else
+		SmoothFlowSOR(Image1,Image2,WarpImage2,vx,vy,alpha,nOuterFPIterations+k,nInnerFPIterations,nCGIterations+k*3,ws);
+	ws.IsWarpDerivatives=false;
+	SolverStatistics& stats=ws.statistics.back();
+	stats.warpTime+=warpTime;
+	stats.workspaceMemory=ws.memory();
+	stats.peakMemory=MemoryAccounting::peak();
+
+	//GMPara.display();
+	if(p.IsDisplay)
+		cout<<" outer "<<stats.nOuterIterations<<" solver "<<stats.nSolverIterations<<" residual "<<stats.lastResidual<<" time "<<timer.lap()+warpTime
+			<<"s (warp "<<stats.warpTime<<" derivatives "<<stats.derivativeTime<<" weights "<<stats.weightTime<<" assembly "<<stats.assemblyTime
+			<<" solver "<<stats.solverTime<<" noise "<<stats.noiseTime<<")"<<endl;
+}
+
+//--------------------------------------------------------------------------------------
+// the rows top..bottom-1 of an image
+//--------------------------------------------------------------------------------------
+template <class T>
+static void CropRows(Image<T>& band,const Image<T>& image,int top,int bottom)
+{
+	int rowSize=image.width()*image.nchannels();
+	band.allocate(image.width(),bottom-top,image.nchannels());
+	memcpy(band.data(),image.data()+(size_t)top*rowSize,sizeof(T)*rowSize*(bottom-top));
+}
+
+//--------------------------------------------------------------------------------------
+// function to solve a level in bands of full rows. Every band is solved from the flow of the level on
+// its rows and the tileHalo rows around them, and blended with its neighbours by weights that fall
+// linearly across the 2*tileHalo rows they share. The rows stay whole so the horizontal wrap holds in
+// every band. Each band starts from the noise model of the level, the next level from their mean
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::SolveLevelBands(TImage& vx,TImage& vy,const TImage& Image1,const TImage& Image2,double alpha,
+																	 int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws)
+{
+	const Parameters& p=ws.parameters();
+	int width=Image1.width(),height=Image1.height();
+	int nBands=(height+p.tileRows-1)/p.tileRows;
+	// the two overlaps of a band don't meet
+	int halo=__min(p.tileHalo,height/nBands/2);
+	ws.blendVx.allocate(width,height);
+	ws.blendVy.allocate(width,height);
+	ws.blendWeight.assign(height,0);
+	if(ws.IsConfidenceLevel)
+		ws.blendConfidence.allocate(width,height);
+	GaussianMixture levelGMPara(ws.GMPara);
+	Vector<double> levelLapPara(ws.LapPara);
+	int nNoise=(p.noiseModel==GMixture) ? levelGMPara.nChannels : levelLapPara.dim();
+	vector<double> noiseSum(nNoise*3,0.0);
+
+	SolverStatistics stats;
+	memset(&stats,0,sizeof(stats));
+	stats.width=width;
+	stats.height=height;
+	for(int b=0;b<nBands;b++)
+	{
+		int rowBegin=(long long)height*b/nBands,rowEnd=(long long)height*(b+1)/nBands;
+		int top=__max(rowBegin-halo,0),bottom=__min(rowEnd+halo,height);
+		CropRows(ws.bandImage1,Image1,top,bottom);
+		CropRows(ws.bandImage2,Image2,top,bottom);
+		CropRows(ws.bandVx,vx,top,bottom);
+		CropRows(ws.bandVy,vy,top,bottom);
+		ws.GMPara=levelGMPara;
+		ws.LapPara=levelLapPara;
+		if(p.interpolation == Bilinear)
+			warpFL(ws.WarpImage2,ws.bandImage1,ws.bandImage2,ws.bandVx,ws.bandVy,p);
 		else
 		{
-
-			vx.imresize(width,height);
-			vx.Multiplywith(1/ratio);
-			vy.imresize(width,height);
-			vy.Multiplywith(1/ratio);
-			//warpFL(warpI2,GPyramid1.Image(k),GPyramid2.Image(k),vx,vy);
-			if(interpolation == Bilinear)
-				warpFL(WarpImage2,Image1,Image2,vx,vy);
+			// the rows at the edges of a band differ from those of the level, so every band has its own
+			ws.bandImage2.bicubicDerivatives(ws.warpDx,ws.warpDy,ws.warpDxDy,p.IsHorizontalWrap);
+			ws.IsWarpDerivatives=true;
+			ws.bandImage2.warpImageBicubicRef(ws.bandImage1,ws.WarpImage2,ws.warpDx,ws.warpDy,ws.warpDxDy,ws.bandVx,ws.bandVy,p.IsHorizontalWrap);
+		}
+		SmoothFlowSOR(ws.bandImage1,ws.bandImage2,ws.WarpImage2,ws.bandVx,ws.bandVy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+		ws.IsWarpDerivatives=false;
+
+		// one entry for the level: the times of the bands add up, the iterations and the residuals are the largest
+		const SolverStatistics& s=ws.statistics.back();
+		stats.nOuterIterations=__max(stats.nOuterIterations,s.nOuterIterations);
+		stats.nSolverIterations=__max(stats.nSolverIterations,s.nSolverIterations);
+		stats.lastUpdate=__max(stats.lastUpdate,s.lastUpdate);
+		stats.lastResidual=__max(stats.lastResidual,s.lastResidual);
+		stats.warpTime+=s.warpTime;
+		stats.derivativeTime+=s.derivativeTime;
+		stats.weightTime+=s.weightTime;
+		stats.assemblyTime+=s.assemblyTime;
+		stats.solverTime+=s.solverTime;
+		stats.noiseTime+=s.noiseTime;
+		ws.statistics.pop_back();
+		for(int c=0;c<nNoise;c++)
+			if(p.noiseModel==GMixture)
+			{
+				noiseSum[c]+=ws.GMPara.alpha[c];
+				noiseSum[nNoise+c]+=ws.GMPara.sigma[c];
+				noiseSum[nNoise*2+c]+=ws.GMPara.beta[c];
+			}
 			else
-				Image2.warpImageBicubicRef(Image1,WarpImage2,vx,vy);
+				noiseSum[c]+=ws.LapPara[c];
+
+		for(int i=top;i<bottom;i++)
+		{
+			double weight=1;
+			if(top>0)
+				weight=__min(weight,(i-top+0.5)/(2*halo));
+			if(bottom<height)
+				weight=__min(weight,(bottom-i-0.5)/(2*halo));
+			const T *pVx=ws.bandVx.data()+(i-top)*width,*pVy=ws.bandVy.data()+(i-top)*width;
+			T *pBlendVx=ws.blendVx.data()+i*width,*pBlendVy=ws.blendVy.data()+i*width;
+			for(int j=0;j<width;j++)
+			{
+				pBlendVx[j]+=weight*pVx[j];
+				pBlendVy[j]+=weight*pVy[j];
+			}
+			if(ws.IsConfidenceLevel)
+			{
+				const T* pConfidence=ws.confidence.data()+(i-top)*width;
+				T* pBlendConfidence=ws.blendConfidence.data()+i*width;
+				for(int j=0;j<width;j++)
+					pBlendConfidence[j]+=weight*pConfidence[j];
+			}
+			ws.blendWeight[i]+=weight;
 		}
-		//SmoothFlowPDE(GPyramid1.Image(k),GPyramid2.Image(k),warpI2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
-		//SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha*pow((1/ratio),k),nOuterFPIterations,nInnerFPIterations,nCGIterations,GMPara);
-		
-		//SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
-		SmoothFlowSOR(Image1,Image2,WarpImage2,vx,vy,alpha,nOuterFPIterations+k,nInnerFPIterations,nCGIterations+k*3);
+	}
+	for(int i=0;i<height;i++)
+	{
+		const T *pBlendVx=ws.blendVx.data()+i*width,*pBlendVy=ws.blendVy.data()+i*width;
+		T *pVx=vx.data()+i*width,*pVy=vy.data()+i*width;
+		for(int j=0;j<width;j++)
+		{
+			pVx[j]=pBlendVx[j]/ws.blendWeight[i];
+			pVy[j]=pBlendVy[j]/ws.blendWeight[i];
+		}
+	}
+	if(ws.IsConfidenceLevel)
+	{
+		ws.confidence.allocate(width,height);
+		for(int i=0;i<height;i++)
+			for(int j=0;j<width;j++)
+				ws.confidence.data()[i*width+j]=ws.blendConfidence.data()[i*width+j]/ws.blendWeight[i];
+	}
+	ws.GMPara=levelGMPara;
+	ws.LapPara=levelLapPara;
+	for(int c=0;c<nNoise;c++)
+		if(p.noiseModel==GMixture)
+		{
+			ws.GMPara.alpha[c]=noiseSum[c]/nBands;
+			ws.GMPara.sigma[c]=noiseSum[nNoise+c]/nBands;
+			ws.GMPara.beta[c]=noiseSum[nNoise*2+c]/nBands;
+		}
+		else
+			ws.LapPara[c]=noiseSum[c]/nBands;
+	if(p.noiseModel==GMixture)
+		ws.GMPara.square();
+	ws.statistics.push_back(stats);
+}
 
-		//GMPara.display();
-		if(IsDisplay)
-			cout<<endl;
+//--------------------------------------------------------------------------------------
+// function to estimate the forward and the backward flow with one pyramid per image
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,const TImage& Im1,const TImage& Im2,
+																	 double alpha,double ratio,int minWidth,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations)
+{
+	Pyramid Pyramid1,Pyramid2;
+	Workspace ws,wsB;
+	BuildPyramid(Pyramid1,Im1,ratio,minWidth);
+	BuildPyramid(Pyramid2,Im2,ratio,minWidth);
+	Coarse2FineFlowBidirectional(vx,vy,vxB,vyB,occlusion,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws,wsB);
+}
+
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,Pyramid& Pyramid1,Pyramid& Pyramid2,
+																	 double alpha,double ratio,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws,Workspace& wsB)
+{
+	const Parameters& p=ws.parameters();
+	PrepareWorkspace(Pyramid1,ws);
+	PrepareWorkspace(Pyramid2,wsB);
+	ws.pyramidTime=wsB.pyramidTime=Pyramid1.pyramidTime+Pyramid2.pyramidTime;
+	ws.featureTime=wsB.featureTime=Pyramid1.featureTime+Pyramid2.featureTime;
+	// both directions read the features of the same level while they are in the cache
+	int startLevel=Pyramid1.nlevels()-1;
+	for(int k=startLevel;k>=0;k--)
+	{
+		SolveLevel(vx,vy,Pyramid1,Pyramid2,alpha,ratio,k,startLevel,false,nOuterFPIterations,nInnerFPIterations,nCGIterations,ws);
+		SolveLevel(vxB,vyB,Pyramid2,Pyramid1,alpha,ratio,k,startLevel,false,nOuterFPIterations,nInnerFPIterations,nCGIterations,wsB);
 	}
-	//warpFL(warpI2,Im1,Im2,vx,vy);
-	Im2.warpImageBicubicRef(Im1,warpI2,vx,vy);
-	warpI2.threshold();
+	OcclusionMask(occlusion,vx,vy,vxB,vyB,p);
+}
+
+//--------------------------------------------------------------------------------------
+// function to mark the pixels where the forward flow and the backward flow at its target
+// disagree, or where the forward flow leaves the image
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::OcclusionMask(TImage& occlusion,const TImage& vx,const TImage& vy,const TImage& vxB,const TImage& vyB,const Parameters& p)
+{
+	int width=vx.width(),height=vx.height();
+	if(!occlusion.matchDimension(width,height,1))
+		occlusion.allocate(width,height);
+	const T *pVx=vx.data(),*pVy=vy.data(),*pVxB=vxB.data(),*pVyB=vyB.data();
+	T* pOcclusion=occlusion.data();
+#ifdef _OPENMP
+	#pragma omp parallel for if(width*height>65536)
+#endif
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double x=j+pVx[offset],y=i+pVy[offset];
+			if(p.IsHorizontalWrap)
+				x=(x<0)?x+width:((x>=width)?x-width:x);
+			if((!p.IsHorizontalWrap && (x<0 || x>width-1)) || y<0 || y>height-1)
+			{
+				pOcclusion[offset]=1;
+				continue;
+			}
+			double u=0,v=0;
+			ImageProcessing::BilinearInterpolate(pVxB,width,height,1,x,y,&u,p.IsHorizontalWrap);
+			ImageProcessing::BilinearInterpolate(pVyB,width,height,1,x,y,&v,p.IsHorizontalWrap);
+			double sum=(pVx[offset]+u)*(pVx[offset]+u)+(pVy[offset]+v)*(pVy[offset]+v);
+			double norm=pVx[offset]*pVx[offset]+pVy[offset]*pVy[offset]+u*u+v*v;
+			pOcclusion[offset]=(sum>p.occlusionRatio*norm+p.occlusionOffset)?1:0;
+		}
 }
 
-void OpticalFlow::Coarse2FineFlowLevel(DImage &vx, DImage &vy, DImage &warpI2,const DImage &Im1, const DImage &Im2, double alpha, double ratio, int nLevels, 
+template <class T>
+void OpticalFlowT<T>::Coarse2FineFlowLevel(TImage &vx, TImage &vy, TImage &warpI2,const TImage &Im1, const TImage &Im2, double alpha, double ratio, int nLevels, 
 																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
 {
 	// first build the pyramid of the two images
-	GaussianPyramid GPyramid1;
-	GaussianPyramid GPyramid2;
-	GaussianPyramid GFlow;
-	DImage flow;
+	GaussianPyramidT<T> GPyramid1;
+	GaussianPyramidT<T> GPyramid2;
+	GaussianPyramidT<T> GFlow;
+	TImage flow;
 	AssembleFlow(vx,vy,flow);
 	if(IsDisplay)
 		cout<<"Constructing pyramid...";
@@ -1033,7 +2329,7 @@ void OpticalFlow::Coarse2FineFlowLevel(DImage &vx, DImage &vy, DImage &warpI2,co
 		cout<<"done!"<<endl;
 	
 	// now iterate from the top level to the bottom
-	DImage Image1,Image2,WarpImage2;
+	TImage Image1,Image2,WarpImage2,foo1,foo2;
 
 	// initialize noise
 	switch(noiseModel){
@@ -1058,12 +2354,7 @@ void OpticalFlow::Coarse2FineFlowLevel(DImage &vx, DImage &vy, DImage &warpI2,co
 		im2feature(Image2,GPyramid2.Image(k));
 
 		if(k<GPyramid1.nlevels()-1) // if at the top level
-		{
-			vx.imresize(width,height);
-			vx.Multiplywith(1/ratio);
-			vy.imresize(width,height);
-			vy.Multiplywith(1/ratio);
-		}
+			ResizeFlow(vx,vy,width,height,1/ratio,foo1,foo2,parameters,&GPyramid1.Image(k),&GPyramid1.Image(k+1));
 		if(interpolation == Bilinear)
 			warpFL(WarpImage2,Image1,Image2,vx,vy);
 		else
@@ -1082,55 +2373,97 @@ void OpticalFlow::Coarse2FineFlowLevel(DImage &vx, DImage &vy, DImage &warpI2,co
 }
 
 //---------------------------------------------------------------------------------------
-// function to convert image to feature image
+// function to convert image to feature image: the gray level and its x and y derivatives, and the two
+// color differences of a color image, written in one pass without temporary images. The values are the
+// ones of desaturate, dx and dy with the advanced filter, the taps added in the same order
 //---------------------------------------------------------------------------------------
-void OpticalFlow::im2feature(DImage &imfeature, const DImage &im)
+template <class T>
+void OpticalFlowT<T>::im2feature(TImage &imfeature, const TImage &im,const Parameters& p)
 {
 	int width=im.width();
 	int height=im.height();
 	int nchannels=im.nchannels();
-	if(nchannels==1)
+	if(nchannels!=1 && nchannels!=3)
 	{
-		imfeature.allocate(im.width(),im.height(),3);
-		DImage imdx,imdy;
-		im.dx(imdx,true);
-		im.dy(imdy,true);
-		_FlowPrecision* data=imfeature.data();
-		for(int i=0;i<height;i++)
-			for(int j=0;j<width;j++)
-			{
-				int offset=i*width+j;
-				data[offset*3]=im.data()[offset];
-				data[offset*3+1]=imdx.data()[offset];
-				data[offset*3+2]=imdy.data()[offset];
-			}
+		imfeature.copyData(im);
+		return;
 	}
-	else if(nchannels==3)
+	imfeature.allocate(width,height,(nchannels==1)?3:5);
+	// one band of rows per thread, each one reads the 2 rows above and below it
+	int nBands=1;
+#ifdef _OPENMP
+	if((double)width*height>65536)
+		nBands=__min(p.numThreads(),height);
+	#pragma omp parallel for num_threads(nBands) schedule(static,1)
+#endif
+	for(int b=0;b<nBands;b++)
+		im2featureRows(imfeature,im,(long long)height*b/nBands,(long long)height*(b+1)/nBands,p.IsHorizontalWrap);
+}
+
+//---------------------------------------------------------------------------------------
+// the feature rows iBegin..iEnd-1. The gray levels of a color image are kept for the 5 rows that the
+// derivative filter reads, row r in the slot r%5 of a ring, so each one is computed once per band
+//---------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowT<T>::im2featureRows(TImage& imfeature,const TImage& im,int iBegin,int iEnd,bool IsHorizontalWrap)
+{
+	int width=im.width(),height=im.height(),nchannels=im.nchannels(),nFeatures=imfeature.nchannels();
+	double filter[5]={1,-8,0,8,-1};
+	for(int l=0;l<5;l++)
+		filter[l]/=12;
+	double wFirst=.299,wLast=.114;
+	if(im.colortype()!=RGB)
 	{
-		DImage grayImage;
-		im.desaturate(grayImage);
-
-		imfeature.allocate(im.width(),im.height(),5);
-		DImage imdx,imdy;
-		grayImage.dx(imdx,true);
-		grayImage.dy(imdy,true);
-		_FlowPrecision* data=imfeature.data();
-		for(int i=0;i<height;i++)
+		wFirst=.114;
+		wLast=.299;
+	}
+	const T* pIm=im.data();
+	vector<T> ring((nchannels==3)?width*5:0);
+	int next=__max(iBegin-2,0);
+	for(int i=iBegin;i<iEnd;i++)
+	{
+		for(;nchannels==3 && next<=__min(i+2,height-1);next++)
+		{
+			const T* pSrc=pIm+(size_t)next*width*3;
+			T* pGray=&ring[(next%5)*width];
 			for(int j=0;j<width;j++)
+				pGray[j]=(double)pSrc[j*3]*wFirst+pSrc[j*3+1]*.587+pSrc[j*3+2]*wLast;
+		}
+		const T* rows[5];
+		for(int l=0;l<5;l++)
+		{
+			int ii=ImageProcessing::EnforceRange(i+l-2,height);
+			rows[l]=(nchannels==3)?&ring[(ii%5)*width]:pIm+(size_t)ii*width;
+		}
+		const T* pGray=rows[2];
+		_FlowPrecision* pFeature=imfeature.data()+(size_t)i*width*nFeatures;
+		for(int j=0;j<width;j++)
+		{
+			_FlowPrecision dx=0,dy=0;
+			if(j>=2 && j+2<width)
+				for(int l=0;l<5;l++)
+					dx+=pGray[j+l-2]*filter[l];
+			else
+				for(int l=0;l<5;l++)
+					dx+=pGray[ImageProcessing::BoundaryRange(j+l-2,width,IsHorizontalWrap)]*filter[l];
+			for(int l=0;l<5;l++)
+				dy+=rows[l][j]*filter[l];
+			_FlowPrecision* data=pFeature+j*nFeatures;
+			data[0]=pGray[j];
+			data[1]=dx;
+			data[2]=dy;
+			if(nchannels==3)
 			{
-				int offset=i*width+j;
-				data[offset*5]=grayImage.data()[offset];
-				data[offset*5+1]=imdx.data()[offset];
-				data[offset*5+2]=imdy.data()[offset];
-				data[offset*5+3]=im.data()[offset*3+1]-im.data()[offset*3];
-				data[offset*5+4]=im.data()[offset*3+1]-im.data()[offset*3+2];
+				const T* pColor=pIm+((size_t)i*width+j)*3;
+				data[3]=pColor[1]-pColor[0];
+				data[4]=pColor[1]-pColor[2];
 			}
+		}
 	}
-	else
-		imfeature.copyData(im);
 }
 
-bool OpticalFlow::LoadOpticalFlow(const char* filename,DImage &flow)
+template <class T>
+bool OpticalFlowT<T>::LoadOpticalFlow(const char* filename,TImage &flow)
 {
 	Image<unsigned short int> foo;
 	if(foo.loadImage(filename) == false)
@@ -1145,7 +2478,8 @@ bool OpticalFlow::LoadOpticalFlow(const char* filename,DImage &flow)
 	return true;
 }
 
-bool OpticalFlow::LoadOpticalFlow(ifstream& myfile,DImage& flow)
+template <class T>
+bool OpticalFlowT<T>::LoadOpticalFlow(ifstream& myfile,TImage& flow)
 {
 	Image<unsigned short int> foo;
 	if(foo.loadImage(myfile) == false)
@@ -1160,7 +2494,8 @@ bool OpticalFlow::LoadOpticalFlow(ifstream& myfile,DImage& flow)
 	return true;
 }
 
-bool OpticalFlow::SaveOpticalFlow(const DImage& flow, const char* filename)
+template <class T>
+bool OpticalFlowT<T>::SaveOpticalFlow(const TImage& flow, const char* filename)
 {
 	Image<unsigned short int> foo;
 	foo.allocate(flow);
@@ -1172,7 +2507,8 @@ bool OpticalFlow::SaveOpticalFlow(const DImage& flow, const char* filename)
 	return foo.saveImage(filename);
 }
 
-bool OpticalFlow::SaveOpticalFlow(const DImage& flow,ofstream& myfile)
+template <class T>
+bool OpticalFlowT<T>::SaveOpticalFlow(const TImage& flow,ofstream& myfile)
 {
 	Image<unsigned short int> foo;
 	foo.allocate(flow);
@@ -1184,7 +2520,8 @@ bool OpticalFlow::SaveOpticalFlow(const DImage& flow,ofstream& myfile)
 	return foo.saveImage(myfile);
 }
 
-bool OpticalFlow::showFlow(const DImage& flow,const char* filename)
+template <class T>
+bool OpticalFlowT<T>::showFlow(const TImage& flow,const char* filename)
 {
 	if(flow.nchannels()!=1)
 	{
@@ -1198,4 +2535,140 @@ bool OpticalFlow::showFlow(const DImage& flow,const char* filename)
 	for(int i = 0;i<flow.npixels(); i++)
 		foo[i] = (flow[i]-Min)/(Max-Min)*255;
 	foo.imwrite(filename);
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------
+// optical flow of a video sequence
+//--------------------------------------------------------------------------------------
+template <class T>
+OpticalFlowSequence<T>::OpticalFlowSequence(double _alpha,double _ratio,int _minWidth,int _nOuterFPIterations,int _nInnerFPIterations,int _nSORIterations)
+{
+	alpha=_alpha;
+	ratio=_ratio;
+	minWidth=_minWidth;
+	nOuterFPIterations=_nOuterFPIterations;
+	nInnerFPIterations=_nInnerFPIterations;
+	nSORIterations=_nSORIterations;
+	IsWarmStart=false;
+	nSkipLevels=2;
+	nWarmOuterFPIterations=0;
+	IsClassified=false;
+	pPrev=&Pyramids[0];
+	pNext=&Pyramids[1];
+	IsPrior=false;
+	lastType=ShotClassifier<T>::Moving;
+	nFrames=0;
+}
+
+template <class T>
+bool OpticalFlowSequence<T>::AddFrame(const TImage& frame,TImage& vx,TImage& vy)
+{
+	TImage warpI2;
+	return AddFrame(frame,vx,vy,warpI2);
+}
+
+template <class T>
+bool OpticalFlowSequence<T>::AddFrame(const TImage& frame,TImage& vx,TImage& vy,TImage& warpI2)
+{
+	if(nFrames>0 && !frame.matchDimension(pPrev->width(0),pPrev->height(0),pPrev->nchannels()))
+	{
+		cout<<"The frames of the sequence have different dimensions!"<<endl;
+		return false;
+	}
+	// the pyramid of the new frame replaces the one of the frame before the previous
+	OpticalFlowT<T>::BuildPyramid(*pNext,frame,ratio,minWidth);
+	nFrames++;
+	bool IsFlow=false;
+	lastType=ShotClassifier<T>::Moving;
+	if(nFrames>1 && IsClassified)
+		lastType=classifier.classifyLevels(pPrev->level(pPrev->nlevels()-1,ws.level1),pNext->level(pNext->nlevels()-1,ws.level2));
+	if(nFrames>1 && lastType!=ShotClassifier<T>::Moving)
+	{
+		vx.allocate(frame.width(),frame.height());
+		vy.allocate(frame.width(),frame.height());
+		warpI2.copyData(frame);
+		IsFlow=true;
+	}
+	else if(nFrames>2 && IsWarmStart && IsPrior)
+	{
+		int nOuter=(nWarmOuterFPIterations>0)?nWarmOuterFPIterations:nOuterFPIterations;
+		OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,*pPrev,*pNext,priorVx,priorVy,alpha,ratio,nSkipLevels,nOuter,nInnerFPIterations,nSORIterations,ws);
+		IsFlow=true;
+	}
+	else if(nFrames>1)
+	{
+		OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,*pPrev,*pNext,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+		IsFlow=true;
+	}
+	if(IsFlow && IsWarmStart)
+	{
+		priorVx.copyData(vx);
+		priorVy.copyData(vy);
+	}
+	// the flow 0 of a cut is no prior for the next shot
+	IsPrior=IsFlow && lastType!=ShotClassifier<T>::Cut;
+	FeaturePyramid<T>* temp=pPrev;
+	pPrev=pNext;
+	pNext=temp;
+	return IsFlow;
+}
+
+//--------------------------------------------------------------------------------------
+// the solver with its own settings
+//--------------------------------------------------------------------------------------
+template <class T>
+FlowSolver<T>::FlowSolver(double _alpha,double _ratio,int _minWidth,int _nOuterFPIterations,int _nInnerFPIterations,int _nSORIterations)
+{
+	alpha=_alpha;
+	ratio=_ratio;
+	minWidth=_minWidth;
+	nOuterFPIterations=_nOuterFPIterations;
+	nInnerFPIterations=_nInnerFPIterations;
+	nSORIterations=_nSORIterations;
+}
+
+template <class T>
+void FlowSolver<T>::BuildPyramid(Pyramid& pyramid,const TImage& im) const
+{
+	OpticalFlowT<T>::BuildPyramid(pyramid,im,ratio,minWidth,parameters);
+}
+
+template <class T>
+void FlowSolver<T>::Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,const TImage& Im1,const TImage& Im2)
+{
+	OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,workspace(ws));
+}
+
+template <class T>
+void FlowSolver<T>::Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2)
+{
+	OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nSORIterations,workspace(ws));
+}
+
+template <class T>
+void FlowSolver<T>::Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& priorVx,const TImage& priorVy,int nSkipLevels)
+{
+	OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,priorVx,priorVy,alpha,ratio,nSkipLevels,nOuterFPIterations,nInnerFPIterations,nSORIterations,workspace(ws));
+}
+
+template <class T>
+void FlowSolver<T>::Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,const TImage& Im1,const TImage& Im2)
+{
+	Pyramid Pyramid1,Pyramid2;
+	BuildPyramid(Pyramid1,Im1);
+	BuildPyramid(Pyramid2,Im2);
+	OpticalFlowT<T>::Coarse2FineFlowBidirectional(vx,vy,vxB,vyB,occlusion,Pyramid1,Pyramid2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nSORIterations,
+																 workspace(ws),workspace(wsB));
+}
+
+// the double and the single precision instantiations of the solver
+template class OpticalFlowT<double>;
+template class OpticalFlowT<float>;
+template class OpticalFlowSequence<double>;
+template class OpticalFlowSequence<float>;
+template class FlowSolver<double>;
+template class FlowSolver<float>;
+template void OpticalFlowT<double>::BuildPyramid(Pyramid&,const ::Image<unsigned char>&,double,double,int,const Parameters&);
+template void OpticalFlowT<double>::BuildPyramid(Pyramid&,const ::Image<unsigned short>&,double,double,int,const Parameters&);
+template void OpticalFlowT<float>::BuildPyramid(Pyramid&,const ::Image<unsigned char>&,double,double,int,const Parameters&);
+template void OpticalFlowT<float>::BuildPyramid(Pyramid&,const ::Image<unsigned short>&,double,double,int,const Parameters&);
@@ -1,69 +1,565 @@
 #pragma once
 
 #include "Image.h"
+#include "GaussianPyramid.h"
 #include "NoiseModel.h"
+#include "ShotClassifier.h"
 #include "Vector.h"
+#include "SparseMatrix.h"
+#include "FlowKernels.h"
+#include <ostream>
 #include <vector>
 
-typedef double _FlowPrecision;
-
-class OpticalFlow
+//--------------------------------------------------------------------------------------------------------
+// settings and noise parameters shared by the double and the single precision solvers. The settings of a
+// solve are a Parameters; the static settings below are the members of OpticalFlowBase::parameters, which
+// the static API and every workspace without parameters of its own use (see FlowWorkspace::pParameters)
+//--------------------------------------------------------------------------------------------------------
+class OpticalFlowBase
 {
 public:
-	static bool IsDisplay;
+	static bool& IsDisplay;
 public:
 	enum InterpolationMethod {Bilinear,Bicubic};
-	static InterpolationMethod interpolation;
+	static InterpolationMethod& interpolation;
 	enum NoiseModel {GMixture,Lap};
-	OpticalFlow(void);
-	~OpticalFlow(void);
 	static GaussianMixture GMPara;
 	static Vector<double> LapPara;
-	static NoiseModel noiseModel;
+	static NoiseModel& noiseModel;
+	// GMixture interpolates the weights of the mixture in the tables of GMPara (see GaussianMixture::weight),
+	// within about 1e-6 of the two exp per sample and channel that are evaluated when false
+	static bool& IsGaussianMixtureTable;
+	// the noise parameters are estimated on every s-th row and column, s the largest stride that keeps at
+	// least noiseSamples pixels of the level, 0 for all the pixels
+	static int& noiseSamples;
+	// the order in which SOR visits the pixels; RedBlack updates each color in parallel
+	enum SORScheme {Lexicographic,RedBlack};
+	static SORScheme& sorScheme;
+	// the solver of the linear system of each inner fixed point iteration of SmoothFlowSOR. PCG is a conjugate
+	// gradient preconditioned by the 2x2 blocks of each pixel, it stops once the residual has dropped by
+	// solverTolerance and the SOR iterations bound its number of iterations. A level with a region of interest
+	// (FlowWorkspace::setROI) is solved by SOR whatever the solver, since PCG runs over the whole level
+	enum LinearSolver {SOR,PCG};
+	static LinearSolver& linearSolver;
+	static double& solverTolerance;
+	// SmoothFlowSOR keeps the derivatives and the data weights of multichannel features in the planar layout
+	// (see Image::planarize), so that their per-channel loops are contiguous. The flow is the same either way
+	static bool& IsPlanar;
+	// early termination, both in pixels of the current level and 0 to run all the iterations: the fixed point
+	// iterations stop when the RMS of (du,dv) is at most updateTolerance, the SOR sweeps and the iterations of
+	// SmoothFlowPDE stop when the RMS change of (du,dv) in one of them is at most sweepTolerance
+	static double& updateTolerance;
+	static double& sweepTolerance;
+	// the margin in pixels around the region of interest of a workspace, on every pyramid level
+	static int& roiDilation;
+	// the levels taller than tileRows+2*tileHalo rows are solved in bands of about tileRows full rows, each one
+	// with tileHalo rows of its neighbours above and below, so the temporaries of SmoothFlowSOR span one band
+	// instead of the level. 0 solves every level at once; a workspace with a region of interest doesn't use bands
+	static int& tileRows;
+	static int& tileHalo;
+	// the forward-backward consistency of Coarse2FineFlowBidirectional: a pixel is occluded when
+	// |w+wB|^2 > occlusionRatio*(|w|^2+|wB|^2)+occlusionOffset, with wB the backward flow at its target
+	static double& occlusionRatio;
+	static double& occlusionOffset;
+	static int& nThreads;
+	static int getNumThreads();
+	// the left and the right borders are adjacent, as in 360 equirectangular frames
+	static bool& IsHorizontalWrap;
+	// the range sigma of the joint bilateral upsampling of the flow from one pyramid level to the next, guided by
+	// the images of the two levels, e.g. 0.1 for images in [0,1]; 0 upsamples the flow bilinearly
+	static double& upsampleSigma;
+	// GPU runs Coarse2FineFlow of two images on a CUDA device when compiled with _OPENCV_GPU, see OpticalFlowGPU.h;
+	// Preview runs the dense inverse search of PreviewFlow.h instead of the variational solver, for previews
+	enum Backend {CPU,GPU,Preview};
+	static Backend& backend;
+	// BuildPyramid stores the levels and the features of the pyramids in IEEE half, about half of the bytes of the
+	// pyramids of a float solve and a quarter of a double one, see FeaturePyramid::compact; each level is expanded
+	// when it is solved, and its samples keep 11 bits of precision
+	static bool& IsHalfPyramid;
+
+	// the settings of one solve, with the defaults of the static settings
+	struct Parameters
+	{
+		bool IsDisplay;
+		InterpolationMethod interpolation;
+		NoiseModel noiseModel;
+		bool IsGaussianMixtureTable;
+		int noiseSamples;
+		SORScheme sorScheme;
+		LinearSolver linearSolver;
+		double solverTolerance,updateTolerance,sweepTolerance;
+		bool IsPlanar;
+		int roiDilation;
+		int tileRows,tileHalo;
+		double occlusionRatio,occlusionOffset;
+		int nThreads;
+		bool IsHorizontalWrap;
+		double upsampleSigma;
+		Backend backend;
+		bool IsHalfPyramid;
+		Parameters();
+		// nThreads, or all the cores for 0
+		int numThreads() const;
+		inline bool IsTiledLevel(int height) const {return tileRows>0 && height>tileRows+2*tileHalo;};
+	};
+	static Parameters parameters;
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the iterations that SmoothFlowSOR or SmoothFlowPDE ran on one pyramid level
+//--------------------------------------------------------------------------------------------------------
+struct SolverStatistics
+{
+	int width,height;
+	int nOuterIterations;	// the outer fixed point iterations
+	int nSolverIterations;	// the SOR sweeps or conjugate gradient iterations over all the fixed point iterations
+	double lastUpdate;		// the RMS of (du,dv) in the last fixed point iteration
+	double lastResidual;	// the RMS change of the last SOR sweep, or the relative residual of the last conjugate gradient
+	// the wall time in seconds of the stages of the level: the upsampling of the flow and the warps, the
+	// derivatives of the images and of the flow, the robust weights, the assembly of the linear system, the
+	// linear solver and the noise estimate
+	double warpTime,derivativeTime,weightTime,assemblyTime,solverTime,noiseTime;
+	// the bytes of the buffers of the workspace after the level, and the peak of MemoryAccounting so far
+	double workspaceMemory,peakMemory;
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the pixels of a mask as spans of columns on every row: the spans of row i are first[i]..first[i+1]-1,
+// and span s covers the columns begin[s]..end[s]-1
+//--------------------------------------------------------------------------------------------------------
+class RowSpans
+{
+public:
+	std::vector<int> first,begin,end;
+public:
+	void clear() {first.clear();begin.clear();end.clear();};
+	inline bool IsEmpty() const {return first.empty();};
+	int npixels() const
+	{
+		int n=0;
+		for(int s=0;s<(int)begin.size();s++)
+			n+=end[s]-begin[s];
+		return n;
+	}
+	// the pixels where mask>0
+	template <class T>
+	void build(const Image<T>& mask)
+	{
+		int width=mask.width(),height=mask.height();
+		const T* pMask=mask.data();
+		clear();
+		for(int i=0;i<height;i++)
+		{
+			first.push_back(begin.size());
+			for(int j=0;j<width;j++)
+			{
+				if(pMask[i*width+j]<=0)
+					continue;
+				begin.push_back(j);
+				while(j<width && pMask[i*width+j]>0)
+					j++;
+				end.push_back(j);
+			}
+		}
+		first.push_back(begin.size());
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// scratch images of the solvers. reserve() sizes them once for the finest level; since Image::allocate
+// reuses a buffer that is large enough, the coarser levels and the fixed point iterations then run
+// without touching the heap. One workspace can be reused across calls of Coarse2FineFlow
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class FlowWorkspace
+{
+public:
+	typedef Image<T> TImage;
+	// feature images of the current pyramid level
+	TImage Image1,Image2,WarpImage2;
+	// derivatives of the images and of the flow field
+	TImage mask,imdx,imdy,imdt;
+	TImage du,dv,uu,vv,ux,uy,vx,vy;
+	TImage Phi_1st,Psi_1st;
+	// components of the linear system
+	TImage imdxy,imdx2,imdy2,imdtdx,imdtdy;
+	TImage A11,A12,A22,b1,b2;
+	TImage foo1,foo2;
+	// conjugate gradient
+	TImage r1,r2,p1,p2,q1,q2;
+	std::vector<double> rou;
+	// preconditioned conjugate gradient: the inverses of the 2x2 blocks and the preconditioned residual
+	TImage M11,M12,M22,z1,z2;
+	// scratch of getDxs
+	TImage smooth1,smooth2,smoothAvg,filterTemp;
+	// the features of the two images in the planar layout
+	TImage planarImage1,planarWarpImage2;
+	// the levels of half pyramids expanded for the level solved: its features in Image1 and Image2, the levels
+	// guiding the upsampling of the flow, and the frames of the final warp
+	TImage level1,level2;
+	// the derivatives of the second image for the bicubic warp, in double as in warpImageBicubicRef. SolveLevel
+	// builds them once per level, or per band, and sets IsWarpDerivatives for the solver not to build them again
+	Image<double> warpDx,warpDy,warpDxDy;
+	bool IsWarpDerivatives;
+	// the noise model of the data term, estimated during the solve. Keeping it here instead of in the
+	// static members of OpticalFlowBase lets several solves run concurrently with one workspace each
+	GaussianMixture GMPara;
+	Vector<double> LapPara;
+	// one entry per pyramid level solved by the last Coarse2FineFlow, the finest level last, and the time
+	// it took to build the two pyramids and their features
+	std::vector<SolverStatistics> statistics;
+	double pyramidTime,featureTime;
+	// the bytes of the two pyramids and their features of the last Coarse2FineFlow
+	double pyramidMemory;
+	// the region of interest at the resolution of the frames, empty for the whole frame, and its dilated
+	// spans on the current level
+	TImage roiMask,roiLevel,roiTemp;
+	RowSpans roiSpans;
+	// the bands of a tiled level: the features and the flow of one band, and the blended flow of the level
+	// with the weight of every row
+	TImage bandImage1,bandImage2,bandVx,bandVy;
+	TImage blendVx,blendVy;
+	std::vector<double> blendWeight;
+	// the confidence of the flow of the finest level in [0,1] when IsConfidence, from the robust weights of
+	// the data term of its last fixed point iteration on the pixels that stay in the image: 1 where the
+	// residual is 0, 0 for outliers and outside the region of interest. Empty with the GPU and Preview
+	// backends. IsConfidenceLevel is set by SolveLevel for the level being solved
+	bool IsConfidence,IsConfidenceLevel;
+	TImage confidence,blendConfidence;
+	// the settings of the solves with this workspace, OpticalFlowBase::parameters when NULL
+	const OpticalFlowBase::Parameters* pParameters;
+public:
+	FlowWorkspace() {pyramidTime=featureTime=pyramidMemory=0;pParameters=NULL;IsConfidence=IsConfidenceLevel=IsWarpDerivatives=false;};
+	inline const OpticalFlowBase::Parameters& parameters() const {return (pParameters!=NULL)?*pParameters:OpticalFlowBase::parameters;};
+	// the flow is only solved where mask>0 and in a margin around it; the flow elsewhere is upsampled from
+	// the coarser levels. The region stays set for all the following solves with this workspace
+	void setROI(const TImage& mask)
+	{
+		if(mask.nchannels()>1)
+			mask.collapse(roiMask);
+		else
+			roiMask.copyData(mask);
+	}
+	void clearROI()
+	{
+		roiMask.clear();
+		roiSpans.clear();
+	}
+	void resetNoise(OpticalFlowBase::NoiseModel noiseModel,int nChannels)
+	{
+		switch(noiseModel){
+		case OpticalFlowBase::GMixture:
+			GMPara.reset(nChannels);
+			break;
+		case OpticalFlowBase::Lap:
+			LapPara.allocate(nChannels);
+			for(int i = 0;i<LapPara.dim();i++)
+				LapPara[i] = 0.02;
+			break;
+		}
+	}
+	void reserve(int width,int height,int nChannels)
+	{
+		TImage* multiChannel[]={&Image1,&Image2,&WarpImage2,&imdx,&imdy,&imdt,&Psi_1st,
+											&smooth1,&smooth2,&smoothAvg,&filterTemp};
+		TImage* singleChannel[]={&mask,&du,&dv,&uu,&vv,&ux,&uy,&vx,&vy,&Phi_1st,&imdxy,&imdx2,&imdy2,&imdtdx,&imdtdy,
+											&A11,&A12,&A22,&b1,&b2,&foo1,&foo2,&r1,&r2,&p1,&p2,&q1,&q2};
+		for(size_t i=0;i<sizeof(multiChannel)/sizeof(multiChannel[0]);i++)
+			if(multiChannel[i]->capacity()<width*height*nChannels)
+				multiChannel[i]->allocate(width,height,nChannels);
+		for(size_t i=0;i<sizeof(singleChannel)/sizeof(singleChannel[0]);i++)
+			if(singleChannel[i]->capacity()<width*height)
+				singleChannel[i]->allocate(width,height);
+		if(parameters().IsPlanar)
+		{
+			TImage* planar[]={&planarImage1,&planarWarpImage2};
+			for(size_t i=0;i<sizeof(planar)/sizeof(planar[0]);i++)
+				if(planar[i]->capacity()<width*height*nChannels)
+					planar[i]->allocate(width,height*nChannels);
+		}
+		if(parameters().linearSolver!=OpticalFlowBase::PCG)
+			return;
+		TImage* preconditioner[]={&M11,&M12,&M22,&z1,&z2};
+		for(size_t i=0;i<sizeof(preconditioner)/sizeof(preconditioner[0]);i++)
+			if(preconditioner[i]->capacity()<width*height)
+				preconditioner[i]->allocate(width,height);
+	}
+	// the bytes of the buffers held by the workspace, what reserve() and the levels solved so far allocated
+	double memory() const
+	{
+		const TImage* images[]={&Image1,&Image2,&WarpImage2,&mask,&imdx,&imdy,&imdt,&du,&dv,&uu,&vv,&ux,&uy,&vx,&vy,&Phi_1st,&Psi_1st,
+										&imdxy,&imdx2,&imdy2,&imdtdx,&imdtdy,&A11,&A12,&A22,&b1,&b2,&foo1,&foo2,&r1,&r2,&p1,&p2,&q1,&q2,
+										&M11,&M12,&M22,&z1,&z2,&smooth1,&smooth2,&smoothAvg,&filterTemp,&planarImage1,&planarWarpImage2,
+										&roiMask,&roiLevel,&roiTemp,&bandImage1,&bandImage2,&bandVx,&bandVy,&blendVx,&blendVy,&confidence,&blendConfidence,
+										&level1,&level2};
+		double bytes=(double)(warpDx.capacity()+warpDy.capacity()+warpDxDy.capacity())*sizeof(double)+
+							(double)(rou.capacity()+blendWeight.capacity())*sizeof(double);
+		for(size_t i=0;i<sizeof(images)/sizeof(images[0]);i++)
+			bytes+=(double)images[i]->capacity()*sizeof(T);
+		return bytes;
+	}
+	// the statistics of the last solve as one line of JSON, the times in seconds and the memory in bytes
+	void writeStatistics(std::ostream& os) const
+	{
+		os<<"{\"pyramid\":"<<pyramidTime<<",\"features\":"<<featureTime<<",\"pyramidMemory\":"<<pyramidMemory<<",\"levels\":[";
+		for(size_t k=0;k<statistics.size();k++)
+		{
+			const SolverStatistics& s=statistics[k];
+			os<<((k>0)?",":"")<<"{\"width\":"<<s.width<<",\"height\":"<<s.height<<",\"outer\":"<<s.nOuterIterations
+				<<",\"solver\":"<<s.nSolverIterations<<",\"lastUpdate\":"<<s.lastUpdate<<",\"lastResidual\":"<<s.lastResidual
+				<<",\"warp\":"<<s.warpTime<<",\"derivatives\":"<<s.derivativeTime<<",\"weights\":"<<s.weightTime
+				<<",\"assembly\":"<<s.assemblyTime<<",\"linearSolver\":"<<s.solverTime<<",\"noise\":"<<s.noiseTime
+				<<",\"workspaceMemory\":"<<s.workspaceMemory<<",\"peakMemory\":"<<s.peakMemory<<"}";
+		}
+		os<<"]}";
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the Gaussian pyramid of a frame together with the feature image of every level. In a video each
+// frame is the second image of one pair and the first image of the next, so it is built only once
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class FeaturePyramid
+{
 public:
-	static void getDxs(DImage& imdx,DImage& imdy,DImage& imdt,const DImage& im1,const DImage& im2);
-	static void SanityCheck(const DImage& imdx,const DImage& imdy,const DImage& imdt,double du,double dv);
-	static void warpFL(DImage& warpIm2,const DImage& Im1,const DImage& Im2,const DImage& vx,const DImage& vy);
-	static void warpFL(DImage& warpIm2,const DImage& Im1,const DImage& Im2,const DImage& flow);
+	typedef Image<unsigned short> HalfImage;
+	GaussianPyramidT<T> pyramid;
+	std::vector< Image<T> > features;
+	// the levels and the features in IEEE half once compact() is called; the images of T are empty then, and
+	// level() and feature() expand the one of a level into a scratch image
+	std::vector<HalfImage> halfLevels,halfFeatures;
+	// the wall time in seconds of the last BuildPyramid
+	double pyramidTime,featureTime;
+	FeaturePyramid() {pyramidTime=featureTime=0;};
+	inline int nlevels() const {return pyramid.nlevels();};
+	inline bool IsHalf() const {return !halfLevels.empty();};
+	inline int width(int k) const {return IsHalf() ? halfLevels[k].width() : pyramid.Image(k).width();};
+	inline int height(int k) const {return IsHalf() ? halfLevels[k].height() : pyramid.Image(k).height();};
+	inline int nchannels() const {return IsHalf() ? halfLevels[0].nchannels() : pyramid.Image(0).nchannels();};
+	inline int nFeatureChannels() const {return IsHalf() ? halfFeatures[0].nchannels() : features[0].nchannels();};
+	// the levels and the features converted to half, and their images of T released
+	void compact()
+	{
+		halfLevels.resize(nlevels());
+		halfFeatures.resize(features.size());
+		for(int k=0;k<nlevels();k++)
+			toHalf(halfLevels[k],pyramid.Image(k));
+		for(size_t k=0;k<features.size();k++)
+			toHalf(halfFeatures[k],features[k]);
+	}
+	// level k of the pyramid, or its expansion into scratch when it is in half
+	const Image<T>& level(int k,Image<T>& scratch) const
+	{
+		if(!IsHalf())
+			return pyramid.Image(k);
+		fromHalf(scratch,halfLevels[k]);
+		return scratch;
+	}
+	const Image<T>& feature(int k,Image<T>& scratch) const
+	{
+		if(!IsHalf())
+			return features[k];
+		fromHalf(scratch,halfFeatures[k]);
+		return scratch;
+	}
+	// the bytes of the buffers of the levels and of their features
+	double memory() const
+	{
+		double bytes=0;
+		for(int k=0;k<nlevels();k++)
+			bytes+=(double)pyramid.Image(k).capacity()*sizeof(T);
+		for(size_t k=0;k<features.size();k++)
+			bytes+=(double)features[k].capacity()*sizeof(T);
+		for(size_t k=0;k<halfLevels.size();k++)
+			bytes+=(double)halfLevels[k].capacity()*sizeof(unsigned short);
+		for(size_t k=0;k<halfFeatures.size();k++)
+			bytes+=(double)halfFeatures[k].capacity()*sizeof(unsigned short);
+		return bytes;
+	}
+private:
+	static void toHalf(HalfImage& half,Image<T>& image)
+	{
+		half.allocate(image.width(),image.height(),image.nchannels());
+		FlowKernels::FloatToHalf(half.data(),image.data(),(size_t)image.nelements());
+		image.clear();
+	}
+	static void fromHalf(Image<T>& image,const HalfImage& half)
+	{
+		image.allocate(half.width(),half.height(),half.nchannels());
+		FlowKernels::HalfToFloat(image.data(),half.data(),(size_t)half.nelements());
+	}
+};
 
+//--------------------------------------------------------------------------------------------------------
+// the coarse to fine optical flow solver, templated over the scalar type of the images
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class OpticalFlowT : public OpticalFlowBase
+{
+public:
+	typedef T _FlowPrecision;
+	typedef Image<T> TImage;
+	typedef FlowWorkspace<T> Workspace;
+	typedef FeaturePyramid<T> Pyramid;
+	OpticalFlowT(void);
+	~OpticalFlowT(void);
+public:
+	static void getDxs(TImage& imdx,TImage& imdy,TImage& imdt,const TImage& im1,const TImage& im2,const Parameters& p=parameters);
+	static void getDxs(TImage& imdx,TImage& imdy,TImage& imdt,const TImage& im1,const TImage& im2,Workspace& ws);
+	// getDxs of two images of nChannels planes in the planar layout, the derivatives in the planar layout
+	static void getDxsPlanar(TImage& imdx,TImage& imdy,TImage& imdt,const TImage& planes1,const TImage& planes2,int nChannels,Workspace& ws);
+	// the smoothing of getDxs of one image, through ws.filterTemp
+	static void SmoothDxs(TImage& smooth,const TImage& im,Workspace& ws);
+	// warpFL of Im2 by (vx,vy), genInImageMask and getDxs of Im1 and the warped Im2 fused, ws.smooth1 holding Im1
+	// smoothed by SmoothDxs; with IsWarped warpIm2 is taken as it is
+	static void WarpDxs(TImage& imdx,TImage& imdy,TImage& imdt,TImage& mask,TImage& warpIm2,const TImage& Im1,const TImage& Im2,
+								const TImage& vx,const TImage& vy,bool IsWarped,Workspace& ws);
+	static void SanityCheck(const TImage& imdx,const TImage& imdy,const TImage& imdt,double du,double dv);
+	static void warpFL(TImage& warpIm2,const TImage& Im1,const TImage& Im2,const TImage& vx,const TImage& vy,const Parameters& p=parameters);
+	static void warpFL(TImage& warpIm2,const TImage& Im1,const TImage& Im2,const TImage& flow);
+	// vx and vy resized to width x height and multiplied by scale through foo1 and foo2, by joint bilateral
+	// upsampling when p.upsampleSigma>0 and the guides at the new size and at the size of the flow are given
+	static void ResizeFlow(TImage& vx,TImage& vy,int width,int height,double scale,TImage& foo1,TImage& foo2,const Parameters& p=parameters,
+								  const TImage* guide=NULL,const TImage* srcGuide=NULL);
 
-	static void genConstFlow(DImage& flow,double value,int width,int height);
-	static void genInImageMask(DImage& mask,const DImage& vx,const DImage& vy,int interval = 0);
-	static void genInImageMask(DImage& mask,const DImage& flow,int interval =0 );
-	static void SmoothFlowPDE(const DImage& Im1,const DImage& Im2, DImage& warpIm2,DImage& vx,DImage& vy,
+
+	static void genConstFlow(TImage& flow,double value,int width,int height);
+	static void genInImageMask(TImage& mask,const TImage& vx,const TImage& vy,int interval = 0,const Parameters& p=parameters);
+	static void genInImageMask(TImage& mask,const TImage& flow,int interval =0 ,const Parameters& p=parameters);
+	static void SmoothFlowPDE(const TImage& Im1,const TImage& Im2, TImage& warpIm2,TImage& vx,TImage& vy,
 														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
+	static void SmoothFlowPDE(const TImage& Im1,const TImage& Im2, TImage& warpIm2,TImage& vx,TImage& vy,
+														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
 	
-	static void SmoothFlowSOR(const DImage& Im1,const DImage& Im2, DImage& warpIm2, DImage& vx, DImage& vy,
+	static void SmoothFlowSOR(const TImage& Im1,const TImage& Im2, TImage& warpIm2, TImage& vx, TImage& vy,
 														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nSORIterations);
+	static void SmoothFlowSOR(const TImage& Im1,const TImage& Im2, TImage& warpIm2, TImage& vx, TImage& vy,
+														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nSORIterations,Workspace& ws);
+	// returns the squared change of (du,dv)
+	static inline double SORUpdate(int i,int j,int imWidth,int imHeight,double alpha,double omega,const _FlowPrecision* phiData,
+														const _FlowPrecision* imdxyData,const _FlowPrecision* imdx2Data,const _FlowPrecision* imdy2Data,
+														const _FlowPrecision* imdtdxData,const _FlowPrecision* imdtdyData,_FlowPrecision* duData,_FlowPrecision* dvData,bool IsWrap);
+	// solves the linear system of SmoothFlowSOR for (du,dv) from zero, returns the number of iterations
+	static int SolvePCG(TImage& du,TImage& dv,const TImage& imdxy,const TImage& imdx2,const TImage& imdy2,const TImage& b1,const TImage& b2,
+														const TImage& Phi_1st,double alpha,int nMaxIterations,double tolerance,Workspace& ws,double* relativeResidual=NULL);
+
+	// the weights and the linear system are only computed inside roi if it is not NULL
+	static void RobustPhi(TImage& Phi_1st,const TImage& ux,const TImage& uy,const TImage& vx,const TImage& vy,double varepsilon_phi,
+												const RowSpans* roi=NULL);
+	static void RobustPsi(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+												const GaussianMixture& GMPara,const Vector<double>& LapPara,
+												double varepsilon_psi,bool normalizeLap,const RowSpans* roi=NULL,const Parameters& p=parameters);
+	// RobustPsi of the derivatives of nChannels planes in the planar layout, Psi_1st in the same layout
+	static void RobustPsiPlanar(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+												const GaussianMixture& GMPara,const Vector<double>& LapPara,
+												double varepsilon_psi,bool normalizeLap,int nChannels,const RowSpans* roi=NULL,const Parameters& p=parameters);
+	// the loop of both over the spans of roi, see below for the strides
+	static void RobustPsiSpans(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+												const GaussianMixture& GMPara,const Vector<double>& LapPara,double varepsilon_psi,bool normalizeLap,
+												int nChannels,int pixelStride,int channelStride,const RowSpans* roi,const Parameters& p);
+	// the weight psi of channel k at a residual of 0 and as the residual grows without bound, the range of
+	// the confidence of the flow
+	static void RobustPsiRange(double& peak,double& floor,const GaussianMixture& GMPara,const Vector<double>& LapPara,
+												double varepsilon_psi,int k,const Parameters& p);
+	// the pixels iBegin..iEnd-1 of Psi_1st, which is reset by the caller. Sample k of pixel i is at
+	// i*pixelStride+k*channelStride, (nChannels,1) for the interleaved and (1,nPixels) for the planar layout
+	template <NoiseModel model>
+	static void RobustPsi(TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const TImage& du,const TImage& dv,
+												const GaussianMixture& GMPara,const Vector<double>& LapPara,double varepsilon_psi,bool normalizeLap,
+												int nChannels,int pixelStride,int channelStride,int iBegin,int iEnd,const Parameters& p);
+	// the components of the linear system, psi*imdx*imdy etc. averaged over the channels, in one pass
+	static void AssembleLinearSystem(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+												const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,const RowSpans* roi=NULL);
+	// the same from Psi_1st and the derivatives of nChannels planes in the planar layout
+	static void AssembleLinearSystemPlanar(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+												const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int nChannels,const RowSpans* roi=NULL);
+	static void AssembleLinearSystemSpans(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+												const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int width,int height,int nChannels,
+												bool IsPlanarLayout,const RowSpans* roi);
+	template <int NC,bool IsPlanarLayout>
+	static void AssembleLinearSystemChannels(TImage& imdxy,TImage& imdx2,TImage& imdy2,TImage& imdtdx,TImage& imdtdy,
+												const TImage& Psi_1st,const TImage& imdx,const TImage& imdy,const TImage& imdt,int nChannels,int iBegin,int iEnd);
+	// the spans of the region of interest of ws on a level, dilated by roiDilation. Empty without a region
+	static void BuildLevelROI(Workspace& ws,int width,int height);
 
-	static void estGaussianMixture(const DImage& Im1,const DImage& Im2,GaussianMixture& para,double prior = 0.9);
-	static void estLaplacianNoise(const DImage& Im1,const DImage& Im2,Vector<double>& para);
-	static void Laplacian(DImage& output,const DImage& input,const DImage& weight);
+	static void estGaussianMixture(const TImage& Im1,const TImage& Im2,GaussianMixture& para,double prior = 0.9,const Parameters& p=parameters);
+	static void estLaplacianNoise(const TImage& Im1,const TImage& Im2,Vector<double>& para,const Parameters& p=parameters);
+	static int noiseStride(const TImage& Im1,const Parameters& p=parameters);
+	static int noiseThreads(const TImage& Im1,int stride,const Parameters& p=parameters);
+	static void Laplacian(TImage& output,const TImage& input,const TImage& weight,const Parameters& p=parameters);
+	// the Laplacian of the two flow components in one pass over the weight
+	static void Laplacian(TImage& output1,TImage& output2,const TImage& input1,const TImage& input2,const TImage& weight,const Parameters& p=parameters);
+	// the rows of Laplacian, output2 and input2 NULL for one component
+	static void LaplacianRows(_FlowPrecision* output1,_FlowPrecision* output2,const _FlowPrecision* input1,const _FlowPrecision* input2,
+								const _FlowPrecision* weight,int width,int height,const Parameters& p);
+	// the matrix of Laplacian(output,input,weight) in CSR, a symmetric band of 5 nonzeros per row
+	static void LaplacianMatrix(SparseMatrix<T>& A,const TImage& weight,const Parameters& p=parameters);
 	static void testLaplacian(int dim=3);
 
 	// function of coarse to fine optical flow
-	static void Coarse2FineFlow(DImage& vx,DImage& vy,DImage &warpI2,const DImage& Im1,const DImage& Im2,double alpha,double ratio,int minWidth,
+	static void Coarse2FineFlow(TImage& vx,TImage& vy,TImage &warpI2,const TImage& Im1,const TImage& Im2,double alpha,double ratio,int minWidth,
 															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
+	static void Coarse2FineFlow(TImage& vx,TImage& vy,TImage &warpI2,const TImage& Im1,const TImage& Im2,double alpha,double ratio,int minWidth,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// coarse to fine flow between two prebuilt feature pyramids
+	static void Coarse2FineFlow(TImage& vx,TImage& vy,TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,double alpha,double ratio,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// coarse to fine flow seeded with a prior flow of the full resolution, e.g. the flow of the previous frame pair.
+	// The nSkipLevels coarsest levels are skipped and the downsampled prior is injected at the next one
+	static void Coarse2FineFlow(TImage& vx,TImage& vy,TImage &warpI2,const TImage& Im1,const TImage& Im2,const TImage& priorVx,const TImage& priorVy,
+															double alpha,double ratio,int minWidth,int nSkipLevels,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
+	static void Coarse2FineFlow(TImage& vx,TImage& vy,TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& priorVx,const TImage& priorVy,
+															double alpha,double ratio,int nSkipLevels,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// the solver loop from level startLevel to the finest level. vx and vy hold the flow of startLevel if IsInit is true
+	static void Coarse2FineFlowFrom(TImage& vx,TImage& vy,TImage &warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,double alpha,double ratio,int startLevel,bool IsInit,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// the two steps of Coarse2FineFlowFrom: prepare the workspace, then upsample and solve the flow of level k
+	static void PrepareWorkspace(Pyramid& Pyramid1,Workspace& ws);
+	static void SolveLevel(TImage& vx,TImage& vy,Pyramid& Pyramid1,Pyramid& Pyramid2,double alpha,double ratio,int k,int startLevel,bool IsInit,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// the frame of Pyramid2 warped to the one of Pyramid1 by the flow of the finest level, the last step of Coarse2FineFlowFrom
+	static void WarpFrame(TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& vx,const TImage& vy,Workspace& ws);
+	// SmoothFlowSOR of a level in overlapping bands of rows, see tileRows
+	static void SolveLevelBands(TImage& vx,TImage& vy,const TImage& Image1,const TImage& Image2,double alpha,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws);
+	// the forward flow (vx,vy) from Im1 to Im2 and the backward flow (vxB,vyB) from Im2 to Im1 on the same pyramids,
+	// the two solves interleaved level by level. occlusion is 1 on the pixels of Im1 that fail the forward-backward
+	// consistency check or move out of the image, 0 elsewhere
+	static void Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,const TImage& Im1,const TImage& Im2,
+															double alpha,double ratio,int minWidth,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
+	static void Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,Pyramid& Pyramid1,Pyramid& Pyramid2,
+															double alpha,double ratio,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,Workspace& ws,Workspace& wsB);
+	static void OcclusionMask(TImage& occlusion,const TImage& vx,const TImage& vy,const TImage& vxB,const TImage& vyB,const Parameters& p=parameters);
+	static void BuildPyramid(Pyramid& pyramid,const TImage& im,double ratio,int minWidth,const Parameters& p=parameters);
+	// the bytes Coarse2FineFlow of two frames of width x height x nChannels holds at its peak, from the
+	// dimensions of the levels alone: the frames, the two pyramids with their features, the workspace and the
+	// flow. A dry run for sizing jobs, without the region of interest and the confidence
+	static double predictMemory(int width,int height,int nChannels,double ratio,int minWidth,const Parameters& p=parameters);
+	// the pyramid of an 8 or 16-bit image, the samples divided by divisor as they are converted into the finest level
+	template <class T1>
+	static void BuildPyramid(Pyramid& pyramid,const ::Image<T1>& im,double divisor,double ratio,int minWidth,const Parameters& p=parameters);
 
-	static void Coarse2FineFlowLevel(DImage& vx,DImage& vy,DImage &warpI2,const DImage& Im1,const DImage& Im2,double alpha,double ratio,int nLevels,
+	static void Coarse2FineFlowLevel(TImage& vx,TImage& vy,TImage &warpI2,const TImage& Im1,const TImage& Im2,double alpha,double ratio,int nLevels,
 															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
 
 	// function to convert image to features
-	static void im2feature(DImage& imfeature,const DImage& im);
+	static void im2feature(TImage& imfeature,const TImage& im,const Parameters& p=parameters);
+	static void im2featureRows(TImage& imfeature,const TImage& im,int iBegin,int iEnd,bool IsHorizontalWrap);
 
 	// function to load optical flow
-	static bool LoadOpticalFlow(const char* filename,DImage& flow);
+	static bool LoadOpticalFlow(const char* filename,TImage& flow);
 
-	static bool LoadOpticalFlow(ifstream& myfile,DImage& flow);
+	static bool LoadOpticalFlow(ifstream& myfile,TImage& flow);
 
-	static bool SaveOpticalFlow(const DImage& flow, const char* filename);
+	static bool SaveOpticalFlow(const TImage& flow, const char* filename);
 
-	static bool SaveOpticalFlow(const DImage& flow,ofstream& myfile);
+	static bool SaveOpticalFlow(const TImage& flow,ofstream& myfile);
 
-	static bool showFlow(const DImage& vx,const char* filename);
+	static bool showFlow(const TImage& vx,const char* filename);
 
 	// function to assemble and dissemble flows
-	static void AssembleFlow(const DImage& vx,const DImage& vy,DImage& flow)
+	static void AssembleFlow(const TImage& vx,const TImage& vy,TImage& flow)
 	{
 		if(!flow.matchDimension(vx.width(),vx.height(),2))
 			flow.allocate(vx.width(),vx.height(),2);
@@ -73,7 +569,7 @@ public:
 			flow.data()[i*2+1] = vy.data()[i];
 		}
 	}
-	static void DissembleFlow(const DImage& flow,DImage& vx,DImage& vy)
+	static void DissembleFlow(const TImage& flow,TImage& vx,TImage& vy)
 	{
 		if(!vx.matchDimension(flow.width(),flow.height(),1))
 			vx.allocate(flow.width(),flow.height());
@@ -85,7 +581,7 @@ public:
 			vy.data()[i] = flow.data()[i*2+1];
 		}
 	}
-	static void ComputeOpticalFlow(const DImage& Im1,const DImage& Im2,DImage& flow)
+	static void ComputeOpticalFlow(const TImage& Im1,const TImage& Im2,TImage& flow)
 	{
 		if(!Im1.matchDimension(Im2))
 		{
@@ -102,8 +598,98 @@ public:
 		int nInnerFPIterations=1;
 		int nCGIterations=40;
 
-		DImage vx,vy,warpI2;
-		OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations);
+		TImage vx,vy,warpI2;
+		Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations);
 		AssembleFlow(vx,vy,flow);
 	}
 };
+
+typedef OpticalFlowT<double> OpticalFlow;
+typedef OpticalFlowT<float> FOpticalFlow;
+
+//--------------------------------------------------------------------------------------------------------
+// optical flow of a video: the frames are added one by one and the flow from the previous frame to the
+// new one is returned. Only the pyramids of the last two frames are kept, each is built once
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class OpticalFlowSequence
+{
+public:
+	typedef Image<T> TImage;
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations;
+	// warm start: seed each pair with the flow of the previous pair, skipping the nSkipLevels coarsest levels
+	// and running nWarmOuterFPIterations outer iterations (0 for nOuterFPIterations)
+	bool IsWarmStart;
+	int nSkipLevels,nWarmOuterFPIterations;
+	// classify every pair on the coarsest levels of its pyramids, see ShotClassifier.h: a static pair and a
+	// cut get the flow 0 without a solve, and the pair after a cut isn't warm started
+	bool IsClassified;
+	ShotClassifier<T> classifier;
+private:
+	FeaturePyramid<T> Pyramids[2];
+	FeaturePyramid<T> *pPrev,*pNext;
+	FlowWorkspace<T> ws;
+	TImage priorVx,priorVy;
+	bool IsPrior;
+	typename ShotClassifier<T>::PairType lastType;
+	int nFrames;
+public:
+	OpticalFlowSequence(double _alpha=1,double _ratio=0.5,int _minWidth=40,int _nOuterFPIterations=3,int _nInnerFPIterations=1,int _nSORIterations=20);
+	// returns false for the first frame, when there is no flow yet
+	bool AddFrame(const TImage& frame,TImage& vx,TImage& vy,TImage& warpI2);
+	bool AddFrame(const TImage& frame,TImage& vx,TImage& vy);
+	// the iterations of the last pair
+	inline const std::vector<SolverStatistics>& statistics() const {return ws.statistics;};
+	// the region of interest of the following pairs, see FlowWorkspace::setROI
+	void setROI(const TImage& mask) {ws.setROI(mask);};
+	void clearROI() {ws.clearROI();};
+	void reset() {nFrames=0;};
+	inline int nframes() const {return nFrames;};
+	// the class of the last pair, Moving without IsClassified
+	inline typename ShotClassifier<T>::PairType pairType() const {return lastType;};
+};
+
+typedef OpticalFlowSequence<double> DOpticalFlowSequence;
+typedef OpticalFlowSequence<float> FOpticalFlowSequence;
+
+//--------------------------------------------------------------------------------------------------------
+// a coarse to fine solver that owns its settings, its noise model and its scratch images instead of the
+// static settings of OpticalFlowBase, so that several solvers with different settings run concurrently,
+// one per thread. The static functions of OpticalFlowT are the same solver on OpticalFlowBase::parameters
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class FlowSolver
+{
+public:
+	typedef Image<T> TImage;
+	typedef FeaturePyramid<T> Pyramid;
+	OpticalFlowBase::Parameters parameters;
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations;
+private:
+	// the forward and the backward workspace
+	FlowWorkspace<T> ws,wsB;
+	// the workspace bound to parameters, rebound on every call so that a copied solver uses its own
+	inline FlowWorkspace<T>& workspace(FlowWorkspace<T>& w) {w.pParameters=&parameters;return w;};
+public:
+	FlowSolver(double _alpha=1,double _ratio=0.5,int _minWidth=40,int _nOuterFPIterations=3,int _nInnerFPIterations=1,int _nSORIterations=20);
+	void BuildPyramid(Pyramid& pyramid,const TImage& im) const;
+	void Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,const TImage& Im1,const TImage& Im2);
+	void Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2);
+	// seeded with a prior flow of the full resolution, the nSkipLevels coarsest levels skipped
+	void Coarse2FineFlow(TImage& vx,TImage& vy,TImage& warpI2,Pyramid& Pyramid1,Pyramid& Pyramid2,const TImage& priorVx,const TImage& priorVy,int nSkipLevels);
+	void Coarse2FineFlowBidirectional(TImage& vx,TImage& vy,TImage& vxB,TImage& vyB,TImage& occlusion,const TImage& Im1,const TImage& Im2);
+	// the iterations of the last solve, the forward one of Coarse2FineFlowBidirectional
+	inline const std::vector<SolverStatistics>& statistics() const {return ws.statistics;};
+	void writeStatistics(std::ostream& os) const {ws.writeStatistics(os);};
+	// the region of interest of the following forward solves, see FlowWorkspace::setROI
+	void setROI(const TImage& mask) {ws.setROI(mask);};
+	void clearROI() {ws.clearROI();};
+	// the confidence of the following forward solves, see FlowWorkspace::confidence
+	void setConfidence(bool IsConfidence) {ws.IsConfidence=IsConfidence;};
+	inline const TImage& confidence() const {return ws.confidence;};
+};
+
+typedef FlowSolver<double> DFlowSolver;
+typedef FlowSolver<float> FFlowSolver;
@@ -0,0 +1,406 @@
+#include "OpticalFlowBatch.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef _OPENCV_GPU
+#include "OpticalFlowGPU.h"
+#endif
+
+using namespace std;
+
+template <class T>
+OpticalFlowBatch<T>::OpticalFlowBatch(double _alpha,double _ratio,int _minWidth,int _nOuterFPIterations,int _nInnerFPIterations,int _nSORIterations)
+{
+	alpha=_alpha;
+	ratio=_ratio;
+	minWidth=_minWidth;
+	nOuterFPIterations=_nOuterFPIterations;
+	nInnerFPIterations=_nInnerFPIterations;
+	nSORIterations=_nSORIterations;
+	nThreads=0;
+	memoryBudget=0;
+	IsLatitudeAdaptive=false;
+	IsRotationAligned=false;
+	IsClassified=false;
+	firstPair=lastPair=0;
+	nWarmupPairs=0;
+	chunkPairs=0;
+	keyframeInterval=0;
+	keyframeResidual=0;
+	nDevices=0;
+	workersPerDevice=2;
+	nHostWorkers=0;
+}
+
+template <class T>
+int OpticalFlowBatch<T>::firstLoadedFrame(int start) const
+{
+	int K=__max(keyframeInterval,1);
+	return __max(start-nWarmupPairs,0)/K*K;
+}
+
+template <class T>
+void OpticalFlowBatch<T>::shardRange(int& first,int& last,int nPairs,int k,int n)
+{
+	first=(double)nPairs*k/n;
+	last=(double)nPairs*(k+1)/n;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the ranges of the file may come in any order, from several runs; they are chained from first on
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+int OpticalFlowBatch<T>::resumePair(const string& filename,int first)
+{
+	ifstream file(filename.c_str());
+	vector<pair<int,int> > ranges;
+	int begin,end;
+	while(file>>begin>>end)
+		ranges.push_back(make_pair(begin,end));
+	bool IsExtended=true;
+	while(IsExtended)
+	{
+		IsExtended=false;
+		for(size_t k=0;k<ranges.size();k++)
+			if(ranges[k].first<=first && ranges[k].second>first)
+			{
+				first=ranges[k].second;
+				IsExtended=true;
+			}
+	}
+	return first;
+}
+
+template <class T>
+double OpticalFlowBatch<T>::pairMemory(int width,int height,int nChannels,double ratio,int minWidth)
+{
+	return OpticalFlowT<T>::predictMemory(width,height,nChannels,ratio,minWidth);
+}
+
+template <class T>
+double OpticalFlowBatch<T>::spanMemory(int width,int height,int nChannels,double ratio,int minWidth,int K)
+{
+	return pairMemory(width,height,nChannels,ratio,minWidth)+(double)__max(K-1,0)*(nChannels+2)*width*height*sizeof(T);
+}
+
+template <class T>
+int OpticalFlowBatch<T>::numDevices() const
+{
+#ifdef _OPENCV_GPU
+	if(OpticalFlowBase::backend==OpticalFlowBase::GPU && OpticalFlowGPU::IsAvailable())
+		return (nDevices>0)?__min(nDevices,OpticalFlowGPU::nDevices()):OpticalFlowGPU::nDevices();
+#endif
+	return 0;
+}
+
+template <class T>
+int OpticalFlowBatch<T>::numDeviceWorkers(int nWorkers) const
+{
+	return __min(numDevices()*__max(workersPerDevice,1),nWorkers);
+}
+
+template <class T>
+int OpticalFlowBatch<T>::numWorkers(int width,int height,int nChannels,int nPairs) const
+{
+	int nWorkers=(nThreads>0)?nThreads:OpticalFlowBase::getNumThreads();
+	if(nThreads<=0 && numDevices()>0)
+		nWorkers=numDevices()*__max(workersPerDevice,1)+__max(nHostWorkers,0);
+	if(memoryBudget>0)
+	{
+		int nFit=memoryBudget/spanMemory(width,height,nChannels,ratio,minWidth,__max(keyframeInterval,1));
+		if(nFit<1)
+			cout<<"The memory budget is too small for one frame pair, the pairs are solved one by one!"<<endl;
+		nWorkers=__min(nWorkers,nFit);
+	}
+	return __max(__min(nWorkers,nPairs),1);
+}
+
+template <class T>
+double OpticalFlowBatch<T>::predictMemory(int width,int height,int nChannels,int nPairs) const
+{
+	int K=__max(keyframeInterval,1);
+	return numWorkers(width,height,nChannels,(nPairs+K-1)/K)*spanMemory(width,height,nChannels,ratio,minWidth,K);
+}
+
+template <class T>
+void OpticalFlowBatch<T>::solvePair(TImage& vx,TImage& vy,TImage& warpI2,const TImage& Im1,const TImage& Im2,typename OpticalFlowT<T>::Workspace& ws,
+												PairStatistics& statistics)
+{
+	double R[9];
+	TImage rotatedIm2;
+	bool IsRotated=IsRotationAligned && rotation.estimate(R,Im1,Im2);
+	if(IsRotated)
+		SphereRotation<T>::rotate(rotatedIm2,Im2,R);
+	const TImage& target=IsRotated?rotatedIm2:Im2;
+	if(IsLatitudeAdaptive)
+		equirect.Coarse2FineFlow(vx,vy,warpI2,Im1,target,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+	else
+		OpticalFlowT<T>::Coarse2FineFlow(vx,vy,warpI2,Im1,target,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+	if(IsRotated)
+		SphereRotation<T>::composeFlow(vx,vy,R);
+	statistics.IsSolved=true;
+	statistics.pyramidTime=ws.pyramidTime;
+	statistics.featureTime=ws.featureTime;
+	statistics.levels=ws.statistics;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the pixel x of the first frame of the span is at x+j/n*F(x) at frame j, so the pixel y of frame j comes
+// from about y-j/n*F(y), where it moves by F/n to the next frame
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowBatch<T>::interpolateFlow(TImage& vx,TImage& vy,const TImage& spanVx,const TImage& spanVy,int j,int n)
+{
+	TImage backVx,backVy;
+	backVx=spanVx*(-(double)j/n);
+	backVy=spanVy*(-(double)j/n);
+	OpticalFlowT<T>::warpFL(vx,spanVx,spanVx,backVx,backVy);
+	OpticalFlowT<T>::warpFL(vy,spanVy,spanVy,backVx,backVy);
+	vx.Multiplywith(1.0/n);
+	vy.Multiplywith(1.0/n);
+}
+
+template <class T>
+double OpticalFlowBatch<T>::coarseResidual(const TImage& Im1,const TImage& Im2,const TImage& vx,const TImage& vy)
+{
+	TImage coarse1,coarse2,coarseVx,coarseVy,warpI2;
+	double scale=__min(256.0/Im1.width(),1.0);
+	if(scale<1)
+	{
+		double sigma=1/scale-1;
+		Im1.GaussianSmoothResize(coarse1,sigma,sigma*3,scale,OpticalFlowBase::IsHorizontalWrap);
+		Im2.GaussianSmoothResize(coarse2,sigma,sigma*3,scale,OpticalFlowBase::IsHorizontalWrap);
+		vx.imresize(coarseVx,coarse1.width(),coarse1.height());
+		vy.imresize(coarseVy,coarse1.width(),coarse1.height());
+		coarseVx.Multiplywith((double)coarse1.width()/Im1.width());
+		coarseVy.Multiplywith((double)coarse1.width()/Im1.width());
+	}
+	else
+	{
+		coarse1.copyData(Im1);
+		coarse2.copyData(Im2);
+		coarseVx.copyData(vx);
+		coarseVy.copyData(vy);
+	}
+	OpticalFlowT<T>::warpFL(warpI2,coarse1,coarse2,coarseVx,coarseVy);
+	warpI2=warpI2-coarse1;
+	return sqrt(warpI2.norm2()/__max(warpI2.nelements(),1));
+}
+
+//--------------------------------------------------------------------------------------------------------
+// a span of one pair, or with a cut in it, is solved pair by pair. The flow of a longer span is solved into
+// vxs[n], vys[n] and interpolated into its pairs, the pairs of too large a residual solved again on their
+// own frames. The statistics of the solve of the span are those of its first pair, unless that one is solved
+// again. The static pairs and the cuts get the flow 0, and the motion of the span is spread over its
+// moving pairs only
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowBatch<T>::solveSpan(vector<TImage>& vxs,vector<TImage>& vys,TImage& warpI2,const vector<TImage>& frames,int n,
+												typename OpticalFlowT<T>::Workspace& ws,vector<PairStatistics>& statistics)
+{
+	typedef ShotClassifier<T> Classifier;
+	int width=frames[0].width(),height=frames[0].height(),nMoving=0;
+	bool IsCut=false;
+	for(int j=0;j<n;j++)
+	{
+		statistics[j].IsSolved=false;
+		statistics[j].type=IsClassified?classifier.classify(frames[j],frames[j+1]):Classifier::Moving;
+		IsCut=IsCut || statistics[j].type==Classifier::Cut;
+		if(statistics[j].type==Classifier::Moving)
+			nMoving++;
+		else
+		{
+			vxs[j].allocate(width,height);
+			vys[j].allocate(width,height);
+		}
+	}
+	if(n==1 || IsCut)
+	{
+		for(int j=0;j<n;j++)
+			if(statistics[j].type==Classifier::Moving)
+				solvePair(vxs[j],vys[j],warpI2,frames[j],frames[j+1],ws,statistics[j]);
+		return;
+	}
+	if(nMoving==0)
+		return;
+	solvePair(vxs[n],vys[n],warpI2,frames[0],frames[n],ws,statistics[0]);
+	for(int j=0,m=0;j<n;j++)
+	{
+		if(statistics[j].type!=Classifier::Moving)
+			continue;
+		interpolateFlow(vxs[j],vys[j],vxs[n],vys[n],m++,nMoving);
+		if(keyframeResidual>0 && coarseResidual(frames[j],frames[j+1],vxs[j],vys[j])>keyframeResidual)
+			solvePair(vxs[j],vys[j],warpI2,frames[j],frames[j+1],ws,statistics[j]);
+	}
+}
+
+template <class T>
+bool OpticalFlowBatch<T>::writeStatistics(FlowSink& sink,int index,typename OpticalFlowT<T>::Workspace& ws,PairStatistics& statistics)
+{
+	if(!statistics.IsSolved)
+		return true;
+	ws.pyramidTime=statistics.pyramidTime;
+	ws.featureTime=statistics.featureTime;
+	ws.statistics.swap(statistics.levels);
+	return sink.writeStatistics(index,ws);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the ordered loop hands the flow fields to the sink in order. A thread that finished ahead waits there
+// with its result, so at most one span of flow fields per thread is held at any time. The chunks end at the
+// multiples of chunkPairs, so the chunks of a resumed run line up with the committed ones. The spans of
+// keyframeInterval pairs start at its multiples and are solved whole, the pairs outside [warmup,end) not
+// written, so the flow of a shard or of a resumed run is the same as in one run. Every frame is loaded by
+// both of its pairs, as the sources expect
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+int OpticalFlowBatch<T>::run(FrameSource& source,FlowSink& sink)
+{
+	int nClipPairs=source.nframes()-1;
+	if(nClipPairs<1)
+	{
+		cout<<"At least two frames are needed!"<<endl;
+		return 0;
+	}
+	int end=(lastPair>0)?__min(lastPair,nClipPairs):nClipPairs;
+	int start=firstPair;
+	if(!checkpointFile.empty())
+		start=resumePair(checkpointFile,firstPair);
+	if(start>=end)
+	{
+		cout<<"No pairs to solve from pair "<<start<<" to "<<end<<"!"<<endl;
+		return 0;
+	}
+	int warmup=firstLoadedFrame(start);
+	int K=__max(keyframeInterval,1);
+	int firstSpan=warmup/K,endSpan=(end+K-1)/K;
+	ofstream checkpoint;
+	if(!checkpointFile.empty())
+	{
+		checkpoint.open(checkpointFile.c_str(),ios::out|ios::app);
+		if(!checkpoint.is_open())
+		{
+			cout<<"Fail to open "<<checkpointFile<<"!"<<endl;
+			return 0;
+		}
+	}
+	int width,height,nChannels;
+	if(!source.frameDimension(width,height,nChannels))
+	{
+		cout<<"Fail to load the first frame!"<<endl;
+		return 0;
+	}
+	int nWorkers=numWorkers(width,height,nChannels,endSpan-firstSpan);
+	int nUsedDevices=numDevices(),nDeviceWorkers=numDeviceWorkers(nWorkers);
+	if(OpticalFlowBase::IsDisplay)
+	{
+		cout<<"Solving frame pairs "<<start<<" to "<<end<<" after "<<start-warmup<<" warm-up pairs with "<<nWorkers<<" threads";
+		if(nUsedDevices>0)
+			cout<<", "<<nDeviceWorkers<<" of them on "<<__min(nUsedDevices,nWorkers)<<" CUDA devices";
+		cout<<endl;
+	}
+
+	int nWritten=0,chunkStart=start;
+	volatile bool IsStopped=false;
+#ifdef _OPENMP
+	#pragma omp parallel num_threads(nWorkers)
+#endif
+	{
+		vector<TImage> frames(K+1),vxs(K+1),vys(K+1);
+		vector<PairStatistics> statistics(K);
+		TImage warpI2,mask;
+		typename OpticalFlowT<T>::Workspace ws;
+#if defined(_OPENCV_GPU) && defined(_OPENMP)
+		// the settings of the threads that solve on the CPU next to those of the devices
+		OpticalFlowBase::Parameters hostParameters=OpticalFlowBase::parameters;
+		hostParameters.backend=OpticalFlowBase::CPU;
+		// the first threads bound to the devices in turn, the others on the CPU
+		int thread=omp_get_thread_num();
+		if(thread<nDeviceWorkers)
+			OpticalFlowGPU::setDevice(thread%nUsedDevices);
+		else if(nUsedDevices>0)
+			ws.pParameters=&hostParameters;
+#endif
+#ifdef _OPENMP
+		#pragma omp for ordered schedule(dynamic,1)
+#endif
+		for(int s=firstSpan;s<endSpan;s++)
+		{
+			int first=s*K,n=__min(first+K,nClipPairs)-first;
+			bool IsLoaded=false;
+			if(!IsStopped)
+			{
+#ifdef _OPENMP
+				#pragma omp critical(OpticalFlowBatchSource)
+#endif
+				{
+					IsLoaded=true;
+					for(int j=0;j<n && IsLoaded;j++)
+						IsLoaded=source.loadFrame(first+j,frames[j]) && source.loadFrame(first+j+1,frames[j+1]);
+					if(IsLoaded && !IsLatitudeAdaptive && source.loadMask(first,mask))
+						ws.setROI(mask);
+					else
+						ws.clearROI();
+				}
+				for(int j=1;j<=n && IsLoaded;j++)
+					IsLoaded=frames[0].matchDimension(frames[j]);
+				if(IsLoaded)
+					solveSpan(vxs,vys,warpI2,frames,n,ws,statistics);
+			}
+#ifdef _OPENMP
+			#pragma omp ordered
+#endif
+			for(int j=0;j<n;j++)
+			{
+				int i=first+j;
+				if(IsStopped || i>=end)
+					;
+				else if(!IsLoaded)
+				{
+					cout<<"Fail to load frames "<<first<<" to "<<first+n<<", or their dimensions don't match!"<<endl;
+					IsStopped=true;
+				}
+				else if(statistics[j].type==ShotClassifier<T>::Cut && !sink.cut(i))
+				{
+					cout<<"Fail to cut the flow at frame "<<i<<"!"<<endl;
+					IsStopped=true;
+				}
+				else if(i<start)
+				{
+					if(!sink.warmupFlow(i,vxs[j],vys[j]))
+					{
+						cout<<"Fail to warm up with the flow of frame "<<i<<"!"<<endl;
+						IsStopped=true;
+					}
+				}
+				else if(!writeStatistics(sink,i,ws,statistics[j]) || !sink.writeFlow(i,vxs[j],vys[j]))
+				{
+					cout<<"Fail to write the flow of frame "<<i<<"!"<<endl;
+					IsStopped=true;
+				}
+				else
+				{
+					nWritten++;
+					if(i+1==end || (chunkPairs>0 && (i+1)%chunkPairs==0))
+					{
+						if(!sink.commit(i+1))
+						{
+							cout<<"Fail to commit the flow of frames "<<chunkStart<<" to "<<i+1<<"!"<<endl;
+							IsStopped=true;
+						}
+						else if(checkpoint.is_open())
+							checkpoint<<chunkStart<<" "<<i+1<<endl;
+						chunkStart=i+1;
+					}
+				}
+			}
+		}
+	}
+	return nWritten;
+}
+
+template class OpticalFlowBatch<double>;
+template class OpticalFlowBatch<float>;
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "Image.h"
+#include "OpticalFlow.h"
+#include "OpticalFlowEquirect.h"
+#include "SphereRotation.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// optical flow of all the consecutive frame pairs of a video without MATLAB. The pairs are independent,
+// so they are solved concurrently, one pair per thread with its own workspace. The number of threads is
+// limited by the memory budget, and the flow fields are handed to the sink in the order of the pairs.
+//
+// A long clip is solved in shards of pairs [firstPair,lastPair), each one from a few warm-up pairs before
+// it for the sinks that smooth over time, e.g. the depth. With a checkpoint file the pairs are committed in
+// chunks of chunkPairs: the sink makes them durable, then the range is appended to the file, and a run with
+// the same file resumes after the last committed chunk.
+//
+// With keyframeInterval K the flow is solved only from frame k to frame k+K of the spans of K pairs that
+// start at the multiples of K, and the flow of the pair k+j, k+j+1 between them is the flow of the span
+// divided by K, sampled by warpFL where the pixels of frame k are at frame k+j. For slowly moving cameras that
+// is K times less solving. With keyframeResidual, a pair whose interpolated flow leaves an RMS residual above
+// it on a coarse level of about 256 columns is solved directly instead.
+//
+// With IsRotationAligned the rotation of the camera between the equirectangular frames of a pair is
+// estimated by rotation and Im2 rotated on the sphere before the solve, so the solver only has the parallax
+// left and a larger minWidth may do; the flow handed to the sink is composed back to the flow to Im2.
+//
+// With IsClassified every pair is classified by classifier first. A static pair gets the flow 0 without a
+// solve, and a cut too, handed to the sink with FlowSink::cut so that what it smooths over time restarts
+// with the new shot. A span of keyframeInterval pairs with a cut in it is solved pair by pair
+//
+// With the GPU backend the threads are bound to the CUDA devices in turn, workersPerDevice threads per
+// device, so that the spans are spread over the devices as they are taken and a thread uploading or warping
+// its frames overlaps the solve of another one on the same device. The pairs are independent, so nothing
+// but the frames and the flow of its own pairs crosses between a device and the host. The threads after
+// those of the devices solve on the CPU instead, nHostWorkers more of them when nThreads is 0, so that the
+// cores take spans of their own while the devices solve theirs. As the flow is handed to the sink in order,
+// the device threads wait for a span of a host thread that is still solving, so a host thread pays off when
+// it solves a span in about the time the device threads take to solve one span each
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class OpticalFlowBatch
+{
+public:
+	typedef Image<T> TImage;
+
+	// random access to the frames. The calls are serialized, so the source does not need to be thread safe
+	class FrameSource
+	{
+	public:
+		virtual ~FrameSource() {};
+		virtual int nframes() = 0;
+		virtual bool loadFrame(int index,TImage& frame) = 0;
+		// the dimension of the frames, by default found by loading the first frame
+		virtual bool frameDimension(int& width,int& height,int& nchannels)
+		{
+			TImage frame;
+			if(!loadFrame(0,frame))
+				return false;
+			width=frame.width();
+			height=frame.height();
+			nchannels=frame.nchannels();
+			return true;
+		}
+		// the region of interest of the pair index, index+1 (see FlowWorkspace::setROI); false to solve
+		// the whole frame. Not used with IsLatitudeAdaptive
+		virtual bool loadMask(int,TImage&) {return false;};
+	};
+	// receives the flow from frame index to frame index+1, in increasing order of index
+	class FlowSink
+	{
+	public:
+		virtual ~FlowSink() {};
+		virtual bool writeFlow(int index,const TImage& vx,const TImage& vy) = 0;
+		// the workspace of the pair after its solve, for its statistics; called before writeFlow
+		virtual bool writeStatistics(int,const typename OpticalFlowT<T>::Workspace&) {return true;};
+		// a pair before the first one to write, solved only to warm up the state of the sink
+		virtual bool warmupFlow(int,const TImage&,const TImage&) {return true;};
+		// the pairs before endIndex are final; called after every chunk and after the last pair
+		virtual bool commit(int) {return true;};
+		// pair index is a cut between two shots, whose flow is 0; called before its writeFlow or warmupFlow,
+		// with IsClassified only
+		virtual bool cut(int) {return true;};
+	};
+
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations;
+	int nThreads;				// the number of concurrent pairs, 0 for all cores
+	double memoryBudget;	// the memory in bytes the concurrent pairs may use, 0 for no limit
+	bool IsLatitudeAdaptive;	// solve equirectangular frames on the latitude bands of equirect
+	OpticalFlowEquirect<T> equirect;
+	bool IsRotationAligned;		// rotate Im2 by the rotation of the camera before the solve
+	SphereRotation<T> rotation;
+	bool IsClassified;			// skip the static pairs and the cuts found by classifier
+	ShotClassifier<T> classifier;
+	int firstPair,lastPair;	// the pairs to write, lastPair 0 for all the pairs from firstPair
+	int nWarmupPairs;			// the pairs solved before firstPair, or before the resumed chunk, for the sink only
+	int chunkPairs;				// the pairs of a committed chunk, 0 to commit once after the last pair
+	std::string checkpointFile;	// the committed ranges, one "first end" per line; empty for none
+	int keyframeInterval;		// the pairs of a span solved from its first to its last frame, 0 or 1 to solve every pair
+	double keyframeResidual;	// the coarse residual of an interpolated pair above which it is solved, 0 for never
+	int nDevices;				// the CUDA devices of the GPU backend, 0 for all of them
+	int workersPerDevice;		// the threads per device when nThreads is 0
+	int nHostWorkers;			// with the GPU backend and nThreads 0, the threads that solve on the CPU
+private:
+	// the class and the statistics of the solve of a pair, IsSolved false for a pair that isn't solved
+	struct PairStatistics
+	{
+		typename ShotClassifier<T>::PairType type;
+		bool IsSolved;
+		double pyramidTime,featureTime;
+		std::vector<SolverStatistics> levels;
+	};
+	void solvePair(TImage& vx,TImage& vy,TImage& warpI2,const TImage& Im1,const TImage& Im2,typename OpticalFlowT<T>::Workspace& ws,
+						PairStatistics& statistics);
+	// the flow of the pairs [0,n) of frames, n+1 frames that all have the same dimension
+	void solveSpan(std::vector<TImage>& vxs,std::vector<TImage>& vys,TImage& warpI2,const std::vector<TImage>& frames,int n,
+						typename OpticalFlowT<T>::Workspace& ws,std::vector<PairStatistics>& statistics);
+	// the statistics of a solved pair to the sink through ws, nothing for an interpolated pair
+	static bool writeStatistics(FlowSink& sink,int index,typename OpticalFlowT<T>::Workspace& ws,PairStatistics& statistics);
+public:
+	// the flow of pair j of a span of n pairs whose flow is (spanVx,spanVy)
+	static void interpolateFlow(TImage& vx,TImage& vy,const TImage& spanVx,const TImage& spanVy,int j,int n);
+	// the RMS of Im2 warped by the flow minus Im1 on a level of about 256 columns
+	static double coarseResidual(const TImage& Im1,const TImage& Im2,const TImage& vx,const TImage& vy);
+	OpticalFlowBatch(double _alpha=1,double _ratio=0.5,int _minWidth=40,int _nOuterFPIterations=3,int _nInnerFPIterations=1,int _nSORIterations=20);
+	// returns the number of flow fields written by this run, without the warm-up pairs
+	int run(FrameSource& source,FlowSink& sink);
+	// the first frame that run() loads to write the pairs from start on: nWarmupPairs before start, moved
+	// back to the start of its span with keyframeInterval, whose pairs are warm-up pairs too
+	int firstLoadedFrame(int start) const;
+	// the pairs [first,last) of shard k of n, the pairs of the clip split evenly
+	static void shardRange(int& first,int& last,int nPairs,int k,int n);
+	// the first pair from first on that is not in a committed range of the checkpoint file
+	static int resumePair(const std::string& filename,int first);
+	// estimated memory of one pair in flight: the two frames, their pyramids, the workspace and the flow,
+	// see OpticalFlowT::predictMemory
+	static double pairMemory(int width,int height,int nChannels,double ratio,int minWidth);
+	// with the K-1 more frames and flow fields of a span of K pairs
+	static double spanMemory(int width,int height,int nChannels,double ratio,int minWidth,int K);
+	int numWorkers(int width,int height,int nChannels,int nPairs) const;
+	// the devices the threads are bound to, 0 unless the backend is GPU and a device is present
+	int numDevices() const;
+	// the threads of run() bound to the devices, the first ones of the nWorkers
+	int numDeviceWorkers(int nWorkers) const;
+	// a dry run of run() on nPairs pairs of frames of width x height x nChannels: the bytes of the spans
+	// solved concurrently, to compare with MemoryAccounting::peak() after the run
+	double predictMemory(int width,int height,int nChannels,int nPairs) const;
+};
+
+typedef OpticalFlowBatch<double> DOpticalFlowBatch;
+typedef OpticalFlowBatch<float> FOpticalFlowBatch;
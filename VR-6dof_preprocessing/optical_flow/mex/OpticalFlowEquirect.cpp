@@ -0,0 +1,171 @@
+#include "OpticalFlowEquirect.h"
+#include <math.h>
+
+using namespace std;
+
+template <class T>
+OpticalFlowEquirect<T>::OpticalFlowEquirect(double _sharpness,int _maxDecimation,int _nOverlapRows)
+{
+	sharpness=_sharpness;
+	maxDecimation=_maxDecimation;
+	nOverlapRows=_nOverlapRows;
+}
+
+template <class T>
+int OpticalFlowEquirect<T>::rowDecimation(int row,int height) const
+{
+	double latitude=(0.5-(row+0.5)/height)*3.14159265358979;
+	double c=cos(latitude);
+	int decimation=1;
+	while(decimation*2<=maxDecimation && c*decimation*2<=sharpness)
+		decimation*=2;
+	return decimation;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the rows with the same decimation form a band. A band lower than twice the overlap is merged into its
+// neighbor towards the equator, which has a smaller decimation
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowEquirect<T>::splitBands(vector<Band>& bands,int height) const
+{
+	bands.clear();
+	for(int i=0;i<height;i++)
+	{
+		int decimation=rowDecimation(i,height);
+		if(bands.empty() || bands.back().decimation!=decimation)
+		{
+			Band band;
+			band.top=i;
+			band.height=1;
+			band.decimation=decimation;
+			bands.push_back(band);
+		}
+		else
+			bands.back().height++;
+	}
+	bool IsMerged=true;
+	while(IsMerged && bands.size()>1)
+	{
+		IsMerged=false;
+		for(int k=0;k<(int)bands.size();k++)
+		{
+			if(bands[k].height>=2*nOverlapRows)
+				continue;
+			int n=(bands[k].top+bands[k].height/2<height/2)?k+1:k-1;
+			if(n<0)
+				n=1;
+			if(n>=(int)bands.size())
+				n=bands.size()-2;
+			bands[n].top=__min(bands[n].top,bands[k].top);
+			bands[n].height+=bands[k].height;
+			bands.erase(bands.begin()+k);
+			IsMerged=true;
+			break;
+		}
+	}
+}
+
+template <class T>
+double OpticalFlowEquirect<T>::pixelRatio(int height) const
+{
+	vector<Band> bands;
+	splitBands(bands,height);
+	double nRows=0;
+	for(int k=0;k<(int)bands.size();k++)
+	{
+		int top=__max(bands[k].top-nOverlapRows,0);
+		int bottom=__min(bands[k].top+bands[k].height+nOverlapRows,height);
+		nRows+=(double)(bottom-top)/bands[k].decimation;
+	}
+	return nRows/height;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// crop the rows of a band and decimate them horizontally after a Gaussian smoothing against aliasing
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlowEquirect<T>::decimateBand(TImage& band,const TImage& im,int top,int height,int decimation)
+{
+	TImage rows;
+	im.crop(rows,0,top,im.width(),height);
+	if(decimation==1)
+	{
+		band.copyData(rows);
+		return;
+	}
+	double sigma=decimation*0.5;
+	int fsize=sigma*3;
+	double* gFilter=new double[fsize*2+1];
+	double sum=0;
+	for(int i=-fsize;i<=fsize;i++)
+	{
+		gFilter[i+fsize]=exp(-(double)(i*i)/(sigma*sigma*2));
+		sum+=gFilter[i+fsize];
+	}
+	for(int i=0;i<2*fsize+1;i++)
+		gFilter[i]/=sum;
+	TImage foo;
+	rows.imfilter_h(foo,gFilter,fsize,OpticalFlowBase::IsHorizontalWrap);
+	delete []gFilter;
+	foo.imresize(band,__max(im.width()/decimation,1),height);
+}
+
+template <class T>
+void OpticalFlowEquirect<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2, const TImage &Im1, const TImage &Im2, double alpha, double ratio, int minWidth,
+																		 int nOuterFPIterations, int nInnerFPIterations, int nSORIterations) const
+{
+	Workspace ws;
+	Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+}
+
+template <class T>
+void OpticalFlowEquirect<T>::Coarse2FineFlow(TImage &vx, TImage &vy, TImage &warpI2, const TImage &Im1, const TImage &Im2, double alpha, double ratio, int minWidth,
+																		 int nOuterFPIterations, int nInnerFPIterations, int nSORIterations,Workspace& ws) const
+{
+	int width=Im1.width(),height=Im1.height();
+	vector<Band> bands;
+	splitBands(bands,height);
+
+	vx.setValue(0,width,height,1);
+	vy.setValue(0,width,height,1);
+	TImage band1,band2,bandVx,bandVy,bandWarpI2,fullVx,fullVy;
+	for(int k=0;k<(int)bands.size();k++)
+	{
+		const Band& band=bands[k];
+		int top=__max(band.top-nOverlapRows,0);
+		int bottom=__min(band.top+band.height+nOverlapRows,height);
+		decimateBand(band1,Im1,top,bottom-top,band.decimation);
+		decimateBand(band2,Im2,top,bottom-top,band.decimation);
+		OpticalFlowT<T>::Coarse2FineFlow(bandVx,bandVy,bandWarpI2,band1,band2,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nSORIterations,ws);
+
+		// back to the full width, the horizontal flow is in the pixels of the band
+		bandVx.imresize(fullVx,width,bottom-top);
+		bandVy.imresize(fullVy,width,bottom-top);
+		fullVx.Multiplywith((double)width/band1.width());
+
+		// blend linearly with the neighbors in the overlap, the weights of two bands sum to 1
+		for(int i=top;i<bottom;i++)
+		{
+			double weight=1;
+			if(k>0 && i<band.top+nOverlapRows)
+				weight=(i-band.top+nOverlapRows+0.5)/(2*nOverlapRows);
+			if(k<(int)bands.size()-1 && i>=band.top+band.height-nOverlapRows)
+				weight=(band.top+band.height+nOverlapRows-i-0.5)/(2*nOverlapRows);
+			const T* pVx=fullVx.data()+(i-top)*width;
+			const T* pVy=fullVy.data()+(i-top)*width;
+			T* pDstVx=vx.data()+i*width;
+			T* pDstVy=vy.data()+i*width;
+			for(int j=0;j<width;j++)
+			{
+				pDstVx[j]+=weight*pVx[j];
+				pDstVy[j]+=weight*pVy[j];
+			}
+		}
+	}
+	Im2.warpImageBicubicRef(Im1,warpI2,vx,vy,ws.parameters().IsHorizontalWrap);
+	warpI2.threshold();
+}
+
+template class OpticalFlowEquirect<double>;
+template class OpticalFlowEquirect<float>;
@@ -0,0 +1,156 @@
+#include "OpticalFlowGPU.h"
+#include "OpticalFlow.h"
+#include <opencv2/gpu/gpu.hpp>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------------
+// the device buffers of a thread, and their page-locked host copies through which the frames are uploaded
+// and the flow downloaded by DMA. hostFrame2 holds the frame in frame2, to recognize it as the next frame1
+//--------------------------------------------------------------------------------------------------------
+struct DeviceFrames
+{
+	int device;
+	bool IsFrame2;
+	cv::gpu::CudaMem hostFrame1,hostFrame2,hostU,hostV;
+	cv::gpu::GpuMat frame1,frame2,u,v;
+	DeviceFrames() {device=-1;IsFrame2=false;};
+	// false if mem is allocated again
+	static bool allocate(cv::gpu::CudaMem& mem,int width,int height)
+	{
+		if(mem.cols==width && mem.rows==height)
+			return true;
+		mem.create(height,width,CV_32FC1,cv::gpu::CudaMem::ALLOC_PAGE_LOCKED);
+		return false;
+	}
+};
+
+static thread_local DeviceFrames deviceFrames;
+
+bool OpticalFlowGPU::IsAvailable()
+{
+	return nDevices()>0;
+}
+
+int OpticalFlowGPU::nDevices()
+{
+	static int count=-1;
+	if(count<0)
+		count=cv::gpu::getCudaEnabledDeviceCount();
+	return count;
+}
+
+bool OpticalFlowGPU::setDevice(int device)
+{
+	if(device<0 || device>=nDevices())
+		return false;
+	try
+	{
+		cv::gpu::setDevice(device);
+	}
+	catch(const cv::Exception& e)
+	{
+		cout<<"Fail to use the CUDA device "<<device<<": "<<e.what()<<endl;
+		return false;
+	}
+	return true;
+}
+
+static bool IsSameFrame(const cv::Mat& frame1,const cv::Mat& frame2)
+{
+	if(frame1.size()!=frame2.size())
+		return false;
+	for(int i=0;i<frame1.rows;i++)
+		if(memcmp(frame1.ptr<float>(i),frame2.ptr<float>(i),frame1.cols*sizeof(float))!=0)
+			return false;
+	return true;
+}
+
+template <class T>
+static void toGrayMat(cv::Mat& mat,const Image<T>& im)
+{
+	Image<T> gray;
+	if(im.nchannels()==3)
+		im.desaturate(gray);
+	else if(im.nchannels()==1)
+		gray.copyData(im);
+	mat.create(im.height(),im.width(),CV_32FC1);
+	for(int i=0;i<im.height();i++)
+	{
+		float* pRow=mat.ptr<float>(i);
+		const T* pData=gray.data()+i*im.width();
+		for(int j=0;j<im.width();j++)
+			pRow[j]=pData[j];
+	}
+}
+
+template <class T>
+static void fromMat(Image<T>& im,const cv::Mat& mat)
+{
+	im.allocate(mat.cols,mat.rows,1);
+	for(int i=0;i<mat.rows;i++)
+	{
+		const float* pRow=mat.ptr<float>(i);
+		T* pData=im.data()+i*mat.cols;
+		for(int j=0;j<mat.cols;j++)
+			pData[j]=pRow[j];
+	}
+}
+
+template <class T>
+bool OpticalFlowGPU::Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T>& warpI2,const Image<T>& Im1,const Image<T>& Im2,double alpha,double ratio,int minWidth,
+												int nOuterFPIterations,int nInnerFPIterations,int nSORIterations)
+{
+	// the device solver has no wraparound boundary, and only takes gray or color frames
+	if(OpticalFlowBase::IsHorizontalWrap || !IsAvailable())
+		return false;
+	if(Im1.nchannels()!=1 && Im1.nchannels()!=3)
+		return false;
+	try
+	{
+		// the buffers of another device are dropped, those of this one reused
+		DeviceFrames& d=deviceFrames;
+		int device=cv::gpu::getDevice();
+		if(d.device!=device)
+		{
+			d=DeviceFrames();
+			d.device=device;
+		}
+		int width=Im1.width(),height=Im1.height();
+		DeviceFrames::allocate(d.hostFrame1,width,height);
+		if(!DeviceFrames::allocate(d.hostFrame2,width,height))
+			d.IsFrame2=false;
+		DeviceFrames::allocate(d.hostU,width,height);
+		DeviceFrames::allocate(d.hostV,width,height);
+		cv::Mat frame1=d.hostFrame1.createMatHeader(),frame2=d.hostFrame2.createMatHeader();
+		cv::Mat u=d.hostU.createMatHeader(),v=d.hostV.createMatHeader();
+		toGrayMat(frame1,Im1);
+		if(d.IsFrame2 && IsSameFrame(frame2,frame1))
+			d.frame1.swap(d.frame2);
+		else
+			d.frame1.upload(frame1);
+		toGrayMat(frame2,Im2);
+		d.frame2.upload(frame2);
+		d.IsFrame2=true;
+		cv::gpu::BroxOpticalFlow brox(alpha,1,ratio,nInnerFPIterations,nOuterFPIterations,nSORIterations);
+		brox(d.frame1,d.frame2,d.u,d.v);
+		d.u.download(u);
+		d.v.download(v);
+		fromMat(vx,u);
+		fromMat(vy,v);
+	}
+	catch(const cv::Exception& e)
+	{
+		deviceFrames.IsFrame2=false;
+		cout<<"The GPU flow failed, falling back to the CPU: "<<e.what()<<endl;
+		return false;
+	}
+	Im2.warpImageBicubicRef(Im1,warpI2,vx,vy);
+	warpI2.threshold();
+	return true;
+}
+
+template bool OpticalFlowGPU::Coarse2FineFlow<double>(DImage&,DImage&,DImage&,const DImage&,const DImage&,double,double,int,int,int,int);
+template bool OpticalFlowGPU::Coarse2FineFlow<float>(FImage&,FImage&,FImage&,const FImage&,const FImage&,double,double,int,int,int,int);
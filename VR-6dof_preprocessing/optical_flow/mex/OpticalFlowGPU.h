@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Image.h"
+
+//--------------------------------------------------------------------------------------------------------
+// the CUDA backend of Coarse2FineFlow, compiled with _OPENCV_GPU and the gpu module of OpenCV 2.4.
+// cv::gpu::BroxOpticalFlow minimizes the same energy on the device: the pyramids, the warping and the
+// red-black SOR of every level stay in device memory, and only the frames and the flow are transferred.
+// The parameters map one to one, except that the device solver works on the gray images (the data term
+// of the color channels is dropped), the gradient constancy has the weight 1 of the derivative features
+// and the depth of the pyramid is chosen by OpenCV instead of minWidth.
+//
+// A thread solves on the device it is bound to by setDevice, the current device of CUDA otherwise, so the
+// threads of OpticalFlowBatch spread the pairs over the devices of a node. Every thread keeps its device
+// buffers from one pair to the next, and the second frame of a pair stays on the device: when the next pair
+// of the thread starts from the same frame, as the consecutive pairs of a span do, it isn't uploaded again.
+//--------------------------------------------------------------------------------------------------------
+class OpticalFlowGPU
+{
+public:
+	// whether a CUDA device is present
+	static bool IsAvailable();
+	// the number of CUDA devices
+	static int nDevices();
+	// binds the calling thread to device, in [0,nDevices()); false if it can't be used
+	static bool setDevice(int device);
+	// returns false when the flow can't be computed on the device, and the caller falls back to the CPU
+	template <class T>
+	static bool Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T>& warpI2,const Image<T>& Im1,const Image<T>& Im2,double alpha,double ratio,int minWidth,
+									int nOuterFPIterations,int nInnerFPIterations,int nSORIterations);
+};
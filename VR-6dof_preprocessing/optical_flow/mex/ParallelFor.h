@@ -0,0 +1,56 @@
+#pragma once
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------------
+// the loops of the elementwise operations of Image over the threads of OpenMP. The elements are split in
+// blocks of grainSize elements or more, rounded to whole rows, one block per thread; an image of less than
+// two blocks, or a loop inside a parallel region, e.g. of the pairs of OpticalFlowBatch or of the bands of a
+// solve, runs on the calling thread alone, so the operations never add threads to those already running.
+// nThreads is the number of threads of a loop, 1 to run every loop serially and 0 for the default of OpenMP
+//--------------------------------------------------------------------------------------------------------
+class ParallelFor
+{
+public:
+	static inline int& grainSize() {static int size=65536;return size;};
+	static inline int& nThreads() {static int n=0;return n;};
+
+	// the number of blocks of a loop over n elements of rows of rowLength elements, 1 for a serial loop
+	static inline int numBlocks(long long n,int rowLength=1)
+	{
+#ifdef _OPENMP
+		if(nThreads()==1 || omp_in_parallel())
+			return 1;
+		long long grain=(grainSize()>rowLength)?grainSize():rowLength;
+		long long nBlocks=n/grain;
+		int nTeam=(nThreads()>0)?nThreads():omp_get_max_threads();
+		return (nBlocks<2)?1:(int)((nBlocks<nTeam)?nBlocks:nTeam);
+#else
+		return 1;
+#endif
+	}
+
+	// kernel(begin,end) on the blocks of [0,n), whose boundaries are multiples of rowLength but for the last
+	template <class Kernel>
+	static inline void run(long long n,const Kernel& kernel,int rowLength=1)
+	{
+		int nBlocks=numBlocks(n,rowLength);
+		if(nBlocks<=1)
+		{
+			if(n>0)
+				kernel(0,n);
+			return;
+		}
+		long long nRows=(n+rowLength-1)/rowLength;
+#ifdef _OPENMP
+		#pragma omp parallel for num_threads(nBlocks) schedule(static,1)
+#endif
+		for(int b=0;b<nBlocks;b++)
+		{
+			long long begin=nRows*b/nBlocks*rowLength,end=nRows*(b+1)/nBlocks*rowLength;
+			kernel(begin,(end<n)?end:n);
+		}
+	}
+};
@@ -0,0 +1,335 @@
+#include "PreviewFlow.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+int PreviewFlow::patchSize=8;
+int PreviewFlow::patchStride=4;
+int PreviewFlow::nPatchIterations=12;
+int PreviewFlow::nRefineIterations=5;
+int PreviewFlow::finestLevel=1;
+
+template <class T>
+static void toGray(vector<float>& gray,const Image<T>& im)
+{
+	int nPixels=im.npixels(),nChannels=im.nchannels();
+	gray.resize(nPixels);
+	const T* pData=im.data();
+	for(int i=0;i<nPixels;i++)
+	{
+		double sum=0;
+		for(int k=0;k<nChannels;k++)
+			sum+=pData[i*nChannels+k];
+		gray[i]=(float)(sum/nChannels);
+	}
+}
+
+// bilinear, the columns wrapping around or clamped, the rows clamped
+inline float PreviewFlow::sample(const vector<float>& plane,int width,int height,float x,float y,bool IsHorizontalWrap)
+{
+	y=__min(__max(y,0.f),(float)(height-1));
+	if(IsHorizontalWrap)
+		x-=floor(x/width)*width;
+	else
+		x=__min(__max(x,0.f),(float)(width-1));
+	int x0=__min((int)x,width-1),y0=(int)y;
+	float fx=x-x0,fy=y-y0;
+	int x1=IsHorizontalWrap?(x0+1)%width:__min(x0+1,width-1),y1=__min(y0+1,height-1);
+	const float* pRow0=&plane[y0*width];
+	const float* pRow1=&plane[y1*width];
+	return (pRow0[x0]*(1-fx)+pRow0[x1]*fx)*(1-fy)+(pRow1[x0]*(1-fx)+pRow1[x1]*fx)*fy;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// every level the 2x2 mean of the level below it, with its central differences
+//--------------------------------------------------------------------------------------------------------
+void PreviewFlow::buildPyramid(vector<Level>& pyramid,const vector<float>& gray,int width,int height,int nLevels)
+{
+	pyramid.resize(nLevels);
+	pyramid[0].width=width;
+	pyramid[0].height=height;
+	pyramid[0].image=gray;
+	for(int k=1;k<nLevels;k++)
+	{
+		const Level& fine=pyramid[k-1];
+		Level& level=pyramid[k];
+		level.width=__max(fine.width/2,1);
+		level.height=__max(fine.height/2,1);
+		level.image.resize(level.width*level.height);
+		for(int i=0;i<level.height;i++)
+		{
+			int i0=__min(2*i,fine.height-1),i1=__min(2*i+1,fine.height-1);
+			for(int j=0;j<level.width;j++)
+			{
+				int j0=__min(2*j,fine.width-1),j1=__min(2*j+1,fine.width-1);
+				level.image[i*level.width+j]=(fine.image[i0*fine.width+j0]+fine.image[i0*fine.width+j1]+
+					fine.image[i1*fine.width+j0]+fine.image[i1*fine.width+j1])/4;
+			}
+		}
+	}
+	for(int k=0;k<nLevels;k++)
+	{
+		Level& level=pyramid[k];
+		int w=level.width,h=level.height;
+		level.dx.resize(w*h);
+		level.dy.resize(w*h);
+		for(int i=0;i<h;i++)
+			for(int j=0;j<w;j++)
+			{
+				int left=__max(j-1,0),right=__min(j+1,w-1),up=__max(i-1,0),down=__min(i+1,h-1);
+				level.dx[i*w+j]=(level.image[i*w+right]-level.image[i*w+left])/__max(right-left,1);
+				level.dy[i*w+j]=(level.image[down*w+j]-level.image[up*w+j])/__max(down-up,1);
+			}
+	}
+}
+
+void PreviewFlow::resizeFlow(const vector<float>& u,const vector<float>& v,int width,int height,vector<float>& resizedU,vector<float>& resizedV,
+								int resizedWidth,int resizedHeight,bool IsHorizontalWrap)
+{
+	float scaleX=(float)resizedWidth/width,scaleY=(float)resizedHeight/height;
+	resizedU.resize(resizedWidth*resizedHeight);
+	resizedV.resize(resizedWidth*resizedHeight);
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int i=0;i<resizedHeight;i++)
+		for(int j=0;j<resizedWidth;j++)
+		{
+			float x=(j+0.5f)/scaleX-0.5f,y=(i+0.5f)/scaleY-0.5f;
+			resizedU[i*resizedWidth+j]=sample(u,width,height,x,y,IsHorizontalWrap)*scaleX;
+			resizedV[i*resizedWidth+j]=sample(v,width,height,x,y,IsHorizontalWrap)*scaleY;
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the flow of the patches from the flow at their centers, and its densification
+//--------------------------------------------------------------------------------------------------------
+void PreviewFlow::searchPatches(const Level& level1,const Level& level2,vector<float>& u,vector<float>& v,bool IsHorizontalWrap)
+{
+	int width=level1.width,height=level1.height;
+	int size=__min(patchSize,__min(width,height)),stride=__max(patchStride,1);
+	int nx=(width-size)/stride+1,ny=(height-size)/stride+1;
+	vector<float> patchU(nx*ny),patchV(nx*ny);
+	double n=size*size;
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int py=0;py<ny;py++)
+	{
+		vector<float> residuals(size*size);
+		vector<int> columns(size+1);
+		for(int px=0;px<nx;px++)
+		{
+			int x0=px*stride,y0=py*stride;
+			int center=(y0+size/2)*width+x0+size/2;
+			float initialU=u[center],initialV=v[center],fu=initialU,fv=initialV;
+			// the Hessian of the gradients of the patch without their mean
+			double meanX=0,meanY=0,hxx=0,hxy=0,hyy=0;
+			for(int i=0;i<size;i++)
+				for(int j=0;j<size;j++)
+				{
+					int offset=(y0+i)*width+x0+j;
+					double gx=level1.dx[offset],gy=level1.dy[offset];
+					meanX+=gx;
+					meanY+=gy;
+					hxx+=gx*gx;
+					hxy+=gx*gy;
+					hyy+=gy*gy;
+				}
+			meanX/=n;
+			meanY/=n;
+			hxx-=n*meanX*meanX;
+			hxy-=n*meanX*meanY;
+			hyy-=n*meanY*meanY;
+			double det=hxx*hyy-hxy*hxy;
+			int index=py*nx+px;
+			patchU[index]=fu;
+			patchV[index]=fv;
+			if(det<1E-12)
+				continue;
+			double firstResidual=0,residual=0,step=1;
+			for(int iter=0;iter<=nPatchIterations;iter++)
+			{
+				// the weights of the bilinear samples are the same over the patch
+				float X=x0+fu,Y=y0+fv;
+				int left=(int)floor(X),top=(int)floor(Y);
+				float fx=X-left,fy=Y-top;
+				for(int j=0;j<=size;j++)
+				{
+					int x=left+j;
+					columns[j]=IsHorizontalWrap?((x%width)+width)%width:__min(__max(x,0),width-1);
+				}
+				double mean=0;
+				for(int i=0;i<size;i++)
+				{
+					const float* pRow0=&level2.image[__min(__max(top+i,0),height-1)*width];
+					const float* pRow1=&level2.image[__min(__max(top+i+1,0),height-1)*width];
+					const float* pTemplate=&level1.image[(y0+i)*width+x0];
+					for(int j=0;j<size;j++)
+					{
+						float e=(pRow0[columns[j]]*(1-fx)+pRow0[columns[j+1]]*fx)*(1-fy)+(pRow1[columns[j]]*(1-fx)+pRow1[columns[j+1]]*fx)*fy-pTemplate[j];
+						residuals[i*size+j]=e;
+						mean+=e;
+					}
+				}
+				mean/=n;
+				double bx=0,by=0;
+				residual=0;
+				for(int i=0;i<size;i++)
+					for(int j=0;j<size;j++)
+					{
+						int offset=(y0+i)*width+x0+j;
+						double e=residuals[i*size+j]-mean;
+						residual+=e*e;
+						bx+=(level1.dx[offset]-meanX)*e;
+						by+=(level1.dy[offset]-meanY)*e;
+					}
+				if(iter==0)
+					firstResidual=residual;
+				if(iter==nPatchIterations || step<1E-4)
+					break;
+				double du=(hyy*bx-hxy*by)/det,dv=(hxx*by-hxy*bx)/det;
+				fu-=du;
+				fv-=dv;
+				step=du*du+dv*dv;
+			}
+			if(residual<firstResidual)
+			{
+				patchU[index]=fu;
+				patchV[index]=fv;
+			}
+		}
+	}
+	// every pixel the mean of the flow of the patches over it weighted by their inverse residual, in gray
+	// levels of 8 bits; the pixels of no patch keep their flow
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int y=0;y<height;y++)
+	{
+		int pyBegin=(y-size+1<=0)?0:(y-size+stride)/stride,pyEnd=__min(y/stride,ny-1);
+		for(int x=0;x<width;x++)
+		{
+			int pxBegin=(x-size+1<=0)?0:(x-size+stride)/stride,pxEnd=__min(x/stride,nx-1);
+			double sumWeight=0,sumU=0,sumV=0;
+			float i1=level1.image[y*width+x];
+			for(int py=pyBegin;py<=pyEnd;py++)
+				for(int px=pxBegin;px<=pxEnd;px++)
+				{
+					float pu=patchU[py*nx+px],pv=patchV[py*nx+px];
+					double d=fabs(sample(level2.image,width,height,x+pu,y+pv,IsHorizontalWrap)-i1)*255;
+					double weight=1/__max(d,1.0);
+					sumWeight+=weight;
+					sumU+=weight*pu;
+					sumV+=weight*pv;
+				}
+			if(sumWeight>0)
+			{
+				u[y*width+x]=(float)(sumU/sumWeight);
+				v[y*width+x]=(float)(sumV/sumWeight);
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the Jacobi iterations of the brightness constancy linearized at the flow of the patches, weighted by the
+// derivative of the Charbonnier penalty of its residual there, and of the smoothness of weight alpha
+//--------------------------------------------------------------------------------------------------------
+void PreviewFlow::refine(const Level& level1,const Level& level2,vector<float>& u,vector<float>& v,double alpha,bool IsHorizontalWrap)
+{
+	int width=level1.width,height=level1.height,nPixels=width*height;
+	vector<float> ix(nPixels),iy(nPixels),it(nPixels),phi(nPixels),u0(u),v0(v),nextU(nPixels),nextV(nPixels);
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int y=0;y<height;y++)
+		for(int x=0;x<width;x++)
+		{
+			int offset=y*width+x;
+			float X=x+u0[offset],Y=y+v0[offset];
+			ix[offset]=sample(level2.dx,width,height,X,Y,IsHorizontalWrap);
+			iy[offset]=sample(level2.dy,width,height,X,Y,IsHorizontalWrap);
+			it[offset]=sample(level2.image,width,height,X,Y,IsHorizontalWrap)-level1.image[offset];
+			phi[offset]=(float)(0.5/sqrt((double)it[offset]*it[offset]+1E-6));
+		}
+	float lambda=(float)(4*alpha);
+	for(int iter=0;iter<nRefineIterations;iter++)
+	{
+#ifdef _OPENMP
+		#pragma omp parallel for
+#endif
+		for(int y=0;y<height;y++)
+		{
+			int up=__max(y-1,0),down=__min(y+1,height-1);
+			for(int x=0;x<width;x++)
+			{
+				int left=(x>0)?x-1:(IsHorizontalWrap?width-1:x),right=(x<width-1)?x+1:(IsHorizontalWrap?0:x);
+				int offset=y*width+x;
+				float meanU=(u[y*width+left]+u[y*width+right]+u[up*width+x]+u[down*width+x])/4;
+				float meanV=(v[y*width+left]+v[y*width+right]+v[up*width+x]+v[down*width+x])/4;
+				float r=it[offset]+ix[offset]*(meanU-u0[offset])+iy[offset]*(meanV-v0[offset]);
+				float w=phi[offset]/(lambda+phi[offset]*(ix[offset]*ix[offset]+iy[offset]*iy[offset]));
+				nextU[offset]=meanU-w*ix[offset]*r;
+				nextV[offset]=meanV-w*iy[offset]*r;
+			}
+		}
+		u.swap(nextU);
+		v.swap(nextV);
+	}
+}
+
+template <class T>
+void PreviewFlow::Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T>& warpI2,const Image<T>& Im1,const Image<T>& Im2,double alpha,int minWidth,
+									bool IsHorizontalWrap)
+{
+	int width=Im1.width(),height=Im1.height();
+	vector<float> gray1,gray2;
+	toGray(gray1,Im1);
+	toGray(gray2,Im2);
+	int minSize=__max(minWidth,2*patchSize),nLevels=1;
+	while((width>>nLevels)>=minSize && (height>>nLevels)>=2*patchSize)
+		nLevels++;
+	int finest=__min(__max(finestLevel,0),nLevels-1);
+	vector<Level> pyramid1,pyramid2;
+	buildPyramid(pyramid1,gray1,width,height,nLevels);
+	buildPyramid(pyramid2,gray2,width,height,nLevels);
+	vector<float> u,v,resizedU,resizedV;
+	for(int k=nLevels-1;k>=finest;k--)
+	{
+		const Level& level1=pyramid1[k];
+		const Level& level2=pyramid2[k];
+		if(k==nLevels-1)
+		{
+			u.assign(level1.width*level1.height,0);
+			v.assign(level1.width*level1.height,0);
+		}
+		else
+		{
+			resizeFlow(u,v,pyramid1[k+1].width,pyramid1[k+1].height,resizedU,resizedV,level1.width,level1.height,IsHorizontalWrap);
+			u.swap(resizedU);
+			v.swap(resizedV);
+		}
+		searchPatches(level1,level2,u,v,IsHorizontalWrap);
+		refine(level1,level2,u,v,alpha,IsHorizontalWrap);
+	}
+	if(finest>0)
+	{
+		resizeFlow(u,v,pyramid1[finest].width,pyramid1[finest].height,resizedU,resizedV,width,height,IsHorizontalWrap);
+		u.swap(resizedU);
+		v.swap(resizedV);
+	}
+	vx.allocate(width,height);
+	vy.allocate(width,height);
+	for(int i=0;i<width*height;i++)
+	{
+		vx.data()[i]=u[i];
+		vy.data()[i]=v[i];
+	}
+	Im2.warpImageBicubicRef(Im1,warpI2,vx,vy,IsHorizontalWrap);
+	warpI2.threshold();
+}
+
+template void PreviewFlow::Coarse2FineFlow<double>(DImage&,DImage&,DImage&,const DImage&,const DImage&,double,int,bool);
+template void PreviewFlow::Coarse2FineFlow<float>(FImage&,FImage&,FImage&,const FImage&,const FImage&,double,int,bool);
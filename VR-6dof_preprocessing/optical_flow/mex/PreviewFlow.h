@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Image.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the Preview backend of Coarse2FineFlow: the dense inverse search of Kroeger et al. on a pyramid of factor
+// 2 of the gray frames, for previews of the depth in tens of ms per pair of 2K frames before the variational
+// pass. On every level from the coarsest down to finestLevel, a patch of patchSize pixels every patchStride
+// pixels refines the flow of the level above at its center by inverse compositional Gauss-Newton, the
+// gradients and the Hessian of the patch of the first frame computed once, the residual of the second frame
+// without its mean. A patch keeps its initial flow when its residual grows. The patches are averaged into the
+// dense flow of the level, every patch weighted by the inverse of its residual at the pixel, then refined by
+// a few Jacobi iterations of the linearized brightness constancy with a smoothness of weight alpha. The flow
+// of finestLevel is upsampled bilinearly to the frames, and nothing of Parameters but IsHorizontalWrap is used
+//--------------------------------------------------------------------------------------------------------
+class PreviewFlow
+{
+public:
+	static int patchSize;			// the side of a patch, 8
+	static int patchStride;			// between the patches, 4
+	static int nPatchIterations;	// of Gauss-Newton of a patch, 12
+	static int nRefineIterations;	// of the variational refinement of a level, 5
+	static int finestLevel;			// the level of finest flow, 1 of half the size of the frames
+private:
+	struct Level
+	{
+		int width,height;
+		std::vector<float> image,dx,dy;
+	};
+	static inline float sample(const std::vector<float>& plane,int width,int height,float x,float y,bool IsHorizontalWrap);
+	static void resizeFlow(const std::vector<float>& u,const std::vector<float>& v,int width,int height,std::vector<float>& resizedU,
+								std::vector<float>& resizedV,int resizedWidth,int resizedHeight,bool IsHorizontalWrap);
+	static void buildPyramid(std::vector<Level>& pyramid,const std::vector<float>& gray,int width,int height,int nLevels);
+	static void searchPatches(const Level& level1,const Level& level2,std::vector<float>& u,std::vector<float>& v,bool IsHorizontalWrap);
+	static void refine(const Level& level1,const Level& level2,std::vector<float>& u,std::vector<float>& v,double alpha,bool IsHorizontalWrap);
+public:
+	template <class T>
+	static void Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T>& warpI2,const Image<T>& Im1,const Image<T>& Im2,double alpha,int minWidth,
+									bool IsHorizontalWrap);
+};
@@ -0,0 +1,134 @@
+#include "RawImage.h"
+#include <cstring>
+#include <iostream>
+
+#ifdef _LINUX_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace std;
+
+const char RawImage::magic[8] = {'R','A','W','I','M','A','G','E'};
+
+bool RawImage::IsRawFile(const char* filename,Sample* pSample)
+{
+	const char* extension=strrchr(filename,'.');
+	if(extension==NULL)
+		return false;
+	Sample sample;
+	if(strcmp(extension,".raw8")==0)
+		sample=UInt8;
+	else if(strcmp(extension,".rawh")==0)
+		sample=Float16;
+	else if(strcmp(extension,".rawf")==0)
+		sample=Float32;
+	else
+		return false;
+	if(pSample!=NULL)
+		*pSample=sample;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the reader
+//--------------------------------------------------------------------------------------------------------
+RawImageReader::RawImageReader()
+{
+	pData=NULL;
+	fileSize=0;
+	pHeader=NULL;
+#ifdef _LINUX_MAC
+	fd=-1;
+#else
+	hFile=hMapping=NULL;
+#endif
+}
+
+bool RawImageReader::open(const char* filename)
+{
+	close();
+#ifdef _LINUX_MAC
+	fd=::open(filename,O_RDONLY);
+	struct stat status;
+	if(fd<0 || fstat(fd,&status)!=0)
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	fileSize=status.st_size;
+	void* pMapped=(fileSize>0)?mmap(NULL,fileSize,PROT_READ,MAP_SHARED,fd,0):MAP_FAILED;
+	if(pMapped==MAP_FAILED)
+	{
+		cout<<"Fail to map "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	pData=(const unsigned char*)pMapped;
+#else
+	hFile=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if(hFile==INVALID_HANDLE_VALUE)
+		hFile=NULL;
+	LARGE_INTEGER size;
+	if(hFile==NULL || !GetFileSizeEx(hFile,&size))
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+	fileSize=size.QuadPart;
+	hMapping=(fileSize>0)?CreateFileMappingA(hFile,NULL,PAGE_READONLY,0,0,NULL):NULL;
+	pData=(hMapping!=NULL)?(const unsigned char*)MapViewOfFile(hMapping,FILE_MAP_READ,0,0,0):NULL;
+	if(pData==NULL)
+	{
+		cout<<"Fail to map "<<filename<<"!"<<endl;
+		close();
+		return false;
+	}
+#endif
+
+	const Header* header=(const Header*)pData;
+	if(fileSize<sizeof(Header) || memcmp(header->magic,magic,8)!=0 || header->version!=version || header->sample>Float32)
+	{
+		cout<<filename<<" is not a raw image!"<<endl;
+		close();
+		return false;
+	}
+	uint64_t nBytes=(uint64_t)header->width*header->height*header->nChannels*sampleSize((Sample)header->sample);
+	if(fileSize-sizeof(Header)<nBytes)
+	{
+		cout<<filename<<" is truncated!"<<endl;
+		close();
+		return false;
+	}
+	pHeader=header;
+	return true;
+}
+
+void RawImageReader::close()
+{
+#ifdef _LINUX_MAC
+	if(pData!=NULL)
+		munmap((void*)pData,fileSize);
+	if(fd>=0)
+		::close(fd);
+	fd=-1;
+#else
+	if(pData!=NULL)
+		UnmapViewOfFile(pData);
+	if(hMapping!=NULL)
+		CloseHandle(hMapping);
+	if(hFile!=NULL)
+		CloseHandle(hFile);
+	hFile=hMapping=NULL;
+#endif
+	pData=NULL;
+	fileSize=0;
+	pHeader=NULL;
+}
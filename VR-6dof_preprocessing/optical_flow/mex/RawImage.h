@@ -0,0 +1,172 @@
+#pragma once
+
+#include "FlowKernels.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <typeinfo>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// an uncompressed image file for the intermediate frames, flows and depths of the pipeline, read and
+// written by ImageIO by the extension of the file: .raw8 stores 8-bit samples, .rawh IEEE half and .rawf
+// float32. The header of 64 bytes is followed by the samples, interleaved as those of Image or planar, one
+// channel after the other, so that a reader maps the file and takes the samples in place instead of
+// decoding them. The samples of .rawh and .rawf are the values of the image as they are, those of .raw8 the
+// values of floating point images times 255 as in the 8-bit images of ImageIO. The file is little endian
+//--------------------------------------------------------------------------------------------------------
+class RawImage
+{
+public:
+	enum Sample {UInt8=0,Float16=1,Float32=2};
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t width,height,nChannels;
+		uint32_t sample;
+		uint32_t IsPlanar;
+		uint32_t reserved[8];
+	};
+	static const char magic[8];
+	static const uint32_t version = 1;
+	static int sampleSize(Sample sample) {return (sample==Float32)?4:((sample==Float16)?2:1);};
+	// whether filename has one of the extensions of the format, and the samples of the extension
+	static bool IsRawFile(const char* filename,Sample* pSample=NULL);
+	template <class T>
+	static bool write(const char* filename,const T* pImagePlane,int width,int height,int nChannels,Sample sample,bool IsPlanar=false);
+};
+
+//--------------------------------------------------------------------------------------------------------
+// maps the whole file into memory; samples() are the stored samples in place, read() converts them into
+// an interleaved image plane of T
+//--------------------------------------------------------------------------------------------------------
+class RawImageReader : public RawImage
+{
+private:
+	const unsigned char* pData;
+	size_t fileSize;
+	const Header* pHeader;
+#ifdef _LINUX_MAC
+	int fd;
+#else
+	void *hFile,*hMapping;
+#endif
+public:
+	RawImageReader();
+	~RawImageReader() {close();};
+	bool open(const char* filename);
+	void close();
+	inline bool IsOpen() const {return pHeader!=NULL;};
+	inline int width() const {return pHeader->width;};
+	inline int height() const {return pHeader->height;};
+	inline int nchannels() const {return pHeader->nChannels;};
+	inline Sample sample() const {return (Sample)pHeader->sample;};
+	inline bool IsPlanar() const {return pHeader->IsPlanar!=0;};
+	inline const void* samples() const {return pData+sizeof(Header);};
+	// pImagePlane holds width*height*nchannels elements
+	template <class T>
+	bool read(T* pImagePlane) const;
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the writer, the samples converted one row or one channel of a row at a time
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+bool RawImage::write(const char* filename,const T* pImagePlane,int width,int height,int nChannels,Sample sample,bool IsPlanar)
+{
+	std::ofstream file(filename,std::ios::out|std::ios::binary|std::ios::trunc);
+	if(!file.is_open())
+	{
+		std::cout<<"Fail to open "<<filename<<"!"<<std::endl;
+		return false;
+	}
+	Header header;
+	memset(&header,0,sizeof(Header));
+	memcpy(header.magic,magic,8);
+	header.version=version;
+	header.width=width;
+	header.height=height;
+	header.nChannels=nChannels;
+	header.sample=sample;
+	header.IsPlanar=IsPlanar?1:0;
+	file.write((const char*)&header,sizeof(Header));
+
+	bool IsFloat=(typeid(T)==typeid(double) || typeid(T)==typeid(float));
+	int nPlanes=IsPlanar?nChannels:1,nRowElements=IsPlanar?width:width*nChannels;
+	std::vector<float> values(nRowElements);
+	std::vector<char> buffer((size_t)nRowElements*sampleSize(sample));
+	for(int c=0;c<nPlanes;c++)
+		for(int i=0;i<height;i++)
+		{
+			const T* pRow=pImagePlane+(size_t)i*width*nChannels;
+			for(int j=0;j<nRowElements;j++)
+				values[j]=IsPlanar?(float)pRow[j*nChannels+c]:(float)pRow[j];
+			switch(sample)
+			{
+			case UInt8:
+				for(int j=0;j<nRowElements;j++)
+				{
+					float value=IsFloat?values[j]*255+0.5f:values[j];
+					buffer[j]=(unsigned char)((value<0)?0:((value>255)?255:value));
+				}
+				break;
+			case Float16:
+				FlowKernels::FloatToHalf((uint16_t*)&buffer[0],&values[0],nRowElements);
+				break;
+			case Float32:
+				memcpy(&buffer[0],&values[0],buffer.size());
+				break;
+			}
+			file.write(&buffer[0],buffer.size());
+		}
+	return file.good();
+}
+
+template <class T>
+bool RawImageReader::read(T* pImagePlane) const
+{
+	if(!IsOpen())
+		return false;
+	int nChannels=nchannels(),nPlanes=IsPlanar()?nChannels:1,nRowElements=IsPlanar()?width():width()*nChannels;
+	bool IsFloat=(typeid(T)==typeid(double) || typeid(T)==typeid(float));
+	std::vector<float> values(nRowElements);
+	const unsigned char* pSamples=(const unsigned char*)samples();
+	size_t rowBytes=(size_t)nRowElements*sampleSize(sample());
+	for(int c=0;c<nPlanes;c++)
+		for(int i=0;i<height();i++)
+		{
+			const unsigned char* pRow=pSamples+((size_t)c*height()+i)*rowBytes;
+			T* pDstRow=pImagePlane+(size_t)i*width()*nChannels;
+			// a float32 file read as float and interleaved is copied as it is
+			if(sample()==Float32 && !IsPlanar() && typeid(T)==typeid(float))
+			{
+				memcpy(pDstRow,pRow,rowBytes);
+				continue;
+			}
+			switch(sample())
+			{
+			case UInt8:
+				for(int j=0;j<nRowElements;j++)
+					values[j]=IsFloat?(float)pRow[j]/255:pRow[j];
+				break;
+			case Float16:
+				FlowKernels::HalfToFloat(&values[0],(const uint16_t*)pRow,nRowElements);
+				break;
+			case Float32:
+				memcpy(&values[0],pRow,rowBytes);
+				break;
+			}
+			if(!IsFloat && sample()!=UInt8)
+				for(int j=0;j<nRowElements;j++)
+					values[j]=(values[j]<0)?0:((values[j]>1)?255:values[j]*255+0.5f);
+			for(int j=0;j<nRowElements;j++)
+				if(IsPlanar())
+					pDstRow[j*nChannels+c]=(T)values[j];
+				else
+					pDstRow[j]=(T)values[j];
+		}
+	return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------------
+// sums over the elements of images and vectors that are the same for any number of threads, so that the
+// parallel solves are reproducible. The elements are summed in blocks whose size only depends on n, each one
+// in a fixed order, and the sums of the blocks pairwise; the threads only decide which blocks they compute.
+// There are at most maxBlocks blocks, so up to maxSums sums of the blocks are kept on the stack and such a
+// reduction allocates nothing
+//--------------------------------------------------------------------------------------------------------
+class Reduction
+{
+public:
+	static const int defaultBlockSize=4096;
+	static const int maxBlocks=256;
+	static const int maxSums=8;
+
+	// the sum of term(i) over [begin,end) in 4 lanes of a fixed order, which the compiler can vectorize
+	template <class Term>
+	static inline double sum(int begin,int end,const Term& term);
+
+	// the pairwise sum of n values stride apart
+	static inline double pairwise(const double* values,int n,int stride=1);
+
+	// nSums sums over [0,n). kernel(begin,end,sums) adds the terms of the block [begin,end) to sums,
+	// which start at 0, and may update the elements of the block in the same pass. The blocks have blockSize
+	// elements or more when n needs more than maxBlocks of them. nThreads is the number of threads of the loop
+	// over the blocks, 1 for serial and 0 for the default of OpenMP; it doesn't change the sums
+	template <class Kernel>
+	static void reduce(int n,int nSums,double* sums,const Kernel& kernel,int nThreads,int blockSize=defaultBlockSize);
+};
+
+template <class Term>
+inline double Reduction::sum(int begin,int end,const Term& term)
+{
+	double lanes[4]={0,0,0,0};
+	int i=begin;
+	for(;i+4<=end;i+=4)
+	{
+		lanes[0]+=term(i);
+		lanes[1]+=term(i+1);
+		lanes[2]+=term(i+2);
+		lanes[3]+=term(i+3);
+	}
+	for(;i<end;i++)
+		lanes[0]+=term(i);
+	return (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+}
+
+inline double Reduction::pairwise(const double* values,int n,int stride)
+{
+	if(n<=8)
+	{
+		double result=0;
+		for(int i=0;i<n;i++)
+			result+=values[(size_t)i*stride];
+		return result;
+	}
+	int half=n/2;
+	return pairwise(values,half,stride)+pairwise(values+(size_t)half*stride,n-half,stride);
+}
+
+template <class Kernel>
+void Reduction::reduce(int n,int nSums,double* sums,const Kernel& kernel,int nThreads,int blockSize)
+{
+	for(int s=0;s<nSums;s++)
+		sums[s]=0;
+	if(n>(long long)blockSize*maxBlocks)
+		blockSize=(n+maxBlocks-1)/maxBlocks;
+	int nBlocks=(n+blockSize-1)/blockSize;
+	if(nBlocks<=1)
+	{
+		if(n>0)
+			kernel(0,n,sums);
+		return;
+	}
+	double stackPartials[maxBlocks*maxSums];
+	std::vector<double> heapPartials;
+	double* partials=stackPartials;
+	if(nSums>maxSums)
+	{
+		heapPartials.resize((size_t)nBlocks*nSums);
+		partials=&heapPartials[0];
+	}
+	for(int i=0;i<nBlocks*nSums;i++)
+		partials[i]=0;
+#ifdef _OPENMP
+	int nTeam=(nThreads>0)?nThreads:omp_get_max_threads();
+	#pragma omp parallel for num_threads(nTeam) schedule(static) if(nThreads!=1)
+#endif
+	for(int b=0;b<nBlocks;b++)
+	{
+		int begin=b*blockSize,end=(b+1<nBlocks)?begin+blockSize:n;
+		kernel(begin,end,partials+b*nSums);
+	}
+	for(int s=0;s<nSums;s++)
+		sums[s]=pairwise(&partials[s],nBlocks,nSums);
+}
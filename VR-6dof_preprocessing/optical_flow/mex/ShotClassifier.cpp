@@ -0,0 +1,84 @@
+#include "ShotClassifier.h"
+#include <math.h>
+
+using namespace std;
+
+template <class T>
+ShotClassifier<T>::ShotClassifier(int _levelWidth,int _nBins,double _cutDistance,double _staticResidual)
+{
+	levelWidth=_levelWidth;
+	nBins=_nBins;
+	cutDistance=_cutDistance;
+	staticResidual=_staticResidual;
+}
+
+template <class T>
+const char* ShotClassifier<T>::name(PairType type)
+{
+	switch(type)
+	{
+	case Static:
+		return "static";
+	case Cut:
+		return "cut";
+	default:
+		return "moving";
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the gray levels are quantized into the indices of their bins, which histogramRegion counts over the level
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void ShotClassifier<T>::histogram(Vector<double>& histogram,const TImage& gray) const
+{
+	TImage bins(gray.width(),gray.height());
+	for(int i=0;i<gray.npixels();i++)
+		bins.data()[i]=__max(__min((int)(gray.data()[i]*nBins),nBins-1),0);
+	Vector<double> counts=bins.template histogramRegion<double>(nBins,0,0,gray.width(),gray.height());
+	histogram.swap(counts);
+	double sum=histogram.sum();
+	if(sum>0)
+		for(int k=0;k<nBins;k++)
+			histogram[k]/=sum;
+}
+
+template <class T>
+typename ShotClassifier<T>::PairType ShotClassifier<T>::classifyLevels(const TImage& level1,const TImage& level2) const
+{
+	if(!level1.matchDimension(level2) || level1.npixels()==0)
+		return Moving;
+	TImage gray1,gray2;
+	level1.desaturate(gray1);
+	level2.desaturate(gray2);
+	Vector<double> histogram1,histogram2;
+	histogram(histogram1,gray1);
+	histogram(histogram2,gray2);
+	double distance=0;
+	for(int k=0;k<nBins;k++)
+		distance+=fabs(histogram1[k]-histogram2[k]);
+	if(distance>cutDistance)
+		return Cut;
+	gray1=gray2-gray1;
+	if(sqrt(gray1.norm2()/gray1.npixels())<staticResidual)
+		return Static;
+	return Moving;
+}
+
+template <class T>
+typename ShotClassifier<T>::PairType ShotClassifier<T>::classify(const TImage& Im1,const TImage& Im2) const
+{
+	if(!Im1.matchDimension(Im2))
+		return Moving;
+	double scale=(double)levelWidth/Im1.width();
+	if(scale>=1)
+		return classifyLevels(Im1,Im2);
+	TImage level1,level2;
+	double sigma=1/scale-1;
+	Im1.GaussianSmoothResize(level1,sigma,sigma*3,scale);
+	Im2.GaussianSmoothResize(level2,sigma,sigma*3,scale);
+	return classifyLevels(level1,level2);
+}
+
+template class ShotClassifier<double>;
+template class ShotClassifier<float>;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Image.h"
+
+//--------------------------------------------------------------------------------------------------------
+// a cheap test of a frame pair before its flow, on gray levels of a few tens of columns such as the
+// coarsest levels of the pyramids of the pair. A pair is a Cut when the histograms of the levels, nBins
+// bins of histogramRegion normalized to 1, are more than cutDistance apart in L1 (0 to 2): the histogram
+// doesn't change much with the motion of the camera, while a cut to another shot changes it. A pair is
+// Static when the RMS difference of the levels is below staticResidual, the intensities being in [0,1]:
+// the smoothing of the coarse level averages the noise of the sensor out, so only a still shot is that
+// close. A cut is neither warm started nor interpolated, and the flow of a cut or of a static pair is 0
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class ShotClassifier
+{
+public:
+	typedef Image<T> TImage;
+	enum PairType {Moving=0,Static=1,Cut=2};
+
+	int levelWidth;			// the columns of the levels that classify() makes of the frames
+	int nBins;
+	double cutDistance;
+	double staticResidual;
+public:
+	ShotClassifier(int _levelWidth=64,int _nBins=32,double _cutDistance=0.6,double _staticResidual=0.002);
+	// the pair of two frames of the same dimension
+	PairType classify(const TImage& Im1,const TImage& Im2) const;
+	// the pair of two levels of the same dimension, of the frames of the pair
+	PairType classifyLevels(const TImage& level1,const TImage& level2) const;
+	static const char* name(PairType type);
+private:
+	void histogram(Vector<double>& histogram,const TImage& gray) const;
+};
+
+typedef ShotClassifier<double> DShotClassifier;
+typedef ShotClassifier<float> FShotClassifier;
@@ -0,0 +1,337 @@
+#pragma once
+
+#include "stdio.h"
+#include "math.h"
+#include "Vector.h"
+#include "Matrix.h"
+#include "project.h"
+#include "Reduction.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------
+// a sparse matrix in the compressed sparse row (CSR) format: the nonzeros of row i are values[k] at
+// columns colIndex[k] for rowStart[i]<=k<rowStart[i+1], in ascending columns. The systems of the image
+// grids, e.g. the 5-point Laplacian of OpticalFlow::LaplacianMatrix, are banded with a handful of
+// nonzeros per row, so the memory and the cost of a product are linear in the number of pixels
+//--------------------------------------------------------------------------------------------------
+template <class T=double>
+class SparseMatrix
+{
+private:
+	int nRow,nCol;
+	vector<int> rowStart,colIndex;
+	vector<T> values;
+	static bool IsDispInfo;
+public:
+	SparseMatrix(void);
+	SparseMatrix(int _nrow,int _ncol);
+	void allocate(int _nrow,int _ncol);
+	void reset();
+	static void enableDispInfo(bool dispInfo=false){IsDispInfo=dispInfo;};
+
+	// the matrix of the triplets (rows[k],cols[k],vals[k]), the duplicates summed
+	void fromTriplets(int _nrow,int _ncol,const vector<int>& rows,const vector<int>& cols,const vector<T>& vals);
+	// the nonzeros of a dense matrix
+	void fromMatrix(const Matrix<T>& matrix);
+	void toMatrix(Matrix<T>& matrix) const;
+	void printMatrix() const;
+
+	// function to access the member variables
+	inline int nrow() const{return nRow;};
+	inline int ncol() const{return nCol;};
+	inline int nnz() const{return rowStart.empty()?0:rowStart[nRow];};
+	inline const int* rowstart() const{return &rowStart[0];};
+	inline const int* colindex() const{return colIndex.empty()?NULL:&colIndex[0];};
+	inline const T* data() const{return values.empty()?NULL:&values[0];};
+	inline T* data() {return values.empty()?NULL:&values[0];};
+	// the entry (row,col), 0 if it isn't stored
+	T data(int row,int col) const;
+
+	bool checkDimRight(const Vector<T>& vect) const;
+	bool IsSymmetric(double tolerance=0) const;
+	void diagonal(Vector<T>& diag) const;
+
+	// functions for matrix computation, the rows in parallel
+	void Multiply(T* result,const T* vect) const;
+	void Multiply(Vector<T>& result,const Vector<T>& vect) const;
+
+	// solve Ax=b of a symmetric positive definite A by conjugate gradient, preconditioned by the inverse
+	// of the diagonal when IsJacobi. It stops when |r|<=tolerance*|b| or after nIterations (5*nRow when
+	// 0), and returns the iterations
+	int ConjugateGradient(Vector<T>& result,const Vector<T>& b,int nIterations=0,double tolerance=1E-6,bool IsJacobi=true,
+								double* relativeResidual=NULL) const;
+};
+
+template<class T>
+bool SparseMatrix<T>::IsDispInfo=false;
+
+template<class T>
+SparseMatrix<T>::SparseMatrix(void)
+{
+	nRow=nCol=0;
+}
+
+template<class T>
+SparseMatrix<T>::SparseMatrix(int nrow,int ncol)
+{
+	allocate(nrow,ncol);
+}
+
+//--------------------------------------------------------------------------------------------------
+// an empty matrix of the dimension, without nonzeros
+//--------------------------------------------------------------------------------------------------
+template<class T>
+void SparseMatrix<T>::allocate(int nrow,int ncol)
+{
+	nRow=nrow;
+	nCol=ncol;
+	rowStart.assign(nRow+1,0);
+	colIndex.clear();
+	values.clear();
+}
+
+template<class T>
+void SparseMatrix<T>::reset()
+{
+	std::fill(values.begin(),values.end(),(T)0);
+}
+
+template<class T>
+void SparseMatrix<T>::fromTriplets(int nrow,int ncol,const vector<int>& rows,const vector<int>& cols,const vector<T>& vals)
+{
+	if(rows.size()!=cols.size() || rows.size()!=vals.size())
+	{
+		cout<<"Error: the triplets of SparseMatrix::fromTriplets() don't have the same length!"<<endl;
+		return;
+	}
+	allocate(nrow,ncol);
+	int nEntries=rows.size();
+	// bucket the triplets by rows, then sort each row by columns and merge the duplicates
+	vector<int> count(nRow+1,0),order(nEntries);
+	for(int k=0;k<nEntries;k++)
+		count[rows[k]+1]++;
+	for(int i=0;i<nRow;i++)
+		count[i+1]+=count[i];
+	vector<int> next(count.begin(),count.end()-1);
+	for(int k=0;k<nEntries;k++)
+		order[next[rows[k]]++]=k;
+	colIndex.reserve(nEntries);
+	values.reserve(nEntries);
+	for(int i=0;i<nRow;i++)
+	{
+		vector<pair<int,T> > row;
+		for(int k=count[i];k<count[i+1];k++)
+			row.push_back(make_pair(cols[order[k]],vals[order[k]]));
+		std::stable_sort(row.begin(),row.end(),[](const pair<int,T>& a,const pair<int,T>& b){return a.first<b.first;});
+		for(size_t k=0;k<row.size();k++)
+			if(k>0 && row[k].first==row[k-1].first)
+				values.back()+=row[k].second;
+			else
+			{
+				colIndex.push_back(row[k].first);
+				values.push_back(row[k].second);
+			}
+		rowStart[i+1]=colIndex.size();
+	}
+}
+
+template<class T>
+void SparseMatrix<T>::fromMatrix(const Matrix<T>& matrix)
+{
+	allocate(matrix.nrow(),matrix.ncol());
+	for(int i=0;i<nRow;i++)
+	{
+		for(int j=0;j<nCol;j++)
+			if(matrix.data(i,j)!=0)
+			{
+				colIndex.push_back(j);
+				values.push_back(matrix.data(i,j));
+			}
+		rowStart[i+1]=colIndex.size();
+	}
+}
+
+template<class T>
+void SparseMatrix<T>::toMatrix(Matrix<T>& matrix) const
+{
+	matrix.allocate(nRow,nCol);
+	matrix.reset();
+	for(int i=0;i<nRow;i++)
+		for(int k=rowStart[i];k<rowStart[i+1];k++)
+			matrix.data(i,colIndex[k])=values[k];
+}
+
+template<class T>
+void SparseMatrix<T>::printMatrix() const
+{
+	for(int i=0;i<nRow;i++)
+	{
+		for(int j=0;j<nCol;j++)
+		{
+			T value=data(i,j);
+			if(value>=0)
+				printf(" ");
+			printf(" %1.0f ",(double)value);
+		}
+		printf("\n");
+	}
+}
+
+template<class T>
+T SparseMatrix<T>::data(int row,int col) const
+{
+	const int* pBegin=&colIndex[0]+rowStart[row];
+	const int* pEnd=&colIndex[0]+rowStart[row+1];
+	const int* pFound=std::lower_bound(pBegin,pEnd,col);
+	if(pFound==pEnd || *pFound!=col)
+		return 0;
+	return values[pFound-&colIndex[0]];
+}
+
+template<class T>
+bool SparseMatrix<T>::checkDimRight(const Vector<T>& vect) const
+{
+	if(nCol==vect.dim())
+		return true;
+	cout<<"The matrix and vector don't match in multiplication!"<<endl;
+	return false;
+}
+
+template<class T>
+bool SparseMatrix<T>::IsSymmetric(double tolerance) const
+{
+	if(nRow!=nCol)
+		return false;
+	for(int i=0;i<nRow;i++)
+		for(int k=rowStart[i];k<rowStart[i+1];k++)
+			if(fabs((double)values[k]-data(colIndex[k],i))>tolerance)
+				return false;
+	return true;
+}
+
+template<class T>
+void SparseMatrix<T>::diagonal(Vector<T>& diag) const
+{
+	int nDiag=__min(nRow,nCol);
+	if(!diag.matchDimension(nDiag))
+		diag.allocate(nDiag);
+	for(int i=0;i<nDiag;i++)
+		diag[i]=data(i,i);
+}
+
+//--------------------------------------------------------------------------------------------------
+// the product with a vector (SpMV); the rows are independent, so they are computed in parallel
+//--------------------------------------------------------------------------------------------------
+template<class T>
+void SparseMatrix<T>::Multiply(T* result,const T* vect) const
+{
+	const int *pRowStart=&rowStart[0],*pColIndex=colIndex.empty()?NULL:&colIndex[0];
+	const T* pValues=values.empty()?NULL:&values[0];
+#ifdef _OPENMP
+	#pragma omp parallel for if(nnz()>65536)
+#endif
+	for(int i=0;i<nRow;i++)
+	{
+		double sum=0;
+		for(int k=pRowStart[i];k<pRowStart[i+1];k++)
+			sum+=pValues[k]*vect[pColIndex[k]];
+		result[i]=sum;
+	}
+}
+
+template<class T>
+void SparseMatrix<T>::Multiply(Vector<T>& result,const Vector<T>& vect) const
+{
+	if(!checkDimRight(vect))
+		return;
+	if(!result.matchDimension(nRow))
+		result.allocate(nRow);
+	Multiply(result.data(),vect.data());
+}
+
+//--------------------------------------------------------------------------------------------------
+// function for preconditioned conjugate gradient method. The vectors are updated in place and the inner
+// products summed in parallel, so a solve allocates nothing after its four work vectors
+//--------------------------------------------------------------------------------------------------
+template<class T>
+int SparseMatrix<T>::ConjugateGradient(Vector<T>& result,const Vector<T>& b,int nIterations,double tolerance,bool IsJacobi,
+															double* relativeResidual) const
+{
+	if(nCol!=nRow)
+	{
+		cout<<"Error: when solving Ax=b, A is not square!"<<endl;
+		return 0;
+	}
+	if(!checkDimRight(b))
+		return 0;
+	if(!result.matchDimension(b))
+		result.allocate(b);
+	result.reset();
+	if(nIterations<=0)
+		nIterations=nRow*5;
+
+	int n=nRow;
+	Vector<T> r(b),z(n),p(n),q(n),invDiag(n);
+	diagonal(invDiag);
+	for(int i=0;i<n;i++)
+		invDiag[i]=(IsJacobi && invDiag[i]!=0)?1/invDiag[i]:1;
+	T *x=result.data(),*pr=r.data(),*pz=z.data(),*pp=p.data(),*pq=q.data();
+	const T* pInvDiag=invDiag.data();
+	bool IsParallel=n>65536;
+	// the dot products are the same for any number of threads
+	int nReduceThreads=IsParallel?0:1;
+
+	double bnorm=sqrt(b.norm2()),rz=0,rnorm=bnorm;
+	int k;
+	for(k=0;k<nIterations;k++)
+	{
+		if(rnorm<=tolerance*bnorm || rnorm<1E-20)
+			break;
+		double rzNew;
+		Reduction::reduce(n,1,&rzNew,[&](int begin,int end,double* sums)
+		{
+			double sum=0;
+			for(int i=begin;i<end;i++)
+			{
+				pz[i]=pr[i]*pInvDiag[i];
+				sum+=pr[i]*pz[i];
+			}
+			sums[0]=sum;
+		},nReduceThreads);
+		if(IsDispInfo)
+			cout<<rnorm<<endl;
+		double beta=(k==0)?0:rzNew/rz;
+		rz=rzNew;
+#ifdef _OPENMP
+		#pragma omp parallel for if(IsParallel)
+#endif
+		for(int i=0;i<n;i++)
+			pp[i]=pz[i]+beta*pp[i];
+		Multiply(pq,pp);
+		double pq_inner;
+		Reduction::reduce(n,1,&pq_inner,[&](int begin,int end,double* sums)
+			{sums[0]=Reduction::sum(begin,end,[&](int i) {return (double)pp[i]*pq[i];});},nReduceThreads);
+		if(pq_inner<=0)
+			break;
+		double alpha=rz/pq_inner,r2;
+		Reduction::reduce(n,1,&r2,[&](int begin,int end,double* sums)
+		{
+			double sum=0;
+			for(int i=begin;i<end;i++)
+			{
+				x[i]+=alpha*pp[i];
+				pr[i]-=alpha*pq[i];
+				sum+=pr[i]*pr[i];
+			}
+			sums[0]=sum;
+		},nReduceThreads);
+		rnorm=sqrt(r2);
+	}
+	if(relativeResidual!=NULL)
+		*relativeResidual=(bnorm>0)?rnorm/bnorm:0;
+	return k;
+}
@@ -0,0 +1,271 @@
+#include "SphereRotation.h"
+#include "ImageProcessing.h"
+#include "Reduction.h"
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+template <class T>
+SphereRotation<T>::SphereRotation(int _coarseWidth,int _fineWidth,int _nIterations,double _robustScale)
+{
+	coarseWidth=_coarseWidth;
+	fineWidth=_fineWidth;
+	nIterations=_nIterations;
+	robustScale=_robustScale;
+}
+
+template <class T>
+inline void SphereRotation<T>::bearing(double* d,double x,double y,int width,int height)
+{
+	double theta=(x+0.5)/width*2*M_PI-M_PI;
+	double phi=M_PI/2-(y+0.5)/height*M_PI;
+	d[0]=cos(phi)*cos(theta);
+	d[1]=cos(phi)*sin(theta);
+	d[2]=sin(phi);
+}
+
+template <class T>
+inline void SphereRotation<T>::project(double& x,double& y,const double* d,int width,int height)
+{
+	double theta=atan2(d[1],d[0]);
+	double phi=asin(__max(__min(d[2],1.0),-1.0));
+	x=(theta+M_PI)/(2*M_PI)*width-0.5;
+	y=(M_PI/2-phi)/M_PI*height-0.5;
+}
+
+static inline void multiply(double* c,const double* R,const double* d)
+{
+	for(int k=0;k<3;k++)
+		c[k]=R[k*3]*d[0]+R[k*3+1]*d[1]+R[k*3+2]*d[2];
+}
+
+// the bilinear sample of a gray level at (x,y), the columns wrapped around
+template <class T>
+static inline double sample(const Image<T>& level,double x,double y)
+{
+	int width=level.width();
+	x=fmod(x,(double)width);
+	if(x<0)
+		x+=width;
+	double result=0;
+	ImageProcessing::BilinearInterpolate(level.data(),width,level.height(),1,x,y,&result,true);
+	return result;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// a small rotation omega moves the bearing d'=Rd by omega x d', so the residual Im2(Rd)-Im1(d) changes by
+// g.(omega x d')=omega.(d' x g), g the gradient of Im2 at d' on the sphere: the gradient in pixels times the
+// derivatives of the column and the row of d'
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+double SphereRotation<T>::energy(const TImage& level1,const TImage& level2,const double* R,double* A,double* b) const
+{
+	int width=level1.width(),height=level1.height();
+	double minCosPhi=cos(80*M_PI/180),scale=robustScale;
+	bool IsNormal=(A!=NULL);
+	// the energy, A and b summed over blocks of rows, the same for any number of threads
+	double sums[13];
+	Reduction::reduce(height,IsNormal?13:1,sums,[&](int begin,int end,double* s)
+		{
+			for(int i=begin;i<end;i++)
+			{
+				double cosPhi=cos(M_PI/2-(i+0.5)/height*M_PI);
+				if(cosPhi<minCosPhi)
+					continue;
+				const T* pRow=level1.data()+i*width;
+				for(int j=0;j<width;j++)
+				{
+					double d[3],rd[3],x,y;
+					bearing(d,j,i,width,height);
+					multiply(rd,R,d);
+					project(x,y,rd,width,height);
+					double r=sample(level2,x,y)-pRow[j];
+					double absR=fabs(r),weight=cosPhi;
+					if(absR<=scale)
+						s[0]+=cosPhi*r*r/2;
+					else
+					{
+						s[0]+=cosPhi*(scale*absR-scale*scale/2);
+						weight*=scale/absR;
+					}
+					if(!IsNormal)
+						continue;
+					double gx=sample(level2,x+0.5,y)-sample(level2,x-0.5,y);
+					double gy=sample(level2,x,y+0.5)-sample(level2,x,y-0.5);
+					double c=__max(sqrt(rd[0]*rd[0]+rd[1]*rd[1]),1E-6);
+					double du=width/(2*M_PI)/(c*c),dv=-height/M_PI;
+					double g[3]={-gx*du*rd[1]-gy*dv*rd[2]*rd[0]/c,gx*du*rd[0]-gy*dv*rd[2]*rd[1]/c,gy*dv*c};
+					double J[3]={rd[1]*g[2]-rd[2]*g[1],rd[2]*g[0]-rd[0]*g[2],rd[0]*g[1]-rd[1]*g[0]};
+					for(int k=0;k<3;k++)
+					{
+						for(int l=0;l<3;l++)
+							s[1+k*3+l]+=weight*J[k]*J[l];
+						s[10+k]-=weight*J[k]*r;
+					}
+				}
+			}
+		},0,4);
+	if(IsNormal)
+		for(int k=0;k<9;k++)
+		{
+			A[k]=sums[1+k];
+			b[k%3]=sums[10+k%3];
+		}
+	return sums[0];
+}
+
+// the 3x3 system by Cramer's rule, false if singular
+static bool solve3x3(double* x,const double* A,const double* b)
+{
+	double det=A[0]*(A[4]*A[8]-A[5]*A[7])-A[1]*(A[3]*A[8]-A[5]*A[6])+A[2]*(A[3]*A[7]-A[4]*A[6]);
+	if(fabs(det)<1E-30)
+		return false;
+	for(int k=0;k<3;k++)
+	{
+		double M[9];
+		for(int l=0;l<9;l++)
+			M[l]=(l%3==k)?b[l/3]:A[l];
+		x[k]=(M[0]*(M[4]*M[8]-M[5]*M[7])-M[1]*(M[3]*M[8]-M[5]*M[6])+M[2]*(M[3]*M[7]-M[4]*M[6]))/det;
+	}
+	return true;
+}
+
+// R=exp([omega]x)*R by the formula of Rodrigues
+static void rotateBy(double* R,const double* omega)
+{
+	double angle=sqrt(omega[0]*omega[0]+omega[1]*omega[1]+omega[2]*omega[2]);
+	if(angle<1E-15)
+		return;
+	double k[3]={omega[0]/angle,omega[1]/angle,omega[2]/angle};
+	double c=cos(angle),s=sin(angle);
+	double E[9]={c+(1-c)*k[0]*k[0],(1-c)*k[0]*k[1]-s*k[2],(1-c)*k[0]*k[2]+s*k[1],
+					(1-c)*k[1]*k[0]+s*k[2],c+(1-c)*k[1]*k[1],(1-c)*k[1]*k[2]-s*k[0],
+					(1-c)*k[2]*k[0]-s*k[1],(1-c)*k[2]*k[1]+s*k[0],c+(1-c)*k[2]*k[2]};
+	double result[9];
+	for(int i=0;i<3;i++)
+		for(int j=0;j<3;j++)
+			result[i*3+j]=E[i*3]*R[j]+E[i*3+1]*R[3+j]+E[i*3+2]*R[6+j];
+	for(int l=0;l<9;l++)
+		R[l]=result[l];
+}
+
+template <class T>
+bool SphereRotation<T>::estimate(double* R,const TImage& Im1,const TImage& Im2) const
+{
+	const double identity[9]={1,0,0,0,1,0,0,0,1};
+	for(int l=0;l<9;l++)
+		R[l]=identity[l];
+	if(!Im1.matchDimension(Im2))
+		return false;
+	// the finest level from the frames, the coarser ones halved from it
+	vector<TImage> levels1(1),levels2(1);
+	double scale=(double)fineWidth/Im1.width(),sigma=1/scale-1;
+	Im1.desaturate(levels1[0]);
+	Im2.desaturate(levels2[0]);
+	if(scale<1)
+	{
+		TImage gray;
+		gray.swap(levels1[0]);
+		gray.GaussianSmoothResize(levels1[0],sigma,sigma*3,scale,true);
+		gray.swap(levels2[0]);
+		gray.GaussianSmoothResize(levels2[0],sigma,sigma*3,scale,true);
+	}
+	while(levels1.back().width()/2>=coarseWidth)
+	{
+		levels1.push_back(TImage());
+		levels2.push_back(TImage());
+		levels1[levels1.size()-2].GaussianSmoothResize(levels1.back(),1,3,0.5,true);
+		levels2[levels2.size()-2].GaussianSmoothResize(levels2.back(),1,3,0.5,true);
+	}
+	for(int n=levels1.size()-1;n>=0;n--)
+	{
+		const TImage &level1=levels1[n],&level2=levels2[n];
+		double A[9],b[3],omega[3],lastR[9];
+		double E=energy(level1,level2,R,A,b),lastE;
+		for(int k=0;k<nIterations;k++)
+		{
+			if(!solve3x3(omega,A,b))
+				break;
+			for(int l=0;l<9;l++)
+				lastR[l]=R[l];
+			lastE=E;
+			rotateBy(R,omega);
+			E=energy(level1,level2,R,A,b);
+			// a step that doesn't descend is taken back
+			if(E>lastE)
+			{
+				for(int l=0;l<9;l++)
+					R[l]=lastR[l];
+				break;
+			}
+			if(sqrt(omega[0]*omega[0]+omega[1]*omega[1]+omega[2]*omega[2])<1E-6)
+				break;
+		}
+	}
+	if(energy(levels1[0],levels2[0],R,NULL,NULL)>=energy(levels1[0],levels2[0],identity,NULL,NULL))
+	{
+		for(int l=0;l<9;l++)
+			R[l]=identity[l];
+		return false;
+	}
+	return true;
+}
+
+template <class T>
+void SphereRotation<T>::rotate(TImage& rotated,const TImage& Im,const double* R)
+{
+	int width=Im.width(),height=Im.height(),nChannels=Im.nchannels();
+	if(!rotated.matchDimension(Im))
+		rotated.allocate(width,height,nChannels);
+	const T* pIm=Im.data();
+	T* pRotated=rotated.data();
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			double d[3],rd[3],x,y;
+			bearing(d,j,i,width,height);
+			multiply(rd,R,d);
+			project(x,y,rd,width,height);
+			if(x<0)
+				x+=width;
+			T* pPixel=pRotated+(i*width+j)*nChannels;
+			for(int k=0;k<nChannels;k++)
+				pPixel[k]=0;
+			ImageProcessing::BilinearInterpolate(pIm,width,height,nChannels,x,y,pPixel,true);
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the pixel x of Im1 is at y=x+v in the rotated Im2, which is Im2 at the bearing R d(y), so its flow to Im2
+// is to the pixel of R d(y). The columns of the flow are wrapped into [-width/2,width/2)
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void SphereRotation<T>::composeFlow(TImage& vx,TImage& vy,const double* R)
+{
+	int width=vx.width(),height=vx.height();
+	T* pVx=vx.data();
+	T* pVy=vy.data();
+#ifdef _OPENMP
+	#pragma omp parallel for
+#endif
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double d[3],rd[3],x,y;
+			bearing(d,j+pVx[offset],i+pVy[offset],width,height);
+			multiply(rd,R,d);
+			project(x,y,rd,width,height);
+			double u=x-j;
+			u-=width*floor((u+width/2.0)/width);
+			pVx[offset]=u;
+			pVy[offset]=y-i;
+		}
+}
+
+template class SphereRotation<double>;
+template class SphereRotation<float>;
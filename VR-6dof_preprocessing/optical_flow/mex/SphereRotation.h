@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Image.h"
+
+//--------------------------------------------------------------------------------------------------------
+// the global rotation of the camera between two equirectangular frames, to rotate the second frame on the
+// sphere before Coarse2FineFlow so that the solver only has the parallax left. The rotation R maps the
+// bearing d of a pixel of Im1 to the bearing of the same point in Im2, Im1(d) ~ Im2(R d), and is estimated
+// by Gauss-Newton on the brightness of the gray frames, from a level of coarseWidth columns up to one of
+// fineWidth columns. The pixels weigh as the area of the sphere they cover, and the residuals beyond
+// robustScale less and less (Huber), so the parallax and the moving objects pull little on the rotation.
+// The rows within 10 degrees of the poles are left out. The bearings are those of FlowDepth, longitude
+// -pi..pi from left to right and latitude pi/2..-pi/2 from top to bottom
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class SphereRotation
+{
+public:
+	typedef Image<T> TImage;
+
+	int coarseWidth;		// the columns of the coarsest level of the estimate
+	int fineWidth;			// of the finest one, or of the frames if they are smaller
+	int nIterations;		// of Gauss-Newton on every level
+	double robustScale;		// of the Huber weights of the residuals, the intensities being in [0,1]
+public:
+	SphereRotation(int _coarseWidth=64,int _fineWidth=256,int _nIterations=10,double _robustScale=0.05);
+	// R as a row-major 3x3 matrix, the identity when the estimate doesn't reduce the residual of the frames,
+	// which returns false
+	bool estimate(double* R,const TImage& Im1,const TImage& Im2) const;
+	// rotated(d)=Im(R d), Im in the orientation of the frame that R maps from
+	static void rotate(TImage& rotated,const TImage& Im,const double* R);
+	// turns the flow (vx,vy) from Im1 to Im2 rotated by R into the flow to Im2 itself
+	static void composeFlow(TImage& vx,TImage& vy,const double* R);
+private:
+	static inline void bearing(double* d,double x,double y,int width,int height);
+	static inline void project(double& x,double& y,const double* d,int width,int height);
+	// the robust energy of the rotation on the level and, with A and b, its normal equations
+	double energy(const TImage& level1,const TImage& level2,const double* R,double* A,double* b) const;
+};
+
+typedef SphereRotation<double> DSphereRotation;
+typedef SphereRotation<float> FSphereRotation;
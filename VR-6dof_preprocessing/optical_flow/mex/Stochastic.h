@@ -5,6 +5,12 @@
 #include "stdlib.h"
 #include "project.h"
 #include "memory.h"
+#include "FlowKernels.h"
+#include <random>
+#include <vector>
+#ifdef OPTICALFLOW_BLAS
+	#include <cblas.h>
+#endif
 
 #define _Release_2DArray(X,i,length) for(i=0;i<length;i++) if(X[i]!=NULL) delete X[i]; delete []X
 
@@ -46,6 +52,11 @@ public:
 	template <class T1,class T2> static void ComputeMeanCovariance(int Dim,int NumData,T1* pData,T2* pMean,T2* pCovarance,double* pWeight=NULL);
 	template <class T1,class T2> static double VectorSquareDistance(int Dim,T1* pVector1,T2* pVector2);
 	template <class T1> static void KMeanClustering(int Dim,int NumData,int NumClusters,T1* pData,int *pPartition,double** pClusterMean=NULL,int MaxIterationNum=10,int MinClusterSampleNumber=2);
+	template <class T1> static void MiniBatchKMeanClustering(int Dim,int NumData,int NumClusters,T1* pData,int* pPartition,double** pClusterMean=NULL,
+																		int MaxIterationNum=100,int BatchSize=1024,unsigned int Seed=0);
+	// the nearest of the centers, given as NumClusters rows of Dim, for every point, in parallel
+	template <class T1> static void AssignClusters(int Dim,int NumData,int NumClusters,const T1* pData,const double* pCenters,int* pPartition);
+	template <int DIM,class T1> static void AssignClustersDim(int Dim,int NumData,int NumClusters,const T1* pData,const double* pCenters,int* pPartition);
 	template <class T> static double norm(T* X,int Dim);
 	template <class T1,class T2> static int FindClosestPoint(T1* pPointSet,int NumPoints,int nDim,T2* QueryPoint);
 	template <class T1,class T2> static void GaussianFiltering(T1* pSrcArray,T2* pDstArray,int NumPoints,int nChannels,int size,double sigma);
@@ -205,34 +216,55 @@ void CStochastic::ComputeMeanCovariance(int Dim,int NumData,T1* pData,T2* pMean,
 		pMean[j]/=Sum;
 
 	//compute covariance;
+#ifdef OPTICALFLOW_BLAS
+	// the lower triangle of the sum of the weighted outer products, as the product of blocks of blockSize
+	// centered samples by the same samples times their weights
+	const int blockSize=256;
+	std::vector<double> centered((size_t)blockSize*Dim),weighted((size_t)blockSize*Dim),covariance((size_t)Dim*Dim,0.0);
+	for(i=0;i<NumData;i+=blockSize)
+	{
+		int n=0;
+		for(int l=i;l<NumData && l<i+blockSize;l++)
+		{
+			double weight=IsWeightLoaded?pWeight[l]:1;
+			if(weight==0)
+				continue;
+			for(j=0;j<Dim;j++)
+			{
+				centered[(size_t)n*Dim+j]=(double)pData[(size_t)l*Dim+j]-pMean[j];
+				weighted[(size_t)n*Dim+j]=centered[(size_t)n*Dim+j]*weight;
+			}
+			n++;
+		}
+		if(n>0)
+			cblas_dgemm(CblasRowMajor,CblasTrans,CblasNoTrans,Dim,Dim,n,1.0,&centered[0],Dim,&weighted[0],Dim,1.0,&covariance[0],Dim);
+	}
+	for(j=0;j<Dim;j++)
+		for(k=0;k<=j;k++)
+			pCovariance[j*Dim+k]=covariance[(size_t)j*Dim+k];
+#else
+	// row j of the lower triangle adds the centered sample times its element j, with FlowKernels::Axpy
 	T2* pTempVector;
 	pTempVector=new T2[Dim];
 
 	for(i=0;i<NumData;i++)
 	{
+		if(IsWeightLoaded && pWeight[i]==0)
+			continue;
+		double weight=IsWeightLoaded?pWeight[i]:1;
 		for(j=0;j<Dim;j++)
 			pTempVector[j]=pData[i*Dim+j]-pMean[j];
-		if(IsWeightLoaded)
-		{
-			if(pWeight[i]==0)
-				continue;
-			for(j=0;j<Dim;j++)
-				for(k=0;k<=j;k++)
-					pCovariance[j*Dim+k]+=pTempVector[j]*pTempVector[k]*pWeight[i];
-		}
-		else
-			for(j=0;j<Dim;j++)
-				for(k=0;k<=j;k++)
-					pCovariance[j*Dim+k]+=pTempVector[j]*pTempVector[k];
+		for(j=0;j<Dim;j++)
+			FlowKernels::Axpy(pCovariance+j*Dim,pTempVector,pTempVector[j]*weight,j+1);
 	}
+	delete []pTempVector;
+#endif
 	for(j=0;j<Dim;j++)
 		for(k=j+1;k<Dim;k++)
 			pCovariance[j*Dim+k]=pCovariance[k*Dim+j];
 
 	for(j=0;j<Dim*Dim;j++)
 		pCovariance[j]/=Sum;
-
-	delete []pTempVector;
 }
 
 template <class T1,class T2>
@@ -281,15 +313,71 @@ double CStochastic::VectorSquareDistance(int Dim,T1* pVector1,T2* pVector2)
 	return result;
 }
 
+//--------------------------------------------------------------------------------------------------------
+// the nearest of the NumClusters centers (rows of Dim) for every point, in parallel. With Dim known at
+// compile time (DIM>0) the distance is unrolled; it is summed in the order of VectorSquareDistance and the
+// ties go to the first cluster, so the partition is the one of the serial loop
+//--------------------------------------------------------------------------------------------------------
+template <int DIM,class T1>
+void CStochastic::AssignClustersDim(int Dim,int NumData,int NumClusters,const T1* pData,const double* pCenters,int* pPartition)
+{
+	const int dim=(DIM>0)?DIM:Dim;
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)NumData*NumClusters*dim>65536)
+#endif
+	for(int i=0;i<NumData;i++)
+	{
+		const T1* pVector=pData+(size_t)i*dim;
+		double MinDistance=1E100;
+		int Index=0;
+		for(int j=0;j<NumClusters;j++)
+		{
+			const double* pCenter=pCenters+j*dim;
+			double Distance=0;
+			for(int l=0;l<dim;l++)
+			{
+				double temp=pVector[l]-pCenter[l];
+				Distance+=temp*temp;
+			}
+			if(Distance<MinDistance)
+			{
+				MinDistance=Distance;
+				Index=j;
+			}
+		}
+		pPartition[i]=Index;
+	}
+}
+
+template <class T1>
+void CStochastic::AssignClusters(int Dim,int NumData,int NumClusters,const T1* pData,const double* pCenters,int* pPartition)
+{
+	switch(Dim)
+	{
+	case 1:
+		AssignClustersDim<1>(Dim,NumData,NumClusters,pData,pCenters,pPartition);
+		break;
+	case 2:
+		AssignClustersDim<2>(Dim,NumData,NumClusters,pData,pCenters,pPartition);
+		break;
+	case 3:
+		AssignClustersDim<3>(Dim,NumData,NumClusters,pData,pCenters,pPartition);
+		break;
+	default:
+		AssignClustersDim<0>(Dim,NumData,NumClusters,pData,pCenters,pPartition);
+	}
+}
+
 template <class T1>
 void CStochastic::KMeanClustering(int Dim,int NumData,int NumClusters,T1* pData,int *pPartition,double** pClusterMean,int MaxIterationNum, int MinClusterSampleNumber)
 {
-	int i,j,k,l,Index,ClusterSampleNumber;
-	double MinDistance,Distance;
+	int i,j,k,l,Index;
 	double** pCenters;
 	pCenters=new double*[NumClusters];
 	for(i=0;i<NumClusters;i++)
 		pCenters[i]=new double[Dim];
+	std::vector<double> centers((size_t)NumClusters*Dim);
+	std::vector<int> ClusterSampleNumber(NumClusters);
 	
 	// generate randome guess of the partition
 _CStochastic_KMeanClustering_InitializePartition:
@@ -302,39 +390,32 @@ _CStochastic_KMeanClustering_InitializePartition:
 
 	for(k=0;k<MaxIterationNum;k++)
 	{
-		// step 1. do partition
-		for(i=0;i<NumData;i++)
+		// step 1. do partition, the points in parallel
+		for(i=0;i<NumClusters;i++)
+			for(l=0;l<Dim;l++)
+				centers[i*Dim+l]=pCenters[i][l];
+		AssignClusters(Dim,NumData,NumClusters,pData,&centers[0],pPartition);
+		// step 2. compute mean, all the clusters in one pass over the data
+		for(i=0;i<NumClusters;i++)
 		{
-			MinDistance=1E100;
-			for(j=0;j<NumClusters;j++)
-			{
-				Distance=VectorSquareDistance(Dim,pData+i*Dim,pCenters[j]);
-				if(Distance<MinDistance)
-				{
-					MinDistance=Distance;
-					Index=j;
-				}
-			}
-			pPartition[i]=Index;
+			memset(pCenters[i],0,sizeof(double)*Dim);
+			ClusterSampleNumber[i]=0;
+		}
+		for(j=0;j<NumData;j++)
+		{
+			double* pCenter=pCenters[pPartition[j]];
+			for(l=0;l<Dim;l++)
+				pCenter[l]+=pData[j*Dim+l];
+			ClusterSampleNumber[pPartition[j]]++;
 		}
-		// step 2. compute mean
 		for(i=0;i<NumClusters;i++)
 		{
-			memset(pCenters[i],0,sizeof(double)*Dim);
-			ClusterSampleNumber=0;
-			for(j=0;j<NumData;j++)
-				if(pPartition[j]==i)
-				{
-					for(l=0;l<Dim;l++)
-						pCenters[i][l]+=pData[j*Dim+l];
-					ClusterSampleNumber++;
-				}
 			// maybe the initial partition is bad
 			// if so just do initial partition again
-			if(ClusterSampleNumber<MinClusterSampleNumber)
+			if(ClusterSampleNumber[i]<MinClusterSampleNumber)
 				goto _CStochastic_KMeanClustering_InitializePartition;
 			for(l=0;l<Dim;l++)
-				pCenters[i][l]/=ClusterSampleNumber;
+				pCenters[i][l]/=ClusterSampleNumber[i];
 		}
 	}
 	// output the final partition if necessary
@@ -348,6 +429,88 @@ _CStochastic_KMeanClustering_InitializePartition:
 	delete []pCenters;
 }
 
+//--------------------------------------------------------------------------------------------------------
+// mini-batch k-means (Sculley 2010) for large data such as every pixel of a depth sequence: the centers
+// are seeded by k-means++ on a subsample, then every iteration moves them towards a random batch of
+// BatchSize points with a learning rate of 1 over the points a center has absorbed. Only the final
+// partition visits all the data, in parallel. The sampling is its own generator seeded by Seed, so the
+// result is repeatable and independent of rand()
+//--------------------------------------------------------------------------------------------------------
+template <class T1>
+void CStochastic::MiniBatchKMeanClustering(int Dim,int NumData,int NumClusters,T1* pData,int* pPartition,double** pClusterMean,
+															int MaxIterationNum,int BatchSize,unsigned int Seed)
+{
+	std::mt19937 generator(Seed);
+	std::uniform_int_distribution<int> anyPoint(0,NumData-1);
+	std::uniform_real_distribution<double> uniform(0,1);
+	std::vector<double> centers((size_t)NumClusters*Dim);
+
+	// k-means++ seeding, each next center drawn with a probability proportional to the squared distance to
+	// the nearest center so far
+	int NumSeedData=__min(NumData,__max(BatchSize*16,NumClusters*64));
+	std::vector<int> seedData(NumSeedData);
+	std::vector<double> seedDistance(NumSeedData,1E100);
+	for(int i=0;i<NumSeedData;i++)
+		seedData[i]=(NumSeedData==NumData)?i:anyPoint(generator);
+	int Index=seedData[std::uniform_int_distribution<int>(0,NumSeedData-1)(generator)];
+	for(int j=0;j<NumClusters;j++)
+	{
+		for(int l=0;l<Dim;l++)
+			centers[j*Dim+l]=pData[(size_t)Index*Dim+l];
+		if(j==NumClusters-1)
+			break;
+		double total=0;
+		for(int i=0;i<NumSeedData;i++)
+		{
+			double d=VectorSquareDistance(Dim,pData+(size_t)seedData[i]*Dim,&centers[j*Dim]);
+			seedDistance[i]=__min(seedDistance[i],d);
+			total+=seedDistance[i];
+		}
+		// all the points on the centers already: any point is as good
+		double threshold=uniform(generator)*total,sum=0;
+		Index=seedData[NumSeedData-1];
+		for(int i=0;i<NumSeedData && total>0;i++)
+		{
+			sum+=seedDistance[i];
+			if(sum>=threshold)
+			{
+				Index=seedData[i];
+				break;
+			}
+		}
+	}
+
+	// the mini-batch updates, the points of a batch gathered to be assigned together
+	BatchSize=__min(BatchSize,NumData);
+	std::vector<T1> batch((size_t)BatchSize*Dim);
+	std::vector<int> batchCluster(BatchSize);
+	std::vector<double> ClusterSampleNumber(NumClusters,0);
+	for(int k=0;k<MaxIterationNum;k++)
+	{
+		for(int i=0;i<BatchSize;i++)
+		{
+			const T1* pVector=pData+(size_t)anyPoint(generator)*Dim;
+			for(int l=0;l<Dim;l++)
+				batch[i*Dim+l]=pVector[l];
+		}
+		AssignClusters(Dim,BatchSize,NumClusters,&batch[0],&centers[0],&batchCluster[0]);
+		for(int i=0;i<BatchSize;i++)
+		{
+			int j=batchCluster[i];
+			double eta=1/(++ClusterSampleNumber[j]);
+			for(int l=0;l<Dim;l++)
+				centers[j*Dim+l]+=(batch[i*Dim+l]-centers[j*Dim+l])*eta;
+		}
+	}
+
+	// the final partition of all the data
+	AssignClusters(Dim,NumData,NumClusters,pData,&centers[0],pPartition);
+	if(pClusterMean!=NULL)
+		for(int j=0;j<NumClusters;j++)
+			for(int l=0;l<Dim;l++)
+				pClusterMean[j][l]=centers[j*Dim+l];
+}
+
 template <class T>
 double CStochastic::norm(T* X,int Dim)
 {
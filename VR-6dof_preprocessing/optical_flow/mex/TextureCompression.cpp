@@ -0,0 +1,243 @@
+#include "TextureCompression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+
+using namespace std;
+
+static inline int pack565(const double* rgb)
+{
+	int r=(int)(__min(__max(rgb[0],0),255)*31/255+0.5),g=(int)(__min(__max(rgb[1],0),255)*63/255+0.5),
+		b=(int)(__min(__max(rgb[2],0),255)*31/255+0.5);
+	return (r<<11)|(g<<5)|b;
+}
+
+static inline void unpack565(int color,int* rgb)
+{
+	int r=(color>>11)&31,g=(color>>5)&63,b=color&31;
+	rgb[0]=(r<<3)|(r>>2);
+	rgb[1]=(g<<2)|(g>>4);
+	rgb[2]=(b<<3)|(b>>2);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the principal axis of the colors by power iterations on their covariance; color0>color1 selects the
+// mode of four colors, the two endpoints and two thirds between them
+//--------------------------------------------------------------------------------------------------------
+void TextureCompression::compressBC1(const double pixels[16][3],unsigned char* pBlock)
+{
+	double mean[3]={0,0,0};
+	for(int i=0;i<16;i++)
+		for(int k=0;k<3;k++)
+			mean[k]+=pixels[i][k]/16;
+	double covariance[3][3]={{0,0,0},{0,0,0},{0,0,0}};
+	for(int i=0;i<16;i++)
+		for(int k=0;k<3;k++)
+			for(int l=0;l<3;l++)
+				covariance[k][l]+=(pixels[i][k]-mean[k])*(pixels[i][l]-mean[l]);
+	double axis[3]={0.57735,0.57735,0.57735};
+	for(int iter=0;iter<8;iter++)
+	{
+		double next[3],norm=0;
+		for(int k=0;k<3;k++)
+		{
+			next[k]=covariance[k][0]*axis[0]+covariance[k][1]*axis[1]+covariance[k][2]*axis[2];
+			norm+=next[k]*next[k];
+		}
+		if(norm<1E-12)
+			break;
+		norm=sqrt(norm);
+		for(int k=0;k<3;k++)
+			axis[k]=next[k]/norm;
+	}
+	double tMin=0,tMax=0;
+	for(int i=0;i<16;i++)
+	{
+		double t=(pixels[i][0]-mean[0])*axis[0]+(pixels[i][1]-mean[1])*axis[1]+(pixels[i][2]-mean[2])*axis[2];
+		tMin=__min(tMin,t);
+		tMax=__max(tMax,t);
+	}
+	double high[3],low[3];
+	for(int k=0;k<3;k++)
+	{
+		high[k]=mean[k]+tMax*axis[k];
+		low[k]=mean[k]+tMin*axis[k];
+	}
+	int color0=pack565(high),color1=pack565(low);
+	if(color0<color1)
+		std::swap(color0,color1);
+	uint32_t indices=0;
+	if(color0!=color1)
+	{
+		int palette[4][3];
+		unpack565(color0,palette[0]);
+		unpack565(color1,palette[1]);
+		for(int k=0;k<3;k++)
+		{
+			palette[2][k]=(2*palette[0][k]+palette[1][k]+1)/3;
+			palette[3][k]=(palette[0][k]+2*palette[1][k]+1)/3;
+		}
+		for(int i=0;i<16;i++)
+		{
+			int best=0;
+			double bestDistance=1E30;
+			for(int m=0;m<4;m++)
+			{
+				double distance=0;
+				for(int k=0;k<3;k++)
+					distance+=(pixels[i][k]-palette[m][k])*(pixels[i][k]-palette[m][k]);
+				if(distance<bestDistance)
+				{
+					bestDistance=distance;
+					best=m;
+				}
+			}
+			indices|=(uint32_t)best<<(2*i);
+		}
+	}
+	pBlock[0]=color0&255;
+	pBlock[1]=color0>>8;
+	pBlock[2]=color1&255;
+	pBlock[3]=color1>>8;
+	for(int i=0;i<4;i++)
+		pBlock[4+i]=(indices>>(8*i))&255;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// value0>value1 selects the mode of eight values, the two endpoints and six sevenths between them
+//--------------------------------------------------------------------------------------------------------
+void TextureCompression::compressBC4(const double values[16],unsigned char* pBlock)
+{
+	double low=values[0],high=values[0];
+	for(int i=1;i<16;i++)
+	{
+		low=__min(low,values[i]);
+		high=__max(high,values[i]);
+	}
+	int value0=(int)(__min(__max(high,0),255)+0.5),value1=(int)(__min(__max(low,0),255)+0.5);
+	uint64_t indices=0;
+	if(value0!=value1)
+	{
+		int palette[8]={value0,value1};
+		for(int m=2;m<8;m++)
+			palette[m]=((8-m)*value0+(m-1)*value1+3)/7;
+		for(int i=0;i<16;i++)
+		{
+			int best=0;
+			double bestDistance=1E30;
+			for(int m=0;m<8;m++)
+				if(fabs(values[i]-palette[m])<bestDistance)
+				{
+					bestDistance=fabs(values[i]-palette[m]);
+					best=m;
+				}
+			indices|=(uint64_t)best<<(3*i);
+		}
+	}
+	pBlock[0]=value0;
+	pBlock[1]=value1;
+	for(int i=0;i<6;i++)
+		pBlock[2+i]=(indices>>(8*i))&255;
+}
+
+void TextureCompression::compress(const BiImage& image,Format format,vector<unsigned char>& blocks)
+{
+	int width=image.width(),height=image.height(),nChannels=image.nchannels();
+	int blocksX=(width+3)/4,blocksY=(height+3)/4;
+	blocks.resize((size_t)blocksX*blocksY*blockBytes);
+	const unsigned char* pImage=image.data();
+#ifdef _OPENMP
+	#pragma omp parallel for if((double)width*height>65536)
+#endif
+	for(int by=0;by<blocksY;by++)
+		for(int bx=0;bx<blocksX;bx++)
+		{
+			double pixels[16][3],values[16];
+			for(int i=0;i<16;i++)
+			{
+				int x=__min(bx*4+i%4,width-1),y=__min(by*4+i/4,height-1);
+				const unsigned char* pPixel=pImage+(y*width+x)*nChannels;
+				// the images are BGR, the blocks RGB
+				for(int k=0;k<3;k++)
+					pixels[i][k]=pPixel[(nChannels>=3)?2-k:0];
+				values[i]=pPixel[0];
+			}
+			unsigned char* pBlock=&blocks[((size_t)by*blocksX+bx)*blockBytes];
+			if(format==BC1)
+				compressBC1(pixels,pBlock);
+			else
+				compressBC4(values,pBlock);
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the header of a DDS of one level of the blocks of a FourCC format, DXT1 or ATI1
+//--------------------------------------------------------------------------------------------------------
+bool TextureCompression::saveDDS(const char* filename,const BiImage& image,Format format)
+{
+	vector<unsigned char> blocks;
+	compress(image,format,blocks);
+	uint32_t header[32];
+	memset(header,0,sizeof(header));
+	memcpy(&header[0],"DDS ",4);
+	header[1]=124;							// the size of the header after the magic
+	header[2]=0x1|0x2|0x4|0x1000|0x80000;	// caps, height, width, pixel format and linear size
+	header[3]=image.height();
+	header[4]=image.width();
+	header[5]=(uint32_t)blocks.size();
+	header[19]=32;							// the size of the pixel format
+	header[20]=0x4;							// a FourCC
+	memcpy(&header[21],(format==BC1)?"DXT1":"ATI1",4);
+	header[27]=0x1000;						// a texture
+	ofstream file(filename,ios::out|ios::binary|ios::trunc);
+	file.write((const char*)header,sizeof(header));
+	file.write((const char*)&blocks[0],blocks.size());
+	if(!file.good())
+	{
+		cout<<"Fail to write "<<filename<<"!"<<endl;
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the header, the index and the level index of a KTX2 of one level, then its data format descriptor: a
+// basic block of one sample of the 64 bits of a block, BC1 of the BT.709 primaries and the sRGB transfer, or
+// BC4 linear. The level follows the descriptor, aligned to the 8 bytes of a block
+//--------------------------------------------------------------------------------------------------------
+bool TextureCompression::saveKTX2(const char* filename,const BiImage& image,Format format)
+{
+	vector<unsigned char> blocks;
+	compress(image,format,blocks);
+	static const unsigned char identifier[12]={0xAB,'K','T','X',' ','2','0',0xBB,'\r','\n',0x1A,'\n'};
+	const uint32_t dfdOffset=104,dfdLength=44,levelOffset=152;
+	uint32_t header[9]={(format==BC1)?132u:139u,	// VK_FORMAT_BC1_RGB_SRGB_BLOCK or VK_FORMAT_BC4_UNORM_BLOCK
+		1,(uint32_t)image.width(),(uint32_t)image.height(),0,0,1,1,0};
+	uint32_t index[4]={dfdOffset,dfdLength,0,0};
+	uint64_t levelIndex[5]={0,0,levelOffset,blocks.size(),blocks.size()};	// the empty global data, then the level
+	uint32_t dfd[11]={dfdLength,
+		0,						// the Khronos vendor, a basic descriptor
+		2|(40u<<16),			// version 2, the size of the block of one sample
+		(format==BC1)?(128u|(1u<<8)|(2u<<16)):(131u|(1u<<8)|(1u<<16)),	// the model, BT.709, the transfer
+		3|(3u<<8),				// 4x4 texels
+		blockBytes,0,			// the bytes of plane 0
+		63u<<16,0,0,0xFFFFFFFFu};	// 64 bits from bit 0, the whole range
+	unsigned char padding[4]={0,0,0,0};
+	ofstream file(filename,ios::out|ios::binary|ios::trunc);
+	file.write((const char*)identifier,sizeof(identifier));
+	file.write((const char*)header,sizeof(header));
+	file.write((const char*)index,sizeof(index));
+	file.write((const char*)levelIndex,sizeof(levelIndex));
+	file.write((const char*)dfd,sizeof(dfd));
+	file.write((const char*)padding,levelOffset-dfdOffset-dfdLength);
+	file.write((const char*)&blocks[0],blocks.size());
+	if(!file.good())
+	{
+		cout<<"Fail to write "<<filename<<"!"<<endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Image.h"
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the block compression of the static layers of the viewer, uploaded as they are by glCompressedTexImage2D:
+// BC1 (DXT1) for the colors, 4 bits per pixel, and BC4 (ATI1, RGTC1) for the gray depth and alpha, 8 bits
+// per pixel. Every 4x4 block is encoded on its own: the endpoints of BC1 are the extremes of the colors of
+// the block along their principal axis, those of BC4 the extremes of its values, and every pixel takes the
+// nearest of the colors or the values between them. The blocks at the right and the bottom borders repeat
+// the last column and row. The files are DDS of a single level, the blocks in rows top to bottom, or the
+// same blocks in a KTX2 of a single level for the web viewer, with no supercompression: BC1 of sRGB colors,
+// BC4 of linear values
+//--------------------------------------------------------------------------------------------------------
+class TextureCompression
+{
+public:
+	enum Format {BC1=0,BC4=1};
+	static const int blockBytes=8;	// of a 4x4 block in both formats
+
+	// the blocks of an 8-bit BGR (or gray) image for BC1, of its first channel for BC4
+	static void compress(const BiImage& image,Format format,std::vector<unsigned char>& blocks);
+	static bool saveDDS(const char* filename,const BiImage& image,Format format);
+	static bool saveKTX2(const char* filename,const BiImage& image,Format format);
+private:
+	static void compressBC1(const double pixels[16][3],unsigned char* pBlock);
+	static void compressBC4(const double values[16],unsigned char* pBlock);
+};
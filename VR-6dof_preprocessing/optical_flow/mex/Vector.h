@@ -2,6 +2,8 @@
 
 #include "stdio.h"
 #include "project.h"
+#include "FlowKernels.h"
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -16,6 +18,8 @@ public:
 	Vector(void);
 	Vector(int ndim,const T *data=NULL);
 	Vector(const Vector<T>& vect);
+	// the buffer of vect is taken over and vect is left empty
+	Vector(Vector<T>&& vect) noexcept;
 	~Vector(void);
 	void releaseData();
 	void allocate(int ndim);
@@ -40,6 +44,8 @@ public:
 	inline T operator[](int index) const {return pData[index];};
 	inline T& operator[](int index){return *(pData+index);};
 	Vector<T>& operator=(const Vector<T>& vect);
+	Vector<T>& operator=(Vector<T>&& vect) noexcept;
+	void swap(Vector<T>& vect) noexcept {std::swap(nDim,vect.nDim);std::swap(pData,vect.pData);};
 
 	//const Vector<T>& operator/(double val) const
 	//{
@@ -69,12 +75,10 @@ public:
 	//friend const Vector<T> operator-(const Vector<T>& vect1,double val);
 	//friend Vector<T> operator/(const Vector<T>& vect,double val);
 	
+	// SIMD for double, see FlowKernels::Dot
 	friend double innerproduct(const Vector<T>& vect1,const Vector<T>& vect2)
 	{
-		double result = 0;
-		for(int i = 0;i<vect1.dim();i++)
-			result += vect1[i]*vect2[i];
-		return result;
+		return FlowKernels::Dot(vect1.data(),vect2.data(),vect1.dim());
 	}
 	
 	void concatenate(const vector< Vector<T> >& vect);
@@ -143,6 +147,14 @@ Vector<T>::Vector(const Vector& vect)
 	copyData(vect);
 }
 
+template <class T>
+Vector<T>::Vector(Vector<T>&& vect) noexcept
+{
+	nDim=0;
+	pData=NULL;
+	swap(vect);
+}
+
 template <class T>
 Vector<T>::~Vector(void)
 {
@@ -153,7 +165,7 @@ template <class T>
 void Vector<T>::releaseData()
 {
 	if(pData!=NULL)
-		delete pData;
+		delete []pData;
 	pData=NULL;
 	nDim=0;
 }
@@ -161,6 +173,12 @@ void Vector<T>::releaseData()
 template <class T>
 void Vector<T>::allocate(int ndim)
 {
+	// the buffer is kept when the dimension matches
+	if(ndim==nDim && pData!=NULL)
+	{
+		reset();
+		return;
+	}
 	releaseData();
 	nDim=ndim;
 	if(nDim>0)
@@ -210,10 +228,7 @@ T Vector<T>::sum() const
 template <class T>
 double Vector<T>::norm2() const
 {
-	double temp=0;
-	for(int i=0;i<nDim;i++)
-		temp+=pData[i]*pData[i];
-	return temp;
+	return FlowKernels::Dot(pData,pData,nDim);
 }
 
 template <class T>
@@ -235,6 +250,17 @@ Vector<T>& Vector<T>::operator =(const Vector<T> &vect)
 	return *this;
 }
 
+template <class T>
+Vector<T>& Vector<T>::operator =(Vector<T>&& vect) noexcept
+{
+	if(this!=&vect)
+	{
+		releaseData();
+		swap(vect);
+	}
+	return *this;
+}
+
 template <class T>
 Vector<T>& Vector<T>::operator +=(const Vector<T> &vect)
 {
@@ -305,7 +331,7 @@ Vector<T>& Vector<T>::operator /=(double val)
 
 
 template<class T>
-const Vector<T> operator+(const Vector<T>& vect1,const Vector<T>& vect2)
+Vector<T> operator+(const Vector<T>& vect1,const Vector<T>& vect2)
 {
 	vect1.dimcheck(vect2);
 	Vector<T> result(vect1);
@@ -314,7 +340,7 @@ const Vector<T> operator+(const Vector<T>& vect1,const Vector<T>& vect2)
 }
 
 template<class T>
-const Vector<T> operator-(const Vector<T>& vect1,const Vector<T>& vect2)
+Vector<T> operator-(const Vector<T>& vect1,const Vector<T>& vect2)
 {
 	vect1.dimcheck(vect2);
 	Vector<T> result(vect1);
@@ -323,7 +349,7 @@ const Vector<T> operator-(const Vector<T>& vect1,const Vector<T>& vect2)
 }
 
 template<class T>
-const Vector<T> operator*(const Vector<T>& vect1,const Vector<T>& vect2)
+Vector<T> operator*(const Vector<T>& vect1,const Vector<T>& vect2)
 {
 	vect1.dimcheck(vect2);
 	Vector<T> result(vect1);
@@ -332,7 +358,7 @@ const Vector<T> operator*(const Vector<T>& vect1,const Vector<T>& vect2)
 }
 
 template<class T>
-const Vector<T> operator/(const Vector<T>& vect1,const Vector<T>& vect2)
+Vector<T> operator/(const Vector<T>& vect1,const Vector<T>& vect2)
 {
 	vect1.dimcheck(vect2);
 	Vector<T> result(vect1);
@@ -0,0 +1,118 @@
+#include "VideoDecoder.h"
+#include <iostream>
+
+using namespace std;
+
+VideoDecoder::VideoDecoder(int _queueSize)
+{
+	queueSize=__max(_queueSize,1);
+	nFrames=firstFrame=0;
+	scale=1;
+	fps=0;
+	IsHorizontalWrap=false;
+	IsOpen=IsStarted=IsClosing=IsEnd=false;
+}
+
+bool VideoDecoder::open(const char* filename,double _scale,bool _IsHorizontalWrap)
+{
+	close();
+	if(!capture.open(filename))
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		return false;
+	}
+	nFrames=capture.get(cv::CAP_PROP_FRAME_COUNT);
+	fps=capture.get(cv::CAP_PROP_FPS);
+	scale=(_scale>0 && _scale<1)?_scale:1;
+	IsHorizontalWrap=_IsHorizontalWrap;
+	IsOpen=true;
+	IsStarted=IsClosing=IsEnd=false;
+	return true;
+}
+
+void VideoDecoder::start(int _firstFrame)
+{
+	if(!IsOpen || IsStarted)
+		return;
+	firstFrame=__max(_firstFrame,0);
+	IsStarted=true;
+	decoder=thread(&VideoDecoder::decodeFrames,this);
+}
+
+bool VideoDecoder::readFrame(DImage& frame)
+{
+	if(!IsOpen)
+		return false;
+	start();
+	unique_lock<std::mutex> lock(mutex);
+	IsNotEmpty.wait(lock,[this]{return !queue.empty() || IsEnd;});
+	if(queue.empty())
+		return false;
+	frame.swap(queue.front());
+	queue.pop_front();
+	IsNotFull.notify_one();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the thread of the decoder: the frames are decoded, converted and downsized outside the lock, and queued
+// in order until the end of the video, a frame that fails to decode, or close()
+//--------------------------------------------------------------------------------------------------------
+void VideoDecoder::decodeFrames()
+{
+	cv::Mat im;
+	for(int i=0;i<firstFrame;i++)
+		if(!capture.grab())
+		{
+			cout<<"Fail to skip frame "<<i<<"!"<<endl;
+			lock_guard<std::mutex> lock(mutex);
+			IsEnd=true;
+			IsNotEmpty.notify_all();
+			return;
+		}
+	DImage frame,resized;
+	double sigma=1/scale-1;
+	for(int i=firstFrame;;i++)
+	{
+		bool IsDecoded=capture.read(im) && frame.imread(im);
+		if(IsDecoded && scale<1)
+		{
+			frame.GaussianSmoothResize(resized,sigma,sigma*3,scale,IsHorizontalWrap);
+			frame.swap(resized);
+		}
+		unique_lock<std::mutex> lock(mutex);
+		if(!IsDecoded)
+		{
+			if(i<nFrames)
+				cout<<"Fail to decode frame "<<i<<"!"<<endl;
+			break;
+		}
+		IsNotFull.wait(lock,[this]{return (int)queue.size()<queueSize || IsClosing;});
+		if(IsClosing)
+			break;
+		queue.push_back(DImage());
+		queue.back().swap(frame);
+		IsNotEmpty.notify_one();
+	}
+	lock_guard<std::mutex> lock(mutex);
+	IsEnd=true;
+	IsNotEmpty.notify_all();
+}
+
+void VideoDecoder::close()
+{
+	if(!IsOpen)
+		return;
+	if(IsStarted)
+	{
+		{
+			lock_guard<std::mutex> lock(mutex);
+			IsClosing=true;
+		}
+		IsNotFull.notify_one();
+		decoder.join();
+	}
+	capture.release();
+	queue.clear();
+	IsOpen=IsStarted=false;
+}
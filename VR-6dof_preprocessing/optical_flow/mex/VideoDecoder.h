@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Image.h"
+#include <opencv2/videoio/videoio.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+//--------------------------------------------------------------------------------------------------------
+// decodes the frames of a video front to back on a thread of its own, the counterpart of VideoEncoder.
+// The thread decodes the frames with the FFmpeg backend of VideoCapture, converts them to DImage and
+// downsizes them by scale, into a bounded queue, so readFrame() only takes the next frame out of it and the
+// decoding overlaps with the solves of the pairs. It blocks only while the queue is empty. A frame of the
+// queue is a frame of doubles, 200MB at 4K, hence the short queue
+//--------------------------------------------------------------------------------------------------------
+class VideoDecoder
+{
+private:
+	cv::VideoCapture capture;
+	std::thread decoder;
+	std::mutex mutex;
+	std::condition_variable IsNotFull,IsNotEmpty;
+	std::deque<DImage> queue;
+	int queueSize,nFrames,firstFrame;
+	double scale,fps;
+	bool IsHorizontalWrap;
+	bool IsOpen,IsStarted,IsClosing,IsEnd;
+public:
+	VideoDecoder(int _queueSize=2);
+	~VideoDecoder() {close();};
+	// scale<1 downsizes the frames, smoothed first as the levels of GaussianPyramid; IsHorizontalWrap
+	// smooths across the left and right borders of 360 frames
+	bool open(const char* filename,double _scale=1,bool _IsHorizontalWrap=false);
+	// starts the thread of the decoder, which skips the frames before firstFrame without decoding them.
+	// readFrame() starts it at frame 0 otherwise
+	void start(int _firstFrame=0);
+	// the next frame, false at the end of the video or when a frame fails to decode
+	bool readFrame(DImage& frame);
+	void close();
+	inline bool isOpened() const {return IsOpen;};
+	// as the container of the video tells them, before any frame is decoded
+	inline int nframes() const {return nFrames;};
+	inline double getFPS() const {return fps;};
+private:
+	void decodeFrames();
+};
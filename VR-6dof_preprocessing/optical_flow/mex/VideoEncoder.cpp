@@ -0,0 +1,104 @@
+#include "VideoEncoder.h"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+VideoEncoder::VideoEncoder(int _queueSize)
+{
+	queueSize=__max(_queueSize,1);
+	nFrames=0;
+	IsOpen=IsClosing=IsHardware=false;
+}
+
+bool VideoEncoder::open(const char* filename,int width,int height,double fps,Acceleration acceleration)
+{
+	close();
+	IsHardware=false;
+#ifdef OPTICALFLOW_HAS_VIDEO_ACCELERATION
+	if(acceleration==Hardware)
+	{
+		vector<int> params;
+		params.push_back(cv::VIDEOWRITER_PROP_HW_ACCELERATION);
+		params.push_back(cv::VIDEO_ACCELERATION_ANY);
+		if(writer.open(filename,cv::CAP_FFMPEG,cv::VideoWriter::fourcc('a','v','c','1'),fps,cv::Size(width,height),params))
+			IsHardware=writer.get(cv::VIDEOWRITER_PROP_HW_ACCELERATION)!=cv::VIDEO_ACCELERATION_NONE;
+	}
+#endif
+	if(acceleration==Hardware && !IsHardware)
+		cout<<"No hardware encoder for "<<filename<<", encoding on the CPU"<<endl;
+	if(!IsHardware && !writer.open(filename,cv::VideoWriter::fourcc('m','p','4','v'),fps,cv::Size(width,height),true))
+	{
+		cout<<"Fail to open "<<filename<<"!"<<endl;
+		return false;
+	}
+	nFrames=0;
+	IsOpen=true;
+	IsClosing=false;
+	encoder=thread(&VideoEncoder::encodeFrames,this);
+	return true;
+}
+
+bool VideoEncoder::writeFrame(const BiImage& frame)
+{
+	if(!IsOpen)
+		return false;
+	if(frame.nchannels()!=1 && frame.nchannels()!=3)
+	{
+		cout<<"VideoEncoder only encodes frames of 1 or 3 channels!"<<endl;
+		return false;
+	}
+	unique_lock<std::mutex> lock(mutex);
+	IsNotFull.wait(lock,[this]{return (int)queue.size()<queueSize;});
+	queue.push_back(frame);
+	nFrames++;
+	IsNotEmpty.notify_one();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the thread of the encoder: the frames are expanded to BGR outside the lock and encoded in order until
+// the queue is closed and empty
+//--------------------------------------------------------------------------------------------------------
+void VideoEncoder::encodeFrames()
+{
+	cv::Mat im;
+	while(true)
+	{
+		BiImage frame;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			IsNotEmpty.wait(lock,[this]{return !queue.empty() || IsClosing;});
+			if(queue.empty())
+				break;
+			frame=queue.front();
+			queue.pop_front();
+			IsNotFull.notify_one();
+		}
+		im.create(frame.height(),frame.width(),CV_8UC3);
+		int nChannels=frame.nchannels();
+		for(int i=0;i<frame.height();i++)
+		{
+			unsigned char* pRow=im.data+i*im.step;
+			const unsigned char* pFrame=frame.data()+i*frame.width()*nChannels;
+			for(int j=0;j<frame.width();j++)
+				for(int k=0;k<3;k++)
+					pRow[j*3+k]=pFrame[j*nChannels+((nChannels==3)?k:0)];
+		}
+		writer.write(im);
+	}
+}
+
+void VideoEncoder::close()
+{
+	if(!IsOpen)
+		return;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		IsClosing=true;
+	}
+	IsNotEmpty.notify_one();
+	encoder.join();
+	writer.release();
+	IsOpen=false;
+}
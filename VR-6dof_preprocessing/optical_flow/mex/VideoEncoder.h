@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Image.h"
+#include <opencv2/videoio/videoio.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// the hardware acceleration properties of VideoCapture and VideoWriter appeared in OpenCV 4.5.2
+#if defined(CV_VERSION_MAJOR) && (CV_VERSION_MAJOR>4 || (CV_VERSION_MAJOR==4 && (CV_VERSION_MINOR>5 || (CV_VERSION_MINOR==5 && CV_VERSION_REVISION>=2))))
+#define OPTICALFLOW_HAS_VIDEO_ACCELERATION
+#endif
+
+//--------------------------------------------------------------------------------------------------------
+// encodes 8-bit frames into a video on a thread of its own, such as the depth and the alpha videos of the
+// viewer. writeFrame() copies the frame into a bounded queue and returns, so the encoding overlaps with
+// the computation of the next frames, and it blocks only while queueSize frames are waiting. With Hardware
+// the frames are encoded as H.264 by the encoder of the GPU that FFmpeg finds (NVENC, QSV, VA-API...),
+// which needs OpenCV 4.5.2 or later; without one, the video is encoded by the MPEG-4 encoder of the CPU
+//--------------------------------------------------------------------------------------------------------
+class VideoEncoder
+{
+public:
+	enum Acceleration {Software=0,Hardware=1};
+private:
+	cv::VideoWriter writer;
+	std::thread encoder;
+	std::mutex mutex;
+	std::condition_variable IsNotFull,IsNotEmpty;
+	std::deque<BiImage> queue;
+	int queueSize,nFrames;
+	bool IsOpen,IsClosing,IsHardware;
+public:
+	VideoEncoder(int _queueSize=8);
+	~VideoEncoder() {close();};
+	bool open(const char* filename,int width,int height,double fps,Acceleration acceleration=Software);
+	// a frame of 1 channel (gray) or 3 channels (BGR)
+	bool writeFrame(const BiImage& frame);
+	// waits for the frames in the queue to be encoded
+	void close();
+	inline bool isOpened() const {return IsOpen;};
+	inline bool isHardware() const {return IsHardware;};
+	inline int nframes() const {return nFrames;};
+private:
+	void encodeFrames();
+};
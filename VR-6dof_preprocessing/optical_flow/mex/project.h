@@ -5,6 +5,8 @@
 // if the files are compiled in linux or mac os then uncomment the following line, otherwise comment it if you compile using visual studio in windows
 // #define _LINUX_MAC
 // #define _OPENCV
+// uncomment to run Coarse2FineFlow on a CUDA device with the gpu module of OpenCV, see OpticalFlowGPU.h
+// #define _OPENCV_GPU
 
 template <class T>
 void _Release1DBuffer(T* pBuffer)
@@ -24,7 +26,12 @@ void _Rlease2DBuffer(T** pBuffer,size_t nElements)
 }
 
 
+// the mex files are compiled with _MATLAB. The standalone build (../CMakeLists.txt) defines _NO_MATLAB instead,
+// together with _OPENCV and _LINUX_MAC, and loads the images through ImageIO. The WebAssembly build defines
+// _NO_IMAGEIO as well, its images come from the buffers of JavaScript and there is no OpenCV
+#ifndef _NO_MATLAB
 #define _MATLAB
+#endif
 
 #ifdef _MATLAB
 #include "mex.h"
@@ -0,0 +1,455 @@
+// Python bindings of the optical flow library, the module opticalflow built with -DOPTICALFLOW_PYTHON=ON
+//
+// usage:
+//
+//   import numpy as np, opticalflow
+//   solver = opticalflow.FlowSolver(alpha=0.012, ratio=0.75, min_width=20, outer=7, inner=1, sor=30)
+//   solver.parameters.sorScheme = opticalflow.SORScheme.RedBlack
+//   vx, vy, warpI2 = solver.flow(im1, im2)
+//   vx, vy, warpI2 = solver.flow(im1, im2, prior_vx, prior_vy, skip_levels=2)
+//   vx, vy, vxB, vyB, occlusion = solver.flow_bidirectional(im1, im2)
+//   vx, vy = opticalflow.OpticalFlowBatch(alpha=0.012).run(frames)
+//   results = opticalflow.FlowSweep().run(im1, im2, [dict(alpha=0.012, ratio=0.75), dict(alpha=0.02, ratio=0.75)])
+//
+// the frames are arrays of (height,width) or (height,width,channels), the same layout as Image, and frames
+// of run() are stacked into (n,height,width[,channels]). A C-contiguous float64 array is solved in place by
+// FlowSolver and a float32 one by FlowSolverFloat, without a copy; other float arrays are converted, and uint8
+// and uint16 arrays are divided by 255 as in Coarse2FineTwoFrames. The flow fields are returned in the
+// buffers the solver allocated for them, without a copy either.
+//
+// The GIL is released during the solves, so a pool of Python threads solves several pairs concurrently with
+// one solver per thread; a solver keeps its workspace between the calls and is not shared between threads.
+// OpticalFlowBatch solves the pairs of its frames on its own threads with opticalflow.parameters
+
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include "OpticalFlowBatch.h"
+#include "FlowSweep.h"
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace py=pybind11;
+using namespace pybind11::literals;
+
+//--------------------------------------------------------------------------------------------------------
+// the frames of an array that are integers are divided by 255
+//--------------------------------------------------------------------------------------------------------
+static bool IsQuantized(const py::array& array)
+{
+	return array.dtype().kind()=='u' && array.itemsize()<=2;
+}
+
+template <class T,class T1>
+static void Dequantize(T* data,const T1* samples,size_t nElements)
+{
+	for(size_t i=0;i<nElements;i++)
+		data[i]=(double)samples[i]/255;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the image of an array of (height,width) or (height,width,channels), attached to the buffer of the array
+// when it is C-contiguous of type T and to a converted copy otherwise
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class ArrayImage
+{
+public:
+	Image<T> image;
+private:
+	// keeps the buffer alive while it is attached
+	py::array_t<T,py::array::c_style|py::array::forcecast> array;
+public:
+	ArrayImage(const py::array& input,const char* name)
+	{
+		if(input.ndim()!=2 && input.ndim()!=3)
+			throw std::invalid_argument(std::string(name)+" must have 2 or 3 dimensions");
+		if(IsQuantized(input))
+		{
+			py::array samples=py::array::ensure(input,py::array::c_style);
+			array=py::array_t<T,py::array::c_style|py::array::forcecast>(std::vector<py::ssize_t>(input.shape(),input.shape()+input.ndim()));
+			if(input.itemsize()==1)
+				Dequantize(array.mutable_data(),(const unsigned char*)samples.data(),array.size());
+			else
+				Dequantize(array.mutable_data(),(const unsigned short*)samples.data(),array.size());
+		}
+		else
+			array=py::array_t<T,py::array::c_style|py::array::forcecast>::ensure(input);
+		if(!array)
+			throw std::invalid_argument(std::string(name)+" is not an array of numbers");
+		int nChannels=(array.ndim()==3) ? array.shape(2) : 1;
+		image.attach(const_cast<T*>(array.data()),array.shape(1),array.shape(0),nChannels);
+	}
+	~ArrayImage() {image.detach();}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// the buffer of an image handed to an array of (height,width[,channels]), freed with the array
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+static void DeleteBuffer(void* data)
+{
+	delete [](T*)data;
+}
+
+template <class T>
+static py::array_t<T> ToArray(Image<T>& image)
+{
+	std::vector<py::ssize_t> shape;
+	shape.push_back(image.height());
+	shape.push_back(image.width());
+	if(image.nchannels()>1)
+		shape.push_back(image.nchannels());
+	if(image.IsEmpty())
+		return py::array_t<T>(std::vector<py::ssize_t>(2,0));
+	T* data=image.detach();
+	py::capsule owner(data,&DeleteBuffer<T>);
+	return py::array_t<T>(shape,data,owner);
+}
+
+template <class T>
+static void CheckPair(const Image<T>& Im1,const Image<T>& Im2,const char* message)
+{
+	if(!Im1.matchDimension(Im2))
+		throw std::invalid_argument(message);
+}
+
+static py::list Statistics(const std::vector<SolverStatistics>& statistics)
+{
+	py::list levels;
+	for(size_t k=0;k<statistics.size();k++)
+	{
+		const SolverStatistics& s=statistics[k];
+		levels.append(py::dict("width"_a=s.width,"height"_a=s.height,"nOuterIterations"_a=s.nOuterIterations,"nSolverIterations"_a=s.nSolverIterations,
+			"lastUpdate"_a=s.lastUpdate,"lastResidual"_a=s.lastResidual,"warpTime"_a=s.warpTime,"derivativeTime"_a=s.derivativeTime,
+			"weightTime"_a=s.weightTime,"assemblyTime"_a=s.assemblyTime,"solverTime"_a=s.solverTime,"noiseTime"_a=s.noiseTime,
+			"workspaceMemory"_a=s.workspaceMemory,"peakMemory"_a=s.peakMemory));
+	}
+	return levels;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the frames of run() from an array of (n,height,width[,channels]), read in place and converted one by one
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class ArraySource : public OpticalFlowBatch<T>::FrameSource
+{
+	const void* samples;
+	int nFrames,width,height,nChannels;
+	int sampleType;	// 0 for T, 1 for uint8, 2 for uint16
+public:
+	ArraySource(const py::array& frames)
+	{
+		nFrames=frames.shape(0);
+		height=frames.shape(1);
+		width=frames.shape(2);
+		nChannels=(frames.ndim()==4) ? frames.shape(3) : 1;
+		sampleType=IsQuantized(frames) ? frames.itemsize() : 0;
+		samples=frames.data();
+	}
+	int nframes() {return nFrames;}
+	bool frameDimension(int& _width,int& _height,int& _nchannels)
+	{
+		_width=width;
+		_height=height;
+		_nchannels=nChannels;
+		return true;
+	}
+	bool loadFrame(int index,Image<T>& frame)
+	{
+		if(index<0 || index>=nFrames)
+			return false;
+		frame.allocate(width,height,nChannels);
+		size_t nElements=frame.nelements(),offset=(size_t)index*nElements;
+		switch(sampleType)
+		{
+		case 0:
+			memcpy(frame.data(),(const T*)samples+offset,sizeof(T)*nElements);
+			break;
+		case 1:
+			Dequantize(frame.data(),(const unsigned char*)samples+offset,nElements);
+			break;
+		default:
+			Dequantize(frame.data(),(const unsigned short*)samples+offset,nElements);
+		}
+		return true;
+	}
+};
+
+// the flow of pair firstPair+k into slice k of the two arrays
+template <class T>
+class ArraySink : public OpticalFlowBatch<T>::FlowSink
+{
+	T *pVx,*pVy;
+	int firstPair,nPairs;
+	size_t nPixels;
+public:
+	ArraySink(T* _pVx,T* _pVy,int _firstPair,int _nPairs,size_t _nPixels) : pVx(_pVx),pVy(_pVy),firstPair(_firstPair),nPairs(_nPairs),nPixels(_nPixels) {}
+	bool writeFlow(int index,const Image<T>& vx,const Image<T>& vy)
+	{
+		int k=index-firstPair;
+		if(k<0 || k>=nPairs || (size_t)vx.npixels()!=nPixels)
+			return false;
+		memcpy(pVx+k*nPixels,vx.data(),sizeof(T)*nPixels);
+		memcpy(pVy+k*nPixels,vy.data(),sizeof(T)*nPixels);
+		return true;
+	}
+};
+
+//--------------------------------------------------------------------------------------------------------
+// FlowSolver<T> and OpticalFlowBatch<T> under the names of the precision
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+static void BindSolver(py::module& m,const char* solverName,const char* batchName)
+{
+	typedef FlowSolver<T> Solver;
+	typedef Image<T> TImage;
+	py::class_<Solver>(m,solverName)
+		.def(py::init<double,double,int,int,int,int>(),"alpha"_a=1,"ratio"_a=0.5,"min_width"_a=40,"outer"_a=3,"inner"_a=1,"sor"_a=20)
+		.def_readwrite("alpha",&Solver::alpha)
+		.def_readwrite("ratio",&Solver::ratio)
+		.def_readwrite("min_width",&Solver::minWidth)
+		.def_readwrite("outer",&Solver::nOuterFPIterations)
+		.def_readwrite("inner",&Solver::nInnerFPIterations)
+		.def_readwrite("sor",&Solver::nSORIterations)
+		.def_readwrite("parameters",&Solver::parameters)
+		.def("flow",[](Solver& solver,const py::array& im1,const py::array& im2,py::object priorVx,py::object priorVy,int nSkipLevels)
+		{
+			ArrayImage<T> Im1(im1,"im1"),Im2(im2,"im2");
+			CheckPair(Im1.image,Im2.image,"The two images don't match!");
+			TImage vx,vy,warpI2;
+			if(priorVx.is_none() || priorVy.is_none())
+			{
+				py::gil_scoped_release release;
+				solver.Coarse2FineFlow(vx,vy,warpI2,Im1.image,Im2.image);
+			}
+			else
+			{
+				ArrayImage<T> Vx(priorVx.cast<py::array>(),"prior_vx"),Vy(priorVy.cast<py::array>(),"prior_vy");
+				if(!Vx.image.matchDimension(Im1.image.width(),Im1.image.height(),1) || !Vy.image.matchDimension(Vx.image))
+					throw std::invalid_argument("The prior flow doesn't match the images!");
+				py::gil_scoped_release release;
+				typename Solver::Pyramid Pyramid1,Pyramid2;
+				solver.BuildPyramid(Pyramid1,Im1.image);
+				solver.BuildPyramid(Pyramid2,Im2.image);
+				solver.Coarse2FineFlow(vx,vy,warpI2,Pyramid1,Pyramid2,Vx.image,Vy.image,nSkipLevels);
+			}
+			return py::make_tuple(ToArray(vx),ToArray(vy),ToArray(warpI2));
+		},"im1"_a,"im2"_a,"prior_vx"_a=py::none(),"prior_vy"_a=py::none(),"skip_levels"_a=0)
+		.def("flow_bidirectional",[](Solver& solver,const py::array& im1,const py::array& im2)
+		{
+			ArrayImage<T> Im1(im1,"im1"),Im2(im2,"im2");
+			CheckPair(Im1.image,Im2.image,"The two images don't match!");
+			TImage vx,vy,vxB,vyB,occlusion;
+			{
+				py::gil_scoped_release release;
+				solver.Coarse2FineFlowBidirectional(vx,vy,vxB,vyB,occlusion,Im1.image,Im2.image);
+			}
+			return py::make_tuple(ToArray(vx),ToArray(vy),ToArray(vxB),ToArray(vyB),ToArray(occlusion));
+		},"im1"_a,"im2"_a)
+		.def("set_roi",[](Solver& solver,const py::array& mask)
+		{
+			ArrayImage<T> Mask(mask,"mask");
+			solver.setROI(Mask.image);
+		},"mask"_a)
+		.def("clear_roi",&Solver::clearROI)
+		.def("set_confidence",&Solver::setConfidence,"enabled"_a)
+		// a copy, the solver keeps its own for the next solve
+		.def("confidence",[](const Solver& solver)
+		{
+			TImage confidence(solver.confidence());
+			return ToArray(confidence);
+		})
+		.def("statistics",[](const Solver& solver) {return Statistics(solver.statistics());})
+		// the bytes of a solve of two frames of (height,width[,channels]) with the parameters of the solver
+		.def("predict_memory",[](const Solver& solver,int height,int width,int channels)
+		{
+			return OpticalFlowT<T>::predictMemory(width,height,channels,solver.ratio,solver.minWidth,solver.parameters);
+		},"height"_a,"width"_a,"channels"_a=1)
+		.def("statistics_json",[](const Solver& solver)
+		{
+			std::ostringstream os;
+			solver.writeStatistics(os);
+			return os.str();
+		});
+
+	typedef OpticalFlowBatch<T> Batch;
+	py::class_<Batch>(m,batchName)
+		.def(py::init<double,double,int,int,int,int>(),"alpha"_a=1,"ratio"_a=0.5,"min_width"_a=40,"outer"_a=3,"inner"_a=1,"sor"_a=20)
+		.def_readwrite("alpha",&Batch::alpha)
+		.def_readwrite("ratio",&Batch::ratio)
+		.def_readwrite("min_width",&Batch::minWidth)
+		.def_readwrite("outer",&Batch::nOuterFPIterations)
+		.def_readwrite("inner",&Batch::nInnerFPIterations)
+		.def_readwrite("sor",&Batch::nSORIterations)
+		.def_readwrite("threads",&Batch::nThreads)
+		.def_readwrite("devices",&Batch::nDevices)
+		.def_readwrite("device_threads",&Batch::workersPerDevice)
+		.def_readwrite("host_threads",&Batch::nHostWorkers)
+		.def_readwrite("memory_budget",&Batch::memoryBudget)
+		.def_readwrite("latitude_adaptive",&Batch::IsLatitudeAdaptive)
+		.def_readwrite("rotation_aligned",&Batch::IsRotationAligned)
+		.def_readwrite("classified",&Batch::IsClassified)
+		.def_property("cut_distance",[](const Batch& batch) {return batch.classifier.cutDistance;},
+							[](Batch& batch,double distance) {batch.classifier.cutDistance=distance;})
+		.def_property("static_residual",[](const Batch& batch) {return batch.classifier.staticResidual;},
+							[](Batch& batch,double residual) {batch.classifier.staticResidual=residual;})
+		.def_readwrite("first_pair",&Batch::firstPair)
+		.def_readwrite("last_pair",&Batch::lastPair)
+		.def_readwrite("keyframe_interval",&Batch::keyframeInterval)
+		.def_readwrite("keyframe_residual",&Batch::keyframeResidual)
+		// the peak bytes of run() on pairs of frames of (height,width[,channels])
+		.def("predict_memory",[](const Batch& batch,int pairs,int height,int width,int channels)
+		{
+			return batch.predictMemory(width,height,channels,pairs);
+		},"pairs"_a,"height"_a,"width"_a,"channels"_a=1)
+		// the flow of the pairs [first_pair,last_pair) as two arrays of (pairs,height,width)
+		.def("run",[](Batch& batch,const py::array& input)
+		{
+			if(input.ndim()!=3 && input.ndim()!=4)
+				throw std::invalid_argument("frames must have 3 or 4 dimensions");
+			py::array frames=IsQuantized(input) ? py::array::ensure(input,py::array::c_style)
+															: py::array(py::array_t<T,py::array::c_style|py::array::forcecast>::ensure(input));
+			if(!frames)
+				throw std::invalid_argument("frames is not an array of numbers");
+			int nClipPairs=frames.shape(0)-1;
+			int end=(batch.lastPair>0) ? __min(batch.lastPair,nClipPairs) : nClipPairs;
+			int nPairs=__max(end-batch.firstPair,0);
+			py::array_t<T> vx(std::vector<py::ssize_t>{nPairs,frames.shape(1),frames.shape(2)});
+			py::array_t<T> vy(std::vector<py::ssize_t>{nPairs,frames.shape(1),frames.shape(2)});
+			ArraySource<T> source(frames);
+			ArraySink<T> sink(vx.mutable_data(),vy.mutable_data(),batch.firstPair,nPairs,(size_t)frames.shape(1)*frames.shape(2));
+			int nWritten;
+			{
+				py::gil_scoped_release release;
+				nWritten=batch.run(source,sink);
+			}
+			if(nWritten<nPairs)
+				throw std::runtime_error("Fail to solve the frame pairs!");
+			return py::make_tuple(vx,vy);
+		},"frames"_a);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// FlowSweep<T>, its settings dicts of the keys of the arguments of FlowSolver and fine_levels, and its
+// results dicts of the flow, the times, the residual and the statistics of every setting
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+static typename FlowSweep<T>::Setting SweepSetting(const py::dict& dict)
+{
+	typename FlowSweep<T>::Setting setting;
+	if(dict.contains("alpha")) setting.alpha=dict["alpha"].cast<double>();
+	if(dict.contains("ratio")) setting.ratio=dict["ratio"].cast<double>();
+	if(dict.contains("min_width")) setting.minWidth=dict["min_width"].cast<int>();
+	if(dict.contains("outer")) setting.nOuterFPIterations=dict["outer"].cast<int>();
+	if(dict.contains("inner")) setting.nInnerFPIterations=dict["inner"].cast<int>();
+	if(dict.contains("sor")) setting.nSORIterations=dict["sor"].cast<int>();
+	if(dict.contains("fine_levels")) setting.nFineLevels=dict["fine_levels"].cast<int>();
+	return setting;
+}
+
+template <class T>
+static void BindSweep(py::module& m,const char* sweepName)
+{
+	typedef FlowSweep<T> Sweep;
+	py::class_<Sweep>(m,sweepName)
+		.def(py::init<>())
+		.def_readwrite("parameters",&Sweep::parameters)
+		// the alpha and the iterations of the levels coarser than the fine_levels of a setting
+		.def_property("coarse",[](const Sweep& sweep)
+		{
+			return py::dict("alpha"_a=sweep.coarse.alpha,"outer"_a=sweep.coarse.nOuterFPIterations,"inner"_a=sweep.coarse.nInnerFPIterations,
+							"sor"_a=sweep.coarse.nSORIterations);
+		},[](Sweep& sweep,const py::dict& dict) {sweep.coarse=SweepSetting<T>(dict);})
+		.def_readonly("sweep_time",&Sweep::sweepTime)
+		.def("level_solves",&Sweep::nLevelSolves)
+		.def("run",[](Sweep& sweep,const py::array& im1,const py::array& im2,const py::list& dicts)
+		{
+			ArrayImage<T> Im1(im1,"im1"),Im2(im2,"im2");
+			CheckPair(Im1.image,Im2.image,"The two images don't match!");
+			std::vector<typename Sweep::Setting> settings;
+			for(size_t i=0;i<dicts.size();i++)
+				settings.push_back(SweepSetting<T>(dicts[i].cast<py::dict>()));
+			std::vector<typename Sweep::Result> results;
+			{
+				py::gil_scoped_release release;
+				sweep.Run(Im1.image,Im2.image,settings,results);
+			}
+			py::list list;
+			for(size_t i=0;i<results.size();i++)
+			{
+				typename Sweep::Result& result=results[i];
+				list.append(py::dict("vx"_a=ToArray(result.vx),"vy"_a=ToArray(result.vy),"warpI2"_a=ToArray(result.warpI2),
+					"time"_a=result.time,"pyramid_time"_a=result.pyramidTime,"residual"_a=result.residual,
+					"shared_levels"_a=result.nSharedLevels,"statistics"_a=Statistics(result.statistics)));
+			}
+			return list;
+		},"im1"_a,"im2"_a,"settings"_a);
+}
+
+PYBIND11_MODULE(opticalflow,m)
+{
+	m.doc()="Coarse2FineFlow of NumPy frames, see OpticalFlowPython.cpp";
+
+	py::enum_<OpticalFlowBase::InterpolationMethod>(m,"InterpolationMethod")
+		.value("Bilinear",OpticalFlowBase::Bilinear)
+		.value("Bicubic",OpticalFlowBase::Bicubic);
+	py::enum_<OpticalFlowBase::NoiseModel>(m,"NoiseModel")
+		.value("GMixture",OpticalFlowBase::GMixture)
+		.value("Lap",OpticalFlowBase::Lap);
+	py::enum_<OpticalFlowBase::SORScheme>(m,"SORScheme")
+		.value("Lexicographic",OpticalFlowBase::Lexicographic)
+		.value("RedBlack",OpticalFlowBase::RedBlack);
+	py::enum_<OpticalFlowBase::LinearSolver>(m,"LinearSolver")
+		.value("SOR",OpticalFlowBase::SOR)
+		.value("PCG",OpticalFlowBase::PCG);
+	py::enum_<OpticalFlowBase::Backend>(m,"Backend")
+		.value("CPU",OpticalFlowBase::CPU)
+		.value("GPU",OpticalFlowBase::GPU)
+		.value("Preview",OpticalFlowBase::Preview);
+
+	typedef OpticalFlowBase::Parameters Parameters;
+	py::class_<Parameters>(m,"Parameters")
+		.def(py::init<>())
+		.def_readwrite("IsDisplay",&Parameters::IsDisplay)
+		.def_readwrite("interpolation",&Parameters::interpolation)
+		.def_readwrite("noiseModel",&Parameters::noiseModel)
+		.def_readwrite("IsGaussianMixtureTable",&Parameters::IsGaussianMixtureTable)
+		.def_readwrite("noiseSamples",&Parameters::noiseSamples)
+		.def_readwrite("sorScheme",&Parameters::sorScheme)
+		.def_readwrite("linearSolver",&Parameters::linearSolver)
+		.def_readwrite("solverTolerance",&Parameters::solverTolerance)
+		.def_readwrite("updateTolerance",&Parameters::updateTolerance)
+		.def_readwrite("sweepTolerance",&Parameters::sweepTolerance)
+		.def_readwrite("IsPlanar",&Parameters::IsPlanar)
+		.def_readwrite("roiDilation",&Parameters::roiDilation)
+		.def_readwrite("tileRows",&Parameters::tileRows)
+		.def_readwrite("tileHalo",&Parameters::tileHalo)
+		.def_readwrite("occlusionRatio",&Parameters::occlusionRatio)
+		.def_readwrite("occlusionOffset",&Parameters::occlusionOffset)
+		.def_readwrite("nThreads",&Parameters::nThreads)
+		.def_readwrite("IsHorizontalWrap",&Parameters::IsHorizontalWrap)
+		.def_readwrite("upsampleSigma",&Parameters::upsampleSigma)
+		.def_readwrite("IsHalfPyramid",&Parameters::IsHalfPyramid)
+		.def_readwrite("backend",&Parameters::backend);
+	// the settings of OpticalFlowBatch and of the solves without a FlowSolver
+	m.attr("parameters")=py::cast(&OpticalFlowBase::parameters,py::return_value_policy::reference);
+	// the bytes held by the images of the process, see MemoryAccounting.h
+	m.def("memory_current",&MemoryAccounting::current);
+	m.def("memory_peak",&MemoryAccounting::peak);
+	m.def("reset_memory_peak",&MemoryAccounting::resetPeak);
+	// the threads and the grain of the elementwise operations of the images, see ParallelFor.h
+	m.def("set_image_threads",[](int n) {ParallelFor::nThreads()=n;},"threads"_a);
+	m.def("set_image_grain",[](int size) {ParallelFor::grainSize()=size;},"elements"_a);
+
+	BindSolver<double>(m,"FlowSolver","OpticalFlowBatch");
+	BindSolver<float>(m,"FlowSolverFloat","OpticalFlowBatchFloat");
+	BindSweep<double>(m,"FlowSweep");
+	BindSweep<float>(m,"FlowSweepFloat");
+}
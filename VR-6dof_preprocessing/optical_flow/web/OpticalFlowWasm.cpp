@@ -0,0 +1,118 @@
+// WebAssembly module of the optical flow library, opticalflow.js built with emcmake cmake (see ../CMakeLists.txt),
+// for the preview depth of short clips in the browser
+//
+// usage, in a Worker, since the solves block the thread that calls them:
+//
+//   const flow = await OpticalFlowModule();
+//   const depth = new flow.PreviewDepth(width, height);
+//   depth.threads = 4;                              // the pairs solved at once, all the cores by default
+//   depth.variational = false;                      // the dense inverse search of PreviewFlow, Coarse2FineFlow if true
+//   const depths = depth.addFrames(rgba, nFrames);  // Uint8Array of the depth of every pair, width*height each
+//   depth.reset();                                  // a new clip, or a cut
+//
+// rgba holds nFrames frames of width x height, 4 bytes a pixel as the data of an ImageData. The first frame of a
+// call makes a pair with the last frame of the call before, so the first call returns nFrames-1 depths and the
+// next ones nFrames. The depths are the inverse depth of FlowDepth quantized to 8 bits, 255 the nearest, of the
+// first frame of every pair. They are a view of the memory of the module, valid until the next call: copy them
+// with slice() to keep them. The pairs are solved on the pthreads of the module, one FlowSolver per thread, and
+// their depths are accumulated in order
+
+#include "project.h"
+#include "Image.h"
+#include "OpticalFlow.h"
+#include "FlowDepth.h"
+#include <emscripten/bind.h>
+#include <emscripten/val.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------
+// the depth of the frames of a clip as they are added
+//--------------------------------------------------------------------------------------------------------
+class PreviewDepth
+{
+	int width,height;
+	// the last frame of the last call, the first of the next pair
+	FImage last;
+	FFlowDepth depth;
+	std::vector<FFlowSolver> solvers;
+	std::vector<unsigned char> depths;
+public:
+	int nThreads;
+	bool IsVariational;
+
+	PreviewDepth(int _width,int _height) : width(_width),height(_height),nThreads(0),IsVariational(false) {}
+
+	void reset()
+	{
+		last.clear();
+		depth.reset();
+	}
+
+	emscripten::val addFrames(const emscripten::val& rgba,int nFrames)
+	{
+		std::vector<unsigned char> samples=emscripten::convertJSArrayToNumberVector<unsigned char>(rgba);
+		size_t nPixels=(size_t)width*height;
+		nFrames=__max(__min(nFrames,(int)(samples.size()/__max(nPixels*4,(size_t)1))),0);
+		// the frames of the pairs, the last one of the last call first
+		std::vector<FImage> frames(nFrames+1);
+		int first=last.IsEmpty() ? 1 : 0;
+		if(first==0)
+			frames[0]=last;
+		for(int i=0;i<nFrames;i++)
+		{
+			FImage& frame=frames[i+1];
+			frame.allocate(width,height,3);
+			const unsigned char* pixels=&samples[i*nPixels*4];
+			float* pData=frame.data();
+			for(size_t p=0;p<nPixels;p++)
+				for(int c=0;c<3;c++)
+					pData[p*3+c]=(float)pixels[p*4+c]/255;
+		}
+		int nPairs=__max(nFrames-first,0);
+		std::vector<FImage> vx(nPairs),vy(nPairs);
+		int nWorkers=__max(__min((nThreads>0) ? nThreads : (int)std::thread::hardware_concurrency(),nPairs),1);
+		if((int)solvers.size()<nWorkers)
+			solvers.resize(nWorkers,FFlowSolver(0.012,0.75,20,3,1,20));
+		std::atomic<int> next(0);
+		auto solve=[&](int worker)
+		{
+			FFlowSolver& solver=solvers[worker];
+			solver.parameters.backend=IsVariational ? OpticalFlowBase::CPU : OpticalFlowBase::Preview;
+			solver.parameters.IsHorizontalWrap=true;
+			solver.parameters.nThreads=1;
+			FImage warpI2;
+			for(int k;(k=next++)<nPairs;)
+				solver.Coarse2FineFlow(vx[k],vy[k],warpI2,frames[first+k],frames[first+k+1]);
+		};
+		std::vector<std::thread> pool;
+		for(int t=1;t<nWorkers;t++)
+			pool.emplace_back(solve,t);
+		solve(0);
+		for(size_t t=0;t<pool.size();t++)
+			pool[t].join();
+
+		depths.resize(nPairs*nPixels);
+		BiImage depth8;
+		for(int k=0;k<nPairs;k++)
+		{
+			depth.addFrame(vx[k],vy[k],depth8);
+			memcpy(&depths[k*nPixels],depth8.data(),nPixels);
+		}
+		if(nFrames>0)
+			last=frames[nFrames];
+		return emscripten::val(emscripten::typed_memory_view(depths.size(),depths.data()));
+	}
+};
+
+EMSCRIPTEN_BINDINGS(opticalflow)
+{
+	emscripten::class_<PreviewDepth>("PreviewDepth")
+		.constructor<int,int>()
+		.property("threads",&PreviewDepth::nThreads)
+		.property("variational",&PreviewDepth::IsVariational)
+		.function("addFrames",&PreviewDepth::addFrames)
+		.function("reset",&PreviewDepth::reset);
+}
@@ -245,6 +245,11 @@ limitations under the License.
     
     void OVR::GLEContext::InitExtensionLoad()
     {
+    #if defined(GLE_LAZY_LOAD)
+        // Everything else is resolved by LazyLoad on its first call. Only the EXT framebuffer mapping below has to be
+        // decided here, as it loads those pointers under names other than their own.
+        GLELoadProc(glBindFramebuffer_Impl, glBindFramebuffer);
+    #else
         // GL_VERSION_1_1
         // We don't load these but rather link to them directly.
         
@@ -653,6 +658,8 @@ limitations under the License.
         GLELoadProc(glRenderbufferStorage_Impl, glRenderbufferStorage);
         GLELoadProc(glRenderbufferStorageMultisample_Impl, glRenderbufferStorageMultisample);
 
+    #endif
+
         if(!glBindFramebuffer_Impl) // This will rarely if ever be the case in practice with modern computers and drivers.
         {
             // See if we can map GL_EXT_framebuffer_object to GL_ARB_framebuffer_object. The former is basically a subset of the latter, but we use only that subset.
@@ -678,6 +685,7 @@ limitations under the License.
           //GLELoadProc(glRenderbufferStorageMultisample_Impl, glRenderbufferStorageMultisampleEXT (nonexistent));
         }
         
+    #if !defined(GLE_LAZY_LOAD)
         // GL_ARB_texture_multisample
         GLELoadProc(glGetMultisamplefv_Impl, glGetMultisamplefv);
         GLELoadProc(glSampleMaski_Impl, glSampleMaski);
@@ -744,6 +752,7 @@ limitations under the License.
 
         // GL_WIN_swap_hint
         GLELoadProc(glAddSwapHintRectWIN_Impl, glAddSwapHintRectWIN);
+    #endif
     }
     
 
@@ -186,6 +186,13 @@ namespace OVR
         void SetEnableHookGetError(bool enabled)
             { EnableHookGetError = enabled; }
 
+    #if defined(GLE_LAZY_LOAD)
+        // Resolves the function pointer impl by its OpenGL name and keeps it. Called by GLEGetCurrentFunction while impl is NULL.
+        template <typename T>
+        T LazyLoad(T& impl, const char* name)
+            { impl = (T)GLEGetProcAddress(name); return impl; }
+    #endif
+
         // Returns the default instance of this class.
         static GLEContext* GetCurrentContext();
         
@@ -135,11 +135,23 @@ limitations under the License.
     #define GLE_HOOKING_ENABLED 1
 #endif
 
+// GLE_LAZY_LOAD
+// When enabled, Init resolves none of the function pointers of InitExtensionLoad; each is looked up by name the first 
+// time it is called through the current GLEContext and kept from then on. Define GLE_EAGER_LOAD to load them all up front.
+// Apple keeps eager loading, since Init routes its vertex array functions to the APPLE ones by version.
+#if !defined(GLE_HOOKING_ENABLED) && !defined(GLE_CGL_ENABLED) && !defined(GLE_EAGER_LOAD)
+    #define GLE_LAZY_LOAD 1
+#endif
+
 // When using hooking, we map all OpenGL function usage to our member functions that end with _Hook. 
 // These member hook functions will internally call the actual OpenGL functions after doing some internal processing.
 #if defined(GLE_HOOKING_ENABLED)
     #define GLEGetCurrentFunction(x) OVR::GLEContext::GetCurrentContext()->x##_Hook
     #define GLEGetCurrentVariable(x) OVR::GLEContext::GetCurrentContext()->x
+#elif defined(GLE_LAZY_LOAD)
+    #define GLEGetCurrentFunction(x) (OVR::GLEContext::GetCurrentContext()->x##_Impl ? OVR::GLEContext::GetCurrentContext()->x##_Impl : \
+                                      OVR::GLEContext::GetCurrentContext()->LazyLoad(OVR::GLEContext::GetCurrentContext()->x##_Impl, #x))
+    #define GLEGetCurrentVariable(x) OVR::GLEContext::GetCurrentContext()->x
 #else
     #define GLEGetCurrentFunction(x) OVR::GLEContext::GetCurrentContext()->x##_Impl
     #define GLEGetCurrentVariable(x) OVR::GLEContext::GetCurrentContext()->x
@@ -24,6 +24,12 @@
 #include "Extras/OVR_Math.h"
 #include "OVR_CAPI_GL.h"
 #include <assert.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
 
 using namespace OVR;
 
@@ -39,17 +45,154 @@ const double M_PI = 3.14159265358979323846;
 const double M_PI_2 = 1.57079632679489661923;
 
 
+//---------------------------------------------------------------------------
+// the texels of an alpha that are not transparent, in rows x cols cells of its texture from the top row, for the
+// passes of its layer to skip the patches of the sphere over empty cells. A texel marks the cells of its neighbours
+// too, the ones the bilinear lookups reach, across the seam of U included
+struct AlphaOccupancy
+{
+    static const int rows = 32, cols = 64;
+    unsigned long long bits[rows];
+
+    AlphaOccupancy(bool occupied = true) { Fill(occupied); }
+
+    void Fill(bool occupied)
+    {
+        for (int r = 0; r < rows; r++)
+            bits[r] = occupied ? ~0ULL : 0;
+    }
+
+    void Add(const AlphaOccupancy &other)
+    {
+        for (int r = 0; r < rows; r++)
+            bits[r] |= other.bits[r];
+    }
+
+    // the cells of the texels [x0, x0 + width) x [y0, y0 + height) of a texture of fullWidth x fullHeight
+    void MarkRegion(int x0, int y0, int width, int height, int fullWidth, int fullHeight)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        unsigned long long mask = 0;
+        for (int x = x0 - 1; x <= x0 + width; x++)
+            mask |= 1ULL << Column(x, fullWidth);
+        for (int y = (std::max)(y0 - 1, 0); y <= (std::min)(y0 + height, fullHeight - 1); y++)
+            bits[Row(y, fullHeight)] |= mask;
+    }
+
+    // the cells of the nonzero texels of the region of MarkRegion, channel 0 of pixels, its texels channels bytes
+    // apart and its rows step bytes apart. The rows of a single channel skip 8 transparent texels at a time
+    void Mark(const unsigned char *pixels, size_t step, int channels, int x0, int y0, int width, int height, int fullWidth, int fullHeight)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        std::vector<unsigned long long> texelMask(width);
+        for (int x = 0; x < width; x++)
+            texelMask[x] = (1ULL << Column(x0 + x - 1, fullWidth)) | (1ULL << Column(x0 + x, fullWidth)) | (1ULL << Column(x0 + x + 1, fullWidth));
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char *row = pixels + y * step;
+            unsigned long long mask = 0;
+            int x = 0;
+            if (channels == 1)
+                for (; x + 8 <= width; x += 8)
+                {
+                    unsigned long long word;
+                    memcpy(&word, row + x, sizeof(word));
+                    if (word)
+                        for (int i = 0; i < 8; i++)
+                            if (row[x + i])
+                                mask |= texelMask[x + i];
+                }
+            for (; x < width; x++)
+                if (row[x * channels])
+                    mask |= texelMask[x];
+            if (!mask)
+                continue;
+            int y1 = y0 + y;
+            for (int t = (std::max)(y1 - 1, 0); t <= (std::min)(y1 + 1, fullHeight - 1); t++)
+                bits[Row(t, fullHeight)] |= mask;
+        }
+    }
+
+    // the cells of the blocks of a BC4 texture but the ones all transparent
+    void MarkBC4(const unsigned char *blocks, int width, int height)
+    {
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        for (int by = 0; by < blocksY; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+                if (BC4Max(blocks + (size_t(by) * blocksX + bx) * 8) > 0)
+                    MarkRegion(bx * 4, by * 4, 4, 4, width, height);
+    }
+
+    // the largest value a BC4 block may decode to: its first endpoint of the 8 interpolated, else the largest
+    // endpoint unless a texel has code 7, 255
+    static int BC4Max(const unsigned char *block)
+    {
+        int a0 = block[0], a1 = block[1];
+        if (a0 > a1)
+            return a0;
+        unsigned long long codes = 0;
+        for (int i = 0; i < 6; i++)
+            codes |= (unsigned long long)block[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+            if (((codes >> (3 * i)) & 7) == 7)
+                return 255;
+        return (std::max)(a0, a1);
+    }
+
+    // any cell of [r0, r1) x [c0, c1)
+    bool Any(int r0, int r1, int c0, int c1) const
+    {
+        unsigned long long mask = c1 - c0 >= cols ? ~0ULL : ((1ULL << (c1 - c0)) - 1) << c0;
+        for (int r = r0; r < r1; r++)
+            if (bits[r] & mask)
+                return true;
+        return false;
+    }
+
+    static int Column(int x, int fullWidth)
+    {
+        x = (x % fullWidth + fullWidth) % fullWidth;
+        return int((long long)x * cols / fullWidth);
+    }
+
+    static int Row(int y, int fullHeight)
+    {
+        return int((long long)y * rows / fullHeight);
+    }
+};
+
+// a frame of the videos as a slot of the ring hands it to the render thread: the textures of the color, the depth
+// and the alpha, the edges and the pyramid of the depth, 0 unless made, and the occupancies of the alpha and of the
+// alpha of the foreground layer of its clip; the clips the ring switched to up to its own, the layers bound with it
+// the ones of layerClip, 0 before the first upload
+struct FrameBundle
+{
+    static const int nVideos = 3;
+    GLuint texture[nVideos];
+    GLuint edges, pyramid;
+    AlphaOccupancy alpha, layerAlpha;
+    int layerClip;
+
+    FrameBundle() : edges(0), pyramid(0), layerClip(0)
+    {
+        for (int k = 0; k < nVideos; k++)
+            texture[k] = 0;
+    }
+};
+
+// the layers of the clip, and the frame of the videos acquired, null for none: its textures 0 and all the patches
+// of the foreground passes drawn
 struct ARGS
 {
-	GLuint *mFront_left, *mFront_dleft, *mFront_aleft, *mFront_bg, *mFront_bgd, *mFront_bbg, *mFront_bbgd, *mBack_left, *mBack_dleft, *mBack_aleft, *mBack_bg, *mBack_bgd, *mBack_bbg, *mBack_bbgd, *black_text, *bga_text;
-	bool *fl_write, *fl_terminate, *pause_all;
+	GLuint *mFront_bg, *mFront_bgd, *mFront_bbg, *mFront_bbgd, *mBack_bg, *mBack_bgd, *mBack_bbg, *mBack_bbgd, *black_text, *bga_text;
+	const FrameBundle *frame;
 };
 
 struct ARGS_aud
 {
-	bool *fl_write, *fl_terminate;
 	std::string *audiofile;
-	bool *pause_all;
 };
 
 
@@ -77,80 +220,1181 @@ std::string loadShader(const char* filepath)
 	}
 }
 
+//The sphere: a mesh of whole vertices, a mesh of 16-bit texture coordinates only whose positions the vertex
+//shaders make, or no mesh at all, the vertex shaders making the vertices from their IDs, or patches of 64x64
+//quads at most that the tessellation subdivides where they are large on screen and where the depth changes
+enum SphereMode { SphereMesh, SphereCompact, SphereProcedural, SphereTessellated };
+static const int tessMaxLevel = 64;
+
+//The declaration of FrameBlock in the shaders
+static const char* viewerFrameBlock = "layout(std140, row_major) uniform ViewerFrame\n{\n\tmat4 frameWVP[2];\n\tmat4 frameView[2];\n"
+	"\tvec4 frameEye[2];\n\tmat4 frameWorld;\n\tvec4 frameCenter;\n\tvec4 frameHead;\n\tfloat frameColored;\n\tfloat frameDesat;\n"
+	"\tfloat frameFade;\n\tfloat frameFadeRadius;\n\tfloat frameBlackRadius;\n\tvec4 frameColorRows;\n};\n";
+
+//The texture coordinates of the color video of a view: its half of a top-bottom stereo video, the top one
+//of the left eye, by the scale (x) and the first rows of the views (y and z) of frameColorRows, all of it mono
+static const char* viewerColorUV = "vec2 ViewerColorUV(vec2 st, int view)\n{\n"
+	"\treturn vec2(st.x, (view == 0 ? frameColorRows.y : frameColorRows.z) + frameColorRows.x * st.y);\n}\n";
+
+//The color of a background layer through the grade of Scene::SetGrade, the 256 levels of viewerGradeLUT per
+//channel, interpolated between them as the texels of the layer are
+static const char* viewerGrade = "uniform sampler2D viewerGradeLUT;\n"
+	"vec4 ViewerGrade(vec4 color)\n{\n\tvec3 st = color.rgb * (255.0 / 256.0) + 0.5 / 256.0;\n"
+	"\treturn vec4(texture(viewerGradeLUT, vec2(st.r, 0.5)).r, texture(viewerGradeLUT, vec2(st.g, 0.5)).r,\n"
+	"\t\ttexture(viewerGradeLUT, vec2(st.b, 0.5)).r, color.a);\n}\n";
+
+//the texture lookups that ViewerColorSamples and ViewerGradeSamples rewrite
+static const char* viewerLookups[] = { "texture", "texture2D", "textureLod", "texture2DLod", "textureGrad", "textureOffset" };
+
+//A line of a fragment shader with the coordinates of its texture lookups of sampler through ViewerColorUV; the
+//lookups must be on one line, textureSize and texelFetch are left as they are
+static std::string ViewerColorSamples(std::string line, const std::string &sampler, const std::string &view)
+{
+	const char **lookups = viewerLookups, **lookupsEnd = viewerLookups + sizeof(viewerLookups) / sizeof(viewerLookups[0]);
+	size_t at = 0;
+	while ((at = line.find(sampler, at)) != std::string::npos)
+	{
+		size_t end = at + sampler.size();
+		bool token = (at == 0 || !(isalnum((unsigned char)line[at - 1]) || line[at - 1] == '_')) &&
+			(end >= line.size() || !(isalnum((unsigned char)line[end]) || line[end] == '_'));
+		size_t comma = line.find_first_not_of(" \t", end), open = at ? line.find_last_not_of(" \t", at - 1) : std::string::npos;
+		if (!token || comma == std::string::npos || line[comma] != ',' || open == std::string::npos || line[open] != '(')
+		{
+			at = end;
+			continue;
+		}
+		size_t name = open;
+		while (name > 0 && (isalnum((unsigned char)line[name - 1]) || line[name - 1] == '_'))
+			name--;
+		std::string function = line.substr(name, open - name);
+		// the coordinates, up to the comma or the parenthesis that ends them
+		size_t last = comma + 1;
+		int depth = 0;
+		for (; last < line.size(); last++)
+		{
+			char c = line[last];
+			if (c == '(' || c == '[')
+				depth++;
+			else if ((c == ')' || c == ']') && depth-- == 0)
+				break;
+			else if (c == ',' && depth == 0)
+				break;
+		}
+		if (std::find(lookups, lookupsEnd, function) == lookupsEnd || last >= line.size())
+		{
+			at = end;
+			continue;
+		}
+		std::string wrapped = " ViewerColorUV(" + line.substr(comma + 1, last - comma - 1) + ", " + view + ")";
+		line.replace(comma + 1, last - comma - 1, wrapped);
+		at = comma + 1 + wrapped.size();
+	}
+	return line;
+}
+
+//A line of a fragment shader with the colors of its texture lookups of sampler through ViewerGrade, the
+//lookups on one line as for ViewerColorSamples
+static std::string ViewerGradeSamples(std::string line, const std::string &sampler)
+{
+	const char **lookups = viewerLookups, **lookupsEnd = viewerLookups + sizeof(viewerLookups) / sizeof(viewerLookups[0]);
+	size_t at = 0;
+	while ((at = line.find(sampler, at)) != std::string::npos)
+	{
+		size_t end = at + sampler.size();
+		bool token = (at == 0 || !(isalnum((unsigned char)line[at - 1]) || line[at - 1] == '_')) &&
+			(end >= line.size() || !(isalnum((unsigned char)line[end]) || line[end] == '_'));
+		size_t open = at ? line.find_last_not_of(" \t", at - 1) : std::string::npos;
+		if (!token || open == std::string::npos || line[open] != '(')
+		{
+			at = end;
+			continue;
+		}
+		size_t name = open;
+		while (name > 0 && (isalnum((unsigned char)line[name - 1]) || line[name - 1] == '_'))
+			name--;
+		std::string function = line.substr(name, open - name);
+		// the parenthesis that ends the lookup
+		size_t last = end;
+		int depth = 0;
+		for (; last < line.size(); last++)
+		{
+			char c = line[last];
+			if (c == '(' || c == '[')
+				depth++;
+			else if ((c == ')' || c == ']') && depth-- == 0)
+				break;
+		}
+		if (std::find(lookups, lookupsEnd, function) == lookupsEnd || last >= line.size())
+		{
+			at = end;
+			continue;
+		}
+		std::string wrapped = "ViewerGrade(" + line.substr(name, last + 1 - name) + ")";
+		line.replace(name, last + 1 - name, wrapped);
+		at = name + wrapped.size();
+	}
+	return line;
+}
+
+//The min (x) and the max (y) of the video depth over the 2x2 texels of a level of its pyramid around st, the
+//columns wrapped around; a level covers 2^(level+1) texels of the depth per texel
+static const char* viewerPyramidRange = "vec2 PyramidRange(sampler2D pyramid, vec2 st, int level)\n{\n"
+	"\tivec2 size = textureSize(pyramid, level), i0 = ivec2(floor(st * vec2(size) - 0.5));\n\tvec2 range = vec2(1.0, 0.0);\n"
+	"\tfor (int j = 0; j < 2; j++)\n\t\tfor (int i = 0; i < 2; i++)\n\t\t{\n"
+	"\t\t\tvec2 r = texelFetch(pyramid, ivec2((i0.x + i + size.x) % size.x, clamp(i0.y + j, 0, size.y - 1)), level).rg;\n"
+	"\t\t\trange = vec2(min(range.x, r.x), max(range.y, r.y));\n\t\t}\n\treturn range;\n}\n";
+
+//The shaders of the Resources rewritten as they load. The uniforms of the frame and of the eyes become the
+//members of the std140 block of FrameBlock, shared by all the programs. The vertex shader of the compact or
+//procedural sphere: its inputs Position, Color and TexCoord (or Position2...) become globals that a new main
+//computes, as AddSphere would, before the shader's own main. The vertex shader of the tessellated sphere is the
+//evaluation shader of the patches, that computes them at gl_TessCoord. The shaders of both eyes at once with
+//GL_OVR_multiview2: the members of an eye are indexed by gl_ViewID_OVR in the vertex shader and by the view
+//it passes on in the fragment shader. The fragment shader split by its alpha: a new main after the shader's own
+//discards the transparent fragments when layerAlphaPass is 1 and the opaque ones when it is 2. The shaders of
+//the depth edges: the vertex shader passes the edges of the video depth at its texture coordinates on, and the
+//fragment shader discards the triangles with a corner on them. The fragment shader of the color video of videoColor,
+//its sampler, where it is top-bottom stereo: its lookups go through ViewerColorUV, for the half of its view. The
+//fragment shader of the color layers of graded, their samplers: their lookups go through ViewerGrade
+std::string ViewerShader(const std::string &source, bool vertex, SphereMode sphere, bool multiview, bool alphaSplit = false, bool depthEdges = false,
+	const char *videoColor = nullptr, const std::vector<std::string> &graded = std::vector<std::string>())
+{
+	// the uniforms of the block, [] the view of the eye
+	static const char* frameUniforms[][2] = { { "matWVP", "frameWVP[]" }, { "matWVP2", "frameWVP[]" }, { "ViewDir2", "frameView[]" },
+		{ "eyepos", "frameEye[].xyz" }, { "matW2", "frameWorld" }, { "SphCenter2", "frameCenter.xyz" }, { "spherecenter", "frameCenter.xyz" },
+		{ "headposition", "frameHead.xyz" }, { "colored", "frameColored" }, { "desat", "frameDesat" },
+		{ "fade", "frameFade" }, { "fadeRadius", "frameFadeRadius" }, { "blackRadius", "frameBlackRadius" } };
+	std::string view = !multiview ? "0" : vertex ? "int(gl_ViewID_OVR)" : "eyeView";
+	bool procedural = vertex && sphere != SphereMesh;
+	std::istringstream lines(source);
+	std::ostringstream body, inputs;
+	std::string line, profile, output, texcoord;
+	int number = 110;
+	bool isFrame = false, colorDeclared = false, gradeDeclared = false;
+	while (getline(lines, line)) {
+		if (colorDeclared)
+			line = ViewerColorSamples(line, videoColor, view);
+		if (gradeDeclared)
+			for (const std::string &sampler : graded)
+				line = ViewerGradeSamples(line, sampler);
+		std::istringstream tokens(line);
+		std::string word, type, name;
+		tokens >> word;
+		if (word == "#version") {
+			tokens >> number;
+			getline(tokens, profile);
+			continue;
+		}
+		if (word.compare(0, 6, "layout") == 0) {
+			while (word.find(')') == std::string::npos && tokens >> word);
+			tokens >> word;
+		}
+		if (!vertex && word == "out" && output.empty() && tokens >> type >> name && type == "vec4")
+			output = name.substr(0, name.find_first_of(";["));
+		if (vertex && !procedural && texcoord.empty() && (word == "in" || word == "attribute") && tokens >> type >> name &&
+			name.find("TexCoord") != std::string::npos)
+			texcoord = name.substr(0, name.find(';')) + (type == "vec2" ? "" : ".xy");
+		if (procedural && (word == "in" || word == "attribute") && tokens >> type >> name) {
+			if (name.back() == ';')
+				name.pop_back();
+			std::string value;
+			if (name.find("Position") != std::string::npos)
+				value = type == "vec4" ? "vec4(spherePosition, 1.0)" : "spherePosition";
+			else if (name.find("Color") != std::string::npos)
+				value = type + "(1.0)";
+			else if (name.find("TexCoord") != std::string::npos)
+				value = type == "vec2" ? "sphereUV" : type == "vec3" ? "vec3(sphereUV, 0.0)" : "vec4(sphereUV, 0.0, 1.0)";
+			if (!value.empty()) {
+				body << type << " " << name << ";\n";
+				inputs << "\t" << name << " = " << value << ";\n";
+				continue;
+			}
+		}
+		if (word == "uniform" && tokens >> type >> name && name.back() == ';') {
+			name.pop_back();
+			const char* (*frame)[2] = std::find_if(std::begin(frameUniforms), std::end(frameUniforms),
+				[&name](const char* (&uniform)[2]) { return name == uniform[0]; });
+			if (frame != std::end(frameUniforms)) {
+				if (!isFrame) {
+					if (multiview && !vertex)
+						body << "flat in int eyeView;\n";
+					body << viewerFrameBlock;
+				}
+				isFrame = true;
+				std::string member = (*frame)[1];
+				size_t index = member.find("[]");
+				if (index != std::string::npos)
+					member.insert(index + 1, view);
+				body << "#define " << name << " " << member << "\n";
+				continue;
+			}
+		}
+		body << line << '\n';
+		if (!vertex && videoColor && !colorDeclared && word == "uniform" && type == "sampler2D" && name == videoColor) {
+			if (!isFrame) {
+				if (multiview)
+					body << "flat in int eyeView;\n";
+				body << viewerFrameBlock;
+			}
+			isFrame = true;
+			body << viewerColorUV;
+			colorDeclared = true;
+		}
+		if (!vertex && !gradeDeclared && word == "uniform" && type == "sampler2D" &&
+			std::find(graded.begin(), graded.end(), name) != graded.end()) {
+			body << viewerGrade;
+			gradeDeclared = true;
+		}
+	}
+	//gl_VertexID, the multiview, the edges and the grade need GLSL 1.30, the uniform blocks 1.40, the tessellation 4.00
+	bool tessellated = vertex && sphere == SphereTessellated;
+	std::string version = "#version " + std::to_string((std::max)(number, tessellated ? 400 :
+		procedural || multiview || depthEdges || gradeDeclared ? 130 : 0)) + profile;
+	if (number < 140 && !tessellated)
+		version += "\n#extension GL_ARB_uniform_buffer_object : require";
+	if (number < 130 && tessellated)
+		version += "\n#define varying out";
+	if (!vertex && alphaSplit && output.empty() && source.find("gl_FragColor") != std::string::npos)
+		output = "gl_FragColor";
+	alphaSplit = alphaSplit && !output.empty();
+	if (!vertex && (alphaSplit || depthEdges))
+		return version + "\n#define main shaderMain\n" + body.str() +
+			"#undef main\n" +
+			(alphaSplit ? "uniform int layerAlphaPass;\n" : "") +
+			(depthEdges ? "in float viewerEdge;\n" : "") +
+			"void main()\n"
+			"{\n" +
+			(depthEdges ? "\tif (viewerEdge > 0.0)\n\t\tdiscard;\n" : "") +
+			"\tshaderMain();\n" +
+			(alphaSplit ? "\tif (layerAlphaPass == 1 ? " + output + ".a < 1.0 : layerAlphaPass == 2 && " + output + ".a >= 1.0)\n"
+				"\t\tdiscard;\n" : "") +
+			"}\n";
+	if (!vertex || (!procedural && !multiview && !depthEdges))
+		return version + "\n" + body.str();
+	if (multiview)
+		version += "\n#extension GL_OVR_multiview2 : require";
+	std::string coordinates;
+	if (sphere == SphereCompact)
+		coordinates = "\tfloat u = sphereTexCoord.x, v = 1.0 - sphereTexCoord.y;\n";
+	if (sphere == SphereProcedural)
+		coordinates =
+			//the corners of the two triangles of every quad in the order of the indices of AddSphere
+			"\tint quad = gl_VertexID / 6, corner = gl_VertexID - quad * 6;\n"
+			"\tint r = quad / (sphereSlices - 1), s = quad - r * (sphereSlices - 1);\n"
+			"\tif (corner == 2 || corner == 3 || corner == 5) r++;\n"
+			"\tif (corner == 1 || corner == 2 || corner == 5) s++;\n"
+			"\tfloat u = float(s) / float(sphereSlices - 1), v = float(r) / float(sphereRings - 1);\n";
+	if (sphere == SphereTessellated)
+		coordinates =
+			"\tint row = gl_PrimitiveID / tessCols, col = gl_PrimitiveID - row * tessCols;\n"
+			"\tfloat u = (float(col) + gl_TessCoord.x) / float(tessCols), v = (float(row) + gl_TessCoord.y) / float(tessRows);\n";
+	if (procedural)
+		coordinates +=
+			"\tfloat theta = 6.283185307 * u, phi = 3.141592654 * v;\n"
+			"\tvec3 spherePosition = sphereRadius * vec3(cos(theta) * sin(phi), -cos(phi), sin(theta) * sin(phi));\n"
+			"\tvec2 sphereUV = vec2(u, 1.0 - v);\n" +
+			inputs.str();
+	if (multiview)
+		coordinates += "\teyeView = int(gl_ViewID_OVR);\n";
+	std::string edges;
+	if (depthEdges)
+		edges = "\tviewerEdge = " + (procedural ? "textureLod(depthEdges, sphereUV, 0.0).r" : !texcoord.empty() ? "textureLod(depthEdges, " + texcoord + ", 0.0).r" : "0.0") + ";\n";
+	return version + "\n#define main shaderMain\n" + body.str() +
+		"#undef main\n" +
+		(multiview ? "layout(num_views = 2) in;\nflat out int eyeView;\n" : "") +
+		(sphere == SphereCompact ? "in vec2 sphereTexCoord;\n" : "") +
+		(depthEdges ? "uniform sampler2D depthEdges;\nout float viewerEdge;\n" : "") +
+		(tessellated ? "layout(quads, fractional_even_spacing, ccw) in;\nuniform int tessRows;\nuniform int tessCols;\n" : "") +
+		"uniform int sphereRings;\n"
+		"uniform int sphereSlices;\n"
+		"uniform float sphereRadius;\n"
+		"void main()\n"
+		"{\n" +
+		coordinates +
+		"\tshaderMain();\n" +
+		edges +
+		"}\n";
+}
+
+//The ray marching of the layers, a full screen triangle per view in place of the sphere. The ray of every pixel,
+//in the coordinates of the sphere, goes in marchSteps steps from where it leaves the sphere of marchNear to where
+//it leaves the sphere of marchFar, and is refined by bisection where it passes behind the surface of the video
+//depth. A texel of depth d, 1 the nearest, is at the inverse distance 1 / marchFar + d (1 / marchNear - 1 / marchFar).
+//Where the video is transparent by its alpha, or where its surface steps by more than marchEdge between two steps,
+//the side of a foreground seen from off the center, the ray is marched again against the inpainted background. The
+//depth of the hit is written for the depth test and the depth layer. With the pyramid of the video depth, marchPyramid
+//1, the ray skips 8 steps at once where they are all nearer than the nearest depth of the texels they cross
+std::string RayMarchShader(bool vertex, bool multiview)
+{
+	std::string header = std::string("#version 330\n") +
+		(multiview ? "#extension GL_OVR_multiview2 : require\n" : "") +
+		viewerFrameBlock;
+	if (vertex)
+		return header +
+			(multiview ? "layout(num_views = 2) in;\nflat out int eyeView;\n" : "") +
+			"out vec3 marchOrigin;\n"
+			"out vec3 marchEnd;\n"
+			"void main()\n"
+			"{\n"
+			"\tvec2 ndc = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);\n" +
+			(multiview ? "\teyeView = int(gl_ViewID_OVR);\n\tmat4 inverseWVP = inverse(frameWVP[eyeView]);\n" : "\tmat4 inverseWVP = inverse(frameWVP[0]);\n") +
+			//the points of the pixel at two depths, affine in ndc as their w is the same
+			"\tvec4 nearPoint = inverseWVP * vec4(ndc, -1.0, 1.0), midPoint = inverseWVP * vec4(ndc, 0.0, 1.0);\n"
+			"\tmarchOrigin = nearPoint.xyz / nearPoint.w;\n"
+			"\tmarchEnd = midPoint.xyz / midPoint.w;\n"
+			"\tgl_Position = vec4(ndc, 0.0, 1.0);\n"
+			"}\n";
+	return header +
+		(multiview ? "flat in int eyeView;\n" : "const int eyeView = 0;\n") +
+		"in vec3 marchOrigin;\n"
+		"in vec3 marchEnd;\n"
+		"out vec4 fragColor;\n"
+		"uniform sampler2D movtext;\n"
+		"uniform sampler2D movdepth;\n"
+		"uniform sampler2D movalpha;\n"
+		"uniform sampler2D bgtext;\n"
+		"uniform sampler2D bgdepth;\n"
+		"uniform sampler2D depthPyramid;\n"
+		"uniform float marchNear;\n"
+		"uniform float marchFar;\n"
+		"uniform float marchEdge;\n"
+		"uniform int marchSteps;\n"
+		"uniform int marchPyramid;\n" +
+		viewerPyramidRange +
+		viewerColorUV +
+		viewerGrade +
+		"vec2 Equirect(vec3 p)\n"
+		"{\n"
+		"\tvec3 n = normalize(p);\n"
+		"\treturn vec2(fract(atan(n.z, n.x) / 6.283185307), 1.0 - acos(clamp(-n.y, -1.0, 1.0)) / 3.141592654);\n"
+		"}\n"
+		"float DepthDistance(float d)\n"
+		"{\n"
+		"\treturn 1.0 / (1.0 / marchFar + d * (1.0 / marchNear - 1.0 / marchFar));\n"
+		"}\n"
+		"float Distance(sampler2D depth, vec2 st)\n"
+		"{\n"
+		"\treturn DepthDistance(textureLod(depth, st, 0.0).r);\n"
+		"}\n"
+		//whether the segment of p0 to p1 is nearer than the video surface: the angle it spans from the center
+		//bounds the texels it crosses, and the level of the pyramid that covers them gives its nearest depth
+		"bool Clear(vec3 p0, vec3 p1)\n"
+		"{\n"
+		"\tvec3 d = p1 - p0, m = 0.5 * (p0 + p1);\n"
+		"\tfloat s = clamp(-dot(p0, d) / max(dot(d, d), 1e-12), 0.0, 1.0);\n"
+		"\tfloat angle = length(d) / max(length(p0 + s * d), 1e-4);\n"
+		"\tivec2 size = textureSize(depthPyramid, 0);\n"
+		"\tvec3 n = normalize(m);\n"
+		"\tfloat texels = max(angle / 3.141592654 * float(size.y), angle / max(length(n.xz) - angle, 1e-3) / 6.283185307 * float(size.x));\n"
+		"\tint top = int(log2(float(max(size.x, size.y))));\n"
+		"\tint mip = clamp(int(ceil(log2(max(2.0 * texels, 1.0)))), 0, top);\n"
+		"\treturn max(length(p0), length(p1)) < DepthDistance(PyramidRange(depthPyramid, Equirect(m), mip).y);\n"
+		"}\n"
+		//the first t of [t0, t1] past the surface of depth, t1 at none; edges: the ones across a step of the
+		//surface are passed; skip: the depth is the video's, skipped by its pyramid
+		"float March(sampler2D depth, vec3 o, vec3 dir, float t0, float t1, bool edges, bool skip)\n"
+		"{\n"
+		"\tfloat dt = (t1 - t0) / float(marchSteps), r = Distance(depth, Equirect(o + t0 * dir));\n"
+		"\tbool before = length(o + t0 * dir) < r;\n"
+		"\tfor (int i = 1; i <= marchSteps; i++)\n"
+		"\t{\n"
+		"\t\tif (skip && before && i + 7 <= marchSteps && Clear(o + (t0 + dt * float(i - 1)) * dir, o + (t0 + dt * float(i + 7)) * dir))\n"
+		"\t\t{\n"
+		"\t\t\ti += 7;\n"
+		"\t\t\tr = Distance(depth, Equirect(o + (t0 + dt * float(i)) * dir));\n"
+		"\t\t\tcontinue;\n"
+		"\t\t}\n"
+		"\t\tfloat t = t0 + dt * float(i);\n"
+		"\t\tvec3 p = o + t * dir;\n"
+		"\t\tfloat next = Distance(depth, Equirect(p));\n"
+		"\t\tbool past = length(p) >= next;\n"
+		"\t\tif (past && before && (!edges || abs(next - r) <= marchEdge))\n"
+		"\t\t{\n"
+		"\t\t\tfloat a = t - dt;\n"
+		"\t\t\tfor (int k = 0; k < 6; k++)\n"
+		"\t\t\t{\n"
+		"\t\t\t\tfloat m = 0.5 * (a + t);\n"
+		"\t\t\t\tvec3 q = o + m * dir;\n"
+		"\t\t\t\tif (length(q) >= Distance(depth, Equirect(q)))\n"
+		"\t\t\t\t\tt = m;\n"
+		"\t\t\t\telse\n"
+		"\t\t\t\t\ta = m;\n"
+		"\t\t\t}\n"
+		"\t\t\treturn t;\n"
+		"\t\t}\n"
+		"\t\tif (past && before && edges)\n"
+		"\t\t\treturn t1;\n"
+		"\t\tbefore = !past;\n"
+		"\t\tr = next;\n"
+		"\t}\n"
+		"\treturn t1;\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"\tvec3 o = marchOrigin, dir = normalize(marchEnd - marchOrigin);\n"
+		//where the ray leaves the spheres of marchNear and marchFar, the origin within them
+		"\tfloat b = dot(o, dir), c = dot(o, o);\n"
+		"\tfloat t0 = c < marchNear * marchNear ? -b + sqrt(b * b - c + marchNear * marchNear) : 0.0;\n"
+		"\tfloat t1 = -b + sqrt(max(b * b - c + marchFar * marchFar, 0.0));\n"
+		"\tfloat t = March(movdepth, o, dir, t0, t1, true, marchPyramid != 0);\n"
+		"\tvec2 st = Equirect(o + t * dir);\n"
+		"\tif (t < t1 && textureLod(movalpha, st, 0.0).r >= 0.5)\n"
+		"\t\tfragColor = vec4(texture(movtext, ViewerColorUV(st, eyeView)).rgb, 1.0);\n"
+		"\telse\n"
+		"\t{\n"
+		"\t\tt = March(bgdepth, o, dir, t0, t1, false, false);\n"
+		"\t\tst = Equirect(o + t * dir);\n"
+		"\t\tfragColor = vec4(ViewerGrade(texture(bgtext, st)).rgb, 1.0);\n"
+		"\t}\n"
+		"\tvec4 clip = frameWVP[eyeView] * vec4(o + t * dir, 1.0);\n"
+		"\tgl_FragDepth = clamp(0.5 * clip.z / clip.w + 0.5, 0.0, 1.0);\n"
+		"}\n";
+}
+
+//The multi-sphere image, msiLayers concentric spheres drawn back to front by the instances of one draw, instance k
+//the layer of inverse depth (k + 0.5) / msiLayers between msiFar and msiNear, as MultiSphereImage exports them. Every
+//sphere is msiRings x msiSlices quads of the corners of the procedural sphere, and its color and alpha are tiles k
+//and msiLayers + k of the atlas of msiColumns tiles per row, sampled within them so that no tile bleeds into the next
+std::string MultiSphereShader(bool vertex, bool multiview)
+{
+	std::string header = std::string("#version 330\n") +
+		(multiview ? "#extension GL_OVR_multiview2 : require\n" : "") +
+		viewerFrameBlock +
+		"uniform int msiLayers;\n";
+	if (vertex)
+		return header +
+			(multiview ? "layout(num_views = 2) in;\n" : "") +
+			"uniform int msiRings;\n"
+			"uniform int msiSlices;\n"
+			"uniform float msiNear;\n"
+			"uniform float msiFar;\n"
+			"out vec2 msiUV;\n"
+			"flat out int msiLayer;\n"
+			"void main()\n"
+			"{\n"
+			"\tint quad = gl_VertexID / 6, corner = gl_VertexID - quad * 6;\n"
+			"\tint r = quad / msiSlices, s = quad - r * msiSlices;\n"
+			"\tif (corner == 2 || corner == 3 || corner == 5) r++;\n"
+			"\tif (corner == 1 || corner == 2 || corner == 5) s++;\n"
+			"\tfloat u = float(s) / float(msiSlices), v = float(r) / float(msiRings);\n"
+			"\tfloat theta = 6.283185307 * u, phi = 3.141592654 * v;\n"
+			"\tfloat d = (float(gl_InstanceID) + 0.5) / float(msiLayers);\n"
+			"\tfloat radius = 1.0 / (1.0 / msiFar + d * (1.0 / msiNear - 1.0 / msiFar));\n"
+			"\tmsiUV = vec2(u, 1.0 - v);\n"
+			"\tmsiLayer = gl_InstanceID;\n"
+			"\tgl_Position = frameWVP[" + (multiview ? "int(gl_ViewID_OVR)" : "0") + "] * vec4(radius * vec3(cos(theta) * sin(phi), -cos(phi), sin(theta) * sin(phi)), 1.0);\n"
+			"}\n";
+	return header +
+		"uniform int msiColumns;\n"
+		"uniform sampler2D msiAtlas;\n"
+		"in vec2 msiUV;\n"
+		"flat in int msiLayer;\n"
+		"out vec4 fragColor;\n"
+		"vec2 Tile(int t, vec2 st)\n"
+		"{\n"
+		"\tvec2 grid = vec2(msiColumns, (2 * msiLayers + msiColumns - 1) / msiColumns), texels = vec2(textureSize(msiAtlas, 0)) / grid;\n"
+		"\treturn (vec2(t % msiColumns, t / msiColumns) + clamp(st, 0.5 / texels, 1.0 - 0.5 / texels)) / grid;\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"\tfloat alpha = texture(msiAtlas, Tile(msiLayers + msiLayer, msiUV)).r;\n"
+		"\tif (alpha <= 0.0)\n"
+		"\t\tdiscard;\n"
+		"\tfragColor = vec4(texture(msiAtlas, Tile(msiLayer, msiUV)).rgb, alpha);\n"
+		"}\n";
+}
+
+//The gallery of the clips, a small sphere per clip drawn by the instances of one draw: instance k is at
+//galleryPlace.xyz, turned by galleryPlace.w about the vertical to face the center, and shows layer galleryLayer of
+//the array of the previews. Its spheres are galleryRings x gallerySlices quads of the corners of the procedural
+//sphere, as the ones of the multi-sphere image; seen from the outside, the near side of one shows the front of its
+//clip and the directions around it as they are seen from within, the one of galleryFocus larger
+std::string GalleryShader(bool vertex, bool multiview)
+{
+	std::string header = std::string("#version 330\n") +
+		(multiview ? "#extension GL_OVR_multiview2 : require\n" : "") +
+		viewerFrameBlock;
+	if (vertex)
+		return header +
+			(multiview ? "layout(num_views = 2) in;\n" : "") +
+			"uniform int galleryRings;\n"
+			"uniform int gallerySlices;\n"
+			"uniform float galleryRadius;\n"
+			"uniform int galleryFocus;\n"
+			"in vec4 galleryPlace;\n"
+			"in float galleryLayer;\n"
+			"out vec3 galleryDir;\n"
+			"flat out float galleryIndex;\n"
+			"void main()\n"
+			"{\n"
+			"\tint quad = gl_VertexID / 6, corner = gl_VertexID - quad * 6;\n"
+			"\tint r = quad / gallerySlices, s = quad - r * gallerySlices;\n"
+			"\tif (corner == 2 || corner == 3 || corner == 5) r++;\n"
+			"\tif (corner == 1 || corner == 2 || corner == 5) s++;\n"
+			"\tfloat theta = 6.283185307 * float(s) / float(gallerySlices), phi = 3.141592654 * float(r) / float(galleryRings);\n"
+			"\tvec3 l = vec3(cos(theta) * sin(phi), -cos(phi), sin(theta) * sin(phi));\n"
+			"\tfloat c = cos(galleryPlace.w), t = sin(galleryPlace.w);\n"
+			"\tfloat radius = gl_InstanceID == galleryFocus ? 1.3 * galleryRadius : galleryRadius;\n"
+			"\tgalleryDir = vec3(l.x, l.y, -l.z);\n"
+			"\tgalleryIndex = galleryLayer;\n"
+			"\tgl_Position = frameWVP[" + (multiview ? "int(gl_ViewID_OVR)" : "0") + "] * vec4(galleryPlace.xyz + radius * vec3(l.x * c - l.z * t, l.y, l.x * t + l.z * c), 1.0);\n"
+			"}\n";
+	return header +
+		"uniform sampler2DArray galleryPreviews;\n"
+		"in vec3 galleryDir;\n"
+		"flat in float galleryIndex;\n"
+		"out vec4 fragColor;\n"
+		"void main()\n"
+		"{\n"
+		"\tvec3 d = normalize(galleryDir);\n"
+		"\tvec2 st = vec2(fract(atan(d.z, d.x) / 6.283185307), 1.0 - acos(clamp(-d.y, -1.0, 1.0)) / 3.141592654);\n"
+		"\tfragColor = vec4(texture(galleryPreviews, vec3(st, galleryIndex)).rgb, 1.0);\n"
+		"}\n";
+}
+
+//The outputs of the vertex shader of the background for Scene::BakeBackground to capture once per clip, their
+//qualifiers, types and names in outputs[0], [1] and [2]. False unless they depend on the static layers alone: the
+//shader reads no uniforms but the samplers of layerSamplers and matWVP (or matWVP2), that only for gl_Position, and
+//outputs floats and vectors of them
+static bool BakedOutputs(const std::string &source, const std::vector<std::string> &layerSamplers, std::vector<std::string> outputs[3])
+{
+	std::istringstream lines(source);
+	std::string line;
+	bool projected = false;
+	while (getline(lines, line)) {
+		std::istringstream tokens(line);
+		std::string word, type, name, qualifier;
+		tokens >> word;
+		if (word.compare(0, 6, "layout") == 0) {
+			while (word.find(')') == std::string::npos && tokens >> word);
+			tokens >> word;
+		}
+		if (word == "flat" || word == "smooth" || word == "noperspective") {
+			qualifier = word;
+			tokens >> word;
+		}
+		if (word == "uniform" && tokens >> type >> name) {
+			name = name.substr(0, name.find(';'));
+			bool layer = type.compare(0, 7, "sampler") == 0 && std::find(layerSamplers.begin(), layerSamplers.end(), name) != layerSamplers.end();
+			if (!layer && name != "matWVP" && name != "matWVP2")
+				return false;
+			continue;
+		}
+		if ((word == "out" || word == "varying") && tokens >> type >> name) {
+			if (name.back() != ';' || name.find('[') != std::string::npos ||
+				(type != "float" && type != "vec2" && type != "vec3" && type != "vec4"))
+				return false;
+			outputs[0].push_back(qualifier);
+			outputs[1].push_back(type);
+			outputs[2].push_back(name.substr(0, name.size() - 1));
+			continue;
+		}
+		if (line.find("matWVP") != std::string::npos) {
+			if (line.find("gl_Position") == std::string::npos)
+				return false;
+			projected = true;
+		}
+	}
+	return projected;
+}
+
+//The vertex shader of the background baked by Scene::BakeBackground, a plain draw of the mesh it captured: the
+//point displaced, bakedOutput0, projected to the view, and the outputs of BakedOutputs, bakedOutput1..., passed on
+//as they are to the fragment shader of the background
+std::string BakedBackgroundShader(const std::vector<std::string> outputs[3], bool multiview)
+{
+	std::string declarations, body;
+	for (size_t i = 0; i < outputs[2].size(); i++) {
+		std::string input = "bakedOutput" + std::to_string(i + 1);
+		declarations += "in " + outputs[1][i] + " " + input + ";\n" + (outputs[0][i].empty() ? "" : outputs[0][i] + " ") +
+			"out " + outputs[1][i] + " " + outputs[2][i] + ";\n";
+		body += "\t" + outputs[2][i] + " = " + input + ";\n";
+	}
+	return std::string("#version 330\n") +
+		(multiview ? "#extension GL_OVR_multiview2 : require\n" : "") +
+		viewerFrameBlock +
+		(multiview ? "layout(num_views = 2) in;\nflat out int eyeView;\n" : "") +
+		"in vec4 bakedOutput0;\n" +
+		declarations +
+		"void main()\n"
+		"{\n" +
+		(multiview ? "\teyeView = int(gl_ViewID_OVR);\n" : "") +
+		body +
+		"\tgl_Position = frameWVP[" + (multiview ? "eyeView" : "0") + "] * vec4(bakedOutput0.xyz / bakedOutput0.w, 1.0);\n"
+		"}\n";
+}
+
+//The control shader of the tessellated sphere, the same for all the programs. An edge of a patch gets a level
+//of its pixels on the screen of the eye over tessPixels, times 1 + tessDepthGain times the range of the depths
+//along it, of the video and of the static layers; from its ends only, so that the patches that share it agree. The
+//range of the video is of the texels of its pyramid over the whole edge with tessPyramid 1, of its ends and middle else.
+//The u of the seam is taken as 0 on both sides. The patches behind the eye are dropped
+std::string TessellationControlShader()
+{
+	return std::string("#version 400\n"
+		"layout(vertices = 1) out;\n") +
+		viewerFrameBlock +
+		"uniform int tessRows;\n"
+		"uniform int tessCols;\n"
+		"uniform float sphereRadius;\n"
+		"uniform vec2 tessViewport;\n"
+		"uniform float tessPixels;\n"
+		"uniform float tessDepthGain;\n"
+		"uniform sampler2D tessDepth;\n"
+		"uniform sampler2D tessLayerDepth;\n"
+		"uniform sampler2D depthPyramid;\n"
+		"uniform int tessPyramid;\n" +
+		viewerPyramidRange +
+		"vec4 Project(vec2 uv)\n"
+		"{\n"
+		"\tfloat theta = 6.283185307 * fract(uv.x), phi = 3.141592654 * uv.y;\n"
+		"\treturn frameWVP[0] * vec4(sphereRadius * vec3(cos(theta) * sin(phi), -cos(phi), sin(theta) * sin(phi)), 1.0);\n"
+		"}\n"
+		"vec2 Depth(vec2 uv)\n"
+		"{\n"
+		"\tvec2 st = vec2(fract(uv.x), 1.0 - uv.y);\n"
+		"\treturn vec2(textureLod(tessDepth, st, 0.0).r, textureLod(tessLayerDepth, st, 0.0).r);\n"
+		"}\n"
+		"float EdgeLevel(vec2 a, vec2 b)\n"
+		"{\n"
+		"\tvec4 pa = Project(a), pb = Project(b);\n"
+		"\tif (pa.w <= 0.0 && pb.w <= 0.0)\n"
+		"\t\treturn 1.0;\n"
+		"\tvec2 sa = pa.xy / max(pa.w, 1e-3), sb = pb.xy / max(pb.w, 1e-3);\n"
+		"\tfloat pixels = length((sa - sb) * 0.5 * tessViewport);\n"
+		"\tvec2 da = Depth(a), dm = Depth(0.5 * (a + b)), db = Depth(b);\n"
+		"\tvec2 range = max(max(da, dm), db) - min(min(da, dm), db);\n"
+		"\tif (tessPyramid != 0)\n"
+		"\t{\n"
+		"\t\tivec2 size = textureSize(depthPyramid, 0);\n"
+		"\t\tfloat texels = max(abs(b.x - a.x) * float(size.x), abs(b.y - a.y) * float(size.y));\n"
+		"\t\tint top = int(log2(float(max(size.x, size.y))));\n"
+		"\t\tint mip = clamp(int(ceil(log2(max(texels, 1.0)))), 0, top);\n"
+		"\t\tvec2 video = PyramidRange(depthPyramid, vec2(fract(0.5 * (a.x + b.x)), 1.0 - 0.5 * (a.y + b.y)), mip);\n"
+		"\t\trange.x = video.y - video.x;\n"
+		"\t}\n"
+		"\tfloat level = pixels / tessPixels * (1.0 + tessDepthGain * max(range.x, range.y));\n"
+		"\treturn clamp(level, 1.0, float(gl_MaxTessGenLevel));\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"\tint row = gl_PrimitiveID / tessCols, col = gl_PrimitiveID - row * tessCols;\n"
+		"\tvec2 size = vec2(tessCols, tessRows);\n"
+		"\tvec2 a = vec2(col, row) / size, c = vec2(col + 1, row + 1) / size, b = vec2(c.x, a.y), d = vec2(a.x, c.y);\n"
+		"\tfloat behind = -0.05 * sphereRadius;\n"
+		"\tif (Project(a).w < behind && Project(b).w < behind && Project(c).w < behind && Project(d).w < behind)\n"
+		"\t{\n"
+		"\t\tgl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = 0.0;\n"
+		"\t\treturn;\n"
+		"\t}\n"
+		"\tgl_TessLevelOuter[0] = EdgeLevel(a, d);\n"
+		"\tgl_TessLevelOuter[1] = EdgeLevel(a, b);\n"
+		"\tgl_TessLevelOuter[2] = EdgeLevel(b, c);\n"
+		"\tgl_TessLevelOuter[3] = EdgeLevel(d, c);\n"
+		"\tgl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);\n"
+		"\tgl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);\n"
+		"}\n";
+}
+
+
+//The uniforms of the frame and of the eyes as the block ViewerFrame of the shaders lays them out, std140 with
+//the matrices row-major; the single view is the first. The fade of the comfort radius is 0 but in the composite
+//pass, that draws it instead of RenderBlack: the alpha of the fade, and the radii of the faded and the black rings,
+//0 for none
+struct FrameBlock
+{
+	Matrix4f wvp[2];
+	Matrix4f view[2];
+	float    eye[2][4];
+	Matrix4f world;
+	float    center[4];
+	float    head[4];
+	float    colored, desat;
+	float    fade, fadeRadius, blackRadius, unused[3];
+	float    colorRows[4];	//the scale and the first rows of the color of both views, of a top-bottom stereo video
+};
+static const GLuint frameBinding = 0;
+
+//The ARB_uniform_buffer_object, the tessellation, the program binary and the parallel compile entry points are
+//not loaded by GLE, so they are loaded here, by Scene::Init before its programs
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+#ifndef GL_PATCHES
+#define GL_PATCHES 0x000E
+#endif
+#ifndef GL_PATCH_VERTICES
+#define GL_PATCH_VERTICES 0x8E72
+#endif
+#ifndef GL_TESS_EVALUATION_SHADER
+#define GL_TESS_EVALUATION_SHADER 0x8E87
+#endif
+#ifndef GL_TESS_CONTROL_SHADER
+#define GL_TESS_CONTROL_SHADER 0x8E88
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+typedef GLuint (APIENTRY *GetUniformBlockIndexProc)(GLuint program, const GLchar *name);
+typedef void (APIENTRY *UniformBlockBindingProc)(GLuint program, GLuint index, GLuint binding);
+typedef void (APIENTRY *BindBufferBaseProc)(GLenum target, GLuint index, GLuint buffer);
+typedef void (APIENTRY *PatchParameteriProc)(GLenum pname, GLint value);
+typedef void (APIENTRY *MultiDrawElementsBaseVertexProc)(GLenum mode, const GLsizei *count, GLenum type, const void *const *indices,
+	GLsizei drawcount, const GLint *basevertex);
+typedef void (APIENTRY *GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRY *ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRY *ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+struct BlockFunctions
+{
+	GetUniformBlockIndexProc getUniformBlockIndex;
+	UniformBlockBindingProc uniformBlockBinding;
+	BindBufferBaseProc bindBufferBase;
+	PatchParameteriProc patchParameteri;
+	MultiDrawElementsBaseVertexProc multiDrawElementsBaseVertex;
+	GetProgramBinaryProc getProgramBinary;
+	ProgramBinaryProc programBinary;
+	ProgramParameteriProc programParameteri;
+	MaxShaderCompilerThreadsProc maxShaderCompilerThreads;
+
+	void Load()
+	{
+		getUniformBlockIndex = (GetUniformBlockIndexProc)wglGetProcAddress("glGetUniformBlockIndex");
+		uniformBlockBinding = (UniformBlockBindingProc)wglGetProcAddress("glUniformBlockBinding");
+		bindBufferBase = (BindBufferBaseProc)wglGetProcAddress("glBindBufferBase");
+		patchParameteri = (PatchParameteriProc)wglGetProcAddress("glPatchParameteri");
+		multiDrawElementsBaseVertex = (MultiDrawElementsBaseVertexProc)wglGetProcAddress("glMultiDrawElementsBaseVertex");
+		getProgramBinary = (GetProgramBinaryProc)wglGetProcAddress("glGetProgramBinary");
+		programBinary = (ProgramBinaryProc)wglGetProcAddress("glProgramBinary");
+		programParameteri = (ProgramParameteriProc)wglGetProcAddress("glProgramParameteri");
+		maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (!maxShaderCompilerThreads)
+			maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)wglGetProcAddress("glMaxShaderCompilerThreadsARB");
+	}
+};
+static BlockFunctions blockFunctions;
+
+//The fixed units of the textures of the layers, bound once a frame by Scene::BindTextures, after the fields of
+//ARGS and the grade of the Scene. The samplers of the programs are set to them once, and the active unit is left at TextureUnits
+enum TextureUnit { UnitLeft, UnitDepthLeft, UnitAlphaLeft, UnitBg, UnitBgDepth, UnitBgAlpha, UnitBbg, UnitBlack, UnitEdges, UnitPyramid,
+	UnitGrade, UnitGallery, TextureUnits };
+//the single channel of the grade
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+
+//The binaries of the linked programs, a file each in programCacheDirectory named by the hash of the sources of
+//the program and of the vendor, the renderer and the version of the driver, so that a change of a shader, of its
+//rewriting or of the driver compiles the program again. No cache without the directory or ARB_get_program_binary
+static std::string programCacheDirectory;
+
+struct ProgramCache
+{
+	// the file of the program of the sources, FNV-1a of them and of the driver
+	static std::string Path(const std::string *sources, int count)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		const char *driver[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+		std::string key;
+		for (int i = 0; i < 3; i++)
+			key += std::string(driver[i] ? driver[i] : "") + '\0';
+		for (int i = 0; i < count; i++)
+			key += sources[i] + '\0';
+		for (size_t i = 0; i < key.size(); i++)
+			hash = (hash ^ (unsigned char)key[i]) * 1099511628211ull;
+		char name[32];
+		sprintf_s(name, "\\%016llx.bin", hash);
+		return programCacheDirectory + name;
+	}
+
+	// the binary format and the binary into the program, false if there is none or the driver rejects it
+	static bool Load(GLuint program, const std::string &path)
+	{
+		if (programCacheDirectory.empty() || !blockFunctions.programBinary)
+			return false;
+		std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+		GLenum format = 0;
+		if (!file.read((char*)&format, sizeof(format)))
+			return false;
+		std::streamoff start = file.tellg();
+		file.seekg(0, std::ios::end);
+		std::vector<char> binary(size_t(file.tellg() - start));
+		file.seekg(start);
+		if (binary.empty() || !file.read(binary.data(), binary.size()))
+			return false;
+		blockFunctions.programBinary(program, format, binary.data(), GLsizei(binary.size()));
+		GLint r;
+		glGetProgramiv(program, GL_LINK_STATUS, &r);
+		return r != 0;
+	}
+
+	static void Save(GLuint program, const std::string &path)
+	{
+		if (programCacheDirectory.empty() || !blockFunctions.getProgramBinary)
+			return;
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		blockFunctions.getProgramBinary(program, length, &length, &format, binary.data());
+		std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write((const char*)&format, sizeof(format));
+		file.write(binary.data(), length);
+	}
+};
 
 struct Shader
 {
 	GLuint program;
+	bool linked;
+	// the program read from the cache, or the shaders of the one compiled until Finish
+	bool cached;
+	std::string cachePath;
+	GLuint shaders[4];
+	int numShaders;
+	std::map<std::string, GLint> uniforms, attribs;
+
+	// -1 for the names not active in the program, as glGetUniformLocation and glGetAttribLocation
+	GLint Uniform(const std::string &name) const
+	{
+		std::map<std::string, GLint>::const_iterator i = uniforms.find(name);
+		return i == uniforms.end() ? -1 : i->second;
+	}
+	GLint Attrib(const std::string &name) const
+	{
+		std::map<std::string, GLint>::const_iterator i = attribs.find(name);
+		return i == attribs.end() ? -1 : i->second;
+	}
 
-	Shader(const char* vertexsrc, const char* fragsrc)
+	// the status is read by Finish, so that the driver compiles while the other programs are started
+	static GLuint Compile(GLenum type, const std::string &source)
+	{
+		const GLchar *text = source.c_str();
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &text, NULL);
+		glCompileShader(shader);
+		return shader;
+	}
+
+	static void CompileLog(GLuint shader)
 	{
-		//Read and load shaders				
-		const std::string vertexShaderStr = loadShader(vertexsrc);
-		const GLchar *vertexShader = vertexShaderStr.c_str();
-		GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vshader, 1, &vertexShader, NULL);
-		glCompileShader(vshader);
 		GLint r;
-		glGetShaderiv(vshader, GL_COMPILE_STATUS, &r);
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &r);
 		if (!r)
 		{
 			GLchar msg[1024];
-			glGetShaderInfoLog(vshader, sizeof(msg), 0, msg);
+			glGetShaderInfoLog(shader, sizeof(msg), 0, msg);
 			if (msg[0]) {
 				OVR_DEBUG_LOG(("Compiling shader failed: %s\n", msg));
 			}
 		}
+	}
 
-		const std::string FragmentShaderStr = loadShader(fragsrc);
-		const GLchar *fragShader = FragmentShaderStr.c_str();
-		GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fshader, 1, &fragShader, NULL);
-		glCompileShader(fshader);
-		glGetShaderiv(fshader, GL_COMPILE_STATUS, &r);
-		if (!r)
+	// the program of sources made in the viewer, of the stages of types; the outputs of feedback captured
+	// interleaved by its transform feedback
+	Shader(const std::string *sources, const GLenum *types, int count, const std::vector<std::string> &feedback = std::vector<std::string>()) :
+		linked(false),
+		cached(false),
+		numShaders(0)
+	{
+		Start(types, sources, count, feedback);
+	}
+
+	Shader(const char* vertexsrc, const char* fragsrc, SphereMode sphere = SphereMesh, bool multiview = false, bool alphaSplit = false,
+		bool depthEdges = false, const char *videoColor = nullptr, const std::vector<std::string> &graded = std::vector<std::string>()) :
+		linked(false),
+		cached(false),
+		numShaders(0)
+	{
+		//Read and load shaders, the vertex shader of the tessellated sphere as the evaluation shader of its patches
+		bool tessellated = sphere == SphereTessellated;
+		GLenum types[4];
+		std::string sources[4];
+		if (tessellated)
 		{
-			GLchar msg[1024];
-			glGetShaderInfoLog(fshader, sizeof(msg), 0, msg);
-			if (msg[0]) {
-				OVR_DEBUG_LOG(("Compiling shader failed: %s\n", msg));
-			}
+			types[numShaders] = GL_VERTEX_SHADER;
+			sources[numShaders++] = "#version 400\nvoid main()\n{\n}\n";
+			types[numShaders] = GL_TESS_CONTROL_SHADER;
+			sources[numShaders++] = TessellationControlShader();
 		}
+		types[numShaders] = tessellated ? GL_TESS_EVALUATION_SHADER : GL_VERTEX_SHADER;
+		sources[numShaders++] = ViewerShader(loadShader(vertexsrc), true, sphere, multiview, false, depthEdges);
+		types[numShaders] = GL_FRAGMENT_SHADER;
+		sources[numShaders++] = ViewerShader(loadShader(fragsrc), false, sphere, multiview, alphaSplit, depthEdges, videoColor, graded);
+		Start(types, sources, numShaders);
+	}
 
+	// the program from the cache, or its compile and link started
+	void Start(const GLenum *types, const std::string *sources, int count, const std::vector<std::string> &feedback = std::vector<std::string>())
+	{
+		numShaders = count;
+		program = glCreateProgram();
+		cachePath = ProgramCache::Path(sources, numShaders);
+		if (ProgramCache::Load(program, cachePath))
+		{
+			cached = true;
+			numShaders = 0;
+			return;
+		}
+		glDeleteProgram(program);
 		program = glCreateProgram();
 
-		glAttachShader(program, vshader);
-		glAttachShader(program, fshader);
+		for (int i = 0; i < numShaders; i++)
+		{
+			shaders[i] = Compile(types[i], sources[i]);
+			glAttachShader(program, shaders[i]);
+		}
+		if (!feedback.empty())
+		{
+			std::vector<const GLchar*> names;
+			for (const std::string &name : feedback)
+				names.push_back(name.c_str());
+			glTransformFeedbackVaryings(program, GLsizei(names.size()), names.data(), GL_INTERLEAVED_ATTRIBS);
+		}
 
+		if (blockFunctions.programParameteri && !programCacheDirectory.empty())
+			blockFunctions.programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(program);
+	}
 
-		glDetachShader(program, vshader);
-		glDetachShader(program, fshader);
+	// the link status, written to the cache, and the locations, after all the programs are started
+	void Finish()
+	{
+		for (int i = 0; i < numShaders; i++)
+			glDetachShader(program, shaders[i]);
 
+		GLint r;
 		glGetProgramiv(program, GL_LINK_STATUS, &r);
+		linked = r != 0;
 		if (!r)
 		{
+			for (int i = 0; i < numShaders; i++)
+				CompileLog(shaders[i]);
 			GLchar msg[1024];
 			glGetProgramInfoLog(program, sizeof(msg), 0, msg);
 			OVR_DEBUG_LOG(("Linking shaders failed: %s\n", msg));
 		}
+		else if (!cached)
+			ProgramCache::Save(program, cachePath);
+
+		// The locations of the active uniforms and attributes, once, and the block of the frame
+		GLint count = 0, size;
+		GLenum type;
+		GLchar name[256];
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			glGetActiveUniform(program, i, sizeof(name), NULL, &size, &type, name);
+			std::string uniform = name;
+			if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+				uniform.resize(uniform.size() - 3);
+			uniforms[uniform] = glGetUniformLocation(program, name);
+		}
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			glGetActiveAttrib(program, i, sizeof(name), NULL, &size, &type, name);
+			attribs[name] = glGetAttribLocation(program, name);
+		}
+		GLuint block = blockFunctions.getUniformBlockIndex(program, "ViewerFrame");
+		if (block != GL_INVALID_INDEX)
+			blockFunctions.uniformBlockBinding(program, block, frameBinding);
+
+		for (int i = 0; i < numShaders; i++)
+			glDeleteShader(shaders[i]);
+		numShaders = 0;
+	}
+};
+
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+//The GPU memory of the viewer: the bytes of every texture, vertex and index buffer and swap chain it allocates, in
+//pools, against a budget of bytes, none at 0. The owners of the objects report them as they allocate, resize and
+//delete them, from the render thread and the video thread. Fits tells the allocations that would exceed the
+//budget, for the background layers to be downscaled and the previews of the gallery to be released; Check warns
+//once the total passes the budget, or the driver reports its video memory short, GL_NVX_gpu_memory_info or
+//GL_ATI_meminfo, where what the viewer allocates next spills to the memory of the system
+struct GpuResidency
+{
+	enum Pool { PoolVideo, PoolLayers, PoolEyes, PoolGallery, PoolMeshes, PoolOther, Pools };
+	static const long long shortBytes = 256ll << 20;
+	struct Object
+	{
+		Pool pool;
+		long long bytes;
+	};
+	std::mutex mutex;
+	std::map<unsigned long long, Object> objects;
+	long long pools[Pools];
+	long long budget;
+	bool warned;
+	int availableQuery;		//the query of the video memory available, -1 before the first Check, 0 for none
+
+	GpuResidency() : budget(0), warned(false), availableQuery(-1) { memset(pools, 0, sizeof(pools)); }
+
+	//the keys of the objects, the names of the textures even and of the buffers odd; the swap chains and the
+	//renderbuffers by the address of their owner
+	void Texture(GLuint id, Pool pool, long long bytes) { Set(2ull * id, pool, bytes); }
+	void Buffer(GLuint id, Pool pool, long long bytes) { Set(2ull * id + 1, pool, bytes); }
+	void Owned(const void *owner, Pool pool, long long bytes) { Set((unsigned long long)(size_t)owner, pool, bytes); }
+	void FreeTexture(GLuint id) { Set(2ull * id, PoolOther, 0); }
+	void FreeBuffer(GLuint id) { Set(2ull * id + 1, PoolOther, 0); }
+	void FreeOwned(const void *owner) { Set((unsigned long long)(size_t)owner, PoolOther, 0); }
+
+	long long Total()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		long long total = 0;
+		for (int p = 0; p < Pools; p++)
+			total += pools[p];
+		return total;
+	}
+
+	long long TextureBytes(GLuint id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<unsigned long long, Object>::const_iterator o = objects.find(2ull * id);
+		return o == objects.end() ? 0 : o->second.bytes;
+	}
+
+	//whether bytes more fit the budget, the ones of the texture replaced by them given back
+	bool Fits(long long bytes, GLuint replaced = 0)
+	{
+		return budget <= 0 || Total() - (replaced ? TextureBytes(replaced) : 0) + bytes <= budget;
+	}
+
+	//the bytes of video memory the driver has left, -1 if it does not tell; on a thread with a context
+	long long Available()
+	{
+		if (availableQuery < 0)
+		{
+			availableQuery = 0;
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count; ++i)
+			{
+				const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+				if (strcmp(extension, "GL_NVX_gpu_memory_info") == 0)
+					availableQuery = GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX;
+				else if (strcmp(extension, "GL_ATI_meminfo") == 0)
+					availableQuery = GL_TEXTURE_FREE_MEMORY_ATI;
+			}
+		}
+		if (!availableQuery)
+			return -1;
+		//the first of the four values of ATI, the texture pool
+		GLint kilobytes[4] = { 0, 0, 0, 0 };
+		glGetIntegerv(availableQuery, kilobytes);
+		return (long long)kilobytes[0] << 10;
+	}
+
+	//whether the budget is passed or the video memory short, warned once until it is back within them
+	bool Check()
+	{
+		long long total = Total(), available = Available();
+		bool over = (budget > 0 && total > budget) || (available >= 0 && available < shortBytes);
+		if (over && !warned)
+		{
+			std::cout << "the GPU memory of the viewer is " << (total >> 20) << " MB";
+			if (budget > 0)
+				std::cout << " of a budget of " << (budget >> 20) << " MB";
+			if (available >= 0)
+				std::cout << ", " << (available >> 20) << " MB of video memory left";
+			std::cout << "\n";
+			Print();
+		}
+		warned = over;
+		return over;
+	}
+
+	void Print()
+	{
+		static const char *names[Pools] = { "video", "layers", "eyes", "gallery", "meshes", "other" };
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int p = 0; p < Pools; p++)
+			std::cout << "  " << names[p] << " " << (pools[p] >> 20) << " MB\n";
+	}
 
-		glDeleteShader(vshader);
-		glDeleteShader(fshader);
+private:
+	void Set(unsigned long long key, Pool pool, long long bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<unsigned long long, Object>::iterator o = objects.find(key);
+		if (o != objects.end())
+		{
+			pools[o->second.pool] -= o->second.bytes;
+			objects.erase(o);
+		}
+		if (bytes <= 0)
+			return;
+		Object object = { pool, bytes };
+		objects[key] = object;
+		pools[pool] += bytes;
 	}
 };
+static GpuResidency gpuResidency;
+
+//the bytes of a texture of bytesPerTexel bytes a texel, its mip levels a third more
+static long long TextureBytes(int width, int height, double bytesPerTexel, bool mipmapped = false)
+{
+	double bytes = double(width) * height * bytesPerTexel;
+	return (long long)(mipmapped ? bytes * 4 / 3 : bytes);
+}
 
 
 //---------------------------------------------------------------------------------------
 struct DepthBuffer
 {
+    ovrSession          Session;
+    ovrTextureSwapChain TextureChain;   // the depth given to the compositor with the layer, or none
     GLuint        texId;
 
-    DepthBuffer(Sizei size, int sampleCount)
+    DepthBuffer(Sizei size, int sampleCount, ovrSession session = nullptr) :
+        Session(session),
+        TextureChain(nullptr),
+        texId(0)
     {
         UNREFERENCED_PARAMETER(sampleCount);
 
         assert(sampleCount <= 1); // The code doesn't currently handle MSAA textures.
 
+        // the chain of the compositor is 32-bit float, as the depth of the multiview it's copied from
+        if (session)
+        {
+            ovrTextureSwapChainDesc desc = {};
+            desc.Type = ovrTexture_2D;
+            desc.ArraySize = 1;
+            desc.Width = size.w;
+            desc.Height = size.h;
+            desc.MipLevels = 1;
+            desc.Format = OVR_FORMAT_D32_FLOAT;
+            desc.SampleCount = 1;
+            desc.StaticImage = ovrFalse;
+            if (OVR_SUCCESS(ovr_CreateTextureSwapChainGL(Session, &desc, &TextureChain)))
+            {
+                int length = 0;
+                ovr_GetTextureSwapChainLength(Session, TextureChain, &length);
+                gpuResidency.Owned(&TextureChain, GpuResidency::PoolEyes, TextureBytes(size.w, size.h, 4) * length);
+                return;
+            }
+            TextureChain = nullptr;
+        }
+
         glGenTextures(1, &texId);
         glBindTexture(GL_TEXTURE_2D, texId);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -167,15 +1411,40 @@ struct DepthBuffer
         }
 
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.w, size.h, 0, GL_DEPTH_COMPONENT, type, NULL);
+        gpuResidency.Texture(texId, GpuResidency::PoolEyes, TextureBytes(size.w, size.h, 4));
     }
     ~DepthBuffer()
     {
+        if (TextureChain)
+        {
+            ovr_DestroyTextureSwapChain(Session, TextureChain);
+            gpuResidency.FreeOwned(&TextureChain);
+            TextureChain = nullptr;
+        }
         if (texId)
         {
             glDeleteTextures(1, &texId);
+            gpuResidency.FreeTexture(texId);
             texId = 0;
         }
     }
+
+    GLuint CurrentTexId() const
+    {
+        if (!TextureChain)
+            return texId;
+        int curIndex;
+        GLuint curTexId;
+        ovr_GetTextureSwapChainCurrentIndex(Session, TextureChain, &curIndex);
+        ovr_GetTextureSwapChainBufferGL(Session, TextureChain, curIndex, &curTexId);
+        return curTexId;
+    }
+
+    void Commit()
+    {
+        if (TextureChain)
+            ovr_CommitTextureSwapChain(Session, TextureChain);
+    }
 };
 
 //--------------------------------------------------------------------------
@@ -186,25 +1455,33 @@ struct TextureBuffer
     GLuint              texId;
     GLuint              fboId;
     Sizei               texSize;
+    // the part drawn, from the bottom left corner, smaller than the texture under the dynamic resolution
+    Sizei               viewSize;
+    // the multisampled color and depth the eye is drawn into when it has more than a sample, resolved into the
+    // texture when it's unset, and the depth of the layer it was set with
+    GLuint              msaaFboId;
+    GLuint              msaaColorId;
+    GLuint              msaaDepthId;
+    DepthBuffer *       msaaResolveDepth;
 
     TextureBuffer(ovrSession session, bool rendertarget, bool displayableOnHmd, Sizei size, int mipLevels, unsigned char * data, int sampleCount) :
         Session(session),
         TextureChain(nullptr),
         texId(0),
         fboId(0),
-        texSize(0, 0)
+        texSize(0, 0),
+        viewSize(size),
+        msaaFboId(0),
+        msaaColorId(0),
+        msaaDepthId(0),
+        msaaResolveDepth(nullptr)
     {
-        UNREFERENCED_PARAMETER(sampleCount);
-
-        assert(sampleCount <= 1); // The code doesn't currently handle MSAA textures.
-
         texSize = size;
 
         if (displayableOnHmd)
         {
             // This texture isn't necessarily going to be a rendertarget, but it usually is.
             assert(session); // No HMD? A little odd.
-            assert(sampleCount == 1); // ovr_CreateSwapTextureSetD3D11 doesn't support MSAA.
 
             ovrTextureSwapChainDesc desc = {};
             desc.Type = ovrTexture_2D;
@@ -223,6 +1500,7 @@ struct TextureBuffer
 
             if(OVR_SUCCESS(result))
             {
+                gpuResidency.Owned(&TextureChain, GpuResidency::PoolEyes, TextureBytes(size.w, size.h, 4, mipLevels > 1) * length);
                 for (int i = 0; i < length; ++i)
                 {
                     GLuint chainTexId;
@@ -267,6 +1545,7 @@ struct TextureBuffer
             }
 
             glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, texSize.w, texSize.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+            gpuResidency.Texture(texId, GpuResidency::PoolEyes, TextureBytes(texSize.w, texSize.h, 4, mipLevels > 1));
         }
 
         if (mipLevels > 1)
@@ -275,6 +1554,27 @@ struct TextureBuffer
         }
 
         glGenFramebuffers(1, &fboId);
+
+        // the swapchain itself has a sample, the samples are drawn apart and resolved into it
+        if (rendertarget && sampleCount > 1)
+            Multisample(sampleCount);
+    }
+
+    // a render target of the images of another swapchain, OpenXR's: texId is set to the image before it is
+    // drawn and cleared before it is deleted, the texture is not its own
+    TextureBuffer(Sizei size) :
+        Session(nullptr),
+        TextureChain(nullptr),
+        texId(0),
+        fboId(0),
+        texSize(size),
+        viewSize(size),
+        msaaFboId(0),
+        msaaColorId(0),
+        msaaDepthId(0),
+        msaaResolveDepth(nullptr)
+    {
+        glGenFramebuffers(1, &fboId);
     }
 
     ~TextureBuffer()
@@ -282,11 +1582,13 @@ struct TextureBuffer
         if (TextureChain)
         {
             ovr_DestroyTextureSwapChain(Session, TextureChain);
+            gpuResidency.FreeOwned(&TextureChain);
             TextureChain = nullptr;
         }
         if (texId)
         {
             glDeleteTextures(1, &texId);
+            gpuResidency.FreeTexture(texId);
             texId = 0;
         }
         if (fboId)
@@ -294,6 +1596,14 @@ struct TextureBuffer
             glDeleteFramebuffers(1, &fboId);
             fboId = 0;
         }
+        if (msaaFboId)
+        {
+            glDeleteFramebuffers(1, &msaaFboId);
+            glDeleteRenderbuffers(1, &msaaColorId);
+            glDeleteRenderbuffers(1, &msaaDepthId);
+            gpuResidency.FreeOwned(&msaaColorId);
+            msaaFboId = msaaColorId = msaaDepthId = 0;
+        }
     }
 
     Sizei GetSize() const
@@ -301,9 +1611,47 @@ struct TextureBuffer
         return texSize;
     }
 
-    void SetAndClearRenderSurface(DepthBuffer* dbuffer)
+    // the eye drawn with samples per pixel, at most the driver's, into renderbuffers of the size of the texture;
+    // the edges of the triangles, the ones of the depth stretched between the layers above all, are smoothed by
+    // the coverage of the samples while the fragments are shaded once a pixel. The depth is 32-bit float as the
+    // chain of the layer of the depth, which it's resolved into
+    bool Multisample(int samples)
     {
-        GLuint curTexId;
+        GLint most = 0;
+        glGetIntegerv(GL_MAX_SAMPLES, &most);
+        samples = (std::min)(samples, int(most));
+        if (samples <= 1 || msaaFboId)
+            return msaaFboId != 0;
+
+        glGenRenderbuffers(1, &msaaColorId);
+        glBindRenderbuffer(GL_RENDERBUFFER, msaaColorId);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_SRGB8_ALPHA8, texSize.w, texSize.h);
+        glGenRenderbuffers(1, &msaaDepthId);
+        glBindRenderbuffer(GL_RENDERBUFFER, msaaDepthId);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GLE_ARB_depth_buffer_float ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, texSize.w, texSize.h);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &msaaFboId);
+        glBindFramebuffer(GL_FRAMEBUFFER, msaaFboId);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msaaColorId);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, msaaDepthId);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+        {
+            glDeleteFramebuffers(1, &msaaFboId);
+            glDeleteRenderbuffers(1, &msaaColorId);
+            glDeleteRenderbuffers(1, &msaaDepthId);
+            msaaFboId = msaaColorId = msaaDepthId = 0;
+        }
+        else
+            gpuResidency.Owned(&msaaColorId, GpuResidency::PoolEyes, TextureBytes(texSize.w, texSize.h, 8) * samples);
+        return complete;
+    }
+
+    void SetAndClearRenderSurface(DepthBuffer* dbuffer)
+    {
+        GLuint curTexId;
         if (TextureChain)
         {
             int curIndex;
@@ -317,16 +1665,38 @@ struct TextureBuffer
 
         glBindFramebuffer(GL_FRAMEBUFFER, fboId);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, dbuffer->texId, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, dbuffer->CurrentTexId(), 0);
 
-        glViewport(0, 0, texSize.w, texSize.h);
+        // the samples are drawn instead, the texture is what they're resolved into
+        if (msaaFboId)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, msaaFboId);
+            msaaResolveDepth = dbuffer;
+        }
+
+        glViewport(0, 0, viewSize.w, viewSize.h);
 		glClearColor(0.5, 0.5, 0.5,1.0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_FRAMEBUFFER_SRGB);
     }
 
+    // the samples averaged into the texture over the part drawn, in linear under GL_FRAMEBUFFER_SRGB; the depth
+    // only for the layer of the depth, a sample of it as the depth has no average
+    void Resolve()
+    {
+        if (!msaaResolveDepth)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, msaaFboId);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboId);
+        glBlitFramebuffer(0, 0, viewSize.w, viewSize.h, 0, 0, viewSize.w, viewSize.h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        if (msaaResolveDepth->TextureChain)
+            glBlitFramebuffer(0, 0, viewSize.w, viewSize.h, 0, 0, viewSize.w, viewSize.h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        msaaResolveDepth = nullptr;
+    }
+
     void UnsetRenderSurface()
     {
+        Resolve();
         glBindFramebuffer(GL_FRAMEBUFFER, fboId);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
@@ -341,6 +1711,489 @@ struct TextureBuffer
     }
 };
 
+//--------------------------------------------------------------------------
+// both eyes drawn at once with GL_OVR_multiview2 into the two layers of a texture array, copied then to the
+// texture of every eye
+struct MultiviewBuffer
+{
+    typedef void (APIENTRY *FramebufferTextureMultiviewOVR)(GLenum target, GLenum attachment, GLuint texture, GLint level, GLint baseViewIndex, GLsizei numViews);
+    FramebufferTextureMultiviewOVR glFramebufferTextureMultiviewOVR;
+    GLuint              colorId, depthId;
+    GLuint              fboId, readFboId;
+    Sizei               texSize, viewSize;
+
+    static bool IsSupported()
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_OVR_multiview2") == 0)
+                return wglGetProcAddress("glFramebufferTextureMultiviewOVR") != NULL;
+        return false;
+    }
+
+    MultiviewBuffer(Sizei size) :
+        colorId(0),
+        depthId(0),
+        fboId(0),
+        readFboId(0),
+        texSize(size),
+        viewSize(size)
+    {
+        glFramebufferTextureMultiviewOVR = (FramebufferTextureMultiviewOVR)wglGetProcAddress("glFramebufferTextureMultiviewOVR");
+
+        glGenTextures(1, &colorId);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, colorId);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, size.w, size.h, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        GLenum internalFormat = GL_DEPTH_COMPONENT24;
+        GLenum type = GL_UNSIGNED_INT;
+        if (GLE_ARB_depth_buffer_float)
+        {
+            internalFormat = GL_DEPTH_COMPONENT32F;
+            type = GL_FLOAT;
+        }
+        glGenTextures(1, &depthId);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthId);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, size.w, size.h, 2, 0, GL_DEPTH_COMPONENT, type, NULL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        gpuResidency.Texture(colorId, GpuResidency::PoolEyes, TextureBytes(size.w, size.h, 4) * 2);
+        gpuResidency.Texture(depthId, GpuResidency::PoolEyes, TextureBytes(size.w, size.h, 4) * 2);
+
+        glGenFramebuffers(1, &fboId);
+        glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+        glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorId, 0, 0, 2);
+        glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthId, 0, 0, 2);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glGenFramebuffers(1, &readFboId);
+    }
+
+    ~MultiviewBuffer()
+    {
+        glDeleteFramebuffers(1, &fboId);
+        glDeleteFramebuffers(1, &readFboId);
+        glDeleteTextures(1, &colorId);
+        glDeleteTextures(1, &depthId);
+        gpuResidency.FreeTexture(colorId);
+        gpuResidency.FreeTexture(depthId);
+    }
+
+    void SetAndClearRenderSurface()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+        glViewport(0, 0, viewSize.w, viewSize.h);
+        glClearColor(0.5, 0.5, 0.5, 1.0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+    }
+
+    // the view of an eye into the framebuffer bound, the texture of the eye; the sRGB values are copied as they are,
+    // and the depth too for the layer of the depth
+    void CopyTo(int eye, Sizei size, bool depth = false)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFboId);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorId, 0, eye);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth ? depthId : 0, 0, eye);
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBlitFramebuffer(0, 0, viewSize.w, viewSize.h, 0, 0, size.w, size.h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        if (depth)
+            glBlitFramebuffer(0, 0, viewSize.w, viewSize.h, 0, 0, size.w, size.h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+};
+
+//--------------------------------------------------------------------------
+// the foveation of an eye with GL_NV_shading_rate_image: an image of a texel per tile of the eye buffer picks
+// the rate of the fragments of the tile from a palette, every pixel within inner of the fovea, a fragment per
+// 2x2 pixels within outer and per 4x4 beyond, in units of half the width of the viewport. The fovea is fixed at
+// the center of the lens, or follows the gaze of an eye tracker given to SetFovea
+#ifndef GL_R8UI
+#define GL_R8UI 0x8232
+#endif
+#ifndef GL_SHADING_RATE_IMAGE_NV
+#define GL_SHADING_RATE_IMAGE_NV 0x9563
+#define GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV 0x9565
+#define GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV 0x9568
+#define GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV 0x956B
+#define GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV 0x955C
+#define GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV 0x955D
+#endif
+
+struct FoveationImage
+{
+    typedef void (APIENTRY *BindShadingRateImageNV)(GLuint texture);
+    typedef void (APIENTRY *ShadingRateImagePaletteNV)(GLuint viewport, GLuint first, GLsizei count, const GLenum *rates);
+    BindShadingRateImageNV      glBindShadingRateImageNV;
+    ShadingRateImagePaletteNV   glShadingRateImagePaletteNV;
+    GLuint              texId;
+    Sizei               viewSize, tiles;
+    GLint               tileWidth, tileHeight;
+    float               inner, outer;
+    Vector2f            fovea;
+    std::vector<GLubyte> rates;
+
+    static bool IsSupported()
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+            if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_NV_shading_rate_image") == 0)
+                return wglGetProcAddress("glBindShadingRateImageNV") != NULL && wglGetProcAddress("glShadingRateImagePaletteNV") != NULL;
+        return false;
+    }
+
+    // center: the fovea, 0 to 1 from the bottom left corner of the buffer
+    FoveationImage(Sizei size, Vector2f center, float innerRadius, float outerRadius) :
+        texId(0),
+        viewSize(size),
+        tileWidth(16),
+        tileHeight(16),
+        inner(innerRadius),
+        outer(outerRadius)
+    {
+        glBindShadingRateImageNV = (BindShadingRateImageNV)wglGetProcAddress("glBindShadingRateImageNV");
+        glShadingRateImagePaletteNV = (ShadingRateImagePaletteNV)wglGetProcAddress("glShadingRateImagePaletteNV");
+        glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV, &tileWidth);
+        glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV, &tileHeight);
+        tiles = Sizei((size.w + tileWidth - 1) / tileWidth, (size.h + tileHeight - 1) / tileHeight);
+
+        glGenTextures(1, &texId);
+        glBindTexture(GL_TEXTURE_2D, texId);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8UI, tiles.w, tiles.h);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        gpuResidency.Texture(texId, GpuResidency::PoolEyes, TextureBytes(tiles.w, tiles.h, 1));
+        SetFovea(center, size);
+    }
+
+    ~FoveationImage()
+    {
+        glDeleteTextures(1, &texId);
+        gpuResidency.FreeTexture(texId);
+    }
+
+    // the rates of the tiles around a new fovea, 0 to 1 from the bottom left corner of the viewport drawn
+    void SetFovea(Vector2f center, Sizei view)
+    {
+        if (!rates.empty() && center == fovea && view == viewSize)
+            return;
+        fovea = center;
+        viewSize = view;
+        rates.resize(size_t(tiles.w) * tiles.h);
+        float half = 0.5f * viewSize.w;
+        for (int y = 0; y < tiles.h; ++y)
+            for (int x = 0; x < tiles.w; ++x)
+            {
+                float dx = ((x + 0.5f) * tileWidth - fovea.x * viewSize.w) / half;
+                float dy = ((y + 0.5f) * tileHeight - fovea.y * viewSize.h) / half;
+                float r = sqrtf(dx * dx + dy * dy);
+                rates[size_t(y) * tiles.w + x] = r < inner ? 0 : r < outer ? 1 : 2;
+            }
+        glBindTexture(GL_TEXTURE_2D, texId);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tiles.w, tiles.h, GL_RED_INTEGER, GL_UNSIGNED_BYTE, rates.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // the radii of the rates changed, the tiles around the same fovea
+    void SetRadii(float innerRadius, float outerRadius)
+    {
+        inner = innerRadius;
+        outer = outerRadius;
+        rates.clear();
+        SetFovea(fovea, viewSize);
+    }
+
+    // the rates of the draws into the eye buffer, until Disable
+    void Enable()
+    {
+        static const GLenum palette[3] = { GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV, GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV,
+            GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV };
+        glBindShadingRateImageNV(texId);
+        glShadingRateImagePaletteNV(0, 0, 3, palette);
+        glEnable(GL_SHADING_RATE_IMAGE_NV);
+    }
+
+    static void Disable()
+    {
+        glDisable(GL_SHADING_RATE_IMAGE_NV);
+    }
+};
+
+//--------------------------------------------------------------------------
+// the GPU time of the frames, measured by GL_TIME_ELAPSED queries that are read numQueries - 1 frames later so
+// that they never wait, for the dynamic resolution and the quality governor
+struct FrameTimer
+{
+    static const int    numQueries = 4;
+    GLuint              queries[numQueries];
+    long long           frame;
+
+    FrameTimer() : frame(0)
+    {
+        glGenQueries(numQueries, queries);
+    }
+
+    ~FrameTimer()
+    {
+        glDeleteQueries(numQueries, queries);
+    }
+
+    void Begin()
+    {
+        glBeginQuery(GL_TIME_ELAPSED, queries[frame % numQueries]);
+    }
+
+    // the end of the draws of the frame; the ms of the oldest query, -1 if it's not there yet
+    float End()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        if (++frame < numQueries)
+            return -1;
+        GLuint oldest = queries[frame % numQueries];
+        GLint available = 0;
+        glGetQueryObjectiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return -1;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(oldest, GL_QUERY_RESULT, &nanoseconds);
+        return float(nanoseconds) * 1e-6f;
+    }
+};
+
+//--------------------------------------------------------------------------
+// the dynamic resolution: the scale of the sides of the eye buffers from the GPU time of the frames of a
+// FrameTimer. The scale shrinks fast over 90% of the budget of a frame and grows slowly under 70%, between
+// minScale and 1
+struct ResolutionScaler
+{
+    float               budgetMs, minScale, scale;
+
+    ResolutionScaler(float refreshRate, float _minScale, float startScale) :
+        budgetMs(1000.0f / refreshRate),
+        minScale(_minScale),
+        scale(startScale)
+    {
+    }
+
+    void Update(float ms)
+    {
+        if (ms > 0.9f * budgetMs)
+            scale = (std::max)(minScale, scale * 0.93f);
+        else if (ms < 0.7f * budgetMs)
+            scale = (std::min)(1.0f, scale * 1.02f);
+    }
+
+    bool AtMin() const
+    {
+        return scale <= minScale;
+    }
+
+    bool AtMax() const
+    {
+        return scale >= 1.0f;
+    }
+
+    Sizei Viewport(Sizei size) const
+    {
+        return Sizei((std::max)(1, int(size.w * scale + 0.5f)), (std::max)(1, int(size.h * scale + 0.5f)));
+    }
+};
+
+//--------------------------------------------------------------------------
+// the layers of the eyes drawn at the rate of the video into a cache of a wider field of view, and every frame
+// of the HMD in between reprojected from it to the pose of the frame: a grid of quads over the cache, every
+// vertex moved to the point of the world of its depth and projected into the view of the eye, sampling the
+// color of the cache. The surfaces stretch across the steps of the depth, as in the positional timewarp, so the
+// cache is drawn again too once the head moves 5 cm or turns by the margin of its field of view
+struct ReprojectionCache
+{
+    static const int    gridStep = 8;       // the pixels of the cache per quad of the grid
+    TextureBuffer     * color[2];
+    DepthBuffer       * depth[2];
+    ovrFovPort          fov[2];
+    Matrix4f            inverse[2];         // from the clip space of the views the cache was drawn from to the world
+    long long           frame;              // the frame of the video in the cache, -1 for none
+    ovrPosef            pose;               // of the head the cache was drawn from
+    float               margin;             // the radians of the field of view of the cache past the one of the eyes
+    Shader            * shader;
+    GLuint              vertexArray;
+
+    static std::string WarpShader(bool vertex)
+    {
+        if (vertex)
+            return "#version 330\n"
+                "uniform sampler2D cacheDepth;\n"
+                "uniform mat4 cacheInverse;\n"
+                "uniform mat4 warpViewProj;\n"
+                "uniform int warpCols;\n"
+                "uniform int warpRows;\n"
+                "out vec2 warpUV;\n"
+                "void main()\n"
+                "{\n"
+                "\tint quad = gl_VertexID / 6, corner = gl_VertexID - quad * 6;\n"
+                "\tint r = quad / warpCols, s = quad - r * warpCols;\n"
+                "\tif (corner == 2 || corner == 3 || corner == 5) r++;\n"
+                "\tif (corner == 1 || corner == 2 || corner == 5) s++;\n"
+                "\twarpUV = vec2(float(s) / float(warpCols), float(r) / float(warpRows));\n"
+                "\tfloat d = textureLod(cacheDepth, warpUV, 0.0).r;\n"
+                "\tgl_Position = warpViewProj * (cacheInverse * vec4(2.0 * warpUV - 1.0, 2.0 * d - 1.0, 1.0));\n"
+                "}\n";
+        return "#version 330\n"
+            "uniform sampler2D cacheColor;\n"
+            "in vec2 warpUV;\n"
+            "out vec4 fragColor;\n"
+            "void main()\n"
+            "{\n"
+            "\tfragColor = texture(cacheColor, warpUV);\n"
+            "}\n";
+    }
+
+    // of scale times the field of view of the eyes, at the density of their buffers
+    ReprojectionCache(const Sizei eyeSize[2], const ovrFovPort eyeFov[2], float scale) :
+        frame(-1),
+        margin(3.14159265f),
+        shader(nullptr),
+        vertexArray(0)
+    {
+        for (int eye = 0; eye < 2; ++eye)
+        {
+            Sizei size(int(eyeSize[eye].w * scale + 0.5f), int(eyeSize[eye].h * scale + 0.5f));
+            color[eye] = new TextureBuffer(nullptr, true, false, size, 1, NULL, 1);
+            depth[eye] = new DepthBuffer(size, 0);
+            const float tans[4] = { eyeFov[eye].UpTan, eyeFov[eye].DownTan, eyeFov[eye].LeftTan, eyeFov[eye].RightTan };
+            for (int side = 0; side < 4; ++side)
+                margin = (std::min)(margin, atanf(tans[side] * scale) - atanf(tans[side]));
+            fov[eye].UpTan = tans[0] * scale;
+            fov[eye].DownTan = tans[1] * scale;
+            fov[eye].LeftTan = tans[2] * scale;
+            fov[eye].RightTan = tans[3] * scale;
+        }
+        GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        std::string sources[2] = { WarpShader(true), WarpShader(false) };
+        shader = new Shader(sources, types, 2);
+        shader->Finish();
+        if (!shader->linked)
+        {
+            glDeleteProgram(shader->program);
+            delete shader;
+            shader = nullptr;
+            return;
+        }
+        glUseProgram(shader->program);
+        glUniform1i(shader->Uniform("cacheColor"), TextureUnits);
+        glUniform1i(shader->Uniform("cacheDepth"), TextureUnits + 1);
+        glUseProgram(0);
+        glGenVertexArrays(1, &vertexArray);
+    }
+
+    ~ReprojectionCache()
+    {
+        if (shader)
+        {
+            glDeleteProgram(shader->program);
+            delete shader;
+        }
+        if (vertexArray)
+            glDeleteVertexArrays(1, &vertexArray);
+        for (int eye = 0; eye < 2; ++eye)
+        {
+            delete color[eye];
+            delete depth[eye];
+        }
+    }
+
+    // whether the layers are to be drawn into the cache again, for another frame of the video or a head out of
+    // its reach
+    bool Due(long long videoFrame, const ovrPosef &head) const
+    {
+        if (videoFrame < 0 || videoFrame != frame)
+            return true;
+        float moved = (Vector3f(head.Position) - Vector3f(pose.Position)).Length();
+        Quatf turn = Quatf(pose.Orientation).Inverted() * Quatf(head.Orientation);
+        float angle = 2 * acosf((std::min)(fabsf(turn.w), 1.0f));
+        return moved > 0.05f || angle > margin;
+    }
+
+    // the view the cache of an eye was just drawn from
+    void Store(int eye, const Matrix4f &view, const Matrix4f &proj)
+    {
+        inverse[eye] = (proj * view).Inverted();
+    }
+
+    // the cache of an eye reprojected into the eye buffer bound, of the view and projection of the frame; the
+    // cache is bound on the units past the ones of the scene, so that its textures stay bound
+    void Draw(int eye, const Matrix4f &view, const Matrix4f &proj)
+    {
+        Sizei size = color[eye]->GetSize();
+        int cols = (std::max)(1, size.w / gridStep), rows = (std::max)(1, size.h / gridStep);
+        Matrix4f viewProj = proj * view;
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glUseProgram(shader->program);
+        glUniformMatrix4fv(shader->Uniform("cacheInverse"), 1, GL_TRUE, &inverse[eye].M[0][0]);
+        glUniformMatrix4fv(shader->Uniform("warpViewProj"), 1, GL_TRUE, &viewProj.M[0][0]);
+        glUniform1i(shader->Uniform("warpCols"), cols);
+        glUniform1i(shader->Uniform("warpRows"), rows);
+        glActiveTexture(GL_TEXTURE0 + TextureUnits + 1);
+        glBindTexture(GL_TEXTURE_2D, depth[eye]->texId);
+        glActiveTexture(GL_TEXTURE0 + TextureUnits);
+        glBindTexture(GL_TEXTURE_2D, color[eye]->texId);
+        glBindVertexArray(vertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, cols * rows * 6);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+};
+
+//-------------------------------------------------------------------------------------------
+// The presses of the keys a thread other than the one of the message pump subscribed to: the pump
+// queues them as the window gets them, autorepeats aside, and calls Notify, so the thread waiting on
+// its own work wakes for them instead of polling the keys of the window. Notify is called on the
+// thread of the pump, and once more when the window stops running
+struct KeyQueue
+{
+    bool                    Subscribed[256];
+    std::function<void()>   Notify;
+    std::mutex              Mutex;
+    std::deque<int>         Pressed;
+
+    KeyQueue(std::initializer_list<int> keys)
+    {
+        for (int i = 0; i < 256; ++i)
+            Subscribed[i] = false;
+        for (int key : keys)
+            Subscribed[key & 255] = true;
+    }
+
+    void Push(int key)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Pressed.push_back(key);
+        }
+        if (Notify)
+            Notify();
+    }
+
+    bool Pop(int &key)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (Pressed.empty())
+            return false;
+        key = Pressed.front();
+        Pressed.pop_front();
+        return true;
+    }
+};
+
 //-------------------------------------------------------------------------------------------
 struct OGL
 {
@@ -351,8 +2204,11 @@ struct OGL
     HGLRC                   WglContext;
 	HGLRC                   WglContext_VideoThread;
     OVR::GLEContext         GLEContext;
-    bool                    Running;
-    bool                    Key[256];
+    std::atomic<bool>       Running;
+    bool                    Key[256];           // of the thread of the pump only, the others subscribe
+    DWORD                   PumpThread;         // the thread that created the window, the one that pumps its messages
+    std::mutex              QueuesMutex;
+    std::vector<KeyQueue*>  Queues;
     int                     WinSizeW;
     int                     WinSizeH;
     GLuint                  fboId;
@@ -366,12 +2222,14 @@ struct OGL
         {
         case WM_KEYDOWN:
             p->Key[wParam] = true;
+            if (!(lParam & (1 << 30)))
+                p->Pressed(int(wParam & 255));
             break;
         case WM_KEYUP:
             p->Key[wParam] = false;
             break;
         case WM_DESTROY:
-            p->Running = false;
+            p->Stop();
             break;
 		case WM_SIZE:
 			p->WinSizeW = LOWORD(lParam);
@@ -380,13 +2238,45 @@ struct OGL
         default:
             return DefWindowProcW(hWnd, Msg, wParam, lParam);
         }
-        if ((p->Key['Q'] && p->Key[VK_CONTROL]) || p->Key[VK_ESCAPE])
+        if (((p->Key['Q'] && p->Key[VK_CONTROL]) || p->Key[VK_ESCAPE]) && p->Running)
         {
-            p->Running = false;
+            p->Stop();
         }
         return 0;
     }
 
+    void Pressed(int key)
+    {
+        std::lock_guard<std::mutex> lock(QueuesMutex);
+        for (KeyQueue *queue : Queues)
+            if (queue->Subscribed[key])
+                queue->Push(key);
+    }
+
+    void Stop()
+    {
+        Running = false;
+        std::lock_guard<std::mutex> lock(QueuesMutex);
+        for (KeyQueue *queue : Queues)
+            if (queue->Notify)
+                queue->Notify();
+    }
+
+    // any thread, the queue outliving its subscription
+    void Subscribe(KeyQueue *queue)
+    {
+        std::lock_guard<std::mutex> lock(QueuesMutex);
+        Queues.push_back(queue);
+    }
+
+    void Unsubscribe(KeyQueue *queue)
+    {
+        std::lock_guard<std::mutex> lock(QueuesMutex);
+        for (size_t i = 0; i < Queues.size(); ++i)
+            if (Queues[i] == queue)
+                Queues.erase(Queues.begin() + i--);
+    }
+
     OGL() :
         Window(nullptr),
         hDC(nullptr),
@@ -394,6 +2284,7 @@ struct OGL
 		WglContext_VideoThread(nullptr),
         GLEContext(),
         Running(false),
+        PumpThread(0),
         WinSizeW(0),
         WinSizeH(0),
         fboId(0),
@@ -414,6 +2305,7 @@ struct OGL
     {
         hInstance = hInst;
         Running = true;
+        PumpThread = GetCurrentThreadId();
 
         WNDCLASSW wc;
         memset(&wc, 0, sizeof(wc));
@@ -581,8 +2473,11 @@ struct OGL
         return true;
     }
 
+    // the messages of the window, on the thread of the pump; the other threads only read Running
     bool HandleMessages(void)
     {
+        if (GetCurrentThreadId() != PumpThread)
+            return Running;
         MSG msg;
         while (PeekMessage(&msg, NULL, 0U, 0U, PM_REMOVE))
         {
@@ -647,12 +2542,14 @@ struct VertexBuffer
         glGenBuffers(1, &buffer);
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
         glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
+        gpuResidency.Buffer(buffer, GpuResidency::PoolMeshes, size);
     }
     ~VertexBuffer()
     {
         if (buffer)
         {
             glDeleteBuffers(1, &buffer);
+            gpuResidency.FreeBuffer(buffer);
             buffer = 0;
         }
     }
@@ -668,12 +2565,14 @@ struct IndexBuffer
         glGenBuffers(1, &buffer);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
+        gpuResidency.Buffer(buffer, GpuResidency::PoolMeshes, size);
     }
     ~IndexBuffer()
     {
         if (buffer)
         {
             glDeleteBuffers(1, &buffer);
+            gpuResidency.FreeBuffer(buffer);
             buffer = 0;
         }
     }
@@ -688,15 +2587,89 @@ struct Model
         DWORD     C;
         float     U, V;
     };
+    // the vertex of SphereCompact, 4 bytes: U and V normalized
+    struct CompactVertex
+    {
+        GLushort  U, V;
+    };
 
     Vector3f        Pos;
     Quatf           Rot;
     Matrix4f        Mat;
     int             numVertices, numIndices;
-    Vertex          Vertices[50000000]; // NOTE fixed maximum!!
-    GLuint        Indices[50000000];
+    // the geometry until AllocateBuffers uploads it, sized by the meshes added
+    std::vector<Vertex> Vertices;
+    std::vector<CompactVertex> CompactVertices;
+    std::vector<GLuint> Indices;
+    // the mesh in patches of their own vertices, the borders repeated, and 16-bit indices drawn from the base
+    // vertex of every patch, where GL 3.2 has the draws with one (patchLocal); in rings with 32-bit indices
+    // otherwise. The patches are those of the culling, their grid refined until no patch has more than 65536
+    // vertices, and the first index, the count and the base vertex of every one kept for the draws
+    std::vector<GLushort> ShortIndices;
+    bool            patchLocal;
+    std::vector<const void*> patchOffsets;
+    std::vector<GLsizei> patchCounts;
+    std::vector<GLint> patchBases;
     VertexBuffer  * vertexBuffer;
     IndexBuffer   * indexBuffer;
+    // the procedural sphere has no buffers: numIndices vertices made from their IDs, the tessellated one
+    // tessRows x tessCols patches of a vertex each
+    SphereMode      sphereMode;
+    int             sphereRings, sphereSlices;
+    float           sphereRadius;
+    GLuint          emptyArray;
+    int             tessRows, tessCols;
+    // the levels of the patches: the pixels of the eye, of an edge of a triangle, and the gain of the depth
+    Vector2f        tessViewport;
+    float           tessPixels, tessDepthGain;
+    // the pyramid of the video depth bound on UnitPyramid for the levels of the patches
+    bool            depthPyramid;
+    // the opaque foreground drawn first, so the background behind it fails the depth test before it's shaded
+    bool            earlyZ;
+    // the culling of the mesh and the procedural sphere in cullBands x cullColumns patches of quads, each with
+    // the cone of its directions from the center: the geometry is assumed no nearer to the center than cullNear,
+    // which bounds how far the eye off the center sees it turned. The ranges of the quads of the patches seen,
+    // in the order of the quads, drawn at once unless cullAll
+    int             cullBands, cullColumns;
+    bool            culling, cullAll;
+    float           cullNear;
+    std::vector<Vector3f> cullAxes;
+    std::vector<float> cullAngles;
+    std::vector<GLint> cullFirsts;
+    std::vector<GLsizei> cullCounts;
+    std::vector<const void*> cullOffsets;
+    std::vector<GLint> cullBases;
+    // the patches seen of the last Cull; the occupancies of the alphas of the passes of the foreground, bound by
+    // Scene::BindTextures, that Draw also skips the patches over the empty cells of, unless !alphaCulling
+    std::vector<char> cullSeen;
+    const AlphaOccupancy *videoAlpha, *layerAlpha;
+    bool            alphaCulling;
+    std::vector<char> alphaSeen;
+    std::vector<GLint> alphaFirsts;
+    std::vector<GLsizei> alphaCounts;
+    std::vector<const void*> alphaOffsets;
+    std::vector<GLint> alphaBases;
+    // the layers drawn only for the patches within lodAngle of the direction of the views, where the parallax is
+    // seen: LodSplit parts the patches seen into the inner ones, lodSeen[0], that the three passes of Render draw,
+    // and the outer ones, lodSeen[1], that the single video pass of RenderSimple draws instead; 0 for none
+    float           lodAngle;
+    bool            lodSplit;
+    std::vector<char> lodSeen[2];
+    std::vector<GLint> lodFirsts[2];
+    std::vector<GLsizei> lodCounts[2];
+    std::vector<const void*> lodOffsets[2];
+    std::vector<GLint> lodBases[2];
+    // the vertex arrays of the buffers, one per shader as their attributes have locations of their own
+    std::map<const Shader*, GLuint> vertexArrays;
+    // the background displaced by its static depth, see Scene::BakeBackground: the outputs of its vertex shader
+    // for every vertex of the buffer, of bakedSizes floats each, drawn by bakedShader with the indices of the mesh
+    // in place of Shaders[0]; nullptr until baked
+    const Shader   *bakedShader;
+    GLuint          bakedBuffer;
+    std::vector<GLint> bakedSizes;
+    // the meshes of densities of their own of the passes of the background, the foreground and the video, owned
+    // by this model and placed and culled as it is; nullptr for the passes drawn with its own mesh
+    Model          *passModels[3];
 
     Model(Vector3f pos) :
         numVertices(0),
@@ -705,12 +2678,48 @@ struct Model
         Rot(),
         Mat(),
         vertexBuffer(nullptr),
-        indexBuffer(nullptr)
-    {}
+        indexBuffer(nullptr),
+        patchLocal(false),
+        sphereMode(SphereMesh),
+        sphereRings(0),
+        sphereSlices(0),
+        sphereRadius(0),
+        emptyArray(0),
+        tessRows(0),
+        tessCols(0),
+        tessViewport(1, 1),
+        tessPixels(8),
+        tessDepthGain(8),
+        depthPyramid(false),
+        earlyZ(false),
+        cullBands(16),
+        cullColumns(32),
+        culling(false),
+        cullAll(true),
+        cullNear(0.5f),
+        videoAlpha(nullptr),
+        layerAlpha(nullptr),
+        alphaCulling(false),
+        lodAngle(0),
+        lodSplit(false),
+        bakedShader(nullptr),
+        bakedBuffer(0)
+    {
+        for (int pass = 0; pass < 3; pass++)
+            passModels[pass] = nullptr;
+    }
 
     ~Model()
     {
         FreeBuffers();
+        for (int pass = 0; pass < 3; pass++)
+            delete passModels[pass];
+    }
+
+    // the mesh of pass 0 (the background), 1 (the foreground) or 2 (the video)
+    Model* PassModel(int pass)
+    {
+        return passModels[pass] ? passModels[pass] : this;
     }
 
     Matrix4f& GetMatrix()
@@ -720,41 +2729,84 @@ struct Model
         return Mat;
     }
 
-    void AddVertex(const Vertex& v) { Vertices[numVertices++] = v; }
-    void AddIndex(GLuint a) { Indices[numIndices++] = a; }
+    void AddVertex(const Vertex& v) { Vertices.push_back(v); numVertices++; }
+    void AddIndex(GLuint a) { Indices.push_back(a); numIndices++; }
 
+    // the memory of the geometry is freed once on the GPU, the counts are kept for the draws
     void AllocateBuffers()
     {
-        vertexBuffer = new VertexBuffer(&Vertices[0], numVertices * sizeof(Vertices[0]));
-        indexBuffer = new IndexBuffer(&Indices[0], numIndices * sizeof(Indices[0]));
+        if (sphereMode == SphereProcedural || sphereMode == SphereTessellated)
+        {
+            glGenVertexArrays(1, &emptyArray);
+            return;
+        }
+        if (sphereMode == SphereCompact)
+            vertexBuffer = new VertexBuffer(CompactVertices.data(), numVertices * sizeof(CompactVertex));
+        else
+            vertexBuffer = new VertexBuffer(Vertices.data(), numVertices * sizeof(Vertex));
+        if (patchLocal)
+            indexBuffer = new IndexBuffer(ShortIndices.data(), numIndices * sizeof(GLushort));
+        else
+            indexBuffer = new IndexBuffer(Indices.data(), numIndices * sizeof(GLuint));
+        std::vector<Vertex>().swap(Vertices);
+        std::vector<CompactVertex>().swap(CompactVertices);
+        std::vector<GLuint>().swap(Indices);
+        std::vector<GLushort>().swap(ShortIndices);
     }
 
     void FreeBuffers()
     {
         delete vertexBuffer; vertexBuffer = nullptr;
         delete indexBuffer; indexBuffer = nullptr;
+        if (emptyArray)
+        {
+            glDeleteVertexArrays(1, &emptyArray);
+            emptyArray = 0;
+        }
+        for (std::map<const Shader*, GLuint>::iterator i = vertexArrays.begin(); i != vertexArrays.end(); ++i)
+            glDeleteVertexArrays(1, &i->second);
+        vertexArrays.clear();
+        if (bakedBuffer)
+        {
+            glDeleteBuffers(1, &bakedBuffer);
+            gpuResidency.FreeBuffer(bakedBuffer);
+            bakedBuffer = 0;
+        }
+        bakedShader = nullptr;
     }
 
-	void AddSphere(float radius, int rings, int slices) {
+	void AddSphere(float radius, int rings, int slices, SphereMode mode = SphereMesh) {
+		sphereMode = mode;
+		sphereRings = rings;
+		sphereSlices = slices;
+		sphereRadius = radius;
+		if (mode == SphereProcedural) {
+			numIndices = (rings - 1) * (slices - 1) * 6;
+			return;
+		}
+		if (mode == SphereTessellated) {
+			tessRows = (rings - 2) / tessMaxLevel + 1;
+			tessCols = (slices - 2) / tessMaxLevel + 1;
+			return;
+		}
 		 
 		//Generate sphere
-		float x, y, z, r, s;
+		float r, s;
 		float const R = 1.f / (float)(rings - 1);
 		float const S = 1.f / (float)(slices - 1);
-		Vertex vertex;
+		patchLocal = blockFunctions.multiDrawElementsBaseVertex != NULL;
+		if (patchLocal) {
+			AddSpherePatches(radius, rings, slices, mode);
+			return;
+		}
+		if (mode == SphereCompact)
+			CompactVertices.reserve(CompactVertices.size() + size_t(rings) * slices);
+		else
+			Vertices.reserve(Vertices.size() + size_t(rings) * slices);
+		Indices.reserve(Indices.size() + size_t(rings - 1) * (slices - 1) * 6);
 		for (r = 0; r < rings; ++r) {
 			for (s = 0; s < slices; ++s) {
-				x = cosf(2 * M_PI * s * S) * sinf(M_PI * r * R);
-				z = sinf(2 * M_PI * s * S) * sinf(M_PI * r * R);
-				y = sinf(-M_PI_2 + (M_PI * r * R));
-				vertex.Pos.x = x * radius;
-				vertex.Pos.y = y * radius;
-				vertex.Pos.z = z * radius;
-				vertex.U = s*S;
-				vertex.V = r*R;
-				vertex.C = 0xffffffff;
-				AddVertex(vertex);
-
+				AddSphereVertex(radius, r, s, R, S, mode);
 			}
 		}
 		unsigned int ringStart, nextRingStart, nextslice;
@@ -776,78 +2828,430 @@ struct Model
 
 		
 	}
-		
 
-	void RenderBlack(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, double ablack, float radius, bool isblack, ARGS args, Shader * Shaders[10])
-	{
-		Matrix4f combined = proj * view * GetMatrix();
-		Matrix4f mtw = GetMatrix();
+	// the vertex of ring r and slice s of the sphere
+	void AddSphereVertex(float radius, float r, float s, float R, float S, SphereMode mode) {
+		if (mode == SphereCompact) {
+			CompactVertex compact = { GLushort(s * S * 65535 + 0.5f), GLushort((1.f - r * R) * 65535 + 0.5f) };
+			CompactVertices.push_back(compact);
+			numVertices++;
+			return;
+		}
+		Vertex vertex;
+		float x = cosf(2 * M_PI * s * S) * sinf(M_PI * r * R);
+		float z = sinf(2 * M_PI * s * S) * sinf(M_PI * r * R);
+		float y = sinf(-M_PI_2 + (M_PI * r * R));
+		vertex.Pos.x = x * radius;
+		vertex.Pos.y = y * radius;
+		vertex.Pos.z = z * radius;
+		//the textures hold the top row of the panoramas first, at V = 0
+		vertex.U = s*S;
+		vertex.V = 1.f - r*R;
+		vertex.C = 0xffffffff;
+		AddVertex(vertex);
+	}
 
-		if (poly_mesh == true)
-		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	// the sphere patch after patch, the quads of every one in rows as in the rings, with the same triangles
+	void AddSpherePatches(float radius, int rings, int slices, SphereMode mode) {
+		float const R = 1.f / (float)(rings - 1);
+		float const S = 1.f / (float)(slices - 1);
+		int rows = rings - 1, cols = slices - 1;
+		while ((rows / cullBands + 2) * (cols / cullColumns + 2) > 65536) {
+			if (cullBands * 2 <= cullColumns)
+				cullBands *= 2;
+			else
+				cullColumns *= 2;
 		}
+		if (mode == SphereCompact)
+			CompactVertices.reserve(CompactVertices.size() + size_t(rows + cullBands) * (cols + cullColumns));
 		else
+			Vertices.reserve(Vertices.size() + size_t(rows + cullBands) * (cols + cullColumns));
+		ShortIndices.reserve(ShortIndices.size() + size_t(rows) * cols * 6);
+		for (int b = 0; b < cullBands; b++)
+			for (int c = 0; c < cullColumns; c++) {
+				int r0, r1, s0, s1;
+				PatchRange(b, cullBands, rows, r0, r1);
+				PatchRange(c, cullColumns, cols, s0, s1);
+				patchOffsets.push_back((const void*)(ShortIndices.size() * sizeof(GLushort)));
+				patchCounts.push_back(GLsizei((r1 - r0) * (s1 - s0) * 6));
+				patchBases.push_back(numVertices);
+				if (r0 == r1 || s0 == s1)
+					continue;
+				for (int r = r0; r <= r1; r++)
+					for (int s = s0; s <= s1; s++)
+						AddSphereVertex(radius, float(r), float(s), R, S, mode);
+				GLushort width = GLushort(s1 - s0 + 1);
+				for (int r = 0; r < r1 - r0; r++)
+					for (int s = 0; s < s1 - s0; s++) {
+						GLushort ringStart = GLushort(r * width), nextRingStart = GLushort(ringStart + width);
+						GLushort quad[6] = { GLushort(ringStart + s), GLushort(ringStart + s + 1), GLushort(nextRingStart + s + 1),
+							GLushort(nextRingStart + s), GLushort(ringStart + s), GLushort(nextRingStart + s + 1) };
+						ShortIndices.insert(ShortIndices.end(), quad, quad + 6);
+					}
+			}
+		numIndices = int(ShortIndices.size());
+	}
+
+	// the draw of the sphere with the program bound, its inputs named as in the shaders; of the patches over the
+	// occupied cells of alpha only, where it is given, and of the inner (part 1) or the outer (part 2) ones of
+	// LodSplit only, where it split them
+	void Draw(const Shader* shader, const char* position, const char* color, const char* texcoord, const AlphaOccupancy *alpha = nullptr, int part = 0)
+	{
+		bool all = cullAll;
+		const std::vector<char> *seen = cullAll ? nullptr : &cullSeen;
+		const std::vector<GLint> *firsts = &cullFirsts, *bases = &cullBases;
+		const std::vector<GLsizei> *counts = &cullCounts;
+		const std::vector<const void*> *offsets = &cullOffsets;
+		if (part > 0 && lodSplit)
 		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			all = false;
+			seen = &lodSeen[part - 1];
+			firsts = &lodFirsts[part - 1];
+			bases = &lodBases[part - 1];
+			counts = &lodCounts[part - 1];
+			offsets = &lodOffsets[part - 1];
 		}
+		if (AlphaLists(alpha, seen))
+		{
+			all = false;
+			firsts = &alphaFirsts;
+			bases = &alphaBases;
+			counts = &alphaCounts;
+			offsets = &alphaOffsets;
+		}
+		if (sphereMode != SphereMesh)
+		{
+			glUniform1i(shader->Uniform("sphereRings"), sphereRings);
+			glUniform1i(shader->Uniform("sphereSlices"), sphereSlices);
+			glUniform1f(shader->Uniform("sphereRadius"), sphereRadius);
+		}
+		if (sphereMode == SphereProcedural)
+		{
+			glBindVertexArray(emptyArray);
+			if (all)
+				glDrawArrays(GL_TRIANGLES, 0, numIndices);
+			else if (!firsts->empty())
+				glMultiDrawArrays(GL_TRIANGLES, &(*firsts)[0], &(*counts)[0], GLsizei(firsts->size()));
+			glBindVertexArray(0);
+			return;
+		}
+		if (sphereMode == SphereTessellated)
+		{
+			glUniform1i(shader->Uniform("tessRows"), tessRows);
+			glUniform1i(shader->Uniform("tessCols"), tessCols);
+			glUniform2f(shader->Uniform("tessViewport"), tessViewport.x, tessViewport.y);
+			glUniform1f(shader->Uniform("tessPixels"), tessPixels);
+			glUniform1f(shader->Uniform("tessDepthGain"), tessDepthGain);
+			glUniform1i(shader->Uniform("tessPyramid"), depthPyramid);
+			glBindVertexArray(emptyArray);
+			blockFunctions.patchParameteri(GL_PATCH_VERTICES, 1);
+			glDrawArrays(GL_PATCHES, 0, tessRows * tessCols);
+			glBindVertexArray(0);
+			return;
+		}
+		glBindVertexArray(VertexArray(shader, position, color, texcoord));
+		if (patchLocal)
+		{
+			const std::vector<GLsizei> &drawn = all ? patchCounts : *counts;
+			if (!drawn.empty())
+				blockFunctions.multiDrawElementsBaseVertex(GL_TRIANGLES, &drawn[0], GL_UNSIGNED_SHORT,
+					all ? &patchOffsets[0] : &(*offsets)[0], GLsizei(drawn.size()), all ? &patchBases[0] : &(*bases)[0]);
+		}
+		else if (all)
+			glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
+		else if (!firsts->empty())
+			glMultiDrawElements(GL_TRIANGLES, &(*counts)[0], GL_UNSIGNED_INT, &(*offsets)[0], GLsizei(firsts->size()));
+		glBindVertexArray(0);
+	}
 
-		glDisable(GL_CULL_FACE);
-		glDisable(GL_BLEND);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		//glDisable(GL_DEPTH_TEST);
-		GLuint shader_black = Shaders[4]->program;
-		glUseProgram(shader_black);
-
-		float black = isblack ? 1.0f : 0.0f;
-		glUniform1f(glGetUniformLocation(shader_black, "black"), (float)black);
-		glUniform1f(glGetUniformLocation(shader_black, "radius"), (float)radius);
-		glUniform1f(glGetUniformLocation(shader_black, "alpha"), (float)ablack);
-		glUniformMatrix4fv(glGetUniformLocation(shader_black, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, *args.black_text);
-		glUniform1i(glGetUniformLocation(shader_black, "bgtext"), 4);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-		glUniform1i(glGetUniformLocation(shader_black, "depthbg"), 5);
+	// every vertex of the buffer once, as a point, for the transform feedback of the program bound
+	void DrawPoints(const Shader* shader, const char* position, const char* color, const char* texcoord)
+	{
+		if (sphereMode != SphereMesh)
+		{
+			glUniform1i(shader->Uniform("sphereRings"), sphereRings);
+			glUniform1i(shader->Uniform("sphereSlices"), sphereSlices);
+			glUniform1f(shader->Uniform("sphereRadius"), sphereRadius);
+		}
+		glBindVertexArray(VertexArray(shader, position, color, texcoord));
+		glDrawArrays(GL_POINTS, 0, numVertices);
+		glBindVertexArray(0);
+	}
 
+	// the quad rows or columns [first, end) of patch k of n, of count quads
+	static void PatchRange(int k, int n, int count, int &first, int &end)
+	{
+		first = int((long long)k * count / n);
+		end = int((long long)(k + 1) * count / n);
+	}
 
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
+	// the direction from the center of the point at quad row r and column s, fractional, as AddSphere places it
+	Vector3f SphereDirection(float r, float s) const
+	{
+		float theta = 2 * float(M_PI) * s / (sphereSlices - 1), phi = float(M_PI) * r / (sphereRings - 1);
+		return Vector3f(cosf(theta) * sinf(phi), -cosf(phi), sinf(theta) * sinf(phi));
+	}
 
-		GLuint posLoc = glGetAttribLocation(shader_black, "Position");
-		GLuint colorLoc = glGetAttribLocation(shader_black, "Color");
-		GLuint uvLoc = glGetAttribLocation(shader_black, "TexCoord");
+	// the cones of the patches from a grid of 9 x 9 of their points, a degree wider for the points in between
+	void CullCones()
+	{
+		int rows = sphereRings - 1, cols = sphereSlices - 1;
+		cullAxes.assign(cullBands * cullColumns, Vector3f(0, 0, 0));
+		cullAngles.assign(cullBands * cullColumns, 0.0f);
+		for (int b = 0; b < cullBands; b++)
+			for (int c = 0; c < cullColumns; c++)
+			{
+				int r0, r1, s0, s1;
+				PatchRange(b, cullBands, rows, r0, r1);
+				PatchRange(c, cullColumns, cols, s0, s1);
+				Vector3f axis(0, 0, 0);
+				for (int i = 0; i <= 8; i++)
+					for (int j = 0; j <= 8; j++)
+						axis += SphereDirection(r0 + (r1 - r0) * i / 8.0f, s0 + (s1 - s0) * j / 8.0f);
+				axis.Normalize();
+				float angle = 0;
+				for (int i = 0; i <= 8; i++)
+					for (int j = 0; j <= 8; j++)
+					{
+						float d = axis.Dot(SphereDirection(r0 + (r1 - r0) * i / 8.0f, s0 + (s1 - s0) * j / 8.0f));
+						angle = (std::max)(angle, acosf((std::min)(1.0f, (std::max)(-1.0f, d))));
+					}
+				cullAxes[b * cullColumns + c] = axis;
+				cullAngles[b * cullColumns + c] = angle + float(M_PI) / 180;
+			}
+	}
 
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
+	// the meshes of the passes culled as this one, at its place and with its settings of the culling
+	void CullPasses(const Matrix4f *view, const Matrix4f *proj, int views)
+	{
+		for (int pass = 0; pass < 3; pass++)
+			if (Model *m = passModels[pass])
+			{
+				m->Pos = Pos;
+				m->Rot = Rot;
+				m->culling = culling;
+				m->alphaCulling = alphaCulling;
+				m->cullNear = cullNear;
+				m->lodAngle = lodAngle;
+				m->Cull(view, proj, views);
+				m->LodSplit(view, views);
+			}
+	}
 
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
+	// the patches seen parted by the cone of lodAngle around the mean direction of the views, see lodAngle: the
+	// inner ones are those whose own cone reaches into it
+	void LodSplit(const Matrix4f *view, int views)
+	{
+		lodSplit = false;
+		if (lodAngle <= 0 || sphereMode == SphereTessellated || sphereRings < 2 || sphereSlices < 2)
+			return;
+		if (cullAxes.empty())
+			CullCones();
+		Matrix4f local = GetMatrix().Inverted();
+		Vector3f forward(0, 0, 0);
+		for (int v = 0; v < views; v++)
+		{
+			Matrix4f camera = local * view[v].Inverted();
+			forward += (camera.Transform(Vector3f(0, 0, -1)) - camera.Transform(Vector3f(0, 0, 0))).Normalized();
+		}
+		forward.Normalize();
+		for (int part = 0; part < 2; part++)
+			lodSeen[part].assign(cullBands * cullColumns, 0);
+		for (int i = 0; i < cullBands * cullColumns; i++)
+		{
+			if (!cullAll && !cullSeen[i])
+				continue;
+			float d = cullAxes[i].Dot(forward);
+			bool inner = acosf((std::min)(1.0f, (std::max)(-1.0f, d))) <= cullAngles[i] + lodAngle;
+			lodSeen[inner ? 0 : 1][i] = 1;
+		}
+		for (int part = 0; part < 2; part++)
+			PatchLists(lodSeen[part], lodFirsts[part], lodCounts[part], lodOffsets[part], lodBases[part]);
+		lodSplit = true;
+	}
 
+	// the patches within the frusta of the views, widened by the turn of the directions seen off the center: the
+	// patches themselves for the patch-local mesh, else ranges of the quads of every row of quads they cover, the
+	// contiguous ones joined
+	void Cull(const Matrix4f *view, const Matrix4f *proj, int views)
+	{
+		cullAll = true;
+		if (!culling || sphereMode == SphereTessellated || sphereRings < 2 || sphereSlices < 2)
+			return;
+		if (cullAxes.empty())
+			CullCones();
+		Matrix4f local = GetMatrix().Inverted();
+		Vector3f forward[2];
+		float limit[2];
+		for (int v = 0; v < views; v++)
+		{
+			Matrix4f camera = local * view[v].Inverted();
+			Vector3f eye = camera.Transform(Vector3f(0, 0, 0));
+			forward[v] = (camera.Transform(Vector3f(0, 0, -1)) - eye).Normalized();
+			float offset = eye.Length();
+			if (offset >= cullNear)
+				return;
+			float tanX = (1 + fabsf(proj[v].M[0][2])) / proj[v].M[0][0], tanY = (1 + fabsf(proj[v].M[1][2])) / proj[v].M[1][1];
+			limit[v] = atanf(sqrtf(tanX * tanX + tanY * tanY)) + asinf(offset / cullNear);
+		}
+		cullSeen.assign(cullBands * cullColumns, 0);
+		for (int i = 0; i < cullBands * cullColumns; i++)
+			for (int v = 0; v < views && !cullSeen[i]; v++)
+			{
+				float d = cullAxes[i].Dot(forward[v]);
+				cullSeen[i] = acosf((std::min)(1.0f, (std::max)(-1.0f, d))) <= cullAngles[i] + limit[v];
+			}
+		PatchLists(cullSeen, cullFirsts, cullCounts, cullOffsets, cullBases);
+		cullAll = false;
+	}
 
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
-		//glDrawElements(GL_POINTS, numIndices, GL_UNSIGNED_SHORT, NULL);
+	// the draws of the patches seen, one per band and column: the patches themselves for the patch-local mesh, else
+	// ranges of the quads of every row of quads they cover, the contiguous ones joined
+	void PatchLists(const std::vector<char> &seen, std::vector<GLint> &firsts, std::vector<GLsizei> &counts,
+		std::vector<const void*> &offsets, std::vector<GLint> &bases) const
+	{
+		firsts.clear();
+		counts.clear();
+		offsets.clear();
+		bases.clear();
+		int rows = sphereRings - 1, cols = sphereSlices - 1;
+		for (int b = 0; b < cullBands; b++)
+		{
+			const char *band = &seen[b * cullColumns];
+			if (patchLocal)
+			{
+				for (int c = 0; c < cullColumns; c++)
+					if (band[c] && patchCounts[b * cullColumns + c] > 0)
+					{
+						counts.push_back(patchCounts[b * cullColumns + c]);
+						offsets.push_back(patchOffsets[b * cullColumns + c]);
+						bases.push_back(patchBases[b * cullColumns + c]);
+					}
+				continue;
+			}
+			int r0, r1;
+			PatchRange(b, cullBands, rows, r0, r1);
+			for (int r = r0; r < r1; r++)
+				for (int c = 0; c < cullColumns; c++)
+				{
+					if (!band[c] || (c > 0 && band[c - 1]))
+						continue;
+					int end = c;
+					while (end < cullColumns && band[end])
+						end++;
+					int s0, s1, t0, t1;
+					PatchRange(c, cullColumns, cols, s0, t0);
+					PatchRange(end - 1, cullColumns, cols, t1, s1);
+					GLint first = (r * cols + s0) * 6;
+					GLsizei count = (s1 - s0) * 6;
+					if (!firsts.empty() && firsts.back() + counts.back() == first)
+						counts.back() += count;
+					else
+					{
+						firsts.push_back(first);
+						counts.push_back(count);
+					}
+				}
+		}
+		for (size_t i = 0; i < firsts.size() && !patchLocal; i++)
+			offsets.push_back((const void*)(firsts[i] * sizeof(GLuint)));
+	}
 
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
+	// the draws of the patches of seen, all of them for nullptr, over the occupied cells of alpha into the alpha
+	// lists, false to draw those of seen. A patch covers the texels of V from 1 - r1 / rows to 1 - r0 / rows of its quad rows, from the top,
+	// and of U from s0 / cols to s1 / cols
+	bool AlphaLists(const AlphaOccupancy *alpha, const std::vector<char> *seen)
+	{
+		if (!alpha || !alphaCulling || sphereMode == SphereTessellated || sphereRings < 2 || sphereSlices < 2)
+			return false;
+		int rows = sphereRings - 1, cols = sphereSlices - 1;
+		alphaSeen.assign(cullBands * cullColumns, 0);
+		bool skipped = false;
+		for (int b = 0; b < cullBands; b++)
+		{
+			int r0, r1;
+			PatchRange(b, cullBands, rows, r0, r1);
+			int cellTop = int((long long)(rows - r1) * AlphaOccupancy::rows / rows);
+			int cellBottom = int(((long long)(rows - r0) * AlphaOccupancy::rows + rows - 1) / rows);
+			for (int c = 0; c < cullColumns; c++)
+			{
+				int i = b * cullColumns + c, s0, s1;
+				if (seen && !(*seen)[i])
+					continue;
+				PatchRange(c, cullColumns, cols, s0, s1);
+				int cellLeft = int((long long)s0 * AlphaOccupancy::cols / cols);
+				int cellRight = int(((long long)s1 * AlphaOccupancy::cols + cols - 1) / cols);
+				alphaSeen[i] = alpha->Any(cellTop, (std::max)(cellBottom, cellTop + 1), cellLeft, (std::max)(cellRight, cellLeft + 1));
+				skipped = skipped || !alphaSeen[i];
+			}
+		}
+		if (!seen && !skipped)
+			return false;
+		PatchLists(alphaSeen, alphaFirsts, alphaCounts, alphaOffsets, alphaBases);
+		return true;
+	}
 
+	// the vertex array of the buffers with the attributes of a shader, made at the first draw with it
+	GLuint VertexArray(const Shader* shader, const char* position, const char* color, const char* texcoord)
+	{
+		GLuint &vertexArray = vertexArrays[shader];
+		if (vertexArray)
+			return vertexArray;
+		glGenVertexArrays(1, &vertexArray);
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
+		if (shader == bakedShader)
+		{
+			GLsizei stride = 0;
+			for (size_t i = 0; i < bakedSizes.size(); i++)
+				stride += bakedSizes[i] * GLsizei(sizeof(float));
+			glBindBuffer(GL_ARRAY_BUFFER, bakedBuffer);
+			size_t offset = 0;
+			for (size_t i = 0; i < bakedSizes.size(); i++)
+			{
+				VertexAttrib(shader->Attrib("bakedOutput" + std::to_string(i)), bakedSizes[i], GL_FLOAT, GL_FALSE, stride, offset);
+				offset += bakedSizes[i] * sizeof(float);
+			}
+		}
+		else if (sphereMode == SphereCompact)
+			VertexAttrib(shader->Attrib("sphereTexCoord"), 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), OVR_OFFSETOF(CompactVertex, U));
+		else
+		{
+			VertexAttrib(shader->Attrib(position), 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), OVR_OFFSETOF(Vertex, Pos));
+			VertexAttrib(shader->Attrib(color), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), OVR_OFFSETOF(Vertex, C));
+			VertexAttrib(shader->Attrib(texcoord), 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), OVR_OFFSETOF(Vertex, U));
+		}
+		glBindVertexArray(0);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-		glUseProgram(0);
+		return vertexArray;
+	}
 
+	// the inputs the shader doesn't use have no location
+	static void VertexAttrib(GLint location, GLint size, GLenum type, GLboolean normalized, GLsizei stride, size_t offset)
+	{
+		if (location < 0)
+			return;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, size, type, normalized, stride, (void*)offset);
+	}
 
-	};
+	// the three layers in one draw by the composite program, Shaders[5], that samples the colors, depths and
+	// alphas of all of them and blends the moving layer over the foreground over the background itself, and
+	// the fade of the comfort radius of the block
+	void RenderComposite(bool poly_mesh, Shader * Shaders[10])
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, poly_mesh ? GL_LINE : GL_FILL);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		Shader * shader_layers = Shaders[5];
+		glUseProgram(shader_layers->program);
+		Draw(shader_layers, "Position", "Color", "TexCoord");
+		glUseProgram(0);
+	}
 
-	void RenderSimple(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat, ARGS args, Shader * Shaders[10])
+	void RenderBlack(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, double ablack, float radius, bool isblack, Shader * Shaders[10])
 	{
-		Matrix4f combined = proj * view * GetMatrix();
-		Matrix4f mtw = GetMatrix();
 
 		if (poly_mesh == true)
 		{
@@ -860,54 +3264,53 @@ struct Model
 
 		glDisable(GL_CULL_FACE);
 		glDisable(GL_BLEND);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		//glDisable(GL_DEPTH_TEST);
-		GLuint shader_simple = Shaders[3]->program;
-		glUseProgram(shader_simple);
+		Shader * shader_black = Shaders[4];
+		glUseProgram(shader_black->program);
+
+		float black = isblack ? 1.0f : 0.0f;
+		glUniform1f(shader_black->Uniform("black"), (float)black);
+		glUniform1f(shader_black->Uniform("radius"), (float)radius);
+		glUniform1f(shader_black->Uniform("alpha"), (float)ablack);
 
-		glUniformMatrix4fv(glGetUniformLocation(shader_simple, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
-		glUniform1f(glGetUniformLocation(shader_simple, "desat"), (float)desat);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-		glUniform1i(glGetUniformLocation(shader_simple, "depthbg"), 5);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_left);
-		glUniform1i(glGetUniformLocation(shader_simple, "bgtext"), 4);
 
+		Draw(shader_black, "Position", "Color", "TexCoord");
 
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
+		glUseProgram(0);
 
-		GLuint posLoc = glGetAttribLocation(shader_simple, "Position");
-		GLuint colorLoc = glGetAttribLocation(shader_simple, "Color");
-		GLuint uvLoc = glGetAttribLocation(shader_simple, "TexCoord");
 
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
+	};
+
+	void RenderSimple(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat, Shader * Shaders[10])
+	{
 
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
+		if (poly_mesh == true)
+		{
+			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		}
+		else
+		{
+			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		}
 
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		//glDisable(GL_DEPTH_TEST);
+		Shader * shader_simple = Shaders[3];
+		glUseProgram(shader_simple->program);
 
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
-		//glDrawElements(GL_POINTS, numIndices, GL_UNSIGNED_SHORT, NULL);
 
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		Draw(shader_simple, "Position", "Color", "TexCoord");
 
 		glUseProgram(0);
 
 	};
 
-    void Render(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat, ARGS args, Shader * Shaders[10])
+    void Render(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat, Shader * Shaders[10])
     {
-        Matrix4f combined = proj * view * GetMatrix();
-		Matrix4f mtw = GetMatrix();
 
 		if (poly_mesh == true)
 		{
@@ -921,54 +3324,37 @@ struct Model
 		glDisable(GL_CULL_FACE);
 		glDisable(GL_BLEND);	
 		//glDisable(GL_DEPTH_TEST);
-		GLuint posLoc;
-		GLuint colorLoc;
-		GLuint uvLoc;
 		/////////////////////////////////////////////////////////////////////////////////////
-		
-		GLuint shader_bg = Shaders[0]->program;
-		glUseProgram(shader_bg);
-		glUniformMatrix4fv(glGetUniformLocation(shader_bg, "matWVP"), 1, GL_TRUE, (FLOAT*)&combined);
-		float vOut = colored ? 1.0f : 0.0f;
-		glUniform1fv(glGetUniformLocation(shader_bg, "colored"), 1, (FLOAT*)&vOut);
-		glUniform1f(glGetUniformLocation(shader_bg, "desat"), (float)desat);
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_bbgd);
-		glUniform1i(glGetUniformLocation(shader_bg, "depthbg"), 1);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_bbg);
-		glUniform1i(glGetUniformLocation(shader_bg, "bgtext"), 3);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-		glUniform1i(glGetUniformLocation(shader_bg, "depthfront"), 5);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, *args.mFront_bgd);
-		glUniform1i(glGetUniformLocation(shader_bg, "depthfg"), 1);
-
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
 
-		posLoc = glGetAttribLocation(shader_bg, "Position");
-		colorLoc = glGetAttribLocation(shader_bg, "Color");
-		uvLoc = glGetAttribLocation(shader_bg, "TexCoord");
-
-		glEnableVertexAttribArray(posLoc);
-		glEnableVertexAttribArray(colorLoc);
-		glEnableVertexAttribArray(uvLoc);
+		// the layers within the cone of LodSplit only, the video alone beyond it as RenderSimple draws it
+		int part = 0;
+		if (lodSplit && layers >= 2.0f) {
+			part = 1;
+			Shader * shader_simple = Shaders[3];
+			glUseProgram(shader_simple->program);
+			Draw(shader_simple, "Position", "Color", "TexCoord", nullptr, 2);
+			glUseProgram(0);
+		}
+		
+		// the fragments of alpha 1 of the foreground, blended they would replace the background all the same; they
+		// write the depth the background is tested against, and the blended pass has the others only
+		Shader * shader_fg = Shaders[1];
+		GLint alphaPass = shader_fg->Uniform("layerAlphaPass");
+		bool opaqueFirst = earlyZ && layers >= 2.0f && alphaPass >= 0;
+		if (opaqueFirst) {
+			glUseProgram(shader_fg->program);
+			glUniform1i(alphaPass, 1);
+			PassModel(1)->Draw(shader_fg, "Position2", "Color2", "TexCoord2", layerAlpha, part);
+			glUseProgram(0);
+		}
 
-		glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-		glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-		glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
+		// the mesh of the background baked for the clip, or displaced by its vertex shader
+		Model * bg = PassModel(0);
+		const Shader * shader_bg = bg->bakedShader ? bg->bakedShader : Shaders[0];
+		glUseProgram(shader_bg->program);
 
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
 
-		glDisableVertexAttribArray(posLoc);
-		glDisableVertexAttribArray(colorLoc);
-		glDisableVertexAttribArray(uvLoc);
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		bg->Draw(shader_bg, "Position", "Color", "TexCoord", nullptr, part);
 
 		glUseProgram(0);
 		
@@ -978,114 +3364,27 @@ struct Model
 			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 
-			GLuint shader_fg = Shaders[1]->program;
-			glUseProgram(shader_fg);
-
-			glUniformMatrix4fv(glGetUniformLocation(shader_fg, "matWVP2"), 1, GL_TRUE, (FLOAT*)&combined);
-			float vOut = colored ? 1.0f : 0.0f;
-			glUniform1fv(glGetUniformLocation(shader_fg, "colored"), 1, (FLOAT*)&vOut);
-			glUniform1f(glGetUniformLocation(shader_fg, "desat"), (float)desat);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_bgd);
-			glUniform1i(glGetUniformLocation(shader_fg, "fgdepth"), 1);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_bgd);
-			glUniform1i(glGetUniformLocation(shader_fg, "Fragfgdepth"), 1);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_bg);
-			glUniform1i(glGetUniformLocation(shader_fg, "fgtext"), 0);
-			glActiveTexture(GL_TEXTURE7);
-			glBindTexture(GL_TEXTURE_2D, *args.bga_text);
-			glUniform1i(glGetUniformLocation(shader_fg, "alphamask"), 7);
-			glActiveTexture(GL_TEXTURE5);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-			glUniform1i(glGetUniformLocation(shader_fg, "frontdepth"), 5);
-
-			glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
-
-			posLoc = glGetAttribLocation(shader_fg, "Position2");
-			colorLoc = glGetAttribLocation(shader_fg, "Color2");
-			uvLoc = glGetAttribLocation(shader_fg, "TexCoord2");
-
-			glEnableVertexAttribArray(posLoc);
-			glEnableVertexAttribArray(colorLoc);
-			glEnableVertexAttribArray(uvLoc);
-
-			glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-			glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-			glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
-
-
-			glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
+			glUseProgram(shader_fg->program);
+			if (alphaPass >= 0)
+				glUniform1i(alphaPass, opaqueFirst ? 2 : 0);
 
-			glDisableVertexAttribArray(posLoc);
-			glDisableVertexAttribArray(colorLoc);
-			glDisableVertexAttribArray(uvLoc);
 
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			PassModel(1)->Draw(shader_fg, "Position2", "Color2", "TexCoord2", layerAlpha, part);
 
 			glUseProgram(0);
 		}
 		
 		/////////////////////////////////////////////////////////////////////////////////////
 		if (layers >= 3.0f) {
-			GLuint shader_mov = Shaders[2]->program;
-			glUseProgram(shader_mov);
-
-			glUniformMatrix4fv(glGetUniformLocation(shader_mov, "matWVP2"), 1, GL_TRUE, (FLOAT*)&combined);
-			glUniformMatrix4fv(glGetUniformLocation(shader_mov, "matW2"), 1, GL_TRUE, (FLOAT*)&mtw);
-			glUniformMatrix4fv(glGetUniformLocation(shader_mov, "ViewDir2"), 1, GL_TRUE, (FLOAT*)&view);
-			glUniform3fv(glGetUniformLocation(shader_mov, "SphCenter2"), 1, (FLOAT*)&spherecenter);
-			glUniform3fv(glGetUniformLocation(shader_mov, "spherecenter"), 1, (FLOAT*)&spherecenter);
-			glUniform3fv(glGetUniformLocation(shader_mov, "eyepos"), 1, (FLOAT*)&EyePos);
-			glUniform3fv(glGetUniformLocation(shader_mov, "headposition"), 1, (FLOAT*)&HeadPos);
-			float vOut = colored ? 1.0f : 0.0f;
-			glUniform1fv(glGetUniformLocation(shader_mov, "colored"), 1, (FLOAT*)&vOut);
-			glUniform1f(glGetUniformLocation(shader_mov, "desat"), (float)desat);
-
-
-			glActiveTexture(GL_TEXTURE5);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-			glUniform1i(glGetUniformLocation(shader_mov, "fgdepth"), 5);
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_left);
-			glUniform1i(glGetUniformLocation(shader_mov, "fgtext"), 4);
-			glActiveTexture(GL_TEXTURE7);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_aleft);
-			glUniform1i(glGetUniformLocation(shader_mov, "alphamask"), 7);
-			glActiveTexture(GL_TEXTURE6);
-			glBindTexture(GL_TEXTURE_2D, *args.mFront_dleft);
-			glUniform1i(glGetUniformLocation(shader_mov, "Fragfgdepth"), 6);
-
+			Shader * shader_mov = Shaders[2];
+			glUseProgram(shader_mov->program);
 
 
-			glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer->buffer);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->buffer);
 
-			posLoc = glGetAttribLocation(shader_mov, "Position2");
-			colorLoc = glGetAttribLocation(shader_mov, "Color2");
-			uvLoc = glGetAttribLocation(shader_mov, "TexCoord2");
 
-			glEnableVertexAttribArray(posLoc);
-			glEnableVertexAttribArray(colorLoc);
-			glEnableVertexAttribArray(uvLoc);
 
-			glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, Pos));
-			glVertexAttribPointer(colorLoc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, C));
-			glVertexAttribPointer(uvLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)OVR_OFFSETOF(Vertex, U));
 
-
-			glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, NULL);
-			//glDrawElements(GL_POINTS, numIndices, GL_UNSIGNED_SHORT, NULL);
-
-			glDisableVertexAttribArray(posLoc);
-			glDisableVertexAttribArray(colorLoc);
-			glDisableVertexAttribArray(uvLoc);
-
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			PassModel(2)->Draw(shader_mov, "Position2", "Color2", "TexCoord2", videoAlpha, part);
 
 			glUseProgram(0);
 		}
@@ -1106,6 +3405,42 @@ struct Scene
     Model * Models[10];
 	int numShaders;
 	Shader * Shaders[10];
+	// the program of the ray marching and its empty vertex array, nullptr unless the layers are marched
+	Shader * marchShader;
+	GLuint marchArray;
+	float marchNear, marchFar, marchEdge;
+	int marchSteps;
+	// the pyramid of the video depth of the frame is bound
+	bool pyramidBound;
+	// the program of the multi-sphere image and its empty vertex array, nullptr unless the layers are spheres
+	Shader * msiShader;
+	GLuint msiArray;
+	int msiLayers, msiColumns, msiRings, msiSlices;
+	float msiNear, msiFar;
+	// the levels of the grade of the color layers, 256x1, on UnitGrade; 0 until SetGrade
+	GLuint gradeTexture;
+	GLuint frameBuffer;
+	FrameBlock frame;
+	float fade[3];
+	// the color video top-bottom stereo, and the eye of the pass of one view
+	bool stereoColor;
+	int colorView;
+	// the programs of the background baked, see InitBakedBackground, nullptr unless it is; the clip of the layers
+	// baked, 0 for none
+	Shader * bakeShader;
+	Shader * bakedShader;
+	int bakedClip;
+	// the gallery of the clips, see InitGallery, nullptr unless there is one: the places of its previews, an
+	// instance each, and their layers of galleryPreviews; the preview of galleryFocus is the one looked at, -1 for
+	// none, and the gallery is drawn instead of the layers while galleryShown
+	Shader * galleryShader;
+	GLuint galleryArray, galleryInstances, galleryPreviews;
+	int galleryCount, galleryFocus;
+	bool galleryShown;
+	// the size of the previews, and whether they are in the video memory at it, see GalleryResident
+	Sizei gallerySize;
+	bool galleryResident;
+	std::vector<Vector4f> galleryPlaces;
 
     void    Add(Model * n)
     {
@@ -1117,76 +3452,663 @@ struct Scene
 		Shaders[numShaders++] = n;
 	}
 
-    void Render(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat, ARGS args)
+	// the textures of the frame on their units, the active unit left past them so that no other bind moves them
+	void BindTextures(const ARGS &args)
+	{
+		static const FrameBundle none;
+		const FrameBundle &frame = args.frame ? *args.frame : none;
+		const GLuint textures[TextureUnits] = { frame.texture[0], frame.texture[1], frame.texture[2], *args.mFront_bg,
+			*args.mFront_bgd, *args.bga_text, *args.mFront_bbg, *args.black_text, frame.edges, frame.pyramid, gradeTexture };
+		for (int unit = 0; unit < TextureUnits; unit++)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(GL_TEXTURE_2D, textures[unit]);
+		}
+		glActiveTexture(GL_TEXTURE0 + TextureUnits);
+		pyramidBound = frame.pyramid != 0;
+		for (int i = 0; i < numModels; i++)
+		{
+			Models[i]->depthPyramid = pyramidBound;
+			Models[i]->videoAlpha = args.frame ? &frame.alpha : nullptr;
+			Models[i]->layerAlpha = args.frame ? &frame.layerAlpha : nullptr;
+		}
+		// the background baked again with the layers of another clip
+		if (bakeShader && args.frame && frame.layerClip != bakedClip)
+			BakeBackground(frame.layerClip);
+	}
+
+	// the meshes of the passes of Models[0] of densities of their own, rings x slices of sizes[pass] for the
+	// background, the foreground and the video; the passes of 0 x 0, or of its own density, keep its mesh. Not for
+	// the tessellated sphere, whose density follows the screen and the depth already
+	void InitPassModels(const Vector2i sizes[3])
+	{
+		Model *m = Models[0];
+		if (m->sphereMode == SphereTessellated)
+			return;
+		for (int pass = 0; pass < 3; pass++)
+		{
+			if (sizes[pass].x < 2 || sizes[pass].y < 2 || (sizes[pass].x == m->sphereRings && sizes[pass].y == m->sphereSlices))
+				continue;
+			Model *p = new Model(m->Pos);
+			p->AddSphere(1.0, sizes[pass].x, sizes[pass].y, m->sphereMode);
+			p->AllocateBuffers();
+			m->passModels[pass] = p;
+		}
+	}
+
+	// the background displaced once per clip by the static depth of its layers, drawn as a plain mesh from then on:
+	// the vertex shader of the background with the rasterizer off, whose outputs for every vertex of the mesh of
+	// the background pass are captured into its bakedBuffer, and the program that draws them with the fragment shader of the
+	// background. The shader must be one that BakedOutputs accepts, and the sphere a mesh; false otherwise, the
+	// background then displaced by its vertex shader every frame
+	bool InitBakedBackground(bool multiview)
+	{
+		Model *m = Models[0]->PassModel(0);
+		SphereMode sphere = m->sphereMode;
+		if (sphere != SphereMesh && sphere != SphereCompact)
+			return false;
+		std::string vertex = loadShader("Resources/VertexShader-bg_simple.vs");
+		static const std::vector<std::string> layerSamplers = { "depthbg", "depthfg", "bgtext" };
+		std::vector<std::string> outputs[3];
+		if (!BakedOutputs(vertex, layerSamplers, outputs))
+			return false;
+		std::vector<std::string> feedback(1, "gl_Position");
+		feedback.insert(feedback.end(), outputs[2].begin(), outputs[2].end());
+		GLenum bakeType = GL_VERTEX_SHADER;
+		std::string bakeSource = ViewerShader(vertex, true, sphere, false);
+		Shader *bake = new Shader(&bakeSource, &bakeType, 1, feedback);
+		GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		std::string sources[2] = { BakedBackgroundShader(outputs, multiview),
+			ViewerShader(loadShader("Resources/FragmentShader-bg_simple.fs"), false, sphere, multiview, false, false, nullptr, { "bgtext" }) };
+		Shader *baked = new Shader(sources, types, 2);
+		bake->Finish();
+		baked->Finish();
+		if (!bake->linked || !baked->linked)
+		{
+			glDeleteProgram(bake->program);
+			glDeleteProgram(baked->program);
+			delete bake;
+			delete baked;
+			return false;
+		}
+		// the samplers of the background as Init sets them for Shaders[0]
+		static const struct { const char *name; TextureUnit unit; } samplers[] = { { "depthbg", UnitBgDepth }, { "bgtext", UnitBbg },
+			{ "depthfront", UnitDepthLeft }, { "depthfg", UnitBgDepth }, { "viewerGradeLUT", UnitGrade } };
+		for (Shader *s : { bake, baked })
+		{
+			glUseProgram(s->program);
+			for (const auto &sampler : samplers)
+				glUniform1i(s->Uniform(sampler.name), sampler.unit);
+		}
+		glUseProgram(0);
+		bakeShader = bake;
+		bakedShader = baked;
+		m->bakedSizes.assign(1, 4);
+		for (const std::string &type : outputs[1])
+			m->bakedSizes.push_back(type == "float" ? 1 : type[3] - '0');
+		return true;
+	}
+
+	// the outputs of the vertex shader of the background for the layers of clip, bound, into the bakedBuffer of
+	// the background pass: its vertices drawn as points with frameWVP[0] the identity meanwhile, so that gl_Position is the
+	// point displaced in the coordinates of the sphere itself
+	void BakeBackground(int clip)
+	{
+		Model *m = Models[0]->PassModel(0);
+		GLsizeiptr stride = 0;
+		for (size_t i = 0; i < m->bakedSizes.size(); i++)
+			stride += m->bakedSizes[i] * sizeof(float);
+		if (!m->bakedBuffer)
+			glGenBuffers(1, &m->bakedBuffer);
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, m->bakedBuffer);
+		glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, stride * m->numVertices, NULL, GL_STATIC_COPY);
+		gpuResidency.Buffer(m->bakedBuffer, GpuResidency::PoolMeshes, (long long)stride * m->numVertices);
+		blockFunctions.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m->bakedBuffer);
+		FrameBlock sphere = frame;
+		sphere.wvp[0] = Matrix4f();
+		glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(sphere), &sphere);
+		glEnable(GL_RASTERIZER_DISCARD);
+		glUseProgram(bakeShader->program);
+		glBeginTransformFeedback(GL_POINTS);
+		m->DrawPoints(bakeShader, "Position", "Color", "TexCoord");
+		glEndTransformFeedback();
+		glUseProgram(0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		blockFunctions.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		m->bakedShader = bakedShader;
+		bakedClip = clip;
+	}
+
+	// whether Render draws the layers in the one composite pass
+	bool IsComposite(double layers) const
+	{
+		return layers >= 3.0f && numShaders > 5;
+	}
+
+	// the fade of the comfort radius in the composite pass, 0 for none
+	void SetFade(float alpha, float radius, float blackRadius)
+	{
+		fade[0] = alpha;
+		fade[1] = radius;
+		fade[2] = blackRadius;
+	}
+
+	// the eye drawn by the next passes of one view, for its half of a stereo color video
+	void SetColorView(int eye)
+	{
+		colorView = eye;
+	}
+
+	// the block of the frame for a model, uploaded when it differs from the last one
+	void UploadFrame(Model * m, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool colored, float desat)
+	{
+		m->Cull(view, proj, views);
+		m->LodSplit(view, views);
+		m->CullPasses(view, proj, views);
+		FrameBlock next;
+		memset(&next, 0, sizeof(next));
+		for (int v = 0; v < views; v++)
+		{
+			next.wvp[v] = proj[v] * view[v] * m->GetMatrix();
+			next.view[v] = view[v];
+			next.eye[v][0] = EyePos[v].x;
+			next.eye[v][1] = EyePos[v].y;
+			next.eye[v][2] = EyePos[v].z;
+		}
+		next.world = m->GetMatrix();
+		next.center[0] = spherecenter.x;
+		next.center[1] = spherecenter.y;
+		next.center[2] = spherecenter.z;
+		next.head[0] = HeadPos.x;
+		next.head[1] = HeadPos.y;
+		next.head[2] = HeadPos.z;
+		next.colored = colored ? 1.0f : 0.0f;
+		next.desat = desat;
+		next.fade = fade[0];
+		next.fadeRadius = fade[1];
+		next.blackRadius = fade[2];
+		next.colorRows[0] = stereoColor ? 0.5f : 1.0f;
+		next.colorRows[1] = stereoColor && views == 1 ? 0.5f * colorView : 0.0f;
+		next.colorRows[2] = stereoColor ? 0.5f : 0.0f;
+		if (memcmp(&next, &frame, sizeof(frame)) == 0)
+			return;
+		frame = next;
+		glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+    void Render(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat)
     {
+        if (msiShader)
+        {
+            UploadFrame(Models[0], spherecenter, EyePos, HeadPos, view, proj, views, colored, desat);
+            RenderMultiSphere();
+            return;
+        }
+        if (marchShader)
+        {
+            UploadFrame(Models[0], spherecenter, EyePos, HeadPos, view, proj, views, colored, desat);
+            RenderMarch();
+            return;
+        }
         for (int i = 0; i < numModels; ++i)
-            Models[i]->Render(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, desat, args, Shaders);
+        {
+            UploadFrame(Models[i], spherecenter, EyePos, HeadPos, view, proj, views, colored, desat);
+            if (IsComposite(layers))
+                Models[i]->RenderComposite(poly_mesh, Shaders);
+            else
+                Models[i]->Render(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, views, poly_mesh, stereo, render_depth, colored, layers, desat, Shaders);
+        }
     }
-	void RenderBlack(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, double ablack, float radius, bool isblack, ARGS args)
+	void RenderBlack(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, double ablack, float radius, bool isblack)
 	{
 		for (int i = 0; i < numModels; ++i)
-			Models[i]->RenderBlack(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, ablack, radius, isblack, args, Shaders);
+		{
+			UploadFrame(Models[i], spherecenter, EyePos, HeadPos, view, proj, views, false, 0.0f);
+			Models[i]->RenderBlack(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, views, poly_mesh, stereo, render_depth, colored, layers, ablack, radius, isblack, Shaders);
+		}
 	}
-	void RenderSimple(Vector2f ScreenSize, Vector3f spherecenter, Vector3f EyePos, Vector3f HeadPos, Matrix4f view, Matrix4f proj, int eye, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat,ARGS args)
+	void RenderSimple(Vector2f ScreenSize, Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views, bool poly_mesh, bool stereo, bool render_depth, bool colored, double layers, float desat)
 	{
 		for (int i = 0; i < numModels; ++i)
-			Models[i]->RenderSimple(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, desat, args, Shaders);
+		{
+			UploadFrame(Models[i], spherecenter, EyePos, HeadPos, view, proj, views, false, desat);
+			Models[i]->RenderSimple(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, views, poly_mesh, stereo, render_depth, colored, layers, desat, Shaders);
+		}
+	}
+
+	// the grade of the color layers, the background and the foreground: every channel of their texels to the power
+	// of gamma. The shaders look it up, so it changes while they play
+	void SetGrade(float gamma)
+	{
+		unsigned char levels[256];
+		for (int i = 0; i < 256; i++)
+			levels[i] = (unsigned char)(pow(i / 255.0, gamma) * 255.0);
+		if (!gradeTexture)
+		{
+			glGenTextures(1, &gradeTexture);
+			glBindTexture(GL_TEXTURE_2D, gradeTexture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		else
+			glBindTexture(GL_TEXTURE_2D, gradeTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 256, 1, 0, GL_RED, GL_UNSIGNED_BYTE, levels);
+		gpuResidency.Texture(gradeTexture, GpuResidency::PoolOther, 256);
+		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
-    void Init(int includeIntensiveGPUobject, Vector3f HeadPos, Vector2i SphereSize)
+	// the program of the ray marching, false if it does not link; its layers are marched from then on in Render,
+	// within the shell of near to far of the sphere of Models[0]
+	bool InitRayMarch(bool multiview, int steps, float near, float far)
+	{
+		GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		std::string sources[2] = { RayMarchShader(true, multiview), RayMarchShader(false, multiview) };
+		Shader *s = new Shader(sources, types, 2);
+		s->Finish();
+		if (!s->linked)
+		{
+			glDeleteProgram(s->program);
+			delete s;
+			return false;
+		}
+		static const struct { const char *name; TextureUnit unit; } samplers[] = { { "movtext", UnitLeft }, { "movdepth", UnitDepthLeft },
+			{ "movalpha", UnitAlphaLeft }, { "bgtext", UnitBbg }, { "bgdepth", UnitBgDepth }, { "depthPyramid", UnitPyramid },
+			{ "viewerGradeLUT", UnitGrade } };
+		glUseProgram(s->program);
+		for (const auto &sampler : samplers)
+			glUniform1i(s->Uniform(sampler.name), sampler.unit);
+		glUseProgram(0);
+		glGenVertexArrays(1, &marchArray);
+		marchShader = s;
+		marchSteps = steps;
+		marchNear = near;
+		marchFar = far;
+		marchEdge = 0.1f * (far - near);
+		return true;
+	}
+
+	void RenderMarch()
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		glUseProgram(marchShader->program);
+		glUniform1f(marchShader->Uniform("marchNear"), marchNear);
+		glUniform1f(marchShader->Uniform("marchFar"), marchFar);
+		glUniform1f(marchShader->Uniform("marchEdge"), marchEdge);
+		glUniform1i(marchShader->Uniform("marchSteps"), marchSteps);
+		glUniform1i(marchShader->Uniform("marchPyramid"), pyramidBound);
+		glBindVertexArray(marchArray);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
+	// the program of the multi-sphere image of layers in the atlas of the color video of columns tiles per row,
+	// false if it does not link; its spheres are drawn from then on in Render, within near to far of Models[0]
+	bool InitMultiSphere(bool multiview, int layers, int columns, float near, float far)
+	{
+		GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		std::string sources[2] = { MultiSphereShader(true, multiview), MultiSphereShader(false, multiview) };
+		Shader *s = new Shader(sources, types, 2);
+		s->Finish();
+		if (!s->linked)
+		{
+			glDeleteProgram(s->program);
+			delete s;
+			return false;
+		}
+		glUseProgram(s->program);
+		glUniform1i(s->Uniform("msiAtlas"), UnitLeft);
+		glUseProgram(0);
+		glGenVertexArrays(1, &msiArray);
+		msiShader = s;
+		msiLayers = layers;
+		msiColumns = columns;
+		// the spheres are of a constant depth, their quads only follow the curvature
+		msiRings = 64;
+		msiSlices = 128;
+		msiNear = near;
+		msiFar = far;
+		return true;
+	}
+
+	// the gallery of count previews of size, in rows of at most 8 on an arc at 1.2 m of the center of the sphere
+	// and 20 degrees apart, the middle row at the height of the center; false if its program does not link. The
+	// array of the previews is black until UploadPreview
+	bool InitGallery(bool multiview, int count, Sizei size)
+	{
+		GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		std::string sources[2] = { GalleryShader(true, multiview), GalleryShader(false, multiview) };
+		Shader *s = new Shader(sources, types, 2);
+		s->Finish();
+		if (!s->linked)
+		{
+			glDeleteProgram(s->program);
+			delete s;
+			return false;
+		}
+		glUseProgram(s->program);
+		glUniform1i(s->Uniform("galleryPreviews"), UnitGallery);
+		glUseProgram(0);
+
+		const int columns = (std::min)(count, 8);
+		const int rows = (count + columns - 1) / columns;
+		const float distance = 1.2f, step = 20.0f * float(M_PI) / 180, spacing = 0.3f;
+		std::vector<float> instances;
+		galleryPlaces.clear();
+		for (int k = 0; k < count; k++)
+		{
+			int row = k / columns, column = k - row * columns, inRow = (std::min)(columns, count - row * columns);
+			float azimuth = (column - 0.5f * (inRow - 1)) * step;
+			Vector4f place(distance * sinf(azimuth), (0.5f * (rows - 1) - row) * spacing, -distance * cosf(azimuth), azimuth);
+			galleryPlaces.push_back(place);
+			float instance[5] = { place.x, place.y, place.z, place.w, float(k) };
+			instances.insert(instances.end(), instance, instance + 5);
+		}
+		glGenBuffers(1, &galleryInstances);
+		glBindBuffer(GL_ARRAY_BUFFER, galleryInstances);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), &instances[0], GL_STATIC_DRAW);
+		gpuResidency.Buffer(galleryInstances, GpuResidency::PoolGallery, instances.size() * sizeof(float));
+		glGenVertexArrays(1, &galleryArray);
+		glBindVertexArray(galleryArray);
+		GLint place = s->Attrib("galleryPlace"), layer = s->Attrib("galleryLayer");
+		if (place >= 0)
+		{
+			glEnableVertexAttribArray(place);
+			glVertexAttribPointer(place, 4, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+			glVertexAttribDivisor(place, 1);
+		}
+		if (layer >= 0)
+		{
+			glEnableVertexAttribArray(layer);
+			glVertexAttribPointer(layer, 1, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(4 * sizeof(float)));
+			glVertexAttribDivisor(layer, 1);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// the previews are of the 8-bit BGR of the videos, as the color layers, bound to UnitGallery for good
+		glActiveTexture(GL_TEXTURE0 + UnitGallery);
+		glGenTextures(1, &galleryPreviews);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, galleryPreviews);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glActiveTexture(GL_TEXTURE0 + TextureUnits);
+
+		galleryShader = s;
+		galleryCount = count;
+		gallerySize = size;
+		galleryResident = false;
+		GalleryResident(true);
+		return true;
+	}
+
+	// the previews of the gallery in the video memory, black until their frames are uploaded again, or out of it
+	// while the gallery is hidden, a texel a preview; false if they were already
+	bool GalleryResident(bool resident)
+	{
+		if (!galleryShader || resident == galleryResident)
+			return false;
+		Sizei size = resident ? gallerySize : Sizei(1, 1);
+		std::vector<unsigned char> black(size.w * size.h * 3 * galleryCount, 0);
+		glActiveTexture(GL_TEXTURE0 + UnitGallery);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, size.w, size.h, galleryCount, 0, GL_BGR, GL_UNSIGNED_BYTE, &black[0]);
+		glActiveTexture(GL_TEXTURE0 + TextureUnits);
+		gpuResidency.Texture(galleryPreviews, GpuResidency::PoolGallery, TextureBytes(size.w, size.h, 3) * galleryCount);
+		galleryResident = resident;
+		return true;
+	}
+
+	// the frame of the preview of clip k, 8-bit BGR of the size of the array, rows of step bytes
+	void UploadPreview(int k, const unsigned char *bgr, Sizei size, size_t step)
+	{
+		glActiveTexture(GL_TEXTURE0 + UnitGallery);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, GLint(step / 3));
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, k, size.w, size.h, 1, GL_BGR, GL_UNSIGNED_BYTE, bgr);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glActiveTexture(GL_TEXTURE0 + TextureUnits);
+	}
+
+	// the preview looked at along forward from eye, in the world, within 12 degrees of it; -1 for none
+	int GalleryFocus(Vector3f eye, Vector3f forward)
+	{
+		Matrix4f world = Models[0]->GetMatrix();
+		int focus = -1;
+		float best = cosf(12.0f * float(M_PI) / 180);
+		for (int k = 0; k < int(galleryPlaces.size()); k++)
+		{
+			Vector3f to = world.Transform(Vector3f(galleryPlaces[k].x, galleryPlaces[k].y, galleryPlaces[k].z)) - eye;
+			float cosine = to.Normalized().Dot(forward.Normalized());
+			if (cosine > best)
+			{
+				best = cosine;
+				focus = k;
+			}
+		}
+		return focus;
+	}
+
+	// the previews instead of the layers, the outsides of their spheres, in one draw of the shared sphere
+	void RenderGallery(Vector3f spherecenter, const Vector3f *EyePos, Vector3f HeadPos, const Matrix4f *view, const Matrix4f *proj, int views)
+	{
+		UploadFrame(Models[0], spherecenter, EyePos, HeadPos, view, proj, views, true, 0.0f);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_BACK);
+		glEnable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		glUseProgram(galleryShader->program);
+		glUniform1i(galleryShader->Uniform("galleryRings"), 24);
+		glUniform1i(galleryShader->Uniform("gallerySlices"), 48);
+		glUniform1f(galleryShader->Uniform("galleryRadius"), 0.12f);
+		glUniform1i(galleryShader->Uniform("galleryFocus"), galleryFocus);
+		glBindVertexArray(galleryArray);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 24 * 48 * 6, galleryCount);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glDisable(GL_CULL_FACE);
+	}
+
+	// the inside of the spheres only, counterclockwise from the center as the front faces are clockwise, so that
+	// the eye out of a near sphere sees its far side through its near one
+	void RenderMultiSphere()
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glUseProgram(msiShader->program);
+		glUniform1i(msiShader->Uniform("msiLayers"), msiLayers);
+		glUniform1i(msiShader->Uniform("msiColumns"), msiColumns);
+		glUniform1i(msiShader->Uniform("msiRings"), msiRings);
+		glUniform1i(msiShader->Uniform("msiSlices"), msiSlices);
+		glUniform1f(msiShader->Uniform("msiNear"), msiNear);
+		glUniform1f(msiShader->Uniform("msiFar"), msiFar);
+		glBindVertexArray(msiArray);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, msiRings * msiSlices * 6, msiLayers);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		glCullFace(GL_BACK);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+	}
+
+    void Init(int includeIntensiveGPUobject, Vector3f HeadPos, Vector2i SphereSize, SphereMode sphere, bool multiview, bool composite, bool depthEdges,
+		bool _stereoColor)
     {
+		stereoColor = _stereoColor;
+		colorView = 0;
+		// the uniforms of the frame, shared by all the programs at binding frameBinding
+		blockFunctions.Load();
+		memset(&frame, 0, sizeof(frame));
+		SetFade(0, 0, 0);
+		glGenBuffers(1, &frameBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(frame), &frame, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		blockFunctions.bindBufferBase(GL_UNIFORM_BUFFER, frameBinding, frameBuffer);
+		// all the threads of the driver for the programs, started one after the other and finished together
+		if (blockFunctions.maxShaderCompilerThreads)
+			blockFunctions.maxShaderCompilerThreads(0xFFFFFFFF);
 
 		const char* vertexsrc = "Resources/VertexShader-bg_simple.vs";
 		const char* fragsrc = "Resources/FragmentShader-bg_simple.fs";
-		Shader * s = new Shader(vertexsrc, fragsrc);
+		Shader * s = new Shader(vertexsrc, fragsrc, sphere, multiview, false, false, nullptr, { "bgtext" });
 		AddShader(s);
 
 		vertexsrc = "Resources/VertexShader-fg_simple.vs";
 		fragsrc = "Resources/FragmentShader-fg_simple.fs";
-		s = new Shader(vertexsrc, fragsrc);
+		s = new Shader(vertexsrc, fragsrc, sphere, multiview, true, false, nullptr, { "fgtext" });
 		AddShader(s);
 
+		// the programs of the video layer, displaced by its depth, discard across its edges
 		vertexsrc = "Resources/VertexShader-mov_simple.vs";
 		fragsrc = "Resources/FragmentShader-mov_simple.fs";
-		s = new Shader(vertexsrc, fragsrc);
+		s = new Shader(vertexsrc, fragsrc, sphere, multiview, false, depthEdges, stereoColor ? "fgtext" : nullptr);
 		AddShader(s);
 
 		vertexsrc = "Resources/VertexShader-simple-simple.vs";
 		fragsrc = "Resources/FragmentShader-bg_simple.fs";
-		s = new Shader(vertexsrc, fragsrc);
+		s = new Shader(vertexsrc, fragsrc, sphere, multiview, false, depthEdges, stereoColor ? "bgtext" : nullptr);
 		AddShader(s);
 		
 		vertexsrc = "Resources/VertexShader-black.vs";
 		fragsrc = "Resources/FragmentShader-black.fs";
-		s = new Shader(vertexsrc, fragsrc);
+		s = new Shader(vertexsrc, fragsrc, sphere, multiview);
 		AddShader(s);
 
+		// the layers in one pass where the composite shaders are there and link, in three passes otherwise
+		vertexsrc = "Resources/VertexShader-composite.vs";
+		fragsrc = "Resources/FragmentShader-composite.fs";
+		s = nullptr;
+		if (composite && std::ifstream(vertexsrc).good() && std::ifstream(fragsrc).good())
+			s = new Shader(vertexsrc, fragsrc, sphere, multiview, false, false, stereoColor ? "movtext" : nullptr, { "bgtext", "fgtext" });
+		else if (composite)
+			std::cout << "No composite shaders in Resources, the layers are drawn in three passes\n";
+		for (int i = 0; i < numShaders; i++)
+			Shaders[i]->Finish();
+		if (s)
+		{
+			s->Finish();
+			if (s->linked)
+				AddShader(s);
+			else
+			{
+				std::cout << "The composite shaders don't link, the layers are drawn in three passes\n";
+				glDeleteProgram(s->program);
+				delete s;
+			}
+		}
+
+		// the samplers of the programs, in the order of Shaders. The depthbg of the background sampled the
+		// depth of the foreground, that rebound its unit for depthfg
+		static const struct { int shader; const char *name; TextureUnit unit; } samplers[] = {
+			{ 0, "depthbg", UnitBgDepth }, { 0, "bgtext", UnitBbg }, { 0, "depthfront", UnitDepthLeft }, { 0, "depthfg", UnitBgDepth },
+			{ 1, "fgdepth", UnitBgDepth }, { 1, "Fragfgdepth", UnitBgDepth }, { 1, "fgtext", UnitBg }, { 1, "alphamask", UnitBgAlpha },
+			{ 1, "frontdepth", UnitDepthLeft },
+			{ 2, "fgdepth", UnitDepthLeft }, { 2, "fgtext", UnitLeft }, { 2, "alphamask", UnitAlphaLeft }, { 2, "Fragfgdepth", UnitDepthLeft },
+			{ 2, "depthEdges", UnitEdges },
+			{ 3, "depthbg", UnitDepthLeft }, { 3, "bgtext", UnitLeft }, { 3, "depthEdges", UnitEdges },
+			{ 4, "bgtext", UnitBlack }, { 4, "depthbg", UnitDepthLeft },
+			{ 5, "bgtext", UnitBbg }, { 5, "bgdepth", UnitBgDepth }, { 5, "fgtext", UnitBg }, { 5, "fgdepth", UnitBgDepth },
+			{ 5, "fgalpha", UnitBgAlpha }, { 5, "movtext", UnitLeft }, { 5, "movdepth", UnitDepthLeft }, { 5, "movalpha", UnitAlphaLeft } };
+		for (const auto &sampler : samplers)
+		{
+			if (sampler.shader >= numShaders)
+				continue;
+			glUseProgram(Shaders[sampler.shader]->program);
+			glUniform1i(Shaders[sampler.shader]->Uniform(sampler.name), sampler.unit);
+		}
+		// the depths that the control shader of the tessellated sphere follows, and the grade of the layers
+		for (int i = 0; i < numShaders; i++)
+		{
+			glUseProgram(Shaders[i]->program);
+			glUniform1i(Shaders[i]->Uniform("tessDepth"), UnitDepthLeft);
+			glUniform1i(Shaders[i]->Uniform("tessLayerDepth"), UnitBgDepth);
+			glUniform1i(Shaders[i]->Uniform("depthPyramid"), UnitPyramid);
+			glUniform1i(Shaders[i]->Uniform("viewerGradeLUT"), UnitGrade);
+		}
+		glUseProgram(0);
+
         // Construct geometry		
 		Model * m = new Model(HeadPos);
 		//Change number of rings and slices to desired
-		m->AddSphere(1.0, SphereSize.x, SphereSize.y); //radius, rings, slices
+		m->AddSphere(1.0, SphereSize.x, SphereSize.y, sphere); //radius, rings, slices
 		m->AllocateBuffers();
 		Add(m);
     }
 
-	Scene() :  numModels(0) {
+	Scene() :  numModels(0), marchShader(nullptr), marchArray(0), pyramidBound(false), msiShader(nullptr), msiArray(0), gradeTexture(0), stereoColor(false),
+		colorView(0), bakeShader(nullptr), bakedShader(nullptr), bakedClip(0),
+		galleryShader(nullptr), galleryArray(0), galleryInstances(0), galleryPreviews(0), galleryCount(0), galleryFocus(-1), galleryShown(false), galleryResident(false) {
 		numShaders = 0;
+		frameBuffer = 0;
+		SetFade(0, 0, 0);
 	};
-	Scene(bool includeIntensiveGPUobject, Vector3f HeadPos, Vector2i SphereSize) :	numModels(0)
+	Scene(bool includeIntensiveGPUobject, Vector3f HeadPos, Vector2i SphereSize, SphereMode sphere = SphereMesh, bool multiview = false, bool composite = false,
+		bool depthEdges = false, bool stereoColor = false) :	numModels(0), marchShader(nullptr), marchArray(0), pyramidBound(false), msiShader(nullptr), msiArray(0),
+		gradeTexture(0), bakeShader(nullptr), bakedShader(nullptr), bakedClip(0),
+		galleryShader(nullptr), galleryArray(0), galleryInstances(0), galleryPreviews(0), galleryCount(0), galleryFocus(-1), galleryShown(false), galleryResident(false)
     {
 		numShaders = 0;
 		numModels = 0;
-        Init(includeIntensiveGPUobject, HeadPos, SphereSize);
+        Init(includeIntensiveGPUobject, HeadPos, SphereSize, sphere, multiview, composite, depthEdges, stereoColor);
     }
     void Release()
     {
         while (numModels-- > 0)
             delete Models[numModels];
+		if (gradeTexture)
+		{
+			glDeleteTextures(1, &gradeTexture);
+			gpuResidency.FreeTexture(gradeTexture);
+		}
+		gradeTexture = 0;
     }
 	void cleanprograms()
 	{
 		while (numShaders-- > 0)
 			glDeleteProgram(Shaders[numShaders]->program);
+		if (marchShader)
+		{
+			glDeleteProgram(marchShader->program);
+			glDeleteVertexArrays(1, &marchArray);
+		}
+		if (msiShader)
+		{
+			glDeleteProgram(msiShader->program);
+			glDeleteVertexArrays(1, &msiArray);
+		}
+		if (bakeShader)
+		{
+			glDeleteProgram(bakeShader->program);
+			glDeleteProgram(bakedShader->program);
+		}
+		if (galleryShader)
+		{
+			glDeleteProgram(galleryShader->program);
+			glDeleteVertexArrays(1, &galleryArray);
+			glDeleteBuffers(1, &galleryInstances);
+			glDeleteTextures(1, &galleryPreviews);
+			gpuResidency.FreeBuffer(galleryInstances);
+			gpuResidency.FreeTexture(galleryPreviews);
+		}
+		if (frameBuffer)
+			glDeleteBuffers(1, &frameBuffer);
 			
 	}
     ~Scene()
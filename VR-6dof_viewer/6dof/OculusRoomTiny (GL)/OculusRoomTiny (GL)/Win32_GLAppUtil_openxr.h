@@ -0,0 +1,292 @@
+/************************************************************************************
+ Filename    :   Win32_GLAppUtil_openxr.h
+ Content     :   The OpenXR session of the viewer, in place of the one of LibOVR
+ *************************************************************************************/
+
+#ifndef OVR_Win32_GLAppUtil_openxr_h
+#define OVR_Win32_GLAppUtil_openxr_h
+
+// Built with VIEWER_OPENXR and the headers and the loader of the OpenXR SDK
+#ifdef VIEWER_OPENXR
+
+#define XR_USE_PLATFORM_WIN32
+#define XR_USE_GRAPHICS_API_OPENGL
+#include <openxr/openxr.h>
+#include <openxr/openxr_platform.h>
+#include <iostream>
+#include <vector>
+#pragma comment(lib, "openxr_loader.lib")
+
+//--------------------------------------------------------------------------
+// the session of an OpenXR runtime on the GL context of the render thread: the stereo view configuration of the
+// HMD, the space of the stage, at the floor as the tracking origin of LibOVR, where the runtime has one, and a
+// swapchain of sRGB color per eye at its recommended size. A frame is waited for, begun and located by
+// BeginFrame, its images drawn between AcquireImage and ReleaseImage, and submitted as a projection layer by
+// EndFrame; the session starts and stops with the events of the runtime in PollEvents
+struct XrGLSession
+{
+    XrInstance          instance;
+    XrSystemId          systemId;
+    XrSession           session;
+    XrSpace             space, viewSpace;
+    XrSessionState      state;
+    bool                running;
+    XrSwapchain         swapchain[2];
+    std::vector<XrSwapchainImageOpenGLKHR> images[2];
+    Sizei               size[2];
+    XrFrameState        frameState;
+    XrView              views[2];
+    XrPosef             head;
+    XrCompositionLayerProjectionView layerViews[2];
+
+    XrGLSession() :
+        instance(XR_NULL_HANDLE),
+        systemId(XR_NULL_SYSTEM_ID),
+        session(XR_NULL_HANDLE),
+        space(XR_NULL_HANDLE),
+        viewSpace(XR_NULL_HANDLE),
+        state(XR_SESSION_STATE_UNKNOWN),
+        running(false)
+    {
+        swapchain[0] = swapchain[1] = XR_NULL_HANDLE;
+    }
+
+    ~XrGLSession()
+    {
+        Destroy();
+    }
+
+    static bool Check(XrResult result, const char *call)
+    {
+        if (XR_SUCCEEDED(result))
+            return true;
+        std::cout << call << " failed with the XrResult " << int(result) << "\n";
+        return false;
+    }
+
+    bool Create(HDC hDC, HGLRC hGLRC)
+    {
+        const char *extensions[] = { XR_KHR_OPENGL_ENABLE_EXTENSION_NAME };
+        XrInstanceCreateInfo instanceInfo = { XR_TYPE_INSTANCE_CREATE_INFO };
+        strcpy_s(instanceInfo.applicationInfo.applicationName, "6dof viewer");
+        instanceInfo.applicationInfo.apiVersion = XR_CURRENT_API_VERSION;
+        instanceInfo.enabledExtensionCount = 1;
+        instanceInfo.enabledExtensionNames = extensions;
+        if (!Check(xrCreateInstance(&instanceInfo, &instance), "xrCreateInstance"))
+            return false;
+
+        XrSystemGetInfo systemInfo = { XR_TYPE_SYSTEM_GET_INFO };
+        systemInfo.formFactor = XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY;
+        if (!Check(xrGetSystem(instance, &systemInfo, &systemId), "xrGetSystem"))
+            return false;
+
+        // the requirements of the GL context must be asked for before the session is created
+        PFN_xrGetOpenGLGraphicsRequirementsKHR getRequirements = nullptr;
+        xrGetInstanceProcAddr(instance, "xrGetOpenGLGraphicsRequirementsKHR", (PFN_xrVoidFunction*)&getRequirements);
+        XrGraphicsRequirementsOpenGLKHR requirements = { XR_TYPE_GRAPHICS_REQUIREMENTS_OPENGL_KHR };
+        if (!getRequirements || !Check(getRequirements(instance, systemId, &requirements), "xrGetOpenGLGraphicsRequirementsKHR"))
+            return false;
+
+        XrGraphicsBindingOpenGLWin32KHR binding = { XR_TYPE_GRAPHICS_BINDING_OPENGL_WIN32_KHR };
+        binding.hDC = hDC;
+        binding.hGLRC = hGLRC;
+        XrSessionCreateInfo sessionInfo = { XR_TYPE_SESSION_CREATE_INFO };
+        sessionInfo.next = &binding;
+        sessionInfo.systemId = systemId;
+        if (!Check(xrCreateSession(instance, &sessionInfo, &session), "xrCreateSession"))
+            return false;
+
+        XrReferenceSpaceCreateInfo spaceInfo = { XR_TYPE_REFERENCE_SPACE_CREATE_INFO };
+        spaceInfo.poseInReferenceSpace.orientation.w = 1;
+        spaceInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
+        if (XR_FAILED(xrCreateReferenceSpace(session, &spaceInfo, &space)))
+        {
+            spaceInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+            if (!Check(xrCreateReferenceSpace(session, &spaceInfo, &space), "xrCreateReferenceSpace"))
+                return false;
+        }
+        spaceInfo.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_VIEW;
+        if (!Check(xrCreateReferenceSpace(session, &spaceInfo, &viewSpace), "xrCreateReferenceSpace"))
+            return false;
+
+        // sRGB colors, as the eye buffers of LibOVR
+        uint32_t count = 0;
+        xrEnumerateSwapchainFormats(session, 0, &count, nullptr);
+        std::vector<int64_t> formats(count);
+        xrEnumerateSwapchainFormats(session, count, &count, formats.data());
+        int64_t format = formats.empty() ? GL_SRGB8_ALPHA8 : formats[0];
+        for (size_t i = 0; i < formats.size(); ++i)
+            if (formats[i] == GL_SRGB8_ALPHA8)
+                format = formats[i];
+
+        XrViewConfigurationView configViews[2] = { { XR_TYPE_VIEW_CONFIGURATION_VIEW }, { XR_TYPE_VIEW_CONFIGURATION_VIEW } };
+        if (!Check(xrEnumerateViewConfigurationViews(instance, systemId, XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, 2, &count, configViews),
+            "xrEnumerateViewConfigurationViews"))
+            return false;
+        for (int eye = 0; eye < 2; ++eye)
+        {
+            size[eye] = Sizei(int(configViews[eye].recommendedImageRectWidth), int(configViews[eye].recommendedImageRectHeight));
+            XrSwapchainCreateInfo swapchainInfo = { XR_TYPE_SWAPCHAIN_CREATE_INFO };
+            swapchainInfo.usageFlags = XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT | XR_SWAPCHAIN_USAGE_SAMPLED_BIT;
+            swapchainInfo.format = format;
+            swapchainInfo.sampleCount = 1;
+            swapchainInfo.width = size[eye].w;
+            swapchainInfo.height = size[eye].h;
+            swapchainInfo.faceCount = 1;
+            swapchainInfo.arraySize = 1;
+            swapchainInfo.mipCount = 1;
+            if (!Check(xrCreateSwapchain(session, &swapchainInfo, &swapchain[eye]), "xrCreateSwapchain"))
+                return false;
+            xrEnumerateSwapchainImages(swapchain[eye], 0, &count, nullptr);
+            images[eye].assign(count, { XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR });
+            xrEnumerateSwapchainImages(swapchain[eye], count, &count, (XrSwapchainImageBaseHeader*)images[eye].data());
+
+            XrCompositionLayerProjectionView &layerView = layerViews[eye];
+            layerView = { XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW };
+            layerView.subImage.swapchain = swapchain[eye];
+            layerView.subImage.imageRect.extent.width = size[eye].w;
+            layerView.subImage.imageRect.extent.height = size[eye].h;
+            views[eye] = { XR_TYPE_VIEW };
+        }
+        head.orientation.x = head.orientation.y = head.orientation.z = 0;
+        head.orientation.w = 1;
+        head.position.x = head.position.y = head.position.z = 0;
+        return true;
+    }
+
+    // the events of the runtime, the session begun when it is ready and ended when it stops; false to quit
+    bool PollEvents()
+    {
+        XrEventDataBuffer event = { XR_TYPE_EVENT_DATA_BUFFER };
+        while (xrPollEvent(instance, &event) == XR_SUCCESS)
+        {
+            if (event.type == XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING)
+                return false;
+            if (event.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED)
+            {
+                state = ((XrEventDataSessionStateChanged*)&event)->state;
+                if (state == XR_SESSION_STATE_READY)
+                {
+                    XrSessionBeginInfo beginInfo = { XR_TYPE_SESSION_BEGIN_INFO };
+                    beginInfo.primaryViewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+                    running = Check(xrBeginSession(session, &beginInfo), "xrBeginSession");
+                }
+                else if (state == XR_SESSION_STATE_STOPPING)
+                {
+                    xrEndSession(session);
+                    running = false;
+                }
+                else if (state == XR_SESSION_STATE_EXITING || state == XR_SESSION_STATE_LOSS_PENDING)
+                    return false;
+            }
+            event = { XR_TYPE_EVENT_DATA_BUFFER };
+        }
+        return true;
+    }
+
+    // the frame paced by the runtime, and the poses of the head and of the eyes at its display; false when it
+    // is not to be drawn, it is ended empty then
+    bool BeginFrame()
+    {
+        frameState = { XR_TYPE_FRAME_STATE };
+        XrFrameWaitInfo waitInfo = { XR_TYPE_FRAME_WAIT_INFO };
+        if (!Check(xrWaitFrame(session, &waitInfo, &frameState), "xrWaitFrame"))
+            return false;
+        XrFrameBeginInfo beginInfo = { XR_TYPE_FRAME_BEGIN_INFO };
+        xrBeginFrame(session, &beginInfo);
+        if (!frameState.shouldRender)
+            return false;
+
+        XrViewLocateInfo locateInfo = { XR_TYPE_VIEW_LOCATE_INFO };
+        locateInfo.viewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+        locateInfo.displayTime = frameState.predictedDisplayTime;
+        locateInfo.space = space;
+        XrViewState viewState = { XR_TYPE_VIEW_STATE };
+        uint32_t count = 0;
+        if (!Check(xrLocateViews(session, &locateInfo, &viewState, 2, &count, views), "xrLocateViews") ||
+            !(viewState.viewStateFlags & XR_VIEW_STATE_ORIENTATION_VALID_BIT))
+            return false;
+        XrSpaceLocation location = { XR_TYPE_SPACE_LOCATION };
+        if (XR_SUCCEEDED(xrLocateSpace(viewSpace, space, frameState.predictedDisplayTime, &location)) &&
+            (location.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT))
+            head = location.pose;
+        return true;
+    }
+
+    GLuint AcquireImage(int eye)
+    {
+        uint32_t index = 0;
+        XrSwapchainImageAcquireInfo acquireInfo = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+        xrAcquireSwapchainImage(swapchain[eye], &acquireInfo, &index);
+        XrSwapchainImageWaitInfo waitInfo = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+        waitInfo.timeout = XR_INFINITE_DURATION;
+        xrWaitSwapchainImage(swapchain[eye], &waitInfo);
+        return images[eye][index].image;
+    }
+
+    void ReleaseImage(int eye)
+    {
+        XrSwapchainImageReleaseInfo releaseInfo = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+        xrReleaseSwapchainImage(swapchain[eye], &releaseInfo);
+    }
+
+    // the frame submitted, the views drawn as a projection layer of the poses they were drawn at
+    bool EndFrame(bool drawn)
+    {
+        XrCompositionLayerProjection layer = { XR_TYPE_COMPOSITION_LAYER_PROJECTION };
+        const XrCompositionLayerBaseHeader *layers[1] = { (const XrCompositionLayerBaseHeader*)&layer };
+        for (int eye = 0; eye < 2; ++eye)
+        {
+            layerViews[eye].pose = views[eye].pose;
+            layerViews[eye].fov = views[eye].fov;
+        }
+        layer.space = space;
+        layer.viewCount = 2;
+        layer.views = layerViews;
+        XrFrameEndInfo endInfo = { XR_TYPE_FRAME_END_INFO };
+        endInfo.displayTime = frameState.predictedDisplayTime;
+        endInfo.environmentBlendMode = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+        endInfo.layerCount = drawn ? 1 : 0;
+        endInfo.layers = layers;
+        return Check(xrEndFrame(session, &endInfo), "xrEndFrame");
+    }
+
+    void Destroy()
+    {
+        for (int eye = 0; eye < 2; ++eye)
+            if (swapchain[eye] != XR_NULL_HANDLE)
+                xrDestroySwapchain(swapchain[eye]);
+        swapchain[0] = swapchain[1] = XR_NULL_HANDLE;
+        if (viewSpace != XR_NULL_HANDLE) xrDestroySpace(viewSpace);
+        if (space != XR_NULL_HANDLE) xrDestroySpace(space);
+        if (session != XR_NULL_HANDLE) xrDestroySession(session);
+        if (instance != XR_NULL_HANDLE) xrDestroyInstance(instance);
+        viewSpace = space = XR_NULL_HANDLE;
+        session = XR_NULL_HANDLE;
+        instance = XR_NULL_HANDLE;
+    }
+
+    // the pose and the field of view of OpenXR as the ones of LibOVR the Scene is drawn with
+    static ovrPosef Pose(const XrPosef &pose)
+    {
+        ovrPosef p;
+        p.Orientation.x = pose.orientation.x; p.Orientation.y = pose.orientation.y;
+        p.Orientation.z = pose.orientation.z; p.Orientation.w = pose.orientation.w;
+        p.Position.x = pose.position.x; p.Position.y = pose.position.y; p.Position.z = pose.position.z;
+        return p;
+    }
+
+    static ovrFovPort Fov(const XrFovf &fov)
+    {
+        ovrFovPort f;
+        f.UpTan = tanf(fov.angleUp);
+        f.DownTan = tanf(-fov.angleDown);
+        f.LeftTan = tanf(-fov.angleLeft);
+        f.RightTan = tanf(fov.angleRight);
+        return f;
+    }
+};
+
+#endif // VIEWER_OPENXR
+
+#endif // OVR_Win32_GLAppUtil_openxr_h
@@ -25,15 +25,28 @@ limitations under the License.
 
 #include <opencv2/opencv.hpp>
 
+//the hardware acceleration properties of VideoCapture and VideoWriter appeared in OpenCV 4.5.2
+#if defined(CV_VERSION_MAJOR) && (CV_VERSION_MAJOR>4 || (CV_VERSION_MAJOR==4 && (CV_VERSION_MINOR>5 || (CV_VERSION_MINOR==5 && CV_VERSION_REVISION>=2))))
+#define VIDEO_HW_ACCELERATION
+#endif
+
 #include "Win32_GLAppUtil_main.h"
+#include "Win32_GLAppUtil_openxr.h"
 
 // Include the Oculus SDK
 #include "OVR_CAPI_GL.h"
+#include "Kernel/OVR_JSON.h" // for settings.json, of LibOVRKernel
+#include "Kernel/OVR_SharedMemory.h" // for the frames of the decoder process
+#include "Kernel/OVR_DebugHelp.h" // for the call stacks of the stall watchdog
 
 #if defined(_WIN32)
 #include <dxgi.h> // for GetDefaultAdapterLuid
 #pragma comment(lib, "dxgi.lib")
 #endif
+#include <urlmon.h> // for the files of a streamed clip
+#pragma comment(lib, "urlmon.lib")
+#include <avrt.h> // for the MMCSS of the audio
+#pragma comment(lib, "avrt.lib")
 
 using namespace OVR;
 #include <iostream>
@@ -44,7 +57,17 @@ using namespace OVR;
 #include <fcntl.h>
 #include <windows.h>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
 #include <irrKlang.h>
+#include <emmintrin.h>
 #include <string.h>
 #include <mbctype.h>
 
@@ -56,27 +79,6 @@ using namespace OVR;
 using namespace irrklang;
 #pragma comment(lib, "irrKlang.lib")
 
-cv::VideoCapture g_video;
-cv::VideoCapture d_video;
-cv::VideoCapture a_video;
-
-
-char g1_filename[200];
-char d1_filename[200];
-char a1_filename[200];
-char bg1_filename[200];
-char bgd1_filename[200];
-char bbg1_filename[200];
-char bbgd1_filename[200];
-char bga_filename[200];
-char bga1_filename[200];
-char g_filename[200];
-char d_filename[200];
-char a_filename[200];
-char bg_filename[200];
-char bgd_filename[200];
-char bbg_filename[200];
-char bbgd_filename[200];
 char video_path[200];
 char data_filename[200];
 char data_path[200];
@@ -98,505 +100,6543 @@ bool vis_fade = true;
 bool vis_clamp = false;
 bool auto_camera = false;
 bool auto_results = false;
+bool hardware_decode = false;
+//the videos decoded by a process of their own into shared memory, see DecoderProcess
+bool decoder_process = false;
+bool packed_layout = false;
+//the live layout: the plain 360 video played as the packed one, its depth computed as it plays, see LiveDepth, the
+//flow of frames live_width wide
+bool live_depth = false;
+int live_width = 512;
+//the tiled layout: a grid of packed videos of tile_cols x tile_rows tiles of the panorama
+int tile_cols = 1, tile_rows = 1;
+bool depth16 = false;
+//the color video uploaded as its NV12 planes, the luma and the chroma of half its size, and converted to RGB
+//on the GPU, instead of converted to BGR by OpenCV on the CPU: half the bytes per pixel. Where the backend of
+//OpenCV does not decode it so, or there are no compute shaders, the color is decoded to BGR
+bool yuv_color = false;
+//the frames uploaded from pixel buffers, persistently mapped or pinned, where the driver has them; from the memory
+//of the decoders otherwise
+bool pbo_uploads = true;
+bool video_mipmaps = false;
+bool memory_reading = false;
+int preload_mb = 256;
+//the paused videos scrubbed frame by frame with the left and right arrows, by seconds with page up and down, from
+//a cache of their GOPs of scrub_mb at most, see GopCache; key frames every scrub_gop frames where their index cannot
+//be read; none at 0
+int scrub_mb = 0;
+int scrub_gop = 30;
+//what is derived from the files of every clip, its layers decoded, the ones the same, the occupancy of the alpha and
+//the key frames of its videos, cached in name.clipcache next to them and mapped from it the next time, see ClipCache
+bool clip_cache = true;
+//the rings x slices of the sphere, a mesh built at startup, compact or, procedural, made by the vertex shaders
+int sphere_rings = 2048, sphere_slices = 1024;
+SphereMode sphere_mode = SphereMesh;
+//the rings x slices of the meshes of their own of the background, the foreground and the video passes, e.g. a coarse
+//background under the dense foregrounds; 0 x 0 for the sphere's. Not of the tessellated sphere
+Vector2i layer_mesh[3] = { Vector2i(0, 0), Vector2i(0, 0), Vector2i(0, 0) };
+//the tessellated sphere: its density at most rings x slices, a triangle edge of tess_pixels on screen, more of them
+//by tess_depth_gain times the range of the depths along an edge
+float tess_pixels = 8, tess_depth_gain = 8;
+//the opaque pixels of the foreground drawn before the background, that is then shaded only where they leave it seen
+bool early_z = true;
+//the background displaced by its static depth once per clip into a buffer, and drawn from it as a plain mesh, where
+//its vertex shader reads nothing but the layers and the sphere is a mesh; see Scene::InitBakedBackground
+bool bake_background = true;
+//the frames handed to the render thread as soon as their uploads and compute passes are submitted, its draws
+//waiting for them on the GPU, in place of the video thread waiting for them on the CPU
+bool gpu_handoff = true;
+//the patches of the sphere out of the views of the eyes not drawn, its geometry no nearer its center than cull_near
+bool culling = true;
+float cull_near = 0.5f;
+//the foreground passes draw only the patches of the sphere over the cells of their alpha that are not all transparent
+bool alpha_culling = true;
+//the layers drawn only for the patches of the sphere within layer_lod degrees of the direction of the view, the video
+//alone beyond them as the simple mode draws it; 0 for the layers everywhere
+float layer_lod = 0;
+//the eyes drawn with eye_samples samples a pixel and resolved before they're committed, smoothing the edges of the
+//depth; not with the multiview, which copies its own views into the eyes
+int eye_samples = 1;
+//the stats of the frames in the headset, a quad layer of the compositor of its own redrawn once a second, see
+//StatsOverlay
+bool stats_overlay = false;
+//the depth and the alpha uploaded in the cells their decoders changed over the frame their slot held before
+bool partial_uploads = true;
+//the grade of the color layers, every channel to the power of layer_gamma, looked up by their shaders
+float layer_gamma = 1.02f;
+//both eyes drawn in one pass with GL_OVR_multiview2 where the driver has it
+bool multiview_stereo = false;
+//the three layers drawn in one pass by the composite shaders of Resources where they are there
+bool composite_layers = false;
+//the foveation of the eye buffers where the driver has GL_NV_shading_rate_image: every pixel shaded within
+//fovea_inner of the center of the lens, half of them within fovea_outer, a quarter beyond, in half widths
+bool foveated = false;
+float fovea_inner = 0.35f, fovea_outer = 0.7f;
+//the layers drawn once per frame of the video, into a cache of reproject times the field of view and the size of the
+//eye buffers, and reprojected by its depth to the pose of every frame of the HMD in between; none at 0
+float reproject = 0;
+//the same while the videos are paused without reproject, into a cache of pause_cache times the field of view, so
+//the still frame is not drawn again for every frame of the HMD; none at 0
+float pause_cache = 1.25f;
+//the dynamic resolution: eye buffers of resolution_max pixels per display pixel, drawn at resolution_min to 1 of
+//their sides as the GPU time of the frames allows
+bool dynamic_resolution = false;
+float resolution_min = 0.6f, resolution_max = 1.2f;
+//the quality stepped down under the load of the GPU, past the dynamic resolution at its minimum, and back up with
+//its headroom, see QualityGovernor: quality_level 0 as set, 1 the tessellation and the foveation coarser, 2 two
+//layers at most, 3 RenderSimple
+bool quality_governor = false;
+int quality_level = 0;
+//the low power mode of laptops: the eyes drawn every other frame and the frames in between left to the timewarp of
+//the compositor, by their depth if it takes the depth layer, the mirror at power_mirror_hz at most, the quality_level
+//power_quality at least, and the render loop and the video thread asleep longer between their frames; power_mode 0
+//off, 1 on, 2 on and off with the battery and the throttling of the GPU, see PowerGovernor
+int power_mode = 0;
+int power_quality = 1;
+float power_mirror_hz = 10;
+std::atomic<bool> lowPower(false);
+//the budget of the GPU memory of the viewer in MB, see GpuResidency, none at 0: the background layers of a clip over it
+//uploaded at a half or a quarter of their size, the previews of the gallery released while it is hidden
+int vram_budget = 0;
+//the profile of the frames, a line per frame and part of it into profile_file, the means of every second to the console
+std::string profile_file;
+//the binary telemetry of every frame next to the data of the session
+bool telemetry_log = false;
+//the render loop, the video thread, the audio thread and the decoders reported when they stall for stall_ms, with
+//their call stacks into the telemetry, see StallWatchdog; none at 0. A decoder back from a stall resyncs the videos
+//to the clock with stall_resync, instead of playing the frames of the stall late
+int stall_ms = 1000;
+bool stall_resync = false;
+//the depth of the eyes submitted with their color, for the positional timewarp of the frames the compositor misses
+bool depth_layer = false;
+//the mirror window, presented mirror_hz times a second, or after every mirror_every frames at 0, so its blit and
+//its swap do not hold the frames of the HMD; mirror_quarter draws it at half the width and height of the window
+bool mirror_window = true;
+float mirror_hz = 0;
+int mirror_every = 1;
+bool mirror_quarter = false;
+//the layers ray marched in ray_march steps against the video depth and the inpainted background, within cull_near
+//and the radius of the sphere, in place of the sphere; none at 0
+int ray_march = 0;
+//the depth of the video median filtered on the GPU as it uploads, and its edges, where it steps by more than
+//depth_filter of its range within 3x3 texels, not drawn across by the video layer; none at 0
+float depth_filter = 0;
+//the layers drawn as the multi_sphere concentric spheres of the multi-sphere image in the atlas <name>_msi.mp4 of
+//msi_columns tiles per row, played in place of the color video, within cull_near and the radius of the sphere; none at 0
+int multi_sphere = 0;
+int msi_columns = 4;
+//the color video of every clip top-bottom stereo, the top half of the left eye, over the mono depth and alpha:
+//each eye samples its half, both still in one draw with the multiview
+bool top_bottom = false;
+//the audio of every clip the first-order ambisonics of <name>_audio.ambix, turned with the head as it plays,
+//in place of the stereo of <name>_audio.mp3
+bool ambisonic = false;
+//the headless benchmark: the head poses of headless_trace, a pose trace or a telemetry, drawn offscreen into
+//eye buffers of headless_size with no HMD, every headless_every-th frame written to <headless_frames><frame>.png
+//if set
+std::string headless_trace;
+Sizei headless_size(1344, 1600);
+std::string headless_frames;
+int headless_every = 0;
+//the benchmark of the video path: the videos of the first clip decoded, stored, uploaded and presented as fast as
+//they go, with no scene and no HMD, for decode_bench seconds in every configuration of the depth, the color, the
+//uploads and the decoding, see DecodeBenchLoop; none at 0
+float decode_bench = 0;
+//the export of a preview: the head poses of export_trace, a pose trace, a telemetry or a camera path, drawn offscreen
+//at export_fps with the videos stepped to the same clock, and the eyes of export_size side by side encoded into
+//export_file, by the encoder of the GPU where FFmpeg finds one
+std::string export_trace, export_file;
+double export_fps = 30;
+Sizei export_size(1344, 1600);
+//the runtime of the HMD, LibOVR or, built with VIEWER_OPENXR, the one OpenXR loads
+bool openxr_runtime = false;
+//the head poses of every frame recorded into the pose trace pose_record, or the ones of the trace pose_replay
+//drawn in place of those of the HMD, until its end
+std::string pose_record, pose_replay;
+//the binaries of the linked programs cached in shader_cache, the directory ShaderCache next to the executable
+//unless it is set, or not at all at off
+std::string shader_cache;
+//the roles of the threads: the render thread of the frames of the HMD, the video thread of the uploads, the
+//decoders of the videos, the threads of the audio, its commands and the mixer of irrKlang, and the background ones
+//of the rewinds of the videos and of the telemetry
+enum ThreadRole { RoleRender, RoleVideo, RoleDecode, RoleAudio, RoleBackground, ThreadRoles };
+//the priorities of the roles unless off: the render thread highest, the video and the decoders above normal, the
+//audio Pro Audio of MMCSS, the background below normal; so that the decoders do not preempt the frames of the HMD
+bool thread_priorities = true;
+//the cores every role runs on, a mask of a bit per core, any at 0
+unsigned long long thread_affinity[ThreadRoles] = { 0, 0, 0, 0, 0 };
+//the suffixes of the lower bitrates of every video, before its extension, for the adaptive bitrate of
+//the videos streamed; rendition 0 is the video itself
+std::vector<std::string> renditions;
+
+//the name, the cores and the priority of the role of the thread calling it, as it starts
+static void SetThreadRole(ThreadRole role)
+{
+	static const char *names[ThreadRoles] = { "6dof render", "6dof video", "6dof decoder", "6dof audio", "6dof background" };
+	static const int priorities[ThreadRoles] = { THREAD_PRIORITY_HIGHEST, THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL,
+		THREAD_PRIORITY_HIGHEST, THREAD_PRIORITY_BELOW_NORMAL };
+	Thread::SetCurrentThreadName(names[role]);
+	if (thread_affinity[role] && !SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(thread_affinity[role])))
+		std::cout << "cannot run the " << names[role] << " thread on the cores of mask " << std::hex << thread_affinity[role] << std::dec << "\n";
+	if (!thread_priorities)
+		return;
+	//the audio scheduled by MMCSS, at the highest priority where it is not there
+	DWORD task = 0;
+	if (role == RoleAudio && AvSetMmThreadCharacteristicsA("Pro Audio", &task))
+		return;
+	SetThreadPriority(GetCurrentThread(), priorities[role]);
+}
+
+//a Path of a server instead of a directory: the videos stream from it (HLS, DASH, RTSP, or http files
+//read progressively, whatever the FFmpeg of OpenCV demuxes), the other files are downloaded
+static bool IsStream(const std::string &name)
+{
+	return name.find("://") != std::string::npos;
+}
+
+static std::string Download(std::string url)
+{
+	char path[MAX_PATH];
+	if (URLDownloadToCacheFileA(NULL, url.c_str(), path, MAX_PATH, 0, NULL) != S_OK)
+		return "";
+	return path;
+}
+
+//the local file of a name: the name itself, or the copy in the Internet cache of the file at a URL,
+//downloaded once whichever thread asks first; empty if it cannot be downloaded
+static std::string LocalFile(const std::string &name)
+{
+	if (!IsStream(name))
+		return name;
+	static std::mutex mutex;
+	static std::map<std::string, std::shared_future<std::string> > files;
+	std::shared_future<std::string> file;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<std::string, std::shared_future<std::string> >::iterator i = files.find(name);
+		if (i == files.end())
+			i = files.insert(std::make_pair(name, std::async(std::launch::deferred, Download, name).share())).first;
+		file = i->second;
+	}
+	return file.get();
+}
+
+//The files of a clip, named after its VideoName in the video path
+struct ClipFiles
+{
+	std::string color, depth, alpha, packed;
+	std::string bg, bgd, bga, bbg, bbgd;
+	std::string audio;
+	std::string preview;				//the low resolution color of the gallery, if the clip has one
+	std::vector<std::string> tiles;		//the packed videos of the tiles of the grid, in rows
+	std::string cache;					//see ClipCache
+};
+
+static ClipFiles MakeClipFiles(const char *name)
+{
+	std::string prefix = std::string(video_path) + name;
+	ClipFiles files;
+	files.color = prefix + (multi_sphere > 0 ? "_msi.mp4" : ".mp4");
+	files.depth = prefix + "_depth.mp4";
+	files.alpha = prefix + "_alphaproc.mp4";
+	files.packed = prefix + "_packed.mp4";
+	files.bg = prefix + "_BG.png";
+	files.bgd = prefix + "_BGD.png";
+	files.bga = prefix + "_BGA.png";
+	files.bbg = prefix + "_BG_inp.png";
+	files.bbgd = prefix + "_BGD_inp.png";
+	files.audio = prefix + (ambisonic ? "_audio.ambix" : "_audio.mp3");
+	files.preview = prefix + "_preview.mp4";
+	files.cache = prefix + ".clipcache";
+	for (int r = 0; r < tile_rows && tile_cols * tile_rows > 1; r++)
+		for (int c = 0; c < tile_cols; c++)
+		{
+			char tile[32];
+			sprintf(tile, "_packed_%d_%d.mp4", r, c);
+			files.tiles.push_back(prefix + tile);
+		}
+	return files;
+}
+
+//The clips played in turn, one per VideoName of the settings. The video thread goes to the next one on
+//the N key, or after clip_loops loops of a clip if set, and starts the audio of the clip
+std::vector<ClipFiles> playlist;
+int clip_loops = 0;
+//the gallery of the clips of the playlist, shown instead of the layers on the G key: a small sphere a clip, of its
+//preview of gallery_width x gallery_width / 2 decoded at gallery_fps frames a second; the one looked at is played
+//on ENTER. 0 for none
+int gallery_width = 0;
+float gallery_fps = 5;
+//the clip picked in the gallery for the video thread to switch to, -1 for none
+std::atomic<int> galleryPick(-1);
 
-int frames, width, height;
-float FPSvideo;
-cv::Mat img1, img;
-cv::Mat d_img1, d_img;
-cv::Mat a_img;
-cv::Mat bg_img;
-cv::Mat bgd_img;
-cv::Mat bbg_img;
-cv::Mat bbgd_img;
 cv::Mat black_img;
-cv::Mat bga_img;
 
 std::ofstream headpose;
 
-void VideoThread(LPVOID pArgs_);
-void AudioThread(LPVOID pArgs_);
+//The ARB_buffer_storage and ARB_sync entry points are not loaded by GLE, so they are loaded here, once
+//for the render and the video threads, whose contexts share their objects
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+//the single-channel textures of the alpha and of the depth video of 16 bits
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+#ifndef GL_R16
+#define GL_R16 0x822A
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_G
+#define GL_TEXTURE_SWIZZLE_G 0x8E43
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_B
+#define GL_TEXTURE_SWIZZLE_B 0x8E44
+#endif
+//the staging memory of the decoders bound as a buffer by AMD_pinned_memory
+#ifndef GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD
+#define GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD 0x9160
+#endif
+//the block compressed background layers of the preprocessing
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
 
+typedef void (APIENTRY *BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void* (APIENTRY *MapBufferRangeProc)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLsync (APIENTRY *FenceSyncProc)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY *ClientWaitSyncProc)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void (APIENTRY *DeleteSyncProc)(GLsync sync);
+typedef void (APIENTRY *WaitSyncProc)(GLsync sync, GLbitfield flags, GLuint64 timeout);
 
-static ovrGraphicsLuid GetDefaultAdapterLuid()
+struct SyncFunctions
 {
-	ovrGraphicsLuid luid = ovrGraphicsLuid();
+	BufferStorageProc bufferStorage;
+	MapBufferRangeProc mapBufferRange;
+	FenceSyncProc fenceSync;
+	ClientWaitSyncProc clientWaitSync;
+	DeleteSyncProc deleteSync;
+	WaitSyncProc waitSync;
+	bool fences, persistent, gpuWaits;
+	bool pinned;		//client memory the GPU reads by DMA as a buffer, without ARB_buffer_storage
+
+	void Load()
+	{
+		bufferStorage = (BufferStorageProc)wglGetProcAddress("glBufferStorage");
+		mapBufferRange = (MapBufferRangeProc)wglGetProcAddress("glMapBufferRange");
+		fenceSync = (FenceSyncProc)wglGetProcAddress("glFenceSync");
+		clientWaitSync = (ClientWaitSyncProc)wglGetProcAddress("glClientWaitSync");
+		deleteSync = (DeleteSyncProc)wglGetProcAddress("glDeleteSync");
+		waitSync = (WaitSyncProc)wglGetProcAddress("glWaitSync");
+		fences = fenceSync && clientWaitSync && deleteSync;
+		persistent = bufferStorage && mapBufferRange && fences;
+		gpuWaits = fences && waitSync;
+		pinned = false;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && fences; ++i)
+			pinned = pinned || strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_AMD_pinned_memory") == 0;
+	}
 
-#if defined(_WIN32)
-	IDXGIFactory* factory = nullptr;
+	//waits on the CPU until the commands before sync are done, and deletes it
+	void Wait(GLsync &sync)
+	{
+		if (!sync)
+			return;
+		while (clientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		deleteSync(sync);
+		sync = NULL;
+	}
+};
+SyncFunctions syncFunctions;
+
+//The hand-off of the presented frame from the video thread to the render thread, without locks. The
+//video thread publishes the slot of the ring it presents, after its upload is done. The render thread
+//acquires the last published slot once per frame, so both eyes draw the color, depth and alpha of the
+//same frame, and releases it with a fence of its draws when they are submitted. The video thread
+//uploads to a slot only when the render thread does not hold it and its draws of it are done.
+//With gpu_handoff the video thread publishes a slot with a fence of its uploads instead of waiting for
+//them, and the first draws of the render thread that acquire it wait for the fence on the GPU: the
+//uploads and compute passes of the next frame run on the context of the video thread while the render
+//thread goes on submitting the draws of the last one
+struct FrameHandoff
+{
+	static const int nSlots = 4;
+	static const int nVideos = FrameBundle::nVideos;
+
+	//the frames of the slots, their textures set before the first slot is published; the edges of the depth are 0
+	//unless filtered and its min and max pyramid 0 unless built
+	FrameBundle bundle[nSlots];
+	std::atomic<int> published, acquired;
+	std::atomic<GLsync> released[nSlots];
+	std::atomic<GLsync> ready[nSlots];		//the uploads of the slots published, until the render thread waits for them
+	std::atomic<long long> frame[nSlots];	//the frame of the video in every slot published
+
+	FrameHandoff() : published(-1), acquired(-1)
+	{
+		for (int i = 0; i < nSlots; i++)
+		{
+			released[i] = NULL;
+			ready[i] = NULL;
+			frame[i] = -1;
+		}
+	}
 
-	if (SUCCEEDED(CreateDXGIFactory(IID_PPV_ARGS(&factory))))
+	//video thread; uploaded: the fence of the uploads of the slot not waited for yet, owned by the handoff
+	void Publish(int slot, long long videoFrame, GLsync uploaded = NULL)
 	{
-		IDXGIAdapter* adapter = nullptr;
+		GLsync last = ready[slot].exchange(uploaded);
+		if (last)
+			syncFunctions.deleteSync(last);
+		frame[slot].store(videoFrame);
+		published.store(slot);
+	}
 
-		if (SUCCEEDED(factory->EnumAdapters(0, &adapter)))
+	bool CanUpload(int slot)
+	{
+		if (acquired.load() == slot)
+			return false;
+		GLsync sync = released[slot].exchange(NULL);
+		syncFunctions.Wait(sync);
+		return true;
+	}
+
+	//render thread: the last published frame, held until Release, false before the first one. The slot is
+	//stored as acquired before it is checked to still be the published one, so the video thread that
+	//published another one in between sees it held
+	bool Acquire(const FrameBundle **front)
+	{
+		int slot = published.load();
+		if (slot < 0)
+			return false;
+		for (;;)
 		{
-			DXGI_ADAPTER_DESC desc;
+			acquired.store(slot);
+			int last = published.load();
+			if (last == slot)
+				break;
+			slot = last;
+		}
+		//the draws after this on the GPU wait for the uploads, on the CPU of neither thread
+		GLsync uploaded = ready[slot].exchange(NULL);
+		if (uploaded)
+		{
+			syncFunctions.waitSync(uploaded, 0, GL_TIMEOUT_IGNORED);
+			syncFunctions.deleteSync(uploaded);
+		}
+		*front = &bundle[slot];
+		return true;
+	}
 
-			adapter->GetDesc(&desc);
-			memcpy(&luid, &desc.AdapterLuid, sizeof(luid));
-			adapter->Release();
+	//the frame of the video acquired, -1 before the first one
+	long long AcquiredFrame() const
+	{
+		int slot = acquired.load();
+		return slot < 0 ? -1 : frame[slot].load();
+	}
+
+	void Release()
+	{
+		int slot = acquired.load();
+		if (slot < 0)
+			return;
+		if (!syncFunctions.fences)
+		{
+			glFinish();
+			return;
 		}
+		GLsync sync = syncFunctions.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		GLsync last = released[slot].exchange(sync);
+		if (last)
+			syncFunctions.deleteSync(last);
+	}
+};
+FrameHandoff videoFrames;
+//the videos paused with the space bar, as the video thread holds them
+std::atomic<bool> videoPaused(false);
+
+//The clock of the export: the seconds of the frame the render thread exports, set before it draws it, which the
+//videos follow in place of the steady clock, and the last of them the video thread has presented the frame of
+struct ExportClock
+{
+	std::atomic<double> seconds, reached;
+	double taken;
+	ExportClock() : seconds(0), reached(-1), taken(0) {}
 
-		factory->Release();
+	//video thread: the seconds the clock moved since the last call, and the ones it moved to
+	double Advance(double &at)
+	{
+		at = seconds.load();
+		double by = at - taken;
+		taken = at;
+		return by;
+	}
+};
+ExportClock exportClock;
+
+//The clock the videos are presented by: the play position of the audio, so the pictures follow the sound
+//instead of drifting from it. The audio thread sets the start of the audio it plays and its sound, the video
+//thread polls the position of the sound and holds the frames of a loop of the videos until the audio of that
+//loop has started. The position moves by the buffers of the mixer, tens of ms, so it is carried on by the
+//steady clock from the time it last moved, for at most maxAhead, and the frames are not presented in bursts
+struct MediaClock
+{
+	static constexpr double maxAhead = 0.1;
+	std::atomic<int> audioStarts;		//the start of the audio playing, as AudioControl::Start numbers them
+	std::atomic<long long> audioMs;		//-1 until the position of the last start is known
+	std::atomic<long long> movedUs;		//the steady clock last time audioMs moved, set before it
+	std::atomic<bool> hasAudio;			//false when the audio cannot be played, the videos keep their own time
+	std::mutex soundMutex;
+	ISound *sound;						//grabbed, NULL while none plays
+	MediaClock() : audioStarts(0), audioMs(-1), movedUs(0), hasAudio(true), sound(NULL) {}
+
+	//audio thread: the sound of a start, NULL for none
+	void SetSound(ISound *next, int start)
+	{
+		std::lock_guard<std::mutex> lock(soundMutex);
+		if (sound)
+			sound->drop();
+		sound = next;
+		if (sound)
+			sound->grab();
+		audioMs = -1;
+		audioStarts = start;
 	}
-#endif
 
-	return luid;
-}
+	//video thread: the position of the sound playing, read once per presentation
+	void Poll()
+	{
+		std::lock_guard<std::mutex> lock(soundMutex);
+		if (!sound)
+			return;
+		ik_u32 position = sound->getPlayPosition();
+		if (position != (ik_u32)-1)
+			Move(position);
+	}
 
+	static long long Microseconds(std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+	}
 
-static int Compare(const ovrGraphicsLuid& lhs, const ovrGraphicsLuid& rhs)
-{
-	return memcmp(&lhs, &rhs, sizeof(ovrGraphicsLuid));
-}
+	void Move(long long ms)
+	{
+		if (ms == audioMs.load())
+			return;
+		movedUs = Microseconds(std::chrono::steady_clock::now());
+		audioMs = ms;
+	}
 
-double clockToMilliseconds(clock_t ticks) {
-	// units/(units/time) => time (seconds) * 1000 = milliseconds
-	return (ticks / (double)CLOCKS_PER_SEC)*1000.0;
-}
+	//video thread: the seconds of the audio at now, -1 before its position is known; held while paused
+	double Seconds(std::chrono::steady_clock::time_point now, bool paused) const
+	{
+		long long ms = audioMs.load();
+		if (ms < 0)
+			return -1;
+		double ahead = paused ? 0 : (Microseconds(now) - movedUs.load()) / 1e6;
+		return ms / 1000.0 + (std::max)(0.0, (std::min)(ahead, maxAhead));
+	}
+};
+MediaClock mediaClock;
 
-// return true to retry later (e.g. after display lost)
-static bool MainLoop(bool retryCreate)
+//The commands of the audio from the video thread: the start of the audio of a clip from its beginning, at the
+//first frame, every loop of the videos and every switch of the clip, and the pause. The audio thread sleeps on
+//them and takes the last state when it wakes, so the starts it missed are one start, the last one
+struct AudioControl
 {
-	TextureBuffer * eyeRenderTexture[2] = { nullptr, nullptr };
-	DepthBuffer   * eyeDepthBuffer[2] = { nullptr, nullptr };
-	ovrMirrorTexture mirrorTexture = nullptr;
-	GLuint          mirrorFBO = 0;
-	Scene         * roomScene = nullptr;
-	long long frameIndex = 0;
+	struct State
+	{
+		int starts, clip;
+		bool paused;
+		int startMs;		//the position the audio of the start plays from
+	};
+	std::mutex mutex;
+	std::condition_variable changed;
+	State state;
+	bool quit;
+	AudioControl() : quit(false)
+	{
+		state.starts = 0;
+		state.clip = 0;
+		state.paused = false;
+		state.startMs = 0;
+	}
 
-	ovrSession session;
-	ovrGraphicsLuid luid;
-	ovrResult result = ovr_Create(&session, &luid);
-	if (!OVR_SUCCESS(result))
-		return retryCreate;
+	//the number of the start, that MediaClock::audioStarts reaches when the audio plays from it, from its
+	//beginning or from ms, after a scrub
+	int Start(int clip, int ms = 0)
+	{
+		int start;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			start = ++state.starts;
+			state.clip = clip;
+			state.startMs = ms;
+		}
+		changed.notify_one();
+		return start;
+	}
 
-	if (Compare(luid, GetDefaultAdapterLuid())) // If luid that the Rift is on is not the default adapter LUID...
+	void Pause(bool paused)
 	{
-		VALIDATE(false, "OpenGL supports only the default graphics adapter.");
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			state.paused = paused;
+		}
+		changed.notify_one();
 	}
-	
-	ovrHmdDesc hmdDesc = ovr_GetHmdDesc(session);
 
-	// Setup Window and Graphics
-	// Note: the mirror window can be any size, for this sample we use 1/2 the HMD resolution
-	//ovrSizei windowSize = { hmdDesc.Resolution.w, hmdDesc.Resolution.h};
-	ovrSizei windowSize = { hmdDesc.Resolution.w / 2, hmdDesc.Resolution.h / 2 };
-	if (!Platform.InitDevice(windowSize.w, windowSize.h, reinterpret_cast<LUID*>(&luid)))
-		goto Done;
+	void Quit()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		changed.notify_one();
+	}
 
-	
-	///////////////////////////////////////////////////////////////////////////////////////////////////
-	//CREATE VIDEO THREAD
-	GLuint mFront_left, mFront_dleft, mFront_aleft, mBack_left, mBack_dleft, mBack_bg, mFront_bg, mFront_bgd, mBack_bgd, mFront_bbg, mBack_bbg, mFront_bbgd, mBack_bbgd, mBack_aleft, black_text, bga_text;
-	bool fl_write = false;
-	bool fl_terminate = false;
-	bool pause_all = false;
-	ARGS args = { &mFront_left, &mFront_dleft, &mFront_aleft, &mFront_bg, &mFront_bgd, &mFront_bbg, &mFront_bbgd, &mBack_left, &mBack_dleft, &mBack_aleft, &mBack_bg, &mBack_bgd, &mBack_bbg, &mBack_bbgd, &black_text, &bga_text, &fl_write, &fl_terminate, &pause_all};
-	
-	HANDLE threadDecoding;
-	threadDecoding = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)VideoThread, &args, 0, NULL);
-	///////////////////////////////////////////////////////////////////////////////////////////////////
+	//audio thread: waits for a state other than last and sets it to it; false to quit
+	bool Wait(State &last)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return quit || state.starts != last.starts || state.paused != last.paused; });
+		last = state;
+		return !quit;
+	}
+};
+AudioControl audioControl;
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////
-	//CREATE AUDIO THREAD
-	ARGS_aud args_aud = { &fl_write, &fl_terminate, &audiofile, &pause_all};
-	HANDLE threadAudioPlaying;
-	threadAudioPlaying = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)AudioThread, &args_aud, 0, NULL);
-	///////////////////////////////////////////////////////////////////////////////////////////////////
+//The seconds since a start on the steady clock, the performance counter on Windows, below the microsecond
+//where clock() ticks by the 15.6 ms of the system timer: the frame counter and the times of the profiler
+struct ScopedTimer
+{
+	std::chrono::steady_clock::time_point begin;
+	ScopedTimer() : begin(std::chrono::steady_clock::now()) {}
+	double Seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(); }
+	void Restart() { begin = std::chrono::steady_clock::now(); }
+};
+
+//The steps of the startup, done in parallel by the threads instead of after fixed sleeps: each prints
+//when it is done and how long after the start of the viewer
+struct StartupProgress
+{
+	std::chrono::steady_clock::time_point begin;
+	std::atomic<int> steps;
+	StartupProgress() : begin(std::chrono::steady_clock::now()), steps(0) {}
+	void Done(const char *step)
+	{
+		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+		printf("startup %d: %s after %lld ms\n", ++steps, step, ms);
+	}
+};
+StartupProgress startup;
+
+//The profile of the frames: the GPU times of the passes of every eye between GL_TIMESTAMP queries, which do
+//not nest in the GL_TIME_ELAPSED of the dynamic resolution, in two sets so that the marks of a frame are read
+//the frame after without waiting; the CPU time of ovr_SubmitFrame, and the CPU times of the decodes and the
+//uploads of the video threads since the last frame. A mark is named by the part of the frame it ends
+struct FrameProfiler
+{
+	static const int maxMarks = 32;
+	struct Mark { const char *name; int eye; };
+	GLuint queries[2][maxMarks];
+	Mark marks[2][maxMarks];
+	int numMarks[2];
+	long long frame;
+	bool enabled;
+	std::ofstream trace;
+	double submitMs;
+	std::atomic<long long> decodeMicros, uploadMicros;
+	std::map<std::string, double> sums;
+	int sumFrames;
+	FrameProfiler() : frame(0), enabled(false), submitMs(0), decodeMicros(0), uploadMicros(0), sumFrames(0) { numMarks[0] = numMarks[1] = 0; }
+
+	//the queries of the context of the render thread, again after a display lost
+	void Start(const std::string &filename)
+	{
+		if (!trace.is_open())
+		{
+			trace.open(filename.c_str());
+			trace << "frame,part,eye,ms\n";
+		}
+		glGenQueries(2 * maxMarks, &queries[0][0]);
+		numMarks[0] = numMarks[1] = 0;
+		enabled = true;
+	}
+	void Stop()
+	{
+		if (enabled)
+			glDeleteQueries(2 * maxMarks, &queries[0][0]);
+		enabled = false;
+	}
 
-	// Make eye render buffers
-	for (int eye = 0; eye < 2; ++eye)
+	void MarkGPU(const char *name, int eye = -1)
 	{
-		ovrSizei idealTextureSize = ovr_GetFovTextureSize(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye], 1);
-		eyeRenderTexture[eye] = new TextureBuffer(session, true, true, idealTextureSize, 1, NULL, 1);
-		eyeDepthBuffer[eye] = new DepthBuffer(eyeRenderTexture[eye]->GetSize(), 0);
+		int set = int(frame & 1);
+		if (!enabled || numMarks[set] == maxMarks)
+			return;
+		marks[set][numMarks[set]].name = name;
+		marks[set][numMarks[set]].eye = eye;
+		glQueryCounter(queries[set][numMarks[set]++], GL_TIMESTAMP);
+	}
+	void Decoded(double seconds) { if (enabled) decodeMicros += (long long)(seconds * 1e6); }
+	void Uploaded(double seconds) { if (enabled) uploadMicros += (long long)(seconds * 1e6); }
+	void Submitted(double seconds) { submitMs = seconds * 1000; }
 
-		if (!eyeRenderTexture[eye]->TextureChain)
+	//the CPU times of this frame, and the GPU times of the one before if its last query is done; the set of
+	//its queries is the one of the next frame
+	void EndFrame()
+	{
+		if (!enabled)
+			return;
+		Write(frame, "submit", -1, submitMs);
+		Write(frame, "decode", -1, decodeMicros.exchange(0) * 1e-3);
+		Write(frame, "upload", -1, uploadMicros.exchange(0) * 1e-3);
+		int set = int(++frame & 1);
+		GLint available = 0;
+		if (numMarks[set] > 1)
+			glGetQueryObjectiv(queries[set][numMarks[set] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
 		{
-			if (retryCreate) goto Done;
-			VALIDATE(false, "Failed to create texture.");
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(queries[set][0], GL_QUERY_RESULT, &begin);
+			for (int i = 1; i < numMarks[set]; i++, begin = end)
+			{
+				glGetQueryObjectui64v(queries[set][i], GL_QUERY_RESULT, &end);
+				Write(frame - 2, marks[set][i].name, marks[set][i].eye, double(end - begin) * 1e-6);
+			}
 		}
+		numMarks[set] = 0;
+		sumFrames++;
 	}
 
-	ovrMirrorTextureDesc desc;
-	memset(&desc, 0, sizeof(desc));
-	desc.Width = windowSize.w;
-	desc.Height = windowSize.h;
-	desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+	void Write(long long index, const char *name, int eye, double ms)
+	{
+		trace << index << "," << name << "," << eye << "," << ms << "\n";
+		std::string part = name;
+		if (eye >= 0)
+			part += eye ? " right" : " left";
+		sums[part] += ms;
+	}
 
-	// Create mirror texture and an FBO used to copy mirror texture to back buffer
-	result = ovr_CreateMirrorTextureGL(session, &desc, &mirrorTexture);
-	if (!OVR_SUCCESS(result))
+	//the means of the frames since the last print, in ms per frame
+	void Print()
+	{
+		if (!enabled || sumFrames == 0)
+			return;
+		std::cout << "profile:";
+		for (std::map<std::string, double>::iterator it = sums.begin(); it != sums.end(); ++it)
+			printf("  %s %.2f", it->first.c_str(), it->second / sumFrames);
+		std::cout << "\n";
+		sums.clear();
+		sumFrames = 0;
+	}
+};
+FrameProfiler profiler;
+
+//The telemetry of the session, a record per frame in a binary file next to the data of the session, to find
+//the sessions whose playback fell below the rate of the video: the head pose at the predicted display time,
+//the CPU time of the frame, the decodes since the last frame, the video frames dropped and repeated, and the
+//latest frame of ovr_GetPerfStats. The render thread only copies a record into a ring of one producer and
+//one consumer, a thread writes them out; a record that finds the ring full is counted as lost
+struct TelemetryRecord
+{
+	long long frame, videoFrame;
+	double displayTime;
+	float position[3], orientation[4];
+	float cpuMs, decodeMs;
+	int decodes, dropped, repeated, lost;
+	int quality;						//the quality_level of the frame
+	int perfCount, perfDropped;
+	ovrPerfStatsPerCompositorFrame perf;
+};
+
+struct TelemetryWriter
+{
+	static const int ringSize = 1024;
+	TelemetryRecord ring[ringSize];
+	std::atomic<long long> head, tail;	//written by the render thread, by the writer thread
+	std::atomic<bool> running;
+	std::atomic<long long> decodeMicros;
+	std::atomic<int> decodes;
+	std::thread writer;
+	std::ofstream file;
+	//the reports of the stall watchdog not written yet, text into the file of the stalls next to the telemetry
+	std::mutex stallMutex;
+	std::string stalls;
+	std::ofstream stallFile;
+	long long frame, lastVideoFrame;
+	int lost;
+	float gpuScale;						//the AdaptiveGpuPerformanceScale of the last record, for PowerGovernor
+	std::chrono::steady_clock::time_point last;
+	TelemetryWriter() : head(0), tail(0), running(false), decodeMicros(0), decodes(0), frame(0), lastVideoFrame(-1), lost(0), gpuScale(1) {}
+
+	//the file starts with a magic and the size of the records
+	bool Open(const std::string &filename)
 	{
-		if (retryCreate) goto Done;
-		VALIDATE(false, "Failed to create mirror texture.");
+		file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.good())
+		{
+			std::cout << "cannot write the telemetry to " << filename << "\n";
+			return false;
+		}
+		int size = sizeof(TelemetryRecord);
+		file.write("6DOFTEL1", 8);
+		file.write((const char*)&size, sizeof(size));
+		std::string stallName = filename.substr(0, filename.find_last_of('.')) + ".stalls";
+		stallFile.open(stallName.c_str(), std::ios::out | std::ios::trunc);
+		last = std::chrono::steady_clock::now();
+		running = true;
+		writer = std::thread(&TelemetryWriter::Flush, this);
+		return true;
 	}
 
-	// Configure the mirror read buffer
-	GLuint texId;
-	ovr_GetMirrorTextureBufferGL(session, mirrorTexture, &texId);
+	void Close()
+	{
+		if (!running)
+			return;
+		running = false;
+		writer.join();
+		file.close();
+		stallFile.close();
+	}
 
-	glGenFramebuffers(1, &mirrorFBO);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texId, 0);
-	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	//watchdog thread
+	void Stall(const std::string &report)
+	{
+		if (!running)
+			return;
+		std::lock_guard<std::mutex> lock(stallMutex);
+		stalls += report;
+	}
 
-	// Turn off vsync to let the compositor do its magic
-	wglSwapIntervalEXT(0);
+	//video threads
+	void Decoded(double seconds)
+	{
+		if (!running)
+			return;
+		decodeMicros += (long long)(seconds * 1e6);
+		decodes++;
+	}
 
-	
-	// FloorLevel will give tracking poses where the floor height is 0
-	ovr_SetTrackingOriginType(session, ovrTrackingOrigin_FloorLevel);
-	ovrTrackingState TrackingState;
-	TrackingState = ovr_GetTrackingState(session, 0, ovrTrue);
+	//render thread, once per frame submitted
+	void Record(ovrSession session, double displayTime, const ovrPosef &head, long long videoFrame)
+	{
+		if (!running)
+			return;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		long long h = this->head.load();
+		if (h - tail.load() == ringSize)
+		{
+			lost++;
+			last = now;
+			return;
+		}
+		TelemetryRecord &r = ring[h % ringSize];
+		r.frame = frame++;
+		r.videoFrame = videoFrame;
+		r.displayTime = displayTime;
+		r.position[0] = head.Position.x; r.position[1] = head.Position.y; r.position[2] = head.Position.z;
+		r.orientation[0] = head.Orientation.x; r.orientation[1] = head.Orientation.y;
+		r.orientation[2] = head.Orientation.z; r.orientation[3] = head.Orientation.w;
+		r.cpuMs = std::chrono::duration<float, std::milli>(now - last).count();
+		r.decodeMs = decodeMicros.exchange(0) * 1e-3f;
+		r.decodes = decodes.exchange(0);
+		//a video frame again, or frames of the video never drawn; none across a loop or a switch
+		r.repeated = videoFrame >= 0 && videoFrame == lastVideoFrame;
+		r.dropped = (lastVideoFrame >= 0 && videoFrame > lastVideoFrame + 1) ? int(videoFrame - lastVideoFrame - 1) : 0;
+		r.lost = lost;
+		r.quality = quality_level;
+		ovrPerfStats stats;
+		memset(&stats, 0, sizeof(stats));
+		ovr_GetPerfStats(session, &stats);
+		gpuScale = stats.AdaptiveGpuPerformanceScale;
+		r.perfCount = stats.FrameStatsCount;
+		r.perfDropped = stats.AnyFrameStatsDropped;
+		memset(&r.perf, 0, sizeof(r.perf));
+		if (stats.FrameStatsCount > 0)
+			r.perf = stats.FrameStats[0];
+		lastVideoFrame = videoFrame;
+		last = now;
+		this->head.store(h + 1);
+	}
 
-	Vector2i SphereSize;
-	//Currently fixed (can take the size of the video as input, but very large meshes are not supported) 
-	SphereSize.x = 2048;
-	SphereSize.y = 1024;
-	Vector3f spherecenter = TrackingState.HeadPose.ThePose.Position;
-	// Make scene
-	roomScene = new Scene(false, TrackingState.HeadPose.ThePose.Position, SphereSize);
-	Vector2f ScreenSize(hmdDesc.Resolution.w, hmdDesc.Resolution.h);
-	
-	//Pass the video texture each frame to the render call
-	//For now we are only passing the first image	
-	clock_t beginFrame = clock();
-	clock_t deltaClock = 0;
-	double deltaTime = 0;
-	unsigned int frames = 0;
-	double  frameRate = 30;
-	double  averageFrameTimeMilliseconds = 33.333;
-	// Main loop
-	clock_t timestamp = 0;
-	clock_t t_origin = 0;
-	bool write = false;
-	double DistX = 0.0;
-	double DistY = 0.0;
-	double DistZ = 0.0;
-	double circle = 0.0;
-	double radius = 100.0;
-	double th = 0.17*0.17;
-	clock_t StartTime = clock();
-	clock_t SpentTime = 0;
-	bool starting = true;
-	while (Platform.HandleMessages())
-	{ 
-		ovrSessionStatus sessionStatus;
-		ovr_GetSessionStatus(session, &sessionStatus);		
-		
-		if (starting == true & sessionStatus.HmdMounted)
+	//writer thread: the records of the ring every 100 ms, and the last ones when the telemetry is closed
+	void Flush()
+	{
+		SetThreadRole(RoleBackground);
+		for (bool more = true; more;)
 		{
-			Sleep(1500.0f);
-			TrackingState = ovr_GetTrackingState(session, frameIndex, ovrFalse);
-			roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
-			spherecenter = TrackingState.HeadPose.ThePose.Position;
-			starting = false;
+			more = running.load();
+			long long t = tail.load(), h = head.load();
+			for (; t < h; t++)
+				file.write((const char*)&ring[t % ringSize], sizeof(TelemetryRecord));
+			tail.store(t);
+			std::string reports;
+			{
+				std::lock_guard<std::mutex> lock(stallMutex);
+				reports.swap(stalls);
+			}
+			if (!reports.empty())
+				stallFile << reports << std::flush;
+			if (more)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		file.flush();
+	}
+};
+TelemetryWriter telemetry;
+
+//The watchdog of the threads that must not stall: the render loop, the video thread, the audio thread and the
+//decoders feed it with what they are doing as they go, and leave it while they wait for work. A thread fed longer
+//than stall_ms ago is reported once per stall, to the console and, with the call stack the SymbolLookup of
+//LibOVRKernel takes of it, into the telemetry. Util_Watchdog of LibOVRKernel only checks every 4 s, and terminates
+//the process after a minute of them
+struct StallWatchdog
+{
+	static const int maxDogs = 32;
+	enum { Free, Adding, Watched };
+	struct Dog
+	{
+		std::atomic<int> state;
+		char name[32];
+		DWORD threadId;
+		std::atomic<long long> fedUs;		//the steady clock when last fed, 0 while it waits for work
+		std::atomic<const char*> doing;
+		std::atomic<long long> item;
+		std::atomic<bool> stalled;			//reported, until it is fed again
+	};
+	Dog dogs[maxDogs];
+	std::atomic<bool> running;
+	std::thread watcher;
+	bool symbols;
+	OVR::SymbolLookup lookup;
+	StallWatchdog() : running(false), symbols(false)
+	{
+		for (int i = 0; i < maxDogs; i++)
+			dogs[i].state = Free;
+	}
+
+	static long long Microseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Start()
+	{
+		symbols = OVR::SymbolLookup::Initialize();
+		running = true;
+		watcher = std::thread(&StallWatchdog::Watch, this);
+	}
+
+	void Stop()
+	{
+		if (!running)
+			return;
+		running = false;
+		watcher.join();
+		if (symbols)
+			OVR::SymbolLookup::Shutdown();
+	}
 
+	//the thread calling it, not watched until it feeds it; NULL when all the dogs are taken
+	Dog *Add(const char *name)
+	{
+		for (int i = 0; i < maxDogs; i++)
+		{
+			int free = Free;
+			if (!dogs[i].state.compare_exchange_strong(free, Adding))
+				continue;
+			Dog &dog = dogs[i];
+			snprintf(dog.name, sizeof(dog.name), "%s", name);
+			dog.threadId = GetCurrentThreadId();
+			dog.fedUs = 0;
+			dog.doing = "";
+			dog.item = -1;
+			dog.stalled = false;
+			dog.state = Watched;
+			return &dog;
 		}
-	
-		/*if (fl_terminate == true)
+		return NULL;
+	}
+
+	//watchdog thread: the dogs every 50 ms
+	void Watch()
+	{
+		SetThreadRole(RoleBackground);
+		while (running)
 		{
-			//headpose << std::endl;
-			delete roomScene;
-			if (mirrorFBO) glDeleteFramebuffers(1, &mirrorFBO);
-			if (mirrorTexture) ovr_DestroyMirrorTexture(session, mirrorTexture);
-			for (int eye = 0; eye < 2; ++eye)
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			long long now = Microseconds();
+			for (int i = 0; i < maxDogs; i++)
 			{
-				delete eyeRenderTexture[eye];
-				delete eyeDepthBuffer[eye];
+				Dog &dog = dogs[i];
+				long long fed = dog.fedUs;
+				if (dog.state != Watched || fed == 0 || now - fed < stall_ms * 1000LL || dog.stalled)
+					continue;
+				dog.stalled = true;
+				Report(dog, (now - fed) / 1000);
 			}
-			Platform.ReleaseDevice();
-			ovr_Destroy(session);
-			//exit(0);
-			return 0;
 		}
-		*/
+	}
 
-		/////////////////////////////////////////////////////////////////////////////////////////////
+	void Report(const Dog &dog, long long ms)
+	{
+		char header[256];
+		snprintf(header, sizeof(header), "stall: %s for %lld ms %s %lld, at telemetry record %lld\n", dog.name, ms,
+			dog.doing.load(), dog.item.load(), telemetry.head.load());
+		std::cout << header;
+		std::string report = header;
+		OVR::String stack;
+		if (symbols && lookup.ReportThreadCallstack(stack, 0, (OVR::ThreadSysId)dog.threadId))
+			report += stack.ToCStr();
+		telemetry.Stall(report + "\n");
+	}
+};
+StallWatchdog stallWatchdog;
+
+//A thread watched by the stall watchdog from its construction to its destruction, on the thread itself
+struct WatchedThread
+{
+	StallWatchdog::Dog *dog;
+	WatchedThread(const char *name) : dog(stallWatchdog.Add(name)) {}
+	~WatchedThread()
+	{
+		if (dog)
+			dog->state = StallWatchdog::Free;
+	}
+
+	//watched from now on, doing item; true once the thread is back from a stall reported
+	bool Feed(const char *doing, long long item = -1)
+	{
+		if (!dog)
+			return false;
+		bool back = Back();
+		dog->doing = doing;
+		dog->item = item;
+		dog->fedUs = StallWatchdog::Microseconds();
+		return back;
+	}
+
+	//not watched while the thread waits for work, true as Feed's
+	bool Disable()
+	{
+		if (!dog)
+			return false;
+		bool back = Back();
+		dog->fedUs = 0;
+		return back;
+	}
+
+	bool Back()
+	{
+		if (!dog->stalled.exchange(false))
+			return false;
+		long long ms = (StallWatchdog::Microseconds() - dog->fedUs) / 1000;
+		std::cout << dog->name << " back after " << ms << " ms " << dog->doing.load() << " " << dog->item.load() << "\n";
+		return true;
+	}
+};
+
+//The compact trace of the head poses: a record per frame of the time of its display from the first one and of
+//the pose, kept in memory by the render thread and written when the viewer quits, so no frame waits on the disk
+struct PoseRecorder
+{
+	struct Record { float time, position[3], orientation[4]; };
+	std::vector<Record> records;
+	double firstTime;
+	PoseRecorder() : firstTime(0) {}
+
+	void Add(double displayTime, const ovrPosef &pose)
+	{
+		if (records.empty())
+		{
+			firstTime = displayTime;
+			records.reserve(90 * 600);
+		}
+		Record r = { float(displayTime - firstTime), { pose.Position.x, pose.Position.y, pose.Position.z },
+			{ pose.Orientation.x, pose.Orientation.y, pose.Orientation.z, pose.Orientation.w } };
+		records.push_back(r);
+	}
+
+	//the file starts with a magic and the size of the records, as the telemetry
+	bool Write(const std::string &filename) const
+	{
+		std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		int size = sizeof(Record);
+		file.write("6DOFPOS1", 8);
+		file.write((const char*)&size, sizeof(size));
+		if (!records.empty())
+			file.write((const char*)&records[0], records.size() * sizeof(Record));
+		if (!file.good())
+			std::cout << "cannot write the pose trace to " << filename << "\n";
+		return file.good();
+	}
+};
+PoseRecorder poseRecorder;
+
+//A trace of head poses to draw the frames of, one per frame: a pose trace of PoseRecorder, or the head poses
+//of the records of a telemetry, or the keyframes of a camera path, a text file of lines
+//	<seconds> <x> <y> <z> <yaw> <pitch>
+//in meters and degrees. The times are the seconds of the poses from the first one
+struct PoseTrace
+{
+	std::vector<ovrPosef> poses;
+	std::vector<double> times;
+
+	static ovrPosef Pose(const float position[3], const float orientation[4])
+	{
+		ovrPosef pose;
+		pose.Position.x = position[0]; pose.Position.y = position[1]; pose.Position.z = position[2];
+		pose.Orientation.x = orientation[0]; pose.Orientation.y = orientation[1];
+		pose.Orientation.z = orientation[2]; pose.Orientation.w = orientation[3];
+		return pose;
+	}
+
+	bool ReadPath(const std::string &filename)
+	{
+		std::ifstream file(filename.c_str());
+		double time;
+		float x, y, z, yaw, pitch;
+		while (file >> time >> x >> y >> z >> yaw >> pitch)
+		{
+			Posef pose(Quatf(Vector3f(0, 1, 0), yaw * MATH_FLOAT_PI / 180) * Quatf(Vector3f(1, 0, 0), pitch * MATH_FLOAT_PI / 180),
+				Vector3f(x, y, z));
+			if (!times.empty() && time <= times.back())
+				continue;
+			poses.push_back(pose);
+			times.push_back(time);
+		}
+		if (poses.empty())
+			std::cout << filename << " has no keyframes\n";
+		return !poses.empty();
+	}
+
+	bool Read(const std::string &filename)
+	{
+		if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".txt") == 0)
+			return ReadPath(filename);
+		std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+		char magic[8];
+		int size = 0;
+		if (!file.read(magic, 8) || !file.read((char*)&size, sizeof(size)))
+			size = 0;
+		bool isTrace = memcmp(magic, "6DOFPOS1", 8) == 0 && size == sizeof(PoseRecorder::Record);
+		if (!isTrace && (memcmp(magic, "6DOFTEL1", 8) != 0 || size != sizeof(TelemetryRecord)))
+		{
+			std::cout << filename << " is neither a pose trace nor a telemetry of this viewer\n";
+			return false;
+		}
+		PoseRecorder::Record p;
+		TelemetryRecord r;
+		double firstTime = 0;
+		while (isTrace ? bool(file.read((char*)&p, sizeof(p))) : bool(file.read((char*)&r, sizeof(r))))
+		{
+			if (!isTrace && poses.empty())
+				firstTime = r.displayTime;
+			poses.push_back(isTrace ? Pose(p.position, p.orientation) : Pose(r.position, r.orientation));
+			times.push_back(isTrace ? double(p.time) : r.displayTime - firstTime);
+		}
+		if (poses.empty())
+			std::cout << filename << " has no frames\n";
+		return !poses.empty();
+	}
+
+	//the pose at seconds from the first one, interpolated between the two around it, the last one after the end
+	ovrPosef At(double seconds) const
+	{
+		size_t next = std::upper_bound(times.begin(), times.end(), seconds) - times.begin();
+		if (next == 0 || next == times.size())
+			return poses[next == 0 ? 0 : next - 1];
+		float f = float((seconds - times[next - 1]) / (times[next] - times[next - 1]));
+		Posef a(poses[next - 1]), b(poses[next]);
+		return Posef(a.Rotation.Slerp(b.Rotation, f), a.Translation.Lerp(b.Translation, f));
+	}
+
+	//the seconds of the trace
+	double Duration() const
+	{
+		return times.empty() ? 0 : times.back();
+	}
+};
+PoseTrace poseReplay;
+
+//The direction the head is predicted to look in a moment, in the coordinates of the sphere, set by the
+//render thread for the tiles of the grid the video thread keeps decoded
+struct ViewDirection
+{
+	std::atomic<float> x, y, z;
+	ViewDirection() : x(0), y(0), z(-1) {}
+};
+ViewDirection viewDirection;
+
+//The orientation of the head for the ambisonic audio, set by the render thread every frame and read by the
+//mixer of irrKlang for every block it mixes: the four components in 16 bits each of one word, so it is never
+//read torn and neither thread waits for the other
+struct HeadOrientation
+{
+	std::atomic<unsigned long long> packed;
+	HeadOrientation() { Set(Quatf()); }
+
+	void Set(const Quatf &q)
+	{
+		const float c[4] = { q.x, q.y, q.z, q.w };
+		unsigned long long word = 0;
+		for (int i = 0; i < 4; i++)
+			word |= (unsigned long long)(unsigned short)(short)((std::max)(-1.0f, (std::min)(c[i], 1.0f)) * 32767) << (16 * i);
+		packed = word;
+	}
+
+	Quatf Get() const
+	{
+		unsigned long long word = packed.load();
+		float c[4];
+		for (int i = 0; i < 4; i++)
+			c[i] = (short)(unsigned short)(word >> (16 * i)) / 32767.0f;
+		Quatf q(c[0], c[1], c[2], c[3]);
+		q.Normalize();
+		return q;
+	}
+};
+HeadOrientation headOrientation;
+
+//The render parameters of settings.json, next to settings.txt: read at startup after it, and again whenever
+//the file is saved while the viewer runs, so the modes and the costs of the rendering are compared without a
+//restart. A value out of its range is reported and the one in use kept. Any of
+//	{ "RenderingMode": "ours" | "static" | "simple", "VisualConstraint": "fade" | "Clamp" | "None",
+//	  "LayerCount": 1 to 3, "Tessellation": [<pixels>, <depth gain>], "Foveation": [<inner>, <outer>],
+//	  "LayerGamma": 0.25 to 4 }
+//the foveation of the eye buffers if it is on in settings.txt
+struct LiveSettings
+{
+	std::string filename;
+	FILETIME written;
+	std::chrono::steady_clock::time_point checked;
+	LiveSettings(const char *name) : filename(name), checked(std::chrono::steady_clock::now())
+	{
+		written.dwLowDateTime = written.dwHighDateTime = 0;
+	}
+
+	//the time the file was last saved, 0 if there is none
+	FILETIME WriteTime() const
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data))
+			data.ftLastWriteTime.dwLowDateTime = data.ftLastWriteTime.dwHighDateTime = 0;
+		return data.ftLastWriteTime;
+	}
+
+	static bool InRange(const char *key, double value, double low, double high)
+	{
+		if (value >= low && value <= high)
+			return true;
+		std::cout << key << " " << value << " of settings.json is not within " << low << " and " << high << ", kept\n";
+		return false;
+	}
+
+	//the settings of the file applied, false if there is none or it does not parse
+	bool Load()
+	{
+		written = WriteTime();
+		if (!written.dwLowDateTime && !written.dwHighDateTime)
+			return false;
+		const char *error = NULL;
+		JSON *root = JSON::Load(filename.c_str(), &error);
+		if (!root)
+		{
+			std::cout << filename << ": " << (error ? error : "cannot be read") << ", the settings kept\n";
+			return false;
+		}
+		JSON *item = root->GetItemByName("RenderingMode");
+		if (item && item->Type == JSON_String)
+		{
+			if (item->Value == "ours" || item->Value == "static" || item->Value == "simple")
+			{
+				positional_track = item->Value != "static";
+				render_simple = item->Value == "simple";
+				snprintf(mode, sizeof(mode), "%s", item->Value.ToCStr());
+			}
+			else
+				std::cout << "RenderingMode " << item->Value.ToCStr() << " of settings.json is not ours, static or simple, kept\n";
+		}
+		item = root->GetItemByName("VisualConstraint");
+		if (item && item->Type == JSON_String)
+		{
+			vis_fade = item->Value == "fade";
+			vis_clamp = item->Value == "Clamp";
+			snprintf(visID, sizeof(visID), "%s", vis_fade || vis_clamp ? item->Value.ToCStr() : "None");
+		}
+		item = root->GetItemByName("LayerCount");
+		if (item && item->Type == JSON_Number && InRange("LayerCount", item->dValue, 1, 3))
+			layers = item->dValue;
+		float values[2];
+		if (root->GetArrayByName("Tessellation", values, 2) == 2 && InRange("Tessellation", values[0], 1, 64) &&
+			InRange("Tessellation", values[1], 0, 64))
+		{
+			tess_pixels = values[0];
+			tess_depth_gain = values[1];
+		}
+		item = root->GetItemByName("LayerGamma");
+		if (item && item->Type == JSON_Number && InRange("LayerGamma", item->dValue, 0.25, 4))
+			layer_gamma = float(item->dValue);
+		if (root->GetArrayByName("Foveation", values, 2) == 2 && InRange("Foveation", values[0], 0, 4) &&
+			InRange("Foveation", values[1], values[0], 4))
+		{
+			fovea_inner = values[0];
+			fovea_outer = values[1];
+		}
+		root->Release();
+		return true;
+	}
+
+	//render thread: the settings loaded again if the file was saved since, checked once a second
+	bool Poll()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - checked < std::chrono::seconds(1))
+			return false;
+		checked = now;
+		FILETIME time = WriteTime();
+		if (CompareFileTime(&time, &written) == 0)
+			return false;
+		bool loaded = Load();
+		if (loaded)
+			std::cout << "settings.json reloaded: " << mode << ", " << visID << ", " << layers << " layers\n";
+		return loaded;
+	}
+};
+LiveSettings liveSettings("settings.json");
+
+//The governor of the quality: the GPU time of the frames averaged over windows of windowFrames, the quality_level
+//stepped down a level when a window takes more than 90% of the budget of a frame, and up when windowsUp of them in a
+//row take less than 60%, with the dynamic resolution at its minimum and at its maximum respectively if it is on, so
+//the two do not pull against each other. No step follows another within holdFrames. The tessellation and the
+//foveation of the coarser levels are set on the scene here, the layers and the mode read by DrawEyes; every
+//transition is printed, and the level of every frame is in the telemetry
+struct QualityGovernor
+{
+	static const int windowFrames = 45, windowsUp = 4, levels = 4;
+	float budgetMs;
+	int holdFrames, held, frames, below;
+	double sumMs;
+
+	QualityGovernor(float refreshRate) : budgetMs(1000.0f / refreshRate), holdFrames(int(2 * refreshRate)), held(0), frames(0), below(0), sumMs(0) {}
+
+	void Update(float ms, const ResolutionScaler *scaler, Scene *scene, FoveationImage *foveation[2])
+	{
+		held++;
+		sumMs += ms;
+		if (++frames < windowFrames)
+			return;
+		float mean = float(sumMs / frames);
+		frames = 0;
+		sumMs = 0;
+		below = mean < 0.6f * budgetMs ? below + 1 : 0;
+		if (held < holdFrames)
+			return;
+		int level = quality_level;
+		if (mean > 0.9f * budgetMs && level < levels - 1 && (!scaler || scaler->AtMin()))
+			level++;
+		else if (below >= windowsUp && level > (lowPower.load() ? power_quality : 0) && (!scaler || scaler->AtMax()))
+			level--;
+		if (level == quality_level)
+			return;
+		std::cout << "quality " << quality_level << " -> " << level << ", " << mean << " ms of " << budgetMs << " ms per frame\n";
+		quality_level = level;
+		held = 0;
+		below = 0;
+		Apply(scene, foveation);
+	}
+
+	//the tessellation and the foveation of the level, over the ones of the settings
+	static void Apply(Scene *scene, FoveationImage *foveation[2])
+	{
+		float coarse = quality_level >= 1 ? 2.0f : 1.0f;
+		scene->Models[0]->tessPixels = tess_pixels * coarse;
+		for (int eye = 0; eye < 2; ++eye)
+			if (foveation[eye])
+				foveation[eye]->SetRadii(fovea_inner / coarse, fovea_outer / coarse);
+	}
+};
+
+//The governor of the power mode, polled every second: the low power mode on while the system runs on its battery
+//or its battery saver, or while the compositor scales the GPU performance it asks for below throttleScale, its sign of
+//a GPU that does not keep up, throttled by its heat; and off again when none of them holds. A state takes holdSeconds
+//in a row to switch the mode, so a plug pulled for a moment or a scale that dips once does not flip it. The quality
+//of the mode is set here, the one before it back when it ends unless the quality governor steps it; every
+//transition is printed
+struct PowerGovernor
+{
+	static const int holdSeconds = 5;
+	static constexpr float throttleScale = 0.9f;
+	int seconds, savedLevel;
+
+	PowerGovernor() : seconds(0), savedLevel(quality_level) {}
+
+	void Update(float gpuScale, Scene *scene, FoveationImage *foveation[2])
+	{
+		bool low = power_mode == 1;
+		if (power_mode == 2)
+		{
+			SYSTEM_POWER_STATUS status;
+			bool battery = GetSystemPowerStatus(&status) && (status.ACLineStatus == 0 || status.SystemStatusFlag == 1);
+			bool throttled = gpuScale > 0 && gpuScale < throttleScale;
+			low = battery || throttled;
+			seconds = low != lowPower.load() ? seconds + 1 : 0;
+			if (seconds < holdSeconds)
+				return;
+			std::cout << "low power " << (low ? "on" : "off") << (battery ? ", on the battery" : "") << ", GPU scale " << gpuScale << "\n";
+		}
+		if (low == lowPower.load())
+			return;
+		seconds = 0;
+		lowPower.store(low);
+		if (low)
+		{
+			savedLevel = quality_level;
+			quality_level = (std::max)(quality_level, power_quality);
+		}
+		else if (!quality_governor)
+			quality_level = savedLevel;
+		QualityGovernor::Apply(scene, foveation);
+	}
+};
+
+void VideoThread(LPVOID pArgs_);
+void AudioThread(LPVOID pArgs_);
+
+
+static ovrGraphicsLuid GetDefaultAdapterLuid()
+{
+	ovrGraphicsLuid luid = ovrGraphicsLuid();
+
+#if defined(_WIN32)
+	IDXGIFactory* factory = nullptr;
+
+	if (SUCCEEDED(CreateDXGIFactory(IID_PPV_ARGS(&factory))))
+	{
+		IDXGIAdapter* adapter = nullptr;
+
+		if (SUCCEEDED(factory->EnumAdapters(0, &adapter)))
+		{
+			DXGI_ADAPTER_DESC desc;
+
+			adapter->GetDesc(&desc);
+			memcpy(&luid, &desc.AdapterLuid, sizeof(luid));
+			adapter->Release();
+		}
+
+		factory->Release();
+	}
+#endif
+
+	return luid;
+}
+
+
+static int Compare(const ovrGraphicsLuid& lhs, const ovrGraphicsLuid& rhs)
+{
+	return memcmp(&lhs, &rhs, sizeof(ovrGraphicsLuid));
+}
+
+//The scene of the sphere centered at the head, its programs from the cache where they are there, for eye
+//buffers of eyeSize
+static Scene *BuildScene(Vector3f center, Sizei eyeSize, bool multiview)
+{
+	Vector2i SphereSize;
+	//The mesh is built and uploaded at startup, the procedural sphere has no buffers and any density
+	SphereSize.x = sphere_rings;
+	SphereSize.y = sphere_slices;
+	if (shader_cache.empty())
+	{
+		CHAR programname[MAX_PATH] = {};
+		std::string executable(programname, GetModuleFileNameA(NULL, programname, MAX_PATH));
+		shader_cache = executable.substr(0, executable.find_last_of("\\/") + 1) + "ShaderCache";
+	}
+	if (shader_cache != "off")
+	{
+		CreateDirectoryA(shader_cache.c_str(), NULL);
+		programCacheDirectory = shader_cache;
+	}
+	if (top_bottom && multi_sphere > 0)
+		std::cout << "the atlas of the multi-sphere image is mono, its top-bottom stereo is left off\n";
+	Scene *roomScene = new Scene(false, center, SphereSize, sphere_mode, multiview, composite_layers, depth_filter > 0, top_bottom && multi_sphere <= 0);
+	roomScene->Models[0]->tessViewport = Vector2f(float(eyeSize.w), float(eyeSize.h));
+	roomScene->Models[0]->tessPixels = tess_pixels;
+	roomScene->Models[0]->tessDepthGain = tess_depth_gain;
+	roomScene->Models[0]->earlyZ = early_z;
+	roomScene->InitPassModels(layer_mesh);
+	roomScene->SetGrade(layer_gamma);
+	if (multi_sphere > 0 && !roomScene->InitMultiSphere(multiview, multi_sphere, msi_columns, cull_near, 1.0f))
+		std::cout << "The multi-sphere image does not link, its atlas is drawn as the color of the sphere\n";
+	if (ray_march > 0 && multi_sphere <= 0 && !roomScene->InitRayMarch(multiview, ray_march, cull_near, 1.0f))
+		std::cout << "The ray marching does not link, the sphere is drawn\n";
+	if (bake_background && !roomScene->marchShader && !roomScene->msiShader && !roomScene->InitBakedBackground(multiview))
+		std::cout << "The background is not one to bake, its vertex shader displaces it every frame\n";
+	roomScene->Models[0]->culling = culling;
+	roomScene->Models[0]->alphaCulling = alpha_culling;
+	roomScene->Models[0]->cullNear = cull_near;
+	roomScene->Models[0]->lodAngle = layer_lod * float(M_PI) / 180;
+	return roomScene;
+}
+
+//The views of both eyes of a frame, from the pose of the head and the offsets and the fields of view of the
+//eyes; the centered ones from the center of the sphere, for the static mode
+struct EyeViews
+{
+	ovrPosef pose[2];
+	Matrix4f view[2], viewCentered[2], proj[2];
+	Vector3f EyePos[2];
+
+	EyeViews(const ovrPosef &head, Vector3f spherecenter, const ovrVector3f HmdToEyeOffset[2], const ovrFovPort fov[2])
+	{
+		ovrPosef FinalEyePosCentered[2];
+		ovr_CalcEyePoses(head, HmdToEyeOffset, pose);//Output: the orientation and the position of the eyes (head & IPD offset)
+		ovrPosef centered;
+		centered.Position = spherecenter;
+		centered.Orientation = head.Orientation;
+		ovr_CalcEyePoses(centered, HmdToEyeOffset, FinalEyePosCentered);
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			Matrix4f rollPitchYaw = Matrix4f(pose[eye].Orientation);
+			EyePos[eye] = pose[eye].Position;
+			Vector3f finalUp = rollPitchYaw.Transform(Vector3f(0, 1, 0));//
+			Vector3f finalForward = rollPitchYaw.Transform(Vector3f(0, 0, -1));//
+			view[eye] = Matrix4f::LookAtRH(EyePos[eye], EyePos[eye] + finalForward, finalUp);
+			proj[eye] = ovrMatrix4f_Projection(fov[eye], 0.2f, 1000.0f, ovrProjection_None);
+			Vector3f EyePosCentered = FinalEyePosCentered[eye].Position;
+			viewCentered[eye] = Matrix4f::LookAtRH(EyePosCentered, EyePosCentered + finalForward, finalUp);
+		}
+	}
+
+	//the poses and the fields of view of both eyes as the runtime locates them, OpenXR's; the centered ones
+	//moved by the head to the center of the sphere
+	EyeViews(const ovrPosef eyePose[2], const ovrPosef &head, Vector3f spherecenter, const ovrFovPort fov[2])
+	{
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			pose[eye] = eyePose[eye];
+			Matrix4f rollPitchYaw = Matrix4f(pose[eye].Orientation);
+			EyePos[eye] = pose[eye].Position;
+			Vector3f finalUp = rollPitchYaw.Transform(Vector3f(0, 1, 0));
+			Vector3f finalForward = rollPitchYaw.Transform(Vector3f(0, 0, -1));
+			view[eye] = Matrix4f::LookAtRH(EyePos[eye], EyePos[eye] + finalForward, finalUp);
+			proj[eye] = ovrMatrix4f_Projection(fov[eye], 0.2f, 1000.0f, ovrProjection_None);
+			Vector3f EyePosCentered = EyePos[eye] - Vector3f(head.Position) + spherecenter;
+			viewCentered[eye] = Matrix4f::LookAtRH(EyePosCentered, EyePosCentered + finalForward, finalUp);
+		}
+	}
+};
+
+//The passes of the rendering mode into the eye buffers, both at once with the multiview, and the fade outside
+//the comfort radius around the center of the sphere: the frames of the HMD and of the headless benchmark
+static void DrawEyes(Scene *roomScene, Vector2f ScreenSize, Vector3f spherecenter, Vector3f HeadPos, const EyeViews &eyes,
+	TextureBuffer *eyeRenderTexture[2], DepthBuffer *eyeDepthBuffer[2], MultiviewBuffer *multiviewBuffer, FoveationImage *foveation[2])
+{
+	// Render world
+	float desat = 0.0;
+	const double th = 0.17*0.17;
+	if (vis_fade == true)
+	{
+		double DistX = (spherecenter.x - HeadPos.x);
+		double DistZ = (spherecenter.z - HeadPos.z);
+		double DistY = (spherecenter.y - HeadPos.y);
+		double circle = DistX*DistX + DistZ*DistZ;
+		double th_mult = 5;
+		if (circle > th)
+		{
+			desat = float(th_mult*circle);
+			desat = fmin(desat, 1.0);
+		}
+	}
+
+	// The fade outside the comfort radius, a faded ring and a black one beyond 1/th_mult: two more
+	// passes of RenderBlack, or a part of the composite pass
+	double fadeDistX = (spherecenter.x - HeadPos.x);
+	double fadeDistZ = (spherecenter.z - HeadPos.z);
+	double fadeDistY = (spherecenter.y - HeadPos.y);
+	double fadeCircle = fadeDistX*fadeDistX + fadeDistZ*fadeDistZ + fadeDistY*fadeDistY;
+	double fade_mult = 10;
+	float fadeRadius = 0, blackRadius = 0;
+	if (vis_fade == true && fadeCircle > th)
+	{
+		fadeRadius = 0.35f;
+		if (fadeCircle > (1.0 / fade_mult))
+			blackRadius = 0.8f;
+	}
+	//the layers and the mode of the quality the governor keeps
+	double layers = quality_level >= 2 ? (std::min)(::layers, 2.0) : ::layers;
+	bool render_simple = ::render_simple || quality_level >= 3;
+	bool fadeComposite = positional_track == true && render_simple == false && roomScene->IsComposite(layers);
+	if (fadeComposite)
+		roomScene->SetFade(fadeRadius > 0 ? float(fade_mult*fadeCircle) : 0.0f, fadeRadius, blackRadius);
+	else
+		roomScene->SetFade(0, 0, 0);
+
+	// Render Scene to Eye Buffers, both at once with the multiview
+	int views = multiviewBuffer ? 2 : 1;
+	for (int eye = 0; eye < 2; eye += views)
+	{
+		// Switch to eye render target
+		if (multiviewBuffer)
+			multiviewBuffer->SetAndClearRenderSurface();
+		else
+			eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+		if (foveation[eye])
+			foveation[eye]->Enable();
+		roomScene->SetColorView(eye);
+
+		//the previews of the gallery instead of the layers, from where the head is
+		if (roomScene->galleryShown)
+		{
+			roomScene->RenderGallery(spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.view[eye], &eyes.proj[eye], views);
+			profiler.MarkGPU("gallery", eye);
+			if (foveation[eye])
+				FoveationImage::Disable();
+			continue;
+		}
+
+		if (positional_track == true & render_simple == false)
+		{
+			roomScene->Render(ScreenSize, spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.view[eye], &eyes.proj[eye], views, poly_mesh, stereo, render_depth, colored, layers, desat);
+			profiler.MarkGPU("render", eye);
+		}
+		if (positional_track == false)
+		{
+			roomScene->RenderSimple(ScreenSize, spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.viewCentered[eye], &eyes.proj[eye], views, poly_mesh, stereo, render_depth, colored, layers, desat);
+			profiler.MarkGPU("simple", eye);
+		}				
+
+		if (positional_track == true & render_simple == true)
+		{
+			roomScene->RenderSimple(ScreenSize, spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.view[eye], &eyes.proj[eye], views, poly_mesh, stereo, render_depth, colored, layers, desat);
+			profiler.MarkGPU("simple", eye);
+		}
+		
+		
+		if (fadeRadius > 0 && !fadeComposite)
+		{
+			roomScene->RenderBlack(ScreenSize, spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.view[eye], &eyes.proj[eye], views, poly_mesh, stereo, render_depth, colored, layers, fade_mult*fadeCircle, fadeRadius, false);
+			if (blackRadius > 0)
+				roomScene->RenderBlack(ScreenSize, spherecenter, &eyes.EyePos[eye], HeadPos, &eyes.view[eye], &eyes.proj[eye], views, poly_mesh, stereo, render_depth, colored, layers, fade_mult*fadeCircle, blackRadius, true);
+			profiler.MarkGPU("black", eye);
+		}
+		if (foveation[eye])
+			FoveationImage::Disable();
+	}
+}
+
+//The passes of every mode drawn once, on the textures of the first frame of the video, into a target of a few pixels
+//of the formats of the eye buffers and of their samples, or into a multiview one: the driver compiles the programs
+//for their states and the formats of the textures bound, and allocates what it allocates on first use, before the
+//first frame the HMD shows instead of in it. Render with every count of layers up to the ones set, composite or not,
+//RenderSimple, the faded and the black RenderBlack, colored and not, desaturated by the fade and not, and the gallery
+static void WarmUpPasses(Scene *roomScene, Vector2f ScreenSize, Vector3f spherecenter, const EyeViews &eyes, bool multiview, int samples)
+{
+	ScopedTimer warming;
+	Sizei size(16, 16);
+	TextureBuffer target(nullptr, true, false, size, 1, NULL, 1);
+	DepthBuffer depth(size, 0);
+	MultiviewBuffer *multiviewTarget = multiview ? new MultiviewBuffer(size) : nullptr;
+	if (!multiviewTarget && samples > 1)
+		target.Multisample(samples);
+	int views = multiview ? 2 : 1;
+	if (multiviewTarget)
+		multiviewTarget->SetAndClearRenderSurface();
+	else
+		target.SetAndClearRenderSurface(&depth);
+	Vector3f HeadPos = eyes.EyePos[0];
+	for (int layerCount = 1; layerCount <= (std::max)(int(layers + 0.5), 1); layerCount++)
+		for (int fade = 0; fade < 2; fade++)
+			for (int color = 0; color < 2; color++)
+			{
+				float desat = fade ? 0.5f : 0.0f;
+				roomScene->SetFade(fade ? 1.0f : 0.0f, fade ? 0.35f : 0.0f, fade ? 0.8f : 0.0f);
+				roomScene->Render(ScreenSize, spherecenter, &eyes.EyePos[0], HeadPos, &eyes.view[0], &eyes.proj[0], views, poly_mesh, stereo, render_depth, color == 1, layerCount, desat);
+				roomScene->RenderSimple(ScreenSize, spherecenter, &eyes.EyePos[0], HeadPos, &eyes.viewCentered[0], &eyes.proj[0], views, poly_mesh, stereo, render_depth, color == 1, layerCount, desat);
+			}
+	roomScene->SetFade(0, 0, 0);
+	roomScene->RenderBlack(ScreenSize, spherecenter, &eyes.EyePos[0], HeadPos, &eyes.view[0], &eyes.proj[0], views, poly_mesh, stereo, render_depth, colored, layers, 1.0, 0.35f, false);
+	roomScene->RenderBlack(ScreenSize, spherecenter, &eyes.EyePos[0], HeadPos, &eyes.view[0], &eyes.proj[0], views, poly_mesh, stereo, render_depth, colored, layers, 1.0, 0.8f, true);
+	if (roomScene->galleryShader)
+		roomScene->RenderGallery(spherecenter, &eyes.EyePos[0], HeadPos, &eyes.view[0], &eyes.proj[0], views);
+	if (!multiviewTarget)
+		target.UnsetRenderSurface();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glFinish();
+	delete multiviewTarget;
+	std::cout << "the passes are warmed up in " << int(warming.Seconds() * 1000) << " ms\n";
+}
+
+//The layer of the color and the depth of the eyes, which LibOVR 1.15 does not declare and its compositor takes as
+//the type 2 of the layers: an ovrLayerEyeFov followed by the depth of the eyes and the terms of their projection
+struct LayerEyeFovDepth
+{
+	ovrLayerHeader Header;
+	ovrTextureSwapChain ColorTexture[ovrEye_Count];
+	ovrRecti Viewport[ovrEye_Count];
+	ovrFovPort Fov[ovrEye_Count];
+	ovrPosef RenderPose[ovrEye_Count];
+	double SensorSampleTime;
+	ovrTextureSwapChain DepthTexture[ovrEye_Count];
+	ovrTimewarpProjectionDesc ProjectionDesc;
+};
+const ovrLayerType layerTypeEyeFovDepth = ovrLayerType(2);
+
+//The stats in the headset as a quad layer of the compositor, of a small swapchain of its own: its lines are
+//drawn by GDI into a bitmap and uploaded only when Draw is given them, once a second with the FPS counter, so
+//that the overlay draws nothing into the eye buffers and is sampled once by the compositor, not once more after
+//the timewarp of the eyes. White on translucent black, premultiplied as the compositor blends it; head locked,
+//a meter ahead and below the center of the view
+struct StatsOverlay
+{
+	TextureBuffer *texture;
+	HDC dc;
+	HBITMAP bitmap;
+	HFONT font;
+	unsigned char *bits;
+	Sizei size;
+
+	StatsOverlay(ovrSession session, Sizei _size) : texture(nullptr), dc(NULL), bitmap(NULL), font(NULL), bits(nullptr), size(_size)
+	{
+		texture = new TextureBuffer(session, true, true, size, 1, NULL, 1);
+		BITMAPINFO info = {};
+		info.bmiHeader.biSize = sizeof(info.bmiHeader);
+		info.bmiHeader.biWidth = size.w;
+		info.bmiHeader.biHeight = -size.h;		//top-down, the rows as the compositor takes them
+		info.bmiHeader.biPlanes = 1;
+		info.bmiHeader.biBitCount = 32;
+		info.bmiHeader.biCompression = BI_RGB;
+		dc = CreateCompatibleDC(NULL);
+		bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, (void**)&bits, NULL, 0);
+		font = CreateFontA(size.h / 5, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+			ANTIALIASED_QUALITY, FIXED_PITCH | FF_MODERN, "Consolas");
+		SelectObject(dc, bitmap);
+		SelectObject(dc, font);
+		SetBkMode(dc, TRANSPARENT);
+		SetTextColor(dc, RGB(255, 255, 255));
+	}
+
+	~StatsOverlay()
+	{
+		DeleteDC(dc);
+		DeleteObject(bitmap);
+		DeleteObject(font);
+		delete texture;
+	}
+
+	bool Valid() const
+	{
+		return texture->TextureChain && bits;
+	}
+
+	//the lines into the current texture of the chain, committed
+	void Draw(const std::vector<std::string> &lines)
+	{
+		memset(bits, 0, size_t(size.w) * size.h * 4);
+		int lineHeight = size.h / (std::max)(int(lines.size()), 1);
+		for (size_t i = 0; i < lines.size(); i++)
+			TextOutA(dc, lineHeight / 4, int(i) * lineHeight, lines[i].c_str(), int(lines[i].size()));
+		GdiFlush();
+		//the alpha of the gray of the antialiased text over the black at half, never below its color
+		for (int i = 0; i < size.w * size.h; i++)
+		{
+			unsigned char *pixel = bits + 4 * i;
+			pixel[3] = (unsigned char)(128 + pixel[1] / 2);
+		}
+		GLuint curTexId;
+		int curIndex;
+		ovr_GetTextureSwapChainCurrentIndex(texture->Session, texture->TextureChain, &curIndex);
+		ovr_GetTextureSwapChainBufferGL(texture->Session, texture->TextureChain, curIndex, &curTexId);
+		glBindTexture(GL_TEXTURE_2D, curTexId);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.w, size.h, GL_BGRA, GL_UNSIGNED_BYTE, bits);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture->Commit();
+	}
+
+	ovrLayerQuad Layer() const
+	{
+		ovrLayerQuad layer = {};
+		layer.Header.Type = ovrLayerType_Quad;
+		layer.Header.Flags = ovrLayerFlag_HeadLocked;
+		layer.ColorTexture = texture->TextureChain;
+		layer.Viewport = Recti(0, 0, size.w, size.h);
+		layer.QuadPoseCenter.Orientation.w = 1;
+		layer.QuadPoseCenter.Position = Vector3f(0, -0.3f, -1.0f);
+		layer.QuadSize = Vector2f(0.4f, 0.4f * size.h / size.w);
+		return layer;
+	}
+};
+
+//The previews of the gallery, decoded by a thread of their own while the gallery is shown: every clip's
+//_preview.mp4, or its color video without one, a frame a clip every 1 / gallery_fps s and looped, shrunk to the
+//size of the previews and of the top half of a top-bottom color. A clip of neither shows its background still.
+//The render thread uploads the frames decoded since its last Upload into the layers of the gallery
+struct GalleryPreviews
+{
+	std::vector<cv::Mat> frames;
+	std::vector<char> fresh;
+	std::mutex mutex;
+	std::thread thread;
+	std::atomic<bool> running, shown;
+	cv::Size size;
+
+	GalleryPreviews() : running(false), shown(false) {}
+	~GalleryPreviews() { Stop(); }
+
+	void Start(const std::vector<ClipFiles> &clips, Sizei previewSize)
+	{
+		size = cv::Size(previewSize.w, previewSize.h);
+		frames.assign(clips.size(), cv::Mat());
+		fresh.assign(clips.size(), 0);
+		running.store(true);
+		thread = std::thread(&GalleryPreviews::Decode, this, clips);
+	}
+
+	void Stop()
+	{
+		running.store(false);
+		if (thread.joinable())
+			thread.join();
+	}
+
+	void Put(size_t k, const cv::Mat &image)
+	{
+		if (image.empty())
+			return;
+		cv::Mat view = top_bottom ? image.rowRange(0, image.rows / 2) : image, preview;
+		cv::resize(view, preview, size, 0, 0, cv::INTER_AREA);
+		if (preview.channels() != 3)
+			cv::cvtColor(preview, preview, preview.channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR);
+		std::lock_guard<std::mutex> lock(mutex);
+		frames[k] = preview;
+		fresh[k] = 1;
+	}
+
+	void Decode(std::vector<ClipFiles> clips)
+	{
+		SetThreadRole(RoleBackground);
+		std::vector<cv::VideoCapture> videos(clips.size());
+		for (size_t k = 0; k < clips.size(); k++)
+			if (!videos[k].open(clips[k].preview) && (multi_sphere > 0 || !videos[k].open(clips[k].color)))
+				Put(k, cv::imread(LocalFile(clips[k].bg)));
+		std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(1.0 / (std::max)(gallery_fps, 0.1f)));
+		while (running.load())
+		{
+			std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + period;
+			for (size_t k = 0; k < videos.size() && shown.load(); k++)
+			{
+				cv::Mat frame;
+				if (!videos[k].isOpened())
+					continue;
+				if (!videos[k].read(frame))
+				{
+					videos[k].set(cv::CAP_PROP_POS_FRAMES, 0);
+					videos[k].read(frame);
+				}
+				Put(k, frame);
+			}
+			std::this_thread::sleep_until(due);
+		}
+	}
+
+	//every preview decoded uploaded again, into the layers of the gallery back in the video memory
+	void Refresh()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t k = 0; k < frames.size(); k++)
+			fresh[k] = !frames[k].empty();
+	}
+
+	void Upload(Scene *scene)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t k = 0; k < frames.size(); k++)
+			if (fresh[k])
+			{
+				scene->UploadPreview(int(k), frames[k].data, Sizei(size.width, size.height), frames[k].step);
+				fresh[k] = 0;
+			}
+	}
+};
+
+// return true to retry later (e.g. after display lost)
+static bool MainLoop(bool retryCreate)
+{
+	TextureBuffer * eyeRenderTexture[2] = { nullptr, nullptr };
+	DepthBuffer   * eyeDepthBuffer[2] = { nullptr, nullptr };
+	MultiviewBuffer * multiviewBuffer = nullptr;
+	FoveationImage * foveation[2] = { nullptr, nullptr };
+	Vector2f        foveaCenter[2];
+	ResolutionScaler * resolutionScaler = nullptr;
+	FrameTimer * frameTimer = nullptr;
+	QualityGovernor * qualityGovernor = nullptr;
+	PowerGovernor * powerGovernor = nullptr;
+	ReprojectionCache * reprojection = nullptr;
+	ReprojectionCache * pauseCache = nullptr;
+	float           cacheScale = 0;
+	Sizei           eyeSizes[2];
+	bool            depthLayer = false;
+	ovrMirrorTexture mirrorTexture = nullptr;
+	GLuint          mirrorFBO = 0;
+	std::chrono::steady_clock::time_point mirrored;
+	Sizei           mirrorSize;
+	int             mirrorFrames = 0;
+	//the layers of the last frame drawn, submitted again for the frames of the low power mode in between
+	LayerEyeFovDepth lastEyes;
+	ovrLayerQuad    lastStats;
+	ovrViewScaleDesc lastViewScale;
+	unsigned int    lastLayerCount = 0;
+	Scene         * roomScene = nullptr;
+	GalleryPreviews previews;
+	StatsOverlay  * statsOverlay = nullptr;
+	float           lastGpuMs = -1;
+	long long frameIndex = 0;
+
+	ovrSession session;
+	ovrGraphicsLuid luid;
+	ovrResult result = ovr_Create(&session, &luid);
+	if (!OVR_SUCCESS(result))
+		return retryCreate;
+
+	if (Compare(luid, GetDefaultAdapterLuid())) // If luid that the Rift is on is not the default adapter LUID...
+	{
+		VALIDATE(false, "OpenGL supports only the default graphics adapter.");
+	}
+	
+	ovrHmdDesc hmdDesc = ovr_GetHmdDesc(session);
+	gpuResidency.budget = (long long)vram_budget << 20;
+
+	// Setup Window and Graphics
+	// Note: the mirror window can be any size, for this sample we use 1/2 the HMD resolution
+	//ovrSizei windowSize = { hmdDesc.Resolution.w, hmdDesc.Resolution.h};
+	ovrSizei windowSize = { hmdDesc.Resolution.w / 2, hmdDesc.Resolution.h / 2 };
+	if (!Platform.InitDevice(windowSize.w, windowSize.h, reinterpret_cast<LUID*>(&luid)))
+		goto Done;
+
+	
+	///////////////////////////////////////////////////////////////////////////////////////////////////
+	//CREATE VIDEO THREAD
+	//the video thread creates the textures; the render thread draws none before the first frame is published
+	GLuint mBack_bg = 0, mFront_bg = 0, mFront_bgd = 0, mBack_bgd = 0, mFront_bbg = 0, mBack_bbg = 0, mFront_bbgd = 0, mBack_bbgd = 0,
+		black_text = 0, bga_text = 0;
+	ARGS args = { &mFront_bg, &mFront_bgd, &mFront_bbg, &mFront_bbgd, &mBack_bg, &mBack_bgd, &mBack_bbg, &mBack_bbgd, &black_text, &bga_text };
+	
+	HANDLE threadDecoding;
+	threadDecoding = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)VideoThread, &args, 0, NULL);
+	///////////////////////////////////////////////////////////////////////////////////////////////////
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////
+	//CREATE AUDIO THREAD
+	ARGS_aud args_aud = { &audiofile };
+	HANDLE threadAudioPlaying;
+	threadAudioPlaying = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)AudioThread, &args_aud, 0, NULL);
+	///////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Make eye render buffers, the depth in chains of the compositor for its layer, for the frames of the low
+	// power mode too
+	depthLayer = (depth_layer || power_mode != 0) && GLE_ARB_depth_buffer_float;
+	if (depth_layer && !depthLayer)
+		std::cout << "the depth layer needs float depth buffers, submitting the color only\n";
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		ovrSizei idealTextureSize = ovr_GetFovTextureSize(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye], dynamic_resolution ? resolution_max : 1);
+		eyeRenderTexture[eye] = new TextureBuffer(session, true, true, idealTextureSize, 1, NULL, 1);
+		eyeDepthBuffer[eye] = new DepthBuffer(eyeRenderTexture[eye]->GetSize(), 0, depthLayer ? session : nullptr);
+		if (depthLayer && !eyeDepthBuffer[eye]->TextureChain)
+		{
+			std::cout << "cannot create the depth chain of an eye, submitting the color only\n";
+			depthLayer = false;
+		}
+
+		if (!eyeRenderTexture[eye]->TextureChain)
+		{
+			if (retryCreate) goto Done;
+			VALIDATE(false, "Failed to create texture.");
+		}
+	}
+
+	//the tessellation needs OpenGL 4.0, and the vertex shaders of the multiview
+	GLint glMajor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &glMajor);
+	if (sphere_mode == SphereTessellated && glMajor < 4)
+	{
+		std::cout << "OpenGL 4.0 is not supported, the sphere is procedural instead of tessellated\n";
+		sphere_mode = SphereProcedural;
+	}
+	if (sphere_mode == SphereTessellated && multiview_stereo)
+	{
+		std::cout << "The tessellated sphere draws the eyes one after the other\n";
+		multiview_stereo = false;
+	}
+
+	//the cache of the reprojection, of the wider field of view at the density of the eye buffers; the one of the
+	//pause is made the first time the videos pause
+	for (int eye = 0; eye < 2; ++eye)
+		eyeSizes[eye] = eyeRenderTexture[eye]->GetSize();
+	if (reproject > 0)
+	{
+		reprojection = new ReprojectionCache(eyeSizes, hmdDesc.DefaultEyeFov, reproject);
+		if (!reprojection->shader)
+		{
+			std::cout << "The reprojection does not link, the layers are drawn every frame\n";
+			delete reprojection;
+			reprojection = nullptr;
+		}
+	}
+	cacheScale = reprojection ? reproject : pause_cache;
+
+	//both eyes in one pass when the driver has GL_OVR_multiview2, at the larger size of the two, large enough for
+	//a cache; the eyes draw their own size of it
+	if (multiview_stereo && MultiviewBuffer::IsSupported())
+	{
+		Sizei left = eyeSizes[0], right = eyeSizes[1], size((std::max)(left.w, right.w), (std::max)(left.h, right.h));
+		float scale = (std::max)(cacheScale, 1.0f);
+		multiviewBuffer = new MultiviewBuffer(Sizei(int(size.w * scale + 0.5f), int(size.h * scale + 0.5f)));
+		multiviewBuffer->viewSize = size;
+	}
+	else if (multiview_stereo)
+		std::cout << "GL_OVR_multiview2 is not supported, drawing the eyes one after the other\n";
+
+	//the samples of the eyes once it's known they're drawn one after the other
+	if (eye_samples > 1 && multiviewBuffer)
+		std::cout << "The eyes are not multisampled with the multiview\n";
+	else if (eye_samples > 1)
+		for (int eye = 0; eye < 2; ++eye)
+			if (!eyeRenderTexture[eye]->Multisample(eye_samples))
+				std::cout << "The eye buffers can't be multisampled, drawing them with a sample\n";
+
+	//the foveae at the centers of the lenses, where the axes of the asymmetric fields of view meet
+	if (foveated && multiviewBuffer)
+		std::cout << "The foveation is not done with the multiview\n";
+	else if (foveated && FoveationImage::IsSupported())
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			ovrFovPort fov = hmdDesc.DefaultEyeFov[eye];
+			foveaCenter[eye] = Vector2f(fov.LeftTan / (fov.LeftTan + fov.RightTan), fov.DownTan / (fov.UpTan + fov.DownTan));
+			foveation[eye] = new FoveationImage(eyeRenderTexture[eye]->GetSize(), foveaCenter[eye], fovea_inner, fovea_outer);
+		}
+	else if (foveated)
+		std::cout << "GL_NV_shading_rate_image is not supported, shading every pixel\n";
+
+	//the resolution of the display to begin with
+	if (dynamic_resolution)
+		resolutionScaler = new ResolutionScaler(hmdDesc.DisplayRefreshRate, resolution_min / resolution_max, (std::min)(1.0f, 1.0f / resolution_max));
+	if (quality_governor)
+		qualityGovernor = new QualityGovernor(hmdDesc.DisplayRefreshRate);
+	if (power_mode != 0)
+		powerGovernor = new PowerGovernor;
+	if (resolutionScaler || qualityGovernor)
+		frameTimer = new FrameTimer;
+	if (!profile_file.empty())
+		profiler.Start(profile_file);
+
+	ovrMirrorTextureDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	mirrorSize = mirror_quarter ? Sizei((std::max)(1, windowSize.w / 2), (std::max)(1, windowSize.h / 2)) : Sizei(windowSize.w, windowSize.h);
+	desc.Width = mirrorSize.w;
+	desc.Height = mirrorSize.h;
+	desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+
+	// Create mirror texture and an FBO used to copy mirror texture to back buffer, none without the mirror
+	// window so the compositor does not draw it either
+	if (mirror_window)
+	{
+		result = ovr_CreateMirrorTextureGL(session, &desc, &mirrorTexture);
+		if (!OVR_SUCCESS(result))
+		{
+			if (retryCreate) goto Done;
+			VALIDATE(false, "Failed to create mirror texture.");
+		}
+
+		// Configure the mirror read buffer
+		GLuint texId;
+		ovr_GetMirrorTextureBufferGL(session, mirrorTexture, &texId);
+
+		glGenFramebuffers(1, &mirrorFBO);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texId, 0);
+		glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	}
+	mirrored = std::chrono::steady_clock::now();
+
+	// Turn off vsync to let the compositor do its magic
+	wglSwapIntervalEXT(0);
+
+	
+	// FloorLevel will give tracking poses where the floor height is 0
+	ovr_SetTrackingOriginType(session, ovrTrackingOrigin_FloorLevel);
+	//the tracking of the HMD, its head pose the one of the frame of the trace replayed in its place
+	auto Track = [&](double time, ovrBool latencyMarker, long long frame) {
+		ovrTrackingState state = ovr_GetTrackingState(session, time, latencyMarker);
+		if (!poseReplay.poses.empty())
+			state.HeadPose.ThePose = poseReplay.poses[size_t((std::min)(frame, (long long)poseReplay.poses.size() - 1))];
+		return state;
+	};
+	ovrTrackingState TrackingState;
+	TrackingState = Track(0, ovrTrue, 0);
+
+	Vector3f spherecenter = TrackingState.HeadPose.ThePose.Position;
+	roomScene = BuildScene(spherecenter, eyeRenderTexture[0]->GetSize(), multiviewBuffer != nullptr);
+	//the gallery of the playlist, its previews decoded while it is shown
+	if (gallery_width > 0 && playlist.size() > 1)
+	{
+		Sizei previewSize(gallery_width, gallery_width / 2);
+		if (roomScene->InitGallery(multiviewBuffer != nullptr, int(playlist.size()), previewSize))
+			previews.Start(playlist, previewSize);
+		else
+			std::cout << "The gallery does not link, the clips are played in turn\n";
+	}
+	startup.Done("scene built");
+	if (stats_overlay)
+	{
+		statsOverlay = new StatsOverlay(session, Sizei(512, 160));
+		if (statsOverlay->Valid())
+			statsOverlay->Draw(std::vector<std::string>(1, "starting"));
+		else
+		{
+			std::cout << "The swapchain of the stats overlay cannot be made, the stats are printed only\n";
+			delete statsOverlay;
+			statsOverlay = nullptr;
+		}
+	}
+	Vector2f ScreenSize(hmdDesc.Resolution.w, hmdDesc.Resolution.h);
+	
+	//Pass the video texture each frame to the render call
+	//For now we are only passing the first image	
+	ScopedTimer second;
+	double deltaTime = 0;
+	unsigned int frames = 0;
+	double  frameRate = 30;
+	double  averageFrameTimeMilliseconds = 33.333;
+	// Main loop
+	bool write = false;
+	double radius = 100.0;
+	bool starting = true;
+	//the head pose settles a moment after the HMD is put on, the scene is centered on it then
+	std::chrono::steady_clock::time_point mounted;
+	bool isMounted = false;
+	bool submitted = false;
+	bool warmedUp = false;
+	WatchedThread watched("render loop");
+	while (Platform.HandleMessages())
+	{ 
+		watched.Feed("drawing frame", frameIndex);
+		ovrSessionStatus sessionStatus;
+		ovr_GetSessionStatus(session, &sessionStatus);		
+		
+		if (starting == true & sessionStatus.HmdMounted & !isMounted)
+		{
+			mounted = std::chrono::steady_clock::now();
+			isMounted = true;
+		}
+		if (starting == true & isMounted && std::chrono::steady_clock::now() - mounted >= std::chrono::milliseconds(1500))
+		{
+			TrackingState = Track(0, ovrFalse, frameIndex);
+			roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
+			spherecenter = TrackingState.HeadPose.ThePose.Position;
+			starting = false;
+
+		}
+	
+		/*if (fl_terminate == true)
+		{
+			//headpose << std::endl;
+			delete roomScene;
+			if (mirrorFBO) glDeleteFramebuffers(1, &mirrorFBO);
+			if (mirrorTexture) ovr_DestroyMirrorTexture(session, mirrorTexture);
+			for (int eye = 0; eye < 2; ++eye)
+			{
+				delete eyeRenderTexture[eye];
+				delete eyeDepthBuffer[eye];
+			}
+			Platform.ReleaseDevice();
+			ovr_Destroy(session);
+			//exit(0);
+			return 0;
+		}
+		*/
+
+		//the render parameters of settings.json, when it is saved, under the quality of the governor
+		if (liveSettings.Poll())
+		{
+			roomScene->Models[0]->tessPixels = tess_pixels;
+			roomScene->Models[0]->tessDepthGain = tess_depth_gain;
+			roomScene->SetGrade(layer_gamma);
+			for (int eye = 0; eye < 2; ++eye)
+				if (foveation[eye])
+					foveation[eye]->SetRadii(fovea_inner, fovea_outer);
+			if (qualityGovernor)
+				QualityGovernor::Apply(roomScene, foveation);
+		}
+
+		/////////////////////////////////////////////////////////////////////////////////////////////
 		//FPS COUNTER
-		clock_t endFrame = clock();
-		deltaClock = endFrame - beginFrame;
-		deltaTime = clockToMilliseconds(deltaClock) / 1000.0;
+		deltaTime = second.Seconds();
 		frames++;
 		if (deltaTime > 1.0) { //every second
 			frameRate = frames / deltaTime;
 			//frameRate = frameRate / 5.0;
-			beginFrame = endFrame;
+			second.Restart();
 			frames = 0;
 			averageFrameTimeMilliseconds = 1000.0 / (frameRate == 0 ? 0.001 : frameRate);
-			std::cout << printf("fps=%02.2f   mspf=%02.2f", frameRate, averageFrameTimeMilliseconds) << std::endl;
+			printf("fps=%02.2f   mspf=%02.2f\n", frameRate, averageFrameTimeMilliseconds);
+			profiler.Print();
+			//the previews of the hidden gallery out of the video memory under its pressure
+			if (gpuResidency.Check() && !roomScene->galleryShown)
+				roomScene->GalleryResident(false);
+			if (powerGovernor)
+			{
+				ovrPerfStats stats;
+				stats.AdaptiveGpuPerformanceScale = telemetry.gpuScale;
+				if (!telemetry.running)
+					ovr_GetPerfStats(session, &stats);
+				powerGovernor->Update(stats.AdaptiveGpuPerformanceScale, roomScene, foveation);
+			}
+			if (statsOverlay)
+			{
+				char line[4][64];
+				sprintf(line[0], "%.1f fps  %.2f ms", frameRate, averageFrameTimeMilliseconds);
+				sprintf(line[1], lastGpuMs >= 0 ? "GPU %.2f ms" : "GPU -", lastGpuMs);
+				sprintf(line[2], "quality %d  scale %.2f%s", quality_level, resolutionScaler ? resolutionScaler->scale : 1.0f, lowPower.load() ? "  low power" : "");
+				sprintf(line[3], "eye %dx%d", eyeRenderTexture[0]->viewSize.w, eyeRenderTexture[0]->viewSize.h);
+				statsOverlay->Draw(std::vector<std::string>(line, line + 4));
+			}
+		}
+		/////////////////////////////////////////////////////////////////////////////////////////////
+		//ovrSessionStatus sessionStatus;
+		ovr_GetSessionStatus(session, &sessionStatus);
+		if (sessionStatus.ShouldQuit)
+		{
+			// Because the application is requested to quit, should not request retry
+			retryCreate = false;
+			break;
+		}
+		if (sessionStatus.ShouldRecenter)
+			ovr_RecenterTrackingOrigin(session);
+
+		if (sessionStatus.IsVisible)
+		{
+
+			if (Platform.Key['T'])
+			{				
+				TrackingState = Track(0, ovrFalse, frameIndex);
+				roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
+				spherecenter = TrackingState.HeadPose.ThePose.Position;
+				positional_track = true;
+			}
+			if (Platform.Key['Y'])
+			{				
+				TrackingState = Track(0, ovrFalse, frameIndex);
+				roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
+				spherecenter = TrackingState.HeadPose.ThePose.Position;
+				positional_track = false;
+			}
+			
+			if (Platform.Key['C']) {
+				colored = !colored;
+				Platform.Key['C'] = false;
+			}
+
+			//the GALLERY shown and hidden on G, the clip of the preview looked at played on ENTER
+			if (Platform.Key['G'] && roomScene->galleryShader) {
+				roomScene->galleryShown = !roomScene->galleryShown;
+				previews.shown.store(roomScene->galleryShown);
+				Platform.Key['G'] = false;
+			}
+			if (Platform.Key[VK_RETURN] && roomScene->galleryShown) {
+				if (roomScene->galleryFocus >= 0)
+				{
+					galleryPick.store(roomScene->galleryFocus);
+					roomScene->galleryShown = false;
+					previews.shown.store(false);
+				}
+				Platform.Key[VK_RETURN] = false;
+			}
+						
+			if (Platform.Key['R'])
+			{
+					TrackingState = Track(0, ovrFalse, frameIndex);
+					roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
+					spherecenter = TrackingState.HeadPose.ThePose.Position;
+			}
+
+			// Every other frame of the low power mode submits the layers of the last one again, nothing drawn or
+			// committed, for the compositor to timewarp them to the pose of its display, by their depth if it takes
+			// the depth layer; the GPU draws the eyes at half the rate of the display
+			if (lowPower.load() && lastLayerCount > 0 && (frameIndex & 1))
+			{
+				ovrLayerHeader* layers[2] = { &lastEyes.Header, &lastStats.Header };
+				result = ovr_SubmitFrame(session, frameIndex, depthLayer ? &lastViewScale : nullptr, layers, lastLayerCount);
+				if (!OVR_SUCCESS(result))
+					goto Done;
+				frameIndex++;
+				continue;
+			}
+			
+
+			// Call ovr_GetRenderDesc each frame to get the ovrEyeRenderDesc, as the returned values (e.g. HmdToEyeOffset) may change at runtime.
+			ovrEyeRenderDesc eyeRenderDesc[2];
+			eyeRenderDesc[0] = ovr_GetRenderDesc(session, ovrEye_Left, hmdDesc.DefaultEyeFov[0]);
+			eyeRenderDesc[1] = ovr_GetRenderDesc(session, ovrEye_Right, hmdDesc.DefaultEyeFov[1]);
+
+			// Get eye poses, feeding in correct IPD offset
+			ovrVector3f               HmdToEyeOffset[2] = { eyeRenderDesc[0].HmdToEyeOffset,
+				eyeRenderDesc[1].HmdToEyeOffset };
+
+			// The textures of one video frame for both eyes
+			const FrameBundle *front = nullptr;
+			bool isFrame = videoFrames.Acquire(&front);
+			ARGS frameArgs = args;
+			frameArgs.frame = front;
+
+			// Every pass drawn once on the first frame of the video, before the HMD shows any, and out of the
+			// GPU time of the frame
+			if (isFrame && !warmedUp)
+			{
+				ovrPosef center;
+				center.Orientation = Quatf();
+				center.Position = spherecenter;
+				roomScene->BindTextures(frameArgs);
+				WarmUpPasses(roomScene, ScreenSize, spherecenter, EyeViews(center, spherecenter, HmdToEyeOffset, hmdDesc.DefaultEyeFov),
+					multiviewBuffer != nullptr, eyeRenderTexture[0]->msaaFboId ? eye_samples : 1);
+				warmedUp = true;
+			}
+
+			// The parts of the eye buffers drawn this frame, and the GPU time of its draws
+			if (resolutionScaler)
+			{
+				for (int eye = 0; eye < 2; ++eye)
+				{
+					eyeRenderTexture[eye]->viewSize = resolutionScaler->Viewport(eyeRenderTexture[eye]->GetSize());
+					if (foveation[eye])
+						foveation[eye]->SetFovea(foveaCenter[eye], eyeRenderTexture[eye]->viewSize);
+				}
+				if (multiviewBuffer)
+					multiviewBuffer->viewSize = resolutionScaler->Viewport(Sizei((std::max)(eyeSizes[0].w, eyeSizes[1].w), (std::max)(eyeSizes[0].h, eyeSizes[1].h)));
+			}
+			if (frameTimer)
+				frameTimer->Begin();
+			profiler.MarkGPU("start");
+			roomScene->BindTextures(frameArgs);
+
+			// The pose as late as the frame allows, everything that does not depend on it done before, predicted
+			// for the display of this frame; the time it is sampled at goes with the layer
+			double displayMidpointSeconds = ovr_GetPredictedDisplayTime(session, frameIndex);
+			TrackingState = Track(displayMidpointSeconds, ovrTrue, frameIndex);
+			double sensorSampleTime = ovr_GetTimeInSeconds();
+			if (ambisonic)
+				headOrientation.Set(TrackingState.HeadPose.ThePose.Orientation);
+			//the view when the frames decoded now are presented, the ring and a margin later
+			if (tile_cols * tile_rows > 1)
+			{
+				ovrTrackingState ahead = Track(displayMidpointSeconds + 0.2, ovrFalse, frameIndex + (long long)(0.2 * hmdDesc.DisplayRefreshRate));
+				Vector3f forward = Matrix4f(ahead.HeadPose.ThePose.Orientation).Transform(Vector3f(0, 0, -1));
+				viewDirection.x = forward.x;
+				viewDirection.y = forward.y;
+				viewDirection.z = forward.z;
+			}
+
+			EyeViews eyes(TrackingState.HeadPose.ThePose, spherecenter, HmdToEyeOffset, hmdDesc.DefaultEyeFov);
+			Vector3f HeadPos = TrackingState.HeadPose.ThePose.Position;
+			if (roomScene->galleryShown)
+			{
+				if (roomScene->GalleryResident(true))
+					previews.Refresh();
+				previews.Upload(roomScene);
+				Vector3f forward = Matrix4f(TrackingState.HeadPose.ThePose.Orientation).Transform(Vector3f(0, 0, -1));
+				roomScene->galleryFocus = roomScene->GalleryFocus(HeadPos, forward);
+			}
+			// The cache of the reprojection, or of the pause while the videos are paused; none for the gallery,
+			// whose previews change without a new frame
+			ReprojectionCache * cache = roomScene->galleryShown ? nullptr : reprojection;
+			if (!cache && !roomScene->galleryShown && pause_cache > 0 && videoPaused.load())
+			{
+				if (!pauseCache)
+				{
+					pauseCache = new ReprojectionCache(eyeSizes, hmdDesc.DefaultEyeFov, pause_cache);
+					if (!pauseCache->shader)
+					{
+						std::cout << "The reprojection does not link, the paused frame is drawn every frame\n";
+						delete pauseCache;
+						pauseCache = nullptr;
+						pause_cache = 0;
+					}
+				}
+				cache = pauseCache;
+			}
+			if (cache)
+			{
+				// The layers into the cache for a new frame of the video or a head out of its reach only, at the
+				// whole size of the cache and from the pose of this frame; the views of the static mode are the
+				// centered ones
+				long long videoFrame = isFrame ? videoFrames.AcquiredFrame() : -1;
+				if (cache->Due(videoFrame, TrackingState.HeadPose.ThePose))
+				{
+					EyeViews cacheEyes(TrackingState.HeadPose.ThePose, spherecenter, HmdToEyeOffset, cache->fov);
+					FoveationImage * unfoveated[2] = { nullptr, nullptr };
+					Sizei eyesView;
+					if (multiviewBuffer)
+					{
+						eyesView = multiviewBuffer->viewSize;
+						Sizei left = cache->color[0]->GetSize(), right = cache->color[1]->GetSize();
+						multiviewBuffer->viewSize = Sizei((std::max)(left.w, right.w), (std::max)(left.h, right.h));
+					}
+					DrawEyes(roomScene, ScreenSize, spherecenter, HeadPos, cacheEyes, cache->color, cache->depth, multiviewBuffer, unfoveated);
+					for (int eye = 0; eye < 2; ++eye)
+					{
+						if (multiviewBuffer)
+						{
+							cache->color[eye]->SetAndClearRenderSurface(cache->depth[eye]);
+							multiviewBuffer->CopyTo(eye, cache->color[eye]->viewSize, true);
+						}
+						cache->color[eye]->UnsetRenderSurface();
+						cache->Store(eye, positional_track ? cacheEyes.view[eye] : cacheEyes.viewCentered[eye], cacheEyes.proj[eye]);
+					}
+					if (multiviewBuffer)
+						multiviewBuffer->viewSize = eyesView;
+					cache->frame = videoFrame;
+					cache->pose = TrackingState.HeadPose.ThePose;
+				}
+				for (int eye = 0; eye < 2; ++eye)
+				{
+					eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+					cache->Draw(eye, positional_track ? eyes.view[eye] : eyes.viewCentered[eye], eyes.proj[eye]);
+					profiler.MarkGPU("reproject", eye);
+				}
+			}
+			else
+				DrawEyes(roomScene, ScreenSize, spherecenter, HeadPos, eyes, eyeRenderTexture, eyeDepthBuffer, multiviewBuffer, foveation);
+
+			for (int eye = 0; eye < 2; ++eye)
+			{
+				// The views of the multiview into the textures of the eyes
+				if (multiviewBuffer && !cache)
+				{
+					eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+					multiviewBuffer->CopyTo(eye, eyeRenderTexture[eye]->viewSize, depthLayer);
+				}
+
+				// Avoids an error when calling SetAndClearRenderSurface during next iteration.
+				// Without this, during the next while loop iteration SetAndClearRenderSurface
+				// would bind a framebuffer with an invalid COLOR_ATTACHMENT0 because the texture ID
+				// associated with COLOR_ATTACHMENT0 had been unlocked by calling wglDXUnlockObjectsNV.
+				eyeRenderTexture[eye]->UnsetRenderSurface();
+
+				// Commit changes to the textures so they get picked up frame
+				eyeRenderTexture[eye]->Commit();
+				eyeDepthBuffer[eye]->Commit();
+			}
+			profiler.MarkGPU("commit");
+			if (frameTimer)
+			{
+				float gpuMs = frameTimer->End();
+				if (gpuMs >= 0)
+					lastGpuMs = gpuMs;
+				if (gpuMs >= 0 && resolutionScaler)
+					resolutionScaler->Update(gpuMs);
+				if (gpuMs >= 0 && qualityGovernor)
+					qualityGovernor->Update(gpuMs, resolutionScaler, roomScene, foveation);
+			}
+
+			// The video thread may upload to the frame again once these draws are done
+			if (isFrame)
+				videoFrames.Release();
+			if (isFrame & !submitted)
+			{
+				startup.Done("first frame submitted");
+				submitted = true;
+			}
+
+			// Do distortion rendering, Present and flush/sync. The layer of the depth begins as the one of the color,
+			// and the offsets of the eyes and the meters of the units place its depth for the positional timewarp
+			LayerEyeFovDepth ld;
+			ld.Header.Type = depthLayer ? layerTypeEyeFovDepth : ovrLayerType_EyeFov;
+			ld.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;   // Because OpenGL.
+			ovrViewScaleDesc viewScale;
+			viewScale.HmdSpaceToWorldScaleInMeters = 1;
+
+			for (int eye = 0; eye < 2; ++eye)
+			{
+				ld.ColorTexture[eye] = eyeRenderTexture[eye]->TextureChain;
+				ld.Viewport[eye] = Recti(eyeRenderTexture[eye]->viewSize);
+				ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
+				ld.RenderPose[eye] = eyes.pose[eye];
+				ld.SensorSampleTime = sensorSampleTime;
+				ld.DepthTexture[eye] = eyeDepthBuffer[eye]->TextureChain;
+				viewScale.HmdToEyeOffset[eye] = HmdToEyeOffset[eye];
+			}
+			ld.ProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(ovrMatrix4f_Projection(hmdDesc.DefaultEyeFov[0], 0.2f, 1000.0f, ovrProjection_None), ovrProjection_None);
+
+			// the stats above the eyes, in the layer list after them
+			ovrLayerQuad statsLayer;
+			ovrLayerHeader* layers[2] = { &ld.Header, nullptr };
+			unsigned int layerCount = 1;
+			if (statsOverlay)
+			{
+				statsLayer = statsOverlay->Layer();
+				layers[layerCount++] = &statsLayer.Header;
+			}
+			ScopedTimer submitting;
+			result = ovr_SubmitFrame(session, frameIndex, depthLayer ? &viewScale : nullptr, layers, layerCount);
+			// a compositor that does not take the layer of the depth gets the color alone from then on
+			if (depthLayer && result == ovrError_InvalidParameter)
+			{
+				std::cout << "the compositor does not take the depth layer, submitting the color only\n";
+				depthLayer = false;
+				ld.Header.Type = ovrLayerType_EyeFov;
+				result = ovr_SubmitFrame(session, frameIndex, nullptr, layers, layerCount);
+			}
+			profiler.Submitted(submitting.Seconds());
+			profiler.EndFrame();
+			lastEyes = ld;
+			lastViewScale = viewScale;
+			if (statsOverlay)
+				lastStats = statsLayer;
+			lastLayerCount = layerCount;
+			telemetry.Record(session, displayMidpointSeconds, TrackingState.HeadPose.ThePose, isFrame ? videoFrames.AcquiredFrame() : -1);
+			if (!pose_record.empty())
+				poseRecorder.Add(displayMidpointSeconds, TrackingState.HeadPose.ThePose);
+			// exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
+			if (!OVR_SUCCESS(result))
+				goto Done;
+
+			frameIndex++;
+			if (!poseReplay.poses.empty() && frameIndex >= (long long)poseReplay.poses.size())
+			{
+				std::cout << "the pose trace " << pose_replay << " is replayed\n";
+				retryCreate = false;
+				break;
+			}
+		}
+		// nothing to draw while the HMD shows another application, asleep instead of polling the session
+		else
+			Sleep(lowPower.load() ? 100 : 10);
+
+		// Blit mirror texture to back buffer, at the rate of the mirror, power_mirror_hz at most in the low power
+		// mode; in between the CPU goes on to the next frame as soon as this one is submitted, while the GPU still
+		// draws it
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		float mirrorHz = mirror_hz;
+		if (lowPower.load() && power_mirror_hz > 0 && (mirrorHz == 0 || mirrorHz > power_mirror_hz))
+			mirrorHz = power_mirror_hz;
+		bool mirrorDue = mirrorHz > 0 ? std::chrono::duration<float>(now - mirrored).count() * mirrorHz >= 1 : ++mirrorFrames >= mirror_every;
+		if (mirrorFBO && mirrorDue)
+		{
+			mirrored = now;
+			mirrorFrames = 0;
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glBlitFramebuffer(0, mirrorSize.h, mirrorSize.w, 0,
+				0, 0, Platform.WinSizeW, Platform.WinSizeH,
+				GL_COLOR_BUFFER_BIT, mirror_quarter ? GL_LINEAR : GL_NEAREST);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+			SwapBuffers(Platform.hDC);
+		}
+	}
+
+Done:
+	profiler.Stop();
+	previews.Stop();
+	delete statsOverlay;
+	delete roomScene;
+	delete multiviewBuffer;
+	for (int eye = 0; eye < 2; ++eye)
+		delete foveation[eye];
+	delete resolutionScaler;
+	delete qualityGovernor;
+	delete powerGovernor;
+	delete frameTimer;
+	delete reprojection;
+	delete pauseCache;
+	if (mirrorFBO) glDeleteFramebuffers(1, &mirrorFBO);
+	if (mirrorTexture) ovr_DestroyMirrorTexture(session, mirrorTexture);
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete eyeRenderTexture[eye];
+		delete eyeDepthBuffer[eye];
+	}
+	Platform.ReleaseDevice();
+	ovr_Destroy(session);
+
+	// Retry on ovrError_DisplayLost
+	return retryCreate || (result == ovrError_DisplayLost);
+}
+
+//the eyes of a frame side by side, as they are seen, into an image file
+static void WriteEyes(TextureBuffer *eyeRenderTexture[2], const std::string &filename)
+{
+	Sizei size = eyeRenderTexture[0]->GetSize();
+	cv::Mat eyes(size.h, 2 * size.w, CV_8UC3), eye(size.h, size.w, CV_8UC3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (int e = 0; e < 2; ++e)
+	{
+		glBindTexture(GL_TEXTURE_2D, eyeRenderTexture[e]->texId);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_UNSIGNED_BYTE, eye.data);
+		eye.copyTo(eyes(cv::Rect(e * size.w, 0, size.w, size.h)));
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	cv::flip(eyes, eyes, 0);
+	if (!cv::imwrite(filename, eyes))
+		std::cout << "cannot write " << filename << "\n";
+}
+
+//The headless benchmark: the head poses of a trace drawn into offscreen eye buffers, with no HMD and no
+//compositor, a frame per pose as fast as the GPU draws them from the first frame of the videos on, and the GPU
+//times of their passes profiled into profile_file, headless.csv unless it is set. The eyes have the fields of
+//view of a Rift CV1 and are 64 mm apart; the videos keep their own time, there is no audio
+static bool HeadlessLoop(bool retryCreate)
+{
+	UNREFERENCED_PARAMETER(retryCreate);
+	PoseTrace trace;
+	if (!trace.Read(headless_trace) || !Platform.InitDevice(headless_size.w / 2, headless_size.h / 2, nullptr))
+		return false;
+
+	mediaClock.hasAudio = false;
+	GLuint mBack_bg = 0, mFront_bg = 0, mFront_bgd = 0, mBack_bgd = 0, mFront_bbg = 0, mBack_bbg = 0, mFront_bbgd = 0, mBack_bbgd = 0,
+		black_text = 0, bga_text = 0;
+	ARGS args = { &mFront_bg, &mFront_bgd, &mFront_bbg, &mFront_bbgd, &mBack_bg, &mBack_bgd, &mBack_bbg, &mBack_bbgd, &black_text, &bga_text };
+	CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)VideoThread, &args, 0, NULL);
+
+	TextureBuffer * eyeRenderTexture[2];
+	DepthBuffer   * eyeDepthBuffer[2];
+	FoveationImage * foveation[2] = { nullptr, nullptr };
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		eyeRenderTexture[eye] = new TextureBuffer(nullptr, true, false, headless_size, 1, NULL, 1);
+		eyeDepthBuffer[eye] = new DepthBuffer(headless_size, 0);
+	}
+	if (sphere_mode == SphereTessellated)
+		multiview_stereo = false;
+	MultiviewBuffer * multiviewBuffer = multiview_stereo && MultiviewBuffer::IsSupported() ? new MultiviewBuffer(headless_size) : nullptr;
+	for (int eye = 0; eye < 2 && eye_samples > 1 && !multiviewBuffer; ++eye)
+		eyeRenderTexture[eye]->Multisample(eye_samples);
+	const ovrFovPort fov[2] = { { 1.329f, 1.329f, 1.058f, 1.092f }, { 1.329f, 1.329f, 1.092f, 1.058f } };
+	const ovrVector3f HmdToEyeOffset[2] = { { -0.032f, 0, 0 }, { 0.032f, 0, 0 } };
+	if (foveated && !multiviewBuffer && FoveationImage::IsSupported())
+		for (int eye = 0; eye < 2; ++eye)
+			foveation[eye] = new FoveationImage(headless_size, Vector2f(fov[eye].LeftTan / (fov[eye].LeftTan + fov[eye].RightTan), 0.5f),
+				fovea_inner, fovea_outer);
+	wglSwapIntervalEXT(0);
+
+	Vector3f spherecenter = trace.poses[0].Position;
+	Scene *roomScene = BuildScene(spherecenter, headless_size, multiviewBuffer != nullptr);
+	startup.Done("scene built");
+	profiler.Start(profile_file.empty() ? "headless.csv" : profile_file);
+	Vector2f ScreenSize(float(2 * headless_size.w), float(headless_size.h));
+
+	std::chrono::steady_clock::time_point begin, second;
+	size_t frame = 0, framesSecond = 0;
+	while (frame < trace.poses.size() && Platform.HandleMessages())
+	{
+		const FrameBundle *front = nullptr;
+		if (!videoFrames.Acquire(&front))
+		{
+			Sleep(1);
+			continue;
+		}
+		if (frame == 0)
+			begin = second = std::chrono::steady_clock::now();
+		if (liveSettings.Poll())
+		{
+			roomScene->Models[0]->tessPixels = tess_pixels;
+			roomScene->Models[0]->tessDepthGain = tess_depth_gain;
+			roomScene->SetGrade(layer_gamma);
+			for (int eye = 0; eye < 2; ++eye)
+				if (foveation[eye])
+					foveation[eye]->SetRadii(fovea_inner, fovea_outer);
+		}
+		ARGS frameArgs = args;
+		frameArgs.frame = front;
+		profiler.MarkGPU("start");
+		roomScene->BindTextures(frameArgs);
+
+		const ovrPosef &head = trace.poses[frame];
+		EyeViews eyes(head, spherecenter, HmdToEyeOffset, fov);
+		DrawEyes(roomScene, ScreenSize, spherecenter, head.Position, eyes, eyeRenderTexture, eyeDepthBuffer, multiviewBuffer, foveation);
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			if (multiviewBuffer)
+			{
+				eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+				multiviewBuffer->CopyTo(eye, eyeRenderTexture[eye]->viewSize, false);
+			}
+			eyeRenderTexture[eye]->UnsetRenderSurface();
+		}
+		profiler.MarkGPU("commit");
+		if (headless_every > 0 && !headless_frames.empty() && frame % headless_every == 0)
+			WriteEyes(eyeRenderTexture, headless_frames + std::to_string(frame) + ".png");
+		videoFrames.Release();
+		profiler.EndFrame();
+		frame++;
+
+		framesSecond++;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - second >= std::chrono::seconds(1))
+		{
+			double seconds = std::chrono::duration<double>(now - second).count();
+			printf("fps=%02.2f   mspf=%02.2f   frame %d of %d\n", framesSecond / seconds, 1000 * seconds / framesSecond, int(frame), int(trace.poses.size()));
+			profiler.Print();
+			second = now;
+			framesSecond = 0;
+		}
+	}
+	if (frame > 0)
+	{
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		printf("headless: %d frames in %.2f s, %.2f ms per frame\n", int(frame), seconds, 1000 * seconds / frame);
+	}
+
+	profiler.Stop();
+	delete roomScene;
+	delete multiviewBuffer;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete foveation[eye];
+		delete eyeRenderTexture[eye];
+		delete eyeDepthBuffer[eye];
+	}
+	Platform.ReleaseDevice();
+	return false;
+}
+
+//The encoder of the export: the eyes side by side read back into one of two pixel pack buffers while the other,
+//the frame before, is mapped and copied out, so the readback of a frame never stalls its draws; the frames are
+//encoded as H.264 on a thread of its own by the encoder of the GPU that FFmpeg finds, NVENC on NVIDIA, or
+//as MPEG-4 on the CPU without one, and the render thread waits only while queueSize of them are queued
+struct ExportWriter
+{
+	static const int queueSize = 4;
+	cv::VideoWriter writer;
+	GLuint pbo[2];
+	Sizei eyeSize;
+	long long read;
+	std::thread encoder;
+	std::mutex mutex;
+	std::condition_variable notFull, notEmpty;
+	std::deque<cv::Mat> queue;
+	bool closing;
+	ExportWriter() : read(0), closing(false) { pbo[0] = pbo[1] = 0; }
+	~ExportWriter() { Close(); }
+
+	bool Open(const std::string &filename, Sizei size, double fps)
+	{
+		eyeSize = size;
+		cv::Size frameSize(2 * size.w, size.h);
+		bool hardware = false;
+#ifdef VIDEO_HW_ACCELERATION
+		std::vector<int> params = { cv::VIDEOWRITER_PROP_HW_ACCELERATION, cv::VIDEO_ACCELERATION_ANY };
+		if (writer.open(filename, cv::CAP_FFMPEG, cv::VideoWriter::fourcc('a', 'v', 'c', '1'), fps, frameSize, params))
+			hardware = writer.get(cv::VIDEOWRITER_PROP_HW_ACCELERATION) != cv::VIDEO_ACCELERATION_NONE;
+#endif
+		if (!hardware)
+		{
+			std::cout << "no hardware encoder for " << filename << ", encoding on the CPU\n";
+			if (!writer.open(filename, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, frameSize, true))
+			{
+				std::cout << "cannot write " << filename << "\n";
+				return false;
+			}
+		}
+		glGenBuffers(2, pbo);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, frameSize.area() * 3, NULL, GL_STREAM_READ);
+			gpuResidency.Buffer(pbo[i], GpuResidency::PoolOther, frameSize.area() * 3);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		encoder = std::thread(&ExportWriter::Encode, this);
+		return true;
+	}
+
+	//render thread: the eyes drawn for frame into its buffer, and the frame before out of the other one
+	void Add(TextureBuffer *eyeRenderTexture[2], long long frame)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[frame % 2]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glPixelStorei(GL_PACK_ROW_LENGTH, 2 * eyeSize.w);
+		for (int e = 0; e < 2; ++e)
+		{
+			glBindTexture(GL_TEXTURE_2D, eyeRenderTexture[e]->texId);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_UNSIGNED_BYTE, (void*)(size_t(e) * eyeSize.w * 3));
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glFlush();
+		if (frame > read)
+			Take(read++);
+	}
+
+	//render thread: the frame read back last
+	void Flush(long long frames)
+	{
+		while (read < frames)
+			Take(read++);
+	}
+
+	void Take(long long frame)
+	{
+		cv::Mat eyes(eyeSize.h, 2 * eyeSize.w, CV_8UC3);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[frame % 2]);
+		const void *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (pixels)
+			cv::flip(cv::Mat(eyes.size(), CV_8UC3, const_cast<void*>(pixels)), eyes, 0);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return (int)queue.size() < queueSize; });
+		queue.push_back(eyes);
+		notEmpty.notify_one();
+	}
+
+	void Encode()
+	{
+		for (;;)
+		{
+			cv::Mat eyes;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				notEmpty.wait(lock, [this] { return !queue.empty() || closing; });
+				if (queue.empty())
+					break;
+				eyes = queue.front();
+				queue.pop_front();
+				notFull.notify_one();
+			}
+			writer.write(eyes);
+		}
+	}
+
+	void Close()
+	{
+		if (!encoder.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closing = true;
+		}
+		notEmpty.notify_one();
+		encoder.join();
+		writer.release();
+		glDeleteBuffers(2, pbo);
+		gpuResidency.FreeBuffer(pbo[0]);
+		gpuResidency.FreeBuffer(pbo[1]);
+	}
+};
+
+//The export of a preview: the head poses of a trace or a camera path drawn into offscreen eye buffers at the fixed
+//step of export_fps, as fast as the GPU draws and encodes them, with no HMD and no audio. Every frame waits for the
+//video thread to present the frame of the videos at its time, so the videos are stepped with the poses however
+//long a frame takes, and the eyes have the fields of view of a Rift CV1, 64 mm apart, as the headless benchmark
+static bool ExportLoop(bool retryCreate)
+{
+	UNREFERENCED_PARAMETER(retryCreate);
+	PoseTrace trace;
+	if (!trace.Read(export_trace) || !Platform.InitDevice(export_size.w / 2, export_size.h / 2, nullptr))
+		return false;
+	ExportWriter exportWriter;
+	if (!exportWriter.Open(export_file, export_size, export_fps))
+	{
+		Platform.ReleaseDevice();
+		return false;
+	}
+
+	mediaClock.hasAudio = false;
+	GLuint mBack_bg = 0, mFront_bg = 0, mFront_bgd = 0, mBack_bgd = 0, mFront_bbg = 0, mBack_bbg = 0, mFront_bbgd = 0, mBack_bbgd = 0,
+		black_text = 0, bga_text = 0;
+	ARGS args = { &mFront_bg, &mFront_bgd, &mFront_bbg, &mFront_bbgd, &mBack_bg, &mBack_bgd, &mBack_bbg, &mBack_bbgd, &black_text, &bga_text };
+	CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)VideoThread, &args, 0, NULL);
+
+	TextureBuffer * eyeRenderTexture[2];
+	DepthBuffer   * eyeDepthBuffer[2];
+	FoveationImage * foveation[2] = { nullptr, nullptr };
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		eyeRenderTexture[eye] = new TextureBuffer(nullptr, true, false, export_size, 1, NULL, 1);
+		eyeDepthBuffer[eye] = new DepthBuffer(export_size, 0);
+	}
+	if (sphere_mode == SphereTessellated)
+		multiview_stereo = false;
+	MultiviewBuffer * multiviewBuffer = multiview_stereo && MultiviewBuffer::IsSupported() ? new MultiviewBuffer(export_size) : nullptr;
+	for (int eye = 0; eye < 2 && eye_samples > 1 && !multiviewBuffer; ++eye)
+		eyeRenderTexture[eye]->Multisample(eye_samples);
+	const ovrFovPort fov[2] = { { 1.329f, 1.329f, 1.058f, 1.092f }, { 1.329f, 1.329f, 1.092f, 1.058f } };
+	const ovrVector3f HmdToEyeOffset[2] = { { -0.032f, 0, 0 }, { 0.032f, 0, 0 } };
+	wglSwapIntervalEXT(0);
+
+	Vector3f spherecenter = trace.poses[0].Position;
+	Scene *roomScene = BuildScene(spherecenter, export_size, multiviewBuffer != nullptr);
+	startup.Done("scene built");
+	Vector2f ScreenSize(float(2 * export_size.w), float(export_size.h));
+
+	const long long frames = (long long)(trace.Duration() * export_fps) + 1;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now(), second = begin;
+	long long frame = 0, framesSecond = 0;
+	while (frame < frames && Platform.HandleMessages())
+	{
+		//the videos at the time of the frame, presented by the video thread
+		double seconds = frame / export_fps;
+		exportClock.seconds.store(seconds);
+		const FrameBundle *front = nullptr;
+		if (exportClock.reached.load() < seconds || !videoFrames.Acquire(&front))
+		{
+			Sleep(0);
+			continue;
+		}
+		ARGS frameArgs = args;
+		frameArgs.frame = front;
+		roomScene->BindTextures(frameArgs);
+
+		ovrPosef head = trace.At(seconds);
+		EyeViews eyes(head, spherecenter, HmdToEyeOffset, fov);
+		DrawEyes(roomScene, ScreenSize, spherecenter, head.Position, eyes, eyeRenderTexture, eyeDepthBuffer, multiviewBuffer, foveation);
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			if (multiviewBuffer)
+			{
+				eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+				multiviewBuffer->CopyTo(eye, eyeRenderTexture[eye]->viewSize, false);
+			}
+			eyeRenderTexture[eye]->UnsetRenderSurface();
+		}
+		exportWriter.Add(eyeRenderTexture, frame);
+		videoFrames.Release();
+		frame++;
+
+		framesSecond++;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - second >= std::chrono::seconds(1))
+		{
+			double elapsed = std::chrono::duration<double>(now - second).count();
+			printf("export: %.2f fps, %.2fx real time, frame %d of %d\n", framesSecond / elapsed, framesSecond / elapsed / export_fps,
+				int(frame), int(frames));
+			second = now;
+			framesSecond = 0;
+		}
+	}
+	exportWriter.Flush(frame);
+	exportWriter.Close();
+	if (frame > 0)
+	{
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		printf("export: %d frames of %.2f s into %s in %.2f s, %.2fx real time\n", int(frame), frame / export_fps, export_file.c_str(),
+			elapsed, frame / export_fps / elapsed);
+	}
+
+	delete roomScene;
+	delete multiviewBuffer;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete eyeRenderTexture[eye];
+		delete eyeDepthBuffer[eye];
+	}
+	Platform.ReleaseDevice();
+	return false;
+}
+
+#ifdef VIEWER_OPENXR
+//The frames of the HMD through OpenXR in place of LibOVR: the session on the GL context of the window, the
+//views it locates drawn by the passes of MainLoop into the images of its swapchains and submitted as a
+//projection layer at the time it paces. The sphere is centered at the head of the first frame drawn; the depth
+//layer, the dynamic resolution and the mirror are LibOVR's and left out, foveation is the one of the eye buffers
+static bool OpenXRLoop(bool retryCreate)
+{
+	UNREFERENCED_PARAMETER(retryCreate);
+	if (!Platform.InitDevice(1344 / 2, 1600 / 2, nullptr))
+		return false;
+	XrGLSession xr;
+	if (!xr.Create(Platform.hDC, Platform.WglContext))
+	{
+		std::cout << "no OpenXR runtime and HMD to draw to\n";
+		Platform.ReleaseDevice();
+		return false;
+	}
+
+	GLuint mBack_bg = 0, mFront_bg = 0, mFront_bgd = 0, mBack_bgd = 0, mFront_bbg = 0, mBack_bbg = 0, mFront_bbgd = 0, mBack_bbgd = 0,
+		black_text = 0, bga_text = 0;
+	ARGS args = { &mFront_bg, &mFront_bgd, &mFront_bbg, &mFront_bbgd, &mBack_bg, &mBack_bgd, &mBack_bbg, &mBack_bbgd, &black_text, &bga_text };
+	CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)VideoThread, &args, 0, NULL);
+	ARGS_aud args_aud = { &audiofile };
+	CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)AudioThread, &args_aud, 0, NULL);
+
+	TextureBuffer * eyeRenderTexture[2];
+	DepthBuffer   * eyeDepthBuffer[2];
+	FoveationImage * foveation[2] = { nullptr, nullptr };
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		eyeRenderTexture[eye] = new TextureBuffer(xr.size[eye]);
+		eyeDepthBuffer[eye] = new DepthBuffer(xr.size[eye], 0);
+	}
+	//the multiview draws both eyes into one buffer copied to each, of the same size
+	if (sphere_mode == SphereTessellated || xr.size[0].w != xr.size[1].w || xr.size[0].h != xr.size[1].h)
+		multiview_stereo = false;
+	MultiviewBuffer * multiviewBuffer = multiview_stereo && MultiviewBuffer::IsSupported() ? new MultiviewBuffer(xr.size[0]) : nullptr;
+	wglSwapIntervalEXT(0);
+
+	Scene *roomScene = nullptr;
+	Vector3f spherecenter;
+	profiler.Start(profile_file);
+	Vector2f ScreenSize(float(xr.size[0].w + xr.size[1].w), float(xr.size[0].h));
+	bool warmedUp = false;
+
+	while (Platform.HandleMessages() && xr.PollEvents())
+	{
+		if (!xr.running)
+		{
+			Sleep(10);
+			continue;
+		}
+		bool drawn = false;
+		const FrameBundle *front = nullptr;
+		if (xr.BeginFrame())
+		{
+			ovrPosef head = XrGLSession::Pose(xr.head), eyePose[2];
+			ovrFovPort fov[2];
+			for (int eye = 0; eye < 2; ++eye)
+			{
+				eyePose[eye] = XrGLSession::Pose(xr.views[eye].pose);
+				fov[eye] = XrGLSession::Fov(xr.views[eye].fov);
+			}
+			if (!roomScene)
+			{
+				spherecenter = head.Position;
+				roomScene = BuildScene(spherecenter, xr.size[0], multiviewBuffer != nullptr);
+				roomScene->Models[0]->Pos = spherecenter;
+				if (foveated && !multiviewBuffer && FoveationImage::IsSupported())
+					for (int eye = 0; eye < 2; ++eye)
+						foveation[eye] = new FoveationImage(xr.size[eye], Vector2f(fov[eye].LeftTan / (fov[eye].LeftTan + fov[eye].RightTan), 0.5f),
+							fovea_inner, fovea_outer);
+				startup.Done("scene built");
+			}
+			if (liveSettings.Poll())
+			{
+				roomScene->Models[0]->tessPixels = tess_pixels;
+				roomScene->Models[0]->tessDepthGain = tess_depth_gain;
+				roomScene->SetGrade(layer_gamma);
+				for (int eye = 0; eye < 2; ++eye)
+					if (foveation[eye])
+						foveation[eye]->SetRadii(fovea_inner, fovea_outer);
+			}
+			if (ambisonic)
+				headOrientation.Set(head.Orientation);
+			if (videoFrames.Acquire(&front))
+			{
+				ARGS frameArgs = args;
+				frameArgs.frame = front;
+				profiler.MarkGPU("start");
+				roomScene->BindTextures(frameArgs);
+				if (!warmedUp)
+				{
+					WarmUpPasses(roomScene, ScreenSize, spherecenter, EyeViews(eyePose, head, spherecenter, fov),
+						multiviewBuffer != nullptr, eyeRenderTexture[0]->msaaFboId ? eye_samples : 1);
+					warmedUp = true;
+				}
+
+				for (int eye = 0; eye < 2; ++eye)
+					eyeRenderTexture[eye]->texId = xr.AcquireImage(eye);
+				EyeViews eyes(eyePose, head, spherecenter, fov);
+				DrawEyes(roomScene, ScreenSize, spherecenter, head.Position, eyes, eyeRenderTexture, eyeDepthBuffer, multiviewBuffer, foveation);
+				for (int eye = 0; eye < 2; ++eye)
+				{
+					if (multiviewBuffer)
+					{
+						eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
+						multiviewBuffer->CopyTo(eye, eyeRenderTexture[eye]->viewSize, false);
+					}
+					eyeRenderTexture[eye]->UnsetRenderSurface();
+					xr.ReleaseImage(eye);
+				}
+				profiler.MarkGPU("commit");
+				videoFrames.Release();
+				drawn = true;
+			}
+		}
+		if (!xr.EndFrame(drawn))
+			break;
+		if (drawn)
+			profiler.EndFrame();
+	}
+
+	profiler.Stop();
+	delete roomScene;
+	delete multiviewBuffer;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete foveation[eye];
+		eyeRenderTexture[eye]->texId = 0;
+		delete eyeRenderTexture[eye];
+		delete eyeDepthBuffer[eye];
+	}
+	xr.Destroy();
+	Platform.ReleaseDevice();
+	return false;
+}
+#endif
+
+//The first-order ambisonic audio of a clip, AmbiX: a WAV of the four channels W, Y, Z, X (ACN order, SN3D)
+//in 16 bits, named .ambix so that irrKlang leaves it to AmbisonicLoader. Its front X is the center of the
+//equirectangular videos, -x in the coordinates of the sphere, its left Y is +z and its up Z is +y
+struct AmbisonicTrack
+{
+	int sampleRate, frames;
+	std::vector<short> channels[4];
+
+	static std::shared_ptr<AmbisonicTrack> Parse(const std::vector<unsigned char> &bytes, const char *filename)
+	{
+		size_t size = bytes.size(), offset = 12, format = 0;
+		if (size < 12 || memcmp(&bytes[0], "RIFF", 4) != 0 || memcmp(&bytes[8], "WAVE", 4) != 0)
+		{
+			printf("%s is not a WAV\n", filename);
+			return std::shared_ptr<AmbisonicTrack>();
+		}
+		//the chunks, of even sizes, up to the samples
+		while (offset + 8 <= size)
+		{
+			const unsigned char *chunk = &bytes[offset];
+			size_t length = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (size_t)chunk[7] << 24;
+			offset += 8;
+			if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16 && offset + 16 <= size)
+				format = offset;
+			else if (memcmp(chunk, "data", 4) == 0 && format)
+			{
+				const unsigned char *f = &bytes[format];
+				int tag = f[0] | f[1] << 8, channelCount = f[2] | f[3] << 8, bits = f[14] | f[15] << 8;
+				if ((tag != 1 && tag != 0xFFFE) || channelCount != 4 || bits != 16)
+				{
+					printf("%s is not 4 channels of 16-bit PCM\n", filename);
+					return std::shared_ptr<AmbisonicTrack>();
+				}
+				std::shared_ptr<AmbisonicTrack> track(new AmbisonicTrack);
+				track->sampleRate = f[4] | f[5] << 8 | f[6] << 16 | f[7] << 24;
+				track->frames = int((std::min)(length, size - offset) / 8);
+				const short *samples = (const short*)&bytes[offset];
+				for (int c = 0; c < 4; c++)
+				{
+					track->channels[c].resize(track->frames);
+					for (int i = 0; i < track->frames; i++)
+						track->channels[c][i] = samples[i * 4 + c];
+				}
+				return track;
+			}
+			offset += length + (length & 1);
+		}
+		printf("%s has no samples\n", filename);
+		return std::shared_ptr<AmbisonicTrack>();
+	}
+};
+
+//four samples of a channel as floats
+static inline __m128 LoadSamples(const short *p)
+{
+	__m128i v = _mm_loadl_epi64((const __m128i*)p);
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+//The stereo stream irrKlang plays of an ambisonic track, read by its mixer thread a block at a time. Every
+//block is decoded for the orientation of the head when it is read: two virtual cardioids out of the ears,
+//turned with the head, so the sound field stays in place as the head turns. Their gains ramp over the block
+//from those of the last one, so the turns do not click, four frames at a time with SSE2
+class AmbisonicStream : public IAudioStream
+{
+public:
+	AmbisonicStream(const std::shared_ptr<AmbisonicTrack> &_track) : track(_track), position(0), mixer(false)
+	{
+		Gains(Quatf(), gains);
+	}
+
+	virtual SAudioStreamFormat getFormat()
+	{
+		SAudioStreamFormat format;
+		format.ChannelCount = 2;
+		format.FrameCount = track->frames;
+		format.SampleRate = track->sampleRate;
+		format.SampleFormat = ESF_S16;
+		return format;
+	}
+
+	virtual bool setPosition(ik_s32 pos)
+	{
+		position = (std::max)(0, (std::min)(pos, track->frames));
+		return true;
+	}
+
+	virtual ik_s32 readFrames(void *target, ik_s32 frameCountToRead)
+	{
+		//the mixer thread of irrKlang, the one that reads the stream
+		if (!mixer)
+			SetThreadRole(RoleAudio);
+		mixer = true;
+		int n = (std::min)(frameCountToRead, track->frames - position);
+		if (n <= 0)
+			return 0;
+		float next[2][4];
+		Gains(headOrientation.Get(), next);
+		Decode(n, next, (short*)target);
+		memcpy(gains, next, sizeof(gains));
+		position += n;
+		return n;
+	}
+
+private:
+	std::shared_ptr<AmbisonicTrack> track;
+	int position;
+	bool mixer;				//the role of the mixer thread set
+	float gains[2][4];		//of W, Y, Z and X for the left and the right ear, at the end of the last block
+
+	//the cardioids of the ears, half the pressure and half the velocity along their direction in the field
+	static void Gains(const Quatf &head, float ears[2][4])
+	{
+		for (int ear = 0; ear < 2; ear++)
+		{
+			Vector3f d = head.Rotate(Vector3f(ear == 0 ? -1.0f : 1.0f, 0, 0));
+			ears[ear][0] = 0.5f;
+			ears[ear][1] = 0.5f * d.z;
+			ears[ear][2] = 0.5f * d.y;
+			ears[ear][3] = -0.5f * d.x;
+		}
+	}
+
+	void Decode(int n, const float next[2][4], short *out) const
+	{
+		const short *p[4];
+		for (int c = 0; c < 4; c++)
+			p[c] = &track->channels[c][position];
+		float step[2][4];
+		for (int ear = 0; ear < 2; ear++)
+			for (int c = 0; c < 4; c++)
+				step[ear][c] = (next[ear][c] - gains[ear][c]) / n;
+		int i = 0;
+		__m128 g[2][4], dg[2][4];
+		for (int ear = 0; ear < 2; ear++)
+			for (int c = 0; c < 4; c++)
+			{
+				float g0 = gains[ear][c], s = step[ear][c];
+				g[ear][c] = _mm_setr_ps(g0 + s, g0 + 2 * s, g0 + 3 * s, g0 + 4 * s);
+				dg[ear][c] = _mm_set1_ps(4 * s);
+			}
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 s[4], ears[2];
+			for (int c = 0; c < 4; c++)
+				s[c] = LoadSamples(p[c] + i);
+			for (int ear = 0; ear < 2; ear++)
+			{
+				ears[ear] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], g[ear][0]), _mm_mul_ps(s[1], g[ear][1])),
+					_mm_add_ps(_mm_mul_ps(s[2], g[ear][2]), _mm_mul_ps(s[3], g[ear][3])));
+				for (int c = 0; c < 4; c++)
+					g[ear][c] = _mm_add_ps(g[ear][c], dg[ear][c]);
+			}
+			//interleaved left and right, saturated to 16 bits
+			__m128i low = _mm_cvtps_epi32(_mm_unpacklo_ps(ears[0], ears[1])), high = _mm_cvtps_epi32(_mm_unpackhi_ps(ears[0], ears[1]));
+			_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(low, high));
+		}
+		for (; i < n; i++)
+			for (int ear = 0; ear < 2; ear++)
+			{
+				float v = 0;
+				for (int c = 0; c < 4; c++)
+					v += p[c][i] * (gains[ear][c] + step[ear][c] * (i + 1));
+				out[2 * i + ear] = (short)(std::max)(-32768.0f, (std::min)(v, 32767.0f));
+			}
+	}
+};
+
+//The loader of the .ambix files: their tracks decoded once by Preload, a stream of a track for every sound
+//of it played, streamed so that the mixer reads it as it plays and not all of it at once
+class AmbisonicLoader : public IAudioStreamLoader
+{
+public:
+	virtual bool isALoadableFileExtension(const ik_c8 *fileName)
+	{
+		size_t length = strlen(fileName);
+		return length > 6 && _stricmp(fileName + length - 6, ".ambix") == 0;
+	}
+
+	virtual IAudioStream *createAudioStream(IFileReader *file)
+	{
+		std::shared_ptr<AmbisonicTrack> track;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::map<std::string, std::shared_ptr<AmbisonicTrack> >::iterator i = tracks.find(file->getFileName());
+			if (i != tracks.end())
+				track = i->second;
+		}
+		if (!track)
+		{
+			std::vector<unsigned char> bytes((std::max)(file->getSize(), 0));
+			if (!bytes.empty() && file->read(&bytes[0], (ik_u32)bytes.size()) == (ik_s32)bytes.size())
+				track = AmbisonicTrack::Parse(bytes, file->getFileName());
+		}
+		return track ? new AmbisonicStream(track) : NULL;
+	}
+
+	void Preload(const char *filename)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tracks.count(filename))
+				return;
+		}
+		std::ifstream file(filename, std::ios::binary);
+		std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::shared_ptr<AmbisonicTrack> track = AmbisonicTrack::Parse(bytes, filename);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (track)
+			tracks[filename] = track;
+	}
+
+	void Remove(const char *filename)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tracks.erase(filename);
+	}
+
+private:
+	std::mutex mutex;
+	std::map<std::string, std::shared_ptr<AmbisonicTrack> > tracks;
+};
+
+//starts the audio from its beginning as start of AudioControl, paused or not, for the play position of the
+//media clock; the sound is dropped by the media clock
+static void PlayAudio(ISoundEngine *engine, const char *filename, int start, bool paused, int ms)
+{
+	ISound *sound = engine->play2D(filename, true, true, true);
+	if (!sound)
+		printf("Could not play %s, the videos keep their own time\n", filename);
+	else
+	{
+		if (ms > 0)
+			sound->setPlayPosition(ms);
+		sound->setIsPaused(paused);
+	}
+	mediaClock.hasAudio = sound != NULL;
+	mediaClock.SetSound(sound, start);
+	if (sound)
+		sound->drop();
+}
+
+//the sound of a file decoded into memory once, for a start with no delay; an ambisonic track is
+//decoded by its loader and streamed from it
+static void PreloadAudio(ISoundEngine *engine, AmbisonicLoader *ambisonicLoader, const char *filename)
+{
+	if (ambisonicLoader)
+		ambisonicLoader->Preload(filename);
+	if (!engine->getSoundSource(filename, false) &&
+		!engine->addSoundSourceFromFile(filename, ambisonicLoader ? ESM_STREAMING : ESM_AUTO_DETECT, !ambisonicLoader))
+		printf("Could not preload %s\n", filename);
+}
+
+//Thread for handling audio: it sleeps on the commands of AudioControl, and the video thread polls the position
+void AudioThread(LPVOID pArgs_)
+{
+	SetThreadRole(RoleAudio);
+	ARGS_aud *pArgs = (ARGS_aud*)pArgs_;
+	std::string *audiofile = pArgs->audiofile;
+	std::string audiofilename = LocalFile(*audiofile);
+
+	ISoundEngine* engine = createIrrKlangDevice();
+	if (!engine)
+	{
+		printf("Could not startup engine\n");
+		mediaClock.hasAudio = false;
+		return;
+	}
+
+	//the ambisonic audio decoded by the mixer for the orientation of the head
+	AmbisonicLoader *ambisonicLoader = NULL;
+	if (ambisonic)
+	{
+		ambisonicLoader = new AmbisonicLoader;
+		engine->registerAudioStreamLoader(ambisonicLoader);
+	}
+
+	//decoded while the videos open, so the audio starts as soon as they are ready, and the audio of the
+	//next clip of the playlist while this one plays
+	int clip = 0;
+	PreloadAudio(engine, ambisonicLoader, audiofilename.c_str());
+	if (playlist.size() > 1)
+		PreloadAudio(engine, ambisonicLoader, LocalFile(playlist[1].audio).c_str());
+	startup.Done("audio loaded");
+
+	AudioControl::State last = { 0, 0, false, 0 }, next = last;
+	WatchedThread watched("audio thread");
+	while (audioControl.Wait(next))
+	{
+		watched.Feed("starting loop", next.starts);
+		if (next.starts != last.starts)
+		{
+			engine->stopAllSounds();
+			//the video thread switched to another clip
+			if (next.clip != clip)
+			{
+				std::string previous = audiofilename;
+				clip = next.clip;
+				audiofilename = LocalFile(playlist[clip].audio);
+				std::string following = LocalFile(playlist[(clip + 1) % playlist.size()].audio);
+				if (previous != following && previous != audiofilename)
+				{
+					engine->removeSoundSource(previous.c_str());
+					if (ambisonicLoader)
+						ambisonicLoader->Remove(previous.c_str());
+				}
+				PreloadAudio(engine, ambisonicLoader, following.c_str());
+			}
+			PlayAudio(engine, audiofilename.c_str(), next.starts, next.paused, next.startMs);
+		}
+		else if (next.paused != last.paused)
+			engine->setAllSoundsPaused(next.paused);
+		last = next;
+		watched.Disable();
+	}
+	mediaClock.SetSound(NULL, last.starts);
+	engine->drop();
+	if (ambisonicLoader)
+		ambisonicLoader->drop();
+}
+
+//the captures of a stream of bytes instead of a file appeared in OpenCV 4.10
+#if defined(CV_VERSION_MAJOR) && (CV_VERSION_MAJOR>4 || (CV_VERSION_MAJOR==4 && CV_VERSION_MINOR>=10))
+#define VIDEOCAPTURE_STREAM_READER
+#endif
+
+//the key frames of the raw packets of VideoCapture, for the index of the scrubbing, are there in OpenCV 4.6
+#if defined(CV_VERSION_MAJOR) && (CV_VERSION_MAJOR>4 || (CV_VERSION_MAJOR==4 && CV_VERSION_MINOR>=6))
+#define VIDEOCAPTURE_KEYFRAMES
+#endif
+
+#ifdef VIDEOCAPTURE_STREAM_READER
+//The bytes of a video file in memory, so the demuxer of its decoder reads them with no system call and
+//no seek of the disk: the whole file read once when it has at most preload_mb, a view of its mapping
+//beyond. The captures of a file, the spare one of the loops too, share them while one is open
+class VideoBytes
+{
+public:
+	const char *data;
+	long long size;
+
+	static std::shared_ptr<VideoBytes> Open(const char *filename)
+	{
+		static std::mutex mutex;
+		static std::map<std::string, std::weak_ptr<VideoBytes> > files;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<VideoBytes> bytes = files[filename].lock();
+		if (bytes)
+			return bytes;
+		bytes.reset(new VideoBytes);
+		if (!bytes->Read(filename))
+			return std::shared_ptr<VideoBytes>();
+		files[filename] = bytes;
+		return bytes;
+	}
+
+	~VideoBytes()
+	{
+		if (view)
+			UnmapViewOfFile(view);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+
+private:
+	std::vector<char> memory;
+	HANDLE file, mapping;
+	void *view;
+
+	VideoBytes() : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL) {}
+
+	bool Read(const char *filename)
+	{
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return false;
+		size = fileSize.QuadPart;
+		if (size <= (long long)preload_mb << 20)
+		{
+			memory.resize(size_t(size));
+			for (long long done = 0; done < size;)
+			{
+				DWORD n = 0;
+				if (!ReadFile(file, &memory[size_t(done)], DWORD((std::min)(size - done, 1LL << 30)), &n, NULL) || n == 0)
+					return false;
+				done += n;
+			}
+			data = &memory[0];
+			return true;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		data = (const char*)view;
+		return view != NULL;
+	}
+};
+
+//a capture's reading and seeking in the bytes of a video
+class MemoryStream : public cv::IStreamReader
+{
+public:
+	MemoryStream(const std::shared_ptr<VideoBytes> &_bytes) : bytes(_bytes), position(0) {}
+
+	long long read(char *buffer, long long size) CV_OVERRIDE
+	{
+		long long n = (std::max)(0LL, (std::min)(size, bytes->size - position));
+		memcpy(buffer, bytes->data + position, size_t(n));
+		position += n;
+		return n;
+	}
+
+	long long seek(long long offset, int origin) CV_OVERRIDE
+	{
+		long long base = (origin == SEEK_CUR) ? position : (origin == SEEK_END) ? bytes->size : 0;
+		if (base + offset < 0 || base + offset > bytes->size)
+			return -1;
+		position = base + offset;
+		return position;
+	}
+
+private:
+	std::shared_ptr<VideoBytes> bytes;
+	long long position;
+};
+#endif
+
+//opens a video decoded on the GPU (D3D11/DXVA or Media Foundation, whichever the OpenCV build has)
+//when hardware decoding is on, else on the CPU, and read from memory when memory reading is on.
+//asDecoded: the frames as decoded, the 16-bit gray of a depth video of more than 8 bits or the NV12 planes
+//of the color, instead of converted to 8-bit BGR
+static bool OpenVideo(cv::VideoCapture &video, const char *filename, bool asDecoded = false)
+{
+	bool opened = false;
+	std::vector<int> params;
+#ifdef VIDEO_HW_ACCELERATION
+	if (hardware_decode)
+		params = { cv::CAP_PROP_HW_ACCELERATION, cv::VIDEO_ACCELERATION_ANY };
+#else
+	if (hardware_decode)
+		std::cout << "OpenCV " << CV_VERSION << " has no hardware decoding, decoding " << filename << " on the CPU\n";
+#endif
+#ifdef VIDEOCAPTURE_STREAM_READER
+	if (memory_reading && !IsStream(filename))
+	{
+		std::shared_ptr<VideoBytes> bytes = VideoBytes::Open(filename);
+		opened = bytes && video.open(cv::makePtr<MemoryStream>(bytes), cv::CAP_ANY, params);
+		if (!opened)
+			std::cout << "cannot read " << filename << " from memory, reading the file\n";
+	}
+#else
+	if (memory_reading)
+		std::cout << "OpenCV " << CV_VERSION << " has no captures of memory, reading the file " << filename << "\n";
+#endif
+#ifdef VIDEO_HW_ACCELERATION
+	if (!opened && hardware_decode)
+		opened = video.open(filename, cv::CAP_ANY, params);
+	if (opened && hardware_decode && video.get(cv::CAP_PROP_HW_ACCELERATION) == cv::VIDEO_ACCELERATION_NONE)
+		std::cout << "no hardware decoder for " << filename << ", decoding on the CPU\n";
+#endif
+	if (!opened && !video.open(filename))
+		return false;
+	if (asDecoded)
+		video.set(cv::CAP_PROP_CONVERT_RGB, 0);
+	return true;
+}
+
+//the pixels of a decoded frame for glTexSubImage2D: 8-bit BGR, the 8-bit gray of the alpha or the
+//16-bit gray of a depth video, or BGRA
+static void PixelFormat(int type, GLenum &format, GLenum &pixelType)
+{
+	format = (CV_MAT_CN(type) == 1) ? GL_RED : (CV_MAT_CN(type) == 4) ? GL_BGRA : GL_BGR;
+	pixelType = (CV_MAT_DEPTH(type) == CV_16U) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+}
+
+//the gray of a single-channel texture read in every channel, as the gray of a BGR one, so the shaders
+//sample the alpha and the depth the same way whatever their textures
+static void GraySwizzle()
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+}
+
+//the mip levels of a texture down to 1x1
+static int MipLevels(int width, int height)
+{
+	int levels = 1;
+	while (((std::max)(width, height) >> levels) > 0)
+		levels++;
+	return levels;
+}
+
+//trilinear and anisotropic sampling of the bound texture, with the most anisotropy the GPU has
+static void MipmapFiltering()
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	if (GLE_EXT_texture_filter_anisotropic)
+	{
+		GLfloat anisotropy = 1;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &anisotropy);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+	}
+}
+
+//textures deleted, and out of gpuResidency
+static void FreeTextures(GLsizei n, const GLuint *textures)
+{
+	glDeleteTextures(n, textures);
+	for (GLsizei i = 0; i < n; i++)
+		gpuResidency.FreeTexture(textures[i]);
+}
+
+//an immutable texture of frames of a size and a type, updated with glTexSubImage2D only, and filled with
+//pixels unless NULL. A gray frame gets a single channel of its 8 or 16 bits. mipmapped: with all the mip
+//levels, generated after every upload. Its bytes are in the video pool of gpuResidency until FreeTextures
+static GLuint VideoTexture(cv::Size size, int type, const void *pixels, bool mipmapped = false)
+{
+	bool gray = CV_MAT_CN(type) == 1;
+	GLenum format, pixelType;
+	PixelFormat(type, format, pixelType);
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	GLenum internalFormat = gray ? ((CV_MAT_DEPTH(type) == CV_16U) ? GL_R16 : GL_R8) : (CV_MAT_CN(type) == 4) ? GL_RGBA8 : GL_RGB8;
+	glTexStorage2D(GL_TEXTURE_2D, mipmapped ? MipLevels(size.width, size.height) : 1, internalFormat, size.width, size.height);
+	gpuResidency.Texture(texture, GpuResidency::PoolVideo, TextureBytes(size.width, size.height, CV_ELEM_SIZE(type), mipmapped));
+	if (pixels)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.width, size.height, format, pixelType, pixels);
+	if (mipmapped)
+	{
+		if (pixels)
+			glGenerateMipmap(GL_TEXTURE_2D);
+		MipmapFiltering();
+	}
+	else
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (gray)
+		GraySwizzle();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+//A file mapped read only, e.g. a clip cache whose images are uploaded from its view in place. Nothing writes it
+//while it is mapped: a clip cache is replaced by a new one, see ClipCache::Replace
+class MappedFile
+{
+public:
+	const unsigned char *data;
+	long long size;
+
+	static std::shared_ptr<MappedFile> Open(const std::string &filename)
+	{
+		std::shared_ptr<MappedFile> mapped(new MappedFile);
+		mapped->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER fileSize;
+		if (mapped->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(mapped->file, &fileSize) || fileSize.QuadPart == 0)
+			return std::shared_ptr<MappedFile>();
+		mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		mapped->view = mapped->mapping ? MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (!mapped->view)
+			return std::shared_ptr<MappedFile>();
+		mapped->data = (const unsigned char*)mapped->view;
+		mapped->size = fileSize.QuadPart;
+		return mapped;
+	}
+
+	~MappedFile()
+	{
+		if (view)
+			UnmapViewOfFile(view);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+
+private:
+	HANDLE file, mapping;
+	void *view;
+
+	MappedFile() : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL) {}
+};
+
+//A background layer, read by a loader thread and uploaded by the video thread: the blocks of the DDS
+//the preprocessing baked, BC1 or BC4 (DXT1 or ATI1, see TextureCompression.h of the optical flow), or
+//the image of the png
+struct BackgroundLayer
+{
+	std::vector<unsigned char> blocks;
+	GLsizei width, height;
+	bool bc1, gray;
+	cv::Mat image;
+	std::shared_ptr<MappedFile> mapping;	//the clip cache the image is a view of, if it is one
+};
+
+//false without the DDS
+static bool ReadCompressed(BackgroundLayer &layer, const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	unsigned int header[32];
+	if (!file.read((char*)header, sizeof(header)) || memcmp(&header[0], "DDS ", 4) != 0)
+		return false;
+	layer.bc1 = memcmp(&header[21], "DXT1", 4) == 0;
+	if (!layer.bc1 && memcmp(&header[21], "ATI1", 4) != 0)
+	{
+		std::cout << filename << " is neither DXT1 nor ATI1\n";
+		return false;
+	}
+	layer.height = header[3];
+	layer.width = header[4];
+	layer.blocks.resize(size_t((layer.width + 3) / 4) * ((layer.height + 3) / 4) * 8);
+	if (!file.read((char*)&layer.blocks[0], layer.blocks.size()))
+	{
+		std::cout << filename << " is truncated\n";
+		layer.blocks.clear();
+		return false;
+	}
+	return true;
+}
+
+//a background layer: name.dds when the preprocessing baked it, else the png, as they are: the shaders grade
+//the color layers. gray: a single channel, the depth and the alpha
+static BackgroundLayer ReadBackground(const char *filename, bool gray)
+{
+	BackgroundLayer layer;
+	layer.gray = gray;
+	std::string name(filename);
+	if (ReadCompressed(layer, LocalFile(name.substr(0, name.find_last_of('.')) + ".dds")))
+		return layer;
+	layer.image = cv::imread(LocalFile(name), gray ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+	return layer;
+}
+
+//the texture of a layer, or its image replaced by the layer of another clip. An image that does not fit the budget
+//of gpuResidency in the place of the texture is uploaded at half its width and height, or at a quarter; the blocks
+//of the DDS as they are
+static void BackgroundTexture(GLuint *texture, const BackgroundLayer &layer)
+{
+	cv::Mat image = layer.image;
+	bool mipmapped = !layer.gray && layer.blocks.empty() && video_mipmaps;
+	for (int halved = 0; halved < 2 && !image.empty(); halved++)
+	{
+		if (gpuResidency.Fits(TextureBytes(image.cols, image.rows, layer.gray ? 1 : 4, mipmapped), *texture))
+			break;
+		cv::Mat half;
+		cv::resize(image, half, cv::Size((image.cols + 1) / 2, (image.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+		image = half;
+	}
+	if (image.cols != layer.image.cols)
+		std::cout << "a background layer is downscaled to " << image.cols << "x" << image.rows << " for the GPU memory budget\n";
+	if (!*texture)
+		glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_2D, *texture);
+	if (!layer.blocks.empty())
+		glCompressedTexImage2D(GL_TEXTURE_2D, 0, layer.bc1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RED_RGTC1, layer.width, layer.height, 0, GLsizei(layer.blocks.size()), &layer.blocks[0]);
+	else if (layer.gray)
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, image.cols, image.rows, 0, GL_RED, GL_UNSIGNED_BYTE, image.data);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.cols, image.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, image.data);
+	if (layer.gray)
+		GraySwizzle();
+	//the DDS has a single level
+	if (mipmapped)
+	{
+		glGenerateMipmap(GL_TEXTURE_2D);
+		MipmapFiltering();
+	}
+	else
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpuResidency.Texture(*texture, GpuResidency::PoolLayers, !layer.blocks.empty() ? (long long)layer.blocks.size() :
+		TextureBytes(image.cols, image.rows, layer.gray ? 1 : 4, mipmapped));
+}
+
+//The buffers of the frames of the decoders that are not decoded in place into the slots: the BGR of the alpha
+//and of the tiles, the renditions scaled, the heads of the loops and the first frames of the clips. A cv::Mat
+//given it as its allocator reuses a buffer of its size freed, so decoding a frame allocates no memory once
+//the ring runs; the buffers are page-locked where the working set allows it, so they are never paged out
+//under the decoders. The buffers freed over maxPooled bytes, e.g. of a clip of another resolution, are released
+class FramePool : public cv::MatAllocator
+{
+	static const size_t maxPooled = size_t(256) << 20;
+	mutable std::mutex mutex;
+	mutable std::multimap<size_t, void*> pooled;	//the buffers freed, by their size
+	mutable size_t pooledBytes;
+	mutable bool lockable;							//the working set grown for the buffers so far
+
+	//the size of whole pages of 64 KB, the granularity of VirtualAlloc, of a buffer of bytes
+	static size_t Pages(size_t bytes) { return (bytes + (size_t(64) << 10) - 1) >> 16 << 16; }
+
+	//a buffer of whole pages of size
+	void *Get(size_t size) const
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::multimap<size_t, void*>::iterator reused = pooled.find(size);
+			if (reused != pooled.end())
+			{
+				void *memory = reused->second;
+				pooled.erase(reused);
+				pooledBytes -= size;
+				return memory;
+			}
+		}
+		void *memory = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!memory)
+			CV_Error(cv::Error::StsNoMem, "cannot allocate a frame buffer");
+		std::lock_guard<std::mutex> lock(mutex);
+		SIZE_T minimum, maximum;
+		if (lockable && !VirtualLock(memory, size))
+		{
+			lockable = GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) &&
+				SetProcessWorkingSetSize(GetCurrentProcess(), minimum + size, (std::max)(maximum, minimum + size)) &&
+				VirtualLock(memory, size);
+			if (!lockable)
+				std::cout << "cannot page-lock the frame buffers of the decoders
+";
+		}
+		return memory;
+	}
+
+public:
+	FramePool() : pooledBytes(0), lockable(true) {}
+
+	~FramePool()
+	{
+		for (std::multimap<size_t, void*>::iterator i = pooled.begin(); i != pooled.end(); ++i)
+			VirtualFree(i->second, 0, MEM_RELEASE);
+	}
+
+	//the steps of the cv::Mat as OpenCV's own allocator sets them, its data in a buffer of the pool
+	cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int, cv::UMatUsageFlags) const
+	{
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--)
+		{
+			if (step)
+			{
+				if (data && step[i] != CV_AUTOSTEP)
+					total = (std::max)(total, step[i]);
+				step[i] = total;
+			}
+			total *= sizes[i];
+		}
+		cv::UMatData *u = new cv::UMatData(this);
+		u->size = total;
+		if (data)
+		{
+			u->data = u->origdata = (uchar*)data;
+			u->flags |= cv::UMatData::USER_ALLOCATED;
+			return u;
+		}
+		u->data = u->origdata = (uchar*)Get(Pages(total));
+		return u;
+	}
+
+	bool allocate(cv::UMatData *u, int, cv::UMatUsageFlags) const
+	{
+		return u != NULL;
+	}
+
+	void deallocate(cv::UMatData *u) const
+	{
+		if (!u)
+			return;
+		if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t size = Pages(u->size);
+			if (pooledBytes + size <= maxPooled)
+			{
+				pooled.insert(std::make_pair(size, (void*)u->origdata));
+				pooledBytes += size;
+			}
+			else
+				VirtualFree(u->origdata, 0, MEM_RELEASE);
+		}
+		delete u;
+	}
+};
+FramePool framePool;
+
+//a decoded frame into the memory of a slot: copied, or the first channel of the BGR of the alpha kept
+//in its single channel. A rendition of a lower resolution is scaled to the slot, with linear
+//interpolation, else the nearest pixels so the depth and the alpha keep their edges. false if empty
+static bool StoreFrame(const cv::Mat &decoded, cv::Mat &target, bool linear = false)
+{
+	if (decoded.empty())
+		return false;
+	if (decoded.size() != target.size())
+	{
+		cv::Mat scaled;
+		scaled.allocator = &framePool;
+		cv::resize(decoded, scaled, target.size(), 0, 0, linear ? cv::INTER_LINEAR : cv::INTER_NEAREST);
+		return StoreFrame(scaled, target);
+	}
+	if (decoded.data == target.data)
+		return true;
+	if (decoded.type() == target.type())
+		decoded.copyTo(target);
+	else if (decoded.type() == CV_8UC3 && target.type() == CV_8UC1)
+		cv::extractChannel(decoded, target, 0);
+	else
+		return false;
+	return true;
+}
+
+//The cells of a frame of a single channel its decoder changed over the frame its slot held before, rows x cols
+//cells of the frame, a bit per column in every row. Where the texture of the slot still holds that frame, only
+//they are uploaded
+struct ChangedCells
+{
+	static const int rows = 32, cols = 64;
+	unsigned long long bits[rows];
+
+	ChangedCells(bool changed = false) { Fill(changed); }
+
+	void Fill(bool changed)
+	{
+		for (int r = 0; r < rows; r++)
+			bits[r] = changed ? ~0ULL : 0;
+	}
+
+	//the first pixel of cell i of n over size pixels
+	static int Bound(int i, int n, int size)
+	{
+		return int((long long)i * size / n);
+	}
+};
+
+//the first channel of the BGR decoded, or the single channel of a frame copied, into the single channel of
+//target as StoreFrame, marking the cells it changes; all of them for any other store
+static bool StoreChanged(const cv::Mat &decoded, cv::Mat &target, ChangedCells &changed)
+{
+	if (decoded.empty())
+		return false;
+	if (decoded.size() != target.size() && decoded.type() == CV_8UC3)
+	{
+		cv::Mat scaled;
+		scaled.allocator = &framePool;
+		cv::resize(decoded, scaled, target.size(), 0, 0, cv::INTER_NEAREST);
+		return StoreChanged(scaled, target, changed);
+	}
+	if ((decoded.type() != CV_8UC3 && decoded.type() != CV_8UC1) || target.type() != CV_8UC1)
+	{
+		changed.Fill(true);
+		return StoreFrame(decoded, target);
+	}
+	int channels = decoded.channels();
+	int columns[ChangedCells::cols + 1];
+	for (int c = 0; c <= ChangedCells::cols; c++)
+		columns[c] = ChangedCells::Bound(c, ChangedCells::cols, target.cols);
+	for (int r = 0; r < ChangedCells::rows; r++)
+		for (int y = ChangedCells::Bound(r, ChangedCells::rows, target.rows); y < ChangedCells::Bound(r + 1, ChangedCells::rows, target.rows); y++)
+		{
+			const unsigned char *source = decoded.ptr(y);
+			unsigned char *row = target.ptr(y);
+			for (int c = 0; c < ChangedCells::cols; c++)
+			{
+				unsigned char difference = 0;
+				for (int x = columns[c]; x < columns[c + 1]; x++)
+				{
+					unsigned char value = source[channels * x];
+					difference |= row[x] ^ value;
+					row[x] = value;
+				}
+				if (difference)
+					changed.bits[r] |= 1ULL << c;
+			}
+		}
+	return true;
+}
+
+//The coarse depth of a plain 360 video computed as it plays, for previews of clips not preprocessed: the flow
+//from the frame before, by the dense inverse search of OpenCV at width live_width on its UMats, OpenCL on the
+//GPU where there is one. The median of the flow is the rotation of the camera, mostly a yaw that shifts the
+//equirect as a whole, and what is left of it the parallax, large for the near points as the depth stage of
+//the preprocessing has it, 255 the nearest. The parallax is averaged over time and normalized by its smoothed
+//high percentile; without the motion of the camera there is no parallax and the depth fades to the far
+struct LiveDepth
+{
+	cv::Ptr<cv::DISOpticalFlow> flow;
+	cv::UMat previous, current, motion;
+	cv::Mat small, gray, vectors, parallax, history, smoothed, depth8, depth;
+	std::vector<float> samples;
+	double range;
+
+	LiveDepth() : range(0) {}
+
+	//no flow from the frame before the next one, e.g. across the loop of the video
+	void Restart()
+	{
+		previous.release();
+	}
+
+	void Reset()
+	{
+		Restart();
+		history.release();
+		range = 0;
+	}
+
+	//the depth of frame bgr into target, BGR of the size of bgr as the depth of the packed frame
+	void Compute(const cv::Mat &bgr, cv::Mat &target)
+	{
+		int width = (std::min)((std::max)(live_width, 16), bgr.cols), height = (std::max)(1, bgr.rows * width / bgr.cols);
+		cv::resize(bgr, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+		cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+		gray.copyTo(current);
+		if (!previous.empty() && previous.size() == current.size())
+		{
+			if (!flow)
+				flow = cv::DISOpticalFlow::create(cv::DISOpticalFlow::PRESET_FAST);
+			flow->calc(previous, current, motion);
+			motion.copyTo(vectors);
+			//the rotation, the medians of the two components
+			float median[2];
+			for (int c = 0; c < 2; c++)
+			{
+				samples.resize(vectors.total());
+				const float *v = vectors.ptr<float>();
+				for (size_t i = 0; i < samples.size(); i++)
+					samples[i] = v[i * 2 + c];
+				std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+				median[c] = samples[samples.size() / 2];
+			}
+			parallax.create(height, width, CV_32FC1);
+			const float *v = vectors.ptr<float>();
+			float *rho = parallax.ptr<float>();
+			for (int i = 0; i < width * height; i++)
+				rho[i] = std::hypot(v[i * 2] - median[0], v[i * 2 + 1] - median[1]);
+			if (history.size() != parallax.size())
+				history = cv::Mat::zeros(parallax.size(), CV_32FC1);
+			cv::accumulateWeighted(parallax, history, 0.3);
+		}
+		std::swap(previous, current);
+		if (history.empty())
+		{
+			target.setTo(cv::Scalar::all(128));
+			return;
+		}
+		cv::blur(history, smoothed, cv::Size(5, 5));
+		//the 99th percentile, the range of 255
+		samples.assign(smoothed.ptr<float>(), smoothed.ptr<float>() + smoothed.total());
+		std::nth_element(samples.begin(), samples.begin() + samples.size() * 99 / 100, samples.end());
+		double high = samples[samples.size() * 99 / 100];
+		range = range > 0 ? 0.9 * range + 0.1 * high : high;
+		smoothed.convertTo(depth8, CV_8U, 255.0 / (std::max)(range, 0.05));
+		cv::resize(depth8, depth, target.size(), 0, 0, cv::INTER_LINEAR);
+		cv::cvtColor(depth, target, cv::COLOR_GRAY2BGR);
+	}
+};
+
+//The depth of the frames filtered on the GPU by a compute shader after their upload: the median of 3x3
+//texels, the columns wrapping around the panorama, and its edges, 1 where the range of the 3x3 texels is over
+//edgeStep. The programs of the video layer discard its triangles with a corner on the edges, instead of
+//stretching them from the foreground to the background. The filtered depth and the edges are textures of the
+//slot of their own, handed to the render thread in place of the depth uploaded
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+#ifndef GL_RG16F
+#define GL_RG16F 0x822F
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+#ifndef GL_TEXTURE_UPDATE_BARRIER_BIT
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#endif
+#ifndef GL_RG
+#define GL_RG 0x8227
+#endif
+#ifndef GL_RG8
+#define GL_RG8 0x822B
+#endif
+
+typedef void (APIENTRY *DispatchComputeProc)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRY *BindImageTextureProc)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRY *MemoryBarrierProc)(GLbitfield barriers);
+
+//The compute passes over the depth of every frame uploaded, on the context of the video thread: the 3x3
+//median of the depth and the mask of its edges, and the pyramid of its min and max. Level 0 of the
+//pyramid is the min (r) and the max (g) of 2x2 texels of the depth, every next level of 2x2 texels of the
+//last one, to 1x1; the columns wrap around as the equirect does, the last row repeats. The ray marching
+//skips the empty space with it, the tessellation reads the range of the depth of an edge
+struct DepthFilter
+{
+	DispatchComputeProc dispatchCompute;
+	BindImageTextureProc bindImageTexture;
+	MemoryBarrierProc memoryBarrier;
+	GLuint program[2];		//of the depth of 8 and of 16 bits, made for their first frame
+	GLuint pyramidProgram[2];	//of level 0 from the depth, and of a level from the last one
+	float edgeStep;
+	bool enabled, pyramid;
+
+	void Load(float step, bool _pyramid)
+	{
+		dispatchCompute = (DispatchComputeProc)wglGetProcAddress("glDispatchCompute");
+		bindImageTexture = (BindImageTextureProc)wglGetProcAddress("glBindImageTexture");
+		memoryBarrier = (MemoryBarrierProc)wglGetProcAddress("glMemoryBarrier");
+		program[0] = program[1] = 0;
+		pyramidProgram[0] = pyramidProgram[1] = 0;
+		edgeStep = step;
+		bool compute = dispatchCompute && bindImageTexture && memoryBarrier;
+		enabled = step > 0 && compute;
+		pyramid = _pyramid && compute;
+		if (step > 0 && !enabled)
+			std::cout << "no compute shaders, the depth is not filtered\n";
+		if (_pyramid && !pyramid)
+			std::cout << "no compute shaders, no pyramid of the depth\n";
+	}
+
+	//a compute program of a source, 0 if it does not link
+	static GLuint Compute(const std::string &source)
+	{
+		const GLchar *text = source.c_str();
+		GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shader, 1, &text, NULL);
+		glCompileShader(shader);
+		GLuint p = glCreateProgram();
+		glAttachShader(p, shader);
+		glLinkProgram(p);
+		glDetachShader(p, shader);
+		glDeleteShader(shader);
+		GLint r;
+		glGetProgramiv(p, GL_LINK_STATUS, &r);
+		if (!r)
+		{
+			glDeleteProgram(p);
+			p = 0;
+		}
+		return p;
+	}
+
+	GLuint Program(bool depth16)
+	{
+		GLuint &p = program[depth16];
+		if (p || !enabled)
+			return p;
+		std::string source = std::string("#version 430\n"
+			"layout(local_size_x = 16, local_size_y = 16) in;\n"
+			"layout(binding = 0) uniform sampler2D rawDepth;\n"
+			"layout(") + (depth16 ? "r16" : "r8") + ", binding = 0) writeonly uniform image2D filteredDepth;\n"
+			"layout(r8, binding = 1) writeonly uniform image2D depthEdges;\n"
+			"uniform float edgeStep;\n"
+			"void main()\n"
+			"{\n"
+			"\tivec2 size = textureSize(rawDepth, 0), p = ivec2(gl_GlobalInvocationID.xy);\n"
+			"\tif (p.x >= size.x || p.y >= size.y)\n"
+			"\t\treturn;\n"
+			"\tfloat d[9];\n"
+			"\tfor (int j = 0; j < 3; j++)\n"
+			"\t\tfor (int i = 0; i < 3; i++)\n"
+			"\t\t\td[j * 3 + i] = texelFetch(rawDepth, ivec2((p.x + i - 1 + size.x) % size.x, clamp(p.y + j - 1, 0, size.y - 1)), 0).r;\n"
+			"\tfloat low = d[0], high = d[0];\n"
+			"\tfor (int i = 1; i < 9; i++)\n"
+			"\t{\n"
+			"\t\tlow = min(low, d[i]);\n"
+			"\t\thigh = max(high, d[i]);\n"
+			"\t}\n"
+			//the five lowest in order, the fifth the median
+			"\tfor (int i = 0; i < 5; i++)\n"
+			"\t\tfor (int k = i + 1; k < 9; k++)\n"
+			"\t\t\tif (d[k] < d[i])\n"
+			"\t\t\t{\n"
+			"\t\t\t\tfloat t = d[i];\n"
+			"\t\t\t\td[i] = d[k];\n"
+			"\t\t\t\td[k] = t;\n"
+			"\t\t\t}\n"
+			"\timageStore(filteredDepth, p, vec4(d[4]));\n"
+			"\timageStore(depthEdges, p, vec4(high - low > edgeStep ? 1.0 : 0.0));\n"
+			"}\n";
+		p = Compute(source);
+		if (!p)
+		{
+			std::cout << "the compute shader of the depth does not link, the depth is not filtered\n";
+			enabled = false;
+		}
+		return p;
+	}
+
+	//level: 0 from the depth, another from the level before it
+	GLuint PyramidProgram(bool level)
+	{
+		GLuint &p = pyramidProgram[level];
+		if (p || !pyramid)
+			return p;
+		std::string source = std::string("#version 430\n"
+			"layout(local_size_x = 16, local_size_y = 16) in;\n") +
+			(level ? "layout(rg16f, binding = 0) readonly uniform image2D source;\n" : "layout(binding = 0) uniform sampler2D source;\n") +
+			"layout(rg16f, binding = 1) writeonly uniform image2D target;\n"
+			"void main()\n"
+			"{\n"
+			"\tivec2 size = " + (level ? "imageSize(source)" : "textureSize(source, 0)") + ", p = ivec2(gl_GlobalInvocationID.xy);\n"
+			"\tif (p.x >= imageSize(target).x || p.y >= imageSize(target).y)\n"
+			"\t\treturn;\n"
+			"\tvec2 range = vec2(1.0, 0.0);\n"
+			"\tfor (int j = 0; j < 2; j++)\n"
+			"\t\tfor (int i = 0; i < 2; i++)\n"
+			"\t\t{\n"
+			"\t\t\tivec2 q = ivec2((2 * p.x + i) % size.x, min(2 * p.y + j, size.y - 1));\n" +
+			(level ? "\t\t\tvec2 r = imageLoad(source, q).rg;\n" : "\t\t\tvec2 r = texelFetch(source, q, 0).rr;\n") +
+			"\t\t\trange = vec2(min(range.x, r.x), max(range.y, r.y));\n"
+			"\t\t}\n"
+			"\timageStore(target, p, vec4(range, 0.0, 0.0));\n"
+			"}\n";
+		p = Compute(source);
+		if (!p)
+		{
+			std::cout << "the compute shader of the pyramid of the depth does not link, no pyramid\n";
+			pyramid = false;
+		}
+		return p;
+	}
+
+	//the levels of a pyramid of levels from the depth, level 0 of size; false if not built
+	bool Pyramid(GLuint depth, GLuint target, cv::Size size, int levels)
+	{
+		GLuint first = PyramidProgram(false), next = PyramidProgram(true);
+		if (!first || !next)
+			return false;
+		glUseProgram(first);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		for (int level = 0; level < levels; level++)
+		{
+			if (level == 1)
+				glUseProgram(next);
+			if (level > 0)
+			{
+				bindImageTexture(0, target, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_RG16F);
+				memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			}
+			bindImageTexture(1, target, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+			dispatchCompute((size.width + 15) / 16, (size.height + 15) / 16, 1);
+			size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+		}
+		memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+		return true;
+	}
+
+	//the filtered depth and the edges of depth, textures of its size and type; false if not filtered
+	bool Run(GLuint depth, GLuint filtered, GLuint edges, cv::Size size, int type)
+	{
+		bool depth16 = CV_MAT_DEPTH(type) == CV_16U;
+		GLuint p = Program(depth16);
+		if (!p)
+			return false;
+		glUseProgram(p);
+		glUniform1f(glGetUniformLocation(p, "edgeStep"), edgeStep);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		bindImageTexture(0, filtered, 0, GL_FALSE, 0, GL_WRITE_ONLY, depth16 ? GL_R16 : GL_R8);
+		bindImageTexture(1, edges, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+		dispatchCompute((size.width + 15) / 16, (size.height + 15) / 16, 1);
+		memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+		return true;
+	}
+};
+
+//The conversion of the NV12 planes of a color frame uploaded, on the context of the video thread: the luma
+//of the frame, an R8 texture, and its chroma of half its size, interleaved U and V in an RG8 one, converted
+//by BT.709 of the video range to the RGBA8 color texture of the slot. The planes are of the converter, not
+//of the slots: the conversion of a slot is done with them before the upload of the next one replaces them
+struct ColorConverter
+{
+	DispatchComputeProc dispatchCompute;
+	BindImageTextureProc bindImageTexture;
+	MemoryBarrierProc memoryBarrier;
+	GLuint program;
+	GLuint planes[2];		//the luma and the chroma
+	cv::Size planeSize;		//of the luma
+	bool enabled;
+
+	void Load()
+	{
+		dispatchCompute = (DispatchComputeProc)wglGetProcAddress("glDispatchCompute");
+		bindImageTexture = (BindImageTextureProc)wglGetProcAddress("glBindImageTexture");
+		memoryBarrier = (MemoryBarrierProc)wglGetProcAddress("glMemoryBarrier");
+		enabled = dispatchCompute && bindImageTexture && memoryBarrier;
+		program = 0;
+		planes[0] = planes[1] = 0;
+		planeSize = cv::Size();
+	}
+
+	//the size of the color of the planes of a frame of size, the luma over the chroma
+	static cv::Size Picture(cv::Size size) { return cv::Size(size.width, size.height * 2 / 3); }
+
+	GLuint Program()
+	{
+		if (program || !enabled)
+			return program;
+		program = DepthFilter::Compute("#version 430\n"
+			"layout(local_size_x = 16, local_size_y = 16) in;\n"
+			"layout(binding = 0) uniform sampler2D luma;\n"
+			"layout(binding = 1) uniform sampler2D chroma;\n"
+			"layout(rgba8, binding = 0) writeonly uniform image2D picture;\n"
+			"void main()\n"
+			"{\n"
+			"\tivec2 size = imageSize(picture), p = ivec2(gl_GlobalInvocationID.xy);\n"
+			"\tif (p.x >= size.x || p.y >= size.y)\n"
+			"\t\treturn;\n"
+			"\tfloat y = (texelFetch(luma, p, 0).r - 16.0 / 255.0) * (255.0 / 219.0);\n"
+			"\tvec2 uv = (texture(chroma, (vec2(p) + 0.5) / vec2(size)).rg - 128.0 / 255.0) * (255.0 / 224.0);\n"
+			"\tvec3 rgb = vec3(y + 1.5748 * uv.y, y - 0.1873 * uv.x - 0.4681 * uv.y, y + 1.8556 * uv.x);\n"
+			"\timageStore(picture, p, vec4(clamp(rgb, 0.0, 1.0), 1.0));\n"
+			"}\n");
+		if (!program)
+		{
+			std::cout << "the compute shader of the color planes does not link, the color is not converted\n";
+			enabled = false;
 		}
-		/////////////////////////////////////////////////////////////////////////////////////////////
-		//ovrSessionStatus sessionStatus;
-		ovr_GetSessionStatus(session, &sessionStatus);
-		if (sessionStatus.ShouldQuit)
+		return program;
+	}
+
+	//the planes of a frame of size, from pixels in the bound unpack buffer or in memory, converted to the
+	//color texture picture; false if not converted
+	bool Run(const void *pixels, GLuint picture, cv::Size size)
+	{
+		GLuint p = Program();
+		if (!p)
+			return false;
+		cv::Size luma = Picture(size);
+		if (planeSize != luma)
+		{
+			FreeTextures(2, planes);
+			planes[0] = VideoTexture(luma, CV_8UC1, NULL);
+			glGenTextures(1, &planes[1]);
+			glBindTexture(GL_TEXTURE_2D, planes[1]);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG8, luma.width / 2, luma.height / 2);
+			gpuResidency.Texture(planes[1], GpuResidency::PoolVideo, TextureBytes(luma.width / 2, luma.height / 2, 2));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			planeSize = luma;
+		}
+		glBindTexture(GL_TEXTURE_2D, planes[0]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, luma.width, luma.height, GL_RED, GL_UNSIGNED_BYTE, pixels);
+		glBindTexture(GL_TEXTURE_2D, planes[1]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, luma.width / 2, luma.height / 2, GL_RG, GL_UNSIGNED_BYTE, (const char*)pixels + size_t(luma.area()));
+		glUseProgram(p);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, planes[1]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, planes[0]);
+		bindImageTexture(0, picture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		dispatchCompute((luma.width + 15) / 16, (luma.height + 15) / 16, 1);
+		memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+		return true;
+	}
+
+	void Release()
+	{
+		FreeTextures(2, planes);
+		planes[0] = planes[1] = 0;
+		planeSize = cv::Size();
+	}
+};
+
+//The decoders of FrameRing in a process of their own, the viewer started again with -decoder, at DecoderProcess
+//on. They decode into the slots of a ring in shared memory that the video thread uploads from, so a decoder
+//that crashes or stalls takes down its process and not the session, and the decoders spread over the cores
+//on their own. The processes only exchange indices that grow, the frame requested of every slot and the
+//frame every video stored in it, with no lock between them. The header is written by the viewer before the
+//process starts, the frames of the slots follow it
+struct SharedFrames
+{
+	static const int nSlots = FrameHandoff::nSlots;
+	static const int nVideos = FrameHandoff::nVideos;
+	static const int maxPath = 1024;
+
+	DWORD viewer;					//the process of the viewer, the decoder process quits with it
+	int nStreams, nFrames;			//the 3 videos or the packed one, and the frames of the videos
+	long long start, resume;		//the frame of the playback at frame 1 of the videos, and the first one to decode
+	long long slotBytes;
+	int width[nVideos], height[nVideos], type[nVideos];
+	long long offset[nVideos];
+	bool packed, asDecoded[nVideos];
+	bool hardware, memory;			//hardware_decode and memory_reading of the viewer, for OpenVideo
+	char filename[nVideos][maxPath];
+	std::atomic<int> stop;
+	std::atomic<long long> request[nSlots];				//the frame every slot is given back for
+	std::atomic<long long> stored[nSlots][nVideos];		//the frame every video stored in the slot
+	std::atomic<long long> loopEnd[nSlots];				//the frame of the slot that ended a loop of the videos
+
+	static size_t HeaderBytes() { return (sizeof(SharedFrames) + 4095) / 4096 * 4096; }
+	unsigned char *Slot(int i) { return (unsigned char*)this + HeaderBytes() + size_t(i) * size_t(slotBytes); }
+
+	//the position in the videos of frame n of the playback, frame 0 shown before the loops
+	int Position(long long n) const { return 1 + int((n - start) % (std::max)(nFrames - 1, 1)); }
+};
+
+//The side of the viewer: the shared memory of the ring, and the decoder process started on it
+class DecoderProcess
+{
+	OVR::Ptr<OVR::SharedMemory> memory;
+	SharedFrames *shared;
+	PROCESS_INFORMATION process;
+	int generation;					//of the shared memory, a new one for every layout
+
+public:
+	DecoderProcess() : shared(NULL), generation(0)
+	{
+		process.hProcess = process.hThread = NULL;
+	}
+
+	//the shared ring of the slots of slotBytes, NULL if it cannot be mapped
+	SharedFrames *Map(long long slotBytes)
+	{
+		Unmap();
+		long long bytes = (long long)SharedFrames::HeaderBytes() + slotBytes * SharedFrames::nSlots;
+		if (bytes > INT_MAX)
+			return NULL;
+		char name[64];
+		snprintf(name, sizeof(name), "6dof_frames_%lu_%d", GetCurrentProcessId(), generation++);
+		OVR::SharedMemory::OpenParameters params;
+		params.globalName = name;
+		params.minSizeBytes = int(bytes);
+		params.openMode = OVR::SharedMemory::OpenMode_CreateOnly;
+		memory = OVR::SharedMemoryFactory::GetInstance()->Open(params);
+		if (!memory || !memory->GetData())
+		{
+			memory.Clear();
+			return NULL;
+		}
+		shared = new (memory->GetData()) SharedFrames();
+		shared->slotBytes = slotBytes;
+		shared->viewer = GetCurrentProcessId();
+		shared->stop = 0;
+		for (int i = 0; i < SharedFrames::nSlots; i++)
+		{
+			shared->request[i] = -1;
+			shared->loopEnd[i] = -1;
+			for (int k = 0; k < SharedFrames::nVideos; k++)
+				shared->stored[i][k] = -1;
+		}
+		return shared;
+	}
+
+	void Unmap()
+	{
+		Stop();
+		shared = NULL;
+		memory.Clear();
+	}
+
+	SharedFrames *Frames() const
+	{
+		return shared;
+	}
+
+	//starts the process decoding from frame resume of the playback on the header written
+	bool Launch(long long resume)
+	{
+		shared->resume = resume;
+		shared->stop = 0;
+		char exe[MAX_PATH];
+		GetModuleFileNameA(NULL, exe, MAX_PATH);
+		std::string command = std::string("\"") + exe + "\" -decoder " + memory->GetName().ToCStr() + " " + std::to_string(memory->GetSizeI());
+		STARTUPINFOA startup = { sizeof(startup) };
+		if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup, &process))
+		{
+			std::cout << "cannot start the decoder process, error " << GetLastError() << "\n";
+			process.hProcess = process.hThread = NULL;
+			return false;
+		}
+		return true;
+	}
+
+	bool Running() const
+	{
+		return process.hProcess && WaitForSingleObject(process.hProcess, 0) == WAIT_TIMEOUT;
+	}
+
+	//asks the process to quit, and kills it if it does not within a second
+	void Stop()
+	{
+		if (!process.hProcess)
+			return;
+		shared->stop = 1;
+		if (WaitForSingleObject(process.hProcess, 1000) != WAIT_OBJECT_0)
+			TerminateProcess(process.hProcess, 1);
+		CloseHandle(process.hProcess);
+		CloseHandle(process.hThread);
+		process.hProcess = process.hThread = NULL;
+	}
+
+	//the process killed and started again from frame resume
+	bool Restart(long long resume)
+	{
+		if (process.hProcess)
+		{
+			TerminateProcess(process.hProcess, 1);
+			WaitForSingleObject(process.hProcess, 1000);
+			CloseHandle(process.hProcess);
+			CloseHandle(process.hThread);
+			process.hProcess = process.hThread = NULL;
+		}
+		return Launch(resume);
+	}
+};
+
+//video k of the decoder process into the slots of the shared ring, each one as soon as the viewer requests
+//its frame. The end of the video seeks to frame 1 for the next loop
+static void DecodeShared(SharedFrames *shared, int k)
+{
+	SetThreadRole(RoleDecode);
+	cv::VideoCapture video;
+	if (!OpenVideo(video, shared->filename[k], shared->asDecoded[k]))
+	{
+		std::cout << "the decoder process cannot open " << shared->filename[k] << "\n";
+		return;
+	}
+	long long n = shared->resume;
+	int position = shared->Position(n);
+	if (position == 1)
+		video.grab();
+	else
+		video.set(CV_CAP_PROP_POS_FRAMES, position);
+	bool linear = k == 0 && !shared->packed;
+	cv::Mat bgr;
+	bgr.allocator = &framePool;
+	for (;; n++)
+	{
+		int index = int(n % SharedFrames::nSlots);
+		while (shared->request[index].load() < n)
+		{
+			if (shared->stop.load())
+				return;
+			Sleep(1);
+		}
+		cv::Mat target = shared->packed ? cv::Mat(shared->height[0] * 3, shared->width[0], CV_8UC3, shared->Slot(index)) :
+			cv::Mat(shared->height[k], shared->width[k], shared->type[k], shared->Slot(index) + shared->offset[k]);
+		cv::Mat inPlace = target;
+		cv::Mat &frame = (target.type() == CV_8UC1 && !shared->asDecoded[k]) ? bgr : inPlace;
+		//a decoder that does not write in place, e.g. at the end of the video, keeps the last frame
+		if (video.read(frame))
+			StoreFrame(frame, target, linear);
+		if (++position >= shared->nFrames)
+		{
+			position = 1;
+			video.set(CV_CAP_PROP_POS_FRAMES, 1);
+			shared->loopEnd[index].store(n);
+		}
+		shared->stored[index][k].store(n);
+	}
+}
+
+//the decoder process, the viewer started with -decoder <shared memory> <bytes>: the videos of the header
+//decoded into the slots, a thread per video, until the viewer stops it or quits
+static int RunDecoderProcess(const char *arguments)
+{
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* fp;
+		freopen_s(&fp, "CONOUT$", "w", stdout);
+		std::cout.clear();
+	}
+	char name[64];
+	int bytes = 0;
+	if (sscanf_s(arguments, "%63s %d", name, unsigned(sizeof(name)), &bytes) != 2)
+		return 1;
+	OVR::SharedMemory::OpenParameters params;
+	params.globalName = name;
+	params.minSizeBytes = bytes;
+	params.openMode = OVR::SharedMemory::OpenMode_OpenOnly;
+	OVR::Ptr<OVR::SharedMemory> memory = OVR::SharedMemoryFactory::GetInstance()->Open(params);
+	if (!memory || !memory->GetData())
+	{
+		std::cout << "the decoder process cannot open the shared memory " << name << "\n";
+		return 1;
+	}
+	SharedFrames *shared = (SharedFrames*)memory->GetData();
+	hardware_decode = shared->hardware;
+	memory_reading = shared->memory;
+	HANDLE viewer = OpenProcess(SYNCHRONIZE, FALSE, shared->viewer);
+	for (int k = 0; k < shared->nStreams; k++)
+		std::thread(DecodeShared, shared, k).detach();
+	while (!shared->stop.load())
+	{
+		if (!viewer)
+			Sleep(50);
+		else if (WaitForSingleObject(viewer, 50) != WAIT_TIMEOUT)
+			break;
+	}
+	//the decoders may be blocked in a read, the process ends with them
+	ExitProcess(0);
+}
+
+//A ring of decoded frames between the decoders and the presentation. Every slot holds a frame of the
+//color, depth and alpha videos in a pixel buffer, and the textures it is uploaded to. A decoder thread
+//per video fills the slots ahead of the presentation clock, the video thread uploads them and presents
+//the slot of the clock, so a frame slow to decode, an I-frame, is absorbed by the frames decoded ahead.
+//Every video is opened twice: while one capture plays, the other is reopened and decoded forward to the
+//frame after the first one, kept in head, so the loop goes on with no seek, frame exact. Switch() goes on
+//with the videos of another clip. The reopened video is the rendition of the bitrate its decoder keeps
+//up with, on its own for every video. At DecoderProcess on the decoders run in the decoder process instead,
+//the slots in its shared memory, and a thread forwards the slots between it and the ring
+class FrameRing
+{
+public:
+	static const int nSlots = FrameHandoff::nSlots;
+	static const int nVideos = FrameHandoff::nVideos;
+	static const int maxStreams = 64;	//the decoders of the tiles of a grid at most
+	//the seconds the decoders read and decoded frames, and stored them into the slots, the flips and the
+	//conversions of the CPU, and the frames they stored, summed over the decoders
+	struct PathTimes
+	{
+		double decode, store;
+		long long frames;
+		PathTimes() : decode(0), store(0), frames(0) {}
+	};
+
+private:
+	struct Slot
+	{
+		GLuint buffer;
+		unsigned char *memory;		//persistently mapped buffer, or staging memory without ARB_buffer_storage, pinned for it by AMD_pinned_memory
+		GLuint texture[nVideos];
+		cv::Size textureSize[nVideos];
+		int textureType[nVideos];
+		GLuint filtered, edges;		//the depth filtered and its edges, of the size and the type of the depth
+		cv::Size filterSize;
+		int filterType;
+		GLuint pyramid;				//the min and max pyramid of the depth, level 0 of half its size
+		cv::Size pyramidSize;		//of the depth it is made for
+		GLsync fence;
+		long long frame;			//the frame of the playback the slot holds or is decoded for
+		int nDecoded;				//the decoders done with it
+		unsigned long long tiles;	//the tiles of the grid decoded into it
+		AlphaOccupancy alpha;		//the cells of its alpha the decoders found occupied, all of the first frames
+		ChangedCells changed[nVideos];	//the cells of the videos the decoders changed in its memory
+		bool partial[nVideos];		//changed is all of them, the video stored over its last frame or not at all
+		bool current[nVideos];		//the textures hold the frames of its memory, since its last upload
+		bool uploaded, loopEnd;
+	};
+
+	Slot slot[nSlots];
+	DepthFilter filter;
+	ColorConverter converter;
+	bool planar;					//the color of NV12 planes, converted on the GPU to its texture
+	bool live;						//the packed frames of a plain video and of its live depth
+	LiveDepth liveDepth;
+	std::vector<unsigned char> staging;
+	cv::Size frameSize[nVideos];
+	int frameType[nVideos];			//CV_8UC3, CV_8UC1 for the alpha, CV_16UC1 for a depth video of 16 bits
+	bool mipmapped[nVideos];		//the color with mipmaps; the depth and the alpha keep their edges
+	GLsizeiptr offset[nVideos], size;
+	int nFrames, nDecoders, nTiles;
+	bool persistent, packed;
+	bool buffered;					//the slots uploaded from their buffers, mapped or pinned, not from client memory
+	bool gpuHandoff;				//the presented slot published with a fence of its uploads, not waited for
+	bool presentedDone;				//the uploads of the presented slot waited for, or already fenced for the handoff
+	long long presented;
+	long long nextUpload;			//the first frame after presented not uploaded
+	bool uploadBlocked;				//by the render thread holding or drawing its slot
+	FrameHandoff *handoff;
+	bool external;					//the slots decoded by the decoder process, in its shared memory
+	DecoderProcess process;
+	std::thread forwarder;
+	static const int stallSeconds = 5, maxRestarts = 3;
+	//the runs of frames identical to the frame before them, of the sidecars of the videos: the last frame of the
+	//run every frame of video k is in, -1 for the others; set for the decoders of the next Start
+	std::vector<int> sameUntil[nVideos], nextSameUntil[nVideos];
+	static const int seekRun = 30;		//the runs the capture seeks over instead of grabbing their frames
+
+	cv::VideoCapture *video[maxStreams];
+	//the capture ready for the next loop, holding frame 1 in head and positioned after it
+	cv::VideoCapture *spare[maxStreams];
+	cv::VideoCapture loopVideo[maxStreams];
+	cv::Mat head[maxStreams];
+	std::string filename[maxStreams];
+	std::thread rewinder[maxStreams];
+	std::thread decoder[maxStreams];
+	int rendition[maxStreams];
+	double busy[maxStreams], idle[maxStreams];	//the seconds decoder k read frames and waited for slots in a loop
+	std::atomic<bool> visible[maxStreams];		//the tiles of the grid in the predicted view
+	AlphaOccupancy layerAlpha;					//of the foreground layer of the clip, handed over with the slots
+	int layerClip;								//the clips switched to, handed over with the slots
+	std::atomic<long long> clockFrame;			//the frame of the clock at the last Present
+	bool woken;									//Wait returns for Wake
+	//the frame the decoders seek resyncBy frames ahead at, after a stall, -1 if none; resynced of them not
+	//taken by the clock yet
+	long long resyncAt, resyncBy, resynced;
+	int resyncDecoders;
+	PathTimes pathTimes;
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool stopping;
+
+public:
+	//first: frame 0 of every video, already read from them, or the tiles of frame 0 of the packed video;
+	//the videos loop over frames 1 to _nFrames-1 after it. videos and filenames: the color, the depth and
+	//the alpha, the packed video, or the packed videos of the tiles of the grid of tile_cols x tile_rows, in
+	//rows; their filenames are reopened for the loops. The textures of the slots go to _handoff
+	void Init(cv::VideoCapture *videos[maxStreams], const char *filenames[maxStreams], const cv::Mat first[nVideos], int _nFrames, bool _packed, FrameHandoff *_handoff)
+	{
+		syncFunctions.Load();
+		filter.Load(depth_filter, ray_march > 0 || sphere_mode == SphereTessellated);
+		converter.Load();
+		persistent = syncFunctions.persistent && pbo_uploads;
+		buffered = (persistent || syncFunctions.pinned) && pbo_uploads;
+		gpuHandoff = gpu_handoff && syncFunctions.gpuWaits;
+		presentedDone = true;
+		handoff = _handoff;
+		if (!pbo_uploads)
+			std::cout << "uploading the frames from the memory of the decoders\n";
+		else if (!buffered)
+			std::cout << "no persistent buffer mapping, uploading the frames from the memory of the decoders\n";
+		else if (!persistent)
+			std::cout << "no persistent buffer mapping, uploading the frames from the memory of the decoders pinned\n";
+		Layout(first, _nFrames, _packed);
+
+		for (int i = 0; i < nSlots; i++)
+		{
+			Slot &s = slot[i];
+			for (int k = 0; k < nVideos; k++)
+			{
+				handoff->bundle[i].texture[k] = s.texture[k] = NewTexture(k, first[k].data);
+				s.textureSize[k] = frameSize[k];
+				s.textureType[k] = frameType[k];
+			}
+			s.filtered = s.edges = s.pyramid = 0;
+			s.fence = NULL;
+			//slot 0 holds the first frame, presented already
+			s.frame = i;
+			s.nDecoded = (i == 0) ? nDecoders : 0;
+			s.tiles = (i == 0) ? ~0ULL : 0;
+			s.alpha.Fill(i == 0);
+			s.uploaded = i == 0;
+			s.loopEnd = false;
+		}
+		Filter(slot[0]);
+		if (filter.enabled || filter.pyramid)
+			glFinish();
+		for (int k = 0; k < maxStreams; k++)
+			visible[k] = true;
+		presented = 0;
+		nextUpload = 1;
+		uploadBlocked = false;
+		layerClip = 0;
+		Start(videos, filenames);
+	}
+
+	//the videos of another clip, arguments as Init's, from the slot after the presented one on: the
+	//decoders of the last videos are stopped, the buffers laid out for the new frames and the first one
+	//uploaded, to new textures where its size or format changes. The render thread keeps the presented
+	//slot until the caller publishes the new one
+	void Switch(cv::VideoCapture *videos[maxStreams], const char *filenames[maxStreams], const cv::Mat first[nVideos], int _nFrames, bool _packed)
+	{
+		Stop();
+		Free();
+		Layout(first, _nFrames, _packed);
+		Show(first);
+		Start(videos, filenames);
+	}
+
+	//the frames of the clip at a position scrubbed to, while the videos are paused: the decoders are stopped
+	//until Resume, and the frames presented in the slot after the presented one
+	void Scrub(const cv::Mat frames[nVideos])
+	{
+		Stop();
+		Show(frames);
+	}
+
+	//the decoders again after Scrub, from the frame after position on; they seek their videos to it
+	void Resume(cv::VideoCapture *videos[maxStreams], const char *filenames[maxStreams], int position)
+	{
+		Start(videos, filenames, position + 1);
+	}
+
+	//the runs of identical frames of the videos of the next Init or Switch, as ReadSameFrames reads them
+	void SetSameFrames(const std::vector<int> until[nVideos])
+	{
+		for (int k = 0; k < nVideos; k++)
+			nextSameUntil[k] = until[k];
+	}
+
+	//the occupancy of the alpha of the foreground layer, handed over with the slots uploaded after this, the
+	//first one of Switch included, as are the layers of another clip
+	void SetLayerAlpha(const AlphaOccupancy &alpha)
+	{
+		layerAlpha = alpha;
+		layerClip++;
+	}
+
+	//hands the presented frame to the render thread, with a fence of its uploads when Present did not wait
+	//for them
+	void Publish()
+	{
+		GLsync uploaded = NULL;
+		if (gpuHandoff && !presentedDone)
+		{
+			uploaded = syncFunctions.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+		}
+		presentedDone = true;
+		handoff->Publish(int(presented % nSlots), presented, uploaded);
+	}
+
+	//uploads the slots decoded since the last call, unless the render thread still holds them, and presents
+	//the last frame up to target, the frame of the presentation clock; false if that is the presented one.
+	//loopEnd: the last frame of the videos was presented
+	bool Present(long long target, bool &loopEnd)
+	{
+		clockFrame = target;
+		long long last = presented;
+		long long n = presented + 1;
+		uploadBlocked = false;
+		for (; n < presented + nSlots; n++)
+		{
+			Slot &s = slot[n % nSlots];
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (s.frame != n || s.nDecoded < nDecoders)
+					break;
+			}
+			if (!s.uploaded)
+			{
+				uploadBlocked = !handoff->CanUpload(int(n % nSlots));
+				if (uploadBlocked)
+					break;
+				Upload(s);
+			}
+			if (n <= target)
+				last = n;
+		}
+		nextUpload = n;
+		if (last == presented)
+			return false;
+
+		//the render thread gets complete textures only, waiting for them on the GPU with gpuHandoff
+		Slot &next = slot[last % nSlots];
+		presentedDone = !gpuHandoff;
+		if (!gpuHandoff)
+		{
+			if (syncFunctions.fences)
+				syncFunctions.Wait(next.fence);
+			else
+				glFinish();
+		}
+
+		//the slots before it go back to the decoders, skipped if the decoders fell behind the clock
+		loopEnd = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (long long n = presented; n < last; n++)
+			{
+				Slot &s = slot[n % nSlots];
+				syncFunctions.Wait(s.fence);
+				loopEnd = loopEnd || s.loopEnd;
+				s.frame = n + nSlots;
+				s.nDecoded = 0;
+				s.tiles = 0;
+				s.alpha.Fill(false);
+				for (int k = 0; k < nVideos; k++)
+				{
+					s.changed[k].Fill(false);
+					s.partial[k] = false;
+				}
+				s.uploaded = false;
+				s.loopEnd = false;
+			}
+			loopEnd = loopEnd || next.loopEnd;
+			next.loopEnd = false;
+		}
+		changed.notify_all();
+		presented = last;
+		return true;
+	}
+
+	long long Presented() const
+	{
+		return presented;
+	}
+
+	//the slots uploaded from their buffers
+	bool Buffered() const
+	{
+		return buffered;
+	}
+
+	//the times of the decoders since the last call
+	PathTimes TakeTimes()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		PathTimes times = pathTimes;
+		pathTimes = PathTimes();
+		return times;
+	}
+
+	//the frames the clock of the caller moves back by, for the decoders that seek ahead at resyncAt
+	long long Resynced()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		long long by = resynced;
+		resynced = 0;
+		return by;
+	}
+
+	//decoder thread, back from a stall on frame n at position of its video: the decoders seek ahead to nSlots
+	//frames after the clock, for the time of their seek, at the first frame no slot holds yet, so the frames of
+	//the stall are not played late. Not across the end of the loop, that starts the clock again
+	void Resync(long long n, int position)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (resyncAt >= 0)
+			return;
+		long long at = 0;
+		for (int i = 0; i < nSlots; i++)
+			at = (std::max)(at, slot[i].frame + 1);
+		long long by = clockFrame + nSlots - at;
+		long long positionAt = position + (at - n);
+		if (by <= 0 || positionAt + by >= nFrames)
+			return;
+		std::cout << "resyncing the videos " << by << " frames ahead at frame " << at << "\n";
+		resyncAt = at;
+		resyncBy = by;
+		resynced += by;
+		resyncDecoders = 0;
+	}
+
+	//the tiles of the grid the decoders keep up to date: the ones with a point within 75 degrees of the
+	//direction the head is predicted to look in, the 100 degrees of the HMD and a margin for the
+	//prediction, sampled on 5x5 points of every tile. The grid covers the sphere of the panorama, its
+	//columns from U = 0 and its rows from the top
+	void View(const Vector3f &direction)
+	{
+		const float inView = cosf(float(75 * M_PI / 180));
+		for (int t = 0; t < nTiles; t++)
+		{
+			bool seen = false;
+			for (int i = 0; i <= 4 && !seen; i++)
+				for (int j = 0; j <= 4 && !seen; j++)
+				{
+					double u = ((t % tile_cols) + i / 4.0) / tile_cols, v = ((t / tile_cols) + j / 4.0) / tile_rows;
+					Vector3f point(float(cos(2 * M_PI * u) * sin(M_PI * v)), float(cos(M_PI * v)), float(sin(2 * M_PI * u) * sin(M_PI * v)));
+					seen = point.Dot(direction) >= inView * direction.Length();
+				}
+			visible[t] = seen;
+		}
+	}
+
+	//blocks until deadline, the next frame of the clock, or until the decoders finish the frame to upload
+	//next, or until Wake. A slot the render thread holds is retried every millisecond instead
+	void Wait(std::chrono::steady_clock::time_point deadline)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (uploadBlocked)
+		{
+			changed.wait_until(lock, (std::min)(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(1)));
+			woken = false;
+			return;
+		}
+		changed.wait_until(lock, deadline, [&] {
+			const Slot &s = slot[nextUpload % nSlots];
+			return stopping || woken || (nextUpload < presented + nSlots && s.frame == nextUpload && s.nDecoded >= nDecoders);
+		});
+		woken = false;
+	}
+
+	//any thread: Wait returns, for a key pressed or the window closed
+	void Wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			woken = true;
+		}
+		changed.notify_all();
+	}
+
+	void Release()
+	{
+		Stop();
+		Free();
+		converter.Release();
+	}
+
+private:
+	//the frames of first uploaded into the slot after the presented one and presented, the slots after it
+	//handed to the decoders of the next Start
+	void Show(const cv::Mat first[nVideos])
+	{
+		long long n = presented + 1;
+		int index = int(n % nSlots);
+		Slot &s = slot[index];
+		for (int k = 0; k < nVideos; k++)
+		{
+			cv::Mat target(frameSize[k], frameType[k], s.memory + offset[k]);
+			StoreFrame(first[k], target);
+			s.changed[k].Fill(false);
+			s.partial[k] = false;
+		}
+		while (!handoff->CanUpload(index))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		s.tiles = ~0ULL;
+		s.alpha.Fill(true);
+		Upload(s);
+		if (syncFunctions.fences)
+			syncFunctions.Wait(s.fence);
+		else
+			glFinish();
+
+		for (int i = 0; i < nSlots; i++)
+		{
+			Slot &r = slot[(n + i) % nSlots];
+			r.frame = n + i;
+			r.nDecoded = (i == 0) ? nDecoders : 0;
+			r.tiles = (i == 0) ? ~0ULL : 0;
+			r.alpha.Fill(i == 0);
+			r.uploaded = i == 0;
+			r.loopEnd = false;
+		}
+		presented = n;
+		nextUpload = n + 1;
+		uploadBlocked = false;
+	}
+
+	//the sizes and the formats of the frames of first, and the buffers of the slots for them. The tiles of a
+	//packed frame follow each other, the frames of different videos are aligned
+	void Layout(const cv::Mat first[nVideos], int _nFrames, bool _packed)
+	{
+		packed = _packed;
+		nFrames = _nFrames;
+		nTiles = packed ? tile_cols * tile_rows : 1;
+		nDecoders = packed ? nTiles : nVideos;
+		live = packed && live_depth && nTiles == 1;
+		liveDepth.Reset();
+		//the color decoded as its planes, a single channel of the luma over the chroma
+		planar = !packed && first[0].type() == CV_8UC1;
+		if (planar && !converter.enabled)
+			std::cout << "no compute shaders, the color planes are not converted\n";
+		external = decoder_process && nTiles == 1 && !live;
+		if (decoder_process && !external)
+			std::cout << (live ? "the live depth is computed by the viewer" : "the tiles of a grid are decoded by the viewer") << ", not by a decoder process\n";
+		size = 0;
+		for (int k = 0; k < nVideos; k++)
+		{
+			frameSize[k] = first[k].size();
+			frameType[k] = first[k].type();
+			mipmapped[k] = video_mipmaps && k == 0;
+			offset[k] = size;
+			GLsizeiptr frameBytes = GLsizeiptr(frameSize[k].area()) * first[k].elemSize();
+			size += packed ? frameBytes : (frameBytes + 63) / 64 * 64;
+		}
+		//the slots of the decoder process are client memory of the viewer, uploaded as such
+		SharedFrames *shared = external ? process.Map(size) : NULL;
+		if (external && !shared)
+		{
+			std::cout << "cannot share " << size * nSlots / (1 << 20) << " MB of frames with a decoder process, decoding in the viewer\n";
+			external = false;
+		}
+		persistent = syncFunctions.persistent && pbo_uploads && !external;
+		buffered = (persistent || syncFunctions.pinned) && pbo_uploads && !external;
+		if (external)
+		{
+			shared->nStreams = nDecoders;
+			shared->nFrames = nFrames;
+			shared->packed = packed;
+			shared->hardware = hardware_decode;
+			shared->memory = memory_reading;
+			for (int k = 0; k < nVideos; k++)
+			{
+				shared->width[k] = frameSize[k].width;
+				shared->height[k] = frameSize[k].height;
+				shared->type[k] = frameType[k];
+				shared->offset[k] = offset[k];
+				shared->asDecoded[k] = frameType[k] == CV_16UC1 || (planar && k == 0);
+			}
+		}
+
+		//the memory pinned is of whole pages
+		const GLsizeiptr page = 4096;
+		if (!persistent && buffered)
+			size = (size + page - 1) / page * page;
+		unsigned char *pages = NULL;
+		if (!persistent && !external)
+		{
+			staging.resize(size * nSlots + page);
+			pages = &staging[0] + (page - GLsizeiptr((uintptr_t)&staging[0] % page)) % page;
+		}
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		for (int i = 0; i < nSlots; i++)
+		{
+			Slot &s = slot[i];
+			s.buffer = 0;
+			for (int k = 0; k < nVideos; k++)
+				s.current[k] = s.partial[k] = false;
+			if (external)
+				s.memory = shared->Slot(i);
+			else if (persistent)
+			{
+				glGenBuffers(1, &s.buffer);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+				syncFunctions.bufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+				gpuResidency.Buffer(s.buffer, GpuResidency::PoolVideo, size);
+				s.memory = (unsigned char*)syncFunctions.mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+			}
+			else if (!external)
+				s.memory = pages + i * size;
+			//the staging memory of the slot read by the GPU itself, as the buffer it uploads from
+			if (!persistent && buffered)
+			{
+				glGenBuffers(1, &s.buffer);
+				glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, s.buffer);
+				glBufferData(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, size, s.memory, GL_STREAM_READ);
+				glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	//the texture of the frames of video k, filled with pixels unless NULL: the RGBA of the color of the
+	//planes converted, or as VideoTexture
+	GLuint NewTexture(int k, const void *pixels)
+	{
+		if (!planar || k != 0)
+			return VideoTexture(frameSize[k], frameType[k], pixels, mipmapped[k]);
+		GLuint texture = VideoTexture(ColorConverter::Picture(frameSize[k]), CV_8UC4, NULL, mipmapped[k]);
+		if (pixels && converter.Run(pixels, texture, frameSize[k]) && mipmapped[k])
+		{
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		return texture;
+	}
+
+	//the decoders of videos from the slot after the presented one, reading the frame at position of them
+	void Start(cv::VideoCapture *videos[maxStreams], const char *filenames[maxStreams], int position = 1)
+	{
+		stopping = false;
+		woken = false;
+		clockFrame = presented;
+		resyncAt = -1;
+		resyncBy = resynced = 0;
+		for (int k = 0; k < nVideos; k++)
+			sameUntil[k] = nextSameUntil[k];
+		if (external)
+		{
+			SharedFrames *shared = process.Frames();
+			shared->start = presented + 1;
+			for (int k = 0; k < nDecoders; k++)
+				snprintf(shared->filename[k], SharedFrames::maxPath, "%s", filenames[k]);
+			process.Launch(presented + 1);
+			forwarder = std::thread(&FrameRing::Forward, this, presented + 1);
+			return;
+		}
+		for (int k = 0; k < nDecoders; k++)
+		{
+			video[k] = videos[k];
+			spare[k] = &loopVideo[k];
+			filename[k] = filenames[k];
+			rendition[k] = 0;
+			busy[k] = idle[k] = 0;
+			rewinder[k] = std::thread(&FrameRing::Rewind, this, k);
+			decoder[k] = std::thread(&FrameRing::Decode, this, k, presented + 1, position);
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		if (external)
+		{
+			forwarder.join();
+			process.Stop();
+			return;
+		}
+		//none after Scrub
+		for (int k = 0; k < nDecoders; k++)
+		{
+			if (decoder[k].joinable())
+				decoder[k].join();
+			if (rewinder[k].joinable())
+				rewinder[k].join();
+		}
+	}
+
+	void Free()
+	{
+		for (int i = 0; i < nSlots; i++)
+		{
+			Slot &s = slot[i];
+			syncFunctions.Wait(s.fence);
+			if (persistent)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			//the pinned memory is released after its buffer
+			if (buffered)
+			{
+				glDeleteBuffers(1, &s.buffer);
+				gpuResidency.FreeBuffer(s.buffer);
+			}
+		}
+		if (external)
+			process.Unmap();
+	}
+
+	//copies the frames of a slot to its textures on the GPU, and the mipmaps of the color, without waiting.
+	//The textures of the frames of a clip before a switch are replaced, the render thread being done with them
+	void Upload(Slot &s)
+	{
+		ScopedTimer uploading;
+		int index = int(&s - slot);
+		for (int k = 0; k < nVideos; k++)
+			if (s.textureSize[k] != frameSize[k] || s.textureType[k] != frameType[k])
+			{
+				FreeTextures(1, &s.texture[k]);
+				handoff->bundle[index].texture[k] = s.texture[k] = NewTexture(k, NULL);
+				s.textureSize[k] = frameSize[k];
+				s.textureType[k] = frameType[k];
+				s.current[k] = false;
+			}
+		if (buffered)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+		for (int k = 0; k < nVideos; k++)
+		{
+			const void *pixels = buffered ? (const void*)offset[k] : (const void*)(s.memory + offset[k]);
+			GLenum format, pixelType;
+			PixelFormat(frameType[k], format, pixelType);
+			glBindTexture(GL_TEXTURE_2D, s.texture[k]);
+			if (planar && k == 0)
+			{
+				converter.Run(pixels, s.texture[k], frameSize[k]);
+				glBindTexture(GL_TEXTURE_2D, s.texture[k]);
+			}
+			else if (nTiles == 1 && s.partial[k] && s.current[k])
+				UploadChanged(s, k, pixels, format, pixelType);
+			else if (nTiles == 1)
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frameSize[k].width, frameSize[k].height, format, pixelType, pixels);
+			else
+			{
+				//the tiles of the grid decoded into the slot, out of the rows of the whole frame
+				int width = frameSize[k].width / tile_cols, height = frameSize[k].height / tile_rows;
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, frameSize[k].width);
+				for (int t = 0; t < nTiles; t++)
+					if ((s.tiles >> t) & 1)
+					{
+						int x = (t % tile_cols) * width, y = (t / tile_cols) * height;
+						size_t skip = (size_t(y) * frameSize[k].width + x) * 3;
+						glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, pixelType, (const char*)pixels + skip);
+					}
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			}
+			if (mipmapped[k])
+				glGenerateMipmap(GL_TEXTURE_2D);
+			s.current[k] = true;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		Filter(s);
+		handoff->bundle[index].alpha = s.alpha;
+		handoff->bundle[index].layerAlpha = layerAlpha;
+		handoff->bundle[index].layerClip = layerClip;
+		if (syncFunctions.fences)
+			s.fence = syncFunctions.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		s.uploaded = true;
+		profiler.Uploaded(uploading.Seconds());
+	}
+
+	//the rectangles of the cells of video k changed in slot s, out of the rows of the whole frame at pixels, the
+	//rows of cells with the same columns changed joined
+	void UploadChanged(const Slot &s, int k, const void *pixels, GLenum format, GLenum pixelType)
+	{
+		const ChangedCells &changed = s.changed[k];
+		int width = frameSize[k].width, height = frameSize[k].height;
+		size_t texel = CV_ELEM_SIZE(frameType[k]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+		for (int r = 0; r < ChangedCells::rows;)
+		{
+			unsigned long long bits = changed.bits[r];
+			int end = r + 1;
+			while (end < ChangedCells::rows && changed.bits[end] == bits)
+				end++;
+			int y0 = ChangedCells::Bound(r, ChangedCells::rows, height), y1 = ChangedCells::Bound(end, ChangedCells::rows, height);
+			for (int c = 0; c < ChangedCells::cols; c++)
+			{
+				if (!((bits >> c) & 1))
+					continue;
+				int last = c;
+				while (last + 1 < ChangedCells::cols && ((bits >> (last + 1)) & 1))
+					last++;
+				int x0 = ChangedCells::Bound(c, ChangedCells::cols, width), x1 = ChangedCells::Bound(last + 1, ChangedCells::cols, width);
+				size_t skip = (size_t(y0) * width + x0) * texel;
+				if (x1 > x0 && y1 > y0)
+					glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, format, pixelType, (const char*)pixels + skip);
+				c = last;
+			}
+			r = end;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+
+	//filters the depth of a slot uploaded, and hands its filtered depth and its edges over in place of its
+	//depth, with the pyramid of the depth handed over; the fence of the slot after it covers both
+	void Filter(Slot &s)
+	{
+		if (!filter.enabled && !filter.pyramid)
+			return;
+		int index = int(&s - slot);
+		if (filter.enabled)
+			FilterDepth(s, index);
+		//of the depth handed over, filtered or not
+		if (filter.pyramid)
+			BuildPyramid(s, index);
+	}
+
+	void FilterDepth(Slot &s, int index)
+	{
+		if (!s.filtered || s.filterSize != frameSize[1] || s.filterType != frameType[1])
+		{
+			FreeTextures(1, &s.filtered);
+			FreeTextures(1, &s.edges);
+			s.filtered = VideoTexture(frameSize[1], frameType[1], NULL);
+			s.edges = VideoTexture(frameSize[1], CV_8UC1, NULL);
+			s.filterSize = frameSize[1];
+			s.filterType = frameType[1];
+		}
+		bool filtered = filter.Run(s.texture[1], s.filtered, s.edges, frameSize[1], frameType[1]);
+		handoff->bundle[index].texture[1] = filtered ? s.filtered : s.texture[1];
+		handoff->bundle[index].edges = filtered ? s.edges : 0;
+	}
+
+	void BuildPyramid(Slot &s, int index)
+	{
+		cv::Size size((frameSize[1].width + 1) / 2, (frameSize[1].height + 1) / 2);
+		int levels = MipLevels(size.width, size.height);
+		if (!s.pyramid || s.pyramidSize != frameSize[1])
+		{
+			FreeTextures(1, &s.pyramid);
+			glGenTextures(1, &s.pyramid);
+			glBindTexture(GL_TEXTURE_2D, s.pyramid);
+			glTexStorage2D(GL_TEXTURE_2D, levels, GL_RG16F, size.width, size.height);
+			gpuResidency.Texture(s.pyramid, GpuResidency::PoolVideo, TextureBytes(size.width, size.height, 4, true));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			s.pyramidSize = frameSize[1];
+		}
+		bool built = filter.Pyramid(handoff->bundle[index].texture[1], s.pyramid, size, levels);
+		handoff->bundle[index].pyramid = built ? s.pyramid : 0;
+	}
+
+	//prepares the spare capture of video k for the next loop, in the background of its decoder
+	void Rewind(int k)
+	{
+		SetThreadRole(RoleBackground);
+		cv::VideoCapture &video = *spare[k];
+		video.release();
+		head[k].release();
+		head[k].allocator = &framePool;
+		std::string name = RenditionName(filename[k], rendition[k]);
+		if (!OpenVideo(video, name.c_str(), frameType[k] == CV_16UC1 || (planar && k == 0)) || !video.grab() || !video.read(head[k]))
 		{
-			// Because the application is requested to quit, should not request retry
-			retryCreate = false;
-			break;
+			std::cout << "cannot reopen " << name << ", seeking to loop it\n";
+			head[k].release();
 		}
-		if (sessionStatus.ShouldRecenter)
-			ovr_RecenterTrackingOrigin(session);
+	}
 
-		if (sessionStatus.IsVisible)
+	//the file of rendition i of a video: the video itself, or its name with the suffix of a lower bitrate
+	static std::string RenditionName(const std::string &filename, int i)
+	{
+		if (i == 0)
+			return filename;
+		size_t dot = filename.find_last_of('.'), slash = filename.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return filename + renditions[i - 1];
+		return filename.substr(0, dot) + renditions[i - 1] + filename.substr(dot);
+	}
+
+	//the rendition of video k for its loop after the next one, from the share of the last loop its decoder
+	//spent reading: a lower bitrate above 90%, the network or the decoder falling behind the clock, a
+	//higher one below 50%
+	void Adapt(int k)
+	{
+		double share = busy[k] / (std::max)(busy[k] + idle[k], 1e-6);
+		int last = rendition[k];
+		if (share > 0.9 && rendition[k] < int(renditions.size()))
+			rendition[k]++;
+		else if (share < 0.5 && rendition[k] > 0)
+			rendition[k]--;
+		if (rendition[k] != last)
+			std::cout << "video " << k << " busy " << int(share * 100) << "% of its loop, rendition " << rendition[k] << " next\n";
+		busy[k] = idle[k] = 0;
+	}
+
+	//at the end of video k, the spare capture takes over, or the video seeks to frame 1 without one.
+	//true if the next frame is the one in head
+	bool Loop(int k)
+	{
+		if (rewinder[k].joinable())
+			rewinder[k].join();
+		if (head[k].empty())
 		{
+			video[k]->set(CV_CAP_PROP_POS_FRAMES, 1);
+			return false;
+		}
+		std::swap(video[k], spare[k]);
+		return true;
+	}
 
-			if (Platform.Key['T'])
-			{				
-				TrackingState = ovr_GetTrackingState(session, frameIndex, ovrFalse);
-				roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
-				spherecenter = TrackingState.HeadPose.ThePose.Position;
-				positional_track = true;
-			}
-			if (Platform.Key['Y'])
-			{				
-				TrackingState = ovr_GetTrackingState(session, frameIndex, ovrFalse);
-				roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
-				spherecenter = TrackingState.HeadPose.ThePose.Position;
-				positional_track = false;
-			}
-			
-			if (Platform.Key['C']) {
-				colored = !colored;
-				Platform.Key['C'] = false;
-			}
-						
-			if (Platform.Key['R'])
-			{
-					TrackingState = ovr_GetTrackingState(session, frameIndex, ovrFalse);
-					roomScene->Models[0]->Pos = TrackingState.HeadPose.ThePose.Position;
-					spherecenter = TrackingState.HeadPose.ThePose.Position;
-			}
-			
+	//the thread of decoder k: the frames of its video, or of the packed video, decoded in place into the
+	//slots in order from start, frame first of the video, 1 unless resumed after a scrub, each one as soon as
+	//it is given back
+	//a decoded frame into the slot: the frame of video k, or tile k of the grid into the packed frame
+	//changed: the cells of the frame of a single channel it changes, stored over the last one of the slot
+	bool Store(const cv::Mat &decoded, cv::Mat &target, int k, bool linear, ChangedCells *changed = nullptr)
+	{
+		if (live)
+			return StoreLive(decoded, target);
+		//the luma and the interleaved chroma of another rendition scaled on their own
+		if (planar && k == 0 && !decoded.empty() && decoded.size() != target.size() && decoded.type() == target.type())
+		{
+			int rows = decoded.rows * 2 / 3, targetRows = target.rows * 2 / 3;
+			cv::Mat luma = target.rowRange(0, targetRows);
+			cv::resize(decoded.rowRange(0, rows), luma, luma.size(), 0, 0, cv::INTER_LINEAR);
+			cv::Mat chroma(decoded.rows - rows, decoded.cols / 2, CV_8UC2, (void*)decoded.ptr(rows), decoded.step);
+			cv::Mat targetChroma(target.rows - targetRows, target.cols / 2, CV_8UC2, target.ptr(targetRows), target.step);
+			cv::resize(chroma, targetChroma, targetChroma.size(), 0, 0, cv::INTER_LINEAR);
+			return true;
+		}
+		if (nTiles == 1)
+			return changed ? StoreChanged(decoded, target, *changed) : StoreFrame(decoded, target, linear);
+		if (decoded.empty())
+			return false;
+		int width = frameSize[0].width / tile_cols, height = frameSize[0].height / tile_rows;
+		int x = (k % tile_cols) * width, y = (k / tile_cols) * height;
+		for (int p = 0; p < nVideos; p++)
+		{
+			cv::Mat part = target(cv::Rect(x, p * frameSize[0].height + y, width, height));
+			StoreFrame(decoded.rowRange(p * decoded.rows / nVideos, (p + 1) * decoded.rows / nVideos), part);
+		}
+		return true;
+	}
 
-			// Call ovr_GetRenderDesc each frame to get the ovrEyeRenderDesc, as the returned values (e.g. HmdToEyeOffset) may change at runtime.
-			ovrEyeRenderDesc eyeRenderDesc[2];
-			eyeRenderDesc[0] = ovr_GetRenderDesc(session, ovrEye_Left, hmdDesc.DefaultEyeFov[0]);
-			eyeRenderDesc[1] = ovr_GetRenderDesc(session, ovrEye_Right, hmdDesc.DefaultEyeFov[1]);
+	//a frame of the plain video into the packed frame of the live layout: its color, its depth and an alpha all opaque
+	bool StoreLive(const cv::Mat &decoded, cv::Mat &target)
+	{
+		int height = frameSize[0].height;
+		cv::Mat color = target.rowRange(0, height), depth = target.rowRange(height, height * 2);
+		if (!StoreFrame(decoded, color, true))
+			return false;
+		liveDepth.Compute(color, depth);
+		target.rowRange(height * 2, height * 3).setTo(cv::Scalar::all(255));
+		return true;
+	}
 
-			// Get eye poses, feeding in correct IPD offset
-			ovrVector3f               HmdToEyeOffset[2] = { eyeRenderDesc[0].HmdToEyeOffset,
-				eyeRenderDesc[1].HmdToEyeOffset };
+	//frame k of slot from copied into slot to as Store, for a frame identical to the one before it
+	bool CopyFrame(const Slot &from, Slot &to, int k, ChangedCells *changed)
+	{
+		cv::Mat source(frameSize[k], frameType[k], from.memory + offset[k]), target(frameSize[k], frameType[k], to.memory + offset[k]);
+		return changed ? StoreChanged(source, target, *changed) : StoreFrame(source, target);
+	}
 
-			double displayMidpointSeconds = ovr_GetPredictedDisplayTime(session, 0);
-			TrackingState = ovr_GetTrackingState(session, displayMidpointSeconds, ovrTrue);
+	//the cells of the alpha decoder k stored into slot s into alpha, all the cells of its region unless stored;
+	//false for the decoders of no alpha. The alpha is the third part of the packed frame, every decoder of a
+	//grid storing its tile of it
+	bool MarkAlpha(const Slot &s, int k, bool stored, AlphaOccupancy &alpha) const
+	{
+		if (!packed && k != 2)
+			return false;
+		int cols = nTiles > 1 ? tile_cols : 1, rows = nTiles > 1 ? tile_rows : 1, t = nTiles > 1 ? k : 0;
+		int fullWidth = frameSize[2].width, fullHeight = frameSize[2].height, channels = CV_MAT_CN(frameType[2]);
+		int width = fullWidth / cols, height = fullHeight / rows, x = (t % cols) * width, y = (t / cols) * height;
+		if (!stored)
+			alpha.MarkRegion(x, y, width, height, fullWidth, fullHeight);
+		else
+			alpha.Mark(s.memory + offset[2] + (size_t(y) * fullWidth + x) * channels, size_t(fullWidth) * channels, channels,
+				x, y, width, height, fullWidth, fullHeight);
+		return true;
+	}
 
-			ovrPosef FinalEyePos[2];
-			ovrPosef FinalEyePosCentered[2];
-			ovrPosef FinalEyePosDefCam[2];
-			ovr_CalcEyePoses(TrackingState.HeadPose.ThePose, HmdToEyeOffset, FinalEyePos);//Output: FinalEyePose --> Final Orientation and Position (head & IPD offset)
-			
-			
-			// Render Scene to Eye Buffers
-			for (int eye = 0; eye < 2; ++eye)
+	//the thread of the decoder process: the slots given back requested of it, and decoded once all its videos
+	//stored their frame. A process that exits, or makes no progress for stallSeconds on a frame it was given,
+	//is started again from that frame, up to maxRestarts times in a row; then the video stops at the last
+	//frame and the session goes on
+	void Forward(long long start)
+	{
+		SetThreadRole(RoleDecode);
+		SharedFrames *shared = process.Frames();
+		long long requested = start, completed = start;
+		int restarts = 0;
+		std::chrono::steady_clock::time_point progress = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopping)
+		{
+			for (; slot[requested % nSlots].frame == requested; requested++)
+				shared->request[requested % nSlots].store(requested);
+			int index = int(completed % nSlots);
+			bool done = requested > completed;
+			for (int k = 0; k < nDecoders && done; k++)
+				done = shared->stored[index][k].load() >= completed;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (done)
 			{
-				Matrix4f rollPitchYawDef;
-				Vector3f finalUpDef;
-				Vector3f finalForwardDef;
-				// Switch to eye render target
-				eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
-				 
-							
-				Matrix4f rollPitchYaw = Matrix4f(FinalEyePos[eye].Orientation);				
-				Vector3f EyePos = FinalEyePos[eye].Position;
-				Vector3f finalUp = rollPitchYaw.Transform(Vector3f(0, 1, 0));//
-				Vector3f finalForward = rollPitchYaw.Transform(Vector3f(0, 0, -1));//				
-				Matrix4f view = Matrix4f::LookAtRH(EyePos, EyePos + finalForward, finalUp);
-				Matrix4f proj = ovrMatrix4f_Projection(hmdDesc.DefaultEyeFov[eye], 0.2f, 1000.0f, ovrProjection_None);
-				Vector3f HeadPos = TrackingState.HeadPose.ThePose.Position;
-
-				// Render world
-				float desat = 0.0;
-				if (vis_fade == true)
+				Slot &s = slot[index];
+				//the slot is not given back before it is decoded, its alpha read without the lock
+				if (alpha_culling)
 				{
-					DistX = (spherecenter.x - TrackingState.HeadPose.ThePose.Position.x);
-					DistZ = (spherecenter.z - TrackingState.HeadPose.ThePose.Position.z);
-					DistY = (spherecenter.y - TrackingState.HeadPose.ThePose.Position.y);
-					circle = DistX*DistX + DistZ*DistZ;
-					double th_mult = 5;
-					if (circle > th)
-					{
-						desat = float(th_mult*circle);
-						desat = fmin(desat, 1.0);
-					}
-				}				
-				
-				if (positional_track == true & render_simple == false)
+					AlphaOccupancy alpha(false);
+					lock.unlock();
+					MarkAlpha(s, packed ? 0 : 2, true, alpha);
+					lock.lock();
+					s.alpha = alpha;
+				}
+				s.nDecoded = nDecoders;
+				s.tiles = ~0ULL;
+				s.loopEnd = shared->loopEnd[index].load() == completed;
+				completed++;
+				restarts = 0;
+				progress = now;
+				changed.notify_all();
+				continue;
+			}
+			if (requested > completed && (!process.Running() || now - progress > std::chrono::seconds(stallSeconds)))
+			{
+				if (restarts == maxRestarts)
 				{
-					roomScene->Render(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, desat, args);
+					std::cout << "the decoder process failed " << maxRestarts << " times on frame " << completed << ", the video stops\n";
+					changed.wait(lock, [&] { return stopping; });
+					return;
 				}
-				if (positional_track == false)
+				restarts++;
+				std::cout << "the decoder process stopped on frame " << completed << ", starting it again\n";
+				lock.unlock();
+				process.Restart(completed);
+				lock.lock();
+				progress = std::chrono::steady_clock::now();
+				continue;
+			}
+			changed.wait_for(lock, std::chrono::milliseconds(1));
+		}
+	}
+
+	void Decode(int k, long long start, int first)
+	{
+		SetThreadRole(RoleDecode);
+		int position = first;
+		bool fromHead = false;
+		//a tile of the grid out of the view is behind its frame, as the capture of a run of identical frames, or
+		//the capture of a position scrubbed to
+		bool stale = first != 1;
+		//the frame of the video the slot of the last frame holds, -1 if it was not stored
+		int held = -1;
+		//the BGR of the single-channel alpha or of a tile of the grid, decoded into memory of the decoder
+		cv::Mat bgr;
+		bgr.allocator = &framePool;
+		char name[32];
+		snprintf(name, sizeof(name), "decoder %d", k);
+		WatchedThread watched(name);
+		for (long long n = start;; n++)
+		{
+			Slot &s = slot[n % nSlots];
+			std::chrono::steady_clock::time_point waiting = std::chrono::steady_clock::now();
+			long long seekBy = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return stopping || s.frame == n; });
+				if (stopping)
+					return;
+				if (n == resyncAt)
 				{
-					ovrPosef centered;
-					centered.Position = spherecenter;
-					centered.Orientation = TrackingState.HeadPose.ThePose.Orientation;
-					ovr_CalcEyePoses(centered, HmdToEyeOffset, FinalEyePosCentered);
-					Vector3f EyePosCentered = FinalEyePosCentered[eye].Position;
-					Matrix4f viewCentered = Matrix4f::LookAtRH(EyePosCentered, EyePosCentered + finalForward, finalUp);
-					roomScene->RenderSimple(ScreenSize, spherecenter, EyePos, HeadPos, viewCentered, proj, eye, poly_mesh, stereo, render_depth, colored, layers, desat, args);
-				}				
-
-				if (positional_track == true & render_simple == true)
+					seekBy = resyncBy;
+					if (++resyncDecoders == nDecoders)
+						resyncAt = -1;
+				}
+			}
+			//seeks to the frame of the resync, as a tile back in the view
+			if (seekBy > 0)
+			{
+				position += int(seekBy);
+				stale = true;
+				if (live)
+					liveDepth.Restart();
+			}
+			watched.Feed("reading frame", n);
+			ScopedTimer reading;
+			idle[k] += std::chrono::duration<double>(reading.begin - waiting).count();
+			cv::Mat target = packed ? cv::Mat(frameSize[0].height * 3, frameSize[0].width, CV_8UC3, s.memory) :
+				cv::Mat(frameSize[k].height, frameSize[k].width, frameType[k], s.memory + offset[k]);
+			cv::Mat inPlace = target;
+			cv::Mat &frame = ((target.type() == CV_8UC1 && !(planar && k == 0)) || nTiles > 1 || live) ? bgr : inPlace;
+			bool linear = k == 0 && !packed;
+			bool stored = false;
+			//the single channel of the depth or the alpha converted over the frame the slot held, nSlots before
+			ChangedCells changed;
+			bool partial = partial_uploads && &frame == &bgr && nTiles == 1 && !live;
+			ChangedCells *diff = partial ? &changed : nullptr;
+			double decodeSeconds = 0;
+			//a frame identical to the one before it, held by the slot of the last frame, is copied from it; the capture
+			//grabs it, or is left behind to seek past a run of seekRun frames or more
+			const std::vector<int> &same = sameUntil[k];
+			if (!packed && !fromHead && held == position - 1 && position < int(same.size()) && same[position] >= position)
+			{
+				if (!stale && same[position] - position + 1 < seekRun)
+					stale = !video[k]->grab();
+				else
+					stale = true;
+				stored = CopyFrame(slot[(n - 1) % nSlots], s, k, diff);
+			}
+			//a tile of the grid out of the predicted view is not decoded, and seeks to its frame back in it
+			else if (visible[k])
+			{
+				if (stale && !fromHead)
+					video[k]->set(CV_CAP_PROP_POS_FRAMES, position);
+				stored = fromHead && Store(head[k], target, k, linear, diff);
+				//a decoder that does not write in place, e.g. at the end of the video, keeps the last frame
+				if (!stored)
 				{
-					roomScene->RenderSimple(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, desat, args);
-
+					ScopedTimer decoding;
+					bool decoded = video[k]->read(frame);
+					decodeSeconds = decoding.Seconds();
+					if (decoded)
+						stored = Store(frame, target, k, linear, diff);
 				}
-				
-				
-				if (vis_fade == true )
+				stale = false;
+			}
+			else
+				stale = true;
+			held = stored ? position : -1;
+			double read = reading.Seconds();
+			if (watched.Disable() && stall_resync)
+				Resync(n, position);
+			AlphaOccupancy alpha(false);
+			bool marked = alpha_culling && MarkAlpha(s, k, stored, alpha);
+			busy[k] += read;
+			if (visible[k])
+			{
+				profiler.Decoded(read);
+				telemetry.Decoded(read);
+			}
+			//the capture played to the end is prepared for the loop after this one
+			if (fromHead)
+			{
+				Adapt(k);
+				rewinder[k] = std::thread(&FrameRing::Rewind, this, k);
+			}
+			fromHead = false;
+			bool loopEnd = ++position >= nFrames;
+			if (loopEnd)
+			{
+				position = 1;
+				fromHead = Loop(k);
+				if (live)
+					liveDepth.Restart();
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				s.nDecoded++;
+				if (stored)
 				{
-					double DistX = (spherecenter.x - TrackingState.HeadPose.ThePose.Position.x);
-					double DistZ = (spherecenter.z - TrackingState.HeadPose.ThePose.Position.z);
-					double DistY = (spherecenter.y - TrackingState.HeadPose.ThePose.Position.y);
-					double circle = DistX*DistX + DistZ*DistZ + DistY*DistY;
-					double th_mult = 10;
-					float radius = 0.35;
-					bool isblack = false;
-					if (circle > th)
-					{
-						roomScene->RenderBlack(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers,th_mult*circle, radius, isblack, args);
-						if (circle > (1.0 / th_mult))
-						{
-							isblack = true;
-							radius = 0.8;
-							roomScene->RenderBlack(ScreenSize, spherecenter, EyePos, HeadPos, view, proj, eye, poly_mesh, stereo, render_depth, colored, layers, th_mult*circle, radius, isblack, args);
-						}
-					}
+					s.tiles |= 1ULL << k;
+					pathTimes.decode += decodeSeconds;
+					pathTimes.store += read - decodeSeconds;
+					pathTimes.frames++;
+				}
+				if (marked)
+					s.alpha.Add(alpha);
+				if (!packed)
+				{
+					s.changed[k] = changed;
+					s.partial[k] = partial;
+				}
+				s.loopEnd = s.loopEnd || loopEnd;
+			}
+			changed.notify_all();
+		}
+	}
+};
+
+//A clip of the playlist made ready to play: its background layers read, its videos opened and their first
+//frames decoded. The next clip is prepared while one plays, so switching to it only uploads them
+struct PreparedClip
+{
+	ClipFiles files;
+	BackgroundLayer layer[5];				//bg, bgd, bga, bbgd and bbg
+	int sameAs[5];							//the layer before each one it is the same as, itself for none
+	AlphaOccupancy layerAlpha;				//of bga, kept after the layers are released
+	std::vector<int> sameUntil[FrameRing::nVideos];	//the runs of identical frames of the depth and the alpha
+	std::vector<int> keys[FrameRing::nVideos];		//the key frames of the videos for GopCache, once they are known
+	cv::VideoCapture video[FrameRing::maxStreams];
+	cv::Mat first[FrameRing::nVideos];		//frame 0 of every video, or the tiles of frame 0 of the packed one
+	int frames;
+	float fps;
+
+	//the videos for FrameRing, the packed one in the place of the color, or the tiles of the grid
+	void Streams(cv::VideoCapture *videos[FrameRing::maxStreams], const char *filenames[FrameRing::maxStreams])
+	{
+		filenames[0] = packed_layout && !live_depth ? files.packed.c_str() : files.color.c_str();
+		filenames[1] = files.depth.c_str();
+		filenames[2] = files.alpha.c_str();
+		for (size_t t = 0; t < files.tiles.size(); t++)
+			filenames[t] = files.tiles[t].c_str();
+		for (int k = 0; k < FrameRing::maxStreams; k++)
+			videos[k] = &video[k];
+	}
+
+	//the layers are on the GPU once uploaded
+	void ReleaseLayers()
+	{
+		for (int i = 0; i < 5; i++)
+			layer[i] = BackgroundLayer();
+	}
+};
 
+//the cells of a layer of alpha that are not all transparent: of its BC4 blocks, or of its image; all of them for a
+//layer of neither
+static AlphaOccupancy LayerOccupancy(const BackgroundLayer &layer)
+{
+	AlphaOccupancy alpha(false);
+	if (!layer.blocks.empty() && !layer.bc1)
+		alpha.MarkBC4(&layer.blocks[0], layer.width, layer.height);
+	else if (!layer.image.empty() && layer.image.depth() == CV_8U)
+		alpha.Mark(layer.image.ptr(), layer.image.step, layer.image.channels(), 0, 0, layer.image.cols, layer.image.rows,
+			layer.image.cols, layer.image.rows);
+	else
+		alpha.Fill(true);
+	return alpha;
+}
+
+//The cache of what a clip derives from its files at every launch, name.clipcache next to its videos, mapped instead
+//by PrepareClip: its layers as they are uploaded, the blocks of the DDS or the pixels of the png decoded, each at an
+//offset of a multiple of 64 that the image of the layer is a view of; the layers the same as one before them, the
+//occupancy of the alpha, and the key frames of the videos once GopCache has indexed them. Every file it is derived
+//from is stamped with its size, the time it was last written and a hash of its first and last 64 KB: the layers of
+//a cache whose stamps are not those of their files are read and cached again, key frames of other videos or of
+//another scrub_gop indexed again. Streamed clips are not cached
+class ClipCache
+{
+	struct Stamp
+	{
+		unsigned long long size, time, hash;
+
+		bool operator==(const Stamp &other) const
+		{
+			return size == other.size && time == other.time && hash == other.hash;
+		}
+	};
+	struct Layer
+	{
+		unsigned int kind;					//0 none, 1 the blocks of a DDS, 2 an image
+		unsigned int bc1, gray, width, height, type;
+		unsigned long long offset, bytes;
+	};
+	struct Header
+	{
+		char magic[8];
+		unsigned int version, scrubGop;
+		Stamp layerFiles[5][2];				//the DDS and the png of every layer
+		Stamp videoFiles[FrameRing::nVideos];
+		Layer layer[5];
+		int sameAs[5];
+		int nKeys[FrameRing::nVideos];
+		unsigned long long alpha[AlphaOccupancy::rows];
+		unsigned long long keysOffset;		//the key frames of the videos, one after the other, after the layers
+	};
+	static const unsigned int version = 1;
+
+public:
+	//the layers, the ones the same and the occupancy of the alpha into clip, and the key frames still valid; false
+	//without a cache up to date
+	static bool Read(PreparedClip *clip)
+	{
+		if (!Enabled(clip->files))
+			return false;
+		std::shared_ptr<MappedFile> mapped = MappedFile::Open(clip->files.cache);
+		if (!mapped || mapped->size < (long long)sizeof(Header))
+			return false;
+		const Header &header = *(const Header*)mapped->data;
+		if (memcmp(header.magic, "CLIPCACH", 8) != 0 || header.version != version)
+			return false;
+		std::string names[5];
+		LayerFiles(clip->files, names);
+		for (int i = 0; i < 5; i++)
+			for (int source = 0; source < 2; source++)
+				if (!(StampOf(SourceFile(names[i], source)) == header.layerFiles[i][source]))
+				{
+					std::cout << clip->files.cache << " is out of date\n";
+					return false;
 				}
+		for (int i = 0; i < 5; i++)
+			if (header.layer[i].offset + header.layer[i].bytes > (unsigned long long)mapped->size)
+			{
+				std::cout << clip->files.cache << " is truncated\n";
+				return false;
+			}
 
-				// Avoids an error when calling SetAndClearRenderSurface during next iteration.
-				// Without this, during the next while loop iteration SetAndClearRenderSurface
-				// would bind a framebuffer with an invalid COLOR_ATTACHMENT0 because the texture ID
-				// associated with COLOR_ATTACHMENT0 had been unlocked by calling wglDXUnlockObjectsNV.
-				eyeRenderTexture[eye]->UnsetRenderSurface();
+		for (int i = 0; i < 5; i++)
+		{
+			const Layer &entry = header.layer[i];
+			const unsigned char *data = mapped->data + entry.offset;
+			BackgroundLayer layer;
+			layer.bc1 = entry.bc1 != 0;
+			layer.gray = entry.gray != 0;
+			layer.width = entry.width;
+			layer.height = entry.height;
+			if (entry.kind == 1)
+				layer.blocks.assign(data, data + entry.bytes);
+			else if (entry.kind == 2)
+			{
+				layer.image = cv::Mat(entry.height, entry.width, entry.type, (void*)data);
+				layer.mapping = mapped;
+			}
+			clip->layer[i] = layer;
+			clip->sameAs[i] = header.sameAs[i];
+		}
+		memcpy(clip->layerAlpha.bits, header.alpha, sizeof(header.alpha));
 
-				// Commit changes to the textures so they get picked up frame
-				eyeRenderTexture[eye]->Commit();
+		unsigned long long offset = header.keysOffset;
+		for (int k = 0; k < FrameRing::nVideos; k++)
+		{
+			unsigned long long bytes = (unsigned long long)(std::max)(header.nKeys[k], 0) * sizeof(int);
+			if (bytes > 0 && offset + bytes <= (unsigned long long)mapped->size && header.scrubGop == (unsigned int)scrub_gop &&
+				StampOf(ScrubFile(clip->files, k)) == header.videoFiles[k])
+			{
+				const int *keys = (const int*)(mapped->data + offset);
+				clip->keys[k].assign(keys, keys + header.nKeys[k]);
 			}
+			offset += bytes;
+		}
+		return true;
+	}
 
-			// Do distortion rendering, Present and flush/sync
-			ovrLayerEyeFov ld;
-			ld.Header.Type = ovrLayerType_EyeFov;
-			ld.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;   // Because OpenGL.
+	//the layers of clip just read, before they are uploaded, into a new cache; its key frames are cached by GopCache
+	static void Write(const PreparedClip &clip)
+	{
+		if (!Enabled(clip.files))
+			return;
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "CLIPCACH", 8);
+		header.version = version;
+		std::string names[5];
+		LayerFiles(clip.files, names);
+		cv::Mat images[5];
+		unsigned long long offset = (sizeof(Header) + 63) / 64 * 64;
+		for (int i = 0; i < 5; i++)
+		{
+			const BackgroundLayer &layer = clip.layer[i];
+			Layer &entry = header.layer[i];
+			for (int source = 0; source < 2; source++)
+				header.layerFiles[i][source] = StampOf(SourceFile(names[i], source));
+			header.sameAs[i] = clip.sameAs[i];
+			entry.gray = layer.gray;
+			if (!layer.blocks.empty())
+			{
+				entry.kind = 1;
+				entry.bc1 = layer.bc1;
+				entry.width = layer.width;
+				entry.height = layer.height;
+				entry.bytes = layer.blocks.size();
+			}
+			else if (!layer.image.empty())
+			{
+				images[i] = layer.image.isContinuous() ? layer.image : layer.image.clone();
+				entry.kind = 2;
+				entry.width = images[i].cols;
+				entry.height = images[i].rows;
+				entry.type = images[i].type();
+				entry.bytes = images[i].total() * images[i].elemSize();
+			}
+			else
+				continue;
+			entry.offset = offset;
+			offset = (offset + entry.bytes + 63) / 64 * 64;
+		}
+		memcpy(header.alpha, clip.layerAlpha.bits, sizeof(header.alpha));
+		header.keysOffset = offset;
+
+		std::string temporary = clip.files.cache + ".tmp";
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		unsigned long long position = sizeof(header);
+		const char zeros[64] = {};
+		for (int i = 0; i < 5 && file; i++)
+		{
+			const Layer &entry = header.layer[i];
+			if (entry.kind == 0)
+				continue;
+			file.write(zeros, std::streamsize(entry.offset - position));
+			if (entry.kind == 1)
+				file.write((const char*)&clip.layer[i].blocks[0], std::streamsize(entry.bytes));
+			else
+				file.write((const char*)images[i].ptr(), std::streamsize(entry.bytes));
+			position = entry.offset + entry.bytes;
+		}
+		file.write(zeros, std::streamsize(offset - position));
+		if (Replace(file, temporary, clip.files.cache))
+			std::cout << "cached the layers of the clip in " << clip.files.cache << "\n";
+		else
+			std::cout << "cannot write " << clip.files.cache << "\n";
+	}
 
-			for (int eye = 0; eye < 2; ++eye)
+	//the key frames indexed by GopCache after the layers of the cache of the clip, into a new cache. Not while
+	//the layers of the cache are mapped, e.g. by the same clip prepared next: they are indexed again then
+	static void WriteKeyFrames(const ClipFiles &files, const std::vector<int> keys[FrameRing::nVideos])
+	{
+		if (!Enabled(files))
+			return;
+		std::shared_ptr<MappedFile> mapped = MappedFile::Open(files.cache);
+		if (!mapped || mapped->size < (long long)sizeof(Header))
+			return;
+		Header header = *(const Header*)mapped->data;
+		if (memcmp(header.magic, "CLIPCACH", 8) != 0 || header.version != version || header.keysOffset > (unsigned long long)mapped->size)
+			return;
+		header.scrubGop = scrub_gop;
+		std::string temporary = files.cache + ".tmp";
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)mapped->data + sizeof(header), std::streamsize(header.keysOffset - sizeof(header)));
+		for (int k = 0; k < FrameRing::nVideos; k++)
+		{
+			header.videoFiles[k] = StampOf(ScrubFile(files, k));
+			header.nKeys[k] = int(keys[k].size());
+			if (!keys[k].empty())
+				file.write((const char*)&keys[k][0], std::streamsize(keys[k].size() * sizeof(int)));
+		}
+		file.seekp(0);
+		file.write((const char*)&header, sizeof(header));
+		mapped.reset();
+		if (!Replace(file, temporary, files.cache))
+			std::cout << "cannot cache the key frames in " << files.cache << "\n";
+	}
+
+	//the video stream k of GopCache reads, none for the depth and the alpha of the packed layout
+	static std::string ScrubFile(const ClipFiles &files, int k)
+	{
+		if (packed_layout)
+			return k == 0 ? files.packed : std::string();
+		return k == 0 ? files.color : (k == 1 ? files.depth : files.alpha);
+	}
+
+private:
+	static bool Enabled(const ClipFiles &files)
+	{
+		return clip_cache && !IsStream(files.color);
+	}
+
+	//a cache written aside moved over the one of the clip, which is never read half written; false if it is mapped
+	static bool Replace(std::ofstream &file, const std::string &temporary, const std::string &cache)
+	{
+		file.close();
+		if (file && MoveFileExA(temporary.c_str(), cache.c_str(), MOVEFILE_REPLACE_EXISTING))
+			return true;
+		DeleteFileA(temporary.c_str());
+		return false;
+	}
+
+	//in the order of PreparedClip::layer
+	static void LayerFiles(const ClipFiles &files, std::string names[5])
+	{
+		names[0] = files.bg;
+		names[1] = files.bgd;
+		names[2] = files.bga;
+		names[3] = files.bbgd;
+		names[4] = files.bbg;
+	}
+
+	//the DDS of a layer, as ReadBackground looks for it first, or its png
+	static std::string SourceFile(const std::string &name, int source)
+	{
+		return source == 0 ? name.substr(0, name.find_last_of('.')) + ".dds" : name;
+	}
+
+	//all zero for a file that is not there
+	static Stamp StampOf(const std::string &filename)
+	{
+		Stamp stamp = { 0, 0, 0 };
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (filename.empty() || !GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes))
+			return stamp;
+		stamp.size = (unsigned long long)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow;
+		stamp.time = (unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime;
+		//FNV-1a of the first and the last 64 KB
+		stamp.hash = 14695981039346656037ULL;
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		std::vector<char> bytes(65536);
+		for (int part = 0; part < 2; part++)
+		{
+			file.clear();
+			file.seekg(part == 0 || stamp.size <= bytes.size() ? 0 : std::streamoff(stamp.size - bytes.size()));
+			file.read(&bytes[0], bytes.size());
+			for (std::streamsize i = 0; i < file.gcount(); i++)
 			{
-				ld.ColorTexture[eye] = eyeRenderTexture[eye]->TextureChain;
-				ld.Viewport[eye] = Recti(eyeRenderTexture[eye]->GetSize());
-				ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
-				ld.RenderPose[eye] = FinalEyePos[eye];
-				ld.SensorSampleTime = 0;
+				stamp.hash ^= (unsigned char)bytes[size_t(i)];
+				stamp.hash *= 1099511628211ULL;
+			}
+		}
+		return stamp;
+	}
+};
+
+//the runs of frames of a video identical to the frame before them, of its sidecar video.same of the preprocessing,
+//a run "first last" a line: the last frame of the run every one of its frames is in, -1 for the others; empty
+//The frames of a clip for the scrubbing of the paused videos, frame by frame both ways or by jumps: every video
+//has a capture of its own, the index of its key frames and an LRU of its GOPs decoded, at most scrub_mb of all of
+//them. A frame out of the cache costs the seek to the key frame before it, which needs no decode, and the decode
+//of its GOP; the frames around it are then in memory. The key frames are read from the packets of the videos
+//without decoding them, every scrub_gop frames where OpenCV cannot read them
+class GopCache
+{
+	struct Gop
+	{
+		int first;
+		std::vector<cv::Mat> frames;
+		size_t bytes;
+	};
+	struct Stream
+	{
+		cv::VideoCapture video;
+		std::string filename;
+		bool asDecoded;
+		std::vector<int> keys;		//the key frames, in order, 0 first
+		int next;					//the frame the capture reads next
+		std::list<Gop> gops;		//the most recently used first
+	};
+	Stream stream[FrameRing::nVideos];
+	int nStreams, nFrames;
+	size_t bytes, budget;
+	bool packed;
+
+public:
+	GopCache() : nStreams(0), nFrames(0), bytes(0), budget(0), packed(false) {}
+
+	//the videos of the clip, decoded as FrameRing reads them: the color as its planes and the depth in 16 bits
+	//where the first frames are. Their key frames are those of the clip cache, or indexed and cached
+	bool Open(PreparedClip &clip)
+	{
+		Close();
+		packed = packed_layout;
+		nStreams = packed ? 1 : FrameRing::nVideos;
+		nFrames = clip.frames;
+		budget = size_t(scrub_mb) << 20;
+		const bool asDecoded[FrameRing::nVideos] = { !packed && clip.first[0].type() == CV_8UC1, clip.first[1].type() == CV_16UC1, false };
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		bool indexed = false;
+		for (int k = 0; k < nStreams; k++)
+		{
+			Stream &v = stream[k];
+			v.filename = ClipCache::ScrubFile(clip.files, k);
+			v.asDecoded = asDecoded[k];
+			if (!OpenVideo(v.video, v.filename.c_str(), v.asDecoded))
+			{
+				std::cout << "cannot read " << v.filename << " to scrub\n";
+				Close();
+				return false;
+			}
+			v.next = 0;
+			if (clip.keys[k].empty())
+			{
+				clip.keys[k] = KeyFrames(v.filename);
+				indexed = true;
 			}
+			v.keys = clip.keys[k];
+		}
+		if (indexed)
+			ClipCache::WriteKeyFrames(clip.files, clip.keys);
+		std::cout << "scrubbing " << nFrames << " frames, " << stream[0].keys.size() << (indexed ? " GOPs indexed in " : " GOPs cached, opened in ") <<
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() << " s\n";
+		return true;
+	}
 
-			ovrLayerHeader* layers = &ld.Header;
-			result = ovr_SubmitFrame(session, frameIndex, nullptr, &layers, 1);
-			// exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
-			if (!OVR_SUCCESS(result))
-				goto Done;
+	void Close()
+	{
+		for (int k = 0; k < nStreams; k++)
+		{
+			stream[k].video.release();
+			stream[k].gops.clear();
+		}
+		bytes = 0;
+		nStreams = 0;
+	}
+
+	bool IsOpen() const
+	{
+		return nStreams > 0;
+	}
+
+	int Frames() const
+	{
+		return nFrames;
+	}
+
+	//frame n of the videos, the parts of the packed one, for FrameRing::Scrub
+	bool Frame(int n, cv::Mat frames[FrameRing::nVideos])
+	{
+		for (int k = 0; k < nStreams; k++)
+		{
+			const cv::Mat *frame = Find(k, n);
+			if (!frame)
+				return false;
+			frames[k] = *frame;
+		}
+		if (packed)
+		{
+			cv::Mat frame = frames[0];
+			int height = frame.rows / 3;
+			for (int k = 0; k < FrameRing::nVideos; k++)
+				frames[k] = frame.rowRange(k * height, (k + 1) * height);
+		}
+		return true;
+	}
 
-			//frameIndex++;
+private:
+	//the frames with a key frame, of the raw packets of the video
+	static std::vector<int> KeyFrames(const std::string &filename)
+	{
+		std::vector<int> keys;
+#ifdef VIDEOCAPTURE_KEYFRAMES
+		cv::VideoCapture raw(filename, cv::CAP_FFMPEG);
+		if (raw.isOpened() && raw.set(cv::CAP_PROP_FORMAT, -1))
+			for (int n = 0; raw.grab(); n++)
+				if (raw.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0)
+					keys.push_back(n);
+#endif
+		if (keys.empty() || keys[0] != 0)
+		{
+			keys.clear();
+			cv::VideoCapture video(filename);
+			int frames = int(video.get(CV_CAP_PROP_FRAME_COUNT));
+			for (int n = 0; n < (std::max)(frames, 1); n += scrub_gop)
+				keys.push_back(n);
 		}
+		return keys;
+	}
 
-		// Blit mirror texture to back buffer
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		GLint w = windowSize.w;
-		GLint h = windowSize.h;
-		glBlitFramebuffer(0, windowSize.h, windowSize.w, 0,
-			0, 0, Platform.WinSizeW, Platform.WinSizeH,
-			GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	//frame n of stream k, of the GOP decoded around it, now the most recently used
+	const cv::Mat *Find(int k, int n)
+	{
+		Stream &v = stream[k];
+		for (std::list<Gop>::iterator gop = v.gops.begin(); gop != v.gops.end(); ++gop)
+			if (n >= gop->first && n < gop->first + int(gop->frames.size()))
+			{
+				v.gops.splice(v.gops.begin(), v.gops, gop);
+				return &v.gops.front().frames[n - gop->first];
+			}
+
+		//the GOP of the key frame before n, to the next key frame, read on from the capture if it is there
+		std::vector<int>::const_iterator key = std::upper_bound(v.keys.begin(), v.keys.end(), n);
+		int first = *(key - 1), end = (key == v.keys.end()) ? nFrames : *key;
+		if (v.next != first)
+			v.video.set(CV_CAP_PROP_POS_FRAMES, first);
+		Gop gop;
+		gop.first = first;
+		gop.bytes = 0;
+		for (int i = first; i < end; i++)
+		{
+			cv::Mat frame;
+			if (!v.video.read(frame))
+				break;
+			gop.bytes += frame.total() * frame.elemSize();
+			gop.frames.push_back(frame);
+		}
+		v.next = first + int(gop.frames.size());
+		if (n >= v.next)
+			return nullptr;
+		bytes += gop.bytes;
+		v.gops.push_front(gop);
+
+		//the GOPs used least recently out of the budget, the ones just decoded kept
+		for (bool evicted = true; bytes > budget && evicted;)
+		{
+			evicted = false;
+			Stream *oldest = nullptr;
+			for (int s = 0; s < nStreams; s++)
+				if (stream[s].gops.size() > 1 && (!oldest || stream[s].gops.size() > oldest->gops.size()))
+					oldest = &stream[s];
+			if (oldest)
+			{
+				bytes -= oldest->gops.back().bytes;
+				oldest->gops.pop_back();
+				evicted = true;
+			}
+		}
+		return &v.gops.front().frames[n - first];
+	}
+};
+
+//without the sidecar
+static std::vector<int> ReadSameFrames(const std::string &video, int frames)
+{
+	std::vector<int> until;
+	std::ifstream file(LocalFile(video + ".same").c_str());
+	int first, last;
+	while (file >> first >> last)
+	{
+		if (until.empty())
+			until.assign((std::max)(frames, 0), -1);
+		for (int i = (std::max)(first, 1); i <= last && i < frames; i++)
+			until[i] = last;
+	}
+	return until;
+}
+
+//The loaders run in parallel: the background layers are read while the videos are opened and their
+//first frames decoded
+//whether two layers read are the same, as blocks or as images
+static bool SameLayer(const BackgroundLayer &a, const BackgroundLayer &b)
+{
+	if (a.gray != b.gray)
+		return false;
+	if (!a.blocks.empty() || !b.blocks.empty())
+		return a.bc1 == b.bc1 && a.width == b.width && a.height == b.height && a.blocks == b.blocks;
+	return !a.image.empty() && a.image.size() == b.image.size() && a.image.type() == b.image.type() &&
+		cv::norm(a.image, b.image, cv::NORM_INF) == 0;
+}
+
+static void PrepareClip(PreparedClip *clip, ClipFiles files)
+{
+	clip->files = files;
+	for (int k = 0; k < FrameRing::nVideos; k++)
+		clip->keys[k].clear();
+	//the layers of the clip cache, else read from their files and cached once the videos are open
+	bool cached = ClipCache::Read(clip);
+	std::future<BackgroundLayer> layers[5];
+	if (!cached)
+	{
+		layers[0] = std::async(std::launch::async, ReadBackground, clip->files.bg.c_str(), false);
+		layers[1] = std::async(std::launch::async, ReadBackground, clip->files.bgd.c_str(), true);
+		layers[2] = std::async(std::launch::async, ReadBackground, clip->files.bga.c_str(), true);
+		layers[3] = std::async(std::launch::async, ReadBackground, clip->files.bbgd.c_str(), true);
+		layers[4] = std::async(std::launch::async, ReadBackground, clip->files.bbg.c_str(), false);
+	}
+	//the audio of a streamed clip is downloaded for the audio thread
+	std::future<std::string> audio = std::async(std::launch::async, LocalFile, clip->files.audio);
+
+	//The images and frames are uploaded top row first, as decoded, the sphere samples them from the top
+
+	//Open videos, read first images
+	cv::VideoCapture &g_video = clip->video[0], &d_video = clip->video[1], &a_video = clip->video[2];
+	cv::Mat &img1 = clip->first[0], &d_img1 = clip->first[1], &a_img = clip->first[2];
+	for (int k = 0; k < FrameRing::nVideos; k++)
+		clip->first[k].allocator = &framePool;
+	std::future<void> opened[FrameRing::maxStreams];
+	if (!clip->files.tiles.empty())
+	{
+		//the tiles of the grid put together into the packed frame, every one packed itself
+		std::vector<cv::Mat> tiles(clip->files.tiles.size());
+		for (size_t t = 0; t < tiles.size(); t++)
+			opened[t] = std::async(std::launch::async, [&, t] {
+				OpenVideo(clip->video[t], clip->files.tiles[t].c_str());
+				if (!clip->video[t].isOpened()) {
+					std::cout << "cannot read tile " << clip->files.tiles[t] << "!\n";
+				}
+				clip->video[t].read(tiles[t]);
+			});
+		for (size_t t = 0; t < tiles.size(); t++)
+			opened[t].get();
+		int width = tiles[0].cols, height = tiles[0].rows / 3;
+		img1.create(height * tile_rows * 3, width * tile_cols, CV_8UC3);
+		img1.setTo(cv::Scalar(0, 0, 0));
+		for (size_t t = 0; t < tiles.size(); t++)
+			if (tiles[t].cols == width && tiles[t].rows == height * 3)
+				for (int p = 0; p < 3; p++)
+					tiles[t].rowRange(p * height, (p + 1) * height).copyTo(img1(cv::Rect(int(t % tile_cols) * width, (p * tile_rows + int(t / tile_cols)) * height, width, height)));
+	}
+	else if (packed_layout)
+	{
+		opened[0] = std::async(std::launch::async, [&] {
+			OpenVideo(g_video, live_depth ? clip->files.color.c_str() : clip->files.packed.c_str());
+			if (!g_video.isOpened()) {
+				std::cout << (live_depth ? "cannot read rgb video!\n" : "cannot read packed video!\n");
+			}
+			g_video.read(img1);
+			//the first frame of the live layout packed with the depth of the middle and an alpha all opaque
+			if (live_depth && img1.type() == CV_8UC3)
+			{
+				cv::Mat packed;
+				packed.allocator = &framePool;
+				packed.create(img1.rows * 3, img1.cols, CV_8UC3);
+				img1.copyTo(packed.rowRange(0, img1.rows));
+				packed.rowRange(img1.rows, img1.rows * 2).setTo(cv::Scalar::all(128));
+				packed.rowRange(img1.rows * 2, img1.rows * 3).setTo(cv::Scalar::all(255));
+				img1 = packed;
+			}
+		});
+	}
+	else
+	{
+	opened[0] = std::async(std::launch::async, [&] {
+		OpenVideo(g_video, clip->files.color.c_str(), yuv_color);
+		if (!g_video.isOpened()) {
+			std::cout << "cannot read rgb video!\n";
+		}
+		g_video.read(img1);
+		//the color as its NV12 planes if the backend of OpenCV decodes it so
+		if (yuv_color && (img1.type() != CV_8UC1 || img1.rows % 3 != 0 || img1.cols % 2 != 0))
+		{
+			std::cout << "the color video is not decoded as NV12 planes, reading it as 8-bit BGR\n";
+			g_video.release();
+			OpenVideo(g_video, clip->files.color.c_str());
+			g_video.read(img1);
+		}
+	});
 
-		SwapBuffers(Platform.hDC);
+	//
+	opened[1] = std::async(std::launch::async, [&] {
+		OpenVideo(d_video, clip->files.depth.c_str(), depth16);
+		if (!d_video.isOpened()) {
+			std::cout << "cannot read video!\n";
+		}
+		d_video.read(d_img1);
+		//a depth video of more than 8 bits is 16-bit gray if the backend of OpenCV decodes it so
+		if (depth16 && d_img1.type() != CV_16UC1)
+		{
+			std::cout << "the depth video is not decoded as 16-bit gray, reading it as 8-bit BGR\n";
+			d_video.release();
+			OpenVideo(d_video, clip->files.depth.c_str());
+			d_video.read(d_img1);
+		}
+	});
+	//
+	opened[2] = std::async(std::launch::async, [&] {
+		OpenVideo(a_video, clip->files.alpha.c_str());
+		if (!a_video.isOpened()) {
+			std::cout << "cannot read video!\n";
+		}
+		a_video.read(a_img);
+		//a single channel of the alpha is uploaded, a third of its BGR
+		cv::Mat a_gray;
+		a_gray.allocator = &framePool;
+		cv::extractChannel(a_img, a_gray, 0);
+		a_img = a_gray;
+	});
 	}
-
-Done:
-	delete roomScene;
-	if (mirrorFBO) glDeleteFramebuffers(1, &mirrorFBO);
-	if (mirrorTexture) ovr_DestroyMirrorTexture(session, mirrorTexture);
-	for (int eye = 0; eye < 2; ++eye)
+	for (int k = 0; k < FrameRing::maxStreams; k++)
+		if (opened[k].valid())
+			opened[k].get();
+
+	//Get number of frames (duration), from the alpha or the packed video
+	cv::VideoCapture &info_video = packed_layout ? g_video : a_video;
+	clip->frames = int(info_video.get(CV_CAP_PROP_FRAME_COUNT));
+	clip->fps = float(info_video.get(CV_CAP_PROP_FPS));
+	for (int k = 0; k < FrameRing::nVideos; k++)
+		clip->sameUntil[k].clear();
+	if (!packed_layout && clip->files.tiles.empty())
 	{
-		delete eyeRenderTexture[eye];
-		delete eyeDepthBuffer[eye];
+		clip->sameUntil[1] = ReadSameFrames(clip->files.depth, clip->frames);
+		clip->sameUntil[2] = ReadSameFrames(clip->files.alpha, clip->frames);
+	}
+	//the packed video stacks the color, the depth and the alpha of a frame top to bottom
+	if (packed_layout)
+	{
+		cv::Mat img = img1;
+		int height = img.rows / 3;
+		img1 = img.rowRange(0, height);
+		d_img1 = img.rowRange(height, height * 2);
+		a_img = img.rowRange(height * 2, height * 3);
 	}
-	Platform.ReleaseDevice();
-	ovr_Destroy(session);
 
-	// Retry on ovrError_DisplayLost
-	return retryCreate || (result == ovrError_DisplayLost);
+	if (!cached)
+	{
+		for (int i = 0; i < 5; i++)
+			clip->layer[i] = layers[i].get();
+		clip->layerAlpha = LayerOccupancy(clip->layer[2]);
+		//the static plates written twice are uploaded once
+		for (int i = 0; i < 5; i++)
+		{
+			clip->sameAs[i] = i;
+			for (int j = 0; j < i && clip->sameAs[i] == i; j++)
+				if (clip->sameAs[j] == j && SameLayer(clip->layer[i], clip->layer[j]))
+					clip->sameAs[i] = j;
+			if (clip->sameAs[i] != i)
+				clip->layer[i] = BackgroundLayer();
+		}
+		ClipCache::Write(*clip);
+	}
+	audio.get();
 }
 
-//Thread for handling audio
-void AudioThread(LPVOID pArgs_)
+//the layers of a clip into their textures, a layer the same as one before it into the texture of that one instead
+//of one of its own: the static plates, e.g. the inpainted background of a clip whose background has nothing to
+//inpaint. A texture shared by layers of the clip before is given one of its own again before it is uploaded
+static void LayerTextures(GLuint *textures[5], const PreparedClip &clip)
 {
-	ARGS_aud *pArgs = (ARGS_aud*)pArgs_;
-	bool *fl_write = pArgs->fl_write;
-	bool *fl_terminate = pArgs->fl_terminate;
-	std::string *audiofile = pArgs->audiofile;
-	bool *pause_all = pArgs->pause_all;
-	std::string audiofilename = *audiofile;
-	const char *cstr = audiofilename.c_str();
-	bool pause_sound;
-	
-
-	ISoundEngine* engine = createIrrKlangDevice();
-	if (!engine)
+	for (int i = 0; i < 5; i++)
 	{
-		printf("Could not startup engine\n");
+		bool shared = false;
+		for (int j = 0; j < 5; j++)
+			shared = shared || (j != i && *textures[j] == *textures[i]);
+		if (clip.sameAs[i] != i)
+		{
+			if (*textures[i] && !shared)
+				FreeTextures(1, textures[i]);
+			*textures[i] = *textures[clip.sameAs[i]];
+			continue;
+		}
+		if (shared)
+			*textures[i] = 0;
+		BackgroundTexture(textures[i], clip.layer[i]);
 	}
+}
 
-	bool played = false;
-	while (Platform.HandleMessages())
+//The benchmark of the video path, with neither LibOVR nor a Rift: the videos of the first clip of the playlist decoded,
+//stored into the slots, uploaded and published by a FrameRing as the video thread does, as fast as the decoders go
+//and with no scene drawn, for decode_bench seconds in each of the 16 configurations of the depth of 8 or 16 bits, the
+//color as BGR or as YUV planes, the uploads buffered or direct and the decoding on the CPU or the hardware. The
+//milliseconds per frame of a stream to decode and to store (its flip and conversion on the CPU), of the uploads of a
+//frame of all the streams until the GPU is done with them (the conversion of the YUV planes with them), and the
+//frames per second, printed and written to decode_bench.csv. A configuration the videos or the driver fall back from
+//says so as it opens them, and its row has what it ran with
+static bool DecodeBenchLoop(bool retryCreate)
+{
+	UNREFERENCED_PARAMETER(retryCreate);
+	if (playlist.empty() || !Platform.InitDevice(640, 360, nullptr))
+		return false;
+	wglSwapIntervalEXT(0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	mediaClock.hasAudio = false;
+	bool computeShaders = wglGetProcAddress("glDispatchCompute") != nullptr;
+	if (decoder_process)
+		std::cout << "the benchmark decodes the videos in the viewer, not in a decoder process\n";
+	decoder_process = false;
+
+	std::ofstream csv("decode_bench.csv");
+	csv << "depth,color,uploads,decoding,decode_ms,store_ms,upload_ms,fps\n";
+	printf("%-6s %-5s %-8s %-9s %10s %10s %10s %8s\n", "depth", "color", "uploads", "decoding", "decode ms", "store ms", "upload ms", "fps");
+	for (int c = 0; c < 16 && Platform.HandleMessages(); c++)
 	{
-		
-
-		if (*fl_write == true & played == false)
+		depth16 = (c & 1) != 0;
+		yuv_color = (c & 2) != 0 && computeShaders;
+		pbo_uploads = (c & 4) == 0;
+		hardware_decode = (c & 8) != 0;
+		PreparedClip clip;
+		PrepareClip(&clip, playlist[0]);
+		if (clip.frames < 2)
 		{
-			Sleep(1500.0f);
-			engine->play2D(cstr, true);
-			played = true;
+			std::cout << "cannot decode " << clip.files.color << "\n";
+			break;
 		}
-		if (*fl_terminate == true)
+		bool hardware = false;
+#ifdef VIDEO_HW_ACCELERATION
+		hardware = clip.video[0].get(cv::CAP_PROP_HW_ACCELERATION) != cv::VIDEO_ACCELERATION_NONE;
+#endif
+		const char *depth = clip.first[1].type() == CV_16UC1 ? "16bit" : "8bit";
+		const char *color = !packed_layout && clip.first[0].type() == CV_8UC1 ? "yuv" : "bgr";
+
+		cv::VideoCapture *videos[FrameRing::maxStreams];
+		const char *videoFiles[FrameRing::maxStreams];
+		clip.Streams(videos, videoFiles);
+		FrameHandoff handoff;
+		FrameRing ring;
+		ring.SetSameFrames(clip.sameUntil);
+		ring.Init(videos, videoFiles, clip.first, clip.frames, packed_layout, &handoff);
+		clip.ReleaseLayers();
+		glFinish();
+		ring.TakeTimes();
+
+		//the slots presented as soon as they are decoded, the GPU done with their uploads before the next ones
+		ScopedTimer running;
+		double uploadSeconds = 0;
+		long long first = ring.Presented();
+		while (running.Seconds() < decode_bench && Platform.HandleMessages())
 		{
-			*fl_terminate = false;
-			engine->stopAllSounds();
-			engine->play2D(cstr, true);
-			played = true;
-			//ExitThread(0);
+			ScopedTimer uploading;
+			bool loopEnd;
+			if (ring.Present(ring.Presented() + FrameRing::nSlots, loopEnd))
+			{
+				glFinish();
+				uploadSeconds += uploading.Seconds();
+				ring.Publish();
+			}
+			else
+				ring.Wait(std::chrono::steady_clock::now() + std::chrono::milliseconds(5));
 		}
-
-		engine->setAllSoundsPaused(*pause_all);
+		double seconds = running.Seconds();
+		long long frames = ring.Presented() - first;
+		FrameRing::PathTimes times = ring.TakeTimes();
+		const char *uploads = ring.Buffered() ? "buffered" : "direct";
+		ring.Release();
+
+		double decodeMs = 1000 * times.decode / (std::max)(times.frames, 1LL), storeMs = 1000 * times.store / (std::max)(times.frames, 1LL);
+		double uploadMs = 1000 * uploadSeconds / (std::max)(frames, 1LL), fps = frames / (std::max)(seconds, 1e-6);
+		const char *decoding = hardware ? "hardware" : "cpu";
+		printf("%-6s %-5s %-8s %-9s %10.2f %10.2f %10.2f %8.1f\n", depth, color, uploads, decoding, decodeMs, storeMs, uploadMs, fps);
+		csv << depth << "," << color << "," << uploads << "," << decoding << "," << decodeMs << "," << storeMs << "," << uploadMs << "," << fps << "\n";
 	}
+	Platform.ReleaseDevice();
+	return false;
 }
 
 //Thread for handling video decoding
 void VideoThread(LPVOID pArgs_)
 {
 /*
-Decode video frame
-Upload frame to back texture
-Swap front and back textures
+Decode video frames ahead into the slots of a ring, one decoder thread per video
+Upload the decoded slots to their textures
+Present the textures of the slot of the presentation clock once its upload is done
 */
+SetThreadRole(RoleVideo);
 wglMakeCurrent(Platform.hDC, Platform.WglContext_VideoThread);
 OVR::GLEContext::SetCurrentContext(&Platform.GLEContext);
 Platform.GLEContext.Init();
+//the color planes are converted by a compute shader, decoded to BGR without them
+if (yuv_color && !wglGetProcAddress("glDispatchCompute"))
+{
+	std::cout << "no compute shaders, decoding the color video to BGR\n";
+	yuv_color = false;
+}
+//the rows of the BGR frames are not padded
+glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
 ARGS *pArgs = (ARGS*)pArgs_;
-GLuint *mFront_left = pArgs->mFront_left;
-GLuint *mFront_dleft = pArgs->mFront_dleft;
-GLuint *mFront_aleft = pArgs->mFront_aleft;
 GLuint *mFront_bg = pArgs->mFront_bg;
 GLuint *mFront_bgd = pArgs->mFront_bgd;
 GLuint *mFront_bbg = pArgs->mFront_bbg;
 GLuint *mFront_bbgd = pArgs->mFront_bbgd;
 
-GLuint *mBack_left = pArgs->mBack_left;
-GLuint *mBack_dleft = pArgs->mBack_dleft;
-GLuint *mBack_aleft = pArgs->mBack_aleft;
 GLuint *mBack_bg = pArgs->mBack_bg;
 GLuint *mBack_bgd = pArgs->mBack_bgd;
 GLuint *mBack_bbg = pArgs->mBack_bbg;
@@ -607,239 +6647,211 @@ GLuint *black_text = pArgs->black_text;
 GLuint *bga_text = pArgs->bga_text;
 
 
-bool *fl_terminate = pArgs->fl_terminate;
-bool *fl_write = pArgs->fl_write;
-bool *pause_all = pArgs->pause_all;
 
-
-std::swap(*mFront_dleft, *mBack_dleft);
-std::swap(*mFront_left, *mBack_left);
-std::swap(*mFront_aleft, *mBack_aleft);
 std::swap(*mFront_bg, *mBack_bg);
 std::swap(*mFront_bgd, *mBack_bgd);
 std::swap(*mFront_bbg, *mBack_bbg);
 std::swap(*mFront_bbgd, *mBack_bbgd);
 
 
-//Get number of frames (duration)
-a_video.open(a_filename);
-if (!a_video.isOpened()) {
-	std::cout << "cannot read depth video!\n";
-}
-frames = int(a_video.get(CV_CAP_PROP_FRAME_COUNT));
-width = int(a_video.get(CV_CAP_PROP_FRAME_WIDTH));
-height = int(a_video.get(CV_CAP_PROP_FRAME_HEIGHT));
-FPSvideo = float(a_video.get(CV_CAP_PROP_FPS));
-//FPSvideo = 10.0f;
-a_video.release();
-
-//GRAMMA CORRECTION LOOKUP TABLE
-double inverse_gamma = 1.02;
-cv::Mat lut_matrix(1, 256, CV_8UC1);
-uchar * ptr = lut_matrix.ptr();
-for (int i = 0; i < 256; i++)
-	ptr[i] = (int)(pow((double)i / 255.0, inverse_gamma) * 255.0);
-
-
-bbgd_img = cv::imread(bbgd_filename);
-cv::flip(bbgd_img, bbgd_img, 0);
-
-bbg_img = cv::imread(bbg_filename);
-cv::flip(bbg_img, bbg_img, 0);
-LUT(bbg_img, lut_matrix, bbg_img);
-
-
-//Open videos, read first images
-g_video.open(g_filename);
-if (!g_video.isOpened()) {
-	std::cout << "cannot read rgb video!\n";
-}
-g_video.read(img);
-img1 = img;
-cv::flip(img1, img1, 0);
-
-//
-d_video.open(d_filename);
-if (!d_video.isOpened()) {
-	std::cout << "cannot read video!\n";
-}
-d_video.read(d_img1);
-cv::flip(d_img1, d_img1, 0);
-//
-a_video.open(a_filename);
-if (!a_video.isOpened()) {
-	std::cout << "cannot read video!\n";
-}
-a_video.read(a_img);
-cv::flip(a_img, a_img, 0);
-
-bg_img = cv::imread(bg_filename);
-cv::flip(bg_img, bg_img, 0);
-LUT(bg_img, lut_matrix, bg_img);
-
-bgd_img = cv::imread(bgd_filename);
-cv::flip(bgd_img, bgd_img, 0);
-
-bga_img = cv::imread(bga_filename);
-cv::flip(bga_img, bga_img, 0);
-
-
+//The clip played and the next one of the playlist, prepared while it plays
+PreparedClip clips[2];
+PreparedClip *current = &clips[0], *next = &clips[1];
+int clipIndex = 0;
+PrepareClip(current, playlist[0]);
 black_img = cv::imread("Resources/black.png");
+startup.Done("videos opened");
 
 
 //Textures
 glGenTextures(1, black_text);
 glBindTexture(GL_TEXTURE_2D, *black_text);
 glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, black_img.cols, black_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, black_img.data);
+gpuResidency.Texture(*black_text, GpuResidency::PoolLayers, TextureBytes(black_img.cols, black_img.rows, 4));
 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 glBindTexture(GL_TEXTURE_2D, 0);
 
-glGenTextures(1, mBack_left);
-glBindTexture(GL_TEXTURE_2D, *mBack_left);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, img1.cols, img1.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, img1.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, mBack_dleft);
-glBindTexture(GL_TEXTURE_2D, *mBack_dleft);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, d_img1.cols, d_img1.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, d_img1.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, mBack_aleft);
-glBindTexture(GL_TEXTURE_2D, *mBack_aleft);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, a_img.cols, a_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, a_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, mBack_bg);
-glBindTexture(GL_TEXTURE_2D, *mBack_bg);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bg_img.cols, bg_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bg_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, mBack_bgd);
-glBindTexture(GL_TEXTURE_2D, *mBack_bgd);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bgd_img.cols, bgd_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bgd_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, bga_text);
-glBindTexture(GL_TEXTURE_2D, *bga_text);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bga_img.cols, bga_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bga_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
-
-glGenTextures(1, mBack_bbgd);
-glBindTexture(GL_TEXTURE_2D, *mBack_bbgd);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bbgd_img.cols, bbgd_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bbgd_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
+//Video textures, the ones of the presented slot of the ring drawn by the render thread
+cv::VideoCapture *videos[FrameRing::maxStreams];
+const char *videoFiles[FrameRing::maxStreams];
+current->Streams(videos, videoFiles);
+FrameRing ring;
+ring.SetSameFrames(current->sameUntil);
+ring.Init(videos, videoFiles, current->first, current->frames, packed_layout, &videoFrames);
+ring.SetLayerAlpha(current->layerAlpha);
+float FPSvideo = current->fps;
 
-glGenTextures(1, mFront_bbg);
-glBindTexture(GL_TEXTURE_2D, *mFront_bbg);
-glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bbg_img.cols, bbg_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bbg_img.data);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-glBindTexture(GL_TEXTURE_2D, 0);
+//The background layers, the BC1 and BC4 textures of the preprocessing if it baked them
+GLuint *layerTextures[5] = { mBack_bg, mBack_bgd, bga_text, mBack_bbgd, mFront_bbg };
+LayerTextures(layerTextures, *current);
+current->ReleaseLayers();
 
 
-std::swap(*mFront_dleft, *mBack_dleft);
-std::swap(*mFront_left, *mBack_left);
-std::swap(*mFront_aleft, *mBack_aleft);
 std::swap(*mFront_bg, *mBack_bg);
 std::swap(*mFront_bgd, *mBack_bgd);
 //std::swap(*mFront_bbg, *mBack_bbg);
 std::swap(*mFront_bbgd, *mBack_bbgd);
 
-bool pause = false;
-int framecount = 1;
-int refresh = 0;
-
-clock_t eF = clock();
-clock_t DTime = 0;
+//the textures are complete before the first frame publishes them and their IDs
+glFinish();
+ring.Publish();
+startup.Done("textures uploaded");
 
-Sleep(1000);
-*fl_write = true;
+//the layers drawn, the ones of the next clip uploaded to them in place
+GLuint *shownLayers[5] = { mFront_bg, mFront_bgd, bga_text, mFront_bbgd, mFront_bbg };
+std::future<void> prepared;
+if (playlist.size() > 1)
+	prepared = std::async(std::launch::async, PrepareClip, next, playlist[1]);
+int clipLoops = 0;
 
-//Read new frames, update textures
-while (Platform.HandleMessages())
+bool pause = false;
+//the paused videos scrubbed to frame scrubbed of the clip, -1 while they are as the decoders left them; the videos of
+//the packed layout or of the color, the depth and the alpha, decoded by the viewer
+GopCache scrubCache;
+int scrubbed = -1;
+bool scrubbing = scrub_mb > 0 && !decoder_process && !live_depth && tile_cols * tile_rows == 1;
+//the loop of the videos played starts at frame loopFirst of the ring, and is the start loopStarts of the audio
+long long loopFirst = 0;
+int loopStarts = 1;
+//the seconds of the loop played, the clock without audio
+double loopTime = 0;
+
+//ready: the audio starts, and the clock with it
+loopStarts = audioControl.Start(clipIndex);
+std::chrono::steady_clock::time_point eF = std::chrono::steady_clock::now();
+WatchedThread watched("video thread");
+//the keys of the video thread, from the message pump of the render thread; a key pressed wakes the wait of the ring
+KeyQueue keys({ VK_SPACE, 'N', VK_LEFT, VK_RIGHT, VK_PRIOR, VK_NEXT });
+keys.Notify = [&ring] { ring.Wake(); };
+Platform.Subscribe(&keys);
+
+//Upload the decoded frames, present the one of the clock
+while (Platform.Running)
 {	
+	watched.Feed("presenting after frame", ring.Presented());
 
-	//PAUSE - CONTINUE	
-	if (Platform.Key[VK_SPACE]) {
-		pause = !pause;
-		Platform.Key[VK_SPACE] = false;
- 		*pause_all = !(*pause_all);
-	}
-
-	DTime = clock() - eF;
-	//FPSvideo = 1;
-	if ((clockToMilliseconds(DTime) > (1.0/ (FPSvideo))*1000.0) || refresh)  //every second
+	//PAUSE - CONTINUE on SPACE, the NEXT CLIP on N, paused a frame BACK and FORWARD on the arrows, a second on
+	//PAGE UP and DOWN
+	bool nextKey = false;
+	for (int key; keys.Pop(key);)
 	{
-		eF = clock();
-		if (pause && refresh==0)
-			continue;
-		
-		if (pause && refresh > 0)
+		if (key == VK_SPACE) {
+			pause = !pause;
+			//the decoders and the clock go on from the frame scrubbed to, the audio with them
+			if (!pause && scrubbed >= 0)
+			{
+				ring.Resume(videos, videoFiles, scrubbed);
+				loopFirst = ring.Presented() - scrubbed;
+				loopTime = scrubbed / FPSvideo;
+				loopStarts = audioControl.Start(clipIndex, int(1000 * loopTime));
+				scrubbed = -1;
+			}
+			audioControl.Pause(pause);
+			videoPaused.store(pause);
+		}
+		else if (key == 'N')
+			nextKey = true;
+		else if (pause && scrubbing)
 		{
-			refresh--;
-			framecount--;
+			int frames = current->frames;
+			int from = scrubbed >= 0 ? scrubbed : int((std::max)(ring.Presented() - loopFirst, 0LL) % (std::max)(frames, 1));
+			int second = (std::max)(int(FPSvideo + 0.5f), 1);
+			int step = key == VK_LEFT ? -1 : key == VK_RIGHT ? 1 : key == VK_PRIOR ? -second : second;
+			int to = (std::max)(0, (std::min)(from + step, frames - 1));
+			cv::Mat scrubFrames[FrameRing::nVideos];
+			if ((scrubCache.IsOpen() || scrubCache.Open(*current)) && scrubCache.Frame(to, scrubFrames))
+			{
+				ring.Scrub(scrubFrames);
+				ring.Publish();
+				scrubbed = to;
+			}
+			else
+				std::cout << "cannot scrub to frame " << to << "\n";
 		}
+	}
 
-		//VIDEO IMG
-		g_video.read(img);	
-		//LUT(img, lut_matrix, img);
-		img1 = img;
-		cv::flip(img1, img1, 0);
-
-		//DEPTH IMG
-		d_video.read(d_img1);
-		cv::flip(d_img1, d_img1, 0);
-
-		//ALPHA IMG
-		a_video.read(a_img);
-		cv::flip(a_img, a_img, 0);
-		
-
-		glBindTexture(GL_TEXTURE_2D, *mBack_left);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img1.cols, img1.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, img1.data);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		glBindTexture(GL_TEXTURE_2D, *mBack_dleft);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, d_img1.cols, d_img1.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, d_img1.data);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		glBindTexture(GL_TEXTURE_2D, *mBack_aleft);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, a_img.cols, a_img.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, a_img.data);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-
-		std::swap(mFront_left, mBack_left);
-		std::swap(mFront_dleft, mBack_dleft);
-		std::swap(mFront_aleft, mBack_aleft);
-
-		framecount++;
-		
-		if (framecount == frames)
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double exportAt = 0;
+	if (!export_file.empty())
+		loopTime += exportClock.Advance(exportAt);
+	else if (!pause)
+		loopTime += std::chrono::duration<double>(now - eF).count();
+	eF = now;
+
+	//the seconds of the loop on the media clock, -1 while the audio of the loop has not started
+	double t = loopTime;
+	mediaClock.Poll();
+	if (mediaClock.hasAudio)
+		t = (mediaClock.audioStarts >= loopStarts) ? (std::max)(mediaClock.Seconds(now, pause), 0.0) : -1;
+
+	if (tile_cols * tile_rows > 1)
+		ring.View(Vector3f(viewDirection.x, viewDirection.y, viewDirection.z));
+
+	//the decoders back from a stall seeked ahead to the clock
+	loopFirst -= ring.Resynced();
+	bool loopEnd;
+	long long target = loopFirst + (long long)(t * FPSvideo);
+	if (t >= 0 && ring.Present(target, loopEnd))
+	{
+		ring.Publish();
+		if (loopEnd)
 		{
-			*fl_terminate = true;
-			//ExitThread(0);
-			framecount = 1;
-			g_video.set(CV_CAP_PROP_POS_FRAMES, framecount);
-			d_video.set(CV_CAP_PROP_POS_FRAMES, framecount);
-			a_video.set(CV_CAP_PROP_POS_FRAMES, framecount);			
+			loopFirst = ring.Presented() + 1;
+			loopStarts = audioControl.Start(clipIndex);
+			loopTime = 0;
+			t = 0;
+			clipLoops++;
 		}
 	}
+	if (!export_file.empty() && t >= 0 && ring.Presented() >= target)
+		exportClock.reached.store(exportAt);
+
+	//NEXT CLIP of the playlist, on the N key or after clip_loops loops: the one prepared meanwhile; or the clip
+	//picked in the gallery, prepared then unless it is the next one
+	int picked = galleryPick.exchange(-1);
+	bool nextClip = nextKey || picked >= 0 || (clip_loops > 0 && clipLoops >= clip_loops);
+	if (nextClip && prepared.valid())
+	{
+		int following = picked >= 0 ? picked : (clipIndex + 1) % int(playlist.size());
+		watched.Feed("switching to clip", following);
+		prepared.get();
+		if (following != (clipIndex + 1) % int(playlist.size()))
+			PrepareClip(next, playlist[following]);
+		scrubCache.Close();
+		scrubbed = -1;
+		std::swap(current, next);
+		clipIndex = following;
+		current->Streams(videos, videoFiles);
+		ring.SetLayerAlpha(current->layerAlpha);
+		ring.SetSameFrames(current->sameUntil);
+		ring.Switch(videos, videoFiles, current->first, current->frames, packed_layout);
+		LayerTextures(shownLayers, *current);
+		current->ReleaseLayers();
+		glFinish();
+		ring.Publish();
+		std::cout << "playing clip " << clipIndex << ", " << current->files.color << "\n";
+
+		//the clock starts again with the audio of the clip, instead of the loop of the last one
+		FPSvideo = current->fps;
+		loopFirst = ring.Presented();
+		loopStarts = audioControl.Start(clipIndex);
+		loopTime = 0;
+		clipLoops = 0;
+		t = mediaClock.hasAudio ? -1 : 0;
+		prepared = std::async(std::launch::async, PrepareClip, next, playlist[(clipIndex + 1) % playlist.size()]);
+	}
+
+	//sleeps until the next frame of the clock is due or a key is pressed, and at least every 50 ms for the
+	//tiles of the view, every 250 ms without tiles in the low power mode
+	double untilNext = (t < 0) ? 0.005 : (ring.Presented() + 1 - loopFirst) / FPSvideo - t;
+	double wake = (lowPower.load() && tile_cols * tile_rows <= 1) ? 0.25 : 0.05;
+	untilNext = export_file.empty() ? (std::max)(0.001, (std::min)(untilNext, wake)) : 0.001;
+	ring.Wait(now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(untilNext)));
 }
+Platform.Unsubscribe(&keys);
+audioControl.Quit();
+ring.Release();
 }
 
 LPSTR* CommandLineToArgvA(_In_opt_ LPCSTR lpCmdLine, _Out_ int *pNumArgs)
@@ -1123,6 +7135,9 @@ void WaitForEnter()
 //-------------------------------------------------------------------------------------
 int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR lpCmdLine, int)
 {
+	//the decoder process of a viewer at DecoderProcess on, no window nor settings of its own
+	if (strncmp(lpCmdLine, "-decoder ", 9) == 0)
+		return RunDecoderProcess(lpCmdLine + 9);
 
 	AllocConsole();
 	FILE* fp;
@@ -1135,22 +7150,23 @@ int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR lpCmdLine, int)
 	std::ifstream is("settings.txt");
 	char buffer[200];
 	char buffer_name[200];
+	std::vector<std::string> clipNames;
 	while (is >> buffer) {
 		if (strcmp(buffer, "Path") == 0) {
 			is >> buffer_name;
-			sprintf(video_path, "%s", buffer_name);
+			snprintf(video_path, sizeof(video_path), "%s", buffer_name);
 		}
 		if (strcmp(buffer, "DataPath") == 0) {
 			is >> buffer_name;
-			sprintf(data_path, "%s", buffer_name);
+			snprintf(data_path, sizeof(data_path), "%s", buffer_name);
 		}
 		if (strcmp(buffer, "UserID") == 0) {
 			is >> buffer_name;
-			sprintf(userID, "%s", buffer_name);
+			snprintf(userID, sizeof(userID), "%s", buffer_name);
 		}
 		if (strcmp(buffer, "Test") == 0) {
 			is >> buffer_name;
-			sprintf(testID, "%s", buffer_name);
+			snprintf(testID, sizeof(testID), "%s", buffer_name);
 		}
 		if (strcmp(buffer, "RenderingMode") == 0) {
 			is >> buffer_name;
@@ -1158,65 +7174,444 @@ int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR lpCmdLine, int)
 			{
 				positional_track = true;
 				render_simple = false;
-				sprintf(mode, "%s", buffer_name);
+				snprintf(mode, sizeof(mode), "%s", buffer_name);
 			}
 			if (strcmp(buffer_name, "static") == 0)
 			{
 				positional_track = false;
 				render_simple = false;
-				sprintf(mode, "%s", buffer_name);
+				snprintf(mode, sizeof(mode), "%s", buffer_name);
 			}
 			if (strcmp(buffer_name, "simple") == 0)
 			{
 				positional_track = true;
 				render_simple = true;
-				sprintf(mode, "%s", buffer_name);
+				snprintf(mode, sizeof(mode), "%s", buffer_name);
 			}
 
 		}
 		if (strcmp(buffer, "VisualConstraint") == 0) {
 			is >> buffer_name;
-			sprintf(visID, "%s", "None");
+			snprintf(visID, sizeof(visID), "%s", "None");
 			if (strcmp(buffer_name, "fade") == 0)
 			{
 				vis_fade = true;
-				sprintf(visID, "%s", buffer_name);
+				snprintf(visID, sizeof(visID), "%s", buffer_name);
 
 			}
 			if (strcmp(buffer_name, "Clamp") == 0)
 			{
 				vis_clamp = true;
-				sprintf(visID, "%s", buffer_name);
+				snprintf(visID, sizeof(visID), "%s", buffer_name);
 			}
 		}
+		if (strcmp(buffer, "Layout") == 0) {
+			is >> buffer_name;
+			packed_layout = strcmp(buffer_name, "packed") == 0 || strcmp(buffer_name, "tiled") == 0 || strcmp(buffer_name, "live") == 0;
+			//live: the plain 360 video, its depth computed as it plays
+			live_depth = strcmp(buffer_name, "live") == 0;
+			//tiled <columns> <rows>
+			if (strcmp(buffer_name, "tiled") == 0)
+				is >> tile_cols >> tile_rows;
+		}
+		if (strcmp(buffer, "Decoding") == 0) {
+			is >> buffer_name;
+			hardware_decode = strcmp(buffer_name, "hardware") == 0;
+		}
+		//DecoderProcess on|off
+		if (strcmp(buffer, "DecoderProcess") == 0) {
+			is >> buffer_name;
+			decoder_process = strcmp(buffer_name, "on") == 0;
+		}
+		if (strcmp(buffer, "Reading") == 0) {
+			is >> buffer_name;
+			memory_reading = strcmp(buffer_name, "memory") == 0;
+		}
+		if (strcmp(buffer, "PreloadMB") == 0) {
+			is >> buffer_name;
+			preload_mb = atoi(buffer_name);
+		}
+		if (strcmp(buffer, "Renditions") == 0) {
+			int n = 0;
+			is >> n;
+			for (int i = 0; i < n && is >> buffer_name; i++)
+				renditions.push_back(buffer_name);
+		}
+		if (strcmp(buffer, "Filtering") == 0) {
+			is >> buffer_name;
+			video_mipmaps = strcmp(buffer_name, "mipmap") == 0;
+		}
+		//ColorFormat bgr|yuv
+		if (strcmp(buffer, "ColorFormat") == 0) {
+			is >> buffer_name;
+			yuv_color = strcmp(buffer_name, "yuv") == 0;
+		}
+		if (strcmp(buffer, "Depth") == 0) {
+			is >> buffer_name;
+			depth16 = strcmp(buffer_name, "16bit") == 0;
+		}
+		//Sphere mesh|compact|procedural|tessellated
+		if (strcmp(buffer, "Sphere") == 0) {
+			is >> buffer_name;
+			sphere_mode = strcmp(buffer_name, "procedural") == 0 ? SphereProcedural : strcmp(buffer_name, "compact") == 0 ? SphereCompact :
+				strcmp(buffer_name, "tessellated") == 0 ? SphereTessellated : SphereMesh;
+		}
+		//Culling off|<near>
+		if (strcmp(buffer, "Culling") == 0) {
+			is >> buffer_name;
+			culling = strcmp(buffer_name, "off") != 0;
+			if (culling)
+				cull_near = float(atof(buffer_name));
+		}
+		//AlphaCulling on|off
+		if (strcmp(buffer, "AlphaCulling") == 0) {
+			is >> buffer_name;
+			alpha_culling = strcmp(buffer_name, "off") != 0;
+		}
+		//PartialUploads on|off
+		if (strcmp(buffer, "PartialUploads") == 0) {
+			is >> buffer_name;
+			partial_uploads = strcmp(buffer_name, "off") != 0;
+		}
+		//LayerGamma <gamma>
+		if (strcmp(buffer, "LayerGamma") == 0)
+			is >> layer_gamma;
+		//LiveWidth <pixels>, of the flow of the live layout
+		if (strcmp(buffer, "LiveWidth") == 0)
+			is >> live_width;
+		//Scrub off|<MB> <GOP frames>
+		if (strcmp(buffer, "Scrub") == 0) {
+			is >> buffer_name;
+			scrub_mb = strcmp(buffer_name, "off") == 0 ? 0 : (std::max)(atoi(buffer_name), 1);
+			if (scrub_mb > 0)
+				is >> scrub_gop;
+			scrub_gop = (std::max)(scrub_gop, 1);
+		}
+		//ClipCache on|off
+		if (strcmp(buffer, "ClipCache") == 0) {
+			is >> buffer_name;
+			clip_cache = strcmp(buffer_name, "off") != 0;
+		}
+		//Handoff gpu|cpu
+		if (strcmp(buffer, "Handoff") == 0) {
+			is >> buffer_name;
+			gpu_handoff = strcmp(buffer_name, "cpu") != 0;
+		}
+		//EarlyZ on|off
+		if (strcmp(buffer, "EarlyZ") == 0) {
+			is >> buffer_name;
+			early_z = strcmp(buffer_name, "off") != 0;
+		}
+		//BakeBackground on|off
+		if (strcmp(buffer, "BakeBackground") == 0) {
+			is >> buffer_name;
+			bake_background = strcmp(buffer_name, "off") != 0;
+		}
+		//Tessellation <pixels> <depth gain>
+		if (strcmp(buffer, "Tessellation") == 0)
+			is >> tess_pixels >> tess_depth_gain;
+		//Mirror off|every <n>|quarter|<hz>, 0 after every frame
+		if (strcmp(buffer, "Mirror") == 0) {
+			is >> buffer_name;
+			mirror_window = strcmp(buffer_name, "off") != 0;
+			if (strcmp(buffer_name, "every") == 0)
+				is >> mirror_every;
+			else if (strcmp(buffer_name, "quarter") == 0)
+				mirror_quarter = true;
+			else if (mirror_window)
+				mirror_hz = float(atof(buffer_name));
+		}
+		//DepthLayer on|off
+		if (strcmp(buffer, "DepthLayer") == 0) {
+			is >> buffer_name;
+			depth_layer = strcmp(buffer_name, "on") == 0;
+		}
+		//Stereo multiview|twopass
+		if (strcmp(buffer, "Stereo") == 0) {
+			is >> buffer_name;
+			multiview_stereo = strcmp(buffer_name, "multiview") == 0;
+		}
+		//DynamicResolution <min> <max>, in pixels per display pixel
+		if (strcmp(buffer, "DynamicResolution") == 0) {
+			dynamic_resolution = true;
+			is >> resolution_min >> resolution_max;
+		}
+		//QualityGovernor on|off
+		if (strcmp(buffer, "QualityGovernor") == 0) {
+			is >> buffer_name;
+			quality_governor = strcmp(buffer_name, "on") == 0;
+		}
+		//PowerMode off|on|auto
+		if (strcmp(buffer, "PowerMode") == 0) {
+			is >> buffer_name;
+			power_mode = strcmp(buffer_name, "on") == 0 ? 1 : strcmp(buffer_name, "auto") == 0 ? 2 : 0;
+		}
+		//PowerCaps <quality> <mirror hz>, the mirror as set at 0
+		if (strcmp(buffer, "PowerCaps") == 0)
+			is >> power_quality >> power_mirror_hz;
+		//VramBudget <MB>, none at 0
+		if (strcmp(buffer, "VramBudget") == 0)
+			is >> vram_budget;
+		//Profile <file.csv>
+		if (strcmp(buffer, "Profile") == 0) {
+			is >> buffer_name;
+			profile_file = buffer_name;
+		}
+		//RayMarch off|<steps>
+		if (strcmp(buffer, "RayMarch") == 0) {
+			is >> buffer_name;
+			ray_march = strcmp(buffer_name, "off") == 0 ? 0 : atoi(buffer_name);
+		}
+		//MultiSphere off|<layers> <columns>
+		if (strcmp(buffer, "MultiSphere") == 0) {
+			is >> buffer_name;
+			multi_sphere = strcmp(buffer_name, "off") == 0 ? 0 : (std::max)(atoi(buffer_name), 2);
+			if (multi_sphere > 0)
+				is >> msi_columns;
+			msi_columns = (std::max)(msi_columns, 1);
+		}
+		//DecodeBench <seconds per configuration>
+		if (strcmp(buffer, "DecodeBench") == 0) {
+			is >> decode_bench;
+		}
+		//Uploads buffered|direct
+		if (strcmp(buffer, "Uploads") == 0) {
+			is >> buffer_name;
+			pbo_uploads = strcmp(buffer_name, "direct") != 0;
+		}
+		//Headless <trace> <eye width> <eye height>
+		if (strcmp(buffer, "Headless") == 0) {
+			is >> buffer_name >> headless_size.w >> headless_size.h;
+			headless_trace = buffer_name;
+		}
+		//Export <trace> <file.mp4> <fps> <eye width> <eye height>
+		if (strcmp(buffer, "Export") == 0) {
+			is >> buffer_name;
+			export_trace = buffer_name;
+			is >> buffer_name >> export_fps >> export_size.w >> export_size.h;
+			export_file = buffer_name;
+			export_fps = (std::max)(export_fps, 1.0);
+		}
+		//Runtime ovr|openxr
+		if (strcmp(buffer, "Runtime") == 0) {
+			is >> buffer_name;
+			openxr_runtime = strcmp(buffer_name, "openxr") == 0;
+		}
+		//PoseTrace record|replay <file>
+		if (strcmp(buffer, "PoseTrace") == 0) {
+			is >> buffer_name;
+			bool record = strcmp(buffer_name, "record") == 0;
+			is >> buffer_name;
+			(record ? pose_record : pose_replay) = buffer_name;
+		}
+		//HeadlessFrames <prefix> <every>
+		if (strcmp(buffer, "HeadlessFrames") == 0) {
+			is >> buffer_name >> headless_every;
+			headless_frames = buffer_name;
+		}
+		//ColorStereo mono|top-bottom
+		if (strcmp(buffer, "ColorStereo") == 0) {
+			is >> buffer_name;
+			top_bottom = strcmp(buffer_name, "top-bottom") == 0;
+		}
+		//Ambisonic on|off
+		if (strcmp(buffer, "Ambisonic") == 0) {
+			is >> buffer_name;
+			ambisonic = strcmp(buffer_name, "on") == 0;
+		}
+		//DepthFilter off|<step>
+		if (strcmp(buffer, "DepthFilter") == 0) {
+			is >> buffer_name;
+			depth_filter = strcmp(buffer_name, "off") == 0 ? 0.0f : float(atof(buffer_name));
+		}
+		//ShaderCache off|<directory>
+		if (strcmp(buffer, "ShaderCache") == 0) {
+			is >> buffer_name;
+			shader_cache = buffer_name;
+		}
+		//PauseCache off|<field of view scale>
+		if (strcmp(buffer, "PauseCache") == 0) {
+			is >> buffer_name;
+			pause_cache = strcmp(buffer_name, "off") == 0 ? 0.0f : (std::max)(float(atof(buffer_name)), 1.0f);
+		}
+		//ThreadPriorities on|off
+		if (strcmp(buffer, "ThreadPriorities") == 0) {
+			is >> buffer_name;
+			thread_priorities = strcmp(buffer_name, "off") != 0;
+		}
+		//Affinity render|video|decoder|audio|background <hexadecimal mask of the cores>
+		if (strcmp(buffer, "Affinity") == 0) {
+			static const char *roles[ThreadRoles] = { "render", "video", "decoder", "audio", "background" };
+			is >> buffer_name;
+			int role = 0;
+			while (role < ThreadRoles && strcmp(roles[role], buffer_name) != 0)
+				role++;
+			is >> buffer_name;
+			if (role < ThreadRoles)
+				thread_affinity[role] = strtoull(buffer_name, NULL, 16);
+		}
+		//Reproject off|<field of view scale>
+		if (strcmp(buffer, "Reproject") == 0) {
+			is >> buffer_name;
+			reproject = strcmp(buffer_name, "off") == 0 ? 0.0f : (std::max)(float(atof(buffer_name)), 1.0f);
+		}
+		//Foveation <inner> <outer>
+		if (strcmp(buffer, "Foveation") == 0) {
+			foveated = true;
+			is >> fovea_inner >> fovea_outer;
+		}
+		//Telemetry on|off
+		if (strcmp(buffer, "Telemetry") == 0) {
+			is >> buffer_name;
+			telemetry_log = strcmp(buffer_name, "on") == 0;
+		}
+		//StallWatchdog <ms>|off
+		if (strcmp(buffer, "StallWatchdog") == 0) {
+			is >> buffer_name;
+			stall_ms = strcmp(buffer_name, "off") == 0 ? 0 : (std::max)(atoi(buffer_name), 1);
+		}
+		//StallResync on|off
+		if (strcmp(buffer, "StallResync") == 0) {
+			is >> buffer_name;
+			stall_resync = strcmp(buffer_name, "on") == 0;
+		}
+		//Layers composite|passes
+		if (strcmp(buffer, "Layers") == 0) {
+			is >> buffer_name;
+			composite_layers = strcmp(buffer_name, "composite") == 0;
+		}
+		//SphereSize <rings> <slices>
+		if (strcmp(buffer, "SphereSize") == 0)
+			is >> sphere_rings >> sphere_slices;
+		//LayerLOD off|<degrees>
+		if (strcmp(buffer, "LayerLOD") == 0) {
+			is >> buffer_name;
+			layer_lod = strcmp(buffer_name, "off") == 0 ? 0.0f : float(atof(buffer_name));
+		}
+		//MSAA off|<samples>
+		if (strcmp(buffer, "MSAA") == 0) {
+			is >> buffer_name;
+			eye_samples = strcmp(buffer_name, "off") == 0 ? 1 : (std::max)(atoi(buffer_name), 1);
+		}
+		//LayerMesh background|foreground|video <rings> <slices>, 0 0 for the sphere's
+		if (strcmp(buffer, "LayerMesh") == 0) {
+			is >> buffer_name;
+			int pass = strcmp(buffer_name, "background") == 0 ? 0 : strcmp(buffer_name, "foreground") == 0 ? 1 : 2;
+			is >> layer_mesh[pass].x >> layer_mesh[pass].y;
+		}
+		//StatsOverlay on|off
+		if (strcmp(buffer, "StatsOverlay") == 0) {
+			is >> buffer_name;
+			stats_overlay = strcmp(buffer_name, "on") == 0;
+		}
+		//Gallery off|<width>, a multiple of 4
+		if (strcmp(buffer, "Gallery") == 0) {
+			is >> buffer_name;
+			gallery_width = strcmp(buffer_name, "off") == 0 ? 0 : (std::max)(atoi(buffer_name) / 4 * 4, 0);
+		}
+		if (strcmp(buffer, "GalleryFPS") == 0) {
+			is >> buffer_name;
+			gallery_fps = float(atof(buffer_name));
+		}
+		if (strcmp(buffer, "ClipLoops") == 0) {
+			is >> buffer_name;
+			clip_loops = atoi(buffer_name);
+		}
 		if (strcmp(buffer, "VideoName") == 0) {
 			is >> buffer_name;
-			sprintf(g1_filename, "%s.mp4", buffer_name);
-			sprintf(d1_filename, "%s_depth.mp4", buffer_name);
-			sprintf(bg1_filename, "%s_BG.png", buffer_name);
-			sprintf(bgd1_filename, "%s_BGD.png", buffer_name);
-			sprintf(bbg1_filename, "%s_BG_inp.png", buffer_name);
-			sprintf(bbgd1_filename, "%s_BGD_inp.png", buffer_name);
-			sprintf(a1_filename, "%s_alphaproc.mp4", buffer_name);
-			sprintf(bga1_filename, "%s_BGA.png", buffer_name);
-			sprintf(buffer, "%s%s_audio.mp3", video_path, buffer_name);
-			audiofile = buffer;
-			sprintf(data_filename, "%s%s-%s-%s-%s-%s.txt", data_path, userID, testID, mode, visID, buffer_name);
+			//the data of the session are named after the first clip
+			if (clipNames.empty())
+				snprintf(data_filename, sizeof(data_filename), "%s%s-%s-%s-%s-%s.txt", data_path, userID, testID, mode, visID, buffer_name);
+			clipNames.push_back(buffer_name);
 		}
 	}
 
+	liveSettings.Load();
+	SetThreadRole(RoleRender);
+
+	if (tile_cols < 1 || tile_rows < 1 || tile_cols * tile_rows > FrameRing::maxStreams)
+	{
+		std::cout << "a grid of " << tile_cols << " x " << tile_rows << " tiles is not supported, playing the packed videos\n";
+		tile_cols = tile_rows = 1;
+	}
+
+	//the vertex IDs of the procedural sphere are GLsizei, the indices of the mesh 32-bit
+	if (sphere_rings < 2 || sphere_slices < 2 || (double)(sphere_rings - 1) * (sphere_slices - 1) * 6 > 2147483647.0)
+	{
+		std::cout << "a sphere of " << sphere_rings << " x " << sphere_slices << " is not supported, drawing 2048 x 1024\n";
+		sphere_rings = 2048;
+		sphere_slices = 1024;
+	}
+
 	//By default start with the first one
-	sprintf(g_filename, "%s%s", video_path, g1_filename);
-	sprintf(d_filename, "%s%s", video_path, d1_filename);
-	sprintf(bg_filename, "%s%s", video_path, bg1_filename);
-	sprintf(bgd_filename, "%s%s", video_path, bgd1_filename);
-	sprintf(bbg_filename, "%s%s", video_path, bbg1_filename);
-	sprintf(bbgd_filename, "%s%s", video_path, bbgd1_filename);
-	sprintf(bga_filename, "%s%s", video_path, bga1_filename);
-	sprintf(a_filename, "%s%s", video_path, a1_filename);
+	if (clipNames.empty())
+	{
+		std::cout << "no VideoName in settings.txt!\n";
+		clipNames.push_back("");
+	}
+	for (size_t i = 0; i < clipNames.size(); i++)
+		playlist.push_back(MakeClipFiles(clipNames[i].c_str()));
+	audiofile = playlist[0].audio;
 
 	//Head position stream
 	//headpose.open(data_filename);
+	//The telemetry of the frames, data_filename with .telemetry for .txt
+	if (telemetry_log)
+	{
+		std::string telemetryName = data_filename[0] ? data_filename : "session.txt";
+		size_t dot = telemetryName.find_last_of('.');
+		telemetry.Open(telemetryName.substr(0, dot) + ".telemetry");
+	}
+	if (stall_ms > 0)
+		stallWatchdog.Start();
+
+	if (!pose_replay.empty() && !poseReplay.Read(pose_replay))
+		pose_replay.clear();
+
+	//the export of a preview, with neither LibOVR nor a Rift
+	if (!export_file.empty())
+	{
+		VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL) export"), "Failed to open window.");
+		Platform.Run(ExportLoop);
+		stallWatchdog.Stop();
+		telemetry.Close();
+		return(0);
+	}
+
+	//the benchmark of the video path, with neither LibOVR nor a Rift
+	if (decode_bench > 0)
+	{
+		VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL) decode benchmark"), "Failed to open window.");
+		Platform.Run(DecodeBenchLoop);
+		stallWatchdog.Stop();
+		telemetry.Close();
+		return(0);
+	}
+
+	//the headless benchmark, with neither LibOVR nor a Rift
+	if (!headless_trace.empty())
+	{
+		VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL) headless"), "Failed to open window.");
+		Platform.Run(HeadlessLoop);
+		stallWatchdog.Stop();
+		telemetry.Close();
+		return(0);
+	}
+
+#ifdef VIEWER_OPENXR
+	//the HMD of the OpenXR runtime, with no LibOVR session
+	if (openxr_runtime)
+	{
+		VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL) OpenXR"), "Failed to open window.");
+		Platform.Run(OpenXRLoop);
+		stallWatchdog.Stop();
+		telemetry.Close();
+		return(0);
+	}
+#else
+	if (openxr_runtime)
+		std::cout << "built without VIEWER_OPENXR, running on LibOVR\n";
+#endif
 
 	// Initializes LibOVR, and the Rift
 	ovrInitParams initParams = { ovrInit_RequestVersion, OVR_MINOR_VERSION, NULL, 0, 0 };
@@ -1226,6 +7621,10 @@ int WINAPI WinMain(HINSTANCE hinst, HINSTANCE, LPSTR lpCmdLine, int)
 	VALIDATE(Platform.InitWindow(hinst, L"Oculus Room Tiny (GL)"), "Failed to open window.");
 
 	Platform.Run(MainLoop);
+	stallWatchdog.Stop();
+	telemetry.Close();
+	if (!pose_record.empty())
+		poseRecorder.Write(pose_record);
 
 	ovr_Shutdown();
 